@@ -8,95 +8,159 @@
 
 #import <Cocoa/Cocoa.h>
 #import <AppKit/AppKit.h>
+#import <ImageIO/ImageIO.h>
+#import <dispatch/dispatch.h>
+#import <pthread.h>
 
 // Copy the given row to the new location
-void CopyRow(NSBitmapImageRep *imageRep,int srcRow,int destRow)
+void CopyRow(unsigned char *data,int rowSize,int srcRow,int destRow)
 {
-    unsigned char *data = [imageRep bitmapData];
-    NSInteger rowSize = [imageRep bytesPerRow];
     bcopy(&data[rowSize*srcRow], &data[rowSize*destRow], rowSize);
 }
 
 // Copy the given column to the new column
-void CopyColumn(NSBitmapImageRep *imageRep,int srcCol,int destCol)
+void CopyColumn(unsigned char *data,int rowSize,int pixSize,int numRows,int srcCol,int destCol)
 {
-    unsigned char *data = [imageRep bitmapData];
-    NSInteger rowLen = [imageRep pixelsWide];
-    NSInteger pixSize = [imageRep bitsPerPixel]/8;
-    for (unsigned int ii=0;ii<[imageRep pixelsHigh];ii++)
-        bcopy(&data[(rowLen*ii+srcCol)*pixSize],&data[(rowLen*ii+destCol)*pixSize], pixSize);
+    for (unsigned int ii=0;ii<numRows;ii++)
+        bcopy(&data[rowSize*ii+srcCol*pixSize],&data[rowSize*ii+destCol*pixSize], pixSize);
+}
+
+// Content hash for a tile's pixels (FNV-1a).  Incremental mode uses it
+//  to skip tiles that haven't changed since the last run.
+static unsigned long long HashBytes(const unsigned char *data,size_t len)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t ii=0;ii<len;ii++)
+    {
+        hash ^= data[ii];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
 }
 
 typedef enum {OutFormatTiff,OutFormatJPEG,OutFormatPNG} OutFormatType;
 
-// Build a single level of the image grid
-bool BuildLevel(int outX,int outY,const char *levelId,NSImage *img,int outSize,int borderSize,const char *outDir,const char *outName,OutFormatType outFormatType,const char *texTool)
+// Build a single level of the image grid.
+// Tiles are fanned out across the cores, with each worker reusing one
+//  bitmap context, and the pixels go straight through ImageIO rather
+//  than bouncing through NSImage per tile.
+bool BuildLevel(int outX,int outY,const char *levelId,CGImageRef img,int outSize,int borderSize,const char *outDir,const char *outName,OutFormatType outFormatType,const char *texTool,bool incremental,NSDictionary *oldHashes,NSMutableDictionary *newHashes)
 {
-    // Work through the chunks
-    for (unsigned int ix=0;ix<outX;ix++)
-    {
-        float sx;
-        sx = ix * img.size.width / outX;
-        for (unsigned int iy=0;iy<outY;iy++)
+    int totalTiles = outX*outY;
+    int numWorkers = (int)[[NSProcessInfo processInfo] activeProcessorCount];
+    if (numWorkers > totalTiles)
+        numWorkers = totalTiles;
+    if (numWorkers < 1)
+        numWorkers = 1;
+
+    double srcWidth = CGImageGetWidth(img);
+    double srcHeight = CGImageGetHeight(img);
+
+    __block bool hadError = false;
+    static pthread_mutex_t hashLock = PTHREAD_MUTEX_INITIALIZER;
+
+    dispatch_apply(numWorkers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   ^(size_t workerId) {
+        // One reusable context per worker
+        CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+        CGContextRef ctx = CGBitmapContextCreate(NULL, outSize, outSize, 8, 4*outSize, colorSpace, kCGImageAlphaNoneSkipLast);
+        CGContextSetInterpolationQuality(ctx, kCGInterpolationHigh);
+
+        for (int tile=(int)workerId;tile<totalTiles;tile+=numWorkers)
         {
-            float sy;
-            sy = (outY-iy-1) * img.size.height / outY;
-            
-            NSBitmapImageRep *imageRep = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL pixelsWide:outSize pixelsHigh:outSize bitsPerSample:8 samplesPerPixel:3 hasAlpha:NO isPlanar:NO colorSpaceName:NSDeviceRGBColorSpace bytesPerRow:4*outSize bitsPerPixel:32] autorelease];
-            
-            // Create an NSGraphicsContext that draws into the NSBitmapImageRep, and make it current.
-            NSGraphicsContext *nsContext = [NSGraphicsContext graphicsContextWithBitmapImageRep:imageRep];
-            [NSGraphicsContext saveGraphicsState];
-            [NSGraphicsContext setCurrentContext:nsContext];
-            
-            // Clear
-            [[NSColor clearColor] set];
-            NSRectFill(NSMakeRect(0, 0, [imageRep pixelsWide], [imageRep pixelsHigh]));
-            
-            // Draw the image, but shrunk down by the border size
-            [img drawInRect:NSMakeRect(borderSize,borderSize,outSize-2*borderSize,outSize-2*borderSize) 
-                   fromRect:NSMakeRect(sx, sy, img.size.width / outX, img.size.height / outY) 
-                  operation:NSCompositeCopy fraction:1.0];
-            
+            NSAutoreleasePool *tilePool = [[NSAutoreleasePool alloc] init];
+
+            int ix = tile / outY;
+            int iy = tile % outY;
+
+            // Crop the source directly.  CGImage rects are top-left
+            //  origin, so this is the same chunk the old bottom-left
+            //  NSImage math picked out.
+            CGRect srcRect = CGRectMake(ix * srcWidth / outX, iy * srcHeight / outY, srcWidth / outX, srcHeight / outY);
+            CGImageRef tileImg = CGImageCreateWithImageInRect(img, srcRect);
+
+            // Clear, then draw the image shrunk down by the border size
+            CGContextClearRect(ctx, CGRectMake(0, 0, outSize, outSize));
+            CGContextDrawImage(ctx, CGRectMake(borderSize, borderSize, outSize-2*borderSize, outSize-2*borderSize), tileImg);
+            CGImageRelease(tileImg);
+
+            unsigned char *data = (unsigned char *)CGBitmapContextGetData(ctx);
+            int rowSize = (int)CGBitmapContextGetBytesPerRow(ctx);
+            int pixSize = 4;
+
             // Copy the top border upward
             for (unsigned int ib=0;ib<borderSize;ib++)
-                CopyRow(imageRep,borderSize,ib);
+                CopyRow(data,rowSize,borderSize,ib);
             // And the bottom row downward
             for (unsigned int ib=outSize-borderSize;ib<outSize;ib++)
-                CopyRow(imageRep,outSize-borderSize-1,ib);
+                CopyRow(data,rowSize,outSize-borderSize-1,ib);
             // Left border leftward
             for (unsigned int ib=0;ib<borderSize;ib++)
-                CopyColumn(imageRep,borderSize,ib);
+                CopyColumn(data,rowSize,pixSize,outSize,borderSize,ib);
             // Right border rightward
             for (unsigned int ib=outSize-borderSize;ib<outSize;ib++)
-                CopyColumn(imageRep,outSize-borderSize-1,ib);
-            
-            // And save it out
+                CopyColumn(data,rowSize,pixSize,outSize,outSize-borderSize-1,ib);
+
             char imgName[1024];
             if (levelId)
                 sprintf(imgName,"%s_%sx%dx%d",outName,levelId,ix,(outY-iy-1));
             else
                 sprintf(imgName,"%s_%dx%d",outName,ix,(outY-iy-1));
-            NSData *resultData = nil;
+
             NSString *ext = nil;
+            CFStringRef utType = NULL;
             switch (outFormatType)
             {
                 case OutFormatTiff:
                     ext = @"tiff";
-                    resultData = [imageRep TIFFRepresentation];
+                    utType = kUTTypeTIFF;
                     break;
                 case OutFormatJPEG:
                     ext = @"jpg";
-                    resultData = [imageRep representationUsingType:NSJPEGFileType properties:nil];
+                    utType = kUTTypeJPEG;
                     break;
                 case OutFormatPNG:
                     ext = @"png";
-                    resultData = [imageRep representationUsingType:NSPNGFileType properties:nil];
+                    utType = kUTTypePNG;
                     break;
             }
             NSString *fullName = [NSString stringWithFormat:@"%s/%s.%@",outDir,imgName,ext];
-            [resultData writeToFile:fullName atomically:NO];
-            
+
+            // In incremental mode an unchanged tile that's still on disk
+            //  doesn't need to be encoded (or pushed through the texture
+            //  tool) again
+            NSString *hashKey = [NSString stringWithFormat:@"%s",imgName];
+            NSString *hashVal = [NSString stringWithFormat:@"%llu",HashBytes(data,(size_t)rowSize*outSize)];
+            pthread_mutex_lock(&hashLock);
+            [newHashes setObject:hashVal forKey:hashKey];
+            bool skipTile = incremental && [hashVal isEqualToString:[oldHashes objectForKey:hashKey]] &&
+                [[NSFileManager defaultManager] fileExistsAtPath:fullName];
+            pthread_mutex_unlock(&hashLock);
+            if (skipTile)
+            {
+                [tilePool drain];
+                continue;
+            }
+
+            // And save it out
+            CGImageRef outImg = CGBitmapContextCreateImage(ctx);
+            CGImageDestinationRef dest = CGImageDestinationCreateWithURL((CFURLRef)[NSURL fileURLWithPath:fullName], utType, 1, NULL);
+            bool wroteOK = false;
+            if (dest)
+            {
+                CGImageDestinationAddImage(dest, outImg, NULL);
+                wroteOK = CGImageDestinationFinalize(dest);
+                CFRelease(dest);
+            }
+            CGImageRelease(outImg);
+            if (!wroteOK)
+            {
+                fprintf(stderr,"Failed to write image: %s\n",[fullName UTF8String]);
+                hadError = true;
+                [tilePool drain];
+                continue;
+            }
+
             // If they gave us a path to the texture tool, invoke that
             if (texTool)
             {
@@ -106,15 +170,18 @@ bool BuildLevel(int outX,int outY,const char *levelId,NSImage *img,int outSize,i
                 if (system(cmd))
                 {
                     fprintf(stderr,"Failed to convert image to pvrtc with this command:\n%s\n",cmd);
-                    return -1;
+                    hadError = true;
                 }
             }
-            
-            [NSGraphicsContext restoreGraphicsState];
+
+            [tilePool drain];
         }
-    }    
-    
-    return true;
+
+        CGContextRelease(ctx);
+        CGColorSpaceRelease(colorSpace);
+    });
+
+    return !hadError;
 }
 
 int main (int argc, const char * argv[])
@@ -124,10 +191,10 @@ int main (int argc, const char * argv[])
 
     if (argc < 4)
     {
-        fprintf(stderr,"syntax: %s <in.img> <outName> <outDir> [-singleres <outX> <outY>] [-multires <maxzoom>] [-outSize <outSize>] [-borderSize <borderSize>] [-texTool <textool path>] [-outformat tiff/jpeg/png]\n",argv[0]);
+        fprintf(stderr,"syntax: %s <in.img> <outName> <outDir> [-singleres <outX> <outY>] [-multires <maxzoom>] [-outSize <outSize>] [-borderSize <borderSize>] [-texTool <textool path>] [-outformat tiff/jpeg/png] [-incremental]\n",argv[0]);
         return -1;
     }
-    
+
     const char *inImage = argv[1];
     const char *outName = argv[2];
     const char *outDir = argv[3];
@@ -138,7 +205,8 @@ int main (int argc, const char * argv[])
     int singleOutX = -1,singleOutY = -1;
     int maxZoom = -1;
     OutFormatType outFormatType = OutFormatTiff;
-    
+    bool incremental = false;
+
     // Work through the arguments
     int ai = 1;
     for (unsigned int ii=4;ii<argc;ii+=ai)
@@ -151,7 +219,7 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing argument for -outSize\n");
                 return -1;
             }
-            
+
             outSize = atoi(argv[ii+1]);
             continue;
         }
@@ -164,11 +232,11 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing argument for -borderSize\n");
                 return -1;
             }
-            
+
             borderSize = atoi(argv[ii+1]);
             continue;
         }
-        
+
         if (!strcmp(argv[ii],"-texTool"))
         {
             ai = 2;
@@ -177,11 +245,11 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing argument for -texTool\n");
                 return -1;
             }
-            
+
             texTool = argv[ii+1];
             continue;
-        }        
-        
+        }
+
         if (!strcmp(argv[ii],"-singleres"))
         {
             ai = 3;
@@ -190,12 +258,12 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing arguments for -singleres\n");
                 return -1;
             }
-            
+
             singleOutX = atoi(argv[ii+1]);
             singleOutY = atoi(argv[ii+2]);
             continue;
         }
-        
+
         if (!strcmp(argv[ii],"-multires"))
         {
             ai = 2;
@@ -204,11 +272,11 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing argument for -multires\n");
                 return -1;
             }
-            
+
             maxZoom = atoi(argv[ii+1]);
             continue;
         }
-        
+
         if (!strcmp(argv[ii],"-outformat"))
         {
             ai = 2;
@@ -217,20 +285,27 @@ int main (int argc, const char * argv[])
                 fprintf(stderr,"Missing argument for -outformat");
                 return -1;
             }
-            
+
             if (!strcmp(argv[ii+1],"jpg") || !strcmp(argv[ii+1],"jpeg"))
                 outFormatType = OutFormatJPEG;
             else
                 if (!strcmp(argv[ii+1],"png"))
                     outFormatType = OutFormatPNG;
-            
+
             continue;
         }
-        
+
+        if (!strcmp(argv[ii],"-incremental"))
+        {
+            ai = 1;
+            incremental = true;
+            continue;
+        }
+
         fprintf(stderr,"Unrecognized argument: %s\n",argv[ii]);
         return -1;
     }
-    
+
     if (singleOutX == -1 && maxZoom == -1)
     {
         fprintf(stderr,"Must specify -singleres or -multires\n");
@@ -250,7 +325,7 @@ int main (int argc, const char * argv[])
             return -1;
         }
     }
-    
+
     NSError *error = nil;
     [[NSFileManager defaultManager] createDirectoryAtPath:[NSString stringWithFormat:@"%s",outDir] withIntermediateDirectories:YES attributes:nil error:&error];
     if (error)
@@ -258,24 +333,35 @@ int main (int argc, const char * argv[])
         fprintf(stderr,"Failed to create output directory.\n");
         return -1;
     }
-    
-    NSImage *img = [[[NSImage alloc] initByReferencingFile:[NSString stringWithFormat:@"%s",inImage]] autorelease];
+
+    // Load the source once as a CGImage.  It's immutable, so the tile
+    //  workers can crop out of it from any thread.
+    CGImageSourceRef imgSrc = CGImageSourceCreateWithURL((CFURLRef)[NSURL fileURLWithPath:[NSString stringWithFormat:@"%s",inImage]], NULL);
+    CGImageRef img = imgSrc ? CGImageSourceCreateImageAtIndex(imgSrc, 0, NULL) : NULL;
+    if (imgSrc)
+        CFRelease(imgSrc);
     if (!img)
     {
         fprintf(stderr,"Failed to open input image.\n");
         return -1;
     }
-    
+
+    // Tile hashes from the last run, if we're skipping unchanged tiles
+    NSString *hashPath = [NSString stringWithFormat:@"%s/%s_hashes.plist",outDir,outName];
+    NSDictionary *oldHashes = incremental ? [NSDictionary dictionaryWithContentsOfFile:hashPath] : nil;
+    NSMutableDictionary *newHashes = [NSMutableDictionary dictionary];
+
     // Create a little header for these images
     NSMutableDictionary *dict = [NSMutableDictionary dictionary];
     [dict setValue:(texTool ? @"pvrtc" : @"tiff") forKey:@"format"];
     [dict setValue:[NSString stringWithFormat:@"%s",outName] forKey:@"baseName"];
 
     // Build the images
+    bool buildOK = true;
     if (singleOutX > 0)
     {
         // Single level is easy enough
-        BuildLevel(singleOutX, singleOutY, NULL, img, outSize, borderSize, outDir, outName, outFormatType, texTool);
+        buildOK = BuildLevel(singleOutX, singleOutY, NULL, img, outSize, borderSize, outDir, outName, outFormatType, texTool, incremental, oldHashes, newHashes);
 
         [dict setValue:[NSNumber numberWithInteger:singleOutX] forKey:@"tilesInX"];
         [dict setValue:[NSNumber numberWithInteger:singleOutY] forKey:@"tilesInY"];
@@ -284,17 +370,20 @@ int main (int argc, const char * argv[])
         {
             char levelStr[10];
             sprintf(levelStr, "%d",level);
-            BuildLevel(1<<level, 1<<level, levelStr, img, outSize, borderSize, outDir, outName, outFormatType, texTool);            
+            if (!BuildLevel(1<<level, 1<<level, levelStr, img, outSize, borderSize, outDir, outName, outFormatType, texTool, incremental, oldHashes, newHashes))
+                buildOK = false;
         }
         [dict setValue:[NSNumber numberWithInteger:maxZoom] forKey:@"maxLevel"];
     }
-    
+    CGImageRelease(img);
+
     [dict setValue:[NSNumber numberWithInteger:outSize] forKey:@"pixelsSquare"];
     [dict setValue:[NSNumber numberWithInteger:borderSize] forKey:@"borderSize"];
     [dict writeToFile:[NSString stringWithFormat:@"%s/%s_info.plist",outDir,outName] atomically:NO];
-    
+
+    // Remember the tile hashes for the next incremental run
+    [newHashes writeToFile:hashPath atomically:NO];
 
     [pool drain];
-    return 0;
+    return buildOK ? 0 : -1;
 }
-
@@ -0,0 +1,40 @@
+/*
+ *  BenchAppDelegate.m
+ *  MaplyBench
+ *
+ *  Created by Steve Gifford on 5/12/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "BenchAppDelegate.h"
+#import "BenchRunnerViewController.h"
+
+@implementation BenchAppDelegate
+
+@synthesize window = _window;
+
+- (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions
+{
+    self.window = [[UIWindow alloc] initWithFrame:[[UIScreen mainScreen] bounds]];
+    self.window.backgroundColor = [UIColor blackColor];
+
+    BenchRunnerViewController *runnerViewC = [[BenchRunnerViewController alloc] init];
+    self.window.rootViewController = runnerViewC;
+
+    [self.window makeKeyAndVisible];
+    return YES;
+}
+
+@end
@@ -0,0 +1,31 @@
+/*
+ *  BenchRunnerViewController.h
+ *  MaplyBench
+ *
+ *  Created by Steve Gifford on 5/12/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <UIKit/UIKit.h>
+
+/** The benchmark runner works through a fixed list of scripted scenarios
+    against a flat map, bracketing each one with the performance capture
+    calls on the view controller.  When the list is done it prints the
+    per-scenario reports as JSON between MAPLYBENCH-BEGIN/END markers
+    (so CI can scrape them out of the log) and exits.
+ */
+@interface BenchRunnerViewController : UIViewController
+
+@end
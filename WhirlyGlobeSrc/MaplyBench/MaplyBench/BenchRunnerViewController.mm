@@ -0,0 +1,275 @@
+/*
+ *  BenchRunnerViewController.mm
+ *  MaplyBench
+ *
+ *  Created by Steve Gifford on 5/12/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "BenchRunnerViewController.h"
+#import "WhirlyGlobeComponent.h"
+
+// How many markers the marker scenario throws at the toolkit
+static const int NumBenchMarkers = 50000;
+// How many labels the layout scenario throws at the toolkit
+static const int NumBenchLabels = 10000;
+// Polygons in the tessellation scenario
+static const int NumBenchPolys = 400;
+
+// One scripted scenario: a name, how long to run it, and blocks to
+//  start and stop the work
+@interface BenchScenario : NSObject
+
+@property (nonatomic,strong) NSString *name;
+@property (nonatomic,assign) NSTimeInterval duration;
+@property (nonatomic,copy) void (^setup)(void);
+@property (nonatomic,copy) void (^teardown)(void);
+
+@end
+
+@implementation BenchScenario
+@end
+
+@implementation BenchRunnerViewController
+{
+    MaplyViewController *mapViewC;
+    NSArray *scenarios;
+    int scenarioAt;
+    NSMutableArray *results;
+
+    // State the scenarios hang on to between setup and teardown
+    MaplyQuadImageTilesLayer *churnLayer;
+    NSTimer *churnTimer;
+    bool churnZoomedIn;
+    NSMutableArray *compObjs;
+}
+
+- (void)viewDidLoad
+{
+    [super viewDidLoad];
+
+    // Flat map, since the scenarios are about load rather than projection
+    mapViewC = [[MaplyViewController alloc] initAsFlatMap];
+    [self.view addSubview:mapViewC.view];
+    mapViewC.view.frame = self.view.bounds;
+    [self addChildViewController:mapViewC];
+    [mapViewC setPosition:MaplyCoordinateMakeWithDegrees(-122.4192, 37.7793) height:0.5];
+
+    results = [NSMutableArray array];
+    compObjs = [NSMutableArray array];
+    [self buildScenarios];
+
+    // Give the toolkit a moment to settle before we start measuring
+    scenarioAt = -1;
+    [self performSelector:@selector(nextScenario) withObject:nil afterDelay:2.0];
+}
+
+- (void)buildScenarios
+{
+    BenchRunnerViewController * __weak weakSelf = self;
+
+    // Tile churn: an animated test tile source under a camera that keeps
+    //  diving in and out, so tiles load and unload constantly
+    BenchScenario *tileChurn = [[BenchScenario alloc] init];
+    tileChurn.name = @"tileChurn";
+    tileChurn.duration = 20.0;
+    tileChurn.setup = ^{ [weakSelf startTileChurn]; };
+    tileChurn.teardown = ^{ [weakSelf stopTileChurn]; };
+
+    // Markers: add a pile of screen markers in batches, then tear them down
+    BenchScenario *markers = [[BenchScenario alloc] init];
+    markers.name = @"markers";
+    markers.duration = 15.0;
+    markers.setup = ^{ [weakSelf addBenchMarkers]; };
+    markers.teardown = ^{ [weakSelf removeCompObjs]; };
+
+    // Vectors: random polygons, which stress the tessellator
+    BenchScenario *vectors = [[BenchScenario alloc] init];
+    vectors.name = @"vectors";
+    vectors.duration = 15.0;
+    vectors.setup = ^{ [weakSelf addBenchVectors]; };
+    vectors.teardown = ^{ [weakSelf removeCompObjs]; };
+
+    // Labels: enough screen labels to keep the layout engine busy
+    BenchScenario *labels = [[BenchScenario alloc] init];
+    labels.name = @"labels";
+    labels.duration = 15.0;
+    labels.setup = ^{ [weakSelf addBenchLabels]; };
+    labels.teardown = ^{ [weakSelf removeCompObjs]; };
+
+    scenarios = @[tileChurn,markers,vectors,labels];
+}
+
+// Kick off the next scenario, or wrap up if we're done
+- (void)nextScenario
+{
+    // Collect the report for the scenario that just ran
+    if (scenarioAt >= 0)
+    {
+        BenchScenario *scenario = scenarios[scenarioAt];
+        NSString *report = [mapViewC stopPerformanceCapture];
+        scenario.teardown();
+        [results addObject:[NSString stringWithFormat:@"{\"name\":\"%@\",\"report\":%@}",scenario.name,report]];
+    }
+
+    scenarioAt++;
+    if (scenarioAt >= [scenarios count])
+    {
+        [self finishUp];
+        return;
+    }
+
+    BenchScenario *scenario = scenarios[scenarioAt];
+    NSLog(@"MaplyBench: running %@ for %.0fs",scenario.name,scenario.duration);
+    [mapViewC startPerformanceCapture];
+    scenario.setup();
+    [self performSelector:@selector(nextScenario) withObject:nil afterDelay:scenario.duration];
+}
+
+// Print the per-scenario reports where CI can scrape them and get out
+- (void)finishUp
+{
+    NSString *json = [NSString stringWithFormat:@"{\"scenarios\":[%@]}",[results componentsJoinedByString:@","]];
+    fprintf(stdout,"MAPLYBENCH-BEGIN\n%s\nMAPLYBENCH-END\n",[json UTF8String]);
+    fflush(stdout);
+    exit(0);
+}
+
+#pragma mark - Tile churn
+
+- (void)startTileChurn
+{
+    MaplyAnimationTestTileSource *tileSource = [[MaplyAnimationTestTileSource alloc] initWithCoordSys:[[MaplySphericalMercator alloc] initWebStandard] minZoom:0 maxZoom:17 depth:1];
+    tileSource.pixelsPerSide = 128;
+    churnLayer = [[MaplyQuadImageTilesLayer alloc] initWithCoordSystem:tileSource.coordSys tileSource:tileSource];
+    churnLayer.maxTiles = 512;
+    churnLayer.drawPriority = 0;
+    [mapViewC addLayer:churnLayer];
+
+    churnZoomedIn = false;
+    churnTimer = [NSTimer scheduledTimerWithTimeInterval:3.0 target:self selector:@selector(churnCamera) userInfo:nil repeats:YES];
+    [self churnCamera];
+}
+
+// Dive in and out so the pager keeps loading and unloading tiles
+- (void)churnCamera
+{
+    churnZoomedIn = !churnZoomedIn;
+    [mapViewC setPosition:MaplyCoordinateMakeWithDegrees(-122.4192, 37.7793) height:(churnZoomedIn ? 0.0005 : 0.5)];
+}
+
+- (void)stopTileChurn
+{
+    [churnTimer invalidate];
+    churnTimer = nil;
+    [mapViewC removeLayer:churnLayer];
+    churnLayer = nil;
+}
+
+#pragma mark - Markers, vectors, labels
+
+// A repeatable spread of locations, so runs compare like for like
+static MaplyCoordinate BenchCoord(int ii,int total)
+{
+    float lon = -180.0 + 360.0 * ((ii * 7919) % total) / (float)total;
+    float lat = -75.0 + 150.0 * ((ii * 104729) % total) / (float)total;
+    return MaplyCoordinateMakeWithDegrees(lon, lat);
+}
+
+- (void)addBenchMarkers
+{
+    UIImage *image = [self benchMarkerImage];
+
+    // Add them in batches, the way a real data layer would
+    int batchSize = 5000;
+    for (int start=0;start<NumBenchMarkers;start+=batchSize)
+    {
+        NSMutableArray *markers = [NSMutableArray array];
+        for (int ii=start;ii<start+batchSize && ii<NumBenchMarkers;ii++)
+        {
+            MaplyScreenMarker *marker = [[MaplyScreenMarker alloc] init];
+            marker.loc = BenchCoord(ii,NumBenchMarkers);
+            marker.size = CGSizeMake(16,16);
+            marker.image = image;
+            [markers addObject:marker];
+        }
+        MaplyComponentObject *compObj = [mapViewC addScreenMarkers:markers desc:nil mode:MaplyThreadAny];
+        if (compObj)
+            [compObjs addObject:compObj];
+    }
+}
+
+- (void)addBenchVectors
+{
+    NSMutableArray *vecs = [NSMutableArray array];
+    const int numPts = 24;
+    MaplyCoordinate coords[numPts];
+    for (int ii=0;ii<NumBenchPolys;ii++)
+    {
+        MaplyCoordinate center = BenchCoord(ii,NumBenchPolys);
+        float radius = 0.5 + 4.5 * ((ii * 31) % 100) / 100.0;
+        for (int jj=0;jj<numPts;jj++)
+        {
+            float ang = 2*M_PI*jj/(float)numPts;
+            // Wobble the radius so the tessellator gets concave loops
+            float thisRadius = radius * (0.6 + 0.4*((jj*13)%7)/7.0);
+            coords[jj] = MaplyCoordinateMakeWithDegrees(center.x*180/M_PI + thisRadius*cosf(ang), center.y*180/M_PI + thisRadius*sinf(ang));
+        }
+        MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] initWithAreal:coords numCoords:numPts attributes:nil];
+        [vecs addObject:vecObj];
+    }
+
+    MaplyComponentObject *compObj = [mapViewC addVectors:vecs desc:@{kMaplyFilled: @(YES), kMaplyColor: [UIColor colorWithRed:1.0 green:0.0 blue:0.0 alpha:0.5]} mode:MaplyThreadAny];
+    if (compObj)
+        [compObjs addObject:compObj];
+}
+
+- (void)addBenchLabels
+{
+    NSMutableArray *labels = [NSMutableArray array];
+    for (int ii=0;ii<NumBenchLabels;ii++)
+    {
+        MaplyScreenLabel *label = [[MaplyScreenLabel alloc] init];
+        label.loc = BenchCoord(ii,NumBenchLabels);
+        label.text = [NSString stringWithFormat:@"Bench Label %d",ii];
+        // Mixed importance keeps the layout engine sorting and culling
+        label.layoutImportance = (ii % 100) / 100.0;
+        [labels addObject:label];
+    }
+    MaplyComponentObject *compObj = [mapViewC addScreenLabels:labels desc:nil mode:MaplyThreadAny];
+    if (compObj)
+        [compObjs addObject:compObj];
+}
+
+- (void)removeCompObjs
+{
+    [mapViewC removeObjects:compObjs mode:MaplyThreadAny];
+    [compObjs removeAllObjects];
+}
+
+// Simple dot to put on the markers, so we don't need bundled assets
+- (UIImage *)benchMarkerImage
+{
+    CGSize size = CGSizeMake(16,16);
+    UIGraphicsBeginImageContextWithOptions(size, NO, 0.0);
+    CGContextRef ctx = UIGraphicsGetCurrentContext();
+    CGContextSetFillColorWithColor(ctx, [UIColor orangeColor].CGColor);
+    CGContextFillEllipseInRect(ctx, CGRectMake(1, 1, size.width-2, size.height-2));
+    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    return image;
+}
+
+@end
@@ -38,6 +38,21 @@
 ///  then be on the main thread and use MaplyThreadCurrent.  Any is the default. 
 typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
 
+/** @brief A persistent set of geo coordinates the view controller keeps projected to screen.
+    @details Returned by registerScreenPoints:numPts:.  The screenPts buffer is rewritten in place on the main thread every time the view changes, so overlay code can just read it each frame rather than converting point by point.
+  */
+@interface MaplyScreenPointSet : NSObject
+
+/// @brief Number of points in the set
+@property (nonatomic,readonly) int numPts;
+
+/** @brief Projected screen points, one per registered coordinate.
+    @details Don't modify these and don't hold the pointer past the point set's lifetime.
+  */
+@property (nonatomic,readonly) CGPoint *screenPts;
+
+@end
+
 /** @brief Base class for the Maply and WhirlyGlobe view controllers.
     @details The Maply Base View Controller is where most of the functionality lives.  For the most part Maply and WhirlyGlobe share methods and data structures.  This view controller sets up the rendering, the threading, basically everything that makes WhirlyGlobe-Maply work.
     @details Don't create one of these directly, instead use the MaplyViewController or the WhirlyGlobeViewController.
@@ -82,6 +97,13 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
   */
 @property (nonatomic,assign) bool threadPerLayer;
 
+/** @brief View controller whose scene this one should display.
+    @details Set this right after creation, before the view loads, to make this view controller a second window onto another one's content.  A minimap or overview pane is the usual case.  Both view controllers must be the same concrete class (globe with globe, map with map).
+    @details The two renderers share one scene and one set of GL resources through a sharegroup, so the second view costs an incremental cull and draw pass per frame rather than a duplicate of all the geometry, textures and tile caches.
+    @details A sharing view controller has its own camera, gestures and position methods, but add your layers and objects through the view controller that owns the scene.  Screen object layout follows the owner's viewpoint.  Tear the sharing view controller down before the owner.
+  */
+@property (nonatomic,weak) MaplyBaseViewController *sharedSceneViewC;
+
 /** @brief Clear all the currently active lights.
     @details There are a default set of lights, so you'll want to do this before adding your own.
   */
@@ -131,6 +153,17 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
   */
 - (MaplyComponentObject *)addScreenMarkers:(NSArray *)markers desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode;
 
+/** @brief Update the positions (and optionally colors) of screen markers in place.
+    @details For markers that just move around, such as vehicles updating every second, this is far cheaper than removing the component object and adding a new one.  The markers keep their existing geometry and textures; only their locations (and colors, if given) change.
+    @details There are a couple of limitations.  Selection happens at the old locations until the markers are rebuilt, and markers under layout control (layoutImportance set) keep their old layout placement.
+    @param compObj A MaplyComponentObject returned by addScreenMarkers:desc:mode:.
+    @param positions An array of new geographic coordinates, one per marker, in the same order the markers were added.
+    @param colors If not nil, an NSArray of UIColor, one per marker, applied in the same order.  Pass nil to leave the colors alone.
+    @param numMarkers The number of coordinates in positions.  It's fine to update fewer markers than were added; the rest stay put.
+    @param threadMode MaplyThreadAny is preferred and will use another thread, thus not blocking the one you're on.  MaplyThreadCurrent will make the changes immediately, blocking this thread.
+  */
+- (void)updateScreenMarkers:(MaplyComponentObject *)compObj positions:(MaplyCoordinate *)positions colors:(NSArray *)colors numMarkers:(int)numMarkers mode:(MaplyThreadMode)threadMode;
+
 /// @brief This calls addMarkers:desc:mode: with mode set to MaplyThreadAny
 - (MaplyComponentObject *)addMarkers:(NSArray *)markers desc:(NSDictionary *)desc;
 
@@ -362,6 +395,17 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
   */
 - (MaplyComponentObject *)addBillboards:(NSArray *)billboards desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode;
 
+/** @brief Group several versions of the same geometry by level of detail.
+    @details Hand this method component objects you've already created for the same feature at different resolutions (say, detailed and simplified versions of 3D building footprints) and the toolkit will switch between them based on the viewer's distance from the center.  Only one version is visible at a time and the switching happens in the scene graph traversal, so there's no per frame cost for the versions that are off.
+    @details Only shapes and vectors are supported at the moment.  The level objects remain yours: removing the LOD group stops the distance switching but does not remove the underlying geometry, and removing the level objects themselves works as usual.
+    @param levels An NSArray of MaplyComponentObject, most detailed first.
+    @param center The point we measure viewer distance from.
+    @param switchDists An NSArray of NSNumber, one per level, in display units.  Level i is visible when the viewer is closer than switchDists[i] and farther than switchDists[i+1] (the last level runs down to the surface).
+    @param threadMode For consistency with the other add methods.  The scene graph work always happens on the layer thread.
+    @return Returns a MaplyComponentObject for the group, which can be used to remove it.
+  */
+- (MaplyComponentObject *)addLODGroup:(NSArray *)levels center:(MaplyCoordinate)center switchDists:(NSArray *)switchDists mode:(MaplyThreadMode)threadMode;
+
 /** @brief Add vectors that can be used for selections.
     @details These are MaplyVectorObject's that will show up in user selection, but won't be visible.  So if a user taps on one, you get the vector in your delegate.  Otherwise, no one will know it's there.
     @return Returns a MaplyComponentObject, which can be used to make modifications or delete the objects created.
@@ -443,6 +487,26 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
  */
 - (CGPoint)screenPointFromGeo:(MaplyCoordinate)geoCoord;
 
+/** @brief Convert a batch of geographic coordinates to screen points in one call.
+    @details Same conversion as screenPointFromGeo:, but the view matrices are worked out once for the whole batch rather than once per point.  Use this if you're positioning more than a handful of overlays per frame.
+    @param geoCoords Array of geographic (lon/lat radians) coordinates to convert.
+    @param screenPts Array to fill in with the corresponding screen points.  Must hold numPts entries.
+    @param numPts How many coordinates there are.
+  */
+- (void)screenPointsFromGeo:(MaplyCoordinate *)geoCoords screenPts:(CGPoint *)screenPts numPts:(int)numPts;
+
+/** @brief Register a persistent set of geo coordinates to keep projected to screen.
+    @details The view controller reprojects the whole set as a batch whenever the view changes and leaves the results in the returned object's screenPts buffer.  This is the cheapest way to track a lot of map features with UIKit overlays: read the buffer when you lay the overlays out rather than converting each point yourself.
+    @param geoCoords The geographic (lon/lat radians) coordinates to track.  We copy these, so you can let yours go.
+    @param numPts How many coordinates there are.
+    @return The point set, or nil for an empty input.  Pass it to removeScreenPoints: when you're done.
+  */
+- (MaplyScreenPointSet *)registerScreenPoints:(MaplyCoordinate *)geoCoords numPts:(int)numPts;
+
+/** @brief Stop reprojecting a point set registered with registerScreenPoints:numPts:.
+  */
+- (void)removeScreenPoints:(MaplyScreenPointSet *)pointSet;
+
 /** @brief Animate the given position to the screen position over time.
  @details This is similar to animateToPosition:time: except that it will attempt to match up the screen position and the geographic position.  This is how you offset the location you're looking at.
  @details If it's impossible to move newPos to loc, then nothing happens.
@@ -486,6 +550,15 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
   */
 - (void)removeTexture:(MaplyTexture *)image mode:(MaplyThreadMode)threadMode;
 
+/** @brief Swap a new image into an existing MaplyTexture.
+    @details The OpenGL ES texture keeps its ID and its storage, so every object using it picks the new image up without being rebuilt.  This is the cheap way to animate a MaplySticker:  hand the sticker a MaplyTexture in its images and then call this per frame.
+    @details The new image must be the same size as the one the texture was created with and the compressed image formats can't be updated.  If the update can't be done the texture is left as it was.
+    @param texture The MaplyTexture to update, from addTexture:imageFormat:wrapFlags:mode:.
+    @param image The new image.  Same size as the original.
+    @param threadMode For MaplyThreadAny we'll do the update on another thread.  For MaplyThreadCurrent we'll block the current thread to finish the update.  MaplyThreadAny is preferred.
+  */
+- (void)updateTexture:(MaplyTexture *)texture image:(UIImage *)image mode:(MaplyThreadMode)threadMode;
+
 /** @brief Set the max number of objects for the layout engine to display.
     @details The layout engine works with screen objects, such MaplyScreenLabel and MaplyScreenMaker.  If those have layoutImportance set, this will control the maximum number we can display.
   */
@@ -518,6 +591,21 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
  */
 - (void)enableObjects:(NSArray *)theObjs mode:(MaplyThreadMode)threadMode;
 
+/** @brief Register a set of alternate representations to be switched by view height.
+    @details Build each representation once, typically with different styling or levels of detail for the same features, then hand them all to this call.  As the viewer's height crosses the given thresholds, the toolkit enables the matching representation and disables the rest.  A zoom style transition thus costs a couple of enable flags rather than a full remove and re-add.
+    @details The representations should generally be added disabled (kMaplyEnable to @(NO)); this call immediately enables the one matching the current height.
+    @param compObjs The alternate representations, ordered from the closest view (lowest height) to the farthest.  Each is a MaplyComponentObject from an add call.
+    @param heights The switch thresholds, one fewer than there are representations, in ascending order.  Representation i shows below heights[i], and the last shows above them all.
+    @return An opaque handle to pass to removeRepresentationSet:, or nil if the arrays don't line up.
+  */
+- (id)addRepresentationSet:(NSArray *)compObjs switchHeights:(NSArray *)heights;
+
+/** @brief Stop switching the given representation set by view height.
+    @details The component objects are left in whatever enable state they had; remove or disable them as usual if they should go away.
+    @param repSet The handle returned by addRepresentationSet:switchHeights:.
+  */
+- (void)removeRepresentationSet:(id)repSet;
+
 /** @brief Call this to start journaling changes for this thread.
     @details Your can collect up your add/remove/enable changes on the current thread.  Call startChanges to start collecting and endChanges to flush the changes.
     @details This has no real meaning on the main thread and don't collect too many changes.  They take memory.
@@ -529,6 +617,12 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
   */
 - (void)endChanges;
 
+/** @brief Run the given block after outstanding MaplyThreadAny work finishes.
+    @details The add and remove calls taking MaplyThreadAny return immediately and do their work behind your back.  If you need to know when a batch of them has actually been processed, submit the batch and then call this.  The block runs on the layer thread once everything ahead of it is done, so don't touch UIKit in it directly.
+    @details This never blocks the calling thread, which makes it the way to sequence a big refresh without stalling the main thread.
+  */
+- (void)addCompletion:(void (^)(void))block;
+
 /** @brief Add the given active object to the scene.
     @details Active objects are used for immediate, frame based updates.  They're fairly expensive, so be careful.  After you create one, you add it to the scene here.
   */
@@ -622,4 +716,79 @@ typedef enum {MaplyThreadCurrent,MaplyThreadAny} MaplyThreadMode;
 /// @brief Turn on/off performance output (goes to the log periodically).
 @property (nonatomic,assign) bool performanceOutput;
 
+/** @brief Start capturing performance timings for a measured phase.
+    @details This clears the renderer's performance counters and keeps them accumulating until you call stopPerformanceCapture.  The benchmark harness brackets each of its scenarios with these.
+  */
+- (void)startPerformanceCapture;
+
+/** @brief Stop capturing performance timings and return them as JSON.
+    @details The string holds the per-phase timers and counters from the renderer in a machine readable form, suitable for diffing between releases.  Pair with startPerformanceCapture.
+  */
+- (NSString *)stopPerformanceCapture;
+
+/// @brief Turn per tile pipeline tracing on or off.  Off by default.
+@property (nonatomic,assign) bool tileTracing;
+
+/** @brief Return recent per tile pipeline traces and stage histograms as JSON.
+    @details While tileTracing is on, each stage a tile passes through (queued, fetch, inflate, decode, build, upload) records a timing span.  The string holds the spans for the most recently loaded tiles, the stage each one spent the longest in, and per stage duration histograms.  This is how you find out whether a slow tile lost its time on the network, decoding the image or waiting on the render thread.
+  */
+- (NSString *)tileTraceReport;
+
+/** @brief Start recording the view state stream to the given file.
+    @details Every camera update gets written out as a timestamped snapshot, so a pan and zoom session from the field can be captured and played back later.  Returns false if we couldn't open the file.
+  */
+- (bool)startViewTrace:(NSString *)fileName;
+
+/** @brief Stop recording the view state stream and close the trace file.
+  */
+- (void)stopViewTrace;
+
+/** @brief Play a recorded view trace back through the view controller.
+    @details The snapshots are applied at their recorded offsets, so the tile loading a session triggered happens on the same schedule every run.  Point your remote tile sources at a populated cacheDir if you want the tile data to be repeatable as well.  We call the completion block when the trace runs out.  Returns false if we couldn't read the trace.
+  */
+- (bool)replayViewTrace:(NSString *)fileName completion:(void (^)(void))completion;
+
+/** @brief Break down roughly how much memory the toolkit is holding, and where.
+    @details Returns a tree of dictionaries, each with a name, estimated bytes, an object count where counting makes sense, and an array of children for the breakdown within a subsystem.  Call it on the main thread.  It's cheap enough to run on a timer when you're chasing memory pressure.
+  */
+- (NSDictionary *)memoryCensus;
+
+/** @brief Shed reconstructible memory across the toolkit.
+    @details Works through the toolkit's caches in priority order — pooled GL object IDs, rendered icons, decoded tile payloads, then layers and registered shedders — dropping state that rebuilds on demand.  Under moderate pressure the most recently used tile payloads survive; critical empties everything and flushes the image layers' loaded tiles back to the visible set.
+    @details A system memory warning triggers this at the moderate level automatically.  Call it yourself with MaplyMemoryPressureCritical when you're about to do something memory hungry, or when you're watching your own footprint and want to head off a jetsam termination.  Call it on the main thread.
+  */
+- (void)shedMemory:(MaplyMemoryPressureSeverity)severity;
+
+/** @brief Register your own object to be told when we're shedding memory.
+    @details Registered shedders are called after the toolkit's own caches, on the main thread.  We retain the object, so remove it with removeMemoryShedder: before it goes away.
+  */
+- (void)addMemoryShedder:(NSObject<MaplyMemoryShedder> *)shedder;
+
+/// @brief Remove an object registered with addMemoryShedder:.
+- (void)removeMemoryShedder:(NSObject<MaplyMemoryShedder> *)shedder;
+
+/** @brief The last couple of seconds worth of frame timings, oldest first.
+    @details Each entry is a dictionary with a start (absolute time the frame began), cpuMs, and gpuMs (0 if the hardware won't say).  The renderer keeps these in a ring buffer, so poll once a second or so and use the start times to skip frames you've already seen.
+  */
+- (NSArray *)recentFrameTimes;
+
+/** @brief Start capturing everything the layers build into a scene snapshot file.
+    @details A snapshot is a warm boot image for the map.  Call this right after creating the view controller, build your scene the normal way, and call finishSceneSnapshot when the layers have settled.  The next launch can hand the file to loadSceneSnapshot:key: and put the finished geometry and textures up immediately, then build the live layers behind it.  The key is your invalidation fingerprint: bake your style and data versions into it and a stale file is simply ignored on load.  Textures and finished drawables are captured; atlas contents and dynamic geometry rebuild themselves and are skipped.
+  */
+- (void)startSceneSnapshot:(NSString *)fileName key:(NSString *)key;
+
+/** @brief Stop capturing and write the scene snapshot file out.
+    @details Returns false if the write failed, in which case no file is left behind.
+  */
+- (bool)finishSceneSnapshot;
+
+/** @brief Load a scene snapshot written on an earlier launch.
+    @details Checks the format version and the invalidation key, then maps the file and puts its textures and drawables back into the scene.  Returns false if the file is missing, stale, or damaged, which just means you build the scene the usual way.  The snapshot contents are static; once your live layers have caught up, call removeSceneSnapshot to drop them.
+  */
+- (bool)loadSceneSnapshot:(NSString *)fileName key:(NSString *)key;
+
+/** @brief Remove everything a loadSceneSnapshot:key: call put into the scene.
+  */
+- (void)removeSceneSnapshot;
+
 @end
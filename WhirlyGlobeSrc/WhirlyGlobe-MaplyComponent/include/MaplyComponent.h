@@ -29,6 +29,7 @@
 #import <MaplySticker.h>
 #import <MaplyBillboard.h>
 #import <MaplyVectorObject.h>
+#import <MaplyVectorAttributeIndex.h>
 #import <MaplyViewTracker.h>
 #import <MaplyViewController.h>
 #import <MaplyQuadPagingLayer.h>
@@ -39,11 +40,13 @@
 #import <MaplyMBTileSource.h>
 #import <MaplyGDALRetileSource.h>
 #import <MaplyRemoteTileSource.h>
+#import <MaplyRegionDownloader.h>
 #import <MaplyMultiplexTileSource.h>
 #import <MaplyAnimationTestTileSource.h>
 #import <MaplyPagingVectorTestTileSource.h>
 #import <MaplyElevationSource.h>
 #import <MaplyElevationDatabase.h>
+#import <MaplyElevationIntersector.h>
 #import <MaplyVectorTiles.h>
 #import <MaplyIconManager.h>
 #import <MaplyTextureBuilder.h>
@@ -27,6 +27,9 @@
     elev_tile_pyramid command line tool.  See that for details.
     Suffice it to say that each tile is separate, contains one extra
     cell on the northern and eastern sides and is made up for shorts (16 bit).
+    @details Tiles written with the tool's -delta option come in a delta
+    encoded format that's smaller and quicker to decode.  Both formats are
+    recognized per tile, so they can mix within one database.
     @see MaplyElevationSourceDelegate
   */
 @interface MaplyElevationDatabase : NSObject <MaplyElevationSourceDelegate>
@@ -44,6 +47,11 @@
 /// @brief Number of samples in the Y direction for each tile
 @property (nonatomic) unsigned int tileSizeY;
 
+/** @brief Byte budget for the cache of decoded elevation grids.
+    @details The loader tends to ask for the same neighborhood of tiles over and over, so we keep recently decoded grids around rather than running a query and an inflate every time.  Least recently used grids go first when the budget runs out.  8MB by default; set it to 0 to turn the cache off.
+  */
+@property (nonatomic) long long elevCacheSize;
+
 /** @brief Initialize with the full path or name of the sqlite file.
     @details It looks for the full path first and then will try to find the name in the bundle with an extension of @"sqlite" if that failes.
     @return Returns a valid elevation database object or nil on failure.
@@ -62,4 +70,23 @@
   */
 - (MaplyElevationChunk *)elevForTile:(MaplyTileID)tileID;
 
+/** @brief Returns elevation data for a whole set of tiles in one database pass.
+    @details When you know the set of tiles you need up front, this is cheaper than calling elevForTile: repeatedly: tiles already decoded come from the cache and the rest are fetched with a single query.
+    @param tileIDs An NSArray of NSValue-wrapped MaplyTileID structs.
+    @return An NSArray matching tileIDs, with a MaplyElevationChunk per tile or NSNull where there was no data.
+  */
+- (NSArray *)elevForTiles:(NSArray *)tileIDs;
+
+/** @brief Returns approximate elevation for a tile, interpolated from a cached ancestor.
+    @details If a parent (or grandparent, up to a few levels) of the given tile has been decoded recently, this builds the tile's grid by bilinearly interpolating the relevant patch of it.  No database access involved, so it's cheap enough to use as a stand-in while the exact chunk loads.
+    @return The interpolated chunk, or nil if no ancestor was cached.
+  */
+- (MaplyElevationChunk *)approximateElevForTile:(MaplyTileID)tileID;
+
+/** @brief Returns the maximum geometric error for the given tile in meters.
+    @details Databases built by a recent elev_tile_pyramid carry a per tile error term: how far the tile's samples stray from what the next coarser level reconstructs.  The quad layer uses this for screen space error paging (see maxScreenError).  Values are cached after the first lookup, so this is cheap to call from the importance delegate.
+    @return The error in meters, or -1.0 if the database predates the maxerror column.
+  */
+- (float)maxErrorForTile:(MaplyTileID)tileID;
+
 @end
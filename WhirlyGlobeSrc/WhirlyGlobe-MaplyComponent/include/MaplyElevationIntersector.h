@@ -0,0 +1,81 @@
+/*
+ *  MaplyElevationIntersector.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <UIKit/UIKit.h>
+#import "MaplyElevationSource.h"
+
+@class WhirlyGlobeViewController;
+
+/** @brief The result of intersecting a view ray with the terrain.
+    @details Returned by the MaplyElevationIntersector.  If found is set, coord and elevation describe where the ray struck the displaced terrain.  If not, the ray missed the globe entirely.
+  */
+@interface MaplyElevationHit : NSObject
+
+/// @brief Set if the ray actually hit the terrain
+@property (nonatomic,assign) bool found;
+/// @brief Geographic location of the hit
+@property (nonatomic,assign) MaplyCoordinate coord;
+/// @brief Elevation at the hit, in meters
+@property (nonatomic,assign) float elevation;
+/// @brief The screen point the query started from
+@property (nonatomic,assign) CGPoint screenPt;
+
+@end
+
+/** @brief Intersects screen taps with the terrain rather than the ideal sphere.
+    @details The globe's own screen queries intersect a smooth sphere, so a tap on a mountainside lands hundreds of meters downhill of where the user actually touched once elevation is displayed.  This object marches the view ray against the elevation source instead, refining with a bisection once it brackets the surface, and hands back where the ray really struck.
+    @details Elevation samples go through a MaplyElevationQuery, so the chunks involved stay cached between queries and nothing touches the database twice for the same neighborhood.  Queries run on their own serial queue with completion blocks on the main queue, and there's a batch entry point that resolves a whole set of screen points in one pass.  Results are also cached per view state, so something like cursor tracking that asks about the same points repeatedly gets answers for free until the view moves.
+  */
+@interface MaplyElevationIntersector : NSObject
+
+/** @brief Construct with the elevation source to intersect against and the globe it's displayed on.
+  */
+- (id)initWithSource:(NSObject<MaplyElevationSourceDelegate> *)elevSource viewC:(WhirlyGlobeViewController *)viewC;
+
+/** @brief Horizontal sampling tolerance in meters.  Defaults to 30.
+    @details Controls both how finely the ray is marched and which level of the elevation pyramid answers the samples.  Smaller is more precise and more work.
+  */
+@property (nonatomic,assign) float toleranceMeters;
+
+/** @brief The highest terrain we need to consider, in meters.  Defaults to 9000.
+    @details The march starts where the ray enters a sphere inflated by this much, so there's no point setting it higher than your data goes.
+  */
+@property (nonatomic,assign) float maxElevation;
+
+/** @brief The lowest terrain we need to consider, in meters.  Defaults to -500.
+  */
+@property (nonatomic,assign) float minElevation;
+
+/** @brief Intersect the ray under a single screen point.  Any thread.
+    @details Returns the hit (or a miss with found unset).  This is the synchronous version; use it if you're already off the main thread.
+  */
+- (MaplyElevationHit *)pointOnTerrainFromScreen:(CGPoint)screenPt;
+
+/** @brief Intersect the ray under a single screen point asynchronously.
+    @details The work happens on the intersector's queue and the completion block is called on the main queue.
+  */
+- (void)pointOnTerrainFromScreen:(CGPoint)screenPt completion:(void (^)(MaplyElevationHit *hit))completion;
+
+/** @brief Intersect a whole set of screen points in one pass.
+    @details Pass an NSArray of NSValue-wrapped CGPoints.  The rays share their elevation chunks, so this is much cheaper than individual queries when the points are near each other (a drag path, say).  The completion block gets an NSArray of MaplyElevationHit in matching order, on the main queue.
+  */
+- (void)pointsOnTerrainFromScreens:(NSArray *)screenPts completion:(void (^)(NSArray *hits))completion;
+
+@end
@@ -88,6 +88,14 @@
   */
 - (bool)tileIsLocal:(MaplyTileID)tileID;
 
+@optional
+
+/** @brief Return the maximum geometric error for the given tile, in meters.
+    @details This is how far the tile's surface strays, vertically, from what the next coarser level renders over the same footprint.  The MaplyQuadImageTilesLayer uses it (when maxScreenError is set) to stop subdividing once the error is too small to see, so flat regions don't page as deep as rough ones.
+    @details Return a negative value if you don't know the error for a tile.  The layer falls back to plain area based importance there.  This gets called from the importance delegate, so it needs to be fast; answer from memory or a small cache, not a fresh fetch.
+  */
+- (float)maxErrorForTile:(MaplyTileID)tileID;
+
 @end
 
 /** @brief A simple test elevation source.
@@ -96,3 +104,39 @@
 @interface MaplyElevationSourceTester : NSObject<MaplyElevationSourceDelegate>
 
 @end
+
+/** @brief Answers elevation questions from the coarsest sufficient level of the pyramid.
+    @details The elevation query sits on top of a MaplyElevationSourceDelegate and picks the level to sample based on the tolerance you pass in, rather than always fetching the most detailed tile that covers a location.  A route profile that's happy with 500m samples gets a level 8 chunk, not a level 14 one.
+    @details Chunks pulled from the source are kept in a small cache, so repeated queries in the same area don't go back to the delegate.  Safe to call from any thread, same as the delegate underneath it.
+  */
+@interface MaplyElevationQuery : NSObject
+
+/** @brief Construct with the elevation source to query.
+  */
+- (id)initWithSource:(NSObject<MaplyElevationSourceDelegate> *)elevSource;
+
+/** @brief Samples per tile edge the source hands back, used to work out what a level resolves.
+    @details Set this to match your source if it differs from the usual 10 cells (11 samples).  We only use it to pick levels, so being a little off just shifts which level answers a given tolerance.
+  */
+@property (nonatomic,assign) int samplesPerTile;
+
+/** @brief How many chunks we'll keep around before dropping the stalest.  Defaults to 32.
+  */
+@property (nonatomic,assign) int maxCachedChunks;
+
+/** @brief Return the coarsest level whose sample spacing is at least as fine as the tolerance.
+    @param tolMeters Acceptable horizontal sample spacing, in meters at the equator.
+  */
+- (int)levelForTolerance:(float)tolMeters;
+
+/** @brief Return the elevation (meters) at the given location, sampled at the given tolerance.
+    @details The chunk comes from the coarsest sufficient level and the value is interpolated within it.  Returns 0.0 where the source has no data, same as the display path.
+  */
+- (float)elevationForCoordinate:(MaplyCoordinate)coord toleranceMeters:(float)tolMeters;
+
+/** @brief Return an elevation chunk covering the given tile's footprint, resampled from the coarsest sufficient level.
+    @details Use this when you want a whole footprint (say, for a profile overlay) without paying for the full resolution tile.  Returns nil if the source has nothing there.
+  */
+- (MaplyElevationChunk *)elevForTile:(MaplyTileID)tileID toleranceMeters:(float)tolMeters;
+
+@end
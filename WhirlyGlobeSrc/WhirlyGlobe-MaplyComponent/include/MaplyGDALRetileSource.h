@@ -21,6 +21,12 @@
 #import "MaplyTileSource.h"
 #import "MaplyCoordinateSystem.h"
 
+/** A tile source for image pyramids retiled out of GDAL imagery.
+    The read/warp work runs ahead of time on the server side; this end
+    fetches the emitted tiles.  It implements the asynchronous fetch
+    protocol, so requests run through a small pool in parallel, and
+    recently fetched tiles stay warm in the shared memory cache.
+  */
 @interface MaplyGDALRetileSource : NSObject<MaplyTileSource>
 
 - (id)initWithURL:(NSString *)baseURL baseName:(NSString *)baseName ext:(NSString *)ext coordSys:(MaplyCoordinateSystem *)coordSys levels:(int)numLevels;
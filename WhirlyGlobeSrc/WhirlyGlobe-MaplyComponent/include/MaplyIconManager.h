@@ -8,6 +8,9 @@
 
 #import <UIKit/UIKit.h>
 
+@class MaplyTexture;
+@class MaplyBaseViewController;
+
 /** An interface/loader for Icons in general.
  */
 @interface MaplyIconManager : NSObject
@@ -18,4 +21,22 @@
 // Slightly more complex icon
 + (UIImage *)iconForName:(NSString *)name size:(CGSize)size color:(UIColor *)color circleColor:(UIColor *)circleColor strokeSize:(float)strokeSize strokeColor:(UIColor *)strokeColor;
 
+// Declare a set of icons up front.  They're rendered in parallel, packed
+//  into a shared texture atlas and registered with the view controller's
+//  scene.  Fetch the handles with prebakedIconForName:.
++ (bool)prebakeIconSet:(NSArray *)names size:(CGSize)size viewC:(MaplyBaseViewController *)viewC;
+
+// Same, but with control over the styling
++ (bool)prebakeIconSet:(NSArray *)names size:(CGSize)size color:(UIColor *)color circleColor:(UIColor *)circleColor strokeSize:(float)strokeSize strokeColor:(UIColor *)strokeColor viewC:(MaplyBaseViewController *)viewC;
+
+// The texture handle for a prebaked icon.  Use it as the image on a
+//  MaplyScreenMarker and markers sharing the atlas batch together.
+// Returns nil if the icon wasn't in a prebaked set.
++ (MaplyTexture *)prebakedIconForName:(NSString *)name;
+
+// Drop the cached rendered images.  They redraw on demand, so this is
+//  safe to call under memory pressure.  Prebaked atlases stay; markers
+//  may be using those textures right now.
++ (void)clearIconCache;
+
 @end
@@ -66,4 +66,28 @@
   */
 @property (nonatomic,readonly) MaplyCoordinateSystem *coordSys;
 
+/** @brief How much of the archive sqlite may memory map, in bytes.
+    @details Memory mapping skips a copy on every page read, which adds
+     up when you're paging tiles as fast as the layer can ask for them.
+     64MB by default.  Set it to 0 to turn mapping off.
+  */
+@property (nonatomic) long long mmapSize;
+
+/** @brief Size of sqlite's page cache, in bytes, per connection.
+    @details We open a read-only connection per fetching thread, and
+     each one gets a page cache this big.  0 (the default) leaves
+     sqlite's own default alone.
+  */
+@property (nonatomic) long long sqliteCacheSize;
+
+/** @brief Fetch a batch of tiles in one call.
+    @details This runs all the lookups on one connection inside a single
+     transaction, which is noticeably faster than individual fetches when
+     you know the set of tiles up front (prefetching, offline rendering).
+    @param tileIDs An array of MaplyTileID wrapped in NSValue.
+    @return An array matching tileIDs, with NSData for the tiles we found
+     and NSNull for the ones we didn't.
+  */
+- (NSArray *)imagesForTiles:(NSArray *)tileIDs;
+
 @end
@@ -25,6 +25,25 @@
 
 @class MaplyQuadImageOfflineLayer;
 
+/** @brief One changed cell of the offline rendered image, when the layer is delivering sub tiles.
+    @details If you set the layer's subTileSize, the rendered output arrives as individual cells on a fixed grid rather than one big image.  Only the cells that actually changed are delivered, so a consumer keeping its own texture (or stack of textures) can update just those regions.
+  */
+@interface MaplyOfflineSubTile : NSObject
+
+/// @brief Horizontal position of the cell on the output grid
+@property (nonatomic) int gridX;
+
+/// @brief Vertical position of the cell on the output grid
+@property (nonatomic) int gridY;
+
+/// @brief Where the cell sits on the full image, in pixels
+@property (nonatomic) CGRect rect;
+
+/// @brief Textures for the cell as MaplyTexture objects, one per image in the stack
+@property (nonatomic) NSArray *textures;
+
+@end
+
 /// The offline renderer passes over images like so
 @interface MaplyOfflineImage : NSObject
 {
@@ -42,6 +61,10 @@
 /// Size of the center pixel in meters
 @property (nonatomic) CGSize centerSize;
 
+/// The changed cells (MaplyOfflineSubTile) when the layer has a
+///  subTileSize set.  In that mode textures above is empty.
+@property (nonatomic) NSArray *subTiles;
+
 @end
 
 
@@ -125,6 +148,11 @@
   */
 @property (nonatomic) bool autoRes;
 
+/** @brief Size (in pixels) of the cells the output is broken into for delivery.  Off by default.
+    @details If set, the delegate gets MaplyOfflineSubTile objects covering just the regions that changed since the last render, on a grid that stays put between renders.  Consumers re-uploading the whole canvas for a small refresh should set this instead.  0 (the default) delivers one monolithic image.
+  */
+@property (nonatomic) int subTileSize;
+
 /** @brief Controls whether the fetching code runs in a single thread or is spawned asyncronously.
     @details If set, we'll kick off the tile fetches in their own dispatched blocks.  If not set, we'll just do it in the layer thread.
  */
@@ -47,7 +47,7 @@ typedef enum {MaplyImageIntRGBA,
     @see MaplyMultiplexTileSource
     @see MaplyWMSTileSource
   */
-@interface MaplyQuadImageTilesLayer : MaplyViewControllerLayer
+@interface MaplyQuadImageTilesLayer : MaplyViewControllerLayer<MaplyMemoryShedder>
 
 /** @brief Initialize with a coordinate system for the image pyramid and the tile source object.  
     @details The initialize expects a coordinate system (probably MaplySphericalMercator) and a tile source.  The tile source can be one of the standard ones listed above, or it can be one of your own that conforms to the MaplyTileSource protocol.
@@ -69,6 +69,7 @@ typedef enum {MaplyImageIntRGBA,
 
 /** @brief The number of simultaneous fetches the layer will attempt at once.
     @details The toolkit loves its dispatch queues and threads.  By default this number is set to 8 or 16, but if you need to constrain it, you can set it lower (or higher!).  If your tile source can't handle multi-thread access, set this to 1.
+    @details For a synchronous tile source (one that only implements imageForTile:) this is also the width of the queue the layer runs the fetches on, so slow I/O never blocks the layer thread or floods the global queues.
   */
 @property (nonatomic,assign) int numSimultaneousFetches;
 
@@ -78,6 +79,24 @@ typedef enum {MaplyImageIntRGBA,
   */
 @property (nonatomic,assign) bool handleEdges;
 
+/** @brief If set, tiles stitch their edges to coarser neighbors instead of generating skirts.
+    @details Rather than hiding the cracks between levels of detail behind skirt geometry, this mode snaps each tile's edge vertices onto the coarser neighbor's edge so the two meet exactly.  That does away with the skirt triangles and the fill they cost every frame.  Edges are recomputed as neighboring tiles load and unload.
+    @details It works best with an elevation source whose levels agree at shared sample points, which is what elev_tile_pyramid produces.  When set, it takes the place of handleEdges.  Off by default.
+  */
+@property (nonatomic,assign) bool stitchEdges;
+
+/** @brief If set, tiles with elevation get a normal map texture and per fragment lighting.
+    @details The normals come from the elevation grid itself, so the shading detail no longer depends on how densely the terrain mesh is tessellated.  That means you can wind the tessellation way down (see tessX/tessY on the elevation setup) and the mountains still light correctly — better, actually, since the normals are per texel rather than per vertex.
+    @details Unless you've assigned your own shader program, the layer switches to the toolkit's normal map lighting shader.  The normal map rides in the second texture unit, which the dynamic texture atlases can't accommodate, so those are turned off for the layer.  Set this before the layer starts.  Off by default.
+  */
+@property (nonatomic,assign) bool useNormalMaps;
+
+/** @brief If set, tile geometry is stored relative to each tile's center rather than in absolute coordinates.
+    @details Vertices are floats on the GPU, and at high zoom levels on a flat map the absolute coordinates get big enough that the leftover float precision makes the geometry visibly wobble.  In this mode each tile's vertices are small offsets from the tile's center, the center rides along in double precision, and the renderer does the sensitive matrix work in double.  The wobble goes away without doubling the vertex memory.
+    @details Only applies to flat maps (the globe doesn't zoom deep enough to care) and it's incompatible with the dynamic atlases, so those are turned off for the layer.  Set this before the layer starts.  Off by default.
+  */
+@property (nonatomic,assign) bool useTileCenters;
+
 /** @brief Generate pole geometry for projections that don't go all the way to the poles.
     @details This is for spherical mercator with web extents.  That projection doesn't run all the way to the poles, but it gets fairly close.  If set, we close that gap for the north and south poles and generate the remaining geometry.
     @details We'll pull a texture value from the edge of the images, so build your texture accordingly.  A nice flat color along the north and south border is the best idea.  If not, it'll look a little odd, but still okay.
@@ -100,6 +119,12 @@ typedef enum {MaplyImageIntRGBA,
   */
 @property (nonatomic,assign) bool asyncFetching;
 
+/** @brief Keep decoded tiles in the shared in-memory cache.
+    @details When the quad tree throws out a tile and the user pans right back, we can pull the decoded version from the MaplyTileMemoryCache rather than refetching and re-decoding it.  The cache has one byte budget for the whole scene.  On by default.
+    @see MaplyTileMemoryCache
+  */
+@property (nonatomic,assign) bool useMemoryCache;
+
 /** @brief Set the minimum time for an update based on the viewer's location and orientation.
     @details Paging layers watch the viewer to see what it's up to.  When the viewer moves, the layer updates its contents accordingly.  However, the viewer can be moving constantly so we need a way to keep things under control.
     @details This value (in seconds) specifies the minimum time between updates.  In other words, we won't recalculate things more often than this.  Default value is 1/10s.
@@ -148,6 +173,12 @@ typedef enum {MaplyImageIntRGBA,
   */
 @property (nonatomic, assign) float animationPeriod;
 
+/** @brief The number of frames either side of the current image kept as full resolution textures.
+    @details When animating a deep image stack (see: imageDepth) every frame normally keeps a full resolution texture per tile, so a 12 frame stack costs 12x the texture memory.  Set this and only the frames within the given distance of the current image stay resident; the rest hold just their compressed source data in CPU memory and rebuild as the animation approaches them.  The window wraps around the ends, so a looping animation always has its next few frames ready.
+    @details By default this is off (0) and every frame stays resident.  Setting it turns off the dynamic texture atlases for this layer, since the atlases can't drop individual frames.
+  */
+@property (nonatomic,assign) int frameResidency;
+
 /** @brief If set to true, we'll consider the list of images for each tile to be circular when we animate.
     @details When set we'll loop back to the first image when we go past the last.  This is the default.
     @details When not set, we'll run from 0 to maxCurrentImage and then restart.
@@ -190,6 +221,12 @@ typedef enum {MaplyImageIntRGBA,
   */
 @property (nonatomic) float importanceScale;
 
+/** @brief Maximum on-screen geometric error, in pixels, before a terrain tile needs to subdivide.
+    @details When an elevation source carries a per tile geometric error term (see maxErrorForTile: in MaplyElevationSourceDelegate and the maxerror column elev_tile_pyramid writes), we can tell how far a tile's surface strays from what its parent already renders.  If that error projects to less than this many pixels on screen, there's no visible reason to load the tile, so we scale its importance down and the pager stops there.  Flat terrain resolves several levels earlier than mountains, which typically cuts resident tiles by a third or more.
+    @details Set to 0.0 (the default) to turn this off.  Around 2.0 is a reasonable value if you want to try it.  Note that this gates image paging along with the terrain, so don't use it if you need full resolution imagery over flat ground.
+  */
+@property (nonatomic) float maxScreenError;
+
 /** @brief Set the shader name to use for generated tiles.
     @details Shader programs are accessed by name.  When you create a shader and tie it into the scene, you'll have the name.  Use that name here to ensure that all tiles are rendered with that MaplyShader.
     @details Be sure to set this immediately after layer creation.  It can't be changed in the middle.
@@ -260,6 +297,18 @@ typedef enum {MaplyImageIntRGBA,
   */
 - (int)targetZoomLevel;
 
+/** @brief Tile state captured from a previous instance of this layer.
+    @details Set this before adding the layer and it will rebuild the captured tile arrangement in one pass, rather than paging down level by level from the min zoom.  Capture the state with snapshotTileState just before removing the old layer.
+    @details Tiles still come from the tile source, so this is only instant if the source caches locally.
+  */
+@property (nonatomic,strong) NSData *restoreTileState;
+
+/** @brief Capture which tiles the layer currently has loaded.
+    @details Hand the result to a replacement layer's restoreTileState to bring it up in the same arrangement, e.g. when toggling a layer off and back on.
+    @details This call is synchronous, so it will block briefly while the layer thread responds.
+  */
+- (NSData *)snapshotTileState;
+
 /** @brief Force a full reload of all tiles.
  @details This will notify the system to flush out all the existing tiles and start reloading from the top.  If everything is cached locally (and the MaplyTileSource objects say so) then this should appear instantly.  If something needs to be fetched or it's taking too long, you'll see these page in from the low to the high level.
  @details This is good for tile sources, like weather, that need to be refreshed every so often.
@@ -0,0 +1,99 @@
+/*
+ *  MaplyRegionDownloader.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 5/9/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "MaplyRemoteTileSource.h"
+
+@class MaplyRegionDownloader;
+
+/** The region downloader delegate hears about download progress.
+    Like the remote tile source delegate, you'll be called in all
+    sorts of random threads here, so act accordingly.
+  */
+@protocol MaplyRegionDownloaderDelegate <NSObject>
+
+@optional
+
+/** @brief A tile was fetched and written to the archive.
+    @param tilesComplete How many tiles of the region are in the archive now, counting any that were already there when we started.
+    @param tilesTotal How many tiles the region works out to in all.
+  */
+- (void)regionDownloader:(MaplyRegionDownloader *)downloader didFetchTile:(MaplyTileID)tileID tilesComplete:(int)tilesComplete tilesTotal:(int)tilesTotal;
+
+/** @brief A tile failed to fetch.
+    @details The download keeps going; a later run against the same archive will pick the tile up, since tiles already present aren't refetched.
+  */
+- (void)regionDownloader:(MaplyRegionDownloader *)downloader didFailTile:(MaplyTileID)tileID error:(NSError *)error;
+
+/// @brief Every tile in the region is in the archive.
+- (void)regionDownloaderDidFinish:(MaplyRegionDownloader *)downloader;
+
+/** @brief The download stopped before covering the region.
+    @details Either cancel was called or the byte budget ran out.  The archive is left in a consistent state, so you can resume by starting the same region again later.
+  */
+- (void)regionDownloader:(MaplyRegionDownloader *)downloader didStopWithError:(NSError *)error;
+
+@end
+
+/** @brief The region downloader pulls a whole region of a tile pyramid down into an MBTiles archive.
+    @details Given a bounding box and a level range it works out the tile set, fetches the tiles through a pool of simultaneous connections, and writes them straight into an MBTiles file that MaplyMBTileSource can open.  That's the supported way to provision a device for offline use, rather than scripting tile by tile fetches through a live layer.
+    @details Downloads resume for free: tiles already present in the archive are skipped, so pointing a new downloader at an existing file just fills in whatever is missing.
+    @see MaplyMBTileSource
+  */
+@interface MaplyRegionDownloader : NSObject
+
+/** @brief Initialize with a tile source description and a destination archive.
+    @param tileInfo Where the tiles come from.  We use its URLs, extension, and zoom limits.
+    @param mbTilesPath Full path of the MBTiles file to write.  Created if it isn't there, appended to if it is.
+  */
+- (id)initWithTileInfo:(MaplyRemoteTileInfo *)tileInfo destination:(NSString *)mbTilesPath;
+
+/// @brief Who to tell about progress.  See the protocol note about threads.
+@property (nonatomic,weak) NSObject<MaplyRegionDownloaderDelegate> *delegate;
+
+/// @brief Simultaneous tile fetches.  Set before starting.  Default is 8.
+@property (nonatomic) int fetchConcurrency;
+
+/** @brief Byte budget for this run.  0 (the default) means no limit.
+    @details Counts bytes of tile data written during this run, not the size of the archive.  When the budget runs out the download stops and the delegate hears didStopWithError:.
+  */
+@property (nonatomic) long long maxBytes;
+
+/// @brief Bytes of tile data written so far in this run
+@property (nonatomic,readonly) long long bytesWritten;
+
+/// @brief Tiles the region works out to in all
+@property (nonatomic,readonly) int tilesTotal;
+
+/// @brief Tiles in the archive, counting ones that were already there
+@property (nonatomic,readonly) int tilesComplete;
+
+/** @brief Start downloading a region.
+    @details Works out the tile set for the box over the given levels, minus whatever the archive already has, and starts fetching.  Only one region runs at a time per downloader.
+    @param bbox The region in geo coordinates (radians).
+    @param minLevel The lowest level to fetch.  Clamped to the tile source's limits.
+    @param maxLevel The highest level to fetch.  Clamped likewise.
+    @return false if a download is already running or the archive can't be opened.
+  */
+- (bool)startRegion:(MaplyBoundingBox)bbox minLevel:(int)minLevel maxLevel:(int)maxLevel;
+
+/// @brief Stop the download.  The delegate hears didStopWithError: once the tiles in flight wind down.
+- (void)cancel;
+
+@end
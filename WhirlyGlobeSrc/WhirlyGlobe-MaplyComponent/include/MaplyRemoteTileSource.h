@@ -103,9 +103,11 @@
 /** @brief The cache directory for image tiles.
  @details In general, we want to cache.  The globe, in particular,
     is going to fetch the same tiles over and over, quite a lot.
- The cacheing behavior is a little dumb.  It will just write
- files to the given directory forever.  If you're interacting
- with a giant image pyramid, that could be problematic.
+ Tiles are kept in a packed cache file in this directory with an
+ in-memory index, so lookups don't have to stat anything.  Old
+ per-file caches found in the directory are migrated as they're read.
+ The cache evicts the least recently used tiles once it passes its
+ byte budget, so it won't grow forever.
  */
 @property (nonatomic, strong) NSString *cacheDir;
 
@@ -115,6 +117,10 @@
       retrieved from the remote source, and the locally cached tile
       will be updated. This is useful for tiles that represent
       impermanent data, such as weather information.
+      @details If the server sent an ETag or Last-Modified with the tile,
+      the refetch is a conditional request.  A 304 Not Modified answer
+      keeps the cached copy and resets its age, so unchanged tiles cost
+      a round trip instead of a download.
   */
 @property (nonatomic) int cachedFileLifetime;
 
@@ -130,6 +136,11 @@
  */
 - (void)addGeoBoundingBox:(MaplyBoundingBox *)bbox;
 
+/** @brief URL template for a smaller variant of the tiles, if the server has one.
+ @details Use {z}, {x}, and {y} for the tile indices, e.g. a 256 pixel endpoint next to a 512 pixel retina one.  When this is set and the shared fetch engine reports constrained bandwidth, tiles are fetched from here first so the screen paints sooner, and the full resolution copy quietly replaces them as it arrives.  The small tiles are never cached.
+ */
+@property (nonatomic, strong) NSString *lowResURLTemplate;
+
 /** @brief Generate the request for a given tile.
  @details If someone outside of this request wants to fetch the data directly, they can do so by using this NSURLRequest.
  @param tileID The tile we'd like the NSURLRequest for.
@@ -137,6 +148,11 @@
  */
 - (NSURLRequest *)requestForTile:(MaplyTileID)tileID;
 
+/** @brief Generate the request for a given tile, possibly the small variant.
+ @details With lowRes set (and a lowResURLTemplate to serve it) this asks for the smaller tile.  Otherwise it's the same as requestForTile:.
+ */
+- (NSURLRequest *)requestForTile:(MaplyTileID)tileID lowRes:(bool)lowRes;
+
 /** @brief The full path for a cached tile.
  @details This returns the full path to where a tile is or where a tile would be if it were cached.
  @details We don't check if the tile is there or not.
@@ -150,6 +166,43 @@
   */
 - (bool)tileIsLocal:(MaplyTileID)tileID;
 
+/** @brief Read a tile's data out of the local cache.
+    @details Tiles live in a packed cache file under cacheDir these days, rather than one file per tile, so go through this rather than reading the fileNameForTile: path yourself.  Respects cachedFileLifetime.
+    @param tileID The tile we want data for.
+    @return The tile data or nil if it's not cached (or too old).
+  */
+- (NSData *)readFromCache:(MaplyTileID)tileID;
+
+/** @brief Write a tile's data into the local cache.
+    @details Does nothing if there's no cacheDir set.
+    @param tileID The tile the data belongs to.
+    @param tileData The data to cache.
+  */
+- (void)writeToCache:(MaplyTileID)tileID tileData:(NSData *)tileData;
+
+/** @brief Write a tile's data into the local cache, keeping its HTTP validators.
+    @details If the server handed back an ETag or Last-Modified with the tile, cache them alongside it.  When the tile passes cachedFileLifetime we'll replay them in a conditional request, and a 304 answer refreshes the cached copy without downloading the tile again.
+    @param tileID The tile the data belongs to.
+    @param tileData The data to cache.
+    @param etag The ETag response header, if there was one.
+    @param lastModified The Last-Modified response header, if there was one.
+  */
+- (void)writeToCache:(MaplyTileID)tileID tileData:(NSData *)tileData etag:(NSString *)etag lastModified:(NSString *)lastModified;
+
+/** @brief Read an expired tile's data and validators out of the local cache.
+    @details Returns the cached data even when it's past cachedFileLifetime, but only if we stored an ETag or Last-Modified with it, so the caller can ask the server whether it's still current.  Returns nil if there's nothing to revalidate with.
+    @param tileID The tile we want data for.
+    @param etag On return, the cached ETag or nil.
+    @param lastModified On return, the cached Last-Modified or nil.
+  */
+- (NSData *)staleDataFromCache:(MaplyTileID)tileID etag:(NSString **)etag lastModified:(NSString **)lastModified;
+
+/** @brief Mark a cached tile as freshly validated.
+    @details Call this when the server answered a conditional request with a 304.  The cached copy's age resets for cachedFileLifetime purposes without rewriting its data.
+    @param tileID The tile the server vouched for.
+  */
+- (void)touchCache:(MaplyTileID)tileID;
+
 /** @brief Check if we should even try to load a given tile.
  @details Check whether tile level is within zoom limits for the source, and if the tile is within any MBRs that have been added.
  @param tileID The tile we're asking about.
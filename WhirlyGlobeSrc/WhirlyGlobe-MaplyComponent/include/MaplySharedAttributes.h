@@ -49,6 +49,9 @@
 #define kWGFade kMaplyFade
 /// Enable or disable an object.  This can be used to create an object disabled.
 #define kMaplyEnable @"enable"
+/// Merge the object's triangle drawables into shared big buffers to cut down on draw calls.  Takes a boolean.
+/// Good for dense per-tile geometry (e.g. vector tiles); enable, disable and remove still work per object, but you can't restyle a consolidated object in place.
+#define kMaplyConsolidate @"consolidate"
 /// Request a given object take the z buffer into account
 #define kMaplyZBufferRead @"zbufferread"
 /// Have a given object write itself to the z buffer
@@ -47,6 +47,7 @@ typedef enum {MaplyOpacityFlat,MaplyOpacityLinear,MaplyOpacitySin1,MaplyOpacityS
 
 /** @brief Build the image from the size and elements specified.
     @details If you've set a reasonable size and added a pattern, this will render the pattern into the image and return it.  If the size of the image differs from the size of the elements, they will be scaled to the image.
+    @details Identical patterns come back as the same image, so adding them to the view controller produces one shared texture rather than one per style.
   */
 - (UIImage *)makeImage;
 
@@ -0,0 +1,67 @@
+/*
+ *  MaplyTileMemoryCache.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import "MaplyTileSource.h"
+
+/** @brief In-memory cache of decoded tile payloads, shared across layers.
+    @details When the quad tree evicts a tile and the user pans right back,
+     we'd otherwise refetch and re-decode it from scratch.  This cache keeps
+     the decoded payloads around, keyed by (source, level, x, y), under a
+     single byte budget for the whole scene.  Least recently used tiles go
+     first when the budget runs out.
+    @details The image tiles layer uses it automatically (see
+     MaplyQuadImageTilesLayer useMemoryCache).  Paging delegates that fetch
+     their own data can consult it directly.
+  */
+@interface MaplyTileMemoryCache : NSObject
+
+/// There's one cache for the whole scene, so the budget means something.
++ (MaplyTileMemoryCache *)sharedCache;
+
+/** @brief Most bytes we'll hold on to across all sources.
+    @details 32MB by default.  Set it to 0 to turn the cache off entirely.
+  */
+@property (nonatomic) long long totalBudget;
+
+/** @brief Look up a tile's payload.
+    @details Returns whatever was stored for the (source,tile) pair, or nil.
+     Counts as a use for eviction purposes.
+  */
+- (id)objectForSource:(id)source tile:(MaplyTileID)tileID;
+
+/** @brief Store a tile's payload with its cost in bytes.
+    @details The cost is whatever you say it is; it only has to be
+     consistent, since it's just counted against the budget.
+  */
+- (void)setObject:(id)object cost:(long long)cost forSource:(id)source tile:(MaplyTileID)tileID;
+
+/** @brief Throw out everything cached for the given source.
+    @details Call this when a source goes away, or when its data has
+     changed out from under us (e.g. a reload).
+  */
+- (void)removeAllForSource:(id)source;
+
+/** @brief Throw out least recently used tiles until we're under the given byte count.
+    @details The budget itself doesn't change; this is a one time shed for memory pressure.  Pass 0 to empty the cache entirely.
+  */
+- (void)evictDownTo:(long long)maxBytes;
+
+@end
@@ -119,7 +119,8 @@ NSString *MaplyTileIDString(MaplyTileID tileID);
 
 /** @brief Start fetching the given tile, probably with your own threads.
     @details If this is filled in that means the layer is expecting you to do your own asynchronous fetch.  You'll be called on a random thread here, so act accordingly.
-    @details If you're using a MaplyQuadImageTilesLayer, when you're done fetching (successful or otherwise) call loadedImagesForTile: with the results.
+    @details If you're using a MaplyQuadImageTilesLayer, when you're done fetching (successful or otherwise) call loadedImagesForTile: with the results.  The layer checks whether the tile is still wanted when the results come in, so a fetch that's outlived its tile just gets dropped; there's no separate cancel to implement beyond (optionally) watching tileUnloaded:.
+    @details The built-in sources (MaplyRemoteTileSource, MaplyMBTileSource) implement this, each running its I/O on its own bounded queue.
     @param layer This is probably a MaplyQuadImageTilesLayer, but others use this protocol as well.  Your tile source should know.
     @param tileID The tile you should start fetching.
   */
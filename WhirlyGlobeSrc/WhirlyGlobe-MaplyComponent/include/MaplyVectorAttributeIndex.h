@@ -0,0 +1,51 @@
+/*
+ *  MaplyVectorAttributeIndex.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import "MaplyVectorObject.h"
+
+/** @brief Columnar attribute index over a collection of vector features.
+    @details If you're filtering thousands of features by attribute, walking MaplyVectorObjects and poking at their attribute dictionaries one by one is slow.  This builds the attributes into columns once, so a query is a scan over packed arrays rather than a dictionary lookup per feature.
+    @details String values are interned when the index is built, so matching on a string is an integer compare per feature.  A column's type (string or numeric) is set by the first value seen for that attribute; features with a different type for it just don't match.
+    @details Build it once per collection and query it as often as you like.  The index holds on to the underlying features, so it will keep them alive.
+  */
+@interface MaplyVectorAttributeIndex : NSObject
+
+/** @brief Build an index over the features in the given vector objects.
+    @details Each vector feature (there may be several per MaplyVectorObject) becomes one row in the index.
+    @param vecObjs An NSArray of MaplyVectorObject.
+  */
++ (MaplyVectorAttributeIndex *)indexForVectorObjects:(NSArray *)vecObjs;
+
+/// @brief Number of vector features in the index
+@property (nonatomic,readonly) int numFeatures;
+
+/** @brief Return the features whose attribute exactly matches the given value.
+    @details The value should be an NSString or an NSNumber, to match how the attribute was stored.
+    @return An NSArray of MaplyVectorObject, one per matching feature.  Empty array if nothing matched.
+  */
+- (NSArray *)vectorsWithAttribute:(NSString *)attrName value:(id)value;
+
+/** @brief Return the features whose numeric attribute falls in [minVal,maxVal].
+    @return An NSArray of MaplyVectorObject, one per matching feature.  Empty array if nothing matched.
+  */
+- (NSArray *)vectorsWithAttribute:(NSString *)attrName min:(double)minVal max:(double)maxVal;
+
+@end
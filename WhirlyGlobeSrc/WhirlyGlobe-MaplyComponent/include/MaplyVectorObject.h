@@ -89,6 +89,13 @@ typedef enum {MaplyVectorNoneType,MaplyVectorPointType,MaplyVectorLinearType,Map
   */
 + (NSDictionary *)VectorObjectsFromGeoJSONAssembly:(NSData *)geoJSON;
 
+/** @brief Parse vector data from geoJSON, a batch of features at a time.
+    @details Rather than parsing the whole document up front, this tokenizes features as it goes and calls the block with a new MaplyVectorObject for each batchSize features, along with how far through the data we've gotten (0 to 1).  That way you can hand the early batches to addVectors: while the rest of a big file is still parsing, and memory stays at about one batch.
+    @details Return false from the block to cancel the parse.
+    @return True on success, false if the parse failed or was cancelled.
+  */
++ (bool)VectorObjectsFromGeoJSONStreaming:(NSData *)geoJSON batchSize:(int)batchSize usingBlock:(bool (^)(MaplyVectorObject *vecObj,float progress))block;
+
 /** @brief Initialize with a single data point and attribution.
     @details This version takes a single coordinate and the attributes to go with it.
   */
@@ -214,6 +221,12 @@ typedef enum {MaplyVectorNoneType,MaplyVectorPointType,MaplyVectorLinearType,Map
   */
 - (void)subdivideToGlobeGreatCircle:(float)epsilon;
 
+/** @brief Return a simplified copy of the linear and areal features at the given tolerance.
+    @details Runs a Visvalingam style simplification over the linears and areal loops: points whose removal changes the shape by less than the tolerance (in radians, so match it to what a pixel covers at your zoom level) are dropped.  The per-point importance ranks are computed once and cached on the shapes, so asking for several tolerances only pays for the ranking the first time; after that each call is just a filter pass.
+    @details Points and triangle meshes pass through unchanged.  Attributes are shared with the original features, not copied.
+  */
+- (MaplyVectorObject *) simplifyWithTolerance:(float)tolerance;
+
 /** @brief Tesselate the areal geometry in this vector object and return triangles.
     @details This will attempt to tesselate the areals (with holes) and turn them into triangles.  No attribution will be assigned to the new triangles, so be aware.  The tesselator is the GLU based one and does a decent job.  Odds are if there's something wrong it's in the input data.
   */
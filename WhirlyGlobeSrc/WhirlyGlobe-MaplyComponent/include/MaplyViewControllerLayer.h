@@ -20,6 +20,20 @@
 
 #import <Foundation/Foundation.h>
 
+/// How badly shedMemory: needs memory back.  Moderate keeps recently used
+///  tile data around; critical drops everything that can be rebuilt.
+typedef enum {MaplyMemoryPressureModerate,MaplyMemoryPressureCritical} MaplyMemoryPressureSeverity;
+
+/** @brief Protocol for objects that can give memory back under pressure.
+    @details Layers that implement this get a call from the view controller's shedMemory: when the system is running low, as do any objects the app registers with addMemoryShedder:.  Drop whatever you can rebuild on demand and keep anything you can't.
+  */
+@protocol MaplyMemoryShedder <NSObject>
+
+/// @brief Drop reconstructible state appropriate to the given severity.
+- (void)shedMemory:(MaplyMemoryPressureSeverity)severity;
+
+@end
+
 /** @brief The View Controller Layer is a base class for other display layers.
     @details You don't create these directory.  This is a base class for things like the MaplyQuadPagingLayer and the MaplyQuadImageTilesLayer.
   */
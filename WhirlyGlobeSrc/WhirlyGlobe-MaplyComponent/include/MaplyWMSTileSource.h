@@ -157,6 +157,22 @@
 /// If set, we'll cache the images locally (a good idea with WMS)
 @property (nonatomic) NSString *cacheDir;
 
+/// Number of seconds we'll consider a cached tile good for.
+/// Past that we'll ask the server whether it's still current (using the
+///  ETag or Last-Modified it came with) before downloading it again.
+/// The default is 0, meaning cached tiles are good forever.
+@property (nonatomic) int cachedFileLifetime;
+
+/** If set, we'll ask the server for one bigger image covering a
+    2^superTileLevels by 2^superTileLevels block of tiles and slice it
+    up ourselves, rather than issuing a GetMap request per tile.  On a
+    slow server that cuts the time spent on round trips way down.
+    The sliced up tiles land in the local cache, so this does nothing
+    unless cacheDir is set.  Check the server's maximum image size
+    before turning it up.
+  */
+@property (nonatomic) int superTileLevels;
+
 /** Initialize with the parameters the WMS server is going to want.
     @param baseURL The main URL we'll use to construct queries.
     @param cap The capabilities as parsed from the service.
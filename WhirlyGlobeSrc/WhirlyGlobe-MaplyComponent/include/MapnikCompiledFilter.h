@@ -0,0 +1,38 @@
+/*
+ *  MapnikCompiledFilter.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+
+/** @brief A Mapnik filter predicate compiled down to a flat program.
+    @details The style rules build one of these when the style loads.  The predicate tree is flattened into postfix comparison and boolean ops, so running a feature through it is one C loop rather than a trip through the NSPredicate machinery per feature per tile.
+    @details Filters using anything beyond attribute/constant comparisons and AND/OR/NOT don't compile.  Check valid and fall back to the NSPredicate for those.
+  */
+@interface MapnikCompiledFilter : NSObject
+
+/// @brief Compile the given predicate.  Check valid afterward.
+- (instancetype)initWithPredicate:(NSPredicate *)predicate;
+
+/// @brief Set if the predicate compiled cleanly.  If not, evaluate: always returns NO and the caller should use the original predicate.
+@property (nonatomic, readonly) bool valid;
+
+/// @brief Run a feature's attributes through the compiled program.
+- (BOOL)evaluate:(NSDictionary *)attributes;
+
+@end
@@ -20,10 +20,16 @@
 
 #import <Foundation/Foundation.h>
 
+@class MapnikCompiledFilter;
+
 @interface MapnikStyleRule : NSObject
 
 @property (nonatomic, strong) NSPredicate *filterPredicate;
 
+//Compiled form of filterPredicate, when the filter is simple enough to
+// compile.  The style set evaluates this instead in the tile parse loop.
+@property (nonatomic, strong, readonly) MapnikCompiledFilter *compiledFilter;
+
 @property (nonatomic, assign) NSUInteger minScaleDenominator;
 @property (nonatomic, assign) NSUInteger maxScaleDenomitator;
 @property (nonatomic, assign) NSUInteger minZoom;
@@ -20,6 +20,41 @@
 
 #import <Foundation/Foundation.h>
 
+/** Streaming zlib inflater.  Holds on to its zlib context and output
+    buffer between streams, so decompressing tile after tile doesn't
+    re-allocate the inflate window or grow a fresh buffer every time.
+    The output buffer is pre-sized from how big recent streams have
+    been running.
+    You can feed the compressed data in pieces and consume what's been
+    inflated so far between feeds, so parsing can start before the
+    whole tile is decompressed.
+    Not thread safe; use inflaterForThread to get the calling thread's own.
+  */
+@interface MaplyStreamingInflater : NSObject
+
+/// The calling thread's inflater.  Created on first use.
++ (MaplyStreamingInflater *)inflaterForThread;
+
+/// Get ready for a new compressed stream
+- (void)reset;
+
+/// Feed in the next piece of compressed data.  Returns NO on a stream error.
+- (BOOL)feedData:(const void *)bytes length:(NSUInteger)length;
+
+/// Bytes inflated so far.  Valid until the next feed, reset, or inflateData call.
+- (const void *)inflatedBytes;
+
+/// Number of bytes inflated so far
+- (NSUInteger)inflatedLength;
+
+/// True once we've seen the end of the stream
+- (BOOL)isDone;
+
+/// Inflate a whole buffer in one shot.  Returns nil if it wasn't a valid stream.
+- (NSData *)inflateData:(NSData *)data;
+
+@end
+
 /** The NSData zlib category adds compress and uncompress methods to
     NSData.
   */
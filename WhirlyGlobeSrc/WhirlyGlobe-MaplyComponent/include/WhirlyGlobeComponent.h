@@ -29,6 +29,7 @@
 #import <MaplySticker.h>
 #import <MaplyBillboard.h>
 #import <MaplyVectorObject.h>
+#import <MaplyVectorAttributeIndex.h>
 #import <MaplyViewTracker.h>
 #import <MaplyViewController.h>
 #import <WhirlyGlobeViewController.h>
@@ -42,6 +43,7 @@
 #import <MaplyGDALRetileSource.h>
 #import <MaplyMultiplexTileSource.h>
 #import <MaplyRemoteTileSource.h>
+#import <MaplyRegionDownloader.h>
 #import <MaplyAnimationTestTileSource.h>
 #import <MaplyPagingVectorTestTileSource.h>
 #import <MaplyElevationSource.h>
@@ -260,6 +260,15 @@
  */
 - (bool)animateToPosition:(MaplyCoordinate)newPos onScreen:(CGPoint)loc time:(NSTimeInterval)howLong;
 
+/** @brief Fly to the given position along a great circle, rising and then settling to the given height.
+    @details This animates position and height together, following the great circle between here and newPos and rising to peakHeight along the way.  It's the standard flight style for a tour between stops.  The path is precomputed when you call this, so the per frame cost is small.
+    @param newPos The geographic position (lon/lat in radians) to fly to.
+    @param height The viewer height above the globe when we arrive.
+    @param peakHeight How high to rise in the middle of the path.  If it's lower than the start or end height we just interpolate the heights instead.
+    @param howLong How long in seconds to take getting there.
+ */
+- (void)animateAlongGreatCircle:(MaplyCoordinate)newPos height:(float)height peakHeight:(float)peakHeight time:(NSTimeInterval)howLong;
+
 /** @brief Animate with a delegate over time.
     @details Fill in the WhirlyGlobeViewControllerAnimationDelegate and you can control the visual view on a frame by frame basis.  You'll get called back at the appropriate time on the main thread over the time period.
     @details You'll also be called one at the end of the animation to establish the final position.
@@ -20,7 +20,9 @@
 
 #import <Foundation/Foundation.h>
 #import <set>
+#import <map>
 #import <WhirlyGlobe.h>
+#import "DynamicDrawableAtlas.h"
 #import "MaplyComponentObject_private.h"
 #import "SelectObject_private.h"
 #import "ImageTexture_private.h"
@@ -49,17 +51,28 @@
     pthread_mutex_t userLock;
     // Component objects created for the user
     NSMutableSet *userObjects;
+
+    pthread_mutex_t consolidationLock;
+    // Shared big drawable atlases for consolidated geometry (kMaplyConsolidate),
+    //  one per shader program and vertex layout
+    std::map<std::pair<WhirlyKit::SimpleIdentity,int>,WhirlyKit::DynamicDrawableAtlas *> consolidationAtlases;
 }
 
 // Note: Not a great idea to be passing this in
 @property (nonatomic,weak) UIView * glView;
 
+// Scene graph layer for level of detail groups, owned by the view controller
+@property (nonatomic,weak) WhirlyKitSceneGraphLayer *sceneGraphLayer;
+
 // Initialize with the view we'll be using
 - (id)initWithView:(WhirlyKitView *)visualView;
 
 // Add screen space (2D) markers
 - (MaplyComponentObject *)addScreenMarkers:(NSArray *)markers desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode;
 
+// Update screen marker positions (and optionally colors) in place
+- (void)updateScreenMarkers:(MaplyComponentObject *)compObj positions:(MaplyCoordinate *)positions colors:(NSArray *)colors numMarkers:(int)numMarkers mode:(MaplyThreadMode)threadMode;
+
 // Add 3D markers
 - (MaplyComponentObject *)addMarkers:(NSArray *)markers desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode;
 
@@ -99,6 +112,9 @@
 // Add billboards
 - (MaplyComponentObject *)addBillboards:(NSArray *)billboards desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode;
 
+// Group level of detail versions of existing objects under scene graph control
+- (MaplyComponentObject *)addLODGroup:(NSArray *)levels center:(MaplyCoordinate)center switchDists:(NSArray *)switchDists mode:(MaplyThreadMode)threadMode;
+
 // Remove objects associated with the user objects
 - (void)removeObjects:(NSArray *)userObjs mode:(MaplyThreadMode)threadMode;
 
@@ -114,12 +130,19 @@
 // Explicitly remove a texture
 - (void)removeTexture:(MaplyTexture *)texture;
 
+// Swap new image data into an existing texture without reallocating it
+- (void)updateTexture:(MaplyTexture *)texture image:(UIImage *)image mode:(MaplyThreadMode)threadMode;
+
 // Start collecting changes for this thread
 - (void)startChanges;
 
 // Flush out outstanding changes for this thread
 - (void)endChanges;
 
+// Run the block on the layer thread after everything submitted ahead
+//  of it with MaplyThreadAny has been processed
+- (void)addCompletion:(void (^)(void))block;
+
 ///// Internal routines.  Don't ever call these outside of the layer thread.
 
 // An internal routine to add an image to our local UIImage/ID cache
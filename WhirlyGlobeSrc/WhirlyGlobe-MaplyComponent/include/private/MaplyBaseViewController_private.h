@@ -40,6 +40,7 @@
     
     WhirlyKitLayerThread *baseLayerThread;
     WhirlyKitLayoutLayer *layoutLayer;
+    WhirlyKitSceneGraphLayer *sceneGraphLayer;
     NSMutableArray *layerThreads;
 
     // Our own interaction layer does most of the work
@@ -53,6 +54,9 @@
     
     // List of annotations we're tracking for location
     NSMutableArray *annotations;
+
+    // Objects the app registered to be called when we shed memory
+    NSMutableArray *memoryShedders;
         
     // General rendering and other display hints
     NSDictionary *hints;
@@ -104,6 +108,10 @@
 /// For loading the Maply or Globe view.  The subclasses call this, but you shouldn't
 - (WhirlyKit::Scene *) loadSetup_scene;
 
+/// Called instead of loadSetup_scene when we're sharing another view
+///  controller's scene.  The subclasses stash their typed pointer here.
+- (void) loadSetup_sharedScene:(WhirlyKit::Scene *)theScene;
+
 /// Override this to set up the default lighting scheme (e.g. the shaders).
 /// The base class provides an adequate default
 - (void) loadSetup_lighting;
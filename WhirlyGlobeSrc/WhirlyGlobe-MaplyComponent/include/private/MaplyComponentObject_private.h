@@ -38,6 +38,8 @@
 @property (nonatomic,assign) WhirlyKit::SimpleIDSet &chunkIDs;
 @property (nonatomic,assign) WhirlyKit::SimpleIDSet &loftIDs;
 @property (nonatomic,assign) WhirlyKit::SimpleIDSet &billIDs;
+@property (nonatomic,assign) WhirlyKit::SimpleIDSet &lodIDs;
+@property (nonatomic,assign) WhirlyKit::SimpleIDSet &consolidatedIDs;
 @property (nonatomic,assign) WhirlyKit::SimpleIDSet &selectIDs;
 @property (nonatomic,assign) std::set<MaplyTexture *> &textures;
 @property (nonatomic,strong) NSArray *vectors;
@@ -20,7 +20,7 @@
 
 #import <vector>
 #import <set>
-#import "AFHTTPRequestOperation.h"
+#import "MaplyTileFetchEngine_private.h"
 
 namespace Maply
 {
@@ -28,7 +28,7 @@ namespace Maply
 class TileFetchOp
 {
 public:
-    TileFetchOp(MaplyTileID tileID) : tileID(tileID), op(nil) { }
+    TileFetchOp(MaplyTileID tileID) : tileID(tileID), request(nil) { }
     
     bool operator < (const TileFetchOp &that) const
     {
@@ -43,7 +43,7 @@ public:
     }
     
     MaplyTileID tileID;
-    AFHTTPRequestOperation *op;
+    MaplyTileFetchRequest *request;
 };
 typedef std::set<TileFetchOp> TileFetchOpSet;
 }
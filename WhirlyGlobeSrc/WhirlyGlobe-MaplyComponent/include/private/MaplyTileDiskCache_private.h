@@ -0,0 +1,71 @@
+/*
+ *  MaplyTileDiskCache_private.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import "MaplyTileSource.h"
+
+/** Packed tile cache living in a single append-only file per cache
+    directory, with an in-memory index keyed by (level,x,y).  Lookups
+    don't touch the file system at all unless they hit, which matters
+    once you've got a couple hundred thousand tiles cached and the
+    per-file version spends its time in stat().
+    The file is compacted in the background when enough of it is dead
+    records or when it blows past the byte budget; eviction is least
+    recently used.
+  */
+typedef enum {MaplyTileCacheCompressionNone=0,MaplyTileCacheCompressionLZ4} MaplyTileCacheCompression;
+
+@interface MaplyTileDiskCache : NSObject
+
+/// Most bytes we'll keep around before evicting old tiles.  256MB by default.
+@property (nonatomic) long long maxCacheSize;
+
+/// Compress tiles on the way in.  Off by default; LZ4 is the one to
+///  use for elevation or vector tiles, where decompressing beats
+///  reading the extra bytes.  Already compressed images won't shrink,
+///  and those get stored raw.  Reads handle either transparently.
+@property (nonatomic) MaplyTileCacheCompression compression;
+
+/// There's one cache object per directory, shared between tile sources.
++ (MaplyTileDiskCache *)diskCacheForDir:(NSString *)dir;
+
+/// Return the data for a tile, or nil if it's not here (or older than maxAge).
+/// Pass 0 for maxAge if you don't care how old it is.
+- (NSData *)dataForTile:(MaplyTileID)tileID maxAge:(int)maxAge;
+
+/// Check for a tile without reading it.  No file system calls involved.
+- (bool)hasTile:(MaplyTileID)tileID maxAge:(int)maxAge;
+
+/// Add (or replace) the data for a tile.
+- (void)setData:(NSData *)data forTile:(MaplyTileID)tileID;
+
+/// Add (or replace) the data for a tile, keeping the HTTP validators
+///  the server sent with it for conditional refetches later.
+- (void)setData:(NSData *)data forTile:(MaplyTileID)tileID etag:(NSString *)etag lastModified:(NSString *)lastModified;
+
+/// Fetch the validators stored with a tile, if there are any.
+/// Either out parameter can be NULL if you only want the other.
+- (bool)validatorsForTile:(MaplyTileID)tileID etag:(NSString **)etag lastModified:(NSString **)lastModified;
+
+/// Mark a tile as freshly validated (the server said 304) without
+///  rewriting its data.  Resets the clock for lifetime checks.
+- (void)touchTile:(MaplyTileID)tileID;
+
+@end
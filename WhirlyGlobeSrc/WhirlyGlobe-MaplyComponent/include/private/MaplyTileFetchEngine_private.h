@@ -0,0 +1,78 @@
+/*
+ *  MaplyTileFetchEngine_private.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+
+/** One caller's interest in a URL.  Hand it back to the engine to
+    cancel.  Several of these may share a single network operation.
+  */
+@interface MaplyTileFetchRequest : NSObject
+@end
+
+/** Shared fetch engine the remote tile sources run their requests
+    through.  It keeps one operation queue per host, so connections
+    get reused instead of set up fresh for every tile, caps the number
+    of simultaneous requests per host, and coalesces requests for the
+    same URL (two layers on the same basemap turn into one fetch).
+    Queued requests are reordered by priority.
+    Transient failures (transport errors and 5xx answers) are retried a
+    few times with exponential backoff and jitter before the failure
+    block fires, and a host that keeps failing gets throttled to a
+    single probe connection until it answers again.
+  */
+@interface MaplyTileFetchEngine : NSObject
+
+/// Maximum simultaneous requests to any one host.  8 by default.
+@property (nonatomic) int maxConnectionsPerHost;
+
+/// Goodput below this (bytes per second) counts as constrained.
+/// 96KB/s by default, about where a small tile paints the screen
+///  meaningfully sooner than a retina one.
+@property (nonatomic) double constrainedBytesPerSec;
+
+/// Smoothed goodput over recent fetches, in bytes per second.
+/// Queue wait counts on purpose; it's the delay the screen sees.
+- (double)goodput;
+
+/// True once we've seen enough fetches to judge and the goodput is
+///  below the constrained threshold.  Tile sources that can serve a
+///  smaller variant check this per fetch.
+- (bool)bandwidthConstrained;
+
+/// There's a single shared engine, so every tile source gets the same pools.
++ (MaplyTileFetchEngine *)sharedEngine;
+
+/// Start (or join) a fetch for the given URL.  Lower priority values
+///  jump the queue; tile sources pass the tile level so coarse tiles,
+///  which everything else waits on, go out first.
+/// The blocks are called on a global concurrent queue.
+- (MaplyTileFetchRequest *)startFetch:(NSURLRequest *)urlReq priority:(int)priority success:(void (^)(NSData *imgData))success failure:(void (^)(NSError *error))failure;
+
+/// Same, but the success block also gets the response headers (for
+///  ETag and Last-Modified), and a 304 to a conditional request
+///  (If-None-Match / If-Modified-Since already set on urlReq) comes
+///  back through notModified instead of being treated as an error.
+- (MaplyTileFetchRequest *)startFetch:(NSURLRequest *)urlReq priority:(int)priority success:(void (^)(NSData *imgData,NSDictionary *headers))success notModified:(void (^)(void))notModified failure:(void (^)(NSError *error))failure;
+
+/// Cancel a single caller's interest.  The network operation is only
+///  cancelled when no one else wants the URL.
+- (void)cancelFetch:(MaplyTileFetchRequest *)request;
+
+@end
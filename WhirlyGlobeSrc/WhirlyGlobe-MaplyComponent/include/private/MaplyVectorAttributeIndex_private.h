@@ -0,0 +1,32 @@
+/*
+ *  MaplyVectorAttributeIndex_private.h
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "MaplyVectorAttributeIndex.h"
+#import <WhirlyGlobe.h>
+
+@interface MaplyVectorAttributeIndex()
+
+// These return the shape IDs instead of wrapping the features back up
+//  in MaplyVectorObjects.  Selection and styling work in IDs, so they
+//  can use the results directly.
+- (void)shapeIDsWithAttribute:(NSString *)attrName value:(id)value ids:(WhirlyKit::SimpleIDSet &)idSet;
+- (void)shapeIDsWithAttribute:(NSString *)attrName min:(double)minVal max:(double)maxVal ids:(WhirlyKit::SimpleIDSet &)idSet;
+
+@end
@@ -43,6 +43,8 @@ public:
 
 // Construct a vector object from the Vector DB raw format
 + (MaplyVectorObject *)VectorObjectFromVectorDBRaw:(NSData *)data;
+// Construct a vector object from the Vector DB binary paged format (WGVB)
++ (MaplyVectorObject *)VectorObjectFromVectorDBBinary:(NSData *)data;
 - (void)addShape:(WhirlyKit::VectorShapeRef)shape;
 
 @end
@@ -26,6 +26,7 @@
 #import "GlobeDoubleTapDelegate.h"
 #import "GlobeTwoFingerTapDelegate.h"
 #import "GlobeDoubleTapDragDelegate.h"
+#import "GlobeAnimatePath.h"
 
 /// This is the private interface to WhirlyGlobeViewController.
 /// Only pull this in if you're subclassing
@@ -43,7 +44,8 @@
     PanDelegateFixed *panDelegate;
     WhirlyGlobeTapDelegate *tapDelegate;
     WhirlyGlobeRotateDelegate *rotateDelegate;
-    AnimateViewRotation *animateRotation;    
+    AnimateViewRotation *animateRotation;
+    WhirlyGlobeAnimateViewPath *animatePath;
     WhirlyGlobeDoubleTapDelegate *doubleTapDelegate;
     WhirlyGlobeTwoFingerTapDelegate *twoFingerTapDelegate;
     WhirlyGlobeDoubleTapDragDelegate *doubleTapDragDelegate;
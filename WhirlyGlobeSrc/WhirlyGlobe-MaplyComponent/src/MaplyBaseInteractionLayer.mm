@@ -32,10 +32,18 @@
 #import "MaplySharedAttributes.h"
 #import "MaplyCoordinateSystem_private.h"
 #import "MaplyTexture_private.h"
+#import "ContentionTracker.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
 
+// Buffer sizes for the consolidation atlases (kMaplyConsolidate)
+static const int ConsolidationElementSize = sizeof(GLushort);
+static const int ConsolidationVertexBytes = 1024*1024;
+static const int ConsolidationElementBytes = 512*1024;
+
+typedef std::map<std::pair<SimpleIdentity,int>,DynamicDrawableAtlas *> ConsolidationAtlasMap;
+
 // Sample a great circle and throw in an interpolated height at each point
 void SampleGreatCircle(MaplyCoordinate startPt,MaplyCoordinate endPt,float height,std::vector<Point3f> &pts,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,float eps)
 {
@@ -166,6 +174,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     pthread_mutex_init(&imageLock, NULL);
     pthread_mutex_init(&userLock, NULL);
     pthread_mutex_init(&changeLock,NULL);
+    pthread_mutex_init(&consolidationLock,NULL);
     
     return self;
 }
@@ -176,6 +185,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     pthread_mutex_destroy(&imageLock);
     pthread_mutex_destroy(&userLock);
     pthread_mutex_destroy(&changeLock);
+    pthread_mutex_destroy(&consolidationLock);
     
     for (ThreadChangeSet::iterator it = perThreadChanges.begin();
          it != perThreadChanges.end();++it)
@@ -198,6 +208,18 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
 
 - (void)shutdown
 {
+    ChangeSet changes;
+    pthread_mutex_lock(&consolidationLock);
+    for (ConsolidationAtlasMap::iterator it = consolidationAtlases.begin();it != consolidationAtlases.end();++it)
+    {
+        it->second->shutdown(changes);
+        delete it->second;
+    }
+    consolidationAtlases.clear();
+    pthread_mutex_unlock(&consolidationLock);
+    if (!changes.empty())
+        [layerThread addChangeRequests:changes];
+
     layerThread = nil;
     scene = NULL;
     imageTextures.clear();
@@ -207,7 +229,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
 // Explicitly add a texture
 - (MaplyTexture *)addTexture:(UIImage *)image imageFormat:(MaplyQuadImageFormat)imageFormat wrapFlags:(int)wrapFlags mode:(MaplyThreadMode)threadMode
 {
-    pthread_mutex_lock(&imageLock);
+    WK_MUTEX_LOCK(&imageLock,"MaplyBaseInteractionLayer::imageLock");
     
     // Look for an existing one
     MaplyImageTexture maplyImageTex;
@@ -289,6 +311,23 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     [texture clear];
 }
 
+// Swap new image data into an existing texture
+- (void)updateTexture:(MaplyTexture *)texture image:(UIImage *)image mode:(MaplyThreadMode)threadMode
+{
+    if (!texture || texture.texID == EmptyIdentity || !image)
+        return;
+
+    // Pull the raw data out here so the render thread doesn't have to
+    unsigned int width,height;
+    NSData *rawData = [image rawDataRetWidth:&width height:&height roundUp:true];
+    if (!rawData)
+        return;
+
+    ChangeSet changes;
+    changes.push_back(new UpdateTextureReq(texture.texID,rawData));
+    [self flushChanges:changes mode:threadMode];
+}
+
 - (MaplyTexture *)addImage:(id)image imageFormat:(MaplyQuadImageFormat)imageFormat mode:(MaplyThreadMode)threadMode
 {
     return [self addImage:image imageFormat:imageFormat wrapFlags:MaplyImageWrapNone mode:threadMode];
@@ -306,7 +345,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
 // Remove an image for the cache, or just decrement its reference count
 - (void)removeImageTexture:(MaplyTexture *)tex;
 {
-    pthread_mutex_lock(&imageLock);
+    WK_MUTEX_LOCK(&imageLock,"MaplyBaseInteractionLayer::imageLock");
     
     // Look for an existing one
     MaplyImageTextureSet::iterator it = imageTextures.find(tex);
@@ -346,7 +385,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     {
         case MaplyThreadCurrent:
         {
-            pthread_mutex_lock(&changeLock);
+            WK_MUTEX_LOCK(&changeLock,"MaplyBaseInteractionLayer::changeLock");
 
             // We might be journaling changes, so let's check
             NSThread *currentThread = [NSThread currentThread];
@@ -372,9 +411,129 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     }
 }
 
+// Push any outstanding consolidation atlas updates through.
+// Call with the consolidation lock held.
+- (void)swapConsolidationAtlases:(ChangeSet &)changes
+{
+    for (ConsolidationAtlasMap::iterator it = consolidationAtlases.begin();it != consolidationAtlases.end();++it)
+    {
+        DynamicDrawableAtlas *atlas = it->second;
+        if (atlas->hasUpdates() && !atlas->waitingOnSwap())
+        {
+            atlas->swap(changes,self,@selector(wakeUpConsolidation));
+            atlas->clearUpdateFlag();
+        }
+    }
+}
+
+// Called on the main thread when a buffer swap lands.  Anything that piled
+//  up while the swap was in flight gets its own swap now.
+- (void)wakeUpConsolidation
+{
+    if ([NSThread currentThread] != layerThread)
+    {
+        [self performSelector:@selector(wakeUpConsolidation) onThread:layerThread withObject:nil waitUntilDone:NO];
+        return;
+    }
+
+    ChangeSet changes;
+    pthread_mutex_lock(&consolidationLock);
+    [self swapConsolidationAtlases:changes];
+    pthread_mutex_unlock(&consolidationLock);
+    if (!changes.empty())
+        [layerThread addChangeRequests:changes];
+}
+
+// Divert freshly built triangle drawables into the shared consolidation
+//  atlases.  We pick the adds out of the change set a manager just
+//  generated, before the originals ever reach the scene, since their
+//  CPU side geometry is freed on GL setup.  Anything the atlas won't
+//  take (lines, instances, oversized drawables) falls through untouched.
+- (void)consolidateDrawables:(ChangeSet &)changes forObject:(MaplyComponentObject *)compObj
+{
+    pthread_mutex_lock(&consolidationLock);
+
+    // The atlas appends its own adds as we go, so only look at what's here now
+    size_t numChanges = changes.size();
+    for (unsigned int ii=0;ii<numChanges;ii++)
+    {
+        AddDrawableReq *addReq = dynamic_cast<AddDrawableReq *>(changes[ii]);
+        if (!addReq)
+            continue;
+        BasicDrawable *draw = dynamic_cast<BasicDrawable *>(addReq->getDrawable());
+        // Only plain triangle drawables.  The drawable subclasses have
+        //  their own draw side logic a big drawable wouldn't run.
+        if (!draw || draw->getType() != GL_TRIANGLES || dynamic_cast<WideVectorDrawable *>(draw))
+            continue;
+
+        // One atlas per shader program and vertex layout
+        std::pair<SimpleIdentity,int> key(draw->getProgram(),draw->singleVertexSize());
+        DynamicDrawableAtlas *atlas = NULL;
+        ConsolidationAtlasMap::iterator it = consolidationAtlases.find(key);
+        if (it != consolidationAtlases.end())
+            atlas = it->second;
+        else {
+            atlas = new DynamicDrawableAtlas("Consolidated Geometry",ConsolidationElementSize,ConsolidationVertexBytes,ConsolidationElementBytes,scene->getMemManager(),NULL,draw->getProgram());
+            consolidationAtlases[key] = atlas;
+        }
+
+        if (atlas->addDrawable(draw,changes,compObj.enable))
+        {
+            // The atlas copied the data out, so the original never goes
+            //  to the scene.  The managers keep issuing requests against
+            //  its ID, which the scene shrugs off.
+            @synchronized(compObj)
+            {
+                compObj.consolidatedIDs.insert(draw->getId());
+            }
+            delete changes[ii];
+            changes[ii] = NULL;
+        }
+    }
+
+    // Clear out the adds we stole
+    ChangeSet keptChanges;
+    keptChanges.reserve(changes.size());
+    for (unsigned int ii=0;ii<changes.size();ii++)
+        if (changes[ii])
+            keptChanges.push_back(changes[ii]);
+    changes.swap(keptChanges);
+
+    [self swapConsolidationAtlases:changes];
+
+    pthread_mutex_unlock(&consolidationLock);
+}
+
+// Flip consolidated drawables on or off in whichever atlas holds them
+- (void)enableConsolidated:(SimpleIDSet &)drawIDs enable:(bool)enable changes:(ChangeSet &)changes
+{
+    pthread_mutex_lock(&consolidationLock);
+
+    for (SimpleIDSet::iterator dit = drawIDs.begin();dit != drawIDs.end();++dit)
+        for (ConsolidationAtlasMap::iterator it = consolidationAtlases.begin();it != consolidationAtlases.end();++it)
+            it->second->setEnableDrawable(*dit,enable);
+    [self swapConsolidationAtlases:changes];
+
+    pthread_mutex_unlock(&consolidationLock);
+}
+
+// Pull consolidated drawables back out of their atlases
+- (void)removeConsolidated:(SimpleIDSet &)drawIDs changes:(ChangeSet &)changes
+{
+    pthread_mutex_lock(&consolidationLock);
+
+    for (SimpleIDSet::iterator dit = drawIDs.begin();dit != drawIDs.end();++dit)
+        for (ConsolidationAtlasMap::iterator it = consolidationAtlases.begin();it != consolidationAtlases.end();++it)
+            if (it->second->removeDrawable(*dit,changes))
+                break;
+    [self swapConsolidationAtlases:changes];
+
+    pthread_mutex_unlock(&consolidationLock);
+}
+
 - (void)startChanges
 {
-    pthread_mutex_lock(&changeLock);
+    WK_MUTEX_LOCK(&changeLock,"MaplyBaseInteractionLayer::changeLock");
 
     // Look for changes in the current thread
     NSThread *currentThread = [NSThread currentThread];
@@ -389,7 +548,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
 
 - (void)endChanges
 {
-    pthread_mutex_lock(&changeLock);
+    WK_MUTEX_LOCK(&changeLock,"MaplyBaseInteractionLayer::changeLock");
 
     // Look for outstanding changes
     NSThread *currentThread = [NSThread currentThread];
@@ -405,6 +564,23 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     pthread_mutex_unlock(&changeLock);
 }
 
+// Runs on the layer thread
+- (void)runCompletion:(void (^)(void))block
+{
+    block();
+}
+
+- (void)addCompletion:(void (^)(void))block
+{
+    if (!layerThread)
+        return;
+
+    // The layer thread works its perform queue off in order, so by the
+    //  time this runs, every add or remove submitted with MaplyThreadAny
+    //  before it has been processed
+    [self performSelector:@selector(runCompletion:) onThread:layerThread withObject:[block copy] waitUntilDone:NO];
+}
+
 // We can refer to shaders by ID or by name.  Figure that out.
 - (void)resolveShader:(NSMutableDictionary *)inDesc
 {
@@ -483,7 +659,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         
         if (marker.selectable)
         {
-            pthread_mutex_lock(&selectLock);
+            WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
             selectObjectSet.insert(SelectObject(wgMarker.selectID,marker));
             pthread_mutex_unlock(&selectLock);
             compObj.selectIDs.insert(wgMarker.selectID);
@@ -504,7 +680,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         [self flushChanges:changes mode:threadMode];
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -531,6 +707,77 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     return compObj;
 }
 
+// Actually update the screen markers
+// Called in an unknown thread
+- (void)updateScreenMarkersRun:(NSArray *)argArray
+{
+    MaplyComponentObject *compObj = [argArray objectAtIndex:0];
+    NSData *posData = [argArray objectAtIndex:1];
+    NSArray *colors = [argArray objectAtIndex:2];
+    if ([colors isKindOfClass:[NSNull class]])
+        colors = nil;
+    MaplyThreadMode threadMode = (MaplyThreadMode)[[argArray objectAtIndex:3] intValue];
+
+    @synchronized(compObj)
+    {
+        bool isHere = false;
+        WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
+        isHere = [userObjects containsObject:compObj];
+        pthread_mutex_unlock(&userLock);
+
+        if (!isHere)
+            return;
+
+        // Convert the geographic locations into display space
+        CoordSystemDisplayAdapter *coordAdapter = visualView.coordAdapter;
+        const MaplyCoordinate *positions = (const MaplyCoordinate *)[posData bytes];
+        int numMarkers = (int)([posData length]/sizeof(MaplyCoordinate));
+        std::vector<Point3d> worldLocs(numMarkers);
+        for (unsigned int ii=0;ii<numMarkers;ii++)
+        {
+            Point3d localPt = coordAdapter->getCoordSystem()->geographicToLocal3d(GeoCoord(positions[ii].x,positions[ii].y));
+            worldLocs[ii] = coordAdapter->localToDisplay(localPt);
+        }
+        std::vector<RGBAColor> shapeColors;
+        shapeColors.reserve([colors count]);
+        for (UIColor *color in colors)
+            shapeColors.push_back([color asRGBAColor]);
+
+        MarkerManager *markerManager = (MarkerManager *)scene->getManager(kWKMarkerManager);
+        if (markerManager)
+        {
+            ChangeSet changes;
+            markerManager->updateScreenMarkers(compObj.markerIDs, worldLocs, shapeColors, changes);
+            [self flushChanges:changes mode:threadMode];
+        }
+    }
+}
+
+// Update screen marker positions in place
+- (void)updateScreenMarkers:(MaplyComponentObject *)compObj positions:(MaplyCoordinate *)positions colors:(NSArray *)colors numMarkers:(int)numMarkers mode:(MaplyThreadMode)threadMode
+{
+    if (!compObj || !positions || numMarkers <= 0)
+        return;
+
+    // The caller's array may not outlive the call, so copy
+    NSData *posData = [NSData dataWithBytes:positions length:numMarkers*sizeof(MaplyCoordinate)];
+    NSArray *argArray = @[compObj, posData, (colors ? colors : [NSNull null]), @(threadMode)];
+
+    // If the object is under construction, toss this over to the layer thread
+    if (compObj.underConstruction)
+        threadMode = MaplyThreadAny;
+
+    switch (threadMode)
+    {
+        case MaplyThreadCurrent:
+            [self updateScreenMarkersRun:argArray];
+            break;
+        case MaplyThreadAny:
+            [self performSelector:@selector(updateScreenMarkersRun:) onThread:layerThread withObject:argArray waitUntilDone:NO];
+            break;
+    }
+}
+
 // Actually add the markers.
 // Called in an unknown thread.
 - (void)addMarkersRun:(NSArray *)argArray
@@ -574,7 +821,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         
         if (marker.selectable)
         {
-            pthread_mutex_lock(&selectLock);
+            WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
             selectObjectSet.insert(SelectObject(wgMarker.selectID,marker));
             pthread_mutex_unlock(&selectLock);
             compObj.selectIDs.insert(wgMarker.selectID);
@@ -592,7 +839,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         [self flushChanges:changes mode:threadMode];
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -693,7 +940,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         
         if (label.selectable)
         {
-            pthread_mutex_lock(&selectLock);
+            WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
             selectObjectSet.insert(SelectObject(wgLabel.selectID,label));
             pthread_mutex_unlock(&selectLock);
             compObj.selectIDs.insert(wgLabel.selectID);
@@ -713,7 +960,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             compObj.labelIDs.insert(labelID);
     }
 
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -802,7 +1049,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         
         if (label.selectable)
         {
-            pthread_mutex_lock(&selectLock);
+            WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
             selectObjectSet.insert(SelectObject(wgLabel.selectID,label));
             pthread_mutex_unlock(&selectLock);
             compObj.selectIDs.insert(wgLabel.selectID);
@@ -821,7 +1068,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             compObj.labelIDs.insert(labelID);
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -917,7 +1164,10 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         if (vectorManager)
         {
             ChangeSet changes;
-            SimpleIdentity vecID = vectorManager->addVectors(&shapes, inDesc, changes);
+            SimpleIdentity vecID = vectorManager->addVectors(std::move(shapes), inDesc, changes);
+            // Fold the triangle geometry into the shared big buffers if asked
+            if ([inDesc[kMaplyConsolidate] boolValue])
+                [self consolidateDrawables:changes forObject:compObj];
             [self flushChanges:changes mode:threadMode];
             if (vecID != EmptyIdentity)
                 compObj.vectorIDs.insert(vecID);
@@ -929,7 +1179,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     if (selVal && [selVal boolValue])
         compObj.vectors = vectors;
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1008,7 +1258,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     if (selVal && [selVal boolValue])
         compObj.vectors = vectors;
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1091,7 +1341,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         [self flushChanges:changes mode:threadMode];
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1139,7 +1389,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     @synchronized(vecObj)
     {
         bool isHere = false;
-        pthread_mutex_lock(&userLock);
+        WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
         isHere = [userObjects containsObject:vecObj];
         pthread_mutex_unlock(&userLock);
         
@@ -1236,7 +1486,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             {
                 newSphere.isSelectable = true;
                 newSphere.selectID = Identifiable::genId();
-                pthread_mutex_lock(&selectLock);
+                WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
                 selectObjectSet.insert(SelectObject(newSphere.selectID,sphere));
                 pthread_mutex_unlock(&selectLock);
                 compObj.selectIDs.insert(newSphere.selectID);
@@ -1261,7 +1511,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             {
                 newCyl.isSelectable = true;
                 newCyl.selectID = Identifiable::genId();
-                pthread_mutex_lock(&selectLock);
+                WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
                 selectObjectSet.insert(SelectObject(newCyl.selectID,cyl));
                 pthread_mutex_unlock(&selectLock);
                 compObj.selectIDs.insert(newCyl.selectID);
@@ -1340,7 +1590,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         [self flushChanges:changes mode:threadMode];
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1447,7 +1697,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
         }
     }
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1483,7 +1733,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     @synchronized(stickerObj)
     {
         bool isHere = false;
-        pthread_mutex_lock(&userLock);
+        WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
         isHere = [userObjects containsObject:stickerObj];
         pthread_mutex_unlock(&userLock);
         
@@ -1596,7 +1846,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     }
     [self flushChanges:changes mode:threadMode];
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1662,7 +1912,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             
             if (bill.selectable)
             {
-                pthread_mutex_lock(&selectLock);
+                WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
                 selectObjectSet.insert(SelectObject(wkBill.selectID,bill));
                 pthread_mutex_unlock(&selectLock);
                 compObj.selectIDs.insert(wkBill.selectID);
@@ -1671,16 +1921,14 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
             UIImage *image = bill.image;
             if (image)
             {
-                MaplyTexture *tex = nil;
                 if ([image isKindOfClass:[UIImage class]])
                 {
-                    tex = [self addImage:image imageFormat:MaplyImageIntRGBA mode:threadMode];
+                    // The billboard manager packs images into its own
+                    //  atlas, which batches the whole group together
+                    wkBill.image = image;
                 } else if ([image isKindOfClass:[MaplyTexture class]])
                 {
-                    tex = (MaplyTexture *)image;
-                }
-                if (tex)
-                {
+                    MaplyTexture *tex = (MaplyTexture *)image;
                     compObj.textures.insert(tex);
                     wkBill.texId = tex.texID;
                 }
@@ -1694,7 +1942,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     }
     [self flushChanges:changes mode:threadMode];
     
-    pthread_mutex_lock(&userLock);
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     [userObjects addObject:compObj];
     compObj.underConstruction = false;
     pthread_mutex_unlock(&userLock);
@@ -1720,6 +1968,81 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     return compObj;
 }
 
+// Called in the layer thread
+- (void)addLODGroupRun:(NSArray *)argArray
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+    NSArray *levels = [argArray objectAtIndex:0];
+    MaplyComponentObject *compObj = [argArray objectAtIndex:1];
+    MaplyCoordinate center;
+    [[argArray objectAtIndex:2] getValue:&center];
+    NSArray *switchDists = [argArray objectAtIndex:3];
+    MaplyThreadMode threadMode = (MaplyThreadMode)[[argArray objectAtIndex:4] intValue];
+
+    ShapeManager *shapeManager = (ShapeManager *)scene->getManager(kWKShapeManager);
+    VectorManager *vectorManager = (VectorManager *)scene->getManager(kWKVectorManager);
+
+    Point3f dispPt = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal(GeoCoord(center.x,center.y)));
+
+    ChangeSet changes;
+    SceneGraphGroup *topGroup = new SceneGraphGroup();
+    int numLevels = std::min((int)[levels count],(int)[switchDists count]);
+    for (int ii=0;ii<numLevels;ii++)
+    {
+        MaplyComponentObject *levelObj = [levels objectAtIndex:ii];
+
+        // Gather up the drawables behind the level's geometry
+        SimpleIDSet drawIDs;
+        @synchronized(levelObj)
+        {
+            if (shapeManager && !levelObj.shapeIDs.empty())
+                shapeManager->getDrawIDs(levelObj.shapeIDs, drawIDs);
+            if (vectorManager && !levelObj.vectorIDs.empty())
+                vectorManager->getDrawIDs(levelObj.vectorIDs, drawIDs);
+        }
+        if (drawIDs.empty())
+            continue;
+
+        SceneGraphLOD *lod = new SceneGraphLOD();
+        lod->center = dispPt;
+        lod->switchIn = [[switchDists objectAtIndex:ii] floatValue];
+        lod->switchOut = (ii+1 < numLevels ? [[switchDists objectAtIndex:ii+1] floatValue] : 0.0);
+        SceneGraphGeometry *geom = new SceneGraphGeometry();
+        for (SimpleIDSet::iterator it = drawIDs.begin();it != drawIDs.end();++it)
+        {
+            geom->addDrawable(*it);
+            // The scene graph traversal owns visibility from here on
+            changes.push_back(new OnOffChangeRequest(*it,false));
+        }
+        lod->addChild(geom);
+        topGroup->addChild(lod);
+    }
+
+    compObj.lodIDs.insert(topGroup->getId());
+    [self flushChanges:changes mode:threadMode];
+    [_sceneGraphLayer addSceneFragment:topGroup attachID:EmptyIdentity];
+
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
+    [userObjects addObject:compObj];
+    compObj.underConstruction = false;
+    pthread_mutex_unlock(&userLock);
+}
+
+// Group level of detail versions of existing objects
+- (MaplyComponentObject *)addLODGroup:(NSArray *)levels center:(MaplyCoordinate)center switchDists:(NSArray *)switchDists mode:(MaplyThreadMode)threadMode
+{
+    MaplyComponentObject *compObj = [[MaplyComponentObject alloc] init];
+    compObj.underConstruction = true;
+
+    NSArray *argArray = @[levels, compObj, [NSValue valueWithBytes:&center objCType:@encode(MaplyCoordinate)], switchDists, @(threadMode)];
+    // The scene graph only runs on the layer thread, so everything goes there
+    if ([NSThread currentThread] == layerThread)
+        [self addLODGroupRun:argArray];
+    else
+        [self performSelector:@selector(addLODGroupRun:) onThread:layerThread withObject:argArray waitUntilDone:NO];
+
+    return compObj;
+}
 
 // Remove the object, but do it on the layer thread
 - (void)removeObjectRun:(NSArray *)argArray
@@ -1737,60 +2060,86 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     BillboardManager *billManager = (BillboardManager *)scene->getManager(kWKBillboardManager);
 
     ChangeSet changes;
-        
-    // First, let's make sure we're representing it
+
+    // Sort out which objects we're actually representing, with one trip
+    //  through the lock rather than one per object
+    NSMutableArray *objsHere = [NSMutableArray array];
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     for (MaplyComponentObject *userObj in userObjs)
-    {
-        bool isHere = false;
-        pthread_mutex_lock(&userLock);
-        isHere = [userObjects containsObject:userObj];
-        pthread_mutex_unlock(&userLock);
-        if (isHere)
+        if ([userObjects containsObject:userObj])
         {
-            @synchronized(userObj)
-            {
-                // Get rid of the various layer objects
-                if (markerManager)
-                    markerManager->removeMarkers(userObj.markerIDs, changes);
-                if (labelManager)
-                    labelManager->removeLabels(userObj.labelIDs, changes);
-                if (vectorManager)
-                    vectorManager->removeVectors(userObj.vectorIDs, changes);
-                if (wideVectorManager)
-                    wideVectorManager->removeVectors(userObj.wideVectorIDs, changes);
-                if (shapeManager)
-                    shapeManager->removeShapes(userObj.shapeIDs, changes);
-                if (loftManager)
-                    loftManager->removeLoftedPolys(userObj.loftIDs, changes);
-                if (chunkManager)
-                    chunkManager->removeChunks(userObj.chunkIDs, changes);
-                if (billManager)
-                    billManager->removeBillboards(userObj.billIDs, changes);
-                
-                // And associated textures
-                userObj.textures.clear();
-
-                // And any references to selection objects
-                pthread_mutex_lock(&selectLock);
-                for (SimpleIDSet::iterator it = userObj.selectIDs.begin();
-                     it != userObj.selectIDs.end(); ++it)
-                {
-                    SelectObjectSet::iterator sit = selectObjectSet.find(SelectObject(*it));
-                    if (sit != selectObjectSet.end())
-                        selectObjectSet.erase(sit);
-                }
-                pthread_mutex_unlock(&selectLock);
-                
-            }
-            
-            pthread_mutex_lock(&userLock);
+            [objsHere addObject:userObj];
             [userObjects removeObject:userObj];
-            pthread_mutex_unlock(&userLock);
-        } else {
+        }
+//        else
 //            NSLog(@"Tried to delete object that doesn't exist");
+    pthread_mutex_unlock(&userLock);
+
+    // The component objects are really just handles on to per manager ID
+    //  sets, so we can union those up and hand each manager a single set.
+    //  That makes the cost of the manager calls (and the selection cleanup)
+    //  per call rather than per object.
+    SimpleIDSet markerIDs,labelIDs,vectorIDs,wideVectorIDs,shapeIDs,loftIDs,chunkIDs,billIDs,lodIDs,selectIDs,consolidatedIDs;
+    for (MaplyComponentObject *userObj in objsHere)
+    {
+        @synchronized(userObj)
+        {
+            markerIDs.insert(userObj.markerIDs.begin(),userObj.markerIDs.end());
+            consolidatedIDs.insert(userObj.consolidatedIDs.begin(),userObj.consolidatedIDs.end());
+            labelIDs.insert(userObj.labelIDs.begin(),userObj.labelIDs.end());
+            vectorIDs.insert(userObj.vectorIDs.begin(),userObj.vectorIDs.end());
+            wideVectorIDs.insert(userObj.wideVectorIDs.begin(),userObj.wideVectorIDs.end());
+            shapeIDs.insert(userObj.shapeIDs.begin(),userObj.shapeIDs.end());
+            loftIDs.insert(userObj.loftIDs.begin(),userObj.loftIDs.end());
+            chunkIDs.insert(userObj.chunkIDs.begin(),userObj.chunkIDs.end());
+            billIDs.insert(userObj.billIDs.begin(),userObj.billIDs.end());
+            lodIDs.insert(userObj.lodIDs.begin(),userObj.lodIDs.end());
+            selectIDs.insert(userObj.selectIDs.begin(),userObj.selectIDs.end());
+
+            // And associated textures
+            userObj.textures.clear();
         }
     }
-    
+
+    // Get rid of the various layer objects
+    if (markerManager && !markerIDs.empty())
+        markerManager->removeMarkers(markerIDs, changes);
+    if (labelManager && !labelIDs.empty())
+        labelManager->removeLabels(labelIDs, changes);
+    if (vectorManager && !vectorIDs.empty())
+        vectorManager->removeVectors(vectorIDs, changes);
+    if (wideVectorManager && !wideVectorIDs.empty())
+        wideVectorManager->removeVectors(wideVectorIDs, changes);
+    if (shapeManager && !shapeIDs.empty())
+        shapeManager->removeShapes(shapeIDs, changes);
+    if (loftManager && !loftIDs.empty())
+        loftManager->removeLoftedPolys(loftIDs, changes);
+    if (chunkManager && !chunkIDs.empty())
+        chunkManager->removeChunks(chunkIDs, changes);
+    if (billManager && !billIDs.empty())
+        billManager->removeBillboards(billIDs, changes);
+    // The scene graph layer marshals this to the layer thread itself.
+    // The drawables belong to the managers above, so this just drops the nodes.
+    for (SimpleIDSet::iterator it = lodIDs.begin();it != lodIDs.end();++it)
+        [_sceneGraphLayer removeSceneFragment:*it];
+    // Consolidated geometry lives in the atlases rather than the scene
+    if (!consolidatedIDs.empty())
+        [self removeConsolidated:consolidatedIDs changes:changes];
+
+    // And any references to selection objects
+    if (!selectIDs.empty())
+    {
+        WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
+        for (SimpleIDSet::iterator it = selectIDs.begin();
+             it != selectIDs.end(); ++it)
+        {
+            SelectObjectSet::iterator sit = selectObjectSet.find(SelectObject(*it));
+            if (sit != selectObjectSet.end())
+                selectObjectSet.erase(sit);
+        }
+        pthread_mutex_unlock(&selectLock);
+    }
+
     [self flushChanges:changes mode:threadMode];
 }
 
@@ -1836,36 +2185,53 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     BillboardManager *billManager = (BillboardManager *)scene->getManager(kWKBillboardManager);
 
     ChangeSet changes;
+
+    // One trip through the lock to sort out which objects are really here
+    NSMutableArray *objsHere = [NSMutableArray array];
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
     for (MaplyComponentObject *compObj in theObjs)
+        if ([userObjects containsObject:compObj])
+            [objsHere addObject:compObj];
+    pthread_mutex_unlock(&userLock);
+
+    // Union the per manager ID sets so each manager sees one call,
+    //  however many objects we were handed
+    SimpleIDSet markerIDs,labelIDs,vectorIDs,wideVectorIDs,shapeIDs,chunkIDs,billIDs,consolidatedIDs;
+    for (MaplyComponentObject *compObj in objsHere)
     {
-        bool isHere = false;
-        pthread_mutex_lock(&userLock);
-        isHere = [userObjects containsObject:compObj];
-        pthread_mutex_unlock(&userLock);
+        compObj.enable = enable;
+        markerIDs.insert(compObj.markerIDs.begin(),compObj.markerIDs.end());
+        labelIDs.insert(compObj.labelIDs.begin(),compObj.labelIDs.end());
+        vectorIDs.insert(compObj.vectorIDs.begin(),compObj.vectorIDs.end());
+        wideVectorIDs.insert(compObj.wideVectorIDs.begin(),compObj.wideVectorIDs.end());
+        shapeIDs.insert(compObj.shapeIDs.begin(),compObj.shapeIDs.end());
+        chunkIDs.insert(compObj.chunkIDs.begin(),compObj.chunkIDs.end());
+        billIDs.insert(compObj.billIDs.begin(),compObj.billIDs.end());
+        consolidatedIDs.insert(compObj.consolidatedIDs.begin(),compObj.consolidatedIDs.end());
+    }
 
-        if (isHere)
-        {
-            compObj.enable = enable;
-            if (vectorManager && !compObj.vectorIDs.empty())
-                vectorManager->enableVectors(compObj.vectorIDs, enable, changes);
-            if (wideVectorManager && !compObj.wideVectorIDs.empty())
-                wideVectorManager->enableVectors(compObj.wideVectorIDs, enable, changes);
-            if (markerManager && !compObj.markerIDs.empty())
-                markerManager->enableMarkers(compObj.markerIDs, enable, changes);
-            if (labelManager && !compObj.labelIDs.empty())
-                labelManager->enableLabels(compObj.labelIDs, enable, changes);
-            if (shapeManager && !compObj.shapeIDs.empty())
-                shapeManager->enableShapes(compObj.shapeIDs, enable, changes);
-            if (billManager && !compObj.billIDs.empty())
-                billManager->enableBillboards(compObj.billIDs, enable, changes);
-            if (chunkManager && !compObj.chunkIDs.empty())
-            {
-                for (SimpleIDSet::iterator it = compObj.chunkIDs.begin();
-                     it != compObj.chunkIDs.end(); ++it)
-                    chunkManager->enableChunk(*it, enable, changes);
-            }
-        }
+    if (vectorManager && !vectorIDs.empty())
+        vectorManager->enableVectors(vectorIDs, enable, changes);
+    if (wideVectorManager && !wideVectorIDs.empty())
+        wideVectorManager->enableVectors(wideVectorIDs, enable, changes);
+    if (markerManager && !markerIDs.empty())
+        markerManager->enableMarkers(markerIDs, enable, changes);
+    if (labelManager && !labelIDs.empty())
+        labelManager->enableLabels(labelIDs, enable, changes);
+    if (shapeManager && !shapeIDs.empty())
+        shapeManager->enableShapes(shapeIDs, enable, changes);
+    if (billManager && !billIDs.empty())
+        billManager->enableBillboards(billIDs, enable, changes);
+    if (chunkManager)
+    {
+        for (SimpleIDSet::iterator it = chunkIDs.begin();
+             it != chunkIDs.end(); ++it)
+            chunkManager->enableChunk(*it, enable, changes);
     }
+    // Consolidated geometry flips in its atlas; the manager requests
+    //  against the original IDs are no-ops
+    if (!consolidatedIDs.empty())
+        [self enableConsolidated:consolidatedIDs enable:enable changes:changes];
 
     [self flushChanges:changes mode:threadMode];
 }
@@ -1938,8 +2304,13 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
     
     pt = [visualView unwrapCoordinate:pt];
     
-    pthread_mutex_lock(&userLock);
-    for (MaplyComponentObject *userObj in userObjects)
+    // Just snapshot the set under the lock.  The point in poly math
+    //  below can run long and the layer threads shouldn't wait on it.
+    WK_MUTEX_LOCK(&userLock,"MaplyBaseInteractionLayer::userLock");
+    NSArray *userObjsToCheck = [userObjects allObjects];
+    pthread_mutex_unlock(&userLock);
+
+    for (MaplyComponentObject *userObj in userObjsToCheck)
     {
         if (userObj.vectors && userObj.isSelectable && userObj.enable)
         {
@@ -1966,8 +2337,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
                 break;
         }
     }
-    pthread_mutex_unlock(&userLock);
-    
+
     return selObj;
 }
 
@@ -1975,7 +2345,7 @@ typedef std::set<ThreadChanges> ThreadChangeSet;
 {
     NSObject *ret = nil;
     
-    pthread_mutex_lock(&selectLock);
+    WK_MUTEX_LOCK(&selectLock,"MaplyBaseInteractionLayer::selectLock");
     SelectObjectSet::iterator sit = selectObjectSet.find(SelectObject(objId));
     if (sit != selectObjectSet.end())
         ret = sit->obj;
@@ -23,6 +23,9 @@
 #import "NSData+Zlib.h"
 #import "MaplyTexture_private.h"
 #import "MaplyAnnotation_private.h"
+#import "MaplyTileMemoryCache.h"
+#import "MaplyIconManager.h"
+#import "WorkRegulator.h"
 #import "NSDictionary+StyleRules.h"
 #import "DDXMLElementAdditions.h"
 #import "NSString+DDXML.h"
@@ -44,8 +47,342 @@ using namespace WhirlyKit;
 
 @end
 
+// Watches the view and writes timestamped camera snapshots to a file
+@interface MaplyViewTraceRecorder : NSObject<WhirlyKitViewWatcherDelegate>
+
+- (id)initWithView:(WhirlyKitView *)view fileName:(NSString *)fileName;
+- (void)stop;
+
+@end
+
+@implementation MaplyViewTraceRecorder
+{
+    WhirlyKitView *view;
+    FILE *fp;
+    NSTimeInterval startTime;
+}
+
+- (id)initWithView:(WhirlyKitView *)inView fileName:(NSString *)fileName
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    fp = fopen([fileName cStringUsingEncoding:NSASCIIStringEncoding],"w");
+    if (!fp)
+        return nil;
+    view = inView;
+    startTime = CFAbsoluteTimeGetCurrent();
+    [view addWatcherDelegate:self];
+    // Write out the state we're starting from
+    [self viewUpdated:view];
+
+    return self;
+}
+
+- (void)viewUpdated:(WhirlyKitView *)inView
+{
+    if (!fp)
+        return;
+
+    NSTimeInterval when = CFAbsoluteTimeGetCurrent() - startTime;
+    if ([inView isKindOfClass:[WhirlyGlobeView class]])
+    {
+        WhirlyGlobeView *globeView = (WhirlyGlobeView *)inView;
+        Eigen::Quaterniond rotQuat = [globeView rotQuat];
+        fprintf(fp,"G %f %.12f %.12f %.12f %.12f %f %f\n",when,rotQuat.x(),rotQuat.y(),rotQuat.z(),rotQuat.w(),globeView.heightAboveGlobe,globeView.tilt);
+    } else if ([inView isKindOfClass:[MaplyView class]])
+    {
+        MaplyView *mapView = (MaplyView *)inView;
+        Point3d loc = mapView.loc;
+        fprintf(fp,"M %f %.12f %.12f %.12f %f\n",when,loc.x(),loc.y(),loc.z(),mapView.rotAngle);
+    }
+}
+
+- (void)stop
+{
+    if (view)
+    {
+        [view removeWatcherDelegate:self];
+        view = nil;
+    }
+    if (fp)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+@end
+
+// One camera snapshot out of a recorded view trace
+typedef struct
+{
+    NSTimeInterval when;
+    bool isGlobe;
+    double vals[6];
+} ViewTraceEntry;
+
+// Reads a view trace back in and applies the snapshots at their recorded offsets
+@interface MaplyViewTraceReplayer : NSObject
+
+@property (nonatomic,copy) void (^completion)(void);
+
+- (id)initWithView:(WhirlyKitView *)view fileName:(NSString *)fileName;
+- (void)start;
+- (void)stop;
+
+@end
+
+@implementation MaplyViewTraceReplayer
+{
+    WhirlyKitView *view;
+    std::vector<ViewTraceEntry> entries;
+    unsigned int entryAt;
+}
+
+- (id)initWithView:(WhirlyKitView *)inView fileName:(NSString *)fileName
+{
+    self = [super init];
+    if (!self)
+        return nil;
+    view = inView;
+
+    FILE *fp = fopen([fileName cStringUsingEncoding:NSASCIIStringEncoding],"r");
+    if (!fp)
+        return nil;
+    char which[2];
+    ViewTraceEntry entry;
+    for (;;)
+    {
+        if (fscanf(fp,"%1s %lf",which,&entry.when) != 2)
+            break;
+        if (which[0] == 'G')
+        {
+            entry.isGlobe = true;
+            if (fscanf(fp,"%lf %lf %lf %lf %lf %lf",&entry.vals[0],&entry.vals[1],&entry.vals[2],&entry.vals[3],&entry.vals[4],&entry.vals[5]) != 6)
+                break;
+        } else if (which[0] == 'M')
+        {
+            entry.isGlobe = false;
+            if (fscanf(fp,"%lf %lf %lf %lf",&entry.vals[0],&entry.vals[1],&entry.vals[2],&entry.vals[3]) != 4)
+                break;
+        } else
+            break;
+        entries.push_back(entry);
+    }
+    fclose(fp);
+    if (entries.empty())
+        return nil;
+
+    return self;
+}
+
+- (void)start
+{
+    entryAt = 0;
+    [self step];
+}
+
+// Apply the next snapshot, then schedule ourselves for the one after
+- (void)step
+{
+    if (!view || entryAt >= entries.size())
+    {
+        if (_completion)
+            _completion();
+        return;
+    }
+
+    const ViewTraceEntry &entry = entries[entryAt];
+    if (entry.isGlobe && [view isKindOfClass:[WhirlyGlobeView class]])
+    {
+        WhirlyGlobeView *globeView = (WhirlyGlobeView *)view;
+        [globeView setRotQuat:Quaterniond(entry.vals[3],entry.vals[0],entry.vals[1],entry.vals[2]) updateWatchers:true];
+        [globeView setHeightAboveGlobe:entry.vals[4] updateWatchers:true];
+        globeView.tilt = entry.vals[5];
+    } else if (!entry.isGlobe && [view isKindOfClass:[MaplyView class]])
+    {
+        MaplyView *mapView = (MaplyView *)view;
+        [mapView setRotAngle:entry.vals[3]];
+        [mapView setLoc:Point3d(entry.vals[0],entry.vals[1],entry.vals[2])];
+    }
+
+    entryAt++;
+    if (entryAt < entries.size())
+    {
+        // Fixed offsets from the trace, so every run loads on the same schedule
+        NSTimeInterval delay = entries[entryAt].when - entry.when;
+        if (delay < 0.0)
+            delay = 0.0;
+        [self performSelector:@selector(step) withObject:nil afterDelay:delay];
+    } else {
+        if (_completion)
+            _completion();
+    }
+}
+
+- (void)stop
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(step) object:nil];
+    view = nil;
+}
+
+@end
+
+// Watches the view height and flips the enables between alternate
+//  representations of the same features.  The representations are built
+//  once up front, so a zoom transition is just an enable/disable.
+@interface MaplyRepresentationSet : NSObject<WhirlyKitViewWatcherDelegate>
+
+- (id)initWithObjects:(NSArray *)compObjs heights:(NSArray *)heights view:(WhirlyKitView *)view viewC:(MaplyBaseViewController *)viewC;
+- (void)shutdown;
+
+@end
+
+@implementation MaplyRepresentationSet
+{
+    MaplyBaseViewController * __weak viewC;
+    WhirlyKitView *view;
+    NSArray *compObjs;
+    NSArray *heights;
+    // Which representation is currently enabled
+    int activeWhich;
+}
+
+- (id)initWithObjects:(NSArray *)inCompObjs heights:(NSArray *)inHeights view:(WhirlyKitView *)inView viewC:(MaplyBaseViewController *)inViewC
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    viewC = inViewC;
+    view = inView;
+    compObjs = inCompObjs;
+    heights = inHeights;
+    activeWhich = -1;
+
+    [view addWatcherDelegate:self];
+    // Sort out the starting state
+    [self viewUpdated:view];
+
+    return self;
+}
+
+- (void)viewUpdated:(WhirlyKitView *)inView
+{
+    // First representation whose switch height is above us
+    double height = [inView heightAboveSurface];
+    int newWhich = 0;
+    while (newWhich < [heights count] && height > [heights[newWhich] doubleValue])
+        newWhich++;
+
+    if (newWhich == activeWhich)
+        return;
+
+    MaplyBaseViewController *theViewC = viewC;
+    if (!theViewC)
+        return;
+
+    // Just flip the enables.  The geometry stays put.
+    NSMutableArray *toDisable = [NSMutableArray array];
+    for (int ii=0;ii<[compObjs count];ii++)
+        if (ii != newWhich)
+            [toDisable addObject:compObjs[ii]];
+    [theViewC enableObjects:@[compObjs[newWhich]] mode:MaplyThreadAny];
+    [theViewC disableObjects:toDisable mode:MaplyThreadAny];
+
+    activeWhich = newWhich;
+}
+
+- (void)shutdown
+{
+    if (view)
+    {
+        [view removeWatcherDelegate:self];
+        view = nil;
+    }
+    compObjs = nil;
+}
+
+@end
+
+@interface MaplyScreenPointSet()<WhirlyKitViewWatcherDelegate>
+
+- (id)initWithCoords:(MaplyCoordinate *)geoCoords numPts:(int)numPts view:(WhirlyKitView *)view viewC:(MaplyBaseViewController *)viewC;
+- (void)shutdown;
+
+@end
+
+@implementation MaplyScreenPointSet
+{
+    MaplyBaseViewController * __weak viewC;
+    WhirlyKitView *view;
+    MaplyCoordinate *geoCoords;
+}
+
+- (id)initWithCoords:(MaplyCoordinate *)inGeoCoords numPts:(int)numPts view:(WhirlyKitView *)inView viewC:(MaplyBaseViewController *)inViewC
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    viewC = inViewC;
+    view = inView;
+    _numPts = numPts;
+    geoCoords = (MaplyCoordinate *)malloc(sizeof(MaplyCoordinate)*numPts);
+    memcpy(geoCoords, inGeoCoords, sizeof(MaplyCoordinate)*numPts);
+    _screenPts = (CGPoint *)malloc(sizeof(CGPoint)*numPts);
+
+    [view addWatcherDelegate:self];
+    // Fill in the starting positions
+    [self viewUpdated:view];
+
+    return self;
+}
+
+- (void)viewUpdated:(WhirlyKitView *)inView
+{
+    MaplyBaseViewController *theViewC = viewC;
+    if (!theViewC)
+        return;
+
+    [theViewC screenPointsFromGeo:geoCoords screenPts:_screenPts numPts:_numPts];
+}
+
+- (void)shutdown
+{
+    if (view)
+    {
+        [view removeWatcherDelegate:self];
+        view = nil;
+    }
+}
+
+- (void)dealloc
+{
+    if (geoCoords)
+        free(geoCoords);
+    if (_screenPts)
+        free(_screenPts);
+}
+
+@end
+
 @implementation MaplyBaseViewController
 {
+    MaplyViewTraceRecorder *viewTraceRecorder;
+    MaplyViewTraceReplayer *viewTraceReplayer;
+    // Active zoom dependent representation sets
+    NSMutableArray *repSets;
+    // Registered point sets we're keeping projected to screen
+    NSMutableArray *pointSets;
+    // Set if the scene belongs to another view controller, so we mustn't delete it
+    bool sceneIsShared;
+    // Scene snapshot being written, if there is one
+    WhirlyKit::SceneSnapshotWriter *sceneSnapshotWriter;
+    // What a loaded scene snapshot put in the scene, so we can pull it back out
+    WhirlyKit::SimpleIDSet snapshotTexIDs,snapshotDrawIDs;
 }
 
 - (void) clear
@@ -57,6 +394,18 @@ using namespace WhirlyKit;
     
     [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(periodicPerfOutput) object:nil];
 
+    [self stopViewTrace];
+    [viewTraceReplayer stop];
+    viewTraceReplayer = nil;
+
+    // An unfinished snapshot just gets dropped
+    if (sceneSnapshotWriter)
+    {
+        scene->setSnapshotWriter(NULL);
+        [baseLayerThread addThingToDelete:sceneSnapshotWriter];
+        sceneSnapshotWriter = NULL;
+    }
+
     [glView stopAnimation];
     
     EAGLContext *oldContext = [EAGLContext currentContext];
@@ -76,7 +425,10 @@ using namespace WhirlyKit;
             [baseLayerThread addThreadToShutdown:layerThread];
         }
 
-        [baseLayerThread addThingToDelete:scene];
+        // A shared scene belongs to the view controller we're a window
+        //  onto, so leave its teardown to them
+        if (!sceneIsShared)
+            [baseLayerThread addThingToDelete:scene];
         [baseLayerThread addThingToRelease:baseLayerThread];
         [baseLayerThread addThingToRelease:visualView];
         [baseLayerThread addThingToRelease:glView];
@@ -92,6 +444,7 @@ using namespace WhirlyKit;
     sceneRenderer = nil;
     baseLayerThread = nil;
     layoutLayer = nil;
+    sceneGraphLayer = nil;
     
     activeObjects = nil;
     
@@ -103,10 +456,19 @@ using namespace WhirlyKit;
         [userLayers removeObject:layer];
     }
     userLayers = nil;
+    memoryShedders = nil;
+
+    for (MaplyRepresentationSet *repSet in repSets)
+        [repSet shutdown];
+    repSets = nil;
+
+    for (MaplyScreenPointSet *pointSet in pointSets)
+        [pointSet shutdown];
+    pointSets = nil;
 
     viewTrackers = nil;
     annotations = nil;
-    
+
     theClearColor = nil;
 }
 
@@ -134,6 +496,10 @@ using namespace WhirlyKit;
     return NULL;
 }
 
+- (void) loadSetup_sharedScene:(WhirlyKit::Scene *)theScene
+{
+}
+
 - (void) loadSetup_lighting
 {
     if (![sceneRenderer isKindOfClass:[WhirlyKitSceneRendererES2 class]])
@@ -185,14 +551,32 @@ using namespace WhirlyKit;
     }
     
     userLayers = [NSMutableArray array];
+    memoryShedders = [NSMutableArray array];
     _threadPerLayer = true;
-    
+
+    // If we're showing another view controller's scene, it has to be
+    //  fully set up already and of the same kind we are
+    MaplyBaseViewController *sharedViewC = _sharedSceneViewC;
+    if (sharedViewC && (![sharedViewC isMemberOfClass:[self class]] || !sharedViewC->scene))
+    {
+        NSLog(@"MaplyBaseViewController: Ignoring sharedSceneViewC.  It must be a fully set up view controller of the same class.");
+        sharedViewC = nil;
+    }
+    sceneIsShared = (sharedViewC != nil);
+
     [self loadSetup_glView];
 
 	// Set up the OpenGL ES renderer
-    sceneRenderer = [[WhirlyKitSceneRendererES3 alloc] init];
-    if (!sceneRenderer)
-        sceneRenderer = [[WhirlyKitSceneRendererES2 alloc] init];
+    if (sharedViewC)
+    {
+        // Join the other view's sharegroup, so we draw its drawables
+        //  and textures rather than duplicating them
+        sceneRenderer = [[[sharedViewC->sceneRenderer class] alloc] initWithSharegroup:sharedViewC->sceneRenderer.context.sharegroup];
+    } else {
+        sceneRenderer = [[WhirlyKitSceneRendererES3 alloc] init];
+        if (!sceneRenderer)
+            sceneRenderer = [[WhirlyKitSceneRendererES2 alloc] init];
+    }
     sceneRenderer.zBufferMode = zBufferOffDefault;
     // Switch to that context for any assets we create
     // Note: Should be switching back at the end
@@ -217,7 +601,17 @@ using namespace WhirlyKit;
     
 	// Need an empty scene and view
     visualView = [self loadSetup_view];
-    scene = [self loadSetup_scene];
+    if (sharedViewC)
+    {
+        scene = sharedViewC->scene;
+        [self loadSetup_sharedScene:scene];
+    } else
+        scene = [self loadSetup_scene];
+    // Compile the default shaders on a worker while we put together
+    //  the layer threads and the view hierarchy.  The first frame
+    //  waits for them if they're not done
+    if ([sceneRenderer isKindOfClass:[WhirlyKitSceneRendererES2 class]])
+        ((WhirlyKitSceneRendererES2 *)sceneRenderer).asyncShaderSetup = true;
     sceneRenderer.scene = scene;
     [self loadSetup_lighting];
     
@@ -225,15 +619,26 @@ using namespace WhirlyKit;
     
     // Need a layer thread to manage the layers
 	baseLayerThread = [[WhirlyKitLayerThread alloc] initWithScene:scene view:visualView renderer:sceneRenderer mainLayerThread:true];
+    if (sharedViewC)
+        baseLayerThread.teardownScene = false;
     [layerThreads addObject:baseLayerThread];
     
-    // Layout still needs a layer to kick it off
-    layoutLayer = [[WhirlyKitLayoutLayer alloc] initWithRenderer:sceneRenderer];
-    [baseLayerThread addLayer:layoutLayer];
+    // Layout still needs a layer to kick it off.  When the scene is
+    //  shared its owner runs the layout, so don't fight over it
+    if (!sharedViewC)
+    {
+        layoutLayer = [[WhirlyKitLayoutLayer alloc] initWithRenderer:sceneRenderer];
+        [baseLayerThread addLayer:layoutLayer];
+    }
     
+    // Scene graph layer for level of detail groups
+    sceneGraphLayer = [[WhirlyKitSceneGraphLayer alloc] init];
+    [baseLayerThread addLayer:sceneGraphLayer];
+
     // Lastly, an interaction layer of our own
     interactLayer = [self loadSetup_interactionLayer];
     interactLayer.glView = glView;
+    interactLayer.sceneGraphLayer = sceneGraphLayer;
     [baseLayerThread addLayer:interactLayer];
     
 	// Give the renderer what it needs
@@ -330,16 +735,56 @@ using namespace WhirlyKit;
 - (void)didReceiveMemoryWarning
 {
     [super didReceiveMemoryWarning];
-    
-    // We may retain a bit of memory here.  Clear it up.
+
+    [self shedMemory:MaplyMemoryPressureModerate];
+}
+
+- (void)shedMemory:(MaplyMemoryPressureSeverity)severity
+{
+    if (!scene)
+        return;
+
+    // Cheapest first: GL buffer and texture IDs pooled for reuse
     scene->getMemManager()->clearBufferIDs();
     scene->getMemManager()->clearTextureIDs();
+
+    // Rendered icon images redraw themselves on demand
+    [MaplyIconManager clearIconCache];
+
+    // Decoded tile payloads refetch and re-decode.  Under moderate
+    //  pressure the most recently used half survives; critical takes it all.
+    MaplyTileMemoryCache *tileCache = [MaplyTileMemoryCache sharedCache];
+    [tileCache evictDownTo:(severity == MaplyMemoryPressureCritical ? 0 : tileCache.totalBudget/2)];
+
+    // Layers with reconstructible state of their own go next
+    for (MaplyViewControllerLayer *layer in [NSArray arrayWithArray:userLayers])
+        if ([layer respondsToSelector:@selector(shedMemory:)])
+            [(NSObject<MaplyMemoryShedder> *)layer shedMemory:severity];
+
+    // The app's shedders go last, once we've done what we can
+    for (NSObject<MaplyMemoryShedder> *shedder in [NSArray arrayWithArray:memoryShedders])
+        [shedder shedMemory:severity];
+}
+
+- (void)addMemoryShedder:(NSObject<MaplyMemoryShedder> *)shedder
+{
+    if (shedder && ![memoryShedders containsObject:shedder])
+        [memoryShedders addObject:shedder];
+}
+
+- (void)removeMemoryShedder:(NSObject<MaplyMemoryShedder> *)shedder
+{
+    [memoryShedders removeObject:shedder];
 }
 
 - (void)setFrameInterval:(int)frameInterval
 {
     _frameInterval = frameInterval;
     glView.frameInterval = frameInterval;
+    // Tell the background work regulator what a frame is supposed to
+    //  cost, so it knows what counts as running over
+    if (frameInterval > 0)
+        WorkRegulator::setFrameBudget(1.5 * frameInterval / 60.0);
 }
 
 static const float PerfOutputDelay = 15.0;
@@ -376,6 +821,187 @@ static const float PerfOutputDelay = 15.0;
     return _performanceOutput;
 }
 
+// Big enough that the renderer won't log and clear on its own mid-capture
+static const int PerfCaptureInterval = 1<<30;
+
+- (void)startPerformanceCapture
+{
+    sceneRenderer.perfInterval = PerfCaptureInterval;
+    [sceneRenderer resetPerfTimer];
+}
+
+- (NSString *)stopPerformanceCapture
+{
+    NSString *report = [sceneRenderer perfTimerReport];
+    sceneRenderer.perfInterval = (_performanceOutput ? 100 : 0);
+    return report;
+}
+
+// How many tiles we hand back in a trace report
+static const int TileTraceReportTiles = 50;
+
+- (void)setTileTracing:(bool)tileTracing
+{
+    _tileTracing = tileTracing;
+    TilePipelineTrace::setEnabled(tileTracing);
+}
+
+- (NSString *)tileTraceReport
+{
+    std::string json;
+    TilePipelineTrace::report(json,TileTraceReportTiles);
+    return [NSString stringWithFormat:@"%s",json.c_str()];
+}
+
+// Convert a census entry and its children into dictionaries
+static NSDictionary *CensusToDict(const WhirlyKit::MemoryCensusEntry &entry)
+{
+    NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+    [dict setObject:[NSString stringWithUTF8String:entry.name.c_str()] forKey:@"name"];
+    [dict setObject:@(entry.bytes) forKey:@"bytes"];
+    if (entry.count > 0)
+        [dict setObject:@(entry.count) forKey:@"count"];
+    if (!entry.children.empty())
+    {
+        NSMutableArray *children = [NSMutableArray array];
+        for (unsigned int ii=0;ii<entry.children.size();ii++)
+            [children addObject:CensusToDict(entry.children[ii])];
+        [dict setObject:children forKey:@"children"];
+    }
+
+    return dict;
+}
+
+- (NSDictionary *)memoryCensus
+{
+    if (!scene)
+        return nil;
+
+    MemoryCensusEntry rootEntry;
+    scene->memoryCensus(rootEntry);
+
+    return CensusToDict(rootEntry);
+}
+
+- (NSArray *)recentFrameTimes
+{
+    std::vector<PerformanceTimer::FrameSample> samples;
+    [sceneRenderer getFrameSamples:samples];
+
+    NSMutableArray *frames = [NSMutableArray arrayWithCapacity:samples.size()];
+    for (unsigned int ii=0;ii<samples.size();ii++)
+    {
+        const PerformanceTimer::FrameSample &sample = samples[ii];
+        [frames addObject:@{@"start": @(sample.frameStart),
+                            @"cpuMs": @(1000.0*sample.cpuDuration),
+                            @"gpuMs": @(1000.0*sample.gpuDuration)}];
+    }
+
+    return frames;
+}
+
+- (bool)startViewTrace:(NSString *)fileName
+{
+    if (viewTraceRecorder)
+        [self stopViewTrace];
+    viewTraceRecorder = [[MaplyViewTraceRecorder alloc] initWithView:visualView fileName:fileName];
+
+    return viewTraceRecorder != nil;
+}
+
+- (void)stopViewTrace
+{
+    [viewTraceRecorder stop];
+    viewTraceRecorder = nil;
+}
+
+- (bool)replayViewTrace:(NSString *)fileName completion:(void (^)(void))completion
+{
+    [viewTraceReplayer stop];
+    viewTraceReplayer = [[MaplyViewTraceReplayer alloc] initWithView:visualView fileName:fileName];
+    if (!viewTraceReplayer)
+        return false;
+
+    MaplyBaseViewController * __weak weakSelf = self;
+    viewTraceReplayer.completion = ^{
+        MaplyBaseViewController *strongSelf = weakSelf;
+        if (strongSelf)
+            strongSelf->viewTraceReplayer = nil;
+        if (completion)
+            completion();
+    };
+    [viewTraceReplayer start];
+
+    return true;
+}
+
+- (void)startSceneSnapshot:(NSString *)fileName key:(NSString *)key
+{
+    if (!scene)
+        return;
+    if (sceneSnapshotWriter)
+        [self finishSceneSnapshot];
+
+    sceneSnapshotWriter = new SceneSnapshotWriter(fileName,[key UTF8String]);
+    scene->setSnapshotWriter(sceneSnapshotWriter);
+}
+
+- (bool)finishSceneSnapshot
+{
+    if (!sceneSnapshotWriter)
+        return false;
+
+    // Unhook first so new batches stop feeding it.  The file write is
+    //  under the writer's own lock, so a batch already underway is safe.
+    scene->setSnapshotWriter(NULL);
+    bool ok = sceneSnapshotWriter->close();
+    // A layer thread may still be looking at the writer, so it gets
+    //  deleted over there, after anything in flight
+    [baseLayerThread addThingToDelete:sceneSnapshotWriter];
+    sceneSnapshotWriter = NULL;
+
+    return ok;
+}
+
+- (bool)loadSceneSnapshot:(NSString *)fileName key:(NSString *)key
+{
+    if (!scene)
+        return false;
+
+    SceneSnapshotReader reader(fileName);
+    if (!reader.isValid([key UTF8String]))
+        return false;
+
+    ChangeSet changes;
+    SimpleIDSet texIDs,drawIDs;
+    if (!reader.load(scene, changes, texIDs, drawIDs))
+        return false;
+
+    snapshotTexIDs.insert(texIDs.begin(),texIDs.end());
+    snapshotDrawIDs.insert(drawIDs.begin(),drawIDs.end());
+    // Through the layer thread, so the GL setup happens in the usual place
+    [baseLayerThread addChangeRequests:changes];
+    [baseLayerThread flushChangeRequests];
+
+    return true;
+}
+
+- (void)removeSceneSnapshot
+{
+    if (!scene || (snapshotTexIDs.empty() && snapshotDrawIDs.empty()))
+        return;
+
+    ChangeSet changes;
+    if (!snapshotDrawIDs.empty())
+        changes.push_back(new RemDrawableSetReq(snapshotDrawIDs));
+    if (!snapshotTexIDs.empty())
+        changes.push_back(new RemTextureSetReq(snapshotTexIDs));
+    snapshotDrawIDs.clear();
+    snapshotTexIDs.clear();
+    [baseLayerThread addChangeRequests:changes];
+    [baseLayerThread flushChangeRequests];
+}
+
 // Build an array of lights and send them down all at once
 - (void)updateLights
 {
@@ -486,6 +1112,11 @@ static const float PerfOutputDelay = 15.0;
     return [self addScreenMarkers:markers desc:desc mode:MaplyThreadAny];
 }
 
+- (void)updateScreenMarkers:(MaplyComponentObject *)compObj positions:(MaplyCoordinate *)positions colors:(NSArray *)colors numMarkers:(int)numMarkers mode:(MaplyThreadMode)threadMode
+{
+    [interactLayer updateScreenMarkers:compObj positions:positions colors:colors numMarkers:numMarkers mode:threadMode];
+}
+
 - (MaplyComponentObject *)addMarkers:(NSArray *)markers desc:(NSDictionary *)desc mode:(MaplyThreadMode)threadMode
 {
     return [interactLayer addMarkers:markers desc:desc mode:threadMode];
@@ -547,6 +1178,11 @@ static const float PerfOutputDelay = 15.0;
     return [interactLayer addBillboards:billboards desc:desc mode:threadMode];
 }
 
+- (MaplyComponentObject *)addLODGroup:(NSArray *)levels center:(MaplyCoordinate)center switchDists:(NSArray *)switchDists mode:(MaplyThreadMode)threadMode
+{
+    return [interactLayer addLODGroup:levels center:center switchDists:switchDists mode:threadMode];
+}
+
 - (MaplyComponentObject *)addSelectionVectors:(NSArray *)vectors
 {
     return [interactLayer addSelectionVectors:vectors desc:nil];
@@ -643,6 +1279,38 @@ static const float PerfOutputDelay = 15.0;
     return CGPointZero;
 }
 
+// Overridden by the subclasses
+- (void)screenPointsFromGeo:(MaplyCoordinate *)geoCoords screenPts:(CGPoint *)screenPts numPts:(int)numPts
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        screenPts[ii] = CGPointZero;
+}
+
+- (MaplyScreenPointSet *)registerScreenPoints:(MaplyCoordinate *)geoCoords numPts:(int)numPts
+{
+    if (!geoCoords || numPts <= 0)
+        return nil;
+
+    MaplyScreenPointSet *pointSet = [[MaplyScreenPointSet alloc] initWithCoords:geoCoords numPts:numPts view:visualView viewC:self];
+    if (pointSet)
+    {
+        if (!pointSets)
+            pointSets = [NSMutableArray array];
+        [pointSets addObject:pointSet];
+    }
+
+    return pointSet;
+}
+
+- (void)removeScreenPoints:(MaplyScreenPointSet *)pointSet
+{
+    if (![pointSet isKindOfClass:[MaplyScreenPointSet class]])
+        return;
+
+    [pointSet shutdown];
+    [pointSets removeObject:pointSet];
+}
+
 // Overridden by the subclasses
 - (bool)animateToPosition:(MaplyCoordinate)newPos onScreen:(CGPoint)loc time:(NSTimeInterval)howLong
 {
@@ -762,6 +1430,11 @@ static const float PerfOutputDelay = 15.0;
     [interactLayer removeTexture:texture];
 }
 
+- (void)updateTexture:(MaplyTexture *)texture image:(UIImage *)image mode:(MaplyThreadMode)threadMode
+{
+    [interactLayer updateTexture:texture image:image mode:threadMode];
+}
+
 - (void)setMaxLayoutObjects:(int)maxLayoutObjects
 {
     LayoutManager *layoutManager = (LayoutManager *)scene->getManager(kWKLayoutManager);
@@ -809,6 +1482,32 @@ static const float PerfOutputDelay = 15.0;
     [interactLayer enableObjects:theObjs mode:threadMode];
 }
 
+- (id)addRepresentationSet:(NSArray *)compObjs switchHeights:(NSArray *)heights
+{
+    if ([compObjs count] == 0 || [heights count] != [compObjs count]-1)
+        return nil;
+
+    MaplyRepresentationSet *repSet = [[MaplyRepresentationSet alloc] initWithObjects:compObjs heights:heights view:visualView viewC:self];
+    if (repSet)
+    {
+        if (!repSets)
+            repSets = [NSMutableArray array];
+        [repSets addObject:repSet];
+    }
+
+    return repSet;
+}
+
+- (void)removeRepresentationSet:(id)inRepSet
+{
+    if (![inRepSet isKindOfClass:[MaplyRepresentationSet class]])
+        return;
+
+    MaplyRepresentationSet *repSet = inRepSet;
+    [repSet shutdown];
+    [repSets removeObject:repSet];
+}
+
 - (void)startChanges
 {
     [interactLayer startChanges];
@@ -819,6 +1518,14 @@ static const float PerfOutputDelay = 15.0;
     [interactLayer endChanges];
 }
 
+- (void)addCompletion:(void (^)(void))block
+{
+    if (!block)
+        return;
+
+    [interactLayer addCompletion:block];
+}
+
 - (void)addActiveObject:(MaplyActiveObject *)theObj
 {
     if ([NSThread currentThread] != [NSThread mainThread])
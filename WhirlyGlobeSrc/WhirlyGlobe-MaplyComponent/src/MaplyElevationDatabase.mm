@@ -19,16 +19,101 @@
  */
 
 #import <UIKit/UIKit.h>
+#import <map>
+#import <list>
+#import <vector>
 #import "MaplyElevationDatabase.h"
 #import "NSData+Zlib.h"
+#import "DataCompressor.h"
 #import "FMDatabase.h"
 #import "FMDatabaseQueue.h"
 
+// Default byte budget for decoded elevation grids
+static const long long DefaultElevCacheSize = 8*1024*1024;
+// How many levels up we'll go looking for a parent to interpolate from
+static const int MaxApproxLevels = 4;
+
+// Precalculated quad index for a tile.  This is faster than x,y,level.
+static long long QuadIndexForTile(MaplyTileID tileID)
+{
+    long long quadIdx = 0;
+    for (int iq=0;iq<tileID.level;iq++)
+        quadIdx += (1LL<<iq)*(1LL<<iq);
+    quadIdx += tileID.y*(1LL<<tileID.level)+tileID.x;
+
+    return quadIdx;
+}
+
+// Header on the delta encoded tiles elev_tile_pyramid writes with -delta
+typedef struct
+{
+    char magic[4];              // 'WGED'
+    unsigned char version;
+    unsigned char reserved[3];
+    unsigned short sizeX,sizeY;
+    float scale,offset;
+} ElevDeltaHeader;
+
+// Same predictor PNG uses, run per sample instead of per byte
+static int PaethPredict(int a,int b,int c)
+{
+    int p = a + b - c;
+    int pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+// Delta encoded blobs announce themselves with a magic number
+static bool IsDeltaBlob(NSData *data)
+{
+    if ([data length] < sizeof(ElevDeltaHeader))
+        return false;
+    const char *bytes = (const char *)[data bytes];
+    return bytes[0] == 'W' && bytes[1] == 'G' && bytes[2] == 'E' && bytes[3] == 'D';
+}
+
+// Codec framed blobs (LZ4 and friends) say what they are; anything
+//  else is the old gzip
+static NSData *UncompressBlob(NSData *data)
+{
+    if (data && WhirlyKit::IsCodecFramed([data bytes],[data length]))
+        return WhirlyKit::CodecDecompress(data);
+    return [data uncompressGZip];
+}
+
+namespace
+{
+
+// One decoded chunk in the cache
+struct ElevCacheEntry
+{
+    ElevCacheEntry(long long quadIdx,MaplyElevationChunk *chunk,long long cost) : quadIdx(quadIdx), chunk(chunk), cost(cost) { }
+    long long quadIdx;
+    MaplyElevationChunk *chunk;
+    long long cost;
+};
+
+// Front of the list is most recently used
+typedef std::list<ElevCacheEntry> ElevCacheList;
+typedef std::map<long long,ElevCacheList::iterator> ElevCacheMap;
+
+}
+
 @implementation MaplyElevationDatabase
 {
     FMDatabase *db;
     FMDatabaseQueue *queue;
     int _minZoom,_maxZoom;
+    ElevCacheList cacheEntries;
+    ElevCacheMap cacheMap;
+    long long cacheUsedBytes;
+    bool hasMaxError;
+    // Per tile geometric error, cached forever.  The entries are tiny and
+    //  the importance delegate asks for the same ones over and over.
+    std::map<long long,float> maxErrorMap;
 }
 
 - (id)initWithName:(NSString *)name
@@ -67,11 +152,59 @@
         _maxZoom = [res intForColumn:@"maxlevel"];
     }
     
+    // Newer pyramids carry a per tile geometric error column
+    FMResultSet *errRes = [db executeQuery:@"SELECT maxerror FROM elevationtiles LIMIT 1"];
+    hasMaxError = (errRes != nil);
+    [errRes close];
+
     queue = [FMDatabaseQueue databaseQueueWithPath:infoPath];
+    _elevCacheSize = DefaultElevCacheSize;
+    cacheUsedBytes = 0;
 
     return self;
 }
 
+// Look a chunk up in the cache.  Call this locked.
+- (MaplyElevationChunk *)cachedChunk:(long long)quadIdx
+{
+    ElevCacheMap::iterator it = cacheMap.find(quadIdx);
+    if (it == cacheMap.end())
+        return nil;
+    // Move it to the front
+    cacheEntries.splice(cacheEntries.begin(),cacheEntries,it->second);
+    cacheMap[quadIdx] = cacheEntries.begin();
+
+    return cacheEntries.begin()->chunk;
+}
+
+// Add a chunk to the cache, dropping old ones past the budget.
+// Call this locked.
+- (void)addCachedChunk:(MaplyElevationChunk *)chunk forIdx:(long long)quadIdx
+{
+    if (!chunk || _elevCacheSize <= 0)
+        return;
+
+    ElevCacheMap::iterator it = cacheMap.find(quadIdx);
+    if (it != cacheMap.end())
+    {
+        cacheUsedBytes -= it->second->cost;
+        cacheEntries.erase(it->second);
+        cacheMap.erase(it);
+    }
+    long long cost = [chunk.data length];
+    cacheEntries.push_front(ElevCacheEntry(quadIdx,chunk,cost));
+    cacheMap[quadIdx] = cacheEntries.begin();
+    cacheUsedBytes += cost;
+
+    while (cacheUsedBytes > _elevCacheSize && !cacheEntries.empty())
+    {
+        ElevCacheEntry &entry = cacheEntries.back();
+        cacheUsedBytes -= entry.cost;
+        cacheMap.erase(entry.quadIdx);
+        cacheEntries.pop_back();
+    }
+}
+
 - (void)dealloc
 {
     [db close];
@@ -99,32 +232,9 @@
     return true;
 }
 
-- (MaplyElevationChunk *)elevForTile:(MaplyTileID)tileID
+// Turn a raw (uncompressed) tile blob into an elevation chunk
+- (MaplyElevationChunk *)chunkFromData:(NSData *)uncompressedData tilePresent:(bool)tilePresent
 {
-    // Put together the precalculated quad index.  This is faster
-    //  than x,y,level
-    int quadIdx = 0;
-    for (int iq=0;iq<tileID.level;iq++)
-        quadIdx += (1<<iq)*(1<<iq);
-    quadIdx += tileID.y*(1<<tileID.level)+tileID.x;
-
-    NSData * __block uncompressedData=nil;
-    bool __block tilePresent = false;
-    // Note: Need to sort this out
-    [queue inDatabase:^(FMDatabase *theDb) {
-        // Now look for the tile
-        FMResultSet *res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT data FROM elevationtiles WHERE quadindex=%d;",quadIdx]];
-        NSData *data = nil;
-        if ([res next])
-        {
-            tilePresent = true;
-            data = [res dataForColumn:@"data"];
-        }
-        if (data && [data length] > 0)
-            uncompressedData = [data uncompressGZip];
-        [res close];
-    }];
-    
     if (!uncompressedData || [uncompressedData length] == 0)
     {
         if (tilePresent)
@@ -139,8 +249,7 @@
         } else
             return nil;
     }
-    
-//    NSLog(@"Loading tile: %d: (%d,%d)",tileID.level,tileID.x,tileID.y);
+
     float *floats = (float *)malloc(sizeof(float)*_tileSizeX*_tileSizeY);
     for (unsigned int ii=0;ii<_tileSizeX*_tileSizeY;ii++)
         floats[ii] = ((short *)[uncompressedData bytes])[ii];
@@ -150,4 +259,237 @@
     return chunk;
 }
 
+// Decode a delta encoded tile (see elev_tile_pyramid) straight into the float grid
+- (MaplyElevationChunk *)chunkFromDeltaData:(NSData *)blobData
+{
+    const ElevDeltaHeader *hdr = (const ElevDeltaHeader *)[blobData bytes];
+    if (hdr->version != 1)
+        return nil;
+    int sizeX = hdr->sizeX,sizeY = hdr->sizeY;
+    int numSamples = sizeX*sizeY;
+    if (numSamples <= 0)
+        return nil;
+
+    NSData *residData = UncompressBlob([blobData subdataWithRange:NSMakeRange(sizeof(ElevDeltaHeader),[blobData length]-sizeof(ElevDeltaHeader))]);
+    if (!residData || [residData length] < numSamples*sizeof(unsigned short))
+        return nil;
+    const unsigned short *resid = (const unsigned short *)[residData bytes];
+
+    // Undo the prediction and the quantization in one pass
+    unsigned short *quant = (unsigned short *)malloc(sizeof(unsigned short)*numSamples);
+    float *floats = (float *)malloc(sizeof(float)*numSamples);
+    float scale = hdr->scale,offset = hdr->offset;
+    for (int iy=0;iy<sizeY;iy++)
+        for (int ix=0;ix<sizeX;ix++)
+        {
+            int idx = iy*sizeX+ix;
+            int left = (ix > 0) ? quant[idx-1] : 0;
+            int up = (iy > 0) ? quant[idx-sizeX] : 0;
+            int upLeft = (ix > 0 && iy > 0) ? quant[idx-sizeX-1] : 0;
+            quant[idx] = (unsigned short)(resid[idx] + PaethPredict(left,up,upLeft));
+            floats[idx] = quant[idx]*scale + offset;
+        }
+    free(quant);
+
+    NSData *floatData = [NSData dataWithBytesNoCopy:floats length:sizeof(float)*numSamples freeWhenDone:YES];
+    return [[MaplyElevationChunk alloc] initWithData:floatData numX:sizeX numY:sizeY];
+}
+
+// Figure out which format a tile blob is in and decode accordingly
+- (MaplyElevationChunk *)chunkFromBlob:(NSData *)blobData tilePresent:(bool)tilePresent
+{
+    if (blobData && [blobData length] > 0)
+    {
+        if (IsDeltaBlob(blobData))
+            return [self chunkFromDeltaData:blobData];
+        return [self chunkFromData:UncompressBlob(blobData) tilePresent:tilePresent];
+    }
+
+    return [self chunkFromData:nil tilePresent:tilePresent];
+}
+
+- (MaplyElevationChunk *)elevForTile:(MaplyTileID)tileID
+{
+    long long quadIdx = QuadIndexForTile(tileID);
+
+    // The loader asks for the same neighborhood over and over
+    @synchronized(self)
+    {
+        MaplyElevationChunk *chunk = [self cachedChunk:quadIdx];
+        if (chunk)
+            return chunk;
+    }
+
+    NSData * __block blobData=nil;
+    bool __block tilePresent = false;
+    // Note: Need to sort this out
+    [queue inDatabase:^(FMDatabase *theDb) {
+        // Now look for the tile
+        FMResultSet *res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT data FROM elevationtiles WHERE quadindex=%lld;",quadIdx]];
+        if ([res next])
+        {
+            tilePresent = true;
+            blobData = [res dataForColumn:@"data"];
+        }
+        [res close];
+    }];
+
+//    NSLog(@"Loading tile: %d: (%d,%d)",tileID.level,tileID.x,tileID.y);
+    // Decode outside the queue block so we don't hold up other database users
+    MaplyElevationChunk *chunk = [self chunkFromBlob:blobData tilePresent:tilePresent];
+    if (chunk)
+    {
+        @synchronized(self)
+        {
+            [self addCachedChunk:chunk forIdx:quadIdx];
+        }
+    }
+
+    return chunk;
+}
+
+- (NSArray *)elevForTiles:(NSArray *)tileIDs
+{
+    NSMutableArray *results = [NSMutableArray array];
+    for (unsigned int ii=0;ii<[tileIDs count];ii++)
+        [results addObject:[NSNull null]];
+
+    // Pick up what we've already got decoded and work out what's missing
+    std::vector<long long> quadIndices;
+    quadIndices.resize([tileIDs count]);
+    NSMutableArray *missingIndices = [NSMutableArray array];
+    @synchronized(self)
+    {
+        for (unsigned int ii=0;ii<[tileIDs count];ii++)
+        {
+            MaplyTileID tileID;
+            [tileIDs[ii] getValue:&tileID];
+            quadIndices[ii] = QuadIndexForTile(tileID);
+            MaplyElevationChunk *chunk = [self cachedChunk:quadIndices[ii]];
+            if (chunk)
+                results[ii] = chunk;
+            else
+                [missingIndices addObject:@(quadIndices[ii])];
+        }
+    }
+
+    if ([missingIndices count] == 0)
+        return results;
+
+    // Fetch everything we're missing in one pass
+    NSMutableDictionary * __block rawData = [NSMutableDictionary dictionary];
+    NSMutableSet * __block presentIndices = [NSMutableSet set];
+    [queue inDatabase:^(FMDatabase *theDb) {
+        NSString *query = [NSString stringWithFormat:@"SELECT quadindex,data FROM elevationtiles WHERE quadindex IN (%@);",[missingIndices componentsJoinedByString:@","]];
+        FMResultSet *res = [theDb executeQuery:query];
+        while ([res next])
+        {
+            NSNumber *quadIdx = @([res longLongIntForColumn:@"quadindex"]);
+            [presentIndices addObject:quadIdx];
+            NSData *data = [res dataForColumn:@"data"];
+            if (data && [data length] > 0)
+                rawData[quadIdx] = data;
+        }
+        [res close];
+    }];
+
+    for (unsigned int ii=0;ii<[tileIDs count];ii++)
+    {
+        if (![results[ii] isKindOfClass:[NSNull class]])
+            continue;
+        NSNumber *quadIdx = @(quadIndices[ii]);
+        MaplyElevationChunk *chunk = [self chunkFromBlob:rawData[quadIdx] tilePresent:[presentIndices containsObject:quadIdx]];
+        if (chunk)
+        {
+            results[ii] = chunk;
+            @synchronized(self)
+            {
+                [self addCachedChunk:chunk forIdx:quadIndices[ii]];
+            }
+        }
+    }
+
+    return results;
+}
+
+- (float)maxErrorForTile:(MaplyTileID)tileID
+{
+    if (!hasMaxError)
+        return -1.0;
+
+    long long quadIdx = QuadIndexForTile(tileID);
+    @synchronized(self)
+    {
+        std::map<long long,float>::iterator it = maxErrorMap.find(quadIdx);
+        if (it != maxErrorMap.end())
+            return it->second;
+    }
+
+    // Cache misses (including tiles that aren't there) so we only ask once
+    float __block maxError = -1.0;
+    [queue inDatabase:^(FMDatabase *theDb) {
+        FMResultSet *res = [theDb executeQuery:[NSString stringWithFormat:@"SELECT maxerror FROM elevationtiles WHERE quadindex=%lld;",quadIdx]];
+        if ([res next])
+            maxError = [res doubleForColumn:@"maxerror"];
+        [res close];
+    }];
+
+    @synchronized(self)
+    {
+        maxErrorMap[quadIdx] = maxError;
+    }
+
+    return maxError;
+}
+
+- (MaplyElevationChunk *)approximateElevForTile:(MaplyTileID)tileID
+{
+    if (_tileSizeX <= 1 || _tileSizeY <= 1)
+        return nil;
+
+    @synchronized(self)
+    {
+        // Walk up the ancestors looking for one we've already decoded
+        MaplyTileID parentID = tileID;
+        int levelsUp = 0;
+        while (parentID.level > _minZoom && levelsUp < MaxApproxLevels)
+        {
+            parentID.x /= 2;  parentID.y /= 2;  parentID.level--;  levelsUp++;
+            MaplyElevationChunk *parent = [self cachedChunk:QuadIndexForTile(parentID)];
+            if (!parent)
+                continue;
+
+            // Interpolate our little patch out of the parent's grid
+            int relX = tileID.x - (parentID.x << levelsUp);
+            int relY = tileID.y - (parentID.y << levelsUp);
+            int numX = parent.numX,numY = parent.numY;
+            const float *parentSamples = (const float *)[parent.data bytes];
+            float *floats = (float *)malloc(sizeof(float)*numX*numY);
+            for (int iy=0;iy<numY;iy++)
+            {
+                float py = (relY + iy/(float)(numY-1)) / (float)(1<<levelsUp) * (numY-1);
+                int py0 = (int)py;
+                if (py0 > numY-2)  py0 = numY-2;
+                float ty = py-py0;
+                const float *row0 = &parentSamples[py0*numX];
+                const float *row1 = &parentSamples[(py0+1)*numX];
+                for (int ix=0;ix<numX;ix++)
+                {
+                    float px = (relX + ix/(float)(numX-1)) / (float)(1<<levelsUp) * (numX-1);
+                    int px0 = (int)px;
+                    if (px0 > numX-2)  px0 = numX-2;
+                    float tx = px-px0;
+                    float elev0 = row0[px0] + tx*(row0[px0+1]-row0[px0]);
+                    float elev1 = row1[px0] + tx*(row1[px0+1]-row1[px0]);
+                    floats[iy*numX+ix] = elev0 + ty*(elev1-elev0);
+                }
+            }
+            NSData *floatData = [NSData dataWithBytesNoCopy:floats length:numX*numY*sizeof(float) freeWhenDone:YES];
+            return [[MaplyElevationChunk alloc] initWithData:floatData numX:numX numY:numY];
+        }
+    }
+
+    return nil;
+}
+
 @end
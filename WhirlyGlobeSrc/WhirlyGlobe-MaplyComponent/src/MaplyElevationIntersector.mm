@@ -0,0 +1,259 @@
+/*
+ *  MaplyElevationIntersector.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <map>
+#import "MaplyElevationIntersector.h"
+#import "WhirlyGlobeViewController_private.h"
+
+using namespace WhirlyKit;
+using namespace Eigen;
+
+// Same radius the elevation displacement uses, so meters convert
+//  to display units consistently with what's on screen
+static const double EarthRadius = 6371000.0;
+
+// Fold a double's bits into a view state fingerprint
+static long long HashDouble(long long hash,double val)
+{
+    long long bits;
+    memcpy(&bits,&val,sizeof(bits));
+    return (hash ^ bits) * 1099511628211LL;
+}
+
+@implementation MaplyElevationHit
+@end
+
+@implementation MaplyElevationIntersector
+{
+    NSObject<MaplyElevationSourceDelegate> *elevSource;
+    WhirlyGlobeViewController __weak *viewC;
+    // Answers the elevation samples and keeps the chunks warm
+    MaplyElevationQuery *elevQuery;
+    // Queries run here, in order
+    dispatch_queue_t queryQueue;
+
+    // Results we've already worked out for the current view state
+    pthread_mutex_t cacheLock;
+    long long viewStateHash;
+    std::map<std::pair<int,int>,MaplyElevationHit *> resultCache;
+}
+
+- (id)initWithSource:(NSObject<MaplyElevationSourceDelegate> *)inElevSource viewC:(WhirlyGlobeViewController *)inViewC
+{
+    self = [super init];
+    if (self)
+    {
+        elevSource = inElevSource;
+        viewC = inViewC;
+        elevQuery = [[MaplyElevationQuery alloc] initWithSource:elevSource];
+        queryQueue = dispatch_queue_create("MaplyElevationIntersector",DISPATCH_QUEUE_SERIAL);
+        pthread_mutex_init(&cacheLock,NULL);
+        viewStateHash = 0;
+        _toleranceMeters = 30.0;
+        _maxElevation = 9000.0;
+        _minElevation = -500.0;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&cacheLock);
+}
+
+// Radius of the terrain surface under the given display direction
+- (double)surfaceRadius:(const Point3d &)dir coordAdapter:(CoordSystemDisplayAdapter *)coordAdapter
+{
+    GeoCoord geoCoord = coordAdapter->getCoordSystem()->localToGeographic(coordAdapter->displayToLocal(dir));
+    MaplyCoordinate coord;
+    coord.x = geoCoord.x();  coord.y = geoCoord.y();
+    float elev = [elevQuery elevationForCoordinate:coord toleranceMeters:_toleranceMeters];
+
+    return 1.0 + elev/EarthRadius;
+}
+
+// The cache only holds up while the view stays put, so fingerprint
+//  the view state and dump the lot when it changes
+- (long long)currentViewStateHash:(WhirlyGlobeView *)globeView
+{
+    Quaterniond rotQuat = [globeView rotQuat];
+    long long hash = -3750763034362895579LL;
+    hash = HashDouble(hash,rotQuat.x());
+    hash = HashDouble(hash,rotQuat.y());
+    hash = HashDouble(hash,rotQuat.z());
+    hash = HashDouble(hash,rotQuat.w());
+    hash = HashDouble(hash,globeView.heightAboveGlobe);
+    hash = HashDouble(hash,globeView.tilt);
+
+    return hash;
+}
+
+- (MaplyElevationHit *)pointOnTerrainFromScreen:(CGPoint)screenPt
+{
+    MaplyElevationHit *hit = [[MaplyElevationHit alloc] init];
+    hit.found = false;
+    hit.screenPt = screenPt;
+
+    WhirlyGlobeViewController *theViewC = viewC;
+    if (!theViewC)
+        return hit;
+    WhirlyGlobeView *globeView = theViewC->globeView;
+    WhirlyKitSceneRendererES2 *sceneRenderer = theViewC->sceneRenderer;
+    if (!globeView || !sceneRenderer)
+        return hit;
+    CoordSystemDisplayAdapter *coordAdapter = globeView.coordAdapter;
+
+    // Check whether we've already answered this one for this view
+    long long thisViewHash = [self currentViewStateHash:globeView];
+    std::pair<int,int> cacheKey((int)roundf(screenPt.x*2),(int)roundf(screenPt.y*2));
+    pthread_mutex_lock(&cacheLock);
+    if (thisViewHash != viewStateHash)
+    {
+        resultCache.clear();
+        viewStateHash = thisViewHash;
+    } else {
+        std::map<std::pair<int,int>,MaplyElevationHit *>::iterator it = resultCache.find(cacheKey);
+        if (it != resultCache.end())
+        {
+            MaplyElevationHit *cachedHit = it->second;
+            pthread_mutex_unlock(&cacheLock);
+            return cachedHit;
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    // Where the ray hits the ideal sphere.  If it misses that entirely
+    //  there's no terrain to hit either.
+    Point3d spherePt;
+    Matrix4d theTransform = [globeView calcFullMatrix];
+    Point2f frameSize(sceneRenderer.framebufferWidth/theViewC->glView.contentScaleFactor,sceneRenderer.framebufferHeight/theViewC->glView.contentScaleFactor);
+    if (![globeView pointOnSphereFromScreen:screenPt transform:&theTransform frameSize:frameSize hit:&spherePt normalized:true])
+    {
+        pthread_mutex_lock(&cacheLock);
+        resultCache[cacheKey] = hit;
+        pthread_mutex_unlock(&cacheLock);
+        return hit;
+    }
+
+    Vector3d eyePos = [globeView eyePos];
+    Point3d rayDir = (spherePt - eyePos).normalized();
+
+    // Enter the march where the ray first dips inside the sphere
+    //  inflated to the highest terrain we care about
+    double maxRadius = 1.0 + _maxElevation/EarthRadius;
+    double minRadius = 1.0 + _minElevation/EarthRadius;
+    double b = eyePos.dot(rayDir);
+    double disc = b*b - (eyePos.squaredNorm() - maxRadius*maxRadius);
+    if (disc < 0.0)
+        disc = 0.0;
+    double tStart = -b - sqrt(disc);
+    if (tStart < 0.0)
+        tStart = 0.0;
+    double tSphere = (spherePt - eyePos).norm();
+
+    // Step so neighboring samples land about a tolerance apart on the ground
+    double tolDisp = _toleranceMeters/EarthRadius;
+    int numSamples = (int)((tSphere - tStart)/tolDisp) + 1;
+    if (numSamples < 16)
+        numSamples = 16;
+    if (numSamples > 512)
+        numSamples = 512;
+    double tStep = (tSphere - tStart)/numSamples;
+
+    // March until we're under the terrain, then close in with a bisection
+    double tAbove = tStart;
+    double tBelow = -1.0;
+    Point3d pt = eyePos + tStart*rayDir;
+    double lastF = pt.norm() - [self surfaceRadius:pt.normalized() coordAdapter:coordAdapter];
+    for (double t = tStart+tStep;;t += tStep)
+    {
+        pt = eyePos + t*rayDir;
+        double radius = pt.norm();
+        double f = radius - [self surfaceRadius:pt.normalized() coordAdapter:coordAdapter];
+        if (f <= 0.0)
+        {
+            tBelow = t;
+            break;
+        }
+        tAbove = t;
+        lastF = f;
+        // Ran out the back of the terrain shell without a hit
+        if (t > tSphere && radius < minRadius)
+            break;
+    }
+
+    if (tBelow > 0.0)
+    {
+        for (unsigned int ii=0;ii<24;ii++)
+        {
+            double tMid = (tAbove+tBelow)/2.0;
+            pt = eyePos + tMid*rayDir;
+            double f = pt.norm() - [self surfaceRadius:pt.normalized() coordAdapter:coordAdapter];
+            if (f > 0.0)
+                tAbove = tMid;
+            else
+                tBelow = tMid;
+        }
+        pt = eyePos + tBelow*rayDir;
+        GeoCoord geoCoord = coordAdapter->getCoordSystem()->localToGeographic(coordAdapter->displayToLocal(pt.normalized()));
+        MaplyCoordinate coord;
+        coord.x = geoCoord.x();  coord.y = geoCoord.y();
+        hit.found = true;
+        hit.coord = coord;
+        hit.elevation = [elevQuery elevationForCoordinate:coord toleranceMeters:_toleranceMeters];
+    }
+
+    pthread_mutex_lock(&cacheLock);
+    resultCache[cacheKey] = hit;
+    pthread_mutex_unlock(&cacheLock);
+
+    return hit;
+}
+
+- (void)pointOnTerrainFromScreen:(CGPoint)screenPt completion:(void (^)(MaplyElevationHit *hit))completion
+{
+    dispatch_async(queryQueue,
+    ^{
+        MaplyElevationHit *hit = [self pointOnTerrainFromScreen:screenPt];
+        dispatch_async(dispatch_get_main_queue(),
+        ^{
+            completion(hit);
+        });
+    });
+}
+
+- (void)pointsOnTerrainFromScreens:(NSArray *)screenPts completion:(void (^)(NSArray *hits))completion
+{
+    dispatch_async(queryQueue,
+    ^{
+        // These share the chunk cache underneath, so running them
+        //  back to back is the batching
+        NSMutableArray *hits = [NSMutableArray array];
+        for (NSValue *val in screenPts)
+            [hits addObject:[self pointOnTerrainFromScreen:[val CGPointValue]]];
+        dispatch_async(dispatch_get_main_queue(),
+        ^{
+            completion(hits);
+        });
+    });
+}
+
+@end
@@ -20,6 +20,9 @@
 
 #import "MaplyElevationSource.h"
 #import "MaplyElevationSource_private.h"
+#import <list>
+#import <map>
+#import <pthread.h>
 
 @implementation MaplyElevationChunk
 
@@ -118,6 +121,183 @@ static const float ScaleFactor = 300;
 
 @end
 
+// One chunk we've pulled from the source, in the query's cache
+typedef struct
+{
+    long long key;
+    MaplyElevationChunk * __strong chunk;
+} ElevQueryCacheEntry;
+
+// Mean radius, just for turning tolerances into levels
+static const double QueryEarthRadius = 6371000.0;
+
+@implementation MaplyElevationQuery
+{
+    NSObject<MaplyElevationSourceDelegate> *elevSource;
+    MaplyCoordinateSystem *coordSys;
+    MaplyCoordinate boundLL,boundUR;
+    std::list<ElevQueryCacheEntry> entries;
+    std::map<long long,std::list<ElevQueryCacheEntry>::iterator> entryMap;
+    pthread_mutex_t lock;
+}
+
+- (id)initWithSource:(NSObject<MaplyElevationSourceDelegate> *)inElevSource
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    elevSource = inElevSource;
+    coordSys = [elevSource getCoordSystem];
+    [coordSys getBoundsLL:&boundLL ur:&boundUR];
+    _samplesPerTile = 10;
+    _maxCachedChunks = 32;
+    pthread_mutex_init(&lock,NULL);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&lock);
+}
+
+- (int)levelForTolerance:(float)tolMeters
+{
+    int minZoom = [elevSource minZoom];
+    int maxZoom = [elevSource maxZoom];
+
+    // Work down from the top until a level resolves finely enough
+    int level;
+    for (level = minZoom; level < maxZoom; level++)
+    {
+        double cellSpan = (boundUR.x - boundLL.x) / (double)((1<<level) * _samplesPerTile);
+        if (cellSpan * QueryEarthRadius <= tolMeters)
+            break;
+    }
+
+    return level;
+}
+
+// Look for a chunk in the cache, asking the source on a miss
+- (MaplyElevationChunk *)chunkForLevel:(int)level x:(int)x y:(int)y
+{
+    long long key = ((long long)level << 48) | ((long long)x << 24) | (long long)y;
+
+    pthread_mutex_lock(&lock);
+    std::map<long long,std::list<ElevQueryCacheEntry>::iterator>::iterator it = entryMap.find(key);
+    if (it != entryMap.end())
+    {
+        entries.splice(entries.begin(),entries,it->second);
+        MaplyElevationChunk *chunk = it->second->chunk;
+        pthread_mutex_unlock(&lock);
+        return chunk;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // Don't hold the lock over the fetch, the source may be slow
+    MaplyTileID tileID;
+    tileID.x = x;  tileID.y = y;  tileID.level = level;
+    MaplyElevationChunk *chunk = [elevSource elevForTile:tileID];
+    if (!chunk)
+        return nil;
+
+    pthread_mutex_lock(&lock);
+    if (entryMap.find(key) == entryMap.end())
+    {
+        ElevQueryCacheEntry entry;
+        entry.key = key;
+        entry.chunk = chunk;
+        entries.push_front(entry);
+        entryMap[key] = entries.begin();
+        while ((int)entries.size() > _maxCachedChunks && !entries.empty())
+        {
+            ElevQueryCacheEntry &oldEntry = entries.back();
+            entryMap.erase(oldEntry.key);
+            entries.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return chunk;
+}
+
+// Interpolate a single value out of a chunk at the given level
+- (float)sampleLevel:(int)level coord:(MaplyCoordinate)coord
+{
+    int numTiles = 1<<level;
+    double dx = (boundUR.x - boundLL.x) / numTiles;
+    double dy = (boundUR.y - boundLL.y) / numTiles;
+    int tx = (int)((coord.x - boundLL.x) / dx);
+    int ty = (int)((coord.y - boundLL.y) / dy);
+    if (tx < 0) tx = 0;  if (tx >= numTiles) tx = numTiles-1;
+    if (ty < 0) ty = 0;  if (ty >= numTiles) ty = numTiles-1;
+
+    MaplyElevationChunk *chunk = [self chunkForLevel:level x:tx y:ty];
+    if (!chunk || chunk.numX < 2 || chunk.numY < 2)
+        return 0.0;
+
+    // The samples span the tile, with the last ones on the far edges
+    double whereX = (coord.x - (boundLL.x + tx * dx)) / dx * (chunk.numX-1);
+    double whereY = (coord.y - (boundLL.y + ty * dy)) / dy * (chunk.numY-1);
+    int minX = (int)whereX, minY = (int)whereY;
+    if (minX < 0) minX = 0;  if (minX > chunk.numX-2) minX = chunk.numX-2;
+    if (minY < 0) minY = 0;  if (minY > chunk.numY-2) minY = chunk.numY-2;
+    float ta = whereX - minX, tb = whereY - minY;
+
+    const float *samples = (const float *)[chunk.data bytes];
+    float elev00 = samples[minY*chunk.numX+minX];
+    float elev10 = samples[minY*chunk.numX+(minX+1)];
+    float elev11 = samples[(minY+1)*chunk.numX+(minX+1)];
+    float elev01 = samples[(minY+1)*chunk.numX+minX];
+    float elev0 = (elev10-elev00)*ta + elev00;
+    float elev1 = (elev11-elev01)*ta + elev01;
+
+    return (elev1-elev0)*tb + elev0;
+}
+
+- (float)elevationForCoordinate:(MaplyCoordinate)coord toleranceMeters:(float)tolMeters
+{
+    return [self sampleLevel:[self levelForTolerance:tolMeters] coord:coord];
+}
+
+- (MaplyElevationChunk *)elevForTile:(MaplyTileID)tileID toleranceMeters:(float)tolMeters
+{
+    int level = [self levelForTolerance:tolMeters];
+    // If the pyramid answers at the tile's own level or better,
+    //  there's nothing to resample
+    if (level >= tileID.level)
+    {
+        MaplyTileID sourceID;
+        sourceID.x = tileID.x;  sourceID.y = tileID.y;  sourceID.level = tileID.level;
+        return [elevSource elevForTile:sourceID];
+    }
+
+    int numTiles = 1<<tileID.level;
+    double dx = (boundUR.x - boundLL.x) / numTiles;
+    double dy = (boundUR.y - boundLL.y) / numTiles;
+    MaplyCoordinate tileLL;
+    tileLL.x = boundLL.x + dx * tileID.x;
+    tileLL.y = boundLL.y + dy * tileID.y;
+
+    // Same layout the sources use: cells plus a shared far edge
+    int numX = _samplesPerTile+1,numY = _samplesPerTile+1;
+    float *floatData = (float *)malloc(sizeof(float)*numX*numY);
+    for (unsigned int iy=0;iy<numY;iy++)
+        for (unsigned int ix=0;ix<numX;ix++)
+        {
+            MaplyCoordinate coord;
+            coord.x = tileLL.x + dx * ix / (numX-1);
+            coord.y = tileLL.y + dy * iy / (numY-1);
+            floatData[iy*numX+ix] = [self sampleLevel:level coord:coord];
+        }
+
+    NSData *data = [[NSData alloc] initWithBytesNoCopy:floatData length:sizeof(float)*numX*numY freeWhenDone:YES];
+    return [[MaplyElevationChunk alloc] initWithData:data numX:numX numY:numY];
+}
+
+@end
+
 @implementation MaplyElevationSourceAdapter
 {
     NSObject<MaplyElevationSourceDelegate> *elevSource;
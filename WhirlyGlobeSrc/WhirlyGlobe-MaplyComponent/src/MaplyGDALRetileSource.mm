@@ -19,6 +19,11 @@
  */
 
 #import "MaplyGDALRetileSource.h"
+#import "MaplyQuadImageTilesLayer.h"
+#import "MaplyTileMemoryCache.h"
+
+// Simultaneous fetches we'll run when the layer leaves fetching to us
+static const int GDALFetchWidth = 4;
 
 @implementation MaplyGDALRetileSource
 {
@@ -28,6 +33,7 @@
     int _tileSize;
     bool _colInDir;
     bool cacheInit;
+    NSOperationQueue *fetchQueue;
 }
 
 - (id)initWithURL:(NSString *)baseURL baseName:(NSString *)baseName ext:(NSString *)ext coordSys:(MaplyCoordinateSystem *)coordSys levels:(int)numLevels
@@ -42,7 +48,10 @@
     _tileSize = 256;
     _colInDir = true;
     cacheInit = false;
-    
+
+    fetchQueue = [[NSOperationQueue alloc] init];
+    fetchQueue.maxConcurrentOperationCount = GDALFetchWidth;
+
     return self;
 }
 
@@ -73,23 +82,46 @@
 
 - (NSString *)cacheFileForTile:(MaplyTileID)tileID
 {
-    // If there's a cache dir, make sure it's there
-    if (!cacheInit)
+    // If there's a cache dir, make sure it's there.
+    // Fetches run in parallel, so take the lock for the one-time setup.
+    @synchronized(self)
     {
-        if (_cacheDir)
+        if (!cacheInit)
         {
-            NSError *error = nil;
-            [[NSFileManager defaultManager] createDirectoryAtPath:_cacheDir withIntermediateDirectories:YES attributes:nil error:&error];
+            if (_cacheDir)
+            {
+                NSError *error = nil;
+                [[NSFileManager defaultManager] createDirectoryAtPath:_cacheDir withIntermediateDirectories:YES attributes:nil error:&error];
+            }
+            cacheInit = true;
         }
-        cacheInit = true;
     }
-    
+
     NSString *localName = [NSString stringWithFormat:@"%@/%d_%d_%d",_cacheDir,tileID.level,tileID.x,tileID.y];
     return localName;
 }
 
 - (id)imageForTile:(MaplyTileID)tileID
 {
+    // Warm results first.  Requests for adjacent tiles tend to arrive
+    //  together, so this catches repeats without touching the disk.
+    NSData *imgData = [[MaplyTileMemoryCache sharedCache] objectForSource:self tile:tileID];
+    if (imgData)
+        return imgData;
+
+    // Then the disk cache
+    NSString *fileName = nil;
+    if (_cacheDir)
+    {
+        fileName = [self cacheFileForTile:tileID];
+        imgData = [NSData dataWithContentsOfFile:fileName];
+        if (imgData)
+        {
+            [[MaplyTileMemoryCache sharedCache] setObject:imgData cost:[imgData length] forSource:self tile:tileID];
+            return imgData;
+        }
+    }
+
     // How they store it on the other end
     int remoteLevel = _numLevels-tileID.level;
     int numPerSide = 1<<tileID.level;
@@ -102,23 +134,7 @@
         numTileIndexSize++;
         testNumPerSide /= 10;
     }
-    
-    NSData *imgData = nil;
-    bool wasCached = false;
-    NSString *fileName = nil;
 
-    // Look for the image in the cache first
-    if (_cacheDir)
-    {
-        fileName = [self cacheFileForTile:tileID];
-        imgData = [NSData dataWithContentsOfFile:fileName];
-        if (imgData)
-        {
-            //            NSLog(@"Tile was cached: %d: (%d,%d)",tileID.level,tileID.x,tileID.y);
-            wasCached = true;
-        }
-    }
-    
     int col = numPerSide-tileID.y;
     int row = tileID.x+1;
     
@@ -149,13 +165,29 @@
     }
     
     if (error || !imgData)
-        imgData = nil;
-    
+        return nil;
+
     // Let's also write it back out for the cache
-    if (_cacheDir && !wasCached)
+    if (_cacheDir)
         [imgData writeToFile:fileName atomically:YES];
-    
+    [[MaplyTileMemoryCache sharedCache] setObject:imgData cost:[imgData length] forSource:self tile:tileID];
+
     return imgData;
 }
 
+- (void)startFetchLayer:(MaplyQuadImageTilesLayer *)layer tile:(MaplyTileID)tileID
+{
+    // The layer leaves the fetch to us, so tiles run through our own
+    //  bounded queue in parallel rather than one at a time wherever
+    //  the layer happens to call
+    [fetchQueue addOperationWithBlock:
+    ^{
+        NSData *imgData = [self imageForTile:tileID];
+        if (imgData)
+            [layer loadedImages:imgData forTile:tileID];
+        else
+            [layer loadError:nil forTile:tileID];
+    }];
+}
+
 @end
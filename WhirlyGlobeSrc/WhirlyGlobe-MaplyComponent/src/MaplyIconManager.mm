@@ -8,10 +8,16 @@
 
 #import "MaplyIconManager.h"
 #import "UIColor+Stuff.h"
+#import "MaplyBaseViewController_private.h"
+#import "MaplyBaseInteractionLayer_private.h"
+#import "MaplyTexture_private.h"
+
+using namespace WhirlyKit;
 
 @implementation MaplyIconManager
 {
     NSCache *imageCache;
+    NSMutableDictionary *prebakedTextures;
 }
 
 + (MaplyIconManager *)shared
@@ -31,7 +37,8 @@
 {
     self = [super init];
     imageCache = [[NSCache alloc] init];
-    
+    prebakedTextures = [NSMutableDictionary dictionary];
+
     return self;
 }
 
@@ -117,6 +124,80 @@
     return retImage;
 }
 
+- (bool)prebakeIconSet:(NSArray *)names size:(CGSize)size color:(UIColor *)color circleColor:(UIColor *)circleColor strokeSize:(float)strokeSize strokeColor:(UIColor *)strokeColor viewC:(MaplyBaseViewController *)viewC
+{
+    size_t numIcons = [names count];
+    if (!viewC || numIcons == 0)
+        return false;
+    MaplyBaseInteractionLayer *interactLayer = viewC->interactLayer;
+    if (!interactLayer)
+        return false;
+    WhirlyKitLayerThread *layerThread = interactLayer->layerThread;
+    Scene *scene = interactLayer->scene;
+    if (!layerThread || !scene)
+        return false;
+
+    // Render the icons in parallel.  The image cache doesn't mind.
+    std::vector<UIImage *> iconImages(numIcons,nil);
+    UIImage * __strong *iconImagePtr = &iconImages[0];
+    size_t numWorkers = [[NSProcessInfo processInfo] processorCount];
+    if (numWorkers > numIcons)
+        numWorkers = numIcons;
+    dispatch_apply(numWorkers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   ^(size_t worker)
+                   {
+                       for (size_t ii=worker;ii<numIcons;ii+=numWorkers)
+                           iconImagePtr[ii] = [self iconForName:[names objectAtIndex:ii] size:size color:color circleColor:circleColor strokeSize:strokeSize strokeColor:strokeColor];
+                   });
+
+    // Pack them into as few atlases as possible and hand out sub texture
+    //  IDs.  Those stand in for texture IDs on the layer side.
+    TextureAtlasBuilder *atlasBuilder = [[TextureAtlasBuilder alloc] initWithTexSizeX:1024 texSizeY:1024];
+    bool ok = true;
+    @synchronized(self)
+    {
+        for (unsigned int ii=0;ii<numIcons;ii++)
+        {
+            UIImage *image = iconImages[ii];
+            if (!image)
+            {
+                ok = false;
+                continue;
+            }
+            SimpleIdentity subTexID = [atlasBuilder addImage:image];
+            if (subTexID == EmptyIdentity)
+            {
+                ok = false;
+                continue;
+            }
+            MaplyTexture *maplyTex = [[MaplyTexture alloc] init];
+            maplyTex.texID = subTexID;
+            [prebakedTextures setObject:maplyTex forKey:[names objectAtIndex:ii]];
+        }
+    }
+
+    // Flush the textures and sub texture mappings into the scene
+    [atlasBuilder processIntoScene:scene layerThread:layerThread texIDs:nil];
+
+    return ok;
+}
+
+- (MaplyTexture *)prebakedIconForName:(NSString *)name
+{
+    if (!name)
+        return nil;
+
+    @synchronized(self)
+    {
+        return [prebakedTextures objectForKey:name];
+    }
+}
+
+- (void)clearIconCache
+{
+    [imageCache removeAllObjects];
+}
+
 + (UIImage *)iconForName:(NSString *)name size:(CGSize)size
 {
     return [[self shared] iconForName:name size:size color:[UIColor blackColor] circleColor:[UIColor whiteColor] strokeSize:1.0 strokeColor:[UIColor blackColor]];
@@ -127,4 +208,24 @@
     return [[self shared] iconForName:name size:size color:color circleColor:circleColor strokeSize:strokeSize strokeColor:strokeColor];
 }
 
++ (bool)prebakeIconSet:(NSArray *)names size:(CGSize)size viewC:(MaplyBaseViewController *)viewC
+{
+    return [[self shared] prebakeIconSet:names size:size color:[UIColor blackColor] circleColor:[UIColor whiteColor] strokeSize:1.0 strokeColor:[UIColor blackColor] viewC:viewC];
+}
+
++ (bool)prebakeIconSet:(NSArray *)names size:(CGSize)size color:(UIColor *)color circleColor:(UIColor *)circleColor strokeSize:(float)strokeSize strokeColor:(UIColor *)strokeColor viewC:(MaplyBaseViewController *)viewC
+{
+    return [[self shared] prebakeIconSet:names size:size color:color circleColor:circleColor strokeSize:strokeSize strokeColor:strokeColor viewC:viewC];
+}
+
++ (MaplyTexture *)prebakedIconForName:(NSString *)name
+{
+    return [[self shared] prebakedIconForName:name];
+}
+
++ (void)clearIconCache
+{
+    [[self shared] clearIconCache];
+}
+
 @end
@@ -18,14 +18,58 @@
  *
  */
 
+#import <vector>
+#import <libkern/OSAtomic.h>
 #import "MaplyMBTileSource.h"
 #import "MaplyCoordinateSystem.h"
+#import "MaplyQuadImageTilesLayer.h"
 #import "WhirlyGlobe.h"
 #import "MaplyCoordinateSystem_private.h"
 
+// Simultaneous reads we'll run when the layer leaves fetching to us
+static const int MBTilesFetchWidth = 4;
+
+// Process unique IDs for the per-thread connection keys.  An object
+//  address can be reused by a later instance; a counter can't, so a
+//  pooled thread never picks up a dead instance's connection.
+static volatile int32_t MBTileSourceSeed = 0;
+
 using namespace Eigen;
 using namespace WhirlyKit;
 
+namespace
+{
+
+/** One thread's view of the archive: a read-only sqlite connection and
+    the statements we run over and over, prepared once.  Per-thread
+    connections mean fetches on different threads don't serialize on a
+    single database handle.
+  */
+class MBTileConnection
+{
+public:
+    MBTileConnection() : db(NULL), tileStmt(NULL), mapStmt(NULL), imageStmt(NULL), validStmt(NULL) { }
+    ~MBTileConnection()
+    {
+        if (tileStmt)
+            sqlite3_finalize(tileStmt);
+        if (mapStmt)
+            sqlite3_finalize(mapStmt);
+        if (imageStmt)
+            sqlite3_finalize(imageStmt);
+        if (validStmt)
+            sqlite3_finalize(validStmt);
+        if (db)
+            sqlite3_close(db);
+    }
+
+    sqlite3 *db;
+    // tiles style archives use tileStmt, the older layout uses map + images
+    sqlite3_stmt *tileStmt,*mapStmt,*imageStmt,*validStmt;
+};
+
+}
+
 @implementation MaplyMBTileSource
 {
     bool tilesStyles;
@@ -33,7 +77,13 @@ using namespace WhirlyKit;
     int _pixelsPerTile;
     WhirlyKit::Mbr _mbr;
     WhirlyKit::GeoMbr _geoMbr;
-    sqlite3 *_sqlDb;
+    NSString *dbPath;
+    // Our slot in the thread dictionaries, unique for the process lifetime
+    int32_t instanceID;
+    // Every connection we've handed out, for cleanup
+    std::vector<MBTileConnection *> connections;
+    // Bounded queue for fetches the layer hands off to us
+    NSOperationQueue *fetchQueue;
 }
 
 - (id)initWithMBTiles:(NSString *)mbTilesName
@@ -41,7 +91,9 @@ using namespace WhirlyKit;
     self = [super init];
     if (!self)
         return nil;
-    
+
+    instanceID = OSAtomicIncrement32(&MBTileSourceSeed);
+
     NSString *infoPath = nil;
     // See if that was a direct path first
     if ([[NSFileManager defaultManager] fileExistsAtPath:mbTilesName])
@@ -61,40 +113,56 @@ using namespace WhirlyKit;
         }
     }
     
-    // Open the sqlite DB
-    if (sqlite3_open([infoPath cStringUsingEncoding:NSASCIIStringEncoding],&_sqlDb) != SQLITE_OK)
+    // Open the sqlite DB to read the metadata.
+    // Tile fetches get their own per-thread connections later.
+    dbPath = infoPath;
+    _mmapSize = 64*1024*1024;
+    _sqliteCacheSize = 0;
+    sqlite3 *sqlDb = NULL;
+    if (sqlite3_open([infoPath cStringUsingEncoding:NSASCIIStringEncoding],&sqlDb) != SQLITE_OK)
     {
         return nil;
     }
     
     _coordSys = [[MaplySphericalMercator alloc] initWebStandard];
     
-    // Look at the metadata
-    sqlhelpers::StatementRead readStmt(_sqlDb,@"select value from metadata where name='bounds';");
-    // Note: Debugging
-    if (readStmt.stepRow())
-    {
-        NSString *bounds = readStmt.getString();
-        NSScanner *scan = [NSScanner scannerWithString:bounds];
-        NSMutableCharacterSet *charSet = [[NSMutableCharacterSet alloc] init];
-        [charSet addCharactersInString:@","];
-        [scan setCharactersToBeSkipped:charSet];
-        double ll_lat,ll_lon,ur_lat,ur_lon;
-        if (![scan scanDouble:&ll_lon] ||
-            ![scan scanDouble:&ll_lat] ||
-            ![scan scanDouble:&ur_lon] ||
-            ![scan scanDouble:&ur_lat])
+    // Look at the metadata.
+    // The statements are scoped so they're all finalized before we
+    //  close this connection at the bottom.
+    bool boundsFailed = false;
+    {
+        sqlhelpers::StatementRead readStmt(sqlDb,@"select value from metadata where name='bounds';");
+        // Note: Debugging
+        if (readStmt.stepRow())
         {
-            return nil;
+            NSString *bounds = readStmt.getString();
+            NSScanner *scan = [NSScanner scannerWithString:bounds];
+            NSMutableCharacterSet *charSet = [[NSMutableCharacterSet alloc] init];
+            [charSet addCharactersInString:@","];
+            [scan setCharactersToBeSkipped:charSet];
+            double ll_lat,ll_lon,ur_lat,ur_lon;
+            if (![scan scanDouble:&ll_lon] ||
+                ![scan scanDouble:&ll_lat] ||
+                ![scan scanDouble:&ur_lon] ||
+                ![scan scanDouble:&ur_lat])
+            {
+                boundsFailed = true;
+            } else {
+                _geoMbr.ll() = GeoCoord::CoordFromDegrees(ll_lon,ll_lat);
+                _geoMbr.ur() = GeoCoord::CoordFromDegrees(ur_lon,ur_lat);
+            }
+        } else {
+            // No bounds implies it covers the whole earth
+            _geoMbr.ll() = GeoCoord::CoordFromDegrees(-180, -85.0511);
+            _geoMbr.ur() = GeoCoord::CoordFromDegrees(180, 85.0511);
         }
-        _geoMbr.ll() = GeoCoord::CoordFromDegrees(ll_lon,ll_lat);
-        _geoMbr.ur() = GeoCoord::CoordFromDegrees(ur_lon,ur_lat);
-    } else {
-        // No bounds implies it covers the whole earth
-        _geoMbr.ll() = GeoCoord::CoordFromDegrees(-180, -85.0511);
-        _geoMbr.ur() = GeoCoord::CoordFromDegrees(180, 85.0511);
     }
-    
+    if (boundsFailed)
+    {
+        sqlite3_close(sqlDb);
+        return nil;
+    }
+
     // And let's convert that over to spherical mercator
     Point3f ll = [_coordSys getCoordSystem]->geographicToLocal(_geoMbr.ll());
     _mbr.ll() = Point2f(ll.x(),ll.y());
@@ -102,37 +170,130 @@ using namespace WhirlyKit;
     _mbr.ur() = Point2f(ur.x(),ur.y());
     
     _minZoom = 0;  _maxZoom = 8;
-    sqlhelpers::StatementRead readStmt2(_sqlDb,@"select value from metadata where name='minzoom';");
-    if (readStmt2.stepRow())
-        _minZoom = [readStmt2.getString() intValue];
-    else {
-        // Read it the hard way
-        sqlhelpers::StatementRead readStmt3(_sqlDb,@"select min(zoom_level) from tiles;");
-        if (readStmt3.stepRow())
-            _minZoom = [readStmt3.getString() intValue];
+    {
+        sqlhelpers::StatementRead readStmt2(sqlDb,@"select value from metadata where name='minzoom';");
+        if (readStmt2.stepRow())
+            _minZoom = [readStmt2.getString() intValue];
+        else {
+            // Read it the hard way
+            sqlhelpers::StatementRead readStmt3(sqlDb,@"select min(zoom_level) from tiles;");
+            if (readStmt3.stepRow())
+                _minZoom = [readStmt3.getString() intValue];
+        }
     }
-    sqlhelpers::StatementRead readStmt3(_sqlDb,@"select value from metadata where name='maxzoom';");
-    if (readStmt3.stepRow())
-        _maxZoom = [readStmt3.getString() intValue];
-    else {
-        // Read it the hard way
-        sqlhelpers::StatementRead readStmt3(_sqlDb,@"select max(zoom_level) from tiles;");
+    {
+        sqlhelpers::StatementRead readStmt3(sqlDb,@"select value from metadata where name='maxzoom';");
         if (readStmt3.stepRow())
             _maxZoom = [readStmt3.getString() intValue];
+        else {
+            // Read it the hard way
+            sqlhelpers::StatementRead readStmt3(sqlDb,@"select max(zoom_level) from tiles;");
+            if (readStmt3.stepRow())
+                _maxZoom = [readStmt3.getString() intValue];
+        }
     }
-    
+
     // Note: We could load something and calculate this, but I don't want to slow us down here
     _pixelsPerTile = 256;
     
     // See if there's a tiles table or it's the older(?) style
-    sqlhelpers::StatementRead testStmt(_sqlDb,@"SELECT name FROM sqlite_master WHERE type='table' AND name='tiles';");
-    if (testStmt.stepRow())
-        tilesStyles = true;
+    {
+        sqlhelpers::StatementRead testStmt(sqlDb,@"SELECT name FROM sqlite_master WHERE type='table' AND name='tiles';");
+        if (testStmt.stepRow())
+            tilesStyles = true;
+    }
+
+    sqlite3_close(sqlDb);
+
+    fetchQueue = [[NSOperationQueue alloc] init];
+    fetchQueue.maxConcurrentOperationCount = MBTilesFetchWidth;
 
-    
     return self;
 }
 
+- (void)dealloc
+{
+    @synchronized(self)
+    {
+        for (unsigned int ii=0;ii<connections.size();ii++)
+            delete connections[ii];
+        connections.clear();
+    }
+}
+
+// Apply the mmap and page cache settings to a connection
+- (void)applyTuning:(sqlite3 *)db
+{
+    char pragmaStmt[100];
+    sprintf(pragmaStmt,"PRAGMA mmap_size=%lld;",_mmapSize);
+    sqlite3_exec(db,pragmaStmt,NULL,NULL,NULL);
+    if (_sqliteCacheSize > 0)
+    {
+        // Negative means KB to sqlite
+        sprintf(pragmaStmt,"PRAGMA cache_size=-%lld;",_sqliteCacheSize/1024);
+        sqlite3_exec(db,pragmaStmt,NULL,NULL,NULL);
+    }
+}
+
+- (void)setMmapSize:(long long)mmapSize
+{
+    _mmapSize = mmapSize;
+    [self retuneConnections];
+}
+
+- (void)setSqliteCacheSize:(long long)sqliteCacheSize
+{
+    _sqliteCacheSize = sqliteCacheSize;
+    [self retuneConnections];
+}
+
+- (void)retuneConnections
+{
+    @synchronized(self)
+    {
+        for (unsigned int ii=0;ii<connections.size();ii++)
+            [self applyTuning:connections[ii]->db];
+    }
+}
+
+// Fetch (or set up) the current thread's connection.
+// If the thread goes away the connection sticks around until we do,
+//  but the layer threads doing the fetching are long lived anyway.
+- (MBTileConnection *)connectionForThread
+{
+    NSMutableDictionary *threadDict = [[NSThread currentThread] threadDictionary];
+    NSString *key = [NSString stringWithFormat:@"MaplyMBTileSource_%d",instanceID];
+    NSValue *connVal = threadDict[key];
+    if (connVal)
+        return (MBTileConnection *)[connVal pointerValue];
+
+    MBTileConnection *conn = new MBTileConnection();
+    if (sqlite3_open_v2([dbPath cStringUsingEncoding:NSASCIIStringEncoding],&conn->db,SQLITE_OPEN_READONLY,NULL) != SQLITE_OK)
+    {
+        delete conn;
+        return NULL;
+    }
+    [self applyTuning:conn->db];
+
+    if (tilesStyles)
+    {
+        sqlite3_prepare_v2(conn->db,"SELECT tile_data from tiles where zoom_level=? AND tile_column=? AND tile_row=?;",-1,&conn->tileStmt,NULL);
+        sqlite3_prepare_v2(conn->db,"SELECT 1 from tiles where zoom_level=? AND tile_column=? AND tile_row=?;",-1,&conn->validStmt,NULL);
+    } else {
+        sqlite3_prepare_v2(conn->db,"SELECT tile_id from map where zoom_level=? AND tile_column=? AND tile_row=?;",-1,&conn->mapStmt,NULL);
+        sqlite3_prepare_v2(conn->db,"SELECT tile_data from images where tile_id=?;",-1,&conn->imageStmt,NULL);
+        sqlite3_prepare_v2(conn->db,"SELECT 1 from map where zoom_level=? AND tile_column=? AND tile_row=?;",-1,&conn->validStmt,NULL);
+    }
+
+    threadDict[key] = [NSValue valueWithPointer:conn];
+    @synchronized(self)
+    {
+        connections.push_back(conn);
+    }
+
+    return conn;
+}
+
 - (int)minZoom
 {
     return _minZoom;
@@ -153,50 +314,108 @@ using namespace WhirlyKit;
     return true;
 }
 
-- (id)imageForTile:(MaplyTileID)tileID
+// Run the tile lookup on the given connection's statements
+- (NSData *)fetchTileData:(MaplyTileID)tileID conn:(MBTileConnection *)conn
 {
     NSData *imageData = nil;
-    
-    @synchronized(self)
+
+    if (conn->tileStmt)
     {
-        if (tilesStyles)
+        sqlite3_bind_int(conn->tileStmt,1,tileID.level);
+        sqlite3_bind_int(conn->tileStmt,2,tileID.x);
+        sqlite3_bind_int(conn->tileStmt,3,tileID.y);
+        if (sqlite3_step(conn->tileStmt) == SQLITE_ROW)
         {
-            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from tiles where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",tileID.level,tileID.x,tileID.y]);
-            if (readStmt.stepRow())
-                imageData = readStmt.getBlob();
-        } else {
-            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_id from map where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",tileID.level,tileID.x,tileID.y]);
-            if (readStmt.stepRow())
+            const void *blob = sqlite3_column_blob(conn->tileStmt,0);
+            int blobLen = sqlite3_column_bytes(conn->tileStmt,0);
+            imageData = [NSData dataWithBytes:blob length:blobLen];
+        }
+        sqlite3_reset(conn->tileStmt);
+    } else if (conn->mapStmt)
+    {
+        sqlite3_bind_int(conn->mapStmt,1,tileID.level);
+        sqlite3_bind_int(conn->mapStmt,2,tileID.x);
+        sqlite3_bind_int(conn->mapStmt,3,tileID.y);
+        if (sqlite3_step(conn->mapStmt) == SQLITE_ROW)
+        {
+            const unsigned char *tile_id = sqlite3_column_text(conn->mapStmt,0);
+            sqlite3_bind_text(conn->imageStmt,1,(const char *)tile_id,-1,SQLITE_TRANSIENT);
+            if (sqlite3_step(conn->imageStmt) == SQLITE_ROW)
             {
-                NSString *tile_id = readStmt.getString();
-                sqlhelpers::StatementRead readStmt2(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from images where tile_id='%@';",tile_id]);
-                if (readStmt2.stepRow())
-                    imageData = readStmt2.getBlob();
+                const void *blob = sqlite3_column_blob(conn->imageStmt,0);
+                int blobLen = sqlite3_column_bytes(conn->imageStmt,0);
+                imageData = [NSData dataWithBytes:blob length:blobLen];
             }
+            sqlite3_reset(conn->imageStmt);
         }
+        sqlite3_reset(conn->mapStmt);
     }
-    
+
     return imageData;
 }
 
+- (id)imageForTile:(MaplyTileID)tileID
+{
+    MBTileConnection *conn = [self connectionForThread];
+    if (!conn)
+        return nil;
+
+    return [self fetchTileData:tileID conn:conn];
+}
 
-- (bool)validTile:(MaplyTileID)tileID bbox:(MaplyBoundingBox *)bbox
+- (void)startFetchLayer:(MaplyQuadImageTilesLayer *)layer tile:(MaplyTileID)tileID
 {
-    @synchronized(self)
+    // Run the read on our own bounded queue rather than whatever thread
+    //  the layer happens to be on.  The per thread connections mean the
+    //  reads genuinely run in parallel.
+    [fetchQueue addOperationWithBlock:
+    ^{
+        NSData *imgData = [self imageForTile:tileID];
+        if (imgData)
+            [layer loadedImages:imgData forTile:tileID];
+        else
+            [layer loadError:nil forTile:tileID];
+    }];
+}
+
+- (NSArray *)imagesForTiles:(NSArray *)tileIDs
+{
+    MBTileConnection *conn = [self connectionForThread];
+    if (!conn)
+        return nil;
+
+    NSMutableArray *results = [NSMutableArray array];
+    // One transaction for the whole batch saves sqlite re-acquiring
+    //  its locks per tile
+    sqlite3_exec(conn->db,"BEGIN;",NULL,NULL,NULL);
+    for (NSValue *tileVal in tileIDs)
     {
-        if (tilesStyles)
-        {
-            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT 1 from tiles where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",tileID.level,tileID.x,tileID.y]);
-            if (readStmt.stepRow())
-                return YES;
-        } else {
-            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT 1 from map where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",tileID.level,tileID.x,tileID.y]);
-            if (readStmt.stepRow())
-                return YES;
-        }
+        MaplyTileID tileID;
+        [tileVal getValue:&tileID];
+        NSData *imageData = [self fetchTileData:tileID conn:conn];
+        [results addObject:(imageData ? imageData : (id)[NSNull null])];
     }
+    sqlite3_exec(conn->db,"COMMIT;",NULL,NULL,NULL);
+
+    return results;
+}
+
+
+- (bool)validTile:(MaplyTileID)tileID bbox:(MaplyBoundingBox *)bbox
+{
+    MBTileConnection *conn = [self connectionForThread];
+    if (!conn || !conn->validStmt)
+        return NO;
+
+    bool valid = false;
+    sqlite3_bind_int(conn->validStmt,1,tileID.level);
+    sqlite3_bind_int(conn->validStmt,2,tileID.x);
+    sqlite3_bind_int(conn->validStmt,3,tileID.y);
+    if (sqlite3_step(conn->validStmt) == SQLITE_ROW)
+        valid = true;
+    sqlite3_reset(conn->validStmt);
 
-    return NO;
+    return valid;
 }
 
 
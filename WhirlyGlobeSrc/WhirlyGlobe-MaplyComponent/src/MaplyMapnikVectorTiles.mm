@@ -34,7 +34,8 @@
 #import "MaplyVectorObject_private.h"
 #import "MaplyScreenLabel.h"
 #import "NSData+Zlib.h"
-#import "vector_tile.pb.h"
+#import "DataCompressor.h"
+#import "TilePipelineTrace.h"
 #import "VectorData.h"
 #import "MaplyMBTileSource.h"
 #import "AFHTTPRequestOperation.h"
@@ -53,6 +54,194 @@ using namespace WhirlyGlobe;
 
 static double MAX_EXTENT = 20037508.342789244;
 
+/* Minimal protobuf wire format scanner.
+   The generated parser (vector_tile.pb.cpp) builds a full heap copy of the
+   tile -- every string, tag and geometry varint -- before we even start
+   converting to vectors, and that copy is the biggest single cost in the
+   tile decode.  Since the vector tile schema is tiny and frozen we walk
+   the raw varint streams in place instead and decode the coordinates
+   straight into the shapes' own storage.
+ */
+typedef struct {
+  const uint8_t *pos;
+  const uint8_t *end;
+} PbfBuffer;
+
+typedef enum {PbfWireVarint=0,PbfWireFixed64=1,PbfWireDelimited=2,PbfWireFixed32=5} PbfWireType;
+
+//Field numbers from vector_tile.proto
+typedef enum {TileLayersField=3} PbfTileFields;
+typedef enum {LayerNameField=1,LayerFeaturesField=2,LayerKeysField=3,LayerValuesField=4,LayerExtentField=5} PbfLayerFields;
+typedef enum {FeatureTagsField=2,FeatureTypeField=3,FeatureGeometryField=4} PbfFeatureFields;
+typedef enum {ValueStringField=1,ValueFloatField=2,ValueDoubleField=3,ValueIntField=4,ValueUintField=5,ValueSintField=6,ValueBoolField=7} PbfValueFields;
+
+static bool PbfReadVarint(PbfBuffer *buf, uint64_t *val) {
+  *val = 0;
+  int shift = 0;
+  while (buf->pos < buf->end) {
+    uint8_t byte = *buf->pos++;
+    *val |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+    shift += 7;
+    if (shift >= 64)
+      return false;
+  }
+  return false;
+}
+
+static bool PbfReadTag(PbfBuffer *buf, unsigned *fieldNum, unsigned *wireType) {
+  uint64_t val;
+  if (!PbfReadVarint(buf, &val))
+    return false;
+  *fieldNum = (unsigned)(val >> 3);
+  *wireType = (unsigned)(val & 0x7);
+  return true;
+}
+
+//Length delimited fields (strings, sub messages, packed arrays) become a
+// sub buffer aliasing the parent; nothing gets copied
+static bool PbfReadSubMessage(PbfBuffer *buf, PbfBuffer *sub) {
+  uint64_t len;
+  if (!PbfReadVarint(buf, &len) || len > (uint64_t)(buf->end - buf->pos))
+    return false;
+  sub->pos = buf->pos;
+  sub->end = buf->pos + len;
+  buf->pos += len;
+  return true;
+}
+
+static bool PbfSkip(PbfBuffer *buf, unsigned wireType) {
+  uint64_t val;
+  switch (wireType) {
+    case PbfWireVarint:
+      return PbfReadVarint(buf, &val);
+    case PbfWireFixed64:
+      if (buf->end - buf->pos < 8)
+        return false;
+      buf->pos += 8;
+      return true;
+    case PbfWireDelimited: {
+      PbfBuffer sub;
+      return PbfReadSubMessage(buf, &sub);
+    }
+    case PbfWireFixed32:
+      if (buf->end - buf->pos < 4)
+        return false;
+      buf->pos += 4;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static NSString *PbfMakeString(PbfBuffer buf) {
+  if (!buf.pos)
+    return nil;
+  return [[NSString alloc] initWithBytes:buf.pos length:buf.end-buf.pos encoding:NSUTF8StringEncoding];
+}
+
+/* A packed repeated field normally arrives as a single length delimited
+   blob, but an encoder is allowed to split it (or write the values
+   unpacked).  This chains the pieces so the geometry decode below sees
+   one stream of varints.
+ */
+typedef struct {
+  const std::vector<PbfBuffer> *chunks;
+  size_t which;
+  PbfBuffer cur;
+} PbfPackedCursor;
+
+static void PbfPackedStart(PbfPackedCursor *cursor, const std::vector<PbfBuffer> &chunks) {
+  cursor->chunks = &chunks;
+  cursor->which = 0;
+  if (!chunks.empty()) {
+    cursor->cur = chunks[0];
+  } else {
+    cursor->cur.pos = cursor->cur.end = NULL;
+  }
+}
+
+static bool PbfPackedAtEnd(PbfPackedCursor *cursor) {
+  while (cursor->cur.pos >= cursor->cur.end) {
+    if (cursor->which + 1 >= cursor->chunks->size())
+      return true;
+    cursor->cur = (*cursor->chunks)[++cursor->which];
+  }
+  return false;
+}
+
+static uint32_t PbfPackedNext(PbfPackedCursor *cursor) {
+  uint64_t val = 0;
+  if (PbfPackedAtEnd(cursor) || !PbfReadVarint(&cursor->cur, &val))
+    return 0;
+  return (uint32_t)val;
+}
+
+//Decode a tile_value one-of into something we can drop in an attribute
+// dictionary.  Returns nil if the value is empty or malformed.
+static id PbfDecodeValue(PbfBuffer valBuf) {
+  unsigned fieldNum, wireType;
+  uint64_t val;
+  id result = nil;
+  while (valBuf.pos < valBuf.end) {
+    if (!PbfReadTag(&valBuf, &fieldNum, &wireType))
+      return nil;
+    switch (fieldNum) {
+      case ValueStringField: {
+        PbfBuffer strBuf;
+        if (!PbfReadSubMessage(&valBuf, &strBuf))
+          return nil;
+        result = PbfMakeString(strBuf);
+        break;
+      }
+      case ValueFloatField: {
+        float fval;
+        if (valBuf.end - valBuf.pos < 4)
+          return nil;
+        memcpy(&fval, valBuf.pos, 4);
+        valBuf.pos += 4;
+        result = @(fval);
+        break;
+      }
+      case ValueDoubleField: {
+        double dval;
+        if (valBuf.end - valBuf.pos < 8)
+          return nil;
+        memcpy(&dval, valBuf.pos, 8);
+        valBuf.pos += 8;
+        result = @(dval);
+        break;
+      }
+      case ValueIntField:
+        if (!PbfReadVarint(&valBuf, &val))
+          return nil;
+        result = @((int64_t)val);
+        break;
+      case ValueUintField:
+        if (!PbfReadVarint(&valBuf, &val))
+          return nil;
+        result = @(val);
+        break;
+      case ValueSintField:
+        if (!PbfReadVarint(&valBuf, &val))
+          return nil;
+        result = @((int64_t)((val >> 1) ^ (-(int64_t)(val & 1))));
+        break;
+      case ValueBoolField:
+        if (!PbfReadVarint(&valBuf, &val))
+          return nil;
+        result = @((bool)val);
+        break;
+      default:
+        if (!PbfSkip(&valBuf, wireType))
+          return nil;
+        break;
+    }
+  }
+  return result;
+}
+
 + (void) StartRemoteVectorTilesWithTileSpec:(NSString *)tileSpecURL style:(NSString *)styleURL cacheDir:(NSString *)cacheDir viewC:(MaplyBaseViewController *)viewC success:(void (^)(MaplyMapnikVectorTiles *vecTiles))successBlock failure:(void (^)(NSError *error))failureBlock
 {
     // We'll invoke this block when we've fetched the tilespec and the style file
@@ -226,13 +415,13 @@ static double MAX_EXTENT = 20037508.342789244;
     double y;
     int32_t dx;
     int32_t dy;
-    int geometrySize;
     MapnikGeometryType g_type;
     int cmd;
     const int cmd_bits = 3;
     unsigned length;
-    int k;
     unsigned cmd_length;
+    unsigned fieldNum;
+    unsigned wireType;
     Point2f point;
     Point2f firstCoord;
 
@@ -260,89 +449,200 @@ static double MAX_EXTENT = 20037508.342789244;
       tileData = [tileSource imageForTile:flippedYTile];
       
       if(tileData.length) {
-        if([tileData isCompressed]) {
+        NSTimeInterval inflateStart = CFAbsoluteTimeGetCurrent();
+        if(WhirlyKit::IsCodecFramed([tileData bytes],[tileData length])) {
+          // Codec framed blobs (LZ4 and friends) say what they are
+          tileData = WhirlyKit::CodecDecompress(tileData);
+          if(!tileData.length) {
+            NSLog(@"Error: tile data was nil after decompression");
+            continue;
+          }
+          WhirlyKit::TilePipelineTrace::addSpan(tileID.level,tileID.x,tileID.y,WhirlyKit::TilePipelineTrace::StageInflate,inflateStart,CFAbsoluteTimeGetCurrent());
+        } else if([tileData isCompressed]) {
           tileData = [tileData uncompressGZip];
           if(!tileData.length) {
             NSLog(@"Error: tile data was nil after decompression");
             continue;
           }
+          WhirlyKit::TilePipelineTrace::addSpan(tileID.level,tileID.x,tileID.y,WhirlyKit::TilePipelineTrace::StageInflate,inflateStart,CFAbsoluteTimeGetCurrent());
         }
         
-        //now attempt to open protobuf
-        mapnik::vector::tile tile;
-        if(tile.ParseFromArray(tileData.bytes, (int)tileData.length)) {
-          tileData = nil;
+        //now scan the protobuf directly rather than letting the generated
+        // parser build an intermediate copy of the whole tile
+        bool parseOk = true;
+        {
+          PbfBuffer tileBuf;
+          tileBuf.pos = (const uint8_t *)[tileData bytes];
+          tileBuf.end = tileBuf.pos + [tileData length];
           //Itterate layers
-          for (unsigned i=0;i<tile.layers_size();++i) {
-            mapnik::vector::tile_layer const& tileLayer = tile.layers(i);
-            scale = tileLayer.extent() / 256.0;
-            NSString *layerName = [NSString stringWithUTF8String:tileLayer.name().c_str()];
+          while (parseOk && tileBuf.pos < tileBuf.end) {
+            if (!(parseOk = PbfReadTag(&tileBuf, &fieldNum, &wireType)))
+              break;
+            if (fieldNum != TileLayersField || wireType != PbfWireDelimited) {
+              parseOk = PbfSkip(&tileBuf, wireType);
+              continue;
+            }
+            PbfBuffer layerBuf;
+            if (!(parseOk = PbfReadSubMessage(&tileBuf, &layerBuf)))
+              break;
+
+            //Find the pieces of the layer.  Field order isn't guaranteed and
+            // mapnik writes the features ahead of the key/value tables, so
+            // note where everything is and come back for the features
+            PbfBuffer nameBuf;
+            nameBuf.pos = nameBuf.end = NULL;
+            uint64_t extent = 4096;
+            std::vector<PbfBuffer> keyBufs,valueBufs,featureBufs;
+            PbfBuffer scanBuf = layerBuf;
+            while (parseOk && scanBuf.pos < scanBuf.end) {
+              if (!(parseOk = PbfReadTag(&scanBuf, &fieldNum, &wireType)))
+                break;
+              if (wireType == PbfWireDelimited) {
+                PbfBuffer subBuf;
+                if (!(parseOk = PbfReadSubMessage(&scanBuf, &subBuf)))
+                  break;
+                switch (fieldNum) {
+                  case LayerNameField:     nameBuf = subBuf;                break;
+                  case LayerFeaturesField: featureBufs.push_back(subBuf);  break;
+                  case LayerKeysField:     keyBufs.push_back(subBuf);      break;
+                  case LayerValuesField:   valueBufs.push_back(subBuf);    break;
+                }
+              } else if (fieldNum == LayerExtentField && wireType == PbfWireVarint) {
+                parseOk = PbfReadVarint(&scanBuf, &extent);
+              } else {
+                parseOk = PbfSkip(&scanBuf, wireType);
+              }
+            }
+            if (!parseOk)
+              break;
+
+            scale = extent / 256.0;
+            NSString *layerName = PbfMakeString(nameBuf);
             if(![self.styleDelegate layerShouldDisplay:layerName]) {
               // if we dont have any styles for a layer, dont bother parsing the features
               continue;
             }
-            
+
+            //Decode the key and value tables once for the whole layer,
+            // not once per feature tag
+            NSMutableArray *layerKeys = [NSMutableArray arrayWithCapacity:keyBufs.size()];
+            for (unsigned int ii=0;ii<keyBufs.size();ii++) {
+              NSString *key = PbfMakeString(keyBufs[ii]);
+              [layerKeys addObject:(key ? key : @"")];
+            }
+            NSMutableArray *layerValues = [NSMutableArray arrayWithCapacity:valueBufs.size()];
+            for (unsigned int ii=0;ii<valueBufs.size();ii++) {
+              id value = PbfDecodeValue(valueBufs[ii]);
+              [layerValues addObject:(value ? value : [NSNull null])];
+            }
+
+            //Features in the same layer tend to repeat the same attribute
+            // combinations, and the style delegate runs its rules over every
+            // lookup.  Resolve each distinct attribute signature once
+            NSMutableDictionary *styleCache = [NSMutableDictionary new];
+
             //itterate features
-            for (unsigned j=0;j<tileLayer.features_size();++j) {
+            for (unsigned j=0;parseOk && j<featureBufs.size();++j) {
               featureCount++;
-              mapnik::vector::tile_feature const & f = tileLayer.features(j);
-              g_type = static_cast<MapnikGeometryType>(f.type());
-              
+              uint64_t rawType = 0;
+              std::vector<uint32_t> tags;
+              std::vector<PbfBuffer> geomBufs;
+              scanBuf = featureBufs[j];
+              while (parseOk && scanBuf.pos < scanBuf.end) {
+                if (!(parseOk = PbfReadTag(&scanBuf, &fieldNum, &wireType)))
+                  break;
+                switch (fieldNum) {
+                  case FeatureTagsField:
+                    if (wireType == PbfWireDelimited) {
+                      PbfBuffer tagBuf;
+                      if (!(parseOk = PbfReadSubMessage(&scanBuf, &tagBuf)))
+                        break;
+                      uint64_t tagVal;
+                      while (tagBuf.pos < tagBuf.end && (parseOk = PbfReadVarint(&tagBuf, &tagVal)))
+                        tags.push_back((uint32_t)tagVal);
+                    } else {
+                      uint64_t tagVal;
+                      if ((parseOk = PbfReadVarint(&scanBuf, &tagVal)))
+                        tags.push_back((uint32_t)tagVal);
+                    }
+                    break;
+                  case FeatureTypeField:
+                    parseOk = PbfReadVarint(&scanBuf, &rawType);
+                    break;
+                  case FeatureGeometryField:
+                    if (wireType == PbfWireDelimited) {
+                      PbfBuffer geomBuf;
+                      if ((parseOk = PbfReadSubMessage(&scanBuf, &geomBuf)))
+                        geomBufs.push_back(geomBuf);
+                    } else {
+                      //unpacked encoding: a span covering just the one varint
+                      PbfBuffer geomBuf;
+                      geomBuf.pos = scanBuf.pos;
+                      uint64_t geomVal;
+                      if ((parseOk = PbfReadVarint(&scanBuf, &geomVal))) {
+                        geomBuf.end = scanBuf.pos;
+                        geomBufs.push_back(geomBuf);
+                      }
+                    }
+                    break;
+                  default:
+                    parseOk = PbfSkip(&scanBuf, wireType);
+                    break;
+                }
+              }
+              if (!parseOk)
+                break;
+              g_type = static_cast<MapnikGeometryType>(rawType);
+
               //Parse attributes
               NSMutableDictionary *attributes = [NSMutableDictionary new];
               attributes[@"geometry_type"] = @(g_type); //this seems wastefull, but is needed for the rule matcher
-              
-              for (int m = 0; m < f.tags_size(); m += 2) {
-                UInt32 key_name = f.tags(m);
-                UInt32 key_value = f.tags(m + 1);
-                if (key_name < static_cast<std::size_t>(tileLayer.keys_size())
-                    && key_value < static_cast<std::size_t>(tileLayer.values_size())) {
-                  NSString *key = [NSString stringWithUTF8String:tileLayer.keys(key_name).c_str()];
+
+              for (unsigned int m = 0; m + 1 < tags.size(); m += 2) {
+                UInt32 key_name = tags[m];
+                UInt32 key_value = tags[m + 1];
+                if (key_name < layerKeys.count && key_value < layerValues.count) {
+                  NSString *key = layerKeys[key_name];
                   if(!key.length) {
                     continue;
                   }
-                  
-                  mapnik::vector::tile_value const& value = tileLayer.values(key_value);
-                  if (value.has_string_value()) {
-                    attributes[key] = [NSString stringWithUTF8String:value.string_value().c_str()];
-                  } else if (value.has_int_value()) {
-                    attributes[key] = @(value.int_value());
-                  } else if (value.has_double_value()) {
-                    attributes[key] = @(value.double_value());
-                  } else if (value.has_float_value()) {
-                    attributes[key] = @(value.float_value());
-                  } else if (value.has_bool_value()) {
-                    attributes[key] = @(value.bool_value());
-                  } else if (value.has_sint_value()) {
-                    attributes[key] = @(value.sint_value());
-                  } else if (value.has_uint_value()) {
-                    attributes[key] = @(value.uint_value());
+
+                  id value = layerValues[key_value];
+                  if (value != [NSNull null]) {
+                    attributes[key] = value;
                   }
                 }
               }
               
-              NSArray *styles = [self.styleDelegate stylesForFeatureWithAttributes:attributes
-                                                                            onTile:tileID
-                                                                           inLayer:layerName];
+              NSArray *styles = styleCache[attributes];
+              if (!styles) {
+                styles = [self.styleDelegate stylesForFeatureWithAttributes:attributes
+                                                                     onTile:tileID
+                                                                    inLayer:layerName];
+                //cache misses as well as hits, since whole layers of
+                // features can resolve to nothing
+                styleCache[attributes] = (styles ? styles : @[]);
+              }
               if(!styles.count) {
                 continue; //no point parsing the geometry if we arent going to render
               }
               
-              //Parse geometry
+              //Parse geometry straight out of the buffer
               x = 0;
               y = 0;
-              geometrySize = f.geometry_size();
               cmd = -1;
               length = 0;
+              PbfPackedCursor geom;
+              PbfPackedStart(&geom, geomBufs);
               
               MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] init];
               
               try {
                 if(g_type == GeomTypeLineString) {
                   VectorLinearRef lin;
-                  for (k = 0; k < geometrySize;) {
+                  while (!PbfPackedAtEnd(&geom)) {
                     if (!length) {
-                      cmd_length = f.geometry(k++);
+                      cmd_length = PbfPackedNext(&geom);
                       cmd = cmd_length & ((1 << cmd_bits) - 1);
                       length = cmd_length >> cmd_bits;
                     }//length is the number of coordinates before the CMD changes
@@ -350,8 +650,8 @@ static double MAX_EXTENT = 20037508.342789244;
                     if (length > 0) {
                       length--;
                       if (cmd == SEG_MOVETO || cmd == SEG_LINETO) {
-                        dx = f.geometry(k++);
-                        dy = f.geometry(k++);
+                        dx = PbfPackedNext(&geom);
+                        dy = PbfPackedNext(&geom);
                         dx = ((dx >> 1) ^ (-(dx & 1)));
                         dy = ((dy >> 1) ^ (-(dy & 1)));
                         x += (static_cast<double>(dx) / scale);
@@ -396,9 +696,9 @@ static double MAX_EXTENT = 20037508.342789244;
                   VectorArealRef shape = VectorAreal::createAreal();
                   VectorRing ring;
                   
-                  for (k = 0; k < geometrySize;) {
+                  while (!PbfPackedAtEnd(&geom)) {
                     if (!length) {
-                      cmd_length = f.geometry(k++);
+                      cmd_length = PbfPackedNext(&geom);
                       cmd = cmd_length & ((1 << cmd_bits) - 1);
                       length = cmd_length >> cmd_bits;
                     }
@@ -406,8 +706,8 @@ static double MAX_EXTENT = 20037508.342789244;
                     if (length > 0) {
                       length--;
                       if (cmd == SEG_MOVETO || cmd == SEG_LINETO) {
-                        dx = f.geometry(k++);
-                        dy = f.geometry(k++);
+                        dx = PbfPackedNext(&geom);
+                        dy = PbfPackedNext(&geom);
                         dx = ((dx >> 1) ^ (-(dx & 1)));
                         dy = ((dy >> 1) ^ (-(dy & 1)));
                         x += (static_cast<double>(dx) / scale);
@@ -445,9 +745,9 @@ static double MAX_EXTENT = 20037508.342789244;
                 } else if(g_type == GeomTypePoint) {
                   VectorPointsRef shape = VectorPoints::createPoints();
                   
-                  for (k = 0; k < geometrySize;) {
+                  while (!PbfPackedAtEnd(&geom)) {
                     if (!length) {
-                      cmd_length = f.geometry(k++);
+                      cmd_length = PbfPackedNext(&geom);
                       cmd = cmd_length & ((1 << cmd_bits) - 1);
                       length = cmd_length >> cmd_bits;
                     }
@@ -455,8 +755,8 @@ static double MAX_EXTENT = 20037508.342789244;
                     if (length > 0) {
                       length--;
                       if (cmd == SEG_MOVETO || cmd == SEG_LINETO) {
-                        dx = f.geometry(k++);
-                        dy = f.geometry(k++);
+                        dx = PbfPackedNext(&geom);
+                        dy = PbfPackedNext(&geom);
                         dx = ((dx >> 1) ^ (-(dx & 1)));
                         dy = ((dy >> 1) ^ (-(dy & 1)));
                         x += (static_cast<double>(dx) / scale);
@@ -484,20 +784,30 @@ static double MAX_EXTENT = 20037508.342789244;
                 NSLog(@"Error parsing feature");
               }
               
+              //Group by style and geometry type, so each style builds its
+              // objects from one homogeneous batch per tile
               for(MaplyVectorTileStyle *style in styles) {
-                NSMutableArray *featuresForStyle = featureStyles[style.uuid];
+                NSMutableDictionary *geomForStyle = featureStyles[style.uuid];
+                if(!geomForStyle) {
+                  geomForStyle = [NSMutableDictionary new];
+                  featureStyles[style.uuid] = geomForStyle;
+                }
+                NSMutableArray *featuresForStyle = geomForStyle[@(g_type)];
                 if(!featuresForStyle) {
                   featuresForStyle = [NSMutableArray new];
-                  featureStyles[style.uuid] = featuresForStyle;
+                  geomForStyle[@(g_type)] = featuresForStyle;
                 }
                 [featuresForStyle addObject:vecObj];
               }
               vecObj.attributes = attributes;
             } //end of iterating features
           }//end of itterating layers
-        } else {
+        }
+        if (!parseOk) {
           NSLog(@"Failed to parse pbf %d/%d/%d", flippedYTile.level, flippedYTile.x, flippedYTile.y);
         }
+        //the feature and attribute spans alias the tile data, so only let
+        // go of it once we're done scanning
         tileData = nil;
       } else {
         NSLog(@"No data for tile %d/%d/%d", flippedYTile.level, flippedYTile.x, flippedYTile.y);
@@ -508,8 +818,13 @@ static double MAX_EXTENT = 20037508.342789244;
                                                                                                                  ascending:YES]]];
     for(id key in symbolizerKeys) {
       MaplyVectorTileStyle *symbolizer = [self.styleDelegate styleForUUID:key];
-      NSArray *features = featureStyles[key];
-      [components addObjectsFromArray:[symbolizer buildObjects:features viewC:layer.viewC]];
+      NSDictionary *geomForStyle = featureStyles[key];
+      //One build per (style, geometry type) pair, so each call hands the
+      // managers a batch they can merge into as few drawables as possible
+      for(NSNumber *geomType in [geomForStyle.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        NSArray *features = geomForStyle[geomType];
+        [components addObjectsFromArray:[symbolizer buildObjects:features viewC:layer.viewC]];
+      }
     }
     
     if(self.debugLabel || self.debugOutline) {
@@ -21,8 +21,11 @@
 #import <vector>
 #import <set>
 #import "MaplyMultiplexTileSource.h"
-#import "AFHTTPRequestOperation.h"
 #import "MaplyQuadImageTilesLayer.h"
+#import "MaplyTileFetchEngine_private.h"
+
+// Number of times we'll try to fetch a single frame before giving up
+static const int MaxFrameFetches = 2;
 
 namespace Maply
 {
@@ -30,8 +33,8 @@ namespace Maply
 class TileFetch
 {
 public:
-    TileFetch(int which,AFHTTPRequestOperation *op) : which(which), op(op) { }
-    TileFetch() : which(-1), op(nil) { }
+    TileFetch(int which,MaplyTileFetchRequest *request) : which(which), request(request) { }
+    TileFetch() : which(-1), request(nil) { }
     
     bool operator < (const TileFetch &that) const
     {
@@ -39,7 +42,7 @@ public:
     }
     
     int which;
-    AFHTTPRequestOperation *op;
+    MaplyTileFetchRequest *request;
 };
 typedef std::set<TileFetch> TileFetchSet;
     
@@ -75,7 +78,7 @@ public:
         for (TileFetchSet::iterator it = fetches.begin();
              it != fetches.end(); ++it)
         {
-            [it->op cancel];
+            [[MaplyTileFetchEngine sharedEngine] cancelFetch:it->request];
         }
         fetches.clear();
         tileData.clear();
@@ -260,12 +263,8 @@ typedef std::set<SortedTile> SortedTileSet;
     
     // Let's write it back out for the cache
     MaplyRemoteTileInfo *tileSource = _tileSources[which];
-    NSString *fileName = [tileSource fileNameForTile:tileID];
-    if (fileName && [tileData isKindOfClass:[NSData class]])
-    {
-        NSData *imgData = tileData;
-        [imgData writeToFile:fileName atomically:YES];
-    }
+    if ([tileData isKindOfClass:[NSData class]])
+        [tileSource writeToCache:tileID tileData:tileData];
 
     // We're done, so let everyone know
     if (done)
@@ -316,6 +315,76 @@ typedef std::set<SortedTile> SortedTileSet;
     [self startFetchLayer:layer tile:tileID frame:-1];
 }
 
+// True if we're still tracking the given tile
+- (bool)isTileWanted:(MaplyTileID)tileID
+{
+    @synchronized(self)
+    {
+        return sortedTiles.find(Maply::SortedTile(tileID)) != sortedTiles.end();
+    }
+}
+
+// Kick off (or retry) the fetch for a single frame of a tile.
+// Each frame schedules and retries on its own, so one slow or flaky
+//  frame doesn't hold up or kill the others.
+- (void)startFrameFetch:(MaplyTileID)tileID which:(int)which attempt:(int)attempt layer:(MaplyQuadImageTilesLayer *)layer
+{
+    MaplyRemoteTileInfo *tileSource = _tileSources[which];
+    NSURLRequest *urlReq = [tileSource requestForTile:tileID];
+    if (!urlReq)
+    {
+        if (self.acceptFailures)
+            [self gotTile:tileID which:which data:nil layer:layer];
+        else
+            [self failedToGetTile:tileID error:nil layer:layer];
+        return;
+    }
+
+    // The shared fetch engine pools connections per host, so the
+    //  frames of one tile reuse the same connections
+    MaplyMultiplexTileSource __weak *weakSelf = self;
+    MaplyTileFetchRequest *request =
+    [[MaplyTileFetchEngine sharedEngine] startFetch:urlReq priority:tileID.level success:
+     ^(NSData *imgData)
+        {
+            if (weakSelf)
+                [weakSelf gotTile:tileID which:which data:imgData layer:layer];
+        }
+    failure:
+     ^(NSError *error)
+        {
+            if (!weakSelf)
+                return;
+            // Give the frame another try before giving up on it
+            if (attempt+1 < MaxFrameFetches && [weakSelf isTileWanted:tileID])
+                [weakSelf startFrameFetch:tileID which:which attempt:attempt+1 layer:layer];
+            else {
+                if (weakSelf.acceptFailures)
+                    [weakSelf gotTile:tileID which:which data:error layer:layer];
+                else
+                    [weakSelf failedToGetTile:tileID error:error layer:layer];
+            }
+        }];
+
+    // Hang on to the request so we can cancel the frame later
+    @synchronized(self)
+    {
+        Maply::SortedTileSet::iterator it = sortedTiles.find(Maply::SortedTile(tileID));
+        if (it == sortedTiles.end())
+        {
+            // The tile went away while we were setting up.  Never mind.
+            [[MaplyTileFetchEngine sharedEngine] cancelFetch:request];
+            return;
+        }
+        Maply::SortedTile theTile = *it;
+        sortedTiles.erase(it);
+        // Replace any earlier attempt for this frame
+        theTile.fetches.erase(Maply::TileFetch(which,nil));
+        theTile.fetches.insert(Maply::TileFetch(which,request));
+        sortedTiles.insert(theTile);
+    }
+}
+
 - (void)startFetchLayer:(id)layer tile:(MaplyTileID)tileID frame:(int)frame
 {
 //    NSLog(@"Starting fetch for tile: %d: (%d,%d)",tileID.level,tileID.x,tileID.y);
@@ -325,8 +394,9 @@ typedef std::set<SortedTile> SortedTileSet;
     Maply::SortedTile newTile(tileID,(int)[_tileSources count]);
     // Don't think about this one too hard.
     std::vector<void (^)()> workBlocks;
+    std::vector<int> netFrames;
     
-    // Work through the sources, kicking off a request as we go
+    // Work through the sources, splitting local from network
     int which = 0;
     for (MaplyRemoteTileInfo *tileSource in _tileSources)
     {
@@ -336,9 +406,8 @@ typedef std::set<SortedTile> SortedTileSet;
             // We'll save the block for later and run at the end
             void (^workBlock)() =
             ^{
-                NSString *fileName = [tileSource fileNameForTile:tileID];
-                NSData *imgData = [NSData dataWithContentsOfFile:fileName];
-                
+                NSData *imgData = [tileSource readFromCache:tileID];
+
                 if (!imgData)
                     [self failedToGetTile:tileID error:nil layer:layer];
                 else
@@ -346,51 +415,21 @@ typedef std::set<SortedTile> SortedTileSet;
             };
             workBlocks.push_back(workBlock);
         } else {
-            // It's not local, so we need to kick off a request
-            NSURLRequest *urlReq = [tileSource requestForTile:tileID];
-            
-            if(urlReq) {
-                // Kick off an async request for the data
-                MaplyMultiplexTileSource __weak *weakSelf = self;
-                AFHTTPRequestOperation *op = [[AFHTTPRequestOperation alloc] initWithRequest:urlReq];
-                dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-                op.completionQueue = queue;
-                [op setCompletionBlockWithSuccess:
-                 ^(AFHTTPRequestOperation *operation, id responseObject)
-                 {
-                     if (weakSelf)
-                         [self gotTile:tileID which:which data:responseObject layer:layer];
-                 }
-                                          failure:
-                 ^(AFHTTPRequestOperation *operation, NSError *error)
-                 {
-                     if (weakSelf)
-                     {
-                         if (weakSelf.acceptFailures)
-                             [self gotTile:tileID which:which data:error layer:layer];
-                         else
-                             [self failedToGetTile:tileID error:error layer:layer];
-                     }
-                 }];
-                
-                newTile.fetches.insert(Maply::TileFetch(which,op));
-            } else {
-                [self failedToGetTile:tileID error:nil layer:layer];
-            }
+            netFrames.push_back(which);
         }
         which++;
     }
 
-    // Kick off the operations after we have the tile data in our set.
-    // Otherwise these can come back before we've defined all of this
+    // Get the tile into our set before any results can come back
     @synchronized(self)
     {
         sortedTiles.insert(newTile);
-        // Kick off the fetch operations
-        for (Maply::TileFetchSet::iterator it = newTile.fetches.begin();
-             it != newTile.fetches.end(); ++it)
-            [it->op start];
     }
+
+    // The network frames fetch independently
+    for (unsigned int ii=0;ii<netFrames.size();ii++)
+        [self startFrameFetch:tileID which:netFrames[ii] attempt:0 layer:layer];
+
     // Run the work blocks that fetch local data
     for (unsigned int ii=0;ii<workBlocks.size();ii++)
         workBlocks[ii]();
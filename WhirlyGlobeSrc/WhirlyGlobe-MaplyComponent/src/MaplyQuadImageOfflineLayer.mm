@@ -30,6 +30,9 @@
 
 using namespace WhirlyKit;
 
+@implementation MaplyOfflineSubTile
+@end
+
 @implementation MaplyOfflineImage
 @end
 
@@ -71,6 +74,7 @@ using namespace WhirlyKit;
     _on = true;
     _textureSize = CGSizeMake(1024, 1024);
     _autoRes = true;
+    _subTileSize = 0;
     _importanceScale = 1.0;
     _singleLevelLoading = false;
     canShortCircuitImportance = false;
@@ -182,6 +186,13 @@ using namespace WhirlyKit;
     tileLoader.sizeY = _textureSize.height;
     tileLoader.autoRes = _autoRes;
     tileLoader.previewLevels = _previewLevels;
+    tileLoader.subTileSize = _subTileSize;
+}
+
+- (void)setSubTileSize:(int)subTileSize
+{
+    _subTileSize = subTileSize;
+    tileLoader.subTileSize = subTileSize;
 }
 
 /// Return the coordinate system we're working in
@@ -251,7 +262,8 @@ using namespace WhirlyKit;
         Point2f span = mbr.ur()-mbr.ll();
         mbr.ll() = centerLocal - span/2.0;
         mbr.ur() = centerLocal + span/2.0;
-        float import = ScreenImportance(lastViewState, Point2f(renderer.framebufferWidth,renderer.framebufferHeight), lastViewState.eyeVec, tileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, ident, nil);
+        Quadtree::NodeAttrs attrs;
+        float import = ScreenImportance(lastViewState, Point2f(renderer.framebufferWidth,renderer.framebufferHeight), lastViewState.eyeVec, tileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, ident, attrs);
         if (import <= quadLayer.minImportance)
         {
             zoomLevel--;
@@ -301,7 +313,7 @@ using namespace WhirlyKit;
 }
 
 /// Return an importance value for the given tile
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(NSMutableDictionary *)attrs
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs
 {
     if (ident.level == 0)
         return MAXFLOAT;
@@ -483,7 +495,7 @@ using namespace WhirlyKit;
 // We're not on the main thread, Dorothy.
 - (void)loader:(WhirlyKitQuadTileOfflineLoader *)loader image:(WhirlyKitQuadTileOfflineImage *)inImage
 {
-    if (_delegate && inImage && !inImage.textures.empty())
+    if (_delegate && inImage && (!inImage.textures.empty() || [inImage.subTiles count] > 0))
     {
         MaplyBoundingBox bbox;
         Mbr mbr = inImage.mbr;
@@ -506,7 +518,31 @@ using namespace WhirlyKit;
         offlineImage.centerSize = inImage.centerSize;
         for (unsigned int ii=0;ii<4;ii++)
             offlineImage->cornerSizes[ii] = inImage->cornerSizes[ii];
-        
+
+        // In sub tile mode, wrap up each changed cell the same way
+        if (inImage.subTiles)
+        {
+            NSMutableArray *subTiles = [NSMutableArray array];
+            for (WhirlyKitQuadTileOfflineSubTile *inSubTile in inImage.subTiles)
+            {
+                MaplyOfflineSubTile *subTile = [[MaplyOfflineSubTile alloc] init];
+                subTile.gridX = inSubTile->gridX;
+                subTile.gridY = inSubTile->gridY;
+                subTile.rect = inSubTile->rect;
+                NSMutableArray *subTextures = [NSMutableArray array];
+                for (unsigned int ii=0;ii<inSubTile->textures.size();ii++)
+                {
+                    MaplyTexture *maplyTex = [[MaplyTexture alloc] init];
+                    maplyTex.texID = inSubTile->textures[ii];
+                    maplyTex.viewC = _viewC;
+                    [subTextures addObject:maplyTex];
+                }
+                subTile.textures = subTextures;
+                [subTiles addObject:subTile];
+            }
+            offlineImage.subTiles = subTiles;
+        }
+
         [_delegate offlineLayer:self images:offlineImage];
     }
 }
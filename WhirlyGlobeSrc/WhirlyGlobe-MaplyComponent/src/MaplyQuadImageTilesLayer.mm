@@ -26,6 +26,7 @@
 #import "MaplyBaseViewController_private.h"
 #import "WhirlyGlobe.h"
 #import "MaplyImageTile_private.h"
+#import "MaplyTileMemoryCache.h"
 
 using namespace WhirlyKit;
 
@@ -92,8 +93,13 @@ using namespace WhirlyKit;
     NSObject<MaplyElevationSourceDelegate> *elevDelegate;
     bool variableSizeTiles;
     bool canDoValidTiles;
+    bool canGetMaxError;
     bool canFetchFrames;
     bool wantsUnload;
+    // Bounded queue that runs the fetch work for synchronous tile sources
+    NSOperationQueue *fetchOpQueue;
+    // Pool that runs the image decode for asynchronous tile sources
+    NSOperationQueue *decodeOpQueue;
 }
 
 - (id)initWithCoordSystem:(MaplyCoordinateSystem *)inCoordSys tileSource:(NSObject<MaplyTileSource> *)inTileSource
@@ -105,9 +111,11 @@ using namespace WhirlyKit;
     _coverPoles = true;
     _numSimultaneousFetches = 8;
     _imageDepth = 1;
+    _frameResidency = 0;
     _currentImage = 0;
     _animationPeriod = 0;
     _asyncFetching = true;
+    _useMemoryCache = true;
     _minElev = -100.0;
     _maxElev = 8900;
     _texturAtlasSize = 2048;
@@ -128,6 +136,8 @@ using namespace WhirlyKit;
     _maxCurrentImage = -1;
     _useElevAsZ = true;
     _importanceScale = 1.0;
+    _maxScreenError = 0.0;
+    _useTileCenters = false;
     _borderTexel = 1;
     canFetchFrames = false;
     
@@ -161,6 +171,15 @@ using namespace WhirlyKit;
     maxZoom = [_tileSource maxZoom];
     tileSize = [_tileSource tileSize];
     
+    // Sources that manage their own fetching hand us images from their
+    //  completion handlers.  The decode runs on this pool so it overlaps
+    //  the network instead of stalling whichever thread called us.
+    if (sourceWantsAsync)
+    {
+        decodeOpQueue = [[NSOperationQueue alloc] init];
+        decodeOpQueue.maxConcurrentOperationCount = [[NSProcessInfo processInfo] processorCount];
+    }
+
     // Set up tile and and quad layer with us as the data source
     tileLoader = [[WhirlyKitQuadTileLoader alloc] initWithDataSource:self];
     [self setupTileLoader];
@@ -171,7 +190,8 @@ using namespace WhirlyKit;
     quadLayer.maxTiles = _maxTiles;
     quadLayer.viewUpdatePeriod = _viewUpdatePeriod;
     quadLayer.minUpdateDist = _minUpdateDist;
-    
+    quadLayer.initialTileState = _restoreTileState;
+
     // Look for a custom program
     if (_shaderProgramName)
     {
@@ -179,7 +199,31 @@ using namespace WhirlyKit;
         tileLoader.programId = _customShader;
     } else
         _customShader = EmptyIdentity;
-    
+
+    // Single channel textures sample as (0,0,0,a), so they need a shader
+    //  that knows to spread the one channel back out
+    if (!_customShader)
+        switch (_imageFormat)
+        {
+            case MaplyImageUByteRed:
+            case MaplyImageUByteGreen:
+            case MaplyImageUByteBlue:
+            case MaplyImageUByteAlpha:
+            case MaplyImageUByteRGB:
+                _customShader = scene->getProgramIDByName(kToolkitDefaultTriangleMultiTexSingleChannel);
+                tileLoader.programId = _customShader;
+                break;
+            default:
+                break;
+        }
+
+    // Normal map lighting has its own program
+    if (_useNormalMaps && !_customShader)
+    {
+        _customShader = scene->getProgramIDByName(kToolkitDefaultTriangleNormalMapProgram);
+        tileLoader.programId = _customShader;
+    }
+
     // If we're switching images, we'll need the right program
     //  and an active object to do the updates
     if (_imageDepth > 1)
@@ -198,7 +242,8 @@ using namespace WhirlyKit;
     }
     
     elevDelegate = _viewC.elevDelegate;
-    
+    canGetMaxError = [elevDelegate respondsToSelector:@selector(maxErrorForTile:)];
+
     [super.layerThread addLayer:quadLayer];
 
     return true;
@@ -231,8 +276,13 @@ using namespace WhirlyKit;
         return;
     }
     
+    // Anything cached for the old source is no longer interesting
+    [[MaplyTileMemoryCache sharedCache] removeAllForSource:_tileSource];
+    // Same for any fetches and decodes we haven't gotten to
+    [fetchOpQueue cancelAllOperations];
+    [decodeOpQueue cancelAllOperations];
     _tileSource = tileSource;
-    
+
     [self setupTileLoader];
     [quadLayer reset];
 }
@@ -240,16 +290,32 @@ using namespace WhirlyKit;
 - (void)setupTileLoader
 {
     tileLoader.ignoreEdgeMatching = !_handleEdges;
+    tileLoader.stitchEdges = _stitchEdges;
     tileLoader.coverPoles = _coverPoles;
     tileLoader.minVis = _minVis;
     tileLoader.maxVis = _maxVis;
     tileLoader.drawPriority = super.drawPriority;
     tileLoader.numImages = _imageDepth;
+    tileLoader.frameResidency = _frameResidency;
+    // The sliding frame window swaps individual tile textures, which
+    //  the shared atlas textures can't do
+    if (_frameResidency > 0)
+        tileLoader.useDynamicAtlas = false;
     tileLoader.includeElev = _includeElevAttrForShader;
     tileLoader.useElevAsZ = (_viewC.elevDelegate != nil) && _useElevAsZ;
     tileLoader.textureAtlasSize = _texturAtlasSize;
     tileLoader.enable = _enable;
     tileLoader.borderTexel = _borderTexel;
+    tileLoader.buildNormalMaps = _useNormalMaps;
+    // The normal map rides in the second texture unit, which the
+    //  dynamic atlases can't accommodate per tile
+    if (_useNormalMaps)
+        tileLoader.useDynamicAtlas = false;
+    tileLoader.useTileCenters = _useTileCenters;
+    // Centered tiles carry their own matrix, which the shared atlas
+    //  drawables can't
+    if (_useTileCenters)
+        tileLoader.useDynamicAtlas = false;
     switch (_imageFormat)
     {
         case MaplyImageIntRGBA:
@@ -428,6 +494,13 @@ using namespace WhirlyKit;
         tileLoader.ignoreEdgeMatching = !_handleEdges;
 }
 
+- (void)setStitchEdges:(bool)stitchEdges
+{
+    _stitchEdges = stitchEdges;
+    if (tileLoader)
+        tileLoader.stitchEdges = _stitchEdges;
+}
+
 - (void)setCoverPoles:(bool)coverPoles
 {
     _coverPoles = coverPoles;
@@ -443,15 +516,65 @@ using namespace WhirlyKit;
         return;
     }
 
+    // The point of a reload is new data, so don't serve up the old
+    [[MaplyTileMemoryCache sharedCache] removeAllForSource:_tileSource];
+
     [self setupTileLoader];
     [quadLayer refresh];
 }
 
+- (void)shedMemory:(MaplyMemoryPressureSeverity)severity
+{
+    if (!super.layerThread)
+        return;
+
+    [self performSelector:@selector(shedMemoryLayerThread:) onThread:super.layerThread withObject:[NSNumber numberWithInt:severity] waitUntilDone:NO];
+}
+
+// Run on the layer thread, since we're poking the quad layer
+- (void)shedMemoryLayerThread:(NSNumber *)severity
+{
+    // The decoded payloads rebuild from the loaded tiles, so they go first
+    [[MaplyTileMemoryCache sharedCache] removeAllForSource:_tileSource];
+
+    // Under critical pressure, flush the loaded tiles too.  The quad tree
+    //  holds up to maxTiles, visible or not; after a refresh only the
+    //  tiles that still matter on screen come back.
+    if ([severity intValue] == MaplyMemoryPressureCritical)
+        [quadLayer refresh];
+}
+
+- (NSData *)snapshotTileState
+{
+    if (!quadLayer || !super.layerThread)
+        return nil;
+    if ([NSThread currentThread] == super.layerThread)
+        return [quadLayer loadedTileState];
+
+    // Fetch it from the layer thread.  This is a snapshot, so we do have to wait.
+    NSMutableArray *result = [NSMutableArray array];
+    [self performSelector:@selector(snapshotTileStateLayerThread:) onThread:super.layerThread withObject:result waitUntilDone:YES];
+    return [result count] > 0 ? [result objectAtIndex:0] : nil;
+}
+
+- (void)snapshotTileStateLayerThread:(NSMutableArray *)result
+{
+    NSData *tileState = [quadLayer loadedTileState];
+    if (tileState)
+        [result addObject:tileState];
+}
+
 - (void)cleanupLayers:(WhirlyKitLayerThread *)inLayerThread scene:(WhirlyKit::Scene *)scene
 {
     [_viewC removeActiveObject:imageUpdater];
     imageUpdater = nil;
+    // Fetches and decodes that haven't started yet aren't wanted anymore
+    [fetchOpQueue cancelAllOperations];
+    [decodeOpQueue cancelAllOperations];
     [inLayerThread removeLayer:quadLayer];
+    // The cache keys on the source by identity, so clear it out before
+    //  the source can go away
+    [[MaplyTileMemoryCache sharedCache] removeAllForSource:_tileSource];
 }
 
 - (void)setImportanceScale:(float)importanceScale
@@ -487,7 +610,8 @@ using namespace WhirlyKit;
         Point2f span = mbr.ur()-mbr.ll();
         mbr.ll() = center - span/2.0;
         mbr.ur() = center + span/2.0;
-        float import = ScreenImportance(lastViewState, Point2f(_renderer.framebufferWidth,_renderer.framebufferHeight), lastViewState.eyeVec, tileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, ident, nil);
+        Quadtree::NodeAttrs attrs;
+        float import = ScreenImportance(lastViewState, Point2f(_renderer.framebufferWidth,_renderer.framebufferHeight), lastViewState.eyeVec, tileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, ident, attrs);
         import *= _importanceScale;
         if (import <= quadLayer.minImportance)
         {
@@ -594,7 +718,7 @@ using namespace WhirlyKit;
 }
 
 /// Return an importance value for the given tile
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(NSMutableDictionary *)attrs
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs
 {
     if (ident.level == 0)
         return MAXFLOAT;
@@ -632,6 +756,29 @@ using namespace WhirlyKit;
         if (elevDelegate)
         {
             import = ScreenImportance(viewState, frameSize, thisTileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, _minElev, _maxElev, ident, attrs);
+            // If we know how far this tile's surface strays from what its parent
+            //  renders, we can stop subdividing once that error is sub-pixel.
+            //  Flat terrain resolves several levels earlier than mountains.
+            if (_maxScreenError > 0.0 && canGetMaxError && import > 0.0)
+            {
+                float maxError = [elevDelegate maxErrorForTile:tileID];
+                if (maxError >= 0.0)
+                {
+                    WhirlyKit::CoordSystem *wkCoordSys = [coordSys getCoordSystem];
+                    GeoCoord geoLL = wkCoordSys->localToGeographic(Point3f(mbr.ll().x(),mbr.ll().y(),0.0));
+                    GeoCoord geoUR = wkCoordSys->localToGeographic(Point3f(mbr.ur().x(),mbr.ur().y(),0.0));
+                    double tileMeters = (geoUR.lon()-geoLL.lon())*cosf((geoLL.lat()+geoUR.lat())/2.0)*EarthRadius;
+                    // Importance is projected screen area over tile size squared,
+                    //  so this is roughly the tile edge in pixels
+                    double edgePixels = sqrt(import)*thisTileSize;
+                    if (tileMeters > 0.0)
+                    {
+                        double errPixels = maxError * edgePixels / tileMeters;
+                        if (errPixels < _maxScreenError)
+                            import *= errPixels / _maxScreenError;
+                    }
+                }
+            }
         } else {
             import = ScreenImportance(viewState, frameSize, viewState.eyeVec, thisTileSize, [coordSys getCoordSystem], scene->getCoordAdapter(), mbr, ident, attrs);
         }
@@ -710,7 +857,25 @@ using namespace WhirlyKit;
         return;
     }
 
-    
+    // See if we've already got the decoded tile in the memory cache.
+    // Happens a lot when the user pans away and right back.
+    if (_useMemoryCache && frame == -1)
+    {
+        WhirlyKitLoadedTile *cachedTile = [[MaplyTileMemoryCache sharedCache] objectForSource:_tileSource tile:tileID];
+        if (cachedTile)
+        {
+            NSArray *args = @[cachedTile,@(tileID.x),@(tileID.y),@(tileID.level),_tileSource];
+            if (super.layerThread)
+            {
+                if ([NSThread currentThread] == super.layerThread)
+                    [self performSelector:@selector(mergeTile:) withObject:args];
+                else
+                    [self performSelector:@selector(mergeTile:) onThread:super.layerThread withObject:args waitUntilDone:NO];
+            }
+            return;
+        }
+    }
+
     // If we're not doing OSM style addressing, we need to flip the Y back to TMS
     if (!_flipY)
     {
@@ -745,6 +910,10 @@ using namespace WhirlyKit;
     // This is the fetching block.  We'll invoke it a couple of different ways below.
     void (^workBlock)() =
     ^{
+        // The tile may have been unloaded while we sat in the queue
+        if (![quadLoader tileIsWantedLevel:level col:col row:row])
+            return;
+
         // Start with elevation
         MaplyElevationChunk *elevChunk = nil;
         if (elevDelegate.minZoom <= tileID.level && tileID.level <= elevDelegate.maxZoom)
@@ -767,6 +936,10 @@ using namespace WhirlyKit;
             return;
         }
 
+        // Elevation can take a while, so check again before the real fetch
+        if (![quadLoader tileIsWantedLevel:level col:col row:row])
+            return;
+
         // Get the data for the tile and sort out what the delegate returned to us
         id tileReturn = nil;
         if (frame != -1 && canFetchFrames)
@@ -828,11 +1001,18 @@ using namespace WhirlyKit;
         }
     };
     
-    // For async mode, off we go
+    // For async mode, off we go.  The work runs through one bounded
+    //  queue per layer, so a slow source (sqlite, say) gets its
+    //  concurrency controlled in one place instead of flooding the
+    //  global queue.
     if (_asyncFetching)
     {
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
-                       workBlock);
+        if (!fetchOpQueue)
+        {
+            fetchOpQueue = [[NSOperationQueue alloc] init];
+            fetchOpQueue.maxConcurrentOperationCount = _numSimultaneousFetches;
+        }
+        [fetchOpQueue addOperationWithBlock:workBlock];
     } else {
         // In sync mode, we just do the work
         workBlock();
@@ -845,6 +1025,23 @@ using namespace WhirlyKit;
 }
 
 - (void)loadedImages:(id)tileReturn forTile:(MaplyTileID)tileID frame:(int)frame
+{
+    // Get the decode off whichever thread the source called us on.
+    // It's usually a network completion handler and the decode would
+    //  otherwise back up the source's other fetches.
+    if (decodeOpQueue && [NSThread currentThread] != super.layerThread)
+    {
+        [decodeOpQueue addOperationWithBlock:
+         ^{
+             [self decodeLoadedImages:tileReturn forTile:tileID frame:frame];
+         }];
+        return;
+    }
+
+    [self decodeLoadedImages:tileReturn forTile:tileID frame:frame];
+}
+
+- (void)decodeLoadedImages:(id)tileReturn forTile:(MaplyTileID)tileID frame:(int)frame
 {
     int borderTexel = tileLoader.borderTexel;
 
@@ -855,6 +1052,10 @@ using namespace WhirlyKit;
         y = (1<<tileID.level)-tileID.y-1;
     }
 
+    // Skip the decode if the tile's been unloaded since the fetch started
+    if (![tileLoader tileIsWantedLevel:tileID.level col:tileID.x row:y])
+        return;
+
     // Get the data for the tile and sort out what the delegate returned to us
     MaplyImageTile *tileData = [[MaplyImageTile alloc] initWithRandomData:tileReturn];
     if (tileSize > 0) {
@@ -947,7 +1148,32 @@ using namespace WhirlyKit;
     // This might happen if we change tile sources while we're waiting for a network call
     if (_tileSource != oldTileSource)
         return;
-    
+
+    // Hang on to the decoded tile in case the quad tree wants it back later
+    if (_useMemoryCache && loadTile)
+    {
+        long long cost = 0;
+        bool cacheIt = true;
+        for (WhirlyKitLoadedImage *loadImage in loadTile.images)
+        {
+            if (loadImage.type == WKLoadedImagePlaceholder)
+            {
+                cacheIt = false;
+                break;
+            }
+            if ([loadImage.imageData isKindOfClass:[NSData class]])
+                cost += [(NSData *)loadImage.imageData length];
+            else
+                cost += 4*loadImage.width*loadImage.height;
+        }
+        if (cacheIt)
+        {
+            MaplyTileID tileID;
+            tileID.x = col;  tileID.y = row;  tileID.level = level;
+            [[MaplyTileMemoryCache sharedCache] setObject:loadTile cost:cost forSource:_tileSource tile:tileID];
+        }
+    }
+
     [tileLoader dataSource: self loadedImage:loadTile forLevel: level col: col row: row];
 }
 
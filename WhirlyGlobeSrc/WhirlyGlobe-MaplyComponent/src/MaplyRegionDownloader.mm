@@ -0,0 +1,341 @@
+/*
+ *  MaplyRegionDownloader.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 5/9/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <vector>
+#import "MaplyRegionDownloader.h"
+#import "MaplyCoordinateSystem.h"
+#import "WhirlyGlobe.h"
+
+// Simultaneous fetches unless the caller says otherwise
+static const int RegionFetchWidth = 8;
+// Tiles we'll write per sqlite transaction.  Bulk throughput dies if
+//  every tile pays for its own sync.
+static const int RegionTxnSize = 32;
+
+@implementation MaplyRegionDownloader
+{
+    MaplyRemoteTileInfo *tileInfo;
+    NSString *dbPath;
+    sqlite3 *db;
+    sqlite3_stmt *insertStmt;
+    NSOperationQueue *fetchQueue;
+    // All the archive writes and bookkeeping run here, in order
+    dispatch_queue_t writeQueue;
+    bool active;
+    volatile bool canceled;
+    volatile bool overBudget;
+    bool inTxn;
+    int txnCount;
+    int tilesPending,tilesDone;
+    // The run's region in degrees, for the bounds metadata
+    double regLLlon,regLLlat,regURlon,regURlat;
+    NSError *stopError;
+}
+
+- (id)initWithTileInfo:(MaplyRemoteTileInfo *)info destination:(NSString *)mbTilesPath
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    tileInfo = info;
+    dbPath = mbTilesPath;
+    _fetchConcurrency = RegionFetchWidth;
+    _maxBytes = 0;
+    writeQueue = dispatch_queue_create("MaplyRegionDownloader",NULL);
+
+    return self;
+}
+
+- (void)dealloc
+{
+    if (insertStmt)
+        sqlite3_finalize(insertStmt);
+    if (db)
+        sqlite3_close(db);
+}
+
+// INSERT OR REPLACE one metadata row
+- (void)writeMetadataName:(NSString *)name value:(NSString *)value
+{
+    sqlhelpers::StatementWrite writeStmt(db,@"INSERT OR REPLACE INTO metadata (name,value) VALUES (?,?);");
+    writeStmt.add(name);
+    writeStmt.add(value);
+    writeStmt.go();
+}
+
+- (bool)startRegion:(MaplyBoundingBox)bbox minLevel:(int)minLevel maxLevel:(int)maxLevel
+{
+    if (active || !tileInfo || !dbPath)
+        return false;
+
+    int minL = std::max(minLevel,tileInfo.minZoom);
+    int maxL = std::min(maxLevel,tileInfo.maxZoom);
+    if (minL > maxL)
+        return false;
+
+    if (sqlite3_open([dbPath cStringUsingEncoding:NSASCIIStringEncoding],&db) != SQLITE_OK)
+    {
+        db = NULL;
+        return false;
+    }
+    sqlhelpers::ConfigureConnection(db,500,false);
+
+    // Lay out the archive if it isn't one already.
+    // The unique index on tiles is what makes resume cheap: tiles
+    //  already present are skipped below, not refetched.
+    sqlhelpers::OneShot(db,"CREATE TABLE IF NOT EXISTS metadata (name text, value text);");
+    sqlhelpers::OneShot(db,"CREATE UNIQUE INDEX IF NOT EXISTS metadata_index ON metadata (name);");
+    sqlhelpers::OneShot(db,"CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);");
+    sqlhelpers::OneShot(db,"CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row);");
+
+    [self writeMetadataName:@"name" value:[[dbPath lastPathComponent] stringByDeletingPathExtension]];
+    [self writeMetadataName:@"format" value:(tileInfo.ext ? tileInfo.ext : @"png")];
+
+    regLLlon = bbox.ll.x * 180.0 / M_PI;  regLLlat = bbox.ll.y * 180.0 / M_PI;
+    regURlon = bbox.ur.x * 180.0 / M_PI;  regURlat = bbox.ur.y * 180.0 / M_PI;
+
+    // Work out the tile set.  The region goes over into the pyramid's
+    //  coordinate system and then it's just ranges of columns and rows
+    //  against the full extents, per level.
+    MaplyCoordinateSystem *coordSys = tileInfo.coordSys;
+    if (!coordSys)
+        coordSys = [[MaplySphericalMercator alloc] initWebStandard];
+    MaplyCoordinate boundLL,boundUR;
+    [coordSys getBoundsLL:&boundLL ur:&boundUR];
+    MaplyCoordinate localLL = [coordSys geoToLocal:bbox.ll];
+    MaplyCoordinate localUR = [coordSys geoToLocal:bbox.ur];
+    double spanX = boundUR.x - boundLL.x;
+    double spanY = boundUR.y - boundLL.y;
+
+    // Which of those are already in the archive
+    sqlite3_stmt *haveStmt = NULL;
+    sqlite3_prepare_v2(db,"SELECT 1 FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?;",-1,&haveStmt,NULL);
+
+    std::vector<MaplyTileID> toFetch;
+    int alreadyThere = 0;
+    for (int level=minL;level<=maxL;level++)
+    {
+        int numSide = 1<<level;
+        int sx = std::max(0,std::min(numSide-1,(int)floor((localLL.x - boundLL.x) / spanX * numSide)));
+        int ex = std::max(0,std::min(numSide-1,(int)floor((localUR.x - boundLL.x) / spanX * numSide)));
+        int sy = std::max(0,std::min(numSide-1,(int)floor((localLL.y - boundLL.y) / spanY * numSide)));
+        int ey = std::max(0,std::min(numSide-1,(int)floor((localUR.y - boundLL.y) / spanY * numSide)));
+        for (int ix=sx;ix<=ex;ix++)
+            for (int iy=sy;iy<=ey;iy++)
+            {
+                MaplyTileID tileID;
+                tileID.level = level;  tileID.x = ix;  tileID.y = iy;
+                bool haveIt = false;
+                if (haveStmt)
+                {
+                    // Rows go in the same convention MaplyMBTileSource
+                    //  reads them back out with
+                    sqlite3_bind_int(haveStmt,1,tileID.level);
+                    sqlite3_bind_int(haveStmt,2,tileID.x);
+                    sqlite3_bind_int(haveStmt,3,tileID.y);
+                    haveIt = (sqlite3_step(haveStmt) == SQLITE_ROW);
+                    sqlite3_reset(haveStmt);
+                }
+                if (haveIt)
+                    alreadyThere++;
+                else
+                    toFetch.push_back(tileID);
+            }
+    }
+    if (haveStmt)
+        sqlite3_finalize(haveStmt);
+
+    sqlite3_prepare_v2(db,"INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?);",-1,&insertStmt,NULL);
+
+    _tilesTotal = alreadyThere + (int)toFetch.size();
+    _tilesComplete = alreadyThere;
+    _bytesWritten = 0;
+    tilesPending = (int)toFetch.size();
+    tilesDone = 0;
+    canceled = false;
+    overBudget = false;
+    inTxn = false;
+    txnCount = 0;
+    stopError = nil;
+    active = true;
+
+    // Maybe a previous run covered it all
+    if (toFetch.empty())
+    {
+        dispatch_async(writeQueue,
+        ^{
+            [self finishRun];
+        });
+        return true;
+    }
+
+    fetchQueue = [[NSOperationQueue alloc] init];
+    fetchQueue.maxConcurrentOperationCount = (_fetchConcurrency > 0 ? _fetchConcurrency : RegionFetchWidth);
+
+    for (unsigned int ii=0;ii<toFetch.size();ii++)
+    {
+        MaplyTileID tileID = toFetch[ii];
+        [fetchQueue addOperationWithBlock:
+        ^{
+            NSData *tileData = nil;
+            NSError *error = nil;
+            // Once we've stopped, tiles still queued just fall through
+            //  to the bookkeeping so the run can wind down
+            if (!canceled && !overBudget)
+            {
+                NSURLRequest *urlReq = [tileInfo requestForTile:tileID];
+                NSURLResponse *resp = nil;
+                tileData = [NSURLConnection sendSynchronousRequest:urlReq returningResponse:&resp error:&error];
+                NSHTTPURLResponse *urlResp = (NSHTTPURLResponse *)resp;
+                if (tileData && urlResp.statusCode != 200)
+                {
+                    NSString *urlRespDesc = [urlResp description];
+                    if (!urlRespDesc)
+                        urlRespDesc = @"Unknown";
+                    error = [[NSError alloc] initWithDomain:@"MaplyRegionDownloader" code:0 userInfo:
+                             @{NSLocalizedDescriptionKey: urlRespDesc}];
+                    tileData = nil;
+                }
+            }
+            dispatch_async(writeQueue,
+            ^{
+                [self writeTile:tileID data:tileData error:error];
+            });
+        }];
+    }
+
+    return true;
+}
+
+// Runs on the write queue.  One tile came back (or didn't).
+- (void)writeTile:(MaplyTileID)tileID data:(NSData *)tileData error:(NSError *)error
+{
+    if (tileData && !canceled && !overBudget)
+    {
+        if (!inTxn)
+        {
+            sqlite3_exec(db,"BEGIN;",NULL,NULL,NULL);
+            inTxn = true;
+        }
+        sqlite3_bind_int(insertStmt,1,tileID.level);
+        sqlite3_bind_int(insertStmt,2,tileID.x);
+        sqlite3_bind_int(insertStmt,3,tileID.y);
+        sqlite3_bind_blob(insertStmt,4,[tileData bytes],(int)[tileData length],SQLITE_TRANSIENT);
+        bool wrote = (sqlite3_step(insertStmt) == SQLITE_DONE);
+        sqlite3_reset(insertStmt);
+
+        if (wrote)
+        {
+            _bytesWritten += [tileData length];
+            _tilesComplete++;
+            if (++txnCount >= RegionTxnSize)
+            {
+                sqlite3_exec(db,"COMMIT;",NULL,NULL,NULL);
+                inTxn = false;
+                txnCount = 0;
+            }
+            if ([_delegate respondsToSelector:@selector(regionDownloader:didFetchTile:tilesComplete:tilesTotal:)])
+                [_delegate regionDownloader:self didFetchTile:tileID tilesComplete:_tilesComplete tilesTotal:_tilesTotal];
+            if (_maxBytes > 0 && _bytesWritten >= _maxBytes)
+            {
+                overBudget = true;
+                stopError = [[NSError alloc] initWithDomain:@"MaplyRegionDownloader" code:0 userInfo:
+                             @{NSLocalizedDescriptionKey: @"Byte budget exceeded"}];
+            }
+        }
+    } else if (error && !canceled && !overBudget)
+    {
+        if ([_delegate respondsToSelector:@selector(regionDownloader:didFailTile:error:)])
+            [_delegate regionDownloader:self didFailTile:tileID error:error];
+    }
+
+    tilesDone++;
+    if (tilesDone >= tilesPending)
+        [self finishRun];
+}
+
+// Runs on the write queue.  Close out the archive and tell the delegate.
+- (void)finishRun
+{
+    if (inTxn)
+    {
+        sqlite3_exec(db,"COMMIT;",NULL,NULL,NULL);
+        inTxn = false;
+    }
+
+    // Zoom range and bounds come off what's actually in the archive,
+    //  so resumed and overlapping runs union together
+    {
+        sqlhelpers::StatementRead zoomStmt(db,@"select min(zoom_level), max(zoom_level) from tiles;");
+        if (zoomStmt.stepRow())
+        {
+            int minZ = zoomStmt.getInt();
+            int maxZ = zoomStmt.getInt();
+            [self writeMetadataName:@"minzoom" value:[NSString stringWithFormat:@"%d",minZ]];
+            [self writeMetadataName:@"maxzoom" value:[NSString stringWithFormat:@"%d",maxZ]];
+        }
+    }
+    {
+        double llLon = regLLlon,llLat = regLLlat,urLon = regURlon,urLat = regURlat;
+        sqlhelpers::StatementRead boundsStmt(db,@"select value from metadata where name='bounds';");
+        if (boundsStmt.stepRow())
+        {
+            double oldLLlon,oldLLlat,oldURlon,oldURlat;
+            if (sscanf([boundsStmt.getString() UTF8String],"%lf,%lf,%lf,%lf",&oldLLlon,&oldLLlat,&oldURlon,&oldURlat) == 4)
+            {
+                llLon = std::min(llLon,oldLLlon);  llLat = std::min(llLat,oldLLlat);
+                urLon = std::max(urLon,oldURlon);  urLat = std::max(urLat,oldURlat);
+            }
+        }
+        boundsStmt.finalize();
+        [self writeMetadataName:@"bounds" value:[NSString stringWithFormat:@"%f,%f,%f,%f",llLon,llLat,urLon,urLat]];
+    }
+
+    if (insertStmt)
+    {
+        sqlite3_finalize(insertStmt);
+        insertStmt = NULL;
+    }
+    sqlite3_close(db);
+    db = NULL;
+    fetchQueue = nil;
+    active = false;
+
+    NSError *error = stopError;
+    if (canceled && !error)
+        error = [[NSError alloc] initWithDomain:@"MaplyRegionDownloader" code:0 userInfo:
+                 @{NSLocalizedDescriptionKey: @"Download canceled"}];
+    if (error)
+    {
+        if ([_delegate respondsToSelector:@selector(regionDownloader:didStopWithError:)])
+            [_delegate regionDownloader:self didStopWithError:error];
+    } else {
+        if ([_delegate respondsToSelector:@selector(regionDownloaderDidFinish:)])
+            [_delegate regionDownloaderDidFinish:self];
+    }
+}
+
+- (void)cancel
+{
+    canceled = true;
+}
+
+@end
@@ -18,12 +18,12 @@
  *
  */
 
-#import "AFHTTPRequestOperation.h"
 #import "MaplyRemoteTileSource.h"
 #import "WhirlyGlobe.h"
 #import "MaplyCoordinateSystem_private.h"
 #import "MaplyQuadImageTilesLayer.h"
 #import "MaplyRemoteTileSource_private.h"
+#import "MaplyTileDiskCache_private.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
@@ -37,6 +37,7 @@ using namespace WhirlyKit;
     int _minZoom,_maxZoom;
     int _pixelsPerSide;
     std::vector<Mbr> mbrs;
+    MaplyTileDiskCache *tileCache;
 }
 
 - (id)initWithBaseURL:(NSString *)baseURL ext:(NSString *)ext minZoom:(int)minZoom maxZoom:(int)maxZoom
@@ -97,6 +98,13 @@ using namespace WhirlyKit;
     return _pixelsPerSide;
 }
 
+- (void)setCacheDir:(NSString *)cacheDir
+{
+    _cacheDir = cacheDir;
+    cacheInit = false;
+    tileCache = cacheDir ? [MaplyTileDiskCache diskCacheForDir:cacheDir] : nil;
+}
+
 - (void)addBoundingBox:(MaplyBoundingBox *)bbox
 {
     Mbr mbr(Point2f(bbox->ll.x,bbox->ll.y),Point2f(bbox->ur.x,bbox->ur.y));
@@ -154,7 +162,12 @@ using namespace WhirlyKit;
 {
     if (!_cacheDir)
         return false;
-    
+
+    // The packed cache knows without hitting the file system
+    if ([tileCache hasTile:tileID maxAge:self.cachedFileLifetime])
+        return true;
+
+    // Fall back to the old one file per tile layout
     NSString *fileName = [self fileNameForTile:tileID];
     if ([[NSFileManager defaultManager] fileExistsAtPath:fileName])
     {
@@ -185,14 +198,88 @@ using namespace WhirlyKit;
 {
     NSDictionary *fileAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:fileName error:nil];
     NSDate *fileTimestamp = [fileAttributes fileModificationDate];
-    
+
     return fileTimestamp;
 }
 
+- (NSData *)readFromCache:(MaplyTileID)tileID
+{
+    if (!tileCache)
+        return nil;
+
+    NSData *tileData = [tileCache dataForTile:tileID maxAge:self.cachedFileLifetime];
+    if (tileData)
+        return tileData;
+
+    // Look for the old one file per tile layout and migrate what we find
+    NSString *fileName = [self fileNameForTile:tileID];
+    if (![[NSFileManager defaultManager] fileExistsAtPath:fileName])
+        return nil;
+    if (self.cachedFileLifetime != 0)
+    {
+        NSDate *fileTimestamp = [MaplyRemoteTileInfo dateForFile:fileName];
+        int ageOfFile = (int) [[NSDate date] timeIntervalSinceDate:fileTimestamp];
+        if (ageOfFile > self.cachedFileLifetime)
+            return nil;
+    }
+    tileData = [NSData dataWithContentsOfFile:fileName];
+    if (tileData)
+    {
+        [tileCache setData:tileData forTile:tileID];
+        [[NSFileManager defaultManager] removeItemAtPath:fileName error:nil];
+    }
+
+    return tileData;
+}
+
+- (NSData *)staleDataFromCache:(MaplyTileID)tileID etag:(NSString **)etag lastModified:(NSString **)lastModified
+{
+    if (!tileCache)
+        return nil;
+
+    // Without a validator to replay there's nothing to revalidate
+    if (![tileCache validatorsForTile:tileID etag:etag lastModified:lastModified])
+        return nil;
+
+    return [tileCache dataForTile:tileID maxAge:0];
+}
+
+- (void)writeToCache:(MaplyTileID)tileID tileData:(NSData *)tileData
+{
+    [tileCache setData:tileData forTile:tileID];
+}
+
+- (void)writeToCache:(MaplyTileID)tileID tileData:(NSData *)tileData etag:(NSString *)etag lastModified:(NSString *)lastModified
+{
+    [tileCache setData:tileData forTile:tileID etag:etag lastModified:lastModified];
+}
+
+- (void)touchCache:(MaplyTileID)tileID
+{
+    [tileCache touchTile:tileID];
+}
+
 - (NSURLRequest *)requestForTile:(MaplyTileID)tileID
+{
+    return [self requestForTile:tileID lowRes:false];
+}
+
+- (NSURLRequest *)requestForTile:(MaplyTileID)tileID lowRes:(bool)lowRes
 {
     int y = ((int)(1<<tileID.level)-tileID.y)-1;
     NSMutableURLRequest *urlReq = nil;
+
+    if (lowRes && _lowResURLTemplate)
+    {
+        // The small variant the server offers alongside the real tiles
+        NSString *fullURLStr = [[[_lowResURLTemplate stringByReplacingOccurrencesOfString:@"{z}" withString:[@(tileID.level) stringValue]]
+                                 stringByReplacingOccurrencesOfString:@"{x}" withString:[@(tileID.x) stringValue]]
+                                stringByReplacingOccurrencesOfString:@"{y}" withString:[@(y) stringValue]];
+        urlReq = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:fullURLStr]];
+        if (_timeOut != 0.0)
+            [urlReq setTimeoutInterval:_timeOut];
+        return urlReq;
+    }
     
     if (_tileURLs)
     {
@@ -219,6 +306,16 @@ using namespace WhirlyKit;
 
 @end
 
+// Response header lookup that doesn't care how the server capitalized it
+static NSString *HTTPHeader(NSDictionary *headers,NSString *name)
+{
+    for (NSString *key in headers)
+        if ([key caseInsensitiveCompare:name] == NSOrderedSame)
+            return headers[key];
+
+    return nil;
+}
+
 @implementation MaplyRemoteTileSource
 {
     Maply::TileFetchOpSet tileSet;
@@ -271,7 +368,7 @@ using namespace WhirlyKit;
              it != tileSet.end(); ++it)
         {
             Maply::TileFetchOp tile = *it;
-            [tile.op cancel];
+            [[MaplyTileFetchEngine sharedEngine] cancelFetch:tile.request];
         }
         tileSet.clear();
     }
@@ -336,57 +433,83 @@ using namespace WhirlyKit;
 // For a remote tile source, this one only works if it's local
 - (id)imageForTile:(MaplyTileID)tileID
 {
-    if ([_tileInfo tileIsLocal:tileID])
-    {
-        bool doLoad = true;
-        NSString *fileName = [_tileInfo fileNameForTile:tileID];
-        if (_tileInfo.cachedFileLifetime > 0)
-        {
-            NSDate *timeStamp = [MaplyRemoteTileInfo dateForFile:fileName];
-            if (timeStamp)
-            {
-                int ageOfFile = (int) [[NSDate date] timeIntervalSinceDate:timeStamp];
-                if (ageOfFile > _tileInfo.cachedFileLifetime)
-                    doLoad = false;
-            }
-        }
-        if (doLoad)
-            return [NSData dataWithContentsOfFile:fileName];
-        
-    }
-    
+    NSData *cachedData = [_tileInfo readFromCache:tileID];
+    if (cachedData)
+        return cachedData;
+
     NSURLRequest *urlReq = [_tileInfo requestForTile:tileID];
     if(urlReq)
     {
+        // If we've got an expired copy with validators, ask the server
+        //  whether it's still good rather than refetching it outright
+        NSString *cachedEtag = nil,*cachedLastMod = nil;
+        NSData *staleData = [_tileInfo staleDataFromCache:tileID etag:&cachedEtag lastModified:&cachedLastMod];
+        if (staleData)
+        {
+            NSMutableURLRequest *condReq = [urlReq mutableCopy];
+            if (cachedEtag)
+                [condReq setValue:cachedEtag forHTTPHeaderField:@"If-None-Match"];
+            if (cachedLastMod)
+                [condReq setValue:cachedLastMod forHTTPHeaderField:@"If-Modified-Since"];
+            urlReq = condReq;
+        }
+
         NSURLResponse *response;
         NSError *error;
         NSData *tileData = [NSURLConnection sendSynchronousRequest:urlReq
                                                  returningResponse:&response error:&error];
-        
+
+        // Still good.  Reset its clock and use what we have.
+        if (staleData && [(NSHTTPURLResponse *)response statusCode] == 304)
+        {
+            [_tileInfo touchCache:tileID];
+            return staleData;
+        }
+
         // Let's also write it back out for the cache
         if (_tileInfo.cacheDir)
-            [tileData writeToFile:[_tileInfo fileNameForTile:tileID] atomically:YES];
-        
+        {
+            NSDictionary *headers = [(NSHTTPURLResponse *)response allHeaderFields];
+            [_tileInfo writeToCache:tileID tileData:tileData etag:HTTPHeader(headers,@"ETag") lastModified:HTTPHeader(headers,@"Last-Modified")];
+        }
+
         return tileData;
     }
-    
+
     return nil;
 }
 
-- (void)startFetchLayer:(MaplyQuadImageTilesLayer *)layer tile:(MaplyTileID)tileID
+// Quietly fetch the full resolution tile behind a low res first paint.
+// When it lands the layer swaps it in through the tile update path.
+- (void)startReplacementFetch:(MaplyQuadImageTilesLayer *)layer tile:(MaplyTileID)tileID
 {
-    NSData *imgData = nil;
-    NSString *fileName = nil;
-    // Look for the image in the cache first
-    if (_tileInfo.cacheDir)
-    {
-        fileName = [_tileInfo fileNameForTile:tileID];
-        if ([_tileInfo tileIsLocal:tileID])
+    NSURLRequest *urlReq = [_tileInfo requestForTile:tileID];
+    MaplyRemoteTileSource __weak *weakSelf = self;
+    // Low priority; the screen is already painted.  If the tile's been
+    //  unloaded by the time this lands, the layer just drops it.
+    [[MaplyTileFetchEngine sharedEngine] startFetch:urlReq priority:tileID.level+16 success:
+     ^(NSData *imgData,NSDictionary *headers)
         {
-            imgData = [self imageForTile:tileID];
+            if (weakSelf)
+            {
+                if (weakSelf.tileInfo.cacheDir)
+                    [weakSelf.tileInfo writeToCache:tileID tileData:imgData etag:HTTPHeader(headers,@"ETag") lastModified:HTTPHeader(headers,@"Last-Modified")];
+                [layer loadedImages:imgData forTile:tileID];
+            }
         }
-    }
-    
+    notModified:nil failure:
+     ^(NSError *error)
+        {
+            // The low res tile stays up.  Nothing got cached, so the
+            //  next visit tries for full resolution again.
+        }];
+}
+
+- (void)startFetchLayer:(MaplyQuadImageTilesLayer *)layer tile:(MaplyTileID)tileID
+{
+    // Look for the image in the cache first
+    NSData *imgData = [_tileInfo readFromCache:tileID];
+
     if (imgData)
     {
         if ([_delegate respondsToSelector:@selector(remoteTileSource:tileDidLoad:)])
@@ -395,7 +518,11 @@ using namespace WhirlyKit;
         // Let the paging layer know about it
         [layer loadedImages:imgData forTile:tileID];
     } else {
-        NSURLRequest *urlReq = [_tileInfo requestForTile:tileID];
+        // Under constrained bandwidth, sources with a smaller variant
+        //  get asked for that first.  It paints the screen far sooner
+        //  and the full resolution tile quietly replaces it below.
+        bool lowResFirst = (_tileInfo.lowResURLTemplate && [[MaplyTileFetchEngine sharedEngine] bandwidthConstrained]);
+        NSURLRequest *urlReq = [_tileInfo requestForTile:tileID lowRes:lowResFirst];
         if(!urlReq)
         {
             [layer loadError:nil forTile:tileID];
@@ -405,34 +532,81 @@ using namespace WhirlyKit;
             return;
         }
         
-        // Kick off an async request for the data
+        // If we've got an expired copy with validators, turn this into
+        //  a conditional request.  A 304 means we keep what we have.
+        // Not for the small variant; its answer isn't the cached tile.
+        NSString *cachedEtag = nil,*cachedLastMod = nil;
+        NSData *staleData = nil;
+        if (!lowResFirst)
+            staleData = [_tileInfo staleDataFromCache:tileID etag:&cachedEtag lastModified:&cachedLastMod];
+        if (staleData)
+        {
+            NSMutableURLRequest *condReq = [urlReq mutableCopy];
+            if (cachedEtag)
+                [condReq setValue:cachedEtag forHTTPHeaderField:@"If-None-Match"];
+            if (cachedLastMod)
+                [condReq setValue:cachedLastMod forHTTPHeaderField:@"If-Modified-Since"];
+            urlReq = condReq;
+        }
+
+        // Kick off an async request through the shared fetch engine.
+        // It'll coalesce this with any other layer asking for the same URL.
+        // The span covers the engine round trip, queue wait included.
+        NSTimeInterval fetchStart = CFAbsoluteTimeGetCurrent();
         MaplyRemoteTileSource __weak *weakSelf = self;
-        AFHTTPRequestOperation *op = [[AFHTTPRequestOperation alloc] initWithRequest:urlReq];
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        op.completionQueue = queue;
-        [op setCompletionBlockWithSuccess:
-         ^(AFHTTPRequestOperation *operation, id responseObject)
+        void (^notModified)(void) = nil;
+        if (staleData)
+            notModified =
+            ^{
+                if (weakSelf)
+                {
+                    TilePipelineTrace::addSpan(tileID.level,tileID.x,tileID.y,TilePipelineTrace::StageFetch,fetchStart,CFAbsoluteTimeGetCurrent());
+
+                    // The server says our expired copy is still the
+                    //  current tile.  Reset its clock and hand it over
+                    //  without downloading or decoding anything.
+                    [weakSelf.tileInfo touchCache:tileID];
+
+                    if (weakSelf.delegate && [weakSelf.delegate respondsToSelector:@selector(remoteTileSource:tileDidLoad:)])
+                        [weakSelf.delegate remoteTileSource:weakSelf tileDidLoad:tileID];
+
+                    [layer loadedImages:staleData forTile:tileID];
+                    [weakSelf clearTile:tileID];
+                }
+            };
+        MaplyTileFetchRequest *request =
+        [[MaplyTileFetchEngine sharedEngine] startFetch:urlReq priority:tileID.level success:
+         ^(NSData *imgData,NSDictionary *headers)
             {
                 if (weakSelf)
                 {
-                    NSData *imgData = responseObject;
-                    
+                    TilePipelineTrace::addSpan(tileID.level,tileID.x,tileID.y,TilePipelineTrace::StageFetch,fetchStart,CFAbsoluteTimeGetCurrent());
+
                     // Let the delegate know we loaded successfully
                     if (weakSelf.delegate && [weakSelf.delegate respondsToSelector:@selector(remoteTileSource:tileDidLoad:)])
                         [weakSelf.delegate remoteTileSource:weakSelf tileDidLoad:tileID];
-                    
+
                     // Let the paging layer know about it
                     [layer loadedImages:imgData forTile:tileID];
 
-                    // Let's also write it back out for the cache
-                    if (weakSelf.tileInfo.cacheDir)
-                        [imgData writeToFile:fileName atomically:YES];
-                    
+                    if (lowResFirst)
+                    {
+                        // The small tile never goes in the cache; the
+                        //  full resolution copy fetched behind it does
+                        [weakSelf startReplacementFetch:layer tile:tileID];
+                    } else {
+                        // Let's also write it back out for the cache, along
+                        //  with whatever validators the server gave us
+                        if (weakSelf.tileInfo.cacheDir)
+                            [weakSelf.tileInfo writeToCache:tileID tileData:imgData etag:HTTPHeader(headers,@"ETag") lastModified:HTTPHeader(headers,@"Last-Modified")];
+                    }
+
                     [weakSelf clearTile:tileID];
                 }
             }
+        notModified:notModified
         failure:
-         ^(AFHTTPRequestOperation *operation, NSError *error)
+         ^(NSError *error)
             {
                 if (weakSelf)
                 {
@@ -444,12 +618,11 @@ using namespace WhirlyKit;
                 }
             }];
         Maply::TileFetchOp fetchOp(tileID);
-        fetchOp.op = op;
+        fetchOp.request = request;
         @synchronized(self)
         {
             tileSet.insert(fetchOp);
         }
-        [op start];
     }
 }
 
@@ -51,23 +51,34 @@
     }
 }
 
+// Identical patterns share one image.  Style loads tend to generate
+//  the same dash patterns over and over and the interaction layer
+//  dedupes textures by image, so one image here means one texture there.
+static NSMutableDictionary *patternCache = nil;
+
 - (UIImage *)makeImage
 {
     // Need to scale these elements to the texture size
     int eleSum = 0;
     for (unsigned int ii=0;ii<elements.size();ii++)
         eleSum += elements[ii];
-    
+
     if (eleSum == 0)
         return nil;
-    
-    UIGraphicsBeginImageContext(size);
-    CGContextRef ctx = UIGraphicsGetCurrentContext();
-    
-    CGContextClearRect(ctx, CGRectMake(0, 0, size.width, size.height));
-    [[UIColor whiteColor] setFill];
-    [[UIColor whiteColor] setStroke];
-    
+
+    // Everything that goes into the pixels goes into the key
+    NSMutableString *cacheKey = [NSMutableString stringWithFormat:@"%dx%d_%d",(int)size.width,(int)size.height,(int)_opacityFunc];
+    for (unsigned int ii=0;ii<elements.size();ii++)
+        [cacheKey appendFormat:@"_%d",elements[ii]];
+    @synchronized([MaplyLinearTextureBuilder class])
+    {
+        if (!patternCache)
+            patternCache = [NSMutableDictionary dictionary];
+        UIImage *cached = patternCache[cacheKey];
+        if (cached)
+            return cached;
+    }
+
     // Precalculate the opacity values since they're the same for every row
     std::vector<float> opacityVals;
     opacityVals.resize((int)size.width);
@@ -105,30 +116,50 @@
         opacityVals[ii] = opacityVal;
     }
     
-    // Work our way through the elements
+    // Which element units are on.  The first element is on, the next
+    //  off and so forth.
+    std::vector<bool> onOff;
+    onOff.resize(eleSum);
     int curY = 0;
     bool onOrOff = 1;
     for (unsigned int ii=0;ii<elements.size();ii++)
     {
-        int eleLen = elements[ii];
-        if (onOrOff)
-            for (unsigned int jj=0;jj<eleLen;jj++)
-            {
-                for (unsigned int xx=0;xx<size.width;xx++)
-                {
-                    float opacity = opacityVals[xx];
-                    // Do a gradiant across the image
-                    [[UIColor colorWithWhite:1.0 alpha:opacity] setFill];
-                    [[UIColor colorWithWhite:1.0 alpha:opacity] setStroke];
-                    CGContextFillRect(ctx, CGRectMake(xx, (curY+jj)/(float)eleSum * size.height, 1, 1));
-                }
-            }
+        for (unsigned int jj=0;jj<elements[ii];jj++)
+            onOff[curY+jj] = onOrOff;
         onOrOff = !onOrOff;
-        curY += eleLen;
+        curY += elements[ii];
+    }
+
+    // Synthesize the pixels directly.  White with the opacity gradient
+    //  across each row, premultiplied, so no CoreGraphics rendering
+    int width = (int)size.width, height = (int)size.height;
+    NSMutableData *pixData = [NSMutableData dataWithLength:width*height*4];
+    unsigned char *pixels = (unsigned char *)[pixData mutableBytes];
+    for (unsigned int yy=0;yy<height;yy++)
+    {
+        if (!onOff[yy * eleSum / height])
+            continue;
+        unsigned char *row = &pixels[yy*width*4];
+        for (unsigned int xx=0;xx<width;xx++)
+        {
+            unsigned char pixVal = (unsigned char)(opacityVals[xx]*255.0+0.5);
+            row[4*xx] = row[4*xx+1] = row[4*xx+2] = row[4*xx+3] = pixVal;
+        }
+    }
+
+    // Just wrap the buffer.  This doesn't copy or draw anything.
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGDataProviderRef provider = CGDataProviderCreateWithCFData((__bridge CFDataRef)pixData);
+    CGImageRef imageRef = CGImageCreate(width, height, 8, 32, width*4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast, provider, NULL, false, kCGRenderingIntentDefault);
+    UIImage *image = [UIImage imageWithCGImage:imageRef];
+    CGImageRelease(imageRef);
+    CGDataProviderRelease(provider);
+    CGColorSpaceRelease(colorSpace);
+
+    @synchronized([MaplyLinearTextureBuilder class])
+    {
+        patternCache[cacheKey] = image;
     }
-    
-    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
-    UIGraphicsEndImageContext();
 
     return image;
 }
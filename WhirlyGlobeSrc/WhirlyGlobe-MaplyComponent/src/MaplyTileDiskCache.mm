@@ -0,0 +1,489 @@
+/*
+ *  MaplyTileDiskCache.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <map>
+#import <string>
+#import <vector>
+#import <algorithm>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import "MaplyTileDiskCache_private.h"
+#import "DataCompressor.h"
+#import "WorkRegulator.h"
+
+// Default byte budget before we start evicting
+static const long long DefaultMaxCacheSize = 256*1024*1024;
+// Compact once this many bytes of the file are dead records
+static const long long CompactionSlack = 16*1024*1024;
+
+namespace
+{
+
+// Magic number at the top of the data file.  Bumped when the record
+//  format changes; a file with the old magic just starts over.
+static const uint32_t TileFileMagic = 0x57477464;  // 'WGtd'
+
+// Fixed size header in front of every tile's data.  The ETag and
+//  Last-Modified strings (if any) sit between the header and the payload.
+struct TileRecordHeader
+{
+    int32_t level,x,y;
+    uint32_t size;
+    // Write time, seconds since the epoch.  Used for lifetime checks
+    //  so we never have to stat anything.
+    uint32_t when;
+    // Lengths of the HTTP validator strings that follow the header
+    uint16_t etagLen,lastModLen;
+};
+
+// Index key
+struct TileKey
+{
+    TileKey(int x,int y,int level) : x(x), y(y), level(level) { }
+    bool operator < (const TileKey &that) const
+    {
+        if (level == that.level)
+        {
+            if (x == that.x)
+                return y < that.y;
+            return x < that.x;
+        }
+        return level < that.level;
+    }
+    int x,y,level;
+};
+
+// What we know about a tile without touching the file
+struct TileIndexEntry
+{
+    TileIndexEntry() : offset(0), size(0), when(0), lastUsed(0) { }
+    off_t offset;   // Where the payload starts (past the header and validators)
+    uint32_t size;
+    uint32_t when;
+    // Updated in memory as tiles are read, for eviction order
+    uint32_t lastUsed;
+    // HTTP validators the server sent with the tile, if any
+    std::string etag,lastMod;
+};
+
+// Full on-disk length of a record the index points to
+static long long EntryLength(const TileIndexEntry &entry)
+{
+    return sizeof(TileRecordHeader) + entry.etag.size() + entry.lastMod.size() + entry.size;
+}
+
+typedef std::map<TileKey,TileIndexEntry> TileIndexMap;
+
+// Sort for compaction, most recently used first
+struct EntryRecencySorter
+{
+    bool operator() (const std::pair<TileKey,TileIndexEntry> &a,const std::pair<TileKey,TileIndexEntry> &b)
+    {
+        return a.second.lastUsed > b.second.lastUsed;
+    }
+};
+
+}
+
+@implementation MaplyTileDiskCache
+{
+    NSString *dataPath;
+    int fd;
+    TileIndexMap index;
+    // Payload plus header bytes for records the index still points to
+    long long liveBytes;
+    // Same, for records that have been replaced
+    long long deadBytes;
+    off_t fileSize;
+    dispatch_queue_t compactQueue;
+    bool compacting;
+}
+
++ (MaplyTileDiskCache *)diskCacheForDir:(NSString *)dir
+{
+    static NSMutableDictionary *caches = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        caches = [NSMutableDictionary dictionary];
+    });
+
+    @synchronized(caches)
+    {
+        MaplyTileDiskCache *cache = caches[dir];
+        if (!cache)
+        {
+            cache = [[MaplyTileDiskCache alloc] initWithDir:dir];
+            if (cache)
+                caches[dir] = cache;
+        }
+        return cache;
+    }
+}
+
+- (id)initWithDir:(NSString *)dir
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _maxCacheSize = DefaultMaxCacheSize;
+    compactQueue = dispatch_queue_create("com.mousebird.tilediskcache", 0);
+    // Compaction never needs to beat interactive work to a core
+    dispatch_set_target_queue(compactQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    compacting = false;
+    liveBytes = 0;
+    deadBytes = 0;
+
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:&error];
+    dataPath = [NSString stringWithFormat:@"%@/tiles.dat",dir];
+
+    if (![self openAndScan])
+        return nil;
+
+    return self;
+}
+
+- (void)dealloc
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+// Open the data file and walk the records to build the index.
+// Later records for a tile replace earlier ones.
+- (bool)openAndScan
+{
+    fd = open([dataPath fileSystemRepresentation],O_RDWR|O_CREAT,0644);
+    if (fd < 0)
+        return false;
+
+    uint32_t magic = 0;
+    ssize_t numRead = pread(fd,&magic,sizeof(magic),0);
+    if (numRead < (ssize_t)sizeof(magic))
+    {
+        // Brand new file.  Stamp it.
+        magic = TileFileMagic;
+        pwrite(fd,&magic,sizeof(magic),0);
+        fileSize = sizeof(magic);
+        return true;
+    }
+    if (magic != TileFileMagic)
+    {
+        // Not ours.  Start over.
+        ftruncate(fd,0);
+        magic = TileFileMagic;
+        pwrite(fd,&magic,sizeof(magic),0);
+        fileSize = sizeof(magic);
+        return true;
+    }
+
+    off_t pos = sizeof(magic);
+    for (;;)
+    {
+        TileRecordHeader header;
+        numRead = pread(fd,&header,sizeof(header),pos);
+        if (numRead < (ssize_t)sizeof(header))
+            break;
+        off_t next = pos + sizeof(header) + header.etagLen + header.lastModLen + header.size;
+        // A truncated payload means we died mid-write.  Drop the tail.
+        struct stat statBuf;
+        if (fstat(fd,&statBuf) < 0 || next > statBuf.st_size)
+        {
+            ftruncate(fd,pos);
+            break;
+        }
+
+        TileKey key(header.x,header.y,header.level);
+        TileIndexMap::iterator it = index.find(key);
+        if (it != index.end())
+        {
+            deadBytes += EntryLength(it->second);
+            liveBytes -= EntryLength(it->second);
+        }
+        TileIndexEntry entry;
+        entry.offset = pos + sizeof(header) + header.etagLen + header.lastModLen;
+        entry.size = header.size;
+        entry.when = header.when;
+        entry.lastUsed = header.when;
+        if (header.etagLen > 0)
+        {
+            entry.etag.resize(header.etagLen);
+            pread(fd,&entry.etag[0],header.etagLen,pos+sizeof(header));
+        }
+        if (header.lastModLen > 0)
+        {
+            entry.lastMod.resize(header.lastModLen);
+            pread(fd,&entry.lastMod[0],header.lastModLen,pos+sizeof(header)+header.etagLen);
+        }
+        index[key] = entry;
+        liveBytes += EntryLength(entry);
+
+        pos = next;
+    }
+    fileSize = pos;
+
+    return true;
+}
+
+- (NSData *)dataForTile:(MaplyTileID)tileID maxAge:(int)maxAge
+{
+    @synchronized(self)
+    {
+        TileIndexMap::iterator it = index.find(TileKey(tileID.x,tileID.y,tileID.level));
+        if (it == index.end())
+            return nil;
+        uint32_t now = (uint32_t)time(NULL);
+        if (maxAge != 0 && now - it->second.when > (uint32_t)maxAge)
+            return nil;
+        it->second.lastUsed = now;
+
+        NSMutableData *tileData = [NSMutableData dataWithLength:it->second.size];
+        ssize_t numRead = pread(fd,[tileData mutableBytes],it->second.size,it->second.offset);
+        if (numRead < (ssize_t)it->second.size)
+            return nil;
+        // Compressed records identify themselves
+        if (WhirlyKit::IsCodecFramed([tileData bytes],[tileData length]))
+            return WhirlyKit::CodecDecompress(tileData);
+        return tileData;
+    }
+}
+
+- (bool)hasTile:(MaplyTileID)tileID maxAge:(int)maxAge
+{
+    @synchronized(self)
+    {
+        TileIndexMap::iterator it = index.find(TileKey(tileID.x,tileID.y,tileID.level));
+        if (it == index.end())
+            return false;
+        if (maxAge != 0 && (uint32_t)time(NULL) - it->second.when > (uint32_t)maxAge)
+            return false;
+        return true;
+    }
+}
+
+- (void)setData:(NSData *)data forTile:(MaplyTileID)tileID
+{
+    [self setData:data forTile:tileID etag:nil lastModified:nil];
+}
+
+- (void)setData:(NSData *)data forTile:(MaplyTileID)tileID etag:(NSString *)etag lastModified:(NSString *)lastModified
+{
+    if (!data)
+        return;
+
+    // Compress if asked, but only keep it when it actually helped.
+    // PNG and JPG tiles come through here too and those don't shrink
+    if (_compression == MaplyTileCacheCompressionLZ4)
+    {
+        NSData *compData = WhirlyKit::CodecCompress(data,WhirlyKit::DataCodecLZ4);
+        if (compData && [compData length] < [data length])
+            data = compData;
+    }
+
+    const char *etagStr = [etag UTF8String];
+    const char *lastModStr = [lastModified UTF8String];
+    size_t etagLen = etagStr ? strlen(etagStr) : 0;
+    size_t lastModLen = lastModStr ? strlen(lastModStr) : 0;
+    // The header only gives the validators 16 bits each.  Anything
+    //  bigger isn't a validator we want to replay anyway.
+    if (etagLen > 65535)
+        etagLen = 0;
+    if (lastModLen > 65535)
+        lastModLen = 0;
+
+    @synchronized(self)
+    {
+        TileRecordHeader header;
+        header.level = tileID.level;
+        header.x = tileID.x;
+        header.y = tileID.y;
+        header.size = (uint32_t)[data length];
+        header.when = (uint32_t)time(NULL);
+        header.etagLen = (uint16_t)etagLen;
+        header.lastModLen = (uint16_t)lastModLen;
+
+        // Append the record.  If we die between these writes the
+        //  truncated record gets dropped on the next open.
+        pwrite(fd,&header,sizeof(header),fileSize);
+        if (etagLen > 0)
+            pwrite(fd,etagStr,etagLen,fileSize+sizeof(header));
+        if (lastModLen > 0)
+            pwrite(fd,lastModStr,lastModLen,fileSize+sizeof(header)+etagLen);
+        pwrite(fd,[data bytes],[data length],fileSize+sizeof(header)+etagLen+lastModLen);
+
+        TileKey key(tileID.x,tileID.y,tileID.level);
+        TileIndexMap::iterator it = index.find(key);
+        if (it != index.end())
+        {
+            deadBytes += EntryLength(it->second);
+            liveBytes -= EntryLength(it->second);
+        }
+        TileIndexEntry entry;
+        entry.offset = fileSize + sizeof(header) + etagLen + lastModLen;
+        entry.size = header.size;
+        entry.when = header.when;
+        entry.lastUsed = header.when;
+        if (etagLen > 0)
+            entry.etag = etagStr;
+        if (lastModLen > 0)
+            entry.lastMod = lastModStr;
+        index[key] = entry;
+        liveBytes += EntryLength(entry);
+        fileSize += sizeof(header) + etagLen + lastModLen + header.size;
+
+        [self maybeCompact];
+    }
+}
+
+- (bool)validatorsForTile:(MaplyTileID)tileID etag:(NSString **)etag lastModified:(NSString **)lastModified
+{
+    @synchronized(self)
+    {
+        TileIndexMap::iterator it = index.find(TileKey(tileID.x,tileID.y,tileID.level));
+        if (it == index.end())
+            return false;
+        if (it->second.etag.empty() && it->second.lastMod.empty())
+            return false;
+        if (etag)
+            *etag = it->second.etag.empty() ? nil : [NSString stringWithUTF8String:it->second.etag.c_str()];
+        if (lastModified)
+            *lastModified = it->second.lastMod.empty() ? nil : [NSString stringWithUTF8String:it->second.lastMod.c_str()];
+        return true;
+    }
+}
+
+- (void)touchTile:(MaplyTileID)tileID
+{
+    @synchronized(self)
+    {
+        TileIndexMap::iterator it = index.find(TileKey(tileID.x,tileID.y,tileID.level));
+        if (it == index.end())
+            return;
+        TileIndexEntry &entry = it->second;
+        entry.when = (uint32_t)time(NULL);
+        entry.lastUsed = entry.when;
+        // Refresh the write time in the record header so the lifetime
+        //  check survives a restart, without rewriting the payload.
+        off_t headerOffset = entry.offset - entry.etag.size() - entry.lastMod.size() - sizeof(TileRecordHeader);
+        pwrite(fd,&entry.when,sizeof(entry.when),headerOffset+offsetof(TileRecordHeader,when));
+    }
+}
+
+// Schedule a compaction if enough of the file is dead or we're over budget.
+// Call this locked.
+- (void)maybeCompact
+{
+    if (compacting)
+        return;
+    if (deadBytes < CompactionSlack && liveBytes <= _maxCacheSize)
+        return;
+    // Compaction is droppable work; when the device is struggling to
+    //  keep the frame rate up, a later write can ask again
+    if (WhirlyKit::WorkRegulator::getLevel() == WhirlyKit::WorkRegulator::WorkMinimal)
+        return;
+
+    compacting = true;
+    dispatch_async(compactQueue,
+    ^{
+        [self compact];
+    });
+}
+
+// Rewrite the file with just the live records, most recently used
+//  first, dropping tiles once we're past the byte budget.
+// This holds the lock for the duration, but it runs on our own queue
+//  and the copy is sequential I/O, so readers only stall briefly.
+- (void)compact
+{
+    @synchronized(self)
+    {
+        std::vector<std::pair<TileKey,TileIndexEntry> > entries;
+        entries.reserve(index.size());
+        for (TileIndexMap::iterator it = index.begin(); it != index.end(); ++it)
+            entries.push_back(*it);
+        std::sort(entries.begin(),entries.end(),EntryRecencySorter());
+
+        NSString *newPath = [dataPath stringByAppendingString:@".new"];
+        int newFd = open([newPath fileSystemRepresentation],O_RDWR|O_CREAT|O_TRUNC,0644);
+        if (newFd < 0)
+        {
+            compacting = false;
+            return;
+        }
+
+        uint32_t magic = TileFileMagic;
+        pwrite(newFd,&magic,sizeof(magic),0);
+        off_t newSize = sizeof(magic);
+        long long newLive = 0;
+
+        TileIndexMap newIndex;
+        std::vector<unsigned char> buf;
+        for (unsigned int ii=0;ii<entries.size();ii++)
+        {
+            TileIndexEntry &entry = entries[ii].second;
+            // Past the budget, the rest get evicted
+            if (newLive + EntryLength(entry) > _maxCacheSize)
+                break;
+            buf.resize(entry.size);
+            if (pread(fd,&buf[0],entry.size,entry.offset) < (ssize_t)entry.size)
+                continue;
+            TileRecordHeader header;
+            header.level = entries[ii].first.level;
+            header.x = entries[ii].first.x;
+            header.y = entries[ii].first.y;
+            header.size = entry.size;
+            header.when = entry.when;
+            header.etagLen = (uint16_t)entry.etag.size();
+            header.lastModLen = (uint16_t)entry.lastMod.size();
+            pwrite(newFd,&header,sizeof(header),newSize);
+            if (header.etagLen > 0)
+                pwrite(newFd,entry.etag.data(),header.etagLen,newSize+sizeof(header));
+            if (header.lastModLen > 0)
+                pwrite(newFd,entry.lastMod.data(),header.lastModLen,newSize+sizeof(header)+header.etagLen);
+            pwrite(newFd,&buf[0],entry.size,newSize+sizeof(header)+header.etagLen+header.lastModLen);
+
+            TileIndexEntry newEntry = entry;
+            newEntry.offset = newSize + sizeof(header) + header.etagLen + header.lastModLen;
+            newIndex[entries[ii].first] = newEntry;
+            newSize += sizeof(header) + header.etagLen + header.lastModLen + entry.size;
+            newLive += EntryLength(entry);
+        }
+
+        if (rename([newPath fileSystemRepresentation],[dataPath fileSystemRepresentation]) < 0)
+        {
+            close(newFd);
+            unlink([newPath fileSystemRepresentation]);
+            compacting = false;
+            return;
+        }
+
+        close(fd);
+        fd = newFd;
+        index = newIndex;
+        fileSize = newSize;
+        liveBytes = newLive;
+        deadBytes = 0;
+        compacting = false;
+    }
+}
+
+@end
@@ -0,0 +1,466 @@
+/*
+ *  MaplyTileFetchEngine.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "AFHTTPRequestOperation.h"
+#import "MaplyTileFetchEngine_private.h"
+#import "PerformanceTimer.h"
+
+using namespace WhirlyKit;
+
+// Default cap on simultaneous requests to one host
+static const int MaxConnectionsPerHost = 8;
+// How many times we'll try a fetch before giving up on it
+static const int MaxFetchAttempts = 3;
+// Base delay before the first retry.  Doubles each attempt.
+static const NSTimeInterval BaseRetryDelay = 1.0;
+// Longest we'll back off, per fetch or per host
+static const NSTimeInterval MaxRetryDelay = 30.0;
+// This many failures in a row and we treat the host as down
+static const int HostDownThreshold = 4;
+// Weight of the newest sample in the goodput average
+static const double GoodputSmoothing = 0.3;
+// Don't judge the network off fewer fetches than this
+static const int GoodputMinSamples = 4;
+// Default threshold for bandwidthConstrained
+static const double ConstrainedBytesPerSec = 96*1024;
+
+// Spread retries out so a burst of failures doesn't come back as a burst
+static NSTimeInterval Jitter(NSTimeInterval delay)
+{
+    return delay * (0.5 + drand48());
+}
+
+@interface MaplyTileFetchRequest()
+// URL this request is interested in
+@property (nonatomic,strong) NSString *urlString;
+// Callbacks for this particular caller
+@property (nonatomic,copy) void (^success)(NSData *imgData,NSDictionary *headers);
+@property (nonatomic,copy) void (^notModified)(void);
+@property (nonatomic,copy) void (^failure)(NSError *error);
+@end
+
+@implementation MaplyTileFetchRequest
+@end
+
+// All the callers interested in a single URL, sharing one operation
+@interface MaplyTileFetchEntry : NSObject
+@property (nonatomic,strong) NSString *urlString;
+@property (nonatomic,strong) NSMutableArray *requests;
+@property (nonatomic,strong) AFHTTPRequestOperation *op;
+// What we need to build the operation again for a retry
+@property (nonatomic,strong) NSURLRequest *urlReq;
+@property (nonatomic) NSOperationQueuePriority queuePriority;
+// When the first caller asked, for the latency telemetry
+@property (nonatomic) NSTimeInterval startTime;
+@property (nonatomic) int attempts;
+@end
+
+@implementation MaplyTileFetchEntry
+@end
+
+// How a host has been treating us lately
+@interface MaplyTileHostStatus : NSObject
+@property (nonatomic) int consecutiveFailures;
+// Don't send the host anything new before this
+@property (nonatomic) NSTimeInterval holdUntil;
+@end
+
+@implementation MaplyTileHostStatus
+@end
+
+// Map a caller priority (tile level, typically) to an operation queue priority
+static NSOperationQueuePriority QueuePriority(int priority)
+{
+    if (priority <= 0)
+        return NSOperationQueuePriorityVeryHigh;
+    if (priority <= 4)
+        return NSOperationQueuePriorityHigh;
+    if (priority <= 8)
+        return NSOperationQueuePriorityNormal;
+    return NSOperationQueuePriorityLow;
+}
+
+@implementation MaplyTileFetchEngine
+{
+    // One operation queue per host, for connection reuse and the per host cap
+    NSMutableDictionary *queuesByHost;
+    // In flight fetches by URL string, for coalescing
+    NSMutableDictionary *activeFetches;
+    // Failure tracking by host, so we back off a down server as a group
+    NSMutableDictionary *hostStatus;
+    // Smoothed bytes per second over recent fetches
+    double goodputBPS;
+    int goodputSamples;
+}
+
++ (MaplyTileFetchEngine *)sharedEngine
+{
+    static MaplyTileFetchEngine *engine = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        engine = [[MaplyTileFetchEngine alloc] init];
+    });
+
+    return engine;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _maxConnectionsPerHost = MaxConnectionsPerHost;
+    _constrainedBytesPerSec = ConstrainedBytesPerSec;
+    queuesByHost = [NSMutableDictionary dictionary];
+    activeFetches = [NSMutableDictionary dictionary];
+    hostStatus = [NSMutableDictionary dictionary];
+
+    return self;
+}
+
+// Fetch or make the operation queue for a host.  Call this locked.
+- (NSOperationQueue *)queueForHost:(NSString *)host
+{
+    if (!host)
+        host = @"";
+    NSOperationQueue *queue = queuesByHost[host];
+    if (!queue)
+    {
+        queue = [[NSOperationQueue alloc] init];
+        queue.maxConcurrentOperationCount = _maxConnectionsPerHost;
+        queuesByHost[host] = queue;
+    }
+
+    return queue;
+}
+
+- (MaplyTileFetchRequest *)startFetch:(NSURLRequest *)urlReq priority:(int)priority success:(void (^)(NSData *imgData))success failure:(void (^)(NSError *error))failure
+{
+    void (^successWithHeaders)(NSData *,NSDictionary *) = nil;
+    if (success)
+        successWithHeaders = ^(NSData *imgData,NSDictionary *headers) { success(imgData); };
+
+    return [self startFetch:urlReq priority:priority success:successWithHeaders notModified:nil failure:failure];
+}
+
+- (MaplyTileFetchRequest *)startFetch:(NSURLRequest *)urlReq priority:(int)priority success:(void (^)(NSData *imgData,NSDictionary *headers))success notModified:(void (^)(void))notModified failure:(void (^)(NSError *error))failure
+{
+    MaplyTileFetchRequest *request = [[MaplyTileFetchRequest alloc] init];
+    request.urlString = [[urlReq URL] absoluteString];
+    request.success = success;
+    request.notModified = notModified;
+    request.failure = failure;
+
+    @synchronized(self)
+    {
+        // Someone may already be fetching this very tile
+        MaplyTileFetchEntry *entry = activeFetches[request.urlString];
+        if (entry)
+        {
+            [entry.requests addObject:request];
+            // The new caller may be in more of a hurry
+            if (QueuePriority(priority) > entry.queuePriority)
+            {
+                entry.queuePriority = QueuePriority(priority);
+                if (entry.op)
+                    entry.op.queuePriority = QueuePriority(priority);
+            }
+            return request;
+        }
+
+        entry = [[MaplyTileFetchEntry alloc] init];
+        entry.urlString = request.urlString;
+        entry.requests = [NSMutableArray arrayWithObject:request];
+        entry.urlReq = urlReq;
+        entry.queuePriority = QueuePriority(priority);
+        entry.attempts = 0;
+        entry.startTime = CFAbsoluteTimeGetCurrent();
+        activeFetches[request.urlString] = entry;
+
+        PerformanceTimer::TelemetryCounters::add(PerformanceTimer::TelemetryCounters::TelemNetRequests,1);
+        PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemLoadQueueDepth,[activeFetches count]);
+
+        [self startOpForEntry:entry];
+    }
+
+    return request;
+}
+
+// Fetch or make the failure tracking for a host.  Call this locked.
+- (MaplyTileHostStatus *)statusForHost:(NSString *)host
+{
+    if (!host)
+        host = @"";
+    MaplyTileHostStatus *status = hostStatus[host];
+    if (!status)
+    {
+        status = [[MaplyTileHostStatus alloc] init];
+        hostStatus[host] = status;
+    }
+
+    return status;
+}
+
+// Get an entry's operation going, honoring any backoff window on the
+//  host.  Call this locked.
+- (void)startOpForEntry:(MaplyTileFetchEntry *)entry
+{
+    MaplyTileHostStatus *status = [self statusForHost:[[entry.urlReq URL] host]];
+    NSTimeInterval now = CFAbsoluteTimeGetCurrent();
+    if (status.holdUntil > now)
+    {
+        // The host's been failing on us.  Wait out the window.
+        MaplyTileFetchEngine __weak *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW,(int64_t)((status.holdUntil-now)*NSEC_PER_SEC)),dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^{
+            [weakSelf restartEntry:entry];
+        });
+        return;
+    }
+
+    [self enqueueEntry:entry];
+}
+
+// Build the network operation for an entry and hand it to the host's
+//  queue.  Call this locked.
+- (void)enqueueEntry:(MaplyTileFetchEntry *)entry
+{
+    entry.attempts = entry.attempts + 1;
+
+    MaplyTileFetchEngine __weak *weakSelf = self;
+    AFHTTPRequestOperation *op = [[AFHTTPRequestOperation alloc] initWithRequest:entry.urlReq];
+    // Retries go to the back of the line; fresh tiles shouldn't wait on them
+    op.queuePriority = (entry.attempts > 1) ? NSOperationQueuePriorityLow : entry.queuePriority;
+    op.completionQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    [op setCompletionBlockWithSuccess:
+     ^(AFHTTPRequestOperation *operation, id responseObject)
+        {
+            [weakSelf hostDidSucceed:[[entry.urlReq URL] host]];
+            [weakSelf fetchDone:entry data:responseObject headers:operation.response.allHeaderFields error:nil];
+        }
+    failure:
+     ^(AFHTTPRequestOperation *operation, NSError *error)
+        {
+            // A 304 lands here because it's outside the acceptable
+            //  status range, but for a conditional request it's the
+            //  answer we were hoping for.
+            if (operation.response.statusCode == 304)
+            {
+                [weakSelf hostDidSucceed:[[entry.urlReq URL] host]];
+                [weakSelf fetchNotModified:entry];
+            } else
+                [weakSelf fetchFailed:entry op:operation error:error];
+        }];
+    entry.op = op;
+
+    [[self queueForHost:[[entry.urlReq URL] host]] addOperation:op];
+}
+
+// A delayed entry coming back around.  Make sure someone still wants it.
+- (void)restartEntry:(MaplyTileFetchEntry *)entry
+{
+    @synchronized(self)
+    {
+        if (activeFetches[entry.urlString] != entry || [entry.requests count] == 0)
+            return;
+        [self startOpForEntry:entry];
+    }
+}
+
+// A fetch went wrong.  Decide whether it's worth another try.
+- (void)fetchFailed:(MaplyTileFetchEntry *)entry op:(AFHTTPRequestOperation *)operation error:(NSError *)error
+{
+    // A server that answered with a 4xx isn't going to change its mind.
+    // Transport errors and 5xx are the transient sort.
+    bool retryable = !operation.response || operation.response.statusCode >= 500;
+    if (retryable)
+        [self hostDidFail:[[entry.urlReq URL] host]];
+
+    if (retryable && entry.attempts < MaxFetchAttempts)
+    {
+        @synchronized(self)
+        {
+            // Only bother if someone still wants it
+            if (activeFetches[entry.urlString] == entry && [entry.requests count] > 0)
+            {
+                entry.op = nil;
+                NSTimeInterval delay = Jitter(MIN(MaxRetryDelay,BaseRetryDelay * (1 << (entry.attempts-1))));
+                MaplyTileFetchEngine __weak *weakSelf = self;
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW,(int64_t)(delay*NSEC_PER_SEC)),dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                ^{
+                    [weakSelf restartEntry:entry];
+                });
+                return;
+            }
+        }
+    }
+
+    [self fetchDone:entry data:nil headers:nil error:error];
+}
+
+// The host answered, so it's clearly up.  Forgive its past.
+- (void)hostDidSucceed:(NSString *)host
+{
+    @synchronized(self)
+    {
+        MaplyTileHostStatus *status = hostStatus[host ? host : @""];
+        if (!status)
+            return;
+        // If we'd throttled it down to a probe, open it back up
+        if (status.consecutiveFailures >= HostDownThreshold)
+            [self queueForHost:host].maxConcurrentOperationCount = _maxConnectionsPerHost;
+        status.consecutiveFailures = 0;
+        status.holdUntil = 0.0;
+    }
+}
+
+// The host failed us again.  Widen its backoff window and, if it looks
+//  down, throttle it to a single probe connection until it answers.
+- (void)hostDidFail:(NSString *)host
+{
+    @synchronized(self)
+    {
+        MaplyTileHostStatus *status = [self statusForHost:host];
+        status.consecutiveFailures = status.consecutiveFailures + 1;
+        int shift = status.consecutiveFailures < 8 ? status.consecutiveFailures-1 : 8;
+        NSTimeInterval holdUntil = CFAbsoluteTimeGetCurrent() + Jitter(MIN(MaxRetryDelay,BaseRetryDelay * (1 << shift)));
+        if (holdUntil > status.holdUntil)
+            status.holdUntil = holdUntil;
+        if (status.consecutiveFailures >= HostDownThreshold)
+            [self queueForHost:host].maxConcurrentOperationCount = 1;
+    }
+}
+
+// Hand the result to everyone who asked for the URL
+- (void)fetchDone:(MaplyTileFetchEntry *)entry data:(NSData *)imgData headers:(NSDictionary *)headers error:(NSError *)error
+{
+    NSArray *requests = nil;
+    @synchronized(self)
+    {
+        requests = [NSArray arrayWithArray:entry.requests];
+        [activeFetches removeObjectForKey:entry.urlString];
+        PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemLoadQueueDepth,[activeFetches count]);
+    }
+
+    if (!error)
+    {
+        PerformanceTimer::TelemetryCounters::add(PerformanceTimer::TelemetryCounters::TelemTileLoads,1);
+        PerformanceTimer::TelemetryCounters::add(PerformanceTimer::TelemetryCounters::TelemNetBytes,[imgData length]);
+        PerformanceTimer::TelemetryCounters::add(PerformanceTimer::TelemetryCounters::TelemTileLoadTimeUs,(int64_t)((CFAbsoluteTimeGetCurrent()-entry.startTime)*1.0e6));
+
+        // Feed the goodput tracker
+        NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent()-entry.startTime;
+        if (elapsed > 0.0 && [imgData length] > 0)
+        {
+            double sample = [imgData length] / elapsed;
+            @synchronized(self)
+            {
+                if (goodputSamples == 0)
+                    goodputBPS = sample;
+                else
+                    goodputBPS = GoodputSmoothing * sample + (1.0 - GoodputSmoothing) * goodputBPS;
+                goodputSamples++;
+            }
+        }
+    }
+
+    for (MaplyTileFetchRequest *request in requests)
+    {
+        if (error)
+        {
+            if (request.failure)
+                request.failure(error);
+        } else {
+            if (request.success)
+                request.success(imgData,headers);
+        }
+    }
+}
+
+// The server said our cached copy is still good
+- (void)fetchNotModified:(MaplyTileFetchEntry *)entry
+{
+    NSArray *requests = nil;
+    @synchronized(self)
+    {
+        requests = [NSArray arrayWithArray:entry.requests];
+        [activeFetches removeObjectForKey:entry.urlString];
+        PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemLoadQueueDepth,[activeFetches count]);
+    }
+
+    for (MaplyTileFetchRequest *request in requests)
+    {
+        // Callers who joined without validators still need an answer
+        if (request.notModified)
+            request.notModified();
+        else if (request.failure)
+            request.failure([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorResourceUnavailable userInfo:nil]);
+    }
+}
+
+- (void)cancelFetch:(MaplyTileFetchRequest *)request
+{
+    if (!request)
+        return;
+
+    @synchronized(self)
+    {
+        MaplyTileFetchEntry *entry = activeFetches[request.urlString];
+        if (!entry)
+            return;
+        [entry.requests removeObjectIdenticalTo:request];
+        // Only kill the operation if no one else cares
+        if ([entry.requests count] == 0)
+        {
+            [entry.op cancel];
+            [activeFetches removeObjectForKey:entry.urlString];
+            PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemLoadQueueDepth,[activeFetches count]);
+        }
+    }
+}
+
+- (double)goodput
+{
+    @synchronized(self)
+    {
+        return goodputBPS;
+    }
+}
+
+- (bool)bandwidthConstrained
+{
+    @synchronized(self)
+    {
+        return goodputSamples >= GoodputMinSamples && goodputBPS < _constrainedBytesPerSec;
+    }
+}
+
+- (void)setMaxConnectionsPerHost:(int)maxConnectionsPerHost
+{
+    _maxConnectionsPerHost = maxConnectionsPerHost;
+    @synchronized(self)
+    {
+        for (NSOperationQueue *queue in [queuesByHost allValues])
+            queue.maxConcurrentOperationCount = maxConnectionsPerHost;
+    }
+}
+
+@end
@@ -0,0 +1,191 @@
+/*
+ *  MaplyTileMemoryCache.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 9/4/13.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <map>
+#import <list>
+#import "MaplyTileMemoryCache.h"
+
+// Default byte budget for the whole scene
+static const long long DefaultTotalBudget = 32*1024*1024;
+
+namespace
+{
+
+// (source,level,x,y) key.  The source is tracked by identity.
+struct TileCacheKey
+{
+    TileCacheKey(void *source,int x,int y,int level) : source(source), x(x), y(y), level(level) { }
+    bool operator < (const TileCacheKey &that) const
+    {
+        if (source == that.source)
+        {
+            if (level == that.level)
+            {
+                if (x == that.x)
+                    return y < that.y;
+                return x < that.x;
+            }
+            return level < that.level;
+        }
+        return source < that.source;
+    }
+    void *source;
+    int x,y,level;
+};
+
+// One cached payload
+struct TileCacheEntry
+{
+    TileCacheEntry(const TileCacheKey &key,id object,long long cost) : key(key), object(object), cost(cost) { }
+    TileCacheKey key;
+    id object;
+    long long cost;
+};
+
+// Front of the list is most recently used
+typedef std::list<TileCacheEntry> TileCacheList;
+typedef std::map<TileCacheKey,TileCacheList::iterator> TileCacheMap;
+
+}
+
+@implementation MaplyTileMemoryCache
+{
+    TileCacheList entries;
+    TileCacheMap entryMap;
+    long long usedBytes;
+}
+
++ (MaplyTileMemoryCache *)sharedCache
+{
+    static MaplyTileMemoryCache *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[MaplyTileMemoryCache alloc] init];
+    });
+
+    return cache;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _totalBudget = DefaultTotalBudget;
+    usedBytes = 0;
+
+    return self;
+}
+
+- (id)objectForSource:(id)source tile:(MaplyTileID)tileID
+{
+    @synchronized(self)
+    {
+        TileCacheKey key((__bridge void *)source,tileID.x,tileID.y,tileID.level);
+        TileCacheMap::iterator it = entryMap.find(key);
+        if (it == entryMap.end())
+            return nil;
+        // Move it to the front
+        entries.splice(entries.begin(),entries,it->second);
+        entryMap[key] = entries.begin();
+        return entries.begin()->object;
+    }
+}
+
+- (void)setObject:(id)object cost:(long long)cost forSource:(id)source tile:(MaplyTileID)tileID
+{
+    if (!object || _totalBudget <= 0)
+        return;
+
+    @synchronized(self)
+    {
+        TileCacheKey key((__bridge void *)source,tileID.x,tileID.y,tileID.level);
+        TileCacheMap::iterator it = entryMap.find(key);
+        if (it != entryMap.end())
+        {
+            usedBytes -= it->second->cost;
+            entries.erase(it->second);
+            entryMap.erase(it);
+        }
+        entries.push_front(TileCacheEntry(key,object,cost));
+        entryMap[key] = entries.begin();
+        usedBytes += cost;
+
+        [self evict];
+    }
+}
+
+- (void)removeAllForSource:(id)source
+{
+    @synchronized(self)
+    {
+        void *sourcePtr = (__bridge void *)source;
+        TileCacheList::iterator it = entries.begin();
+        while (it != entries.end())
+        {
+            if (it->key.source == sourcePtr)
+            {
+                usedBytes -= it->cost;
+                entryMap.erase(it->key);
+                it = entries.erase(it);
+            } else
+                ++it;
+        }
+    }
+}
+
+- (void)evictDownTo:(long long)maxBytes
+{
+    @synchronized(self)
+    {
+        while (usedBytes > maxBytes && !entries.empty())
+        {
+            TileCacheEntry &entry = entries.back();
+            usedBytes -= entry.cost;
+            entryMap.erase(entry.key);
+            entries.pop_back();
+        }
+    }
+}
+
+- (void)setTotalBudget:(long long)totalBudget
+{
+    @synchronized(self)
+    {
+        _totalBudget = totalBudget;
+        [self evict];
+    }
+}
+
+// Drop the least recently used entries until we're under budget.
+// Call this locked.
+- (void)evict
+{
+    while (usedBytes > _totalBudget && !entries.empty())
+    {
+        TileCacheEntry &entry = entries.back();
+        usedBytes -= entry.cost;
+        entryMap.erase(entry.key);
+        entries.pop_back();
+    }
+}
+
+@end
@@ -0,0 +1,268 @@
+/*
+ *  MaplyVectorAttributeIndex.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <limits>
+#import <map>
+#import <string>
+#import <vector>
+#import "MaplyVectorAttributeIndex_private.h"
+#import "MaplyVectorObject_private.h"
+
+using namespace WhirlyKit;
+
+namespace Maply
+{
+
+// One attribute across all the features.  Strings are interned, so a
+//  row is just an int either way.
+class AttrColumn
+{
+public:
+    AttrColumn(bool isString) : isString(isString), internDict(nil)
+    {
+        if (isString)
+            internDict = [NSMutableDictionary dictionary];
+    }
+
+    bool isString;
+    // Per row interned string ID.  -1 means missing
+    std::vector<int> stringIds;
+    // Per row numeric value.  NaN means missing
+    std::vector<double> nums;
+    // String value -> interned ID
+    NSMutableDictionary *internDict;
+};
+
+typedef std::map<std::string,AttrColumn> AttrColumnMap;
+
+}
+
+using namespace Maply;
+
+@implementation MaplyVectorAttributeIndex
+{
+    // The features, in row order.  We hang on to them so row indices
+    //  stay valid and so query results can wrap them back up
+    std::vector<VectorShapeRef> features;
+    AttrColumnMap columns;
+}
+
++ (MaplyVectorAttributeIndex *)indexForVectorObjects:(NSArray *)vecObjs
+{
+    MaplyVectorAttributeIndex *index = [[MaplyVectorAttributeIndex alloc] init];
+    [index buildFromVectorObjects:vecObjs];
+
+    return index;
+}
+
+- (int)numFeatures
+{
+    return (int)features.size();
+}
+
+// Pad every column out to the current number of rows
+- (void)padColumnsTo:(size_t)numRows
+{
+    for (AttrColumnMap::iterator it = columns.begin();it != columns.end();++it)
+    {
+        AttrColumn &col = it->second;
+        if (col.isString)
+            col.stringIds.resize(numRows,-1);
+        else
+            col.nums.resize(numRows,std::numeric_limits<double>::quiet_NaN());
+    }
+}
+
+- (void)buildFromVectorObjects:(NSArray *)vecObjs
+{
+    // Gather the features in a stable order
+    for (MaplyVectorObject *vecObj in vecObjs)
+        for (ShapeSet::iterator it = vecObj.shapes.begin();
+             it != vecObj.shapes.end(); ++it)
+            features.push_back(*it);
+
+    // Turn the attributes sideways into columns.  Shapes backed by an
+    //  interned store hand us their rows directly, with no dictionary
+    //  in the middle; the rest go through getAttrDict().
+    for (unsigned int row=0;row<features.size();row++)
+    {
+        int storeRow;
+        VectorAttrStore *store = features[row]->getAttrStore(storeRow);
+        if (store)
+        {
+            const VectorAttrStore::AttrRow &attrRow = store->getRow(storeRow);
+            for (unsigned int ii=0;ii<attrRow.size();ii++)
+                [self addValue:attrRow[ii].second forKey:store->getKey(attrRow[ii].first) row:row];
+        } else {
+            NSDictionary *attrDict = features[row]->getAttrDict();
+            for (NSString *key in attrDict)
+                [self addValue:attrDict[key] forKey:key row:row];
+        }
+    }
+
+    [self padColumnsTo:features.size()];
+}
+
+// Drop one attribute value into its column
+- (void)addValue:(id)value forKey:(NSString *)key row:(unsigned int)row
+{
+    if (!key)
+        return;
+    bool valueIsString = [value isKindOfClass:[NSString class]];
+    if (!valueIsString && ![value isKindOfClass:[NSNumber class]])
+        return;
+
+    std::string keyStr = [key cStringUsingEncoding:NSUTF8StringEncoding];
+    AttrColumnMap::iterator colIt = columns.find(keyStr);
+    if (colIt == columns.end())
+    {
+        // First time we've seen this attribute.  Its type
+        //  decides the column type
+        colIt = columns.insert(std::make_pair(keyStr,AttrColumn(valueIsString))).first;
+    }
+    AttrColumn &col = colIt->second;
+    // Features carrying the other type for this attribute
+    //  stay missing
+    if (col.isString != valueIsString)
+        return;
+
+    if (col.isString)
+    {
+        col.stringIds.resize(row+1,-1);
+        NSNumber *stringId = col.internDict[value];
+        if (!stringId)
+        {
+            stringId = @([col.internDict count]);
+            col.internDict[value] = stringId;
+        }
+        col.stringIds[row] = [stringId intValue];
+    } else {
+        col.nums.resize(row+1,std::numeric_limits<double>::quiet_NaN());
+        col.nums[row] = [value doubleValue];
+    }
+}
+
+// Look up a column, or NULL if we don't have it
+- (AttrColumn *)findColumn:(NSString *)attrName
+{
+    if (!attrName)
+        return NULL;
+    AttrColumnMap::iterator it = columns.find([attrName cStringUsingEncoding:NSUTF8StringEncoding]);
+    if (it == columns.end())
+        return NULL;
+
+    return &it->second;
+}
+
+// Run the scan, handing each matching row to the block
+- (void)scanColumn:(AttrColumn *)col value:(id)value rows:(void (^)(unsigned int row))rowBlock
+{
+    if (col->isString)
+    {
+        if (![value isKindOfClass:[NSString class]])
+            return;
+        // If the string was never interned, nothing can match it
+        NSNumber *stringId = col->internDict[value];
+        if (!stringId)
+            return;
+        int matchId = [stringId intValue];
+        const std::vector<int> &stringIds = col->stringIds;
+        for (unsigned int row=0;row<stringIds.size();row++)
+            if (stringIds[row] == matchId)
+                rowBlock(row);
+    } else {
+        if (![value isKindOfClass:[NSNumber class]])
+            return;
+        double matchVal = [value doubleValue];
+        const std::vector<double> &nums = col->nums;
+        for (unsigned int row=0;row<nums.size();row++)
+            if (nums[row] == matchVal)
+                rowBlock(row);
+    }
+}
+
+- (void)scanColumn:(AttrColumn *)col min:(double)minVal max:(double)maxVal rows:(void (^)(unsigned int row))rowBlock
+{
+    if (col->isString)
+        return;
+    const std::vector<double> &nums = col->nums;
+    for (unsigned int row=0;row<nums.size();row++)
+        if (nums[row] >= minVal && nums[row] <= maxVal)
+            rowBlock(row);
+}
+
+// Wrap a row's feature back up for the caller
+- (MaplyVectorObject *)vectorForRow:(unsigned int)row
+{
+    MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] init];
+    vecObj.shapes.insert(features[row]);
+
+    return vecObj;
+}
+
+- (NSArray *)vectorsWithAttribute:(NSString *)attrName value:(id)value
+{
+    NSMutableArray *result = [NSMutableArray array];
+    AttrColumn *col = [self findColumn:attrName];
+    if (!col)
+        return result;
+
+    [self scanColumn:col value:value rows:
+     ^(unsigned int row) { [result addObject:[self vectorForRow:row]]; }];
+
+    return result;
+}
+
+- (NSArray *)vectorsWithAttribute:(NSString *)attrName min:(double)minVal max:(double)maxVal
+{
+    NSMutableArray *result = [NSMutableArray array];
+    AttrColumn *col = [self findColumn:attrName];
+    if (!col)
+        return result;
+
+    [self scanColumn:col min:minVal max:maxVal rows:
+     ^(unsigned int row) { [result addObject:[self vectorForRow:row]]; }];
+
+    return result;
+}
+
+- (void)shapeIDsWithAttribute:(NSString *)attrName value:(id)value ids:(WhirlyKit::SimpleIDSet &)idSet
+{
+    AttrColumn *col = [self findColumn:attrName];
+    if (!col)
+        return;
+
+    std::vector<VectorShapeRef> &theFeatures = features;
+    [self scanColumn:col value:value rows:
+     ^(unsigned int row) { idSet.insert(theFeatures[row]->getId()); }];
+}
+
+- (void)shapeIDsWithAttribute:(NSString *)attrName min:(double)minVal max:(double)maxVal ids:(WhirlyKit::SimpleIDSet &)idSet
+{
+    AttrColumn *col = [self findColumn:attrName];
+    if (!col)
+        return;
+
+    std::vector<VectorShapeRef> &theFeatures = features;
+    [self scanColumn:col min:minVal max:maxVal rows:
+     ^(unsigned int row) { idSet.insert(theFeatures[row]->getId()); }];
+}
+
+@end
@@ -116,6 +116,21 @@ public:
     return nil;
 }
 
++ (bool)VectorObjectsFromGeoJSONStreaming:(NSData *)geoJSON batchSize:(int)batchSize usingBlock:(bool (^)(MaplyVectorObject *vecObj,float progress))block
+{
+    if ([geoJSON length] == 0)
+        return false;
+
+    return VectorParseGeoJSONStreaming(geoJSON,(batchSize > 0 ? batchSize : 100),
+                                       ^(ShapeSet &shapes,float progress)
+    {
+        MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] init];
+        vecObj->_shapes.insert(shapes.begin(),shapes.end());
+
+        return block(vecObj,progress);
+    });
+}
+
 + (NSDictionary *)VectorObjectsFromGeoJSONAssembly:(NSData *)geoJSON
 {
     if ([geoJSON length] > 0)
@@ -902,6 +917,67 @@ public:
     }    
 }
 
+- (MaplyVectorObject *) simplifyWithTolerance:(float)tolerance
+{
+    MaplyVectorObject *newVec = [[MaplyVectorObject alloc] init];
+    // Ranks are effective areas, so square the linear tolerance
+    float minArea = tolerance*tolerance;
+
+    for (ShapeSet::iterator it = _shapes.begin();it!=_shapes.end();it++)
+    {
+        VectorLinearRef lin = boost::dynamic_pointer_cast<VectorLinear>(*it);
+        VectorArealRef ar = boost::dynamic_pointer_cast<VectorAreal>(*it);
+        if (lin)
+        {
+            // Rank the points the first time through
+            if (lin->ptRanks.size() != lin->pts.size())
+                VectorRankPoints(lin->pts,false,lin->ptRanks);
+
+            VectorLinearRef newLin = VectorLinear::createLinear();
+            VectorSimplify(lin->pts,lin->ptRanks,minArea,newLin->pts);
+            if (newLin->pts.size() < 2)
+                continue;
+            newLin->setAttrDict(lin->getAttrDict());
+            newLin->initGeoMbr();
+            newVec->_shapes.insert(newLin);
+        } else if (ar)
+        {
+            if (ar->loopRanks.size() != ar->loops.size())
+            {
+                ar->loopRanks.resize(ar->loops.size());
+                for (unsigned int ii=0;ii<ar->loops.size();ii++)
+                    VectorRankPoints(ar->loops[ii],true,ar->loopRanks[ii]);
+            }
+
+            VectorArealRef newAr = VectorAreal::createAreal();
+            for (unsigned int ii=0;ii<ar->loops.size();ii++)
+            {
+                VectorRing newLoop;
+                VectorSimplify(ar->loops[ii],ar->loopRanks[ii],minArea,newLoop);
+                // Collapsed loops just go away.  For the outer loop that
+                //  means the whole feature is below the tolerance.
+                if (newLoop.size() < 3)
+                {
+                    if (ii == 0)
+                        break;
+                    continue;
+                }
+                newAr->loops.push_back(newLoop);
+            }
+            if (newAr->loops.empty())
+                continue;
+            newAr->setAttrDict(ar->getAttrDict());
+            newAr->initGeoMbr();
+            newVec->_shapes.insert(newAr);
+        } else {
+            // Points and meshes don't simplify; pass them through
+            newVec->_shapes.insert(*it);
+        }
+    }
+
+    return newVec;
+}
+
 - (MaplyVectorObject *) tesselate
 {
     MaplyVectorObject *newVec = [[MaplyVectorObject alloc] init];
@@ -1007,18 +1083,215 @@ public:
 }
 
 
+// Bulk copy points out of the WGVB point pool, appending
+static void CopyPoolPoints(const unsigned char *bytes,int pointPoolOff,int numPoolPts,int startPt,int numPts,WhirlyKit::VectorRing &pts)
+{
+    if (startPt < 0 || numPts < 0 || startPt+numPts > numPoolPts)
+        throw 1;
+    size_t base = pts.size();
+    pts.resize(base+numPts);
+    if (numPts > 0)
+        memcpy(&pts[base], bytes+pointPoolOff+8*(size_t)startPt, 8*(size_t)numPts);
+}
+
+// And the matching simplification ranks
+static void CopyPoolRanks(const unsigned char *bytes,int rankPoolOff,int numPoolRanks,int startPt,int numPts,WhirlyKit::VectorRanks &ranks)
+{
+    if (startPt < 0 || numPts < 0 || startPt+numPts > numPoolRanks)
+        throw 1;
+    size_t base = ranks.size();
+    ranks.resize(base+numPts);
+    if (numPts > 0)
+        memcpy(&ranks[base], bytes+rankPoolOff+4*(size_t)startPt, 4*(size_t)numPts);
+}
+
+// Read from the binary paged format (WGVB) the newer vector_dice writes.
+// Fixed size tables pointing into one big point pool, with the MBRs and
+//  simplification ranks computed by the dicer, so this is offset checks
+//  and bulk copies rather than a parse.
++ (MaplyVectorObject *)VectorObjectFromVectorDBBinary:(NSData *)data
+{
+    MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] init];
+
+    try
+    {
+        // We reuse the reader for its bounds checking, jumping pos around
+        Maply::DataReader dataReader(data);
+        const unsigned char *bytes = dataReader.bytes;
+
+        // Header.  Fixed offsets to the various tables.
+        dataReader.pos = 4;
+        int version = dataReader.getInt();
+        if (version != 1)
+            throw 1;
+        int numChunks = dataReader.getInt();
+        dataReader.rangeCheck(numChunks, 0, 1000000);
+        int chunkTableOff = dataReader.getInt();
+        int stringTableOff = dataReader.getInt();
+        int pointPoolOff = dataReader.getInt();
+        int rankPoolOff = dataReader.getInt();
+        dataReader.rangeCheck(chunkTableOff, 0, dataReader.len);
+        dataReader.rangeCheck(stringTableOff, 0, dataReader.len);
+        if (pointPoolOff < 0 || pointPoolOff > rankPoolOff || rankPoolOff > dataReader.len)
+            throw 1;
+        int numPoolPts = (rankPoolOff - pointPoolOff) / 8;
+        int numPoolRanks = (dataReader.len - rankPoolOff) / 4;
+
+        // String table, same layout as the raw format's
+        std::vector<NSString *> strings;
+        dataReader.pos = stringTableOff;
+        int numStrings = dataReader.getInt();
+        dataReader.rangeCheck(numStrings, 0, 1000000);
+        strings.resize(numStrings,nil);
+        for (unsigned int ii=0;ii<numStrings;ii++)
+            strings[ii] = dataReader.getString();
+
+        // Each chunk has a group of shared attributes
+        for (int ii=0;ii<numChunks;ii++)
+        {
+            dataReader.pos = chunkTableOff + 20*ii;
+            int attrOff = dataReader.getInt();
+            int numAttrs = dataReader.getInt();
+            int geomType = dataReader.getInt();
+            int numFeat = dataReader.getInt();
+            int featTableOff = dataReader.getInt();
+            dataReader.rangeCheck(attrOff, 0, dataReader.len);
+            dataReader.rangeCheck(numAttrs, 0, 10000);
+            dataReader.rangeCheck(numFeat, 0, 1000000);
+            dataReader.rangeCheck(featTableOff, 0, dataReader.len);
+
+            // All the attributes are shared within the chunk
+            NSMutableDictionary *attrDict = [NSMutableDictionary dictionary];
+            dataReader.pos = attrOff;
+            for (unsigned int jj=0;jj<numAttrs;jj++)
+            {
+                // Name is index into the string table
+                int nameIdx = dataReader.getInt();
+                dataReader.rangeCheck(nameIdx, 0, (int)strings.size());
+                NSString *name = strings[nameIdx];
+
+                // Type
+                int type = dataReader.getInt();
+                switch (type)
+                {
+                    case 0:
+                        attrDict[name] = @(dataReader.getInt());
+                        break;
+                    case 1:
+                        attrDict[name] = @(dataReader.getFloat());
+                        break;
+                    case 2:
+                    {
+                        int valIdx = dataReader.getInt();
+                        dataReader.rangeCheck(valIdx, 0, (int)strings.size());
+                        attrDict[name] = strings[valIdx];
+                    }
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            // Work through the features
+            for (int jj=0;jj<numFeat;jj++)
+            {
+                // Feature record is the precomputed MBR and geometry offset
+                dataReader.pos = featTableOff + 20*jj;
+                GeoCoord ll,ur;
+                ll.x() = dataReader.getFloat();
+                ll.y() = dataReader.getFloat();
+                ur.x() = dataReader.getFloat();
+                ur.y() = dataReader.getFloat();
+                GeoMbr geoMbr(ll,ur);
+                int geomOff = dataReader.getInt();
+                dataReader.rangeCheck(geomOff, 0, dataReader.len);
+
+                // Geometry record is loops pointing into the point pool
+                dataReader.pos = geomOff;
+                int numLoops = dataReader.getInt();
+                dataReader.rangeCheck(numLoops, 1, 100000);
+
+                VectorShapeRef shape;
+                switch (geomType)
+                {
+                        // Point(s)
+                    case 1:
+                    {
+                        VectorPointsRef pts = VectorPoints::createPoints();
+                        shape = pts;
+                        for (int li=0;li<numLoops;li++)
+                        {
+                            int numPts = dataReader.getInt();
+                            int startPt = dataReader.getInt();
+                            CopyPoolPoints(bytes,pointPoolOff,numPoolPts,startPt,numPts,pts->pts);
+                        }
+                        pts->geoMbr = geoMbr;
+                    }
+                        break;
+                        // Line string
+                    case 2:
+                    {
+                        VectorLinearRef lin = VectorLinear::createLinear();
+                        shape = lin;
+                        int numPts = dataReader.getInt();
+                        int startPt = dataReader.getInt();
+                        CopyPoolPoints(bytes,pointPoolOff,numPoolPts,startPt,numPts,lin->pts);
+                        CopyPoolRanks(bytes,rankPoolOff,numPoolRanks,startPt,numPts,lin->ptRanks);
+                        lin->geoMbr = geoMbr;
+                    }
+                        break;
+                        // Polygon
+                    case 3:
+                    {
+                        VectorArealRef ar = VectorAreal::createAreal();
+                        shape = ar;
+                        ar->loops.resize(numLoops);
+                        ar->loopRanks.resize(numLoops);
+                        for (int li=0;li<numLoops;li++)
+                        {
+                            int numPts = dataReader.getInt();
+                            int startPt = dataReader.getInt();
+                            CopyPoolPoints(bytes,pointPoolOff,numPoolPts,startPt,numPts,ar->loops[li]);
+                            CopyPoolRanks(bytes,rankPoolOff,numPoolRanks,startPt,numPts,ar->loopRanks[li]);
+                        }
+                        ar->geoMbr = geoMbr;
+                    }
+                        break;
+                    default:
+                        throw 1;
+                        break;
+                }
+
+                shape->setAttrDict(attrDict);
+                vecObj.shapes.insert(shape);
+            }
+        }
+    }
+    catch (...)
+    {
+        NSLog(@"Failed to read binary VectorDB tile.");
+        return nil;
+    }
+
+    return vecObj;
+}
+
 // Read from the raw vector format in the Vector DB
 // Note: Put this somewhere else.
 // Note: Bullet proof this if we start getting these over the network
 + (MaplyVectorObject *)VectorObjectFromVectorDBRaw:(NSData *)data
 {
+    // The binary format is self describing, so we hand that off here
+    if ([data length] >= 4 && !memcmp([data bytes], "WGVB", 4))
+        return [MaplyVectorObject VectorObjectFromVectorDBBinary:data];
+
     MaplyVectorObject *vecObj = [[MaplyVectorObject alloc] init];
-    
+
     try
     {
         // Wrap a reader around the NSData
         Maply::DataReader dataReader(data);
-        
+
         // String table first
         std::vector<NSString *> strings;
         int numStrings = dataReader.getInt();
@@ -224,6 +224,15 @@ typedef enum {
                     label.offset = CGPointMake(subStyle->dx, subStyle->dy);
                     // Make bigger text slightly more important
                     label.layoutImportance = 1.0 + subStyle->textSize/1000;
+                    // Labels the dicer already laid out get a pinned placement
+                    //  and ride in a higher importance band, so the layout
+                    //  engine only has to settle fights across tile edges
+                    NSNumber *layoutRank = vec.attributes[@"mx_layoutRank"];
+                    if ([layoutRank isKindOfClass:[NSNumber class]] && [layoutRank intValue] >= 0)
+                    {
+                        label.layoutPlacement = kMaplyLayoutCenter;
+                        label.layoutImportance = 2.0 + subStyle->textSize/1000 - [layoutRank intValue]/1000.0;
+                    }
                     label.selectable = false;
                 }
             }
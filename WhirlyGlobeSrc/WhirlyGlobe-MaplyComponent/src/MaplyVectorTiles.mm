@@ -33,11 +33,21 @@
 #import <string>
 #import <map>
 #import <vector>
+#import "DataCompressor.h"
 
 using namespace Maply;
 
 typedef std::map<std::string,MaplyVectorTileStyle *> StyleMap;
 
+// Codec framed blobs (LZ4 and friends) say what they are; anything
+//  else is the old gzip
+static NSData *UncompressTile(NSData *data)
+{
+    if (data && WhirlyKit::IsCodecFramed([data bytes],[data length]))
+        return WhirlyKit::CodecDecompress(data);
+    return [data uncompressGZip];
+}
+
 @interface MaplyVectorTiles()
 @property (nonatomic,readonly) NSString *tilesDir;
 @end
@@ -417,7 +427,7 @@ typedef std::map<std::string,MaplyVectorTileStyle *> StyleMap;
             if (compressed)
             {
                 if (data && [data length] > 0)
-                    uncompressedData = [data uncompressGZip];
+                    uncompressedData = UncompressTile(data);
             } else
                 uncompressedData = data;
             [res close];
@@ -536,7 +546,7 @@ typedef std::map<std::string,NSMutableArray *> VecsForStyles;
                
                if (cacheData)
                {
-                   NSData *uncompressedData = [cacheData uncompressGZip];
+                   NSData *uncompressedData = UncompressTile(cacheData);
                    MaplyVectorObject *vecObj = nil;
                    if ([uncompressedData length] > 0)
                        vecObj = [MaplyVectorObject VectorObjectFromVectorDBRaw:uncompressedData];
@@ -568,7 +578,7 @@ typedef std::map<std::string,NSMutableArray *> VecsForStyles;
                         if ([tileData isKindOfClass:[NSData class]])
                         {
                             // Uncompress the data
-                            NSData *uncompressedData = [tileData uncompressGZip];
+                            NSData *uncompressedData = UncompressTile(tileData);
                             MaplyVectorObject *vecObj = nil;
                             if ([uncompressedData length] > 0)
                                 vecObj = [MaplyVectorObject VectorObjectFromVectorDBRaw:uncompressedData];
@@ -239,6 +239,11 @@ using namespace Maply;
     return mapScene;
 }
 
+- (void) loadSetup_sharedScene:(Scene *)theScene
+{
+    mapScene = (Maply::MapScene *)theScene;
+}
+
 - (MaplyBaseInteractionLayer *) loadSetup_interactionLayer
 {
     mapInteractLayer = [[MaplyInteractionLayer alloc] initWithMapView:mapView];
@@ -738,6 +743,21 @@ using namespace Maply;
     return [mapView pointOnScreenFromPlane:pt transform:&modelTrans frameSize:Point2f(sceneRenderer.framebufferWidth/glView.contentScaleFactor,sceneRenderer.framebufferHeight/glView.contentScaleFactor)];
 }
 
+- (void)screenPointsFromGeo:(MaplyCoordinate *)geoCoords screenPts:(CGPoint *)screenPts numPts:(int)numPts
+{
+    // Work the matrices out once for the whole batch
+    CoordSystemDisplayAdapter *coordAdapter = visualView.coordAdapter;
+    CoordSystem *coordSys = coordAdapter->getCoordSystem();
+    Eigen::Matrix4d modelTrans = [visualView calcFullMatrix];
+    Point2f frameSize(sceneRenderer.framebufferWidth/glView.contentScaleFactor,sceneRenderer.framebufferHeight/glView.contentScaleFactor);
+
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        Point3d pt = coordAdapter->localToDisplay(coordSys->geographicToLocal3d(GeoCoord(geoCoords[ii].x,geoCoords[ii].y)));
+        screenPts[ii] = [mapView pointOnScreenFromPlane:pt transform:&modelTrans frameSize:frameSize];
+    }
+}
+
 // See if the given bounding box is all on sreen
 - (bool)checkCoverage:(Mbr &)mbr mapView:(MaplyView *)theView height:(float)height
 {
@@ -21,6 +21,7 @@
 #import "MaplyWMSTileSource.h"
 #import "DDXMLElementAdditions.h"
 #import "DDXML.h"
+#import "MaplyTileDiskCache_private.h"
 
 @implementation MaplyWMSLayerBoundingBox
 
@@ -271,9 +272,25 @@
 
 @end
 
+// Response header lookup that doesn't care how the server capitalized it
+static NSString *HTTPHeader(NSDictionary *headers,NSString *name)
+{
+    for (NSString *key in headers)
+        if ([key caseInsensitiveCompare:name] == NSOrderedSame)
+            return headers[key];
+
+    return nil;
+}
+
 @implementation MaplyWMSTileSource
 {
     bool cacheInit;
+    MaplyTileDiskCache *tileCache;
+    // Constant part of the GetMap query.  Only the bounding box and
+    //  image size change from tile to tile.
+    NSString *reqTemplate;
+    // One lock per super tile block being fetched right now
+    NSMutableDictionary *superTileLocks;
 }
 
 - (id)initWithBaseURL:(NSString *)baseURL capabilities:(MaplyWMSCapabilities *)cap layer:(MaplyWMSLayer *)layer style:(MaplyWMSStyle *)style coordSys:(MaplyCoordinateSystem *)coordSys minZoom:(int)minZoom maxZoom:(int)maxZoom tileSize:(int)tileSize
@@ -293,12 +310,73 @@
     _tileSize = 256;
     _imageType = @"image/png";
     _transparent = false;
-    
+    _cachedFileLifetime = 0;
+    _superTileLevels = 0;
+    superTileLocks = [NSMutableDictionary dictionary];
+
     // Note: Should check the image type is there
-    
+
     return self;
 }
 
+- (void)setCacheDir:(NSString *)cacheDir
+{
+    _cacheDir = cacheDir;
+    tileCache = cacheDir ? [MaplyTileDiskCache diskCacheForDir:cacheDir] : nil;
+}
+
+// Anything that goes into the request template invalidates it
+- (void)setBaseURL:(NSString *)baseURL
+{
+    _baseURL = baseURL;
+    [self clearReqTemplate];
+}
+
+- (void)setImageType:(NSString *)imageType
+{
+    _imageType = imageType;
+    [self clearReqTemplate];
+}
+
+- (void)setLayer:(MaplyWMSLayer *)layer
+{
+    _layer = layer;
+    [self clearReqTemplate];
+}
+
+- (void)setStyle:(MaplyWMSStyle *)style
+{
+    _style = style;
+    [self clearReqTemplate];
+}
+
+- (void)setTransparent:(bool)transparent
+{
+    _transparent = transparent;
+    [self clearReqTemplate];
+}
+
+- (void)clearReqTemplate
+{
+    @synchronized(self)
+    {
+        reqTemplate = nil;
+    }
+}
+
+// Serialize the parameters that don't change per tile just once.
+// The per tile work is then an append of BBOX and size.
+- (NSString *)reqTemplate
+{
+    @synchronized(self)
+    {
+        if (!reqTemplate)
+            reqTemplate = [NSString stringWithFormat:@"%@?SERVICE=WMS&VERSION=1.1.1&REQUEST=GetMap&LAYERS=%@&STYLES=%@&SRS=%@&FORMAT=%@&TRANSPARENT=%@",_baseURL,_layer.name,(_style ? _style.name : @""),[_coordSys getSRS],_imageType,(_transparent ? @"true" : @"false")];
+
+        return reqTemplate;
+    }
+}
+
 // Figure out the name for the tile, if it's local
 - (NSString *)cacheFileForTile:(MaplyTileID)tileID
 {
@@ -321,77 +399,224 @@
 {
     if (!_cacheDir)
     return false;
-    
+
+    if ([tileCache hasTile:tileID maxAge:_cachedFileLifetime])
+        return true;
+
+    // Look for the old one file per tile layout
     NSString *fileName = [self cacheFileForTile:tileID];
     if ([[NSFileManager defaultManager] fileExistsAtPath:fileName])
     return true;
-    
+
     return false;
 }
 
-/// Return the image for a given tile
-- (id)imageForTile:(MaplyTileID)tileID
+// Check the cache for a tile, migrating anything we find in the
+//  old one file per tile layout
+- (NSData *)readFromCache:(MaplyTileID)tileID
 {
-    NSData *imgData = nil;
-    bool wasCached = false;
-    NSString *fileName = nil;
-    // Look for the image in the cache first
-    if (_cacheDir)
+    if (!tileCache)
+        return nil;
+
+    NSData *tileData = [tileCache dataForTile:tileID maxAge:_cachedFileLifetime];
+    if (tileData)
+        return tileData;
+
+    NSString *fileName = [self cacheFileForTile:tileID];
+    tileData = [NSData dataWithContentsOfFile:fileName];
+    if (tileData)
     {
-        fileName = [self cacheFileForTile:tileID];
-        imgData = [NSData dataWithContentsOfFile:fileName];
-        wasCached = true;
+        [tileCache setData:tileData forTile:tileID];
+        [[NSFileManager defaultManager] removeItemAtPath:fileName error:nil];
     }
-    
-    if (!imgData)
+
+    return tileData;
+}
+
+// An expired cache entry we can revalidate, if its validators came with it
+- (NSData *)staleDataFromCache:(MaplyTileID)tileID etag:(NSString **)etag lastModified:(NSString **)lastModified
+{
+    if (!tileCache)
+        return nil;
+
+    // Without a validator to replay there's nothing to revalidate
+    if (![tileCache validatorsForTile:tileID etag:etag lastModified:lastModified])
+        return nil;
+
+    return [tileCache dataForTile:tileID maxAge:0];
+}
+
+// Bounding box for a block of tiles on a side, anchored at the
+//  given tile's lower left
+- (void)boundsForTile:(MaplyTileID)tileID numTiles:(int)numTiles ll:(MaplyCoordinate *)tileLL ur:(MaplyCoordinate *)tileUR
+{
+    MaplyCoordinate ll,ur;
+    [self getBoundsLL:&ll ur:&ur];
+    int numSide = 1<<tileID.level;
+    tileLL->x = tileID.x * (ur.x-ll.x)/numSide + ll.x;
+    tileLL->y = tileID.y * (ur.y-ll.y)/numSide + ll.y;
+    tileUR->x = (tileID.x+numTiles) * (ur.x-ll.x)/numSide + ll.x;
+    tileUR->y = (tileID.y+numTiles) * (ur.y-ll.y)/numSide + ll.y;
+}
+
+// Put a GetMap request together for the bounding box
+- (NSMutableURLRequest *)requestForBox:(MaplyCoordinate)ll ur:(MaplyCoordinate)ur width:(int)width height:(int)height
+{
+    NSString *reqStr = [NSString stringWithFormat:@"%@&BBOX=%f,%f,%f,%f&WIDTH=%d&HEIGHT=%d",[self reqTemplate],ll.x,ll.y,ur.x,ur.y,width,height];
+    NSString *fullReqStr = [reqStr stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+
+    return [NSMutableURLRequest requestWithURL:[NSURL URLWithString:fullReqStr]];
+}
+
+// Fetch one bigger image covering this tile's whole block, slice it
+//  into tiles, and cache them all.  Returns the piece we were asked for.
+- (NSData *)imageFromSuperTile:(MaplyTileID)tileID
+{
+    int numLevels = _superTileLevels;
+    if (numLevels > tileID.level)
+        numLevels = tileID.level;
+    int blockSide = 1<<numLevels;
+    MaplyTileID blockID;
+    blockID.level = tileID.level;
+    blockID.x = (tileID.x / blockSide) * blockSide;
+    blockID.y = (tileID.y / blockSide) * blockSide;
+    NSString *blockKey = [NSString stringWithFormat:@"%d_%d_%d",blockID.level,blockID.x,blockID.y];
+
+    // One thread fetches a given block.  The rest of its tiles wait
+    //  here and then find theirs in the cache.
+    NSObject *blockLock = nil;
+    @synchronized(self)
     {
-        // SRS string for the coordinate system
-        NSString *srsStr = [_coordSys getSRS];
-
-        // Coordinates of the tile we're asking for
-        MaplyCoordinate ll,ur;
-        [self getBoundsLL:&ll ur:&ur];
-        MaplyCoordinate tileLL,tileUR;
-        int numSide = 1<<tileID.level;
-        tileLL.x = tileID.x * (ur.x-ll.x)/numSide + ll.x;
-        tileLL.y = tileID.y * (ur.y-ll.y)/numSide + ll.y;
-        tileUR.x = (tileID.x+1) * (ur.x-ll.x)/numSide + ll.x;
-        tileUR.y = (tileID.y+1) * (ur.y-ll.y)/numSide + ll.y;
-        
-        // Put the layer request together
-        NSMutableString *layerStr = [NSMutableString string];
-        [layerStr appendString:_layer.name];
-        
-        NSMutableString *reqStr = [NSMutableString stringWithFormat:@"%@?SERVICE=WMS&VERSION=1.1.1&REQUEST=GetMap&LAYERS=%@&STYLES=&SRS=%@&BBOX=%f,%f,%f,%f&WIDTH=%d&HEIGHT=%d&FORMAT=%@&TRANSPARENT=%@",_baseURL,layerStr,srsStr,tileLL.x,tileLL.y,tileUR.x,tileUR.y,_tileSize,_tileSize,_imageType,(_transparent ? @"true" : @"false")];
-        if (_style)
-            [reqStr appendFormat:@"&STYLES=%@",_style.name];
-        NSString *fullReqStr = [reqStr stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-        NSURLRequest *urlReq = [NSURLRequest requestWithURL:[NSURL URLWithString:fullReqStr]];
-        
-        // Fetch the image synchronously
-        NSURLResponse *resp = nil;
-        NSError *error = nil;
-        imgData = [NSURLConnection sendSynchronousRequest:urlReq returningResponse:&resp error:&error];
-        if (error || !imgData)
+        blockLock = superTileLocks[blockKey];
+        if (!blockLock)
         {
-            NSLog(@"Failed to fetch image at: %@",reqStr);
-            return nil;
+            blockLock = [[NSObject alloc] init];
+            superTileLocks[blockKey] = blockLock;
         }
-        
-        // some wms servers will response with 200 OK, but with text error.
-        if (![[resp MIMEType] hasPrefix:@"image/"])
+    }
+
+    NSData *tileData = nil;
+    @synchronized(blockLock)
+    {
+        // Someone else may have filled the cache in while we waited
+        tileData = [tileCache dataForTile:tileID maxAge:_cachedFileLifetime];
+        if (!tileData)
         {
-            NSLog(@"Failed to fetch image at: %@. Got mime type %@ - expected %@",
-                  reqStr, [resp MIMEType], _imageType);
-            return nil;
+            MaplyCoordinate blockLL,blockUR;
+            [self boundsForTile:blockID numTiles:blockSide ll:&blockLL ur:&blockUR];
+            NSURLRequest *urlReq = [self requestForBox:blockLL ur:blockUR width:_tileSize*blockSide height:_tileSize*blockSide];
+
+            NSURLResponse *resp = nil;
+            NSError *error = nil;
+            NSData *blockData = [NSURLConnection sendSynchronousRequest:urlReq returningResponse:&resp error:&error];
+            UIImage *blockImage = nil;
+            if (!error && blockData && [[resp MIMEType] hasPrefix:@"image/"])
+                blockImage = [UIImage imageWithData:blockData];
+            if (blockImage)
+            {
+                int tileWidth = blockImage.size.width/blockSide;
+                int tileHeight = blockImage.size.height/blockSide;
+                for (int ix=0;ix<blockSide;ix++)
+                    for (int iy=0;iy<blockSide;iy++)
+                    {
+                        // Tile Y counts up from the bottom, image rows down from the top
+                        CGRect cropRect = CGRectMake(ix*tileWidth,(blockSide-1-iy)*tileHeight,tileWidth,tileHeight);
+                        CGImageRef cropRef = CGImageCreateWithImageInRect(blockImage.CGImage,cropRect);
+                        if (!cropRef)
+                            continue;
+                        NSData *cropData = UIImagePNGRepresentation([UIImage imageWithCGImage:cropRef]);
+                        CGImageRelease(cropRef);
+                        if (!cropData)
+                            continue;
+                        MaplyTileID cropID;
+                        cropID.level = tileID.level;
+                        cropID.x = blockID.x+ix;
+                        cropID.y = blockID.y+iy;
+                        // Note: The block's validators belong to the block's URL,
+                        //       so the pieces go in without any
+                        [tileCache setData:cropData forTile:cropID];
+                        if (cropID.x == tileID.x && cropID.y == tileID.y)
+                            tileData = cropData;
+                    }
+            }
         }
-        
     }
-    
+
+    @synchronized(self)
+    {
+        [superTileLocks removeObjectForKey:blockKey];
+    }
+
+    return tileData;
+}
+
+/// Return the image for a given tile
+- (id)imageForTile:(MaplyTileID)tileID
+{
+    // Look for the image in the cache first
+    NSData *imgData = [self readFromCache:tileID];
+    if (imgData)
+        return imgData;
+
+    // A bigger GetMap covering the whole block costs about the same
+    //  round trip as a single tile, so fetch that and slice it up
+    if (_superTileLevels > 0 && tileCache)
+    {
+        imgData = [self imageFromSuperTile:tileID];
+        if (imgData)
+            return imgData;
+        // Fall through and fetch the tile on its own
+    }
+
+    // Coordinates of the tile we're asking for
+    MaplyCoordinate tileLL,tileUR;
+    [self boundsForTile:tileID numTiles:1 ll:&tileLL ur:&tileUR];
+    NSMutableURLRequest *urlReq = [self requestForBox:tileLL ur:tileUR width:_tileSize height:_tileSize];
+
+    // If we've got an expired copy with validators, ask the server
+    //  whether it's still good rather than refetching it outright
+    NSString *cachedEtag = nil,*cachedLastMod = nil;
+    NSData *staleData = [self staleDataFromCache:tileID etag:&cachedEtag lastModified:&cachedLastMod];
+    if (staleData)
+    {
+        if (cachedEtag)
+            [urlReq setValue:cachedEtag forHTTPHeaderField:@"If-None-Match"];
+        if (cachedLastMod)
+            [urlReq setValue:cachedLastMod forHTTPHeaderField:@"If-Modified-Since"];
+    }
+
+    // Fetch the image synchronously
+    NSURLResponse *resp = nil;
+    NSError *error = nil;
+    imgData = [NSURLConnection sendSynchronousRequest:urlReq returningResponse:&resp error:&error];
+    if (error || !imgData)
+    {
+        NSLog(@"Failed to fetch image at: %@",urlReq.URL);
+        return nil;
+    }
+
+    // Still good.  Reset its clock and use what we have.
+    if (staleData && [(NSHTTPURLResponse *)resp statusCode] == 304)
+    {
+        [tileCache touchTile:tileID];
+        return staleData;
+    }
+
+    // some wms servers will response with 200 OK, but with text error.
+    if (![[resp MIMEType] hasPrefix:@"image/"])
+    {
+        NSLog(@"Failed to fetch image at: %@. Got mime type %@ - expected %@",
+              urlReq.URL, [resp MIMEType], _imageType);
+        return nil;
+    }
+
     // Let's also write it back out for the cache
-    if (_cacheDir && !wasCached)
-        [imgData writeToFile:fileName atomically:YES];
-    
+    if (tileCache)
+    {
+        NSDictionary *headers = [(NSHTTPURLResponse *)resp allHeaderFields];
+        [tileCache setData:imgData forTile:tileID etag:HTTPHeader(headers,@"ETag") lastModified:HTTPHeader(headers,@"Last-Modified")];
+    }
+
     return imgData;
 }
 
@@ -0,0 +1,234 @@
+/*
+ *  MapnikCompiledFilter.mm
+ *  WhirlyGlobe-MaplyComponent
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "MapnikCompiledFilter.h"
+#import <vector>
+
+typedef enum {
+  FilterOpTrue = 0,
+  FilterOpEqual, FilterOpNotEqual,
+  FilterOpLess, FilterOpLessEq, FilterOpGreater, FilterOpGreaterEq,
+  FilterOpAnd, FilterOpOr, FilterOpNot
+} FilterOpType;
+
+typedef struct {
+  FilterOpType op;
+  //index into keys/constants for the comparison ops, -1 otherwise
+  int keyIdx;
+  int constIdx;
+} FilterInstr;
+
+//Most filters are one comparison; the deepest real style we've seen is ~10
+static const int FilterMaxStack = 64;
+
+//Compare an attribute value against a constant the way NSPredicate would.
+//Sets ok to false if the two aren't comparable.
+static inline NSComparisonResult CompareValues(id attrVal, id constVal, bool *ok) {
+  *ok = true;
+  if([attrVal isKindOfClass:[NSNumber class]]) {
+    if([constVal isKindOfClass:[NSNumber class]])
+      return [(NSNumber *)attrVal compare:(NSNumber *)constVal];
+    if([constVal isKindOfClass:[NSString class]])
+      return [(NSNumber *)attrVal compare:@([(NSString *)constVal doubleValue])];
+  } else if([attrVal isKindOfClass:[NSString class]]) {
+    //Mapnik filters compare string attributes to numbers fairly often
+    if([constVal isKindOfClass:[NSNumber class]])
+      return [@([(NSString *)attrVal doubleValue]) compare:(NSNumber *)constVal];
+    if([constVal isKindOfClass:[NSString class]])
+      return [(NSString *)attrVal compare:(NSString *)constVal];
+  }
+  *ok = false;
+  return NSOrderedAscending;
+}
+
+@implementation MapnikCompiledFilter
+{
+  std::vector<FilterInstr> instrs;
+  //these retain the objects the instructions point at
+  NSMutableArray *keys;
+  NSMutableArray *constants;
+}
+
+- (instancetype)initWithPredicate:(NSPredicate *)predicate {
+  self = [super init];
+  if(self) {
+    keys = [NSMutableArray array];
+    constants = [NSMutableArray array];
+    _valid = predicate && [self compilePredicate:predicate];
+    if(!_valid)
+      instrs.clear();
+  }
+  return self;
+}
+
+//Flatten the predicate tree into postfix order
+- (bool)compilePredicate:(NSPredicate *)predicate {
+  if([predicate isEqual:[NSPredicate predicateWithValue:YES]]) {
+    FilterInstr instr = {FilterOpTrue, -1, -1};
+    instrs.push_back(instr);
+    return true;
+  }
+
+  if([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+    NSCompoundPredicate *compound = (NSCompoundPredicate *)predicate;
+    NSArray *subs = compound.subpredicates;
+    switch(compound.compoundPredicateType) {
+      case NSNotPredicateType:
+      {
+        if(subs.count != 1 || ![self compilePredicate:subs[0]])
+          return false;
+        FilterInstr instr = {FilterOpNot, -1, -1};
+        instrs.push_back(instr);
+        return true;
+      }
+      case NSAndPredicateType:
+      case NSOrPredicateType:
+      {
+        if(subs.count == 0)
+          return false;
+        if(![self compilePredicate:subs[0]])
+          return false;
+        FilterOpType op = (compound.compoundPredicateType == NSAndPredicateType) ? FilterOpAnd : FilterOpOr;
+        for(NSUInteger ii = 1; ii < subs.count; ii++) {
+          if(![self compilePredicate:subs[ii]])
+            return false;
+          FilterInstr instr = {op, -1, -1};
+          instrs.push_back(instr);
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  if([predicate isKindOfClass:[NSComparisonPredicate class]]) {
+    NSComparisonPredicate *comp = (NSComparisonPredicate *)predicate;
+    //only plain <attribute> <op> <constant> comparisons (either way around)
+    if(comp.comparisonPredicateModifier != NSDirectPredicateModifier || comp.options != 0)
+      return false;
+    NSExpression *lhs = comp.leftExpression;
+    NSExpression *rhs = comp.rightExpression;
+    bool swapped = false;
+    if(lhs.expressionType == NSConstantValueExpressionType &&
+       rhs.expressionType == NSKeyPathExpressionType) {
+      NSExpression *tmp = lhs;
+      lhs = rhs;
+      rhs = tmp;
+      swapped = true;
+    }
+    if(lhs.expressionType != NSKeyPathExpressionType ||
+       rhs.expressionType != NSConstantValueExpressionType)
+      return false;
+    FilterOpType op;
+    switch(comp.predicateOperatorType) {
+      case NSEqualToPredicateOperatorType:              op = FilterOpEqual;  break;
+      case NSNotEqualToPredicateOperatorType:           op = FilterOpNotEqual;  break;
+      case NSLessThanPredicateOperatorType:             op = swapped ? FilterOpGreater : FilterOpLess;  break;
+      case NSLessThanOrEqualToPredicateOperatorType:    op = swapped ? FilterOpGreaterEq : FilterOpLessEq;  break;
+      case NSGreaterThanPredicateOperatorType:          op = swapped ? FilterOpLess : FilterOpGreater;  break;
+      case NSGreaterThanOrEqualToPredicateOperatorType: op = swapped ? FilterOpLessEq : FilterOpGreaterEq;  break;
+      default:
+        return false;
+    }
+    id constVal = rhs.constantValue;
+    if(!constVal)
+      return false;
+    FilterInstr instr;
+    instr.op = op;
+    instr.keyIdx = (int)keys.count;
+    [keys addObject:lhs.keyPath];
+    instr.constIdx = (int)constants.count;
+    [constants addObject:constVal];
+    instrs.push_back(instr);
+    return true;
+  }
+
+  return false;
+}
+
+- (BOOL)evaluate:(NSDictionary *)attributes {
+  bool stack[FilterMaxStack];
+  int top = -1;
+  CFDictionaryRef attrDict = (__bridge CFDictionaryRef)attributes;
+
+  for(unsigned int ii = 0; ii < instrs.size(); ii++) {
+    const FilterInstr &instr = instrs[ii];
+    switch(instr.op) {
+      case FilterOpTrue:
+        if(top+1 >= FilterMaxStack)
+          return NO;
+        stack[++top] = true;
+        break;
+      case FilterOpAnd:
+        if(top < 1)
+          return NO;
+        stack[top-1] = stack[top-1] && stack[top];
+        top--;
+        break;
+      case FilterOpOr:
+        if(top < 1)
+          return NO;
+        stack[top-1] = stack[top-1] || stack[top];
+        top--;
+        break;
+      case FilterOpNot:
+        if(top < 0)
+          return NO;
+        stack[top] = !stack[top];
+        break;
+      default:
+      {
+        if(top+1 >= FilterMaxStack)
+          return NO;
+        id attrVal = (__bridge id)CFDictionaryGetValue(attrDict, (__bridge const void *)keys[instr.keyIdx]);
+        bool result = false;
+        if(attrVal) {
+          bool ok;
+          NSComparisonResult order = CompareValues(attrVal, constants[instr.constIdx], &ok);
+          if(ok) {
+            switch(instr.op) {
+              case FilterOpEqual:     result = (order == NSOrderedSame);  break;
+              case FilterOpNotEqual:  result = (order != NSOrderedSame);  break;
+              case FilterOpLess:      result = (order == NSOrderedAscending);  break;
+              case FilterOpLessEq:    result = (order != NSOrderedDescending);  break;
+              case FilterOpGreater:   result = (order == NSOrderedDescending);  break;
+              case FilterOpGreaterEq: result = (order != NSOrderedAscending);  break;
+              default:  break;
+            }
+          } else if(instr.op == FilterOpEqual) {
+            result = [attrVal isEqual:constants[instr.constIdx]];
+          } else if(instr.op == FilterOpNotEqual) {
+            result = ![attrVal isEqual:constants[instr.constIdx]];
+          }
+        } else {
+          //missing attribute matches nothing, except a != test
+          result = (instr.op == FilterOpNotEqual);
+        }
+        stack[++top] = result;
+        break;
+      }
+    }
+  }
+
+  return (top == 0) ? stack[0] : NO;
+}
+
+@end
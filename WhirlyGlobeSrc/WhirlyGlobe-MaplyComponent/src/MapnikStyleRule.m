@@ -20,10 +20,12 @@
 
 
 #import "MapnikStyleRule.h"
+#import "MapnikCompiledFilter.h"
 #import "MaplyVectorStyle.h"
 
 @interface MapnikStyleRule ()
 @property (nonatomic, strong, readwrite) NSMutableArray *symbolizers;
+@property (nonatomic, strong, readwrite) MapnikCompiledFilter *compiledFilter;
 @end
 
 @implementation MapnikStyleRule
@@ -65,6 +67,14 @@
 }
 
 
+- (void)setFilterPredicate:(NSPredicate *)filterPredicate {
+  _filterPredicate = filterPredicate;
+  //compile the predicate once, so the tile parse loop can skip NSPredicate
+  MapnikCompiledFilter *compiled = [[MapnikCompiledFilter alloc] initWithPredicate:filterPredicate];
+  self.compiledFilter = compiled.valid ? compiled : nil;
+}
+
+
 - (void)setMaxScaleDenomitator:(NSUInteger)maxScaleDenomitator {
   _maxScaleDenomitator = maxScaleDenomitator;
   self.minZoom = [MapnikStyleRule scaleToZoom:maxScaleDenomitator];
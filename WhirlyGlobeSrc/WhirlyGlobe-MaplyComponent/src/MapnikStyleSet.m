@@ -44,6 +44,8 @@
 @property (nonatomic, strong) NSMutableDictionary *styles;
 @property (nonatomic, strong) NSMutableDictionary *layers;
 @property (nonatomic, strong) NSMutableDictionary *symbolizers;
+//layer_zoom -> array of MapnikZoomStyle, built as tiles come in
+@property (nonatomic, strong) NSMutableDictionary *zoomLayers;
 
 @property (nonatomic, assign, readwrite) BOOL parsing;
 @property (nonatomic, assign) BOOL success;
@@ -51,6 +53,16 @@
 
 @end
 
+//A style narrowed to the rules that can apply at one zoom level, so the
+// per-feature loop doesn't re-test zoom ranges
+@interface MapnikZoomStyle : NSObject
+@property (nonatomic, strong) MapnikStyle *style;
+@property (nonatomic, strong) NSArray *rules;
+@end
+
+@implementation MapnikZoomStyle
+@end
+
 @implementation MapnikStyleSet
 
 static NSString *MAP_ELEMENT = @"Map";
@@ -158,6 +170,7 @@ static NSString *FILTERMODE_ATTRIBUTE = @"filter-mode";
   self.styles = [NSMutableDictionary dictionary];
   self.layers = [NSMutableDictionary dictionary];
   self.symbolizers = [NSMutableDictionary dictionary];
+  self.zoomLayers = [NSMutableDictionary dictionary];
   
   NSInteger symbolizerId = 0;
 
@@ -282,31 +295,64 @@ static NSString *FILTERMODE_ATTRIBUTE = @"filter-mode";
 - (NSArray*)stylesForFeatureWithAttributes:(NSDictionary*)attributes
                                     onTile:(MaplyTileID)tileID
                                    inLayer:(NSString*)layer {
-  NSMutableArray *symbolizers = [NSMutableArray new];
-  NSArray *styles = self.layers[layer];
+  //Work out which rules can apply at this zoom level once, not per feature
+  NSString *zoomKey = [NSString stringWithFormat:@"%@_%d", layer, tileID.level];
+  NSArray *zoomStyles;
+  @synchronized(self) {
+    if(!self.zoomLayers) {
+      self.zoomLayers = [NSMutableDictionary dictionary];
+    }
+    zoomStyles = self.zoomLayers[zoomKey];
+    if(!zoomStyles) {
+      NSMutableArray *builtStyles = [NSMutableArray array];
+      for(MapnikStyle *style in self.layers[layer]) {
+        NSMutableArray *applicableRules = [NSMutableArray array];
+        for(MapnikStyleRule *rule in style.rules) {
+          if(tileID.level <= rule.maxZoom && (tileID.level >= rule.minZoom ||
+                                              (tileID.level == _tileMaxZoom && rule.minZoom >= _tileMaxZoom))) {
+            //some rules dont take effect until after max zoom, so we need to apply them at maxZoom
+            [applicableRules addObject:rule];
+          }
+        }
+        if(applicableRules.count) {
+          MapnikZoomStyle *zoomStyle = [MapnikZoomStyle new];
+          zoomStyle.style = style;
+          zoomStyle.rules = applicableRules;
+          [builtStyles addObject:zoomStyle];
+        }
+      }
+      zoomStyles = builtStyles;
+      self.zoomLayers[zoomKey] = zoomStyles;
+    }
+  }
 
-  for(MapnikStyle *style in styles) {
-    for(MapnikStyleRule *rule in style.rules) {
-      if(tileID.level <= rule.maxZoom && (tileID.level >= rule.minZoom ||
-                                          (tileID.level == _tileMaxZoom && rule.minZoom >= _tileMaxZoom))) {
-        //some rules dont take effect until after max zoom, so we need to apply them at maxZoom
+  NSMutableArray *symbolizers = [NSMutableArray new];
+  for(MapnikZoomStyle *zoomStyle in zoomStyles) {
+    for(MapnikStyleRule *rule in zoomStyle.rules) {
+      BOOL matched;
+      if(rule.compiledFilter) {
+        matched = [rule.compiledFilter evaluate:attributes];
+      } else {
+        //filter was too odd to compile, so it's NSPredicate for this one
         @try {
-          if([rule.filterPredicate evaluateWithObject:attributes]) {
-            [symbolizers addObjectsFromArray:rule.symbolizers];
-            if(style.filterModeFirst) {
-              //filter mode first means we stop applying rules after the first match
-              //https://github.com/mapnik/mapnik/issues/706
-              break;
-            }
-          }
+          matched = [rule.filterPredicate evaluateWithObject:attributes];
         }
         @catch (NSException *exception) {
           NSLog(@"Error evaluating rule:%@", rule.filterPredicate);
+          matched = NO;
+        }
+      }
+      if(matched) {
+        [symbolizers addObjectsFromArray:rule.symbolizers];
+        if(zoomStyle.style.filterModeFirst) {
+          //filter mode first means we stop applying rules after the first match
+          //https://github.com/mapnik/mapnik/issues/706
+          break;
         }
       }
     }
   }
-  
+
   return symbolizers;
 }
 
@@ -20,6 +20,134 @@
 
 #import <Foundation/Foundation.h>
 #import <zlib.h>
+#import "NSData+Zlib.h"
+
+@implementation MaplyStreamingInflater
+{
+    z_stream strm;
+    BOOL streamValid;
+    BOOL done;
+    NSMutableData *outBuf;
+    NSUInteger outLen;
+    // Largest stream we've seen, for pre-sizing the buffer
+    NSUInteger histSize;
+}
+
++ (MaplyStreamingInflater *)inflaterForThread
+{
+    NSMutableDictionary *threadDict = [[NSThread currentThread] threadDictionary];
+    MaplyStreamingInflater *inflater = threadDict[@"MaplyStreamingInflater"];
+    if (!inflater)
+    {
+        inflater = [[MaplyStreamingInflater alloc] init];
+        if (inflater)
+            threadDict[@"MaplyStreamingInflater"] = inflater;
+    }
+
+    return inflater;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    histSize = 16384;
+    outBuf = [NSMutableData dataWithLength:histSize];
+    outLen = 0;
+    done = NO;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    // The +32 lets zlib figure out gzip vs zlib headers on its own
+    if (inflateInit2(&strm, (15+32)) != Z_OK)
+        return nil;
+    streamValid = YES;
+
+    return self;
+}
+
+- (void)dealloc
+{
+    if (streamValid)
+        inflateEnd(&strm);
+}
+
+- (void)reset
+{
+    // Remember how big streams have been running, so the next one
+    //  usually lands in a single pre-sized buffer
+    if (outLen > histSize)
+        histSize = outLen;
+    if ([outBuf length] < histSize)
+        [outBuf setLength:histSize];
+    outLen = 0;
+    done = NO;
+    // Keeps the window allocation, unlike tearing the stream down
+    inflateReset(&strm);
+}
+
+- (BOOL)feedData:(const void *)bytes length:(NSUInteger)length
+{
+    if (done)
+        return YES;
+
+    strm.next_in = (Bytef *)bytes;
+    strm.avail_in = (unsigned int)length;
+    // Keep calling inflate whenever the last round filled the output
+    //  buffer exactly; zlib may still be holding decoded data even
+    //  though the input is exhausted
+    while (!done && (strm.avail_in > 0 || strm.avail_out == 0))
+    {
+        if (outLen >= [outBuf length])
+            [outBuf increaseLengthBy:[outBuf length]/2 + 16384];
+        strm.next_out = (Bytef *)[outBuf mutableBytes] + outLen;
+        strm.avail_out = (unsigned int)([outBuf length] - outLen);
+
+        int status = inflate(&strm, Z_SYNC_FLUSH);
+        outLen = [outBuf length] - strm.avail_out;
+        if (status == Z_STREAM_END)
+            done = YES;
+        else if (status == Z_BUF_ERROR)
+            // No progress to be made; the exact fill had nothing behind it
+            break;
+        else if (status != Z_OK)
+            return NO;
+    }
+
+    return YES;
+}
+
+- (const void *)inflatedBytes
+{
+    return [outBuf mutableBytes];
+}
+
+- (NSUInteger)inflatedLength
+{
+    return outLen;
+}
+
+- (BOOL)isDone
+{
+    return done;
+}
+
+- (NSData *)inflateData:(NSData *)data
+{
+    [self reset];
+    if (![self feedData:[data bytes] length:[data length]])
+        return nil;
+    if (!done)
+        return nil;
+
+    return [NSData dataWithBytes:[outBuf mutableBytes] length:outLen];
+}
+
+@end
 
 @implementation NSData(zlib)
 - (BOOL)isCompressed
@@ -75,51 +203,10 @@
 
 - (NSData *) uncompressGZip
 {
-    NSData *compressedData = self;
-    
-    if ([compressedData length] == 0) return compressedData;
-    
-    NSUInteger full_length = [compressedData length];
-    NSUInteger half_length = [compressedData length] / 2;
-    
-    NSMutableData *decompressed = [NSMutableData dataWithLength: full_length + half_length];
-    BOOL done = NO;
-    int status;
-    
-    z_stream strm;
-    strm.next_in = (Bytef *)[compressedData bytes];
-    strm.avail_in = (unsigned int)[compressedData length];
-    strm.total_out = 0;
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    
-    if (inflateInit2(&strm, (15+32)) != Z_OK) return nil;
-    
-    while (!done) {
-        // Make sure we have enough room and reset the lengths.
-        if (strm.total_out >= [decompressed length]) {
-            [decompressed increaseLengthBy: half_length];
-        }
-        strm.next_out = [decompressed mutableBytes] + strm.total_out;
-        strm.avail_out = (unsigned int)([decompressed length] - strm.total_out);
-        
-        // Inflate another chunk.
-        status = inflate (&strm, Z_SYNC_FLUSH);
-        if (status == Z_STREAM_END) {
-            done = YES;
-        } else if (status != Z_OK) {
-            break;
-        }
-    }
-    if (inflateEnd (&strm) != Z_OK) return nil;
-    
-    // Set real length.
-    if (done) {
-        [decompressed setLength: strm.total_out];
-        return [NSData dataWithData: decompressed];
-    } else {
-        return nil;
-    }
+    if ([self length] == 0) return self;
+
+    // The thread's inflater reuses its context and buffer from the last tile
+    return [[MaplyStreamingInflater inflaterForThread] inflateData:self];
 }
 
 @end
@@ -221,7 +221,7 @@ static const float MomentumAnimLen = 1.0;
                 Point3d p0 = [view pointUnproject:Point2f(touch0.x,touch0.y) width:sceneRender.framebufferWidth/glView.contentScaleFactor height:sceneRender.framebufferHeight/glView.contentScaleFactor clip:false];
                 Point3d p1 = [view pointUnproject:Point2f(touch1.x,touch1.y) width:sceneRender.framebufferWidth/glView.contentScaleFactor height:sceneRender.framebufferHeight/glView.contentScaleFactor clip:false];
                 Eigen::Matrix4d modelMat = [view calcFullMatrix];
-                Eigen::Matrix4d invModelMat = modelMat.inverse();
+                Eigen::Matrix4d invModelMat = [view cachedMatrixInverse:modelMat];
                 Vector4d model_p0 = invModelMat * Vector4d(p0.x(),p0.y(),p0.z(),1.0);
                 Vector4d model_p1 = invModelMat * Vector4d(p1.x(),p1.y(),p1.z(),1.0);
                 model_p0.x() /= model_p0.w();  model_p0.y() /= model_p0.w();  model_p0.z() /= model_p0.w();
@@ -48,7 +48,10 @@ using namespace WhirlyGlobe;
             self = nil;
             return nil;
         }
-        _earthLayer = [[WhirlyGlobeSphericalEarthLayer alloc] initWithTexGroup:texGroup];
+        // The cache name folds in the group dimensions, so a different
+        //  group with the same base name won't pick up a stale compiled file
+        NSString *cacheName = [NSString stringWithFormat:@"%@_%dx%d_%d",texGroup.baseName,texGroup.numX,texGroup.numY,texGroup.pixelsSquare];
+        _earthLayer = [[WhirlyGlobeSphericalEarthLayer alloc] initWithTexGroup:texGroup cacheName:cacheName];
         [layerThread addLayer:_earthLayer];
     }
     
@@ -77,7 +77,8 @@ using namespace WhirlyGlobe;
     panDelegate = nil;
     tapDelegate = nil;
     rotateDelegate = nil;
-    animateRotation = nil;    
+    animateRotation = nil;
+    animatePath = nil;
 
     doubleTapDelegate = nil;
     twoFingerTapDelegate = nil;
@@ -123,10 +124,16 @@ using namespace WhirlyGlobe;
 {
     globeScene = new WhirlyGlobe::GlobeScene(globeView.coordAdapter,4);
     sceneRenderer.theView = globeView;
-    
+
     return globeScene;
 }
 
+- (void) loadSetup_sharedScene:(Scene *)theScene
+{
+    globeScene = (WhirlyGlobe::GlobeScene *)theScene;
+    sceneRenderer.theView = globeView;
+}
+
 - (MaplyBaseInteractionLayer *) loadSetup_interactionLayer
 {
     globeInteractLayer = [[WGInteractionLayer alloc] initWithGlobeView:globeView];
@@ -584,6 +591,17 @@ using namespace WhirlyGlobe;
         return false;
 }
 
+// Fly along a great circle, rising to a peak height in the middle
+- (void)animateAlongGreatCircle:(WGCoordinate)newPos height:(float)height peakHeight:(float)peakHeight time:(NSTimeInterval)howLong
+{
+    // If we were rotating from one point to another, stop
+    [globeView cancelAnimation];
+
+    // The path delegate precomputes the whole path up front
+    animatePath = [[WhirlyGlobeAnimateViewPath alloc] initWithView:globeView toPosition:GeoCoord(newPos.x,newPos.y) endHeight:height peakHeight:peakHeight howLong:howLong];
+    globeView.delegate = animatePath;
+}
+
 // External facing set position
 - (void)setPosition:(WGCoordinate)newPos
 {
@@ -951,6 +969,21 @@ using namespace WhirlyGlobe;
     return [globeView pointOnScreenFromSphere:pt transform:&modelTrans frameSize:Point2f(sceneRenderer.framebufferWidth/glView.contentScaleFactor,sceneRenderer.framebufferHeight/glView.contentScaleFactor)];
 }
 
+- (void)screenPointsFromGeo:(MaplyCoordinate *)geoCoords screenPts:(CGPoint *)screenPts numPts:(int)numPts
+{
+    // Work the matrices out once for the whole batch
+    CoordSystemDisplayAdapter *coordAdapter = visualView.coordAdapter;
+    CoordSystem *coordSys = coordAdapter->getCoordSystem();
+    Eigen::Matrix4d modelTrans = [visualView calcFullMatrix];
+    Point2f frameSize(sceneRenderer.framebufferWidth/glView.contentScaleFactor,sceneRenderer.framebufferHeight/glView.contentScaleFactor);
+
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        Point3d pt = coordAdapter->localToDisplay(coordSys->geographicToLocal3d(GeoCoord(geoCoords[ii].x,geoCoords[ii].y)));
+        screenPts[ii] = [globeView pointOnScreenFromSphere:pt transform:&modelTrans frameSize:frameSize];
+    }
+}
+
 - (bool)screenPointFromGeo:(MaplyCoordinate)geoCoord screenPt:(CGPoint *)screenPt
 {
     Point3d pt = visualView.coordAdapter->localToDisplay(visualView.coordAdapter->getCoordSystem()->geographicToLocal3d(GeoCoord(geoCoord.x,geoCoord.y)));
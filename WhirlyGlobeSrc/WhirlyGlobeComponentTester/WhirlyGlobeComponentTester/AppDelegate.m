@@ -20,6 +20,7 @@
 
 #import "AppDelegate.h"
 #import "StartupViewController.h"
+#import "SoakTestViewController.h"
 
 @implementation AppDelegate
 {
@@ -32,7 +33,16 @@
 {
     self.window = [[UIWindow alloc] initWithFrame:[[UIScreen mainScreen] bounds]];
     self.window.backgroundColor = [UIColor whiteColor];
-    
+
+    // Scripted soak/regression mode for the device farm.
+    // Launch with -soak YES and it runs the matrix and exits.
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:@"soak"])
+    {
+        self.window.rootViewController = [[SoakTestViewController alloc] init];
+        [self.window makeKeyAndVisible];
+        return YES;
+    }
+
     StartupViewController *startViewC = [[StartupViewController alloc] init];
     navC = [[UINavigationController alloc] initWithRootViewController:startViewC];
     navC.navigationBar.barStyle = UIBarStyleBlackOpaque;
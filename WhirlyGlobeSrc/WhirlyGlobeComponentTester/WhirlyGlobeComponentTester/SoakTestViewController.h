@@ -0,0 +1,33 @@
+/*
+ *  SoakTestViewController.h
+ *  WhirlyGlobeComponentTester
+ *
+ *  Created by Steve Gifford on 5/12/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <UIKit/UIKit.h>
+
+/** The soak test runner drives the regular test view controller through
+    a fixed matrix of configurations, no human required.  Each scenario
+    gets the same camera path while we collect frame time histograms and
+    peak memory from the profiling calls.  When the matrix is done the
+    runner writes a JSON report to the Documents directory, prints it
+    between SOAKTEST-BEGIN/END markers for log scrapers, and exits.
+    Launch the app with -soak YES to get it.
+ */
+@interface SoakTestViewController : UIViewController
+
+@end
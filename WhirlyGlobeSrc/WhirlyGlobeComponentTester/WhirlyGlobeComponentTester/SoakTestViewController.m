@@ -0,0 +1,239 @@
+/*
+ *  SoakTestViewController.m
+ *  WhirlyGlobeComponentTester
+ *
+ *  Created by Steve Gifford on 5/12/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "SoakTestViewController.h"
+#import "TestViewController.h"
+
+// How long we measure each scenario once it's settled
+static const NSTimeInterval ScenarioDuration = 30.0;
+// How long we give a scenario to load before we start measuring
+static const NSTimeInterval SettleTime = 5.0;
+// The camera moves to a new stop this often
+static const NSTimeInterval CameraPeriod = 3.0;
+
+// Frame time histogram bucket edges (ms).  The last bucket is open ended.
+static const int NumFrameBuckets = 6;
+static const double FrameBucketEdges[NumFrameBuckets] = {8.0,16.7,33.3,66.7,133.3,1.0e9};
+
+// Camera path stops (lon,lat), shared by every scenario so runs compare
+static const int NumSoakStops = 10;
+static const float SoakStops[NumSoakStops][2] =
+{
+    {-122.4192, 37.7793},       // San Francisco
+    {-77.036667, 38.895111},    // Washington, DC
+    {-0.1275, 51.507222},       // London
+    {37.616667, 55.75},         // Moscow
+    {77.208889, 28.613889},     // New Delhi
+    {139.6917, 35.689506},      // Tokyo
+    {151.211111, -33.859972},   // Sydney
+    {-58.383333, -34.6},        // Buenos Aires
+    {3.395833, 6.453056},       // Lagos
+    {-94.58, 39.1},             // Kansas City
+};
+
+@implementation SoakTestViewController
+{
+    NSArray *scenarios;
+    int scenarioAt;
+    TestViewController *testViewC;
+    NSMutableArray *results;
+
+    // Measurement state for the scenario underway
+    NSTimer *cameraTimer,*sampleTimer;
+    int cameraAt;
+    bool zoomedIn;
+    int frameBuckets[NumFrameBuckets];
+    int numFrames;
+    double worstFrameMs;
+    NSTimeInterval lastFrameStart;
+    unsigned long long peakBytes;
+}
+
+- (void)viewDidLoad
+{
+    [super viewDidLoad];
+    self.view.backgroundColor = [UIColor blackColor];
+
+    // The matrix of configurations we grind through.  These lean on
+    //  local and generated layers, so a device farm run doesn't hang
+    //  on someone else's tile server.
+    scenarios = @[
+        @{@"name": @"globe_geography_class", @"mapType": @(MaplyGlobe), @"base": kMaplyTestGeographyClass},
+        @{@"name": @"globe_quad_test_objects", @"mapType": @(MaplyGlobe), @"base": kMaplyTestQuadTest,
+          @"objects": @[kMaplyTestLabel2D,kMaplyTestMarker2D,kMaplyTestShapeGreatCircle]},
+        @{@"name": @"globe_quad_test_animated", @"mapType": @(MaplyGlobe), @"base": kMaplyTestQuadTestAnimate},
+        @{@"name": @"globe_countries_lofted", @"mapType": @(MaplyGlobe), @"base": kMaplyTestBlueMarble,
+          @"objects": @[kMaplyTestCountry,kMaplyTestLoftedPoly]},
+        @{@"name": @"map2d_quad_test_megamarkers", @"mapType": @(Maply2DMap), @"base": kMaplyTestQuadTest,
+          @"objects": @[kMaplyTestMegaMarkers,kMaplyTestLabel2D]},
+        @{@"name": @"map3d_geography_roads", @"mapType": @(Maply3DMap), @"base": kMaplyTestGeographyClass,
+          @"objects": @[kMaplyTestRoads]},
+    ];
+
+    results = [NSMutableArray array];
+    scenarioAt = -1;
+    [self nextScenario];
+}
+
+// Bring up the test controller for the next scenario, or wrap up
+- (void)nextScenario
+{
+    scenarioAt++;
+    if (scenarioAt >= [scenarios count])
+    {
+        [self finishUp];
+        return;
+    }
+
+    NSDictionary *scenario = scenarios[scenarioAt];
+    NSLog(@"SoakTest: setting up %@",scenario[@"name"]);
+
+    testViewC = [[TestViewController alloc] initWithMapType:(MapType)[scenario[@"mapType"] intValue]];
+    [self.view addSubview:testViewC.view];
+    testViewC.view.frame = self.view.bounds;
+    [self addChildViewController:testViewC];
+
+    // The test controller reads its switches in viewDidLoad, so we
+    //  poke ours in afterwards and let the layers start loading
+    [self performSelector:@selector(applyScenario) withObject:nil afterDelay:0.5];
+}
+
+- (void)applyScenario
+{
+    NSDictionary *scenario = scenarios[scenarioAt];
+    [testViewC setTestOption:scenario[@"base"] section:kMaplyTestCategoryBaseLayers value:true];
+    for (NSString *object in scenario[@"objects"])
+        [testViewC setTestOption:object section:kMaplyTestCategoryObjects value:true];
+    [testViewC rebuildContents];
+
+    [self performSelector:@selector(startMeasuring) withObject:nil afterDelay:SettleTime];
+}
+
+- (void)startMeasuring
+{
+    for (unsigned int ii=0;ii<NumFrameBuckets;ii++)
+        frameBuckets[ii] = 0;
+    numFrames = 0;
+    worstFrameMs = 0.0;
+    lastFrameStart = 0.0;
+    peakBytes = 0;
+    cameraAt = 0;
+    zoomedIn = false;
+
+    [[testViewC baseViewC] startPerformanceCapture];
+    cameraTimer = [NSTimer scheduledTimerWithTimeInterval:CameraPeriod target:self selector:@selector(moveCamera) userInfo:nil repeats:YES];
+    sampleTimer = [NSTimer scheduledTimerWithTimeInterval:1.0 target:self selector:@selector(samplePerformance) userInfo:nil repeats:YES];
+    [self moveCamera];
+
+    [self performSelector:@selector(stopMeasuring) withObject:nil afterDelay:ScenarioDuration];
+}
+
+// The fixed camera path: hop between stops, diving in at every other one
+- (void)moveCamera
+{
+    MaplyBaseViewController *baseViewC = [testViewC baseViewC];
+    MaplyCoordinate coord = MaplyCoordinateMakeWithDegrees(SoakStops[cameraAt][0],SoakStops[cameraAt][1]);
+    float height = zoomedIn ? 0.002 : 0.5;
+    if ([baseViewC isKindOfClass:[WhirlyGlobeViewController class]])
+    {
+        WhirlyGlobeViewController *globeViewC = (WhirlyGlobeViewController *)baseViewC;
+        globeViewC.height = height;
+        [globeViewC animateToPosition:coord time:CameraPeriod/2.0];
+    } else if ([baseViewC isKindOfClass:[MaplyViewController class]]) {
+        MaplyViewController *mapViewC = (MaplyViewController *)baseViewC;
+        mapViewC.height = height;
+        [mapViewC animateToPosition:coord time:CameraPeriod/2.0];
+    }
+
+    zoomedIn = !zoomedIn;
+    cameraAt = (cameraAt + 1) % NumSoakStops;
+}
+
+// Pull the frame ring and the memory census once a second
+- (void)samplePerformance
+{
+    MaplyBaseViewController *baseViewC = [testViewC baseViewC];
+    for (NSDictionary *frame in [baseViewC recentFrameTimes])
+    {
+        NSTimeInterval start = [frame[@"start"] doubleValue];
+        // The ring will still have frames we counted last time through
+        if (start <= lastFrameStart)
+            continue;
+        lastFrameStart = start;
+        double cpuMs = [frame[@"cpuMs"] doubleValue];
+        numFrames++;
+        if (cpuMs > worstFrameMs)
+            worstFrameMs = cpuMs;
+        for (unsigned int ii=0;ii<NumFrameBuckets;ii++)
+            if (cpuMs <= FrameBucketEdges[ii])
+            {
+                frameBuckets[ii]++;
+                break;
+            }
+    }
+
+    unsigned long long bytes = [[baseViewC memoryCensus][@"bytes"] unsignedLongLongValue];
+    if (bytes > peakBytes)
+        peakBytes = bytes;
+}
+
+- (void)stopMeasuring
+{
+    [cameraTimer invalidate];
+    cameraTimer = nil;
+    [sampleTimer invalidate];
+    sampleTimer = nil;
+
+    // One last sample so a late spike doesn't slip away
+    [self samplePerformance];
+
+    NSDictionary *scenario = scenarios[scenarioAt];
+    NSString *report = [[testViewC baseViewC] stopPerformanceCapture];
+
+    NSMutableArray *histogram = [NSMutableArray array];
+    for (unsigned int ii=0;ii<NumFrameBuckets;ii++)
+        [histogram addObject:[NSString stringWithFormat:@"%d",frameBuckets[ii]]];
+
+    [results addObject:[NSString stringWithFormat:@"{\"name\":\"%@\",\"frames\":%d,\"worstFrameMs\":%.2f,\"peakBytes\":%llu,\"histogramMs\":[%@],\"report\":%@}",
+                        scenario[@"name"],numFrames,worstFrameMs,peakBytes,[histogram componentsJoinedByString:@","],report]];
+
+    // Tear the scenario down and move along
+    [testViewC.view removeFromSuperview];
+    [testViewC removeFromParentViewController];
+    testViewC = nil;
+
+    [self nextScenario];
+}
+
+// Write the report where the device farm can collect it and get out
+- (void)finishUp
+{
+    NSString *json = [NSString stringWithFormat:@"{\"scenarios\":[%@]}",[results componentsJoinedByString:@","]];
+
+    NSString *docDir = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES) objectAtIndex:0];
+    NSString *reportFile = [docDir stringByAppendingPathComponent:@"soak_report.json"];
+    [json writeToFile:reportFile atomically:YES encoding:NSUTF8StringEncoding error:nil];
+
+    fprintf(stdout,"SOAKTEST-BEGIN\n%s\nSOAKTEST-END\n",[json UTF8String]);
+    fflush(stdout);
+    exit(0);
+}
+
+@end
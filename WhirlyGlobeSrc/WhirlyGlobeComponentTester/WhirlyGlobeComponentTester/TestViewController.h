@@ -42,4 +42,10 @@ typedef enum {MaplyGlobe,MaplyGlobeWithElevation,Maply3DMap,Maply2DMap,MaplyNumT
 // Fire it up with a particular base layer and map or globe display
 - (id)initWithMapType:(MapType)mapType;
 
+// Hooks for the scripted soak test runner.  These poke the same
+//  configuration switches the settings panel does.
+- (MaplyBaseViewController *)baseViewC;
+- (void)setTestOption:(NSString *)row section:(NSString *)section value:(bool)on;
+- (void)rebuildContents;
+
 @end
@@ -423,6 +423,33 @@ typedef enum {HighPerformance,LowPerformance} PerformanceMode;
 	return YES;
 }
 
+#pragma mark - Soak test hooks
+
+- (MaplyBaseViewController *)baseViewC
+{
+    return baseViewC;
+}
+
+// The soak runner flips the same switches the settings panel does
+- (void)setTestOption:(NSString *)row section:(NSString *)section value:(bool)on
+{
+    for (ConfigSection *cs in configViewC.values)
+        if (![cs.sectionName compare:section])
+        {
+            // Turning one option on turns its siblings off
+            if (cs.singleSelect && on)
+                for (NSString *which in [cs.rows allKeys])
+                    cs.rows[which] = @(NO);
+            if (cs.rows[row])
+                cs.rows[row] = @(on);
+        }
+}
+
+- (void)rebuildContents
+{
+    [self changeMapContents];
+}
+
 #pragma mark - Data Display
 
 // Change the heading every so often
@@ -37,9 +37,13 @@
 
 /// Return true if you have an update that needs to be procssed.
 /// Return false if you don't, otherwise we'll be constantly rendering.
+/// This is your dirty flag: the renderer skips updateForFrame entirely
+///  while you return false, so keep it cheap and keep it honest.
 - (bool)hasUpdate;
 
 /// Update your stuff for display, but be quick!
+/// The renderer runs the dirty models under a per frame time budget.
+///  If you're still dirty when your turn ends, you go first next frame.
 - (void)updateForFrame:(WhirlyKitRendererFrameInfo *)frameInfo;
 
 /// Time to clean up your toys
@@ -25,8 +25,8 @@ namespace WhirlyKit
 {
     
 class BigDrawableSwap;
-    
-/** The Big Drawable is a double buffered drawable we can use to make changes
+
+/** The Big Drawable is a multi buffered drawable we can use to make changes
     in one thread and have them reflected in the visuals without slowing
     the renderer down.
   */
@@ -34,6 +34,11 @@ class BigDrawable : public Drawable
 {
     friend class DynamicDrawableAtlas;
 public:
+    /// Number of buffers we rotate through.  With three, the layer
+    ///  thread can flush again while a swap is still in flight without
+    ///  touching the buffer the renderer is drawing.
+    static const int NumBuffers = 3;
+
     /// Construct with a debugging name, a compatible drawable, and the total number of bytes
     BigDrawable(const std::string &name,int singleVertexSize,const std::vector<VertexAttribute> &templateAttributes ,int singleElementSize,int numVertexBytes,int numElementBytes);
     virtual ~BigDrawable();
@@ -115,11 +120,24 @@ public:
     
     /// Clear the region referred to by position and size (in bytes)
     void clearRegion(int vertPos,int vertSize,SimpleIdentity elementChunkId);
+
+    /// Move the given region's vertex data down into the lowest free
+    ///  slot that will hold it, rebasing its element indices.  Used by
+    ///  the atlas' incremental compaction pass.  The move takes effect
+    ///  with the next flush/swap.  Updates vertPos and returns true if
+    ///  the region actually moved.
+    bool moveRegion(int &vertPos,int vertSize,SimpleIdentity elementChunkId);
+
+    /// Fragmentation info for the vertex buffer: how many free regions
+    ///  there are and the largest contiguous one (in bytes)
+    void getFragmentation(int &numRegions,int &largestFree);
     
-    /// Flush out changes to the inactive buffer and request a switch
+    /// Flush out changes to the next write buffer and request a switch
     void swap(ChangeSet &changes,BigDrawableSwap *swapRequest);
-    
-    /// Return true if we're waiting on a buffer swap, but don't block
+
+    /// Return true if the whole buffer ring is in flight and another
+    ///  flush would touch a buffer the renderer may be using.  With the
+    ///  ring this is almost never the case.  Doesn't block.
     bool isWaitingOnSwap();
     
     /// Check if there are outstanding changes in either buffer
@@ -192,20 +210,27 @@ protected:
         std::vector<ChangeRef> changes;
         // VAO we use for rendering
         GLuint vertexArrayObj;
+        // Fence dropped behind the buffer when it went out of service (ES3).
+        // The flush that reuses it waits on this instead of trusting the
+        //  depth of the ring.
+        GLsync readFence;
     };
     
     int numVertexBytes,numElementBytes;
     // One of these buffers will be active at a time
-    Buffer buffers[2];
+    Buffer buffers[NumBuffers];
     // Which buffer is currently active
     int activeBuffer;
+    // Next buffer in the ring we'll flush into
+    int writeBuffer;
     // Size of one vertex
     int singleVertexSize;
     // Size of one element
     int singleElementSize;
-    
+
     pthread_cond_t useCondition;
-    bool waitingOnSwap;
+    // Number of swap requests in flight to the renderer
+    int pendingSwaps;
     pthread_mutex_t useMutex;
     
     // Free region within the vertex buffer
@@ -230,9 +255,12 @@ protected:
     class ElementChunk : public Identifiable
     {
     public:
-        ElementChunk(NSData *elementData) : elementData(elementData), enabled(true) { }
-        ElementChunk(SimpleIdentity theId) : Identifiable(theId) { }
+        ElementChunk(NSData *elementData) : elementData(elementData), vertData(nil), enabled(true) { }
+        ElementChunk(SimpleIdentity theId) : Identifiable(theId), elementData(nil), vertData(nil), enabled(true) { }
         NSData *elementData;
+        /// We hang on to the vertex data so the compaction pass can
+        ///  relocate the region without reading the GPU back
+        NSData *vertData;
         bool enabled;
     };
     typedef std::set<ElementChunk> ElementChunkSet;
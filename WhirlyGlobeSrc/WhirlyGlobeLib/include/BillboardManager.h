@@ -26,6 +26,7 @@
 #import "BillboardDrawable.h"
 #import "Scene.h"
 #import "SelectionManager.h"
+#import "DynamicTextureAtlas.h"
 
 // Used to pass parameters around between threads
 @interface WhirlyKitBillboardInfo : NSObject
@@ -58,6 +59,9 @@
 @property (nonatomic,assign) float width;
 /// Color of geometry
 @property (nonatomic,assign) UIColor *color;
+/// If set, we'll pack this into the shared billboard atlas so the
+///  whole group can render together.  Otherwise we use texId.
+@property (nonatomic) UIImage *image;
 /// Texture to use
 @property (nonatomic,assign) WhirlyKit::SimpleIdentity texId;
 /// If set, this marker should be made selectable
@@ -84,6 +88,7 @@ public:
     
     SimpleIDSet drawIDs;  // Drawables created for this
     SimpleIDSet selectIDs;  // IDs used for selection
+    std::vector<SubTexture> subTexs;  // Atlas regions to hand back on removal
     float fade;  // Time to fade away for removal
 };
 
@@ -96,8 +101,8 @@ public:
     BillboardDrawableBuilder(Scene *scene,ChangeSet &changes,BillboardSceneRep *sceneRep,WhirlyKitBillboardInfo *billInfo,SimpleIdentity billboardProgram,SimpleIdentity texId);
     ~BillboardDrawableBuilder();
     
-    void addBillboard(Point3f center,float width,float height,UIColor *color);
-    
+    void addBillboard(Point3f center,float width,float height,UIColor *color,const SubTexture &subTex);
+
     void flush();
     
 protected:
@@ -133,6 +138,10 @@ public:
 
 protected:
     pthread_mutex_t billLock;
+    pthread_mutex_t atlasLock;
+    // Shared atlas for billboards handed over as images.  One atlas page
+    //  means one drawable for the whole group.
+    DynamicTextureAtlas *texAtlas;
     BillboardSceneRepSet sceneReps;
 };
 
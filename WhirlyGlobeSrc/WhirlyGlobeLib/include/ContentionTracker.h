@@ -0,0 +1,117 @@
+/*
+ *  ContentionTracker.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 6/2/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import <pthread.h>
+#import <string>
+#import <map>
+
+/// Define WK_LOCK_PROFILING (in the build settings of a profiling
+///  configuration) to compile the lock instrumentation in.  In a
+///  regular build the wrappers below collapse to the bare pthread
+///  calls and nothing here costs anything.
+#ifndef WK_LOCK_PROFILING
+#define WK_LOCK_PROFILING 0
+#endif
+
+namespace WhirlyKit
+{
+
+/** Collects wait times for named locks and ages for queued work so we
+    can see where the engine blocks.  Threads report in from wherever
+    they stall, so the tracker takes its own (uninstrumented) lock.
+    The renderer logs and clears this alongside the performance timers.
+  */
+class ContentionTracker
+{
+public:
+    /// Wait time histogram buckets: <100us, <1ms, <10ms, <100ms, the rest
+    static const int NumWaitBuckets = 5;
+
+    /// Everything we know about one named lock (or queue)
+    class WaitEntry
+    {
+    public:
+        WaitEntry();
+        void addWait(NSTimeInterval dur);
+
+        int numWaits;
+        NSTimeInterval totalWait,maxWait;
+        int buckets[NumWaitBuckets];
+    };
+
+    /// There's one tracker and everyone reports to it
+    static ContentionTracker &getInstance();
+
+    /// Record a blocking wait on the given named lock
+    void addWait(const char *name,NSTimeInterval dur);
+
+    /// Record how long a piece of queued work sat before it ran
+    void addLatency(const char *name,NSTimeInterval age);
+
+    /// Write the histograms to NSLog and start over.
+    /// The renderer calls this when it logs the performance timers.
+    void logAndClear();
+
+protected:
+    ContentionTracker();
+
+    pthread_mutex_t lock;
+    std::map<std::string,WaitEntry> waitEntries;
+    std::map<std::string,WaitEntry> latencyEntries;
+};
+
+}
+
+/** Lock wrappers for the hot locks.  In a regular build these are the
+    bare pthread calls.  In a profiling build we try the lock first and
+    only pay for timestamps when we would actually have blocked, so the
+    uncontended path stays uncontended.
+  */
+#if WK_LOCK_PROFILING
+#define WK_MUTEX_LOCK(mutexPtr,lockName) \
+    do { \
+        if (pthread_mutex_trylock(mutexPtr) != 0) { \
+            NSTimeInterval wkWaitStart = CFAbsoluteTimeGetCurrent(); \
+            pthread_mutex_lock(mutexPtr); \
+            WhirlyKit::ContentionTracker::getInstance().addWait(lockName,CFAbsoluteTimeGetCurrent()-wkWaitStart); \
+        } \
+    } while (0)
+#define WK_RWLOCK_RDLOCK(rwlockPtr,lockName) \
+    do { \
+        if (pthread_rwlock_tryrdlock(rwlockPtr) != 0) { \
+            NSTimeInterval wkWaitStart = CFAbsoluteTimeGetCurrent(); \
+            pthread_rwlock_rdlock(rwlockPtr); \
+            WhirlyKit::ContentionTracker::getInstance().addWait(lockName,CFAbsoluteTimeGetCurrent()-wkWaitStart); \
+        } \
+    } while (0)
+#define WK_RWLOCK_WRLOCK(rwlockPtr,lockName) \
+    do { \
+        if (pthread_rwlock_trywrlock(rwlockPtr) != 0) { \
+            NSTimeInterval wkWaitStart = CFAbsoluteTimeGetCurrent(); \
+            pthread_rwlock_wrlock(rwlockPtr); \
+            WhirlyKit::ContentionTracker::getInstance().addWait(lockName,CFAbsoluteTimeGetCurrent()-wkWaitStart); \
+        } \
+    } while (0)
+#else
+#define WK_MUTEX_LOCK(mutexPtr,lockName) pthread_mutex_lock(mutexPtr)
+#define WK_RWLOCK_RDLOCK(rwlockPtr,lockName) pthread_rwlock_rdlock(rwlockPtr)
+#define WK_RWLOCK_WRLOCK(rwlockPtr,lockName) pthread_rwlock_wrlock(rwlockPtr)
+#endif
@@ -67,14 +67,30 @@ public:
     /// Convert from display coordinates to geocentric
     virtual WhirlyKit::Point3f geocentricToLocal(WhirlyKit::Point3f) = 0;
     virtual WhirlyKit::Point3d geocentricToLocal(WhirlyKit::Point3d) = 0;
-    
+
+    /** Batch versions of the conversions above.  The defaults just call
+        the single point versions in a loop, but subclasses override them
+        to hoist the per point virtual dispatch out of tight builder loops
+        and, for the Proj-4 backed systems, run one transform over the
+        whole array.  Input and output arrays may be the same.
+      */
+    virtual void localToGeographic(const Point3f *inPts,GeoCoord *outCoords,unsigned int numPts);
+    virtual void geographicToLocal(const GeoCoord *inCoords,Point3f *outPts,unsigned int numPts);
+    virtual void geographicToLocal(const GeoCoord *inCoords,Point3d *outPts,unsigned int numPts);
+    virtual void localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    virtual void geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+
     /// Return true if the given coordinate system is the same as the one passed in
     virtual bool isSameAs(CoordSystem *coordSys) { return false; }
 };
-    
+
 /// Convert a point from one coordinate system to another
 Point3f CoordSystemConvert(CoordSystem *inSystem,CoordSystem *outSystem,Point3f inCoord);
 Point3d CoordSystemConvert3d(CoordSystem *inSystem,CoordSystem *outSystem,Point3d inCoord);
+
+/// Batch version of the conversion above.  Identical systems just copy.
+/// Input and output arrays may be the same.
+void CoordSystemConvertArray(CoordSystem *inSystem,CoordSystem *outSystem,const Point3f *inCoords,Point3f *outCoords,unsigned int numCoords);
     
 /** The Coordinate System Display Adapter handles the task of
     converting coordinates in the native system to data values we
@@ -101,7 +117,14 @@ public:
     /// Convert from display coordinates to the local system's coordinates
     virtual WhirlyKit::Point3f displayToLocal(WhirlyKit::Point3f) = 0;
     virtual WhirlyKit::Point3d displayToLocal(WhirlyKit::Point3d) = 0;
-    
+
+    /// Batch versions of localToDisplay.  The defaults just loop;
+    ///  subclasses with real math override them so the mesh builders
+    ///  aren't paying a virtual call per vertex.  Input and output
+    ///  arrays may be the same.
+    virtual void localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    virtual void localToDisplay(const Point3d *inPts,Point3d *outPts,unsigned int numPts);
+
     /// For flat systems the normal is Z up.  For the globe, it's based on the location.
     virtual Point3f normalForLocal(Point3f) = 0;
     virtual Point3d normalForLocal(Point3d) = 0;
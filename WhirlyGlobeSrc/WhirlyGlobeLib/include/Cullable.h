@@ -18,6 +18,8 @@
  *
  */
 
+#import <map>
+#import <set>
 #import "Drawable.h"
 #import "CoordSystem.h"
 
@@ -31,30 +33,57 @@ class Cullable;
     for scenegraph culling.
   */
 class CullTree
-{ 
+{
     friend class Cullable;
 public:
     CullTree(WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr localMbr,int depth,int maxDrawPerNode = 8);
     ~CullTree();
-    
+
     Cullable *getTopCullable() { return topCullable; }
     int getCount() { return numCullables; }
-    
+
+    /// Remove the given drawable wherever it wound up.
+    /// We cache the nodes each drawable landed in, so this patches the
+    ///  tree directly rather than descending from the top by bounding box.
+    void remDrawable(DrawableRef drawable);
+
+    /// Start a bulk add.  Node splits are deferred until the end, so a
+    ///  whole layer flush rebalances the tree once rather than once per
+    ///  drawable.
+    void beginBulkAdds();
+    /// Finish a bulk add, splitting any nodes that wound up overfull
+    void endBulkAdds();
+
     /// Print stats out to the log
     void dumpStats();
-    
+
 protected:
+    /// Bookkeeping for the cull nodes a given drawable was filed under
+    void registerDrawable(SimpleIdentity drawId,Cullable *cullable);
+    void unregisterDrawable(SimpleIdentity drawId,Cullable *cullable);
+
     CoordSystemDisplayAdapter *coordAdapter;
     Cullable *topCullable;
     int depth;
     int maxDrawPerNode;
     int numCullables;
+    bool bulkAdds;
+
+    /// Which cull nodes each drawable is in, so removal is a direct patch
+    typedef std::map<SimpleIdentity,std::set<Cullable *> > DrawNodeMap;
+    DrawNodeMap drawNodeMap;
 };
     
 /// Number of "corners" we used to define things in world space.
 #define WhirlyKitCullableCorners 8
 /// Number of normals we'll consider for backface culling calculations.
 #define WhirlyKitCullableCornerNorms 4
+/// How far (in radians) the eye can move before cached backface
+///  culling results have to be refreshed.  The bounding cones are
+///  padded by this much, so the cached results stay conservative.
+#define WhirlyKitEyeCullSlop 0.0175f
+/// minEyeDot value for a node that can never be fully backfacing
+#define WhirlyKitNeverEyeCull -2.0f
 
 /** This is a representation of cullable geometry.  It has
     geometry/direction info and a list of associated
@@ -98,16 +127,34 @@ public:
     /// Count the number of nodes at and below this level
     int countNodes() const;
         
-public:	
+public:
     Cullable *getOrAddChild(int which,CullTree *tree);
     void possibleRemoveChild(int which,CullTree *tree);
     void addDrawableToChildren(CullTree *cullTree,Mbr drawLocalMbr,DrawableRef draw);
     void split(CullTree *);
-    
+    /// Pull everything below up into this node and drop the children
+    void collapse(CullTree *cullTree);
+    /// Clear the drawable bookkeeping for this node and everything below
+    void unregisterSubtree(CullTree *cullTree);
+    /// Split any nodes that wound up overfull after a bulk add
+    void splitIfOverfull(CullTree *cullTree);
+
+    /// Parent node, so removals can patch the cached child lists upward
+    Cullable *parent;
+
     /// 3D locations (in model space) of the corners
 	Point3f cornerPoints[WhirlyKitCullableCorners];
 	/// Normal vectors (in model space) for the corners
     Eigen::Vector3f cornerNorms[WhirlyKitCullableCornerNorms];
+    /// Axis of the bounding cone around the corner normals
+    Eigen::Vector3f coneAxis;
+    /// Eye dot product below which the whole node faces away.
+    /// WhirlyKitNeverEyeCull if the node can't be fully backfacing.
+    float minEyeDot;
+    /// Generation stamp for the cached eye facing test
+    int eyeCullGen;
+    /// Cached result of the eye facing test
+    bool eyeFacing;
     /// Opposite of depth.  0 means go no lower
     int height;
     /// Local coordinates for bounding box
@@ -0,0 +1,385 @@
+/*
+ *  DataCompressor.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+/** Pluggable compression codecs for the tile, elevation and snapshot
+    formats.  Everything goes out in a little self describing frame
+    (magic, codec, raw size), so readers don't need to be told what a
+    blob was compressed with and formats can switch codecs per record.
+
+    zlib still wins on ratio, but LZ4 decodes several times faster,
+    which is what matters for cache resident data the layer threads
+    chew through.  The LZ4 block codec is implemented right here from
+    the format spec rather than pulling in the library.
+
+    This is all header only, inline, Foundation free C++ (apart from
+    the NSData conveniences) so the offline tools (elev_tile_pyramid,
+    vector_dice) can write the same frames without linking the lib.
+ */
+namespace WhirlyKit
+{
+
+/// The codecs a frame can name.  Zstd is a registration slot; we don't
+///  ship the library, but if you link it you can plug it in with
+///  RegisterDataCodec and the frames round trip like any other.
+typedef enum {DataCodecNone=0,DataCodecZlib=1,DataCodecLZ4=2,DataCodecZstd=3,DataCodecMax} DataCodecType;
+
+/// Frame header: 'W','G','C','D', one byte of codec, four bytes of raw size
+static const size_t CodecFrameHeaderSize = 9;
+
+/// Worst case output size for the LZ4 block compressor
+inline size_t LZ4CompressBound(size_t srcLen)
+{
+    return srcLen + srcLen/255 + 16;
+}
+
+inline unsigned int LZ4Read32(const unsigned char *p)
+{
+    unsigned int val;
+    memcpy(&val,p,4);
+    return val;
+}
+
+/** Decode one LZ4 block.  The caller knows the decompressed size (it's
+    in the frame header) and hands in a buffer exactly that big.
+    Returns false if the stream is malformed or doesn't fill the buffer.
+ */
+inline bool LZ4DecompressBlock(const unsigned char *src,size_t srcLen,unsigned char *dst,size_t dstLen)
+{
+    const unsigned char *ip = src, *iend = src+srcLen;
+    unsigned char *op = dst, *oend = dst+dstLen;
+
+    while (ip < iend)
+    {
+        unsigned int token = *ip++;
+
+        // Literals
+        size_t litLen = token >> 4;
+        if (litLen == 15)
+        {
+            unsigned int more;
+            do {
+                if (ip >= iend)
+                    return false;
+                more = *ip++;
+                litLen += more;
+            } while (more == 255);
+        }
+        if (ip+litLen > iend || op+litLen > oend)
+            return false;
+        memcpy(op,ip,litLen);
+        op += litLen;  ip += litLen;
+
+        // The last sequence is literals only
+        if (ip >= iend)
+            break;
+
+        // Match offset and length
+        if (ip+2 > iend)
+            return false;
+        size_t offset = ip[0] | (ip[1]<<8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op-dst))
+            return false;
+        size_t matchLen = token & 15;
+        if (matchLen == 15)
+        {
+            unsigned int more;
+            do {
+                if (ip >= iend)
+                    return false;
+                more = *ip++;
+                matchLen += more;
+            } while (more == 255);
+        }
+        matchLen += 4;
+        if (op+matchLen > oend)
+            return false;
+
+        // Matches overlap themselves (that's how runs work), so byte by byte
+        const unsigned char *match = op-offset;
+        for (size_t ii=0;ii<matchLen;ii++)
+            op[ii] = match[ii];
+        op += matchLen;
+    }
+
+    return op == oend;
+}
+
+/** Encode one LZ4 block.  Greedy matcher over a small hash table; not
+    as tight as the reference implementation but the output is spec
+    conformant and the decode side doesn't care who wrote it.
+    dst needs LZ4CompressBound(srcLen) bytes.  Returns the compressed
+    size, or 0 if the destination was too small.
+ */
+inline size_t LZ4CompressBlock(const unsigned char *src,size_t srcLen,unsigned char *dst,size_t dstCap)
+{
+    if (dstCap < LZ4CompressBound(srcLen))
+        return 0;
+
+    const int HashBits = 14;
+    std::vector<int> hashTab(1<<HashBits,-1);
+
+    const unsigned char *ip = src, *iend = src+srcLen;
+    const unsigned char *anchor = src;
+    unsigned char *op = dst;
+
+    // The format wants the last match to start 12+ bytes from the end
+    if (srcLen > 12)
+    {
+        const unsigned char *mflimit = iend-12;
+        while (ip < mflimit)
+        {
+            unsigned int seq = LZ4Read32(ip);
+            int hash = (int)((seq * 2654435761U) >> (32-HashBits));
+            const unsigned char *match = (hashTab[hash] >= 0 ? src+hashTab[hash] : NULL);
+            hashTab[hash] = (int)(ip-src);
+            if (!match || ip-match > 0xFFFF || LZ4Read32(match) != seq)
+            {
+                ip++;
+                continue;
+            }
+
+            // Extend the match.  The last 5 bytes always go out as literals
+            size_t matchLen = 4;
+            const unsigned char *mlimit = iend-5;
+            while (ip+matchLen < mlimit && ip[matchLen] == match[matchLen])
+                matchLen++;
+
+            // Literal run up to the match
+            size_t litLen = ip-anchor;
+            unsigned char *token = op++;
+            if (litLen >= 15)
+            {
+                *token = 15<<4;
+                size_t rem = litLen-15;
+                while (rem >= 255) { *op++ = 255;  rem -= 255; }
+                *op++ = (unsigned char)rem;
+            } else
+                *token = (unsigned char)(litLen<<4);
+            memcpy(op,anchor,litLen);
+            op += litLen;
+
+            // Offset, then the match length past the implied 4
+            size_t offset = ip-match;
+            *op++ = (unsigned char)(offset & 0xFF);
+            *op++ = (unsigned char)(offset >> 8);
+            size_t matchRem = matchLen-4;
+            if (matchRem >= 15)
+            {
+                *token |= 15;
+                matchRem -= 15;
+                while (matchRem >= 255) { *op++ = 255;  matchRem -= 255; }
+                *op++ = (unsigned char)matchRem;
+            } else
+                *token |= (unsigned char)matchRem;
+
+            ip += matchLen;
+            anchor = ip;
+        }
+    }
+
+    // Whatever's left goes out as literals
+    size_t litLen = iend-anchor;
+    unsigned char *token = op++;
+    if (litLen >= 15)
+    {
+        *token = 15<<4;
+        size_t rem = litLen-15;
+        while (rem >= 255) { *op++ = 255;  rem -= 255; }
+        *op++ = (unsigned char)rem;
+    } else
+        *token = (unsigned char)(litLen<<4);
+    memcpy(op,anchor,litLen);
+    op += litLen;
+
+    return op-dst;
+}
+
+/// Hooks for codecs we don't implement ourselves (e.g. zstd)
+typedef bool (*DataCodecCompressFunc)(const void *src,size_t srcLen,std::vector<unsigned char> &out);
+typedef bool (*DataCodecDecompressFunc)(const void *src,size_t srcLen,size_t rawSize,std::vector<unsigned char> &out);
+
+struct DataCodecHooks
+{
+    DataCodecCompressFunc compress;
+    DataCodecDecompressFunc decompress;
+};
+
+/// The registration table.  Function local so the header stays header only
+inline DataCodecHooks *DataCodecHookTable()
+{
+    static DataCodecHooks hooks[DataCodecMax];
+    return hooks;
+}
+
+/// Plug in an external codec (zstd, typically).  Frames naming that
+///  codec then compress and decompress through the given functions.
+inline void RegisterDataCodec(DataCodecType codec,DataCodecCompressFunc compress,DataCodecDecompressFunc decompress)
+{
+    if (codec < 0 || codec >= DataCodecMax)
+        return;
+    DataCodecHookTable()[codec].compress = compress;
+    DataCodecHookTable()[codec].decompress = decompress;
+}
+
+/// True if the given blob starts with our codec frame header
+inline bool IsCodecFramed(const void *data,size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    return len >= CodecFrameHeaderSize &&
+        bytes[0] == 'W' && bytes[1] == 'G' && bytes[2] == 'C' && bytes[3] == 'D';
+}
+
+/// Compress a buffer into a self describing frame.
+/// Returns false if the codec failed or isn't registered.
+inline bool CodecCompressBuffer(const void *src,size_t srcLen,DataCodecType codec,std::vector<unsigned char> &out)
+{
+    out.resize(CodecFrameHeaderSize);
+    out[0] = 'W';  out[1] = 'G';  out[2] = 'C';  out[3] = 'D';
+    out[4] = (unsigned char)codec;
+    unsigned int rawSize = (unsigned int)srcLen;
+    memcpy(&out[5],&rawSize,4);
+
+    switch (codec)
+    {
+        case DataCodecNone:
+            out.insert(out.end(),(const unsigned char *)src,(const unsigned char *)src+srcLen);
+            break;
+        case DataCodecZlib:
+        {
+            uLongf destLen = compressBound(srcLen);
+            out.resize(CodecFrameHeaderSize+destLen);
+            if (compress2(&out[CodecFrameHeaderSize],&destLen,(const Bytef *)src,srcLen,Z_DEFAULT_COMPRESSION) != Z_OK)
+                return false;
+            out.resize(CodecFrameHeaderSize+destLen);
+        }
+            break;
+        case DataCodecLZ4:
+        {
+            out.resize(CodecFrameHeaderSize+LZ4CompressBound(srcLen));
+            size_t compLen = LZ4CompressBlock((const unsigned char *)src,srcLen,&out[CodecFrameHeaderSize],out.size()-CodecFrameHeaderSize);
+            if (compLen == 0)
+                return false;
+            out.resize(CodecFrameHeaderSize+compLen);
+        }
+            break;
+        default:
+        {
+            if (codec >= DataCodecMax || !DataCodecHookTable()[codec].compress)
+                return false;
+            std::vector<unsigned char> compData;
+            if (!DataCodecHookTable()[codec].compress(src,srcLen,compData))
+                return false;
+            out.insert(out.end(),compData.begin(),compData.end());
+        }
+            break;
+    }
+
+    return true;
+}
+
+/// Decompress a frame written by CodecCompressBuffer.
+/// Returns false for anything that isn't one of our frames.
+inline bool CodecDecompressBuffer(const void *data,size_t len,std::vector<unsigned char> &out)
+{
+    if (!IsCodecFramed(data,len))
+        return false;
+    const unsigned char *bytes = (const unsigned char *)data;
+    DataCodecType codec = (DataCodecType)bytes[4];
+    unsigned int rawSize;
+    memcpy(&rawSize,bytes+5,4);
+    const unsigned char *payload = bytes+CodecFrameHeaderSize;
+    size_t payloadLen = len-CodecFrameHeaderSize;
+
+    out.resize(rawSize);
+    if (rawSize == 0)
+    {
+        // The compressors emit a little framing even for an empty input
+        //  (an LZ4 literal token, zlib's header and trailer), so don't
+        //  demand an empty payload; a known codec is enough
+        switch (codec)
+        {
+            case DataCodecNone:
+                return payloadLen == 0;
+            case DataCodecZlib:
+            case DataCodecLZ4:
+                return true;
+            default:
+                return codec < DataCodecMax && DataCodecHookTable()[codec].decompress != NULL;
+        }
+    }
+
+    switch (codec)
+    {
+        case DataCodecNone:
+            if (payloadLen != rawSize)
+                return false;
+            memcpy(&out[0],payload,rawSize);
+            break;
+        case DataCodecZlib:
+        {
+            uLongf destLen = rawSize;
+            if (uncompress(&out[0],&destLen,payload,payloadLen) != Z_OK || destLen != rawSize)
+                return false;
+        }
+            break;
+        case DataCodecLZ4:
+            if (!LZ4DecompressBlock(payload,payloadLen,&out[0],rawSize))
+                return false;
+            break;
+        default:
+            if (codec >= DataCodecMax || !DataCodecHookTable()[codec].decompress)
+                return false;
+            if (!DataCodecHookTable()[codec].decompress(payload,payloadLen,rawSize,out))
+                return false;
+            break;
+    }
+
+    return true;
+}
+
+#ifdef __OBJC__
+/// NSData version of CodecCompressBuffer.  Returns nil on failure
+inline NSData *CodecCompress(NSData *data,DataCodecType codec)
+{
+    std::vector<unsigned char> out;
+    if (!CodecCompressBuffer([data bytes],[data length],codec,out))
+        return nil;
+    return [NSData dataWithBytes:&out[0] length:out.size()];
+}
+
+/// NSData version of CodecDecompressBuffer.  Returns nil for
+///  anything that isn't one of our frames
+inline NSData *CodecDecompress(NSData *data)
+{
+    std::vector<unsigned char> out;
+    if (!CodecDecompressBuffer([data bytes],[data length],out))
+        return nil;
+    if (out.empty())
+        return [NSData data];
+    return [NSData dataWithBytes:&out[0] length:out.size()];
+}
+#endif
+
+}
@@ -30,16 +30,29 @@ namespace WhirlyKit
 #define kToolkitDefaultTriangleNoLightingProgram "Default Triangle;lighting=no"
 /// Triangle shader, takes two textures, with lighting
 #define kToolkitDefaultTriangleMultiTex "Default Triangle;multitex=yes;lighting=yes"
+/// Same, but expands single channel (GL_ALPHA) textures to luminance
+#define kToolkitDefaultTriangleMultiTexSingleChannel "Default Triangle;multitex=yes;lighting=yes;single=yes"
+/// Triangle shader with per-instance position, color, and scale, with lighting
+#define kToolkitDefaultTriangleInstancedProgram "Default Triangle;instanced=yes;lighting=yes"
+/// Triangle shader that lights per fragment from a normal map in the second texture.
+/// This is what terrain with normal maps (buildNormalMaps) wants.
+#define kToolkitDefaultTriangleNormalMapProgram "Default Triangle;normalmap=yes;lighting=yes"
 /// Line (and point) shader with backface culling (for globe)
 #define kToolkitDefaultLineProgram "Default Line;backface=yes"
 /// Line (and point) shader without backface culling
 #define kToolkitDefaultLineNoBackfaceProgram "Default Line;backface=no"
 /// Billboard shader
 #define kToolkitDefaultBillboardProgram "Default Billboard"
+/// GPU evaluated particle shader
+#define kToolkitDefaultParticleProgram "Default Particle"
 /// Screen space shader
 #define kToolkitDefaultScreenSpaceProgram "Default Screenspace"
 /// Widened vector shader
 #define kToolkitDefaultWideVectorProgram "Default Wide Vector"
+/// Widened vector shader that does the join expansion on the GPU
+#define kToolkitDefaultWideVectorGPUProgram "Default Wide Vector GPU"
+/// Marker shader that flips animation frames on the GPU
+#define kToolkitDefaultMarkerAnimProgram "Default Marker Anim"
 
 /// Create the default shaders and register them in the appropriate places in the scene
 void SetupDefaultShaders(Scene *);
@@ -59,6 +59,8 @@ namespace WhirlyKit
 	
 class Scene;
     class OpenGLES2Program;
+    class OpenGLESUniform;
+    class OpenGLESAttribute;
 
 /// We'll only keep this many buffers or textures around for reuse
 #define WhirlyKitOpenGLMemCacheMax 32
@@ -71,28 +73,76 @@ class Scene;
 /// Used to manage OpenGL buffer IDs and such.
 /// They're expensive to create and delete, so we try to do it
 ///  outside the renderer.
+/// What a piece of tracked GPU memory is being used for.
+/// Used to break the census down by subsystem.
+typedef enum {WKMemTexture,WKMemTexAtlas,WKMemDrawable,WKMemDrawAtlas,WKMemMax} WKGPUMemClass;
+
 class OpenGLMemManager
 {
 public:
     OpenGLMemManager();
     ~OpenGLMemManager();
-    
+
     /// Pick a buffer ID off the list or ask OpenGL for one
     GLuint getBufferID(unsigned int size=0,GLenum drawType=GL_STATIC_DRAW);
     /// Toss the given buffer ID back on the list for reuse
     void removeBufferID(GLuint bufID);
 
+    /// A region carved out of one of the big pool buffers
+    class SubAllocation
+    {
+    public:
+        SubAllocation() : bufID(0), offset(0), size(0) { }
+        GLuint bufID;
+        int offset;
+        int size;
+    };
+
+    /// Carve a small allocation out of one of the shared pool buffers.
+    /// Thousands of little per-feature drawables each owning a VBO is
+    ///  real GL object churn, so they share big static buffers instead.
+    /// Returns false if the request is too big for the pool.
+    bool subAllocBuffer(unsigned int size,SubAllocation &subAlloc);
+    /// Return a sub allocation to its pool.  Adjacent free blocks are
+    ///  merged, so the pools defragment as regions come back.
+    void subFreeBuffer(const SubAllocation &subAlloc);
+
     /// Pick a texture ID off the list or ask OpenGL for one
     GLuint getTexID();
     /// Toss the given texture ID back on the list for reuse
     void removeTexID(GLuint texID);
-        
+
+    /// Hand a buffer back with its storage intact.  A later request for
+    ///  the same size and usage gets it without reallocating the store.
+    void recycleBufferID(GLuint bufID,unsigned int size,GLenum drawType);
+    /// Hand a texture back with its storage intact
+    void recycleTexID(GLuint texID,unsigned int width,unsigned int height,GLenum format);
+    /// Pick a texture with matching storage off the recycle list.
+    /// Returns 0 if there isn't one; fall back on getTexID() then.
+    GLuint getRecycledTexID(unsigned int width,unsigned int height,GLenum format);
+    /// The renderer calls this once a frame.  Recycled objects that sit
+    ///  unclaimed past the TTL get deleted for real.
+    void updateFrame();
+
+
     /// Clear out any and all buffer IDs that we may have sitting around
     void clearBufferIDs();
     
     /// Clear out any and all texture IDs that we have sitting around
     void clearTextureIDs();
     
+    /// Objects that own GPU memory report their allocations here,
+    ///  by subsystem, so we can keep a running census
+    void addTrackedMem(WKGPUMemClass memClass,size_t bytes);
+    /// And report them gone here when they tear down
+    void subTrackedMem(WKGPUMemClass memClass,size_t bytes);
+    /// Fill in the per-subsystem byte counts and return the total
+    size_t getTrackedMem(size_t memByClass[WKMemMax]);
+    /// Set the GPU memory budget (0 for none, the default)
+    void setMemBudget(size_t bytes);
+    /// True if the tracked total has passed the budget
+    bool isOverBudget();
+
     /// Print out stats about what's in the cache
     void dumpStats();
         
@@ -107,6 +157,35 @@ protected:
 
     std::set<GLuint> buffIDs;
     std::set<GLuint> texIDs;
+
+    /// Free space tracking for one of the big sub allocation buffers
+    class PoolBuffer
+    {
+    public:
+        PoolBuffer() : bufID(0) { }
+        GLuint bufID;
+        /// Free blocks by offset -> size, so neighbors merge on free
+        std::map<int,int> freeBlocks;
+    };
+    std::vector<PoolBuffer> poolBuffers;
+
+    /// A GL object sitting on a recycle list with its storage intact
+    class RecycledResource
+    {
+    public:
+        GLuint glId;
+        // Frame it was recycled on, for the TTL
+        long long frame;
+    };
+    // Buffers classed by (size,usage), textures by ((width,height),format)
+    std::map<std::pair<unsigned int,GLenum>,std::vector<RecycledResource> > recycledBuffers;
+    std::map<std::pair<std::pair<unsigned int,unsigned int>,GLenum>,std::vector<RecycledResource> > recycledTextures;
+    long long frameCount;
+
+    /// Bytes of GPU memory reported to us, by subsystem
+    size_t trackedMem[WKMemMax];
+    /// GPU memory budget in bytes (0 means none)
+    size_t memBudget;
 };
 
 /// Mapping from Simple ID to an int
@@ -126,12 +205,36 @@ public:
 		
     /// Return true if this change requires a GL Flush in the thread it was executed in
     virtual bool needsFlush() { return false; }
-    
+
+    /// Number of bytes this change will push at the GPU, if any.
+    /// The scene uses this to spread texture uploads across frames.
+    virtual size_t uploadSize() { return 0; }
+
+    /// Scheduling classes for when a frame runs out of change budget.
+    /// Interactive toggles may still slip through, new content is the
+    ///  default, and deletions are happy to wait a frame.
+    typedef enum {PriorityInteractive=0,PriorityContent,PriorityDeletion} Priority;
+
+    /// Which scheduling class this change falls in
+    virtual int priority() { return PriorityContent; }
+
+    /// Identity of the one resource this change touches, if its CPU
+    ///  side work can safely run alongside changes to other resources.
+    /// EmptyIdentity means order or thread sensitive: run it serially.
+    virtual SimpleIdentity resourceTag() { return EmptyIdentity; }
+
     /// Fill this in to set up whatever resources we need on the GL side
     virtual void setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memManager) { };
-		
+
 	/// Make a change to the scene.  For the renderer.  Never call this.
 	virtual void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view) = 0;
+
+    /// If we know exactly which part of the screen this change will touch,
+    ///  fill in that region (framebuffer coordinates) and return true.
+    /// The renderer can then get away with a partial redraw in scissor
+    ///  damage mode.  Most changes can't know, so the default is false,
+    ///  which means assume the whole screen.  Called just before execute().
+    virtual bool getDamageRegion(Scene *scene,WhirlyKitSceneRendererES *renderer,Mbr &damageMbr) { return false; }
 };
     
 /// Representation of a list of changes.  Might get more complex in the future.
@@ -184,10 +287,18 @@ public:
 
     /// Check if we're supposed to write to the z buffer
     virtual bool getWriteZbuffer() const { return true; }
-    
+
+    /// Return the first texture we'll bind (if any).
+    /// The render state buckets use this to group drawables.
+    virtual SimpleIdentity getStateTexId() const { return EmptyIdentity; }
+
     /// Update anything associated with the renderer.  Probably renderUntil.
     virtual void updateRenderer(WhirlyKitSceneRendererES *renderer) = 0;
-    
+
+    /// Rough count of bytes retained on the CPU side, for the memory
+    ///  census.  Cheap beats exact here.
+    virtual size_t memorySize() const { return 0; }
+
 protected:
     std::string name;
 };
@@ -212,9 +323,27 @@ public:
 	/// This is called by execute if there's a drawable to modify.
     /// This is the one you override.
 	virtual void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw) = 0;
-	
+
+    /// The drawable we're aimed at.  The scene scheduler uses this to
+    ///  decide if an interactive change can jump an over-budget frame.
+    SimpleIdentity getDrawId() { return drawId; }
+
+    /// Changes to different drawables are independent of each other,
+    ///  so the scene can run their CPU side work in parallel
+    virtual SimpleIdentity resourceTag() { return drawId; }
+
+    /// The lookup and attribute work, without the shared state bucket
+    ///  update.  The scene runs batches of these on the pool and then
+    ///  calls finishExecute for each on the render thread.
+    void executeParallel(Scene *scene,WhirlyKitSceneRendererES *renderer);
+
+    /// The shared structure part of execute.  Render thread only.
+    void finishExecute(Scene *scene);
+
 protected:
 	SimpleIdentity drawId;
+    /// Carries the drawable from executeParallel to finishExecute
+    DrawableRef theDrawable;
 };
 
 /// Turn off visibility checking
@@ -228,10 +357,26 @@ static const unsigned int MaxDrawableTriangles = (MaxDrawablePoints / 3);
     
 class SubTexture;
 
-/// Data types we'll accept for attributes
-typedef enum {BDFloat3Type,BDChar4Type,BDFloat2Type,BDFloatType} BDAttributeDataType;
-    
-    
+/// Data types we'll accept for attributes.
+/// The half float and packed byte versions take the same floating point
+///  appends as their full size counterparts and convert on the way in.
+typedef enum {BDFloat3Type,BDChar4Type,BDFloat2Type,BDFloatType,BDHalf2Type,BDChar4nType} BDAttributeDataType;
+
+/// 2D value stored as 16 bit half floats
+class HalfVec2
+{
+public:
+    GLushort x,y;
+};
+
+/// Normal packed into four signed, normalized bytes (w unused)
+class PackedNormal
+{
+public:
+    signed char x,y,z,w;
+};
+
+
 /// Used to keep track of attributes (other than points)
 class VertexAttribute
 {
@@ -257,9 +402,11 @@ public:
     
     /// Convenience routine to add a color (if the type matches)
     void addColor(const RGBAColor &color);
-    /// Convenience routine to add a 2D vector (if the type matches)
+    /// Convenience routine to add a 2D vector (if the type matches).
+    /// For BDHalf2Type the vector is converted to half floats on the way in.
     void addVector2f(const Eigen::Vector2f &vec);
-    /// Convenience routine to add a 3D vector (if the type matches)
+    /// Convenience routine to add a 3D vector (if the type matches).
+    /// For BDChar4nType the vector is packed into signed bytes on the way in.
     void addVector3f(const Eigen::Vector3f &vec);
     /// Convenience routine to add a float (if the type matches)
     void addFloat(float val);
@@ -275,10 +422,26 @@ public:
     
     /// Clean out the data array
     void clear();
-    
+
+    /// Rebuild the data array, taking each new element from the given
+    ///  source index in the old one.  Used when reordering vertices.
+    void permute(const std::vector<unsigned int> &srcIndices);
+
     /// Return a pointer to the given element
     void *addressForElement(int which);
-    
+
+    /// Return a pointer to the start of the (contiguous) element array
+    const void *dataStart() const;
+
+    /// Copy every element into an interleaved buffer with the given
+    ///  stride in one strided pass.  Much faster than fetching the
+    ///  address of each element in turn.
+    void copyToBuffer(unsigned char *basePtr,int stride) const;
+
+    /// Bulk load raw elements of our data type.  The scene snapshot
+    ///  reader uses this to restore an attribute in one memcpy.
+    void appendRawData(const void *srcData,int numElems);
+
     /// Return the number of components as needed by glVertexAttribPointer
     GLuint glEntryComponents() const;
     
@@ -316,6 +479,7 @@ public:
 class BasicDrawable : public Drawable
 {
     friend class BigDrawableAtlas;
+    friend class BasicDrawableInstance;
 public:
     /// Construct empty
 	BasicDrawable(const std::string &name);
@@ -341,6 +505,9 @@ public:
 	
     /// Size of a single vertex used in creating an interleaved buffer.
     virtual GLuint singleVertexSize();
+
+    /// Bytes retained in the geometry arrays, for the memory census
+    virtual size_t memorySize() const;
         
     /// Called render-thread side to set up a VAO
     virtual void setupVAO(OpenGLES2Program *prog);
@@ -411,12 +578,22 @@ public:
     void setVisibleRange(float minVis,float maxVis,float minVisBand=0.0,float maxVisBand=0.0);
     /// Retrieve the visible range, just min and max
     void getVisibleRange(float &minVis,float &maxVis);
+
+    /// Drop the drawable entirely when it projects smaller than minPix
+    ///  pixels on screen.  The radius is in display coordinates.  There's
+    ///  a little hysteresis built in so it won't flicker at the cutoff.
+    void setScreenSpaceGate(float worldRadius,float minPix);
     
     /// Retrieve the visible range, including bands
     void getVisibleRange(float &minVis,float &maxVis,float &minVisBand,float &maxVisBand);
     /// Set the fade in and out
     void setFade(NSTimeInterval inFadeDown,NSTimeInterval inFadeUp);
-    
+
+    /// Set an absolute time range outside which we won't draw.
+    /// Both 0.0 (the default) turns the check off.  A fade out can
+    ///  expire this way without an enable change request per drawable.
+    void setEnableTimeRange(NSTimeInterval inStartEnable,NSTimeInterval inEndEnable);
+
     /// Set the line width (if using lines)
     void setLineWidth(float inWidth);
     
@@ -467,19 +644,34 @@ public:
     
     /// Add a triangle.  Should point to the vertex IDs.
 	void addTriangle(Triangle tri);
-    
+
+    /// Weld duplicate vertices and reorder the triangles for the
+    ///  post transform vertex cache (Forsyth style).  Call after the
+    ///  geometry is built, before the drawable goes to the scene.
+    ///  Only does anything for triangle drawables.
+    void optimizeTriangles();
+
+
     /// Return the texture ID
     SimpleIdentity getTexId(unsigned int which);
-    
+
+    /// First texture we'll bind, for render state bucketing
+    virtual SimpleIdentity getStateTexId() const;
+
     /// Texture ID and pointer to vertex attribute info
     class TexInfo
     {
     public:
-        TexInfo() : texId(EmptyIdentity), texCoordEntry(0) { }
+        TexInfo() : texId(EmptyIdentity), texCoordEntry(0), texScale(1.0,1.0), texOffset(0.0,0.0) { }
         /// Texture ID within the scene
         SimpleIdentity texId;
         /// Vertex attribute entry for this set of texture coordinates
         int texCoordEntry;
+        /// Transform applied to the texture coordinates in the shader
+        ///  (for shaders that support it).  Identity by default.  When
+        ///  an atlas relocates a region the drawable can follow it by
+        ///  changing this instead of rewriting vertex data.
+        Point2f texScale,texOffset;
     };
 
     /// Return the current texture info
@@ -488,6 +680,11 @@ public:
     /// Add a new vertex related attribute.  Need a data type and the name the shader refers to
     ///  it by.  The index returned is how you will access it.
     int addAttribute(BDAttributeDataType dataType,const std::string &name);
+
+    /// Switch texture coordinates to half floats and normals to packed bytes
+    ///  to cut the vertex fetch bandwidth in half.  Call this before adding
+    ///  any vertex data.  Adds go through the same calls and convert on append.
+    void setCompactVertexFormat();
     
     /// Return the number of points added so far
     unsigned int getNumPoints() const;
@@ -519,6 +716,12 @@ public:
     /// Run the texture and texture coordinates based on a SubTexture
     void applySubTexture(int which,SubTexture subTex,int startingAt=0);
 
+    /// Set the shader side texture coordinate transform for the given
+    ///  texture entry.  The vertex data keeps its original coordinates
+    ///  and the shader applies scale and offset, so moving a drawable
+    ///  within an atlas is a uniform write rather than a buffer rewrite.
+    void setTexTransform(unsigned int which,const Point2f &scale,const Point2f &offset);
+
     /// Update fade up/down times in renderer (i.e. keep the renderer rendering)
     virtual void updateRenderer(WhirlyKitSceneRendererES *renderer);
     
@@ -527,6 +730,15 @@ public:
     
     /// Copy vertex and element data into appropriate NSData objects
     void asVertexAndElementData(NSMutableData **retVertData,NSMutableData **retElementData,int singleElementSize,const Point3d *center);
+
+    /// Append our CPU side state to a scene snapshot record.  Only
+    ///  valid before setupGL(), which strips the vertex arrays.
+    bool snapshotWrite(NSMutableData *data) const;
+
+    /// Rebuild this drawable from a record written by snapshotWrite().
+    /// Texture IDs come back as they were written; the snapshot reader
+    ///  remaps them afterward.
+    bool snapshotRead(const unsigned char *&ptr,const unsigned char *end);
     
     /// Assuming this is a set of triangles, convert to a triangle strip
     void convertToTriStrip();
@@ -539,6 +751,18 @@ protected:
     virtual void setupTexCoordEntry(int which,int numReserve);
     /// Draw routine for OpenGL 2.0
     virtual void drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+    /// Resolve the program's attribute and uniform slots once per program,
+    /// so the draw loop isn't doing name lookups per call
+    void resolveSlots(OpenGLES2Program *prog);
+    /// Work out the fade for this frame
+    float calcFade(WhirlyKitRendererFrameInfo *frameInfo);
+    /// Bind the program's and the drawable's textures, filling in which
+    /// slots got used so the caller can unbind them after the draw
+    void bindDrawTextures(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene,OpenGLES2Program *prog,bool *hasTexture);
+    /// Decide which draw path we can take, once the data's in GL
+    void chooseDrawVariant();
+    /// The general draw path, when the straight line VBO variant doesn't apply
+    void drawGeneralOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene,OpenGLES2Program *prog);
     /// Add a single point to the GL Buffer.
     /// Override this to add your own data to interleaved vertex buffers.
     virtual void addPointToBuffer(unsigned char *basePtr,int which,const Point3d *center);
@@ -562,6 +786,7 @@ protected:
     SimpleIdentity programId;    // Program to use for rendering
     bool usingBuffers;  // If set, we've downloaded the buffers already
     NSTimeInterval fadeUp,fadeDown;  // Controls fade in and fade out
+    NSTimeInterval startEnable,endEnable;  // Absolute time range we'll draw in.  Both 0s means always
 	unsigned int drawPriority;  // Used to sort drawables
 	float drawOffset;    // Number of units of Z buffer resolution to offset upward (by the normal)
     bool isAlpha;  // Set if we want to be drawn last
@@ -571,6 +796,10 @@ protected:
 	RGBAColor color;
     float minVisible,maxVisible;
     float minVisibleFadeBand,maxVisibleFadeBand;
+    // Screen space size gate.  Zero radius means no gating
+    float gateWorldRadius,gateMinPix;
+    // Whether the gate let us through last frame, for hysteresis
+    mutable bool gateWasOn;
     float lineWidth;
     // For zBufferOffDefault mode we'll sort this to the end
     bool requestZBuffer;
@@ -589,8 +818,37 @@ protected:
     int vertexSize;
 	GLuint pointBuffer,triBuffer,sharedBuffer;
     GLuint vertArrayObj;
+    // Attribute and uniform slots resolved against a particular program.
+    // Only valid while progId matches the program we're drawing with.
+    class ResolvedSlots
+    {
+    public:
+        ResolvedSlots() : progId(EmptyIdentity), vertAttr(NULL) { }
+        SimpleIdentity progId;
+        const OpenGLESAttribute *vertAttr;
+        // Parallel to vertexAttributes
+        std::vector<const OpenGLESAttribute *> progAttrs;
+        OpenGLESUniform *baseMapUni[WhirlyKitMaxTextures];
+        OpenGLESUniform *texScaleUni[WhirlyKitMaxTextures];
+        OpenGLESUniform *texOffsetUni[WhirlyKitMaxTextures];
+        OpenGLESUniform *mvpMatUni,*mvMatUni,*mvNormalMatUni,*pMatUni;
+        OpenGLESUniform *fadeUni,*hasTextureUni,*eyeVecUni;
+    };
+    ResolvedSlots slots;
+    // Which path drawOGL2 takes, decided when the data lands in GL.
+    // The VBO variant is straight line code: everything's in the shared
+    //  interleaved buffer and drawing is defaults, the VAO, and the call.
+    typedef enum {DrawVariantGeneral,DrawVariantVBO} DrawVariant;
+    DrawVariant drawVariant;
+    // Attributes with no data of their own, which just set program defaults
+    std::vector<int> defaultAttrs;
     GLuint sharedBufferOffset;
     bool sharedBufferIsExternal;
+    // Set if our region came out of the memory manager's pool
+    bool sharedBufferIsPooled;
+    // Bytes in the shared buffer if we own it, for recycling on teardown
+    int sharedBufferSize;
+    OpenGLMemManager::SubAllocation poolAlloc;
 };
     
 /// Reference counted version of BasicDrawable
@@ -601,9 +859,11 @@ class ColorChangeRequest : public DrawableChangeRequest
 {
 public:
 	ColorChangeRequest(SimpleIdentity drawId,RGBAColor color);
-	
+
 	void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw);
-	
+
+    int priority() { return PriorityInteractive; }
+
 protected:
 	unsigned char color[4];
 };
@@ -613,9 +873,11 @@ class OnOffChangeRequest : public DrawableChangeRequest
 {
 public:
 	OnOffChangeRequest(SimpleIdentity drawId,bool OnOff);
-	
+
 	void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw);
-	
+
+    int priority() { return PriorityInteractive; }
+
 protected:
 	bool newOnOff;
 };	
@@ -625,9 +887,11 @@ class VisibilityChangeRequest : public DrawableChangeRequest
 {
 public:
     VisibilityChangeRequest(SimpleIdentity drawId,float minVis,float maxVis);
-    
+
     void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw);
-    
+
+    int priority() { return PriorityInteractive; }
+
 protected:
     float minVis,maxVis;
 };
@@ -637,13 +901,52 @@ class FadeChangeRequest : public DrawableChangeRequest
 {
 public:
     FadeChangeRequest(SimpleIdentity drawId,NSTimeInterval fadeUp,NSTimeInterval fadeDown);
-    
+
     void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw);
-    
+
+    int priority() { return PriorityInteractive; }
+
+    /// Pokes the renderer as well as the drawable, so keep it serial
+    virtual SimpleIdentity resourceTag() { return EmptyIdentity; }
+
 protected:
     NSTimeInterval fadeUp,fadeDown;
 };
-    
+
+/** Change the fades on a whole set of drawables at once.  Mass fade outs
+    go through here so they cost one change request rather than one per
+    drawable.  A fade out also sets the drawables' enable windows, so they
+    expire on their own without follow up enable requests.
+  */
+class FadeGangChangeRequest : public ChangeRequest
+{
+public:
+    FadeGangChangeRequest(const SimpleIDSet &drawIDs,NSTimeInterval fadeUp,NSTimeInterval fadeDown);
+
+    void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+protected:
+    std::vector<SimpleIdentity> drawIDs;
+    NSTimeInterval fadeUp,fadeDown;
+};
+
+/** Change the shader side texture coordinate transform on a drawable.
+    This is how a drawable follows its region when an atlas moves
+    things around: one small change request instead of a geometry
+    rewrite per drawable.
+  */
+class DrawTexTransformChangeRequest : public DrawableChangeRequest
+{
+public:
+    DrawTexTransformChangeRequest(SimpleIdentity drawId,unsigned int which,const Point2f &scale,const Point2f &offset);
+
+    void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw);
+
+protected:
+    unsigned int which;
+    Point2f scale,offset;
+};
+
 /// Change the texture used by a drawable
 class DrawTexChangeRequest : public DrawableChangeRequest
 {
@@ -708,6 +1011,9 @@ protected:
 /** A Basic Drawable Instance replicates a basic drawable while
     tweaking some of the fields.  This is good for using the same
     geometry to implement vectors of multiple colors and line widths.
+    It can also replicate the master geometry many times over, with
+    a position, color, and scale per replica.  With lots of those
+    we'll use instanced rendering if the hardware supports it.
   */
 class BasicDrawableInstance : public Drawable
 {
@@ -715,6 +1021,21 @@ public:
     /// Construct emtpy
     BasicDrawableInstance(const std::string &name,SimpleIdentity masterID);
 
+    /// A single replica of the master geometry.  The managers fill
+    ///  these in when a lot of features share the same mesh.
+    class SingleInstance
+    {
+    public:
+        SingleInstance() : center(0,0,0), colorOverride(false), scale(1.0) { }
+        /// Where the instance goes in display coordinates
+        Point3d center;
+        /// Set if this instance has its own color
+        bool colorOverride;
+        RGBAColor color;
+        /// Uniform scale applied around the center
+        double scale;
+    };
+
     /// Return the local MBR, if we're working in a non-geo coordinate system
     virtual Mbr getLocalMbr() const;
 	
@@ -723,7 +1044,11 @@ public:
     
     /// For OpenGLES2, this is the program to use to render this drawable.
     virtual SimpleIdentity getProgram() const;
-	
+
+    /// For OpenGLES2, set the program to render with.  The instanced
+    ///  path wants a shader that declares the per-instance attributes.
+    void setProgram(SimpleIdentity progId) { programId = progId; }
+
 	/// We're allowed to turn drawables off completely
 	virtual bool isOn(WhirlyKitRendererFrameInfo *frameInfo) const;
     
@@ -733,9 +1058,13 @@ public:
     /// Return true if the drawable has alpha.  These will be sorted last.
     virtual bool hasAlpha(WhirlyKitRendererFrameInfo *frameInfo) const;
 
+    /// Defer to the master for z buffer behavior
+    virtual bool getRequestZBuffer() const { return basicDraw->getRequestZBuffer(); }
+    virtual bool getWriteZbuffer() const { return basicDraw->getWriteZbuffer(); }
+
     /// Update anything associated with the renderer.  Probably renderUntil.
     virtual void updateRenderer(WhirlyKitSceneRendererES *renderer);
-    
+
     /// Fill this in to draw the basic drawable
 	virtual void draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
     
@@ -759,13 +1088,35 @@ public:
     
     /// Set the drawable we're instancing
     void setMaster(BasicDrawableRef draw) { basicDraw = draw; }
-    
+
     /// Return the translation matrix if there is one
     const Eigen::Matrix4d *getMatrix() const;
-    
+
+    /// Add replicas of the master geometry.  Once these are present
+    ///  we draw them instead of the single tweaked master.
+    void addInstances(const std::vector<SingleInstance> &insts);
+
+    /// Create the per-instance vertex buffer, if we have instances
+    virtual void setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memManager);
+
+    /// Get rid of the per-instance vertex buffer
+    virtual void teardownGL(OpenGLMemManager *memManager);
+
 protected:
+    /// Set up a VAO combining the master's vertex data with our per-instance attributes
+    void setupInstanceVAO(OpenGLES2Program *prog);
+    /// Draw all the instances in one call (EXT_draw_instanced path)
+    void drawInstanced(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+    /// Draw the instances one at a time through the master (fallback path)
+    void drawInstancesByHand(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+
     SimpleIdentity masterID;
     BasicDrawableRef basicDraw;
+    SimpleIdentity programId;
+    std::vector<SingleInstance> instances;
+    GLuint instBuffer;
+    GLuint vertArrayObj;
+    int numInstances;
     bool enable;
     bool hasDrawPriority;
     int drawPriority;
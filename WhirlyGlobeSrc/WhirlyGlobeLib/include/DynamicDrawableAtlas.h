@@ -69,6 +69,18 @@ public:
     /// Return the list of current drawables by ID
     void getDrawableIDs(SimpleIDSet &drawIDs);
         
+    /// Incrementally compact the big drawables.  Moves up to maxBytes of
+    ///  region data down into lower free space, so free areas coalesce
+    ///  into blocks big enough for new tiles and we stop growing new big
+    ///  drawables under churn.  Call once per flush from the layer
+    ///  thread; the moves take effect with the next swap.
+    /// Returns the number of bytes actually moved.
+    int compact(int maxBytes);
+
+    /// Fragmentation report across the big drawables: total free vertex
+    ///  bytes, the largest single free block and the free region count.
+    void getUsage(int &totalFree,int &largestFree,int &numRegions);
+
     /// Check if there are any active updates in any of the drawable buffers
     bool hasUpdates();
     
@@ -36,13 +36,19 @@ namespace WhirlyKit
 class DynamicTexture : public TextureBase
 {
 public:
+    /// How space in the texture is handed out.  The cell grid is simple
+    ///  and cheap to free, shelf packing wastes far less area for mixed
+    ///  size content like glyphs next to icons.
+    typedef enum {GridPacking,ShelfPacking} PackingMode;
+
     /// Constructor for sorting
-    DynamicTexture(SimpleIdentity myId) : TextureBase(myId), layoutGrid(NULL) { }
+    DynamicTexture(SimpleIdentity myId) : TextureBase(myId), layoutGrid(NULL), packing(GridPacking), shelfTop(0), usedTexels(0), valid(false), trackedMemSize(0), usesMipmaps(false), mipDirty(false) { }
     /// Construct with a name, square texture size, cell size (in texels), and the memory format
-    DynamicTexture(const std::string &name,int texSize,int cellSize,GLenum format);
+    DynamicTexture(const std::string &name,int texSize,int cellSize,GLenum format,PackingMode packing=GridPacking);
     ~DynamicTexture();
-    
-    /// Represents a region in the texture
+
+    /// Represents a region in the texture.  Measured in cells for
+    ///  grid packing, texels for shelf packing.
     class Region
     {
     public:
@@ -61,12 +67,22 @@ public:
     
     /// Add the data at a given location in the texture
     void addTextureData(int startX,int startY,int width,int height,NSData *data);
-    
+
+    /// Set this (before createInGL) to keep a mipmap chain.
+    /// Deep levels blend across neighboring regions; the border texels
+    ///  tiles carry cover the levels that matter during zoom-out.
+    void setUsesMipmaps(bool use) { usesMipmaps = use; }
+
+    /// Render side only.  Rebuild the mip chain if regions came in
+    ///  since the last time.  Cheap no-op otherwise.
+    void generateMipmaps();
+
     /// Set or clear a given region
     void setRegion(const Region &region,bool enable);
     
-    /// Look for an open region of the given cell extents
-    bool findRegion(int cellsX,int cellsY,Region &region);
+    /// Look for an open region of the given extents.
+    /// In cells for grid packing, texels for shelf packing.
+    bool findRegion(int sizeX,int sizeY,Region &region);
     
     /// Add a region to the list of ones to be cleared.
     /// This is called by the renderer
@@ -78,13 +94,36 @@ public:
     /// Number of sub textures we're currently representing
     int &getNumRegions() { return numRegions; }
     
-    /// Return texture cell utilization
-    void getUtilization(int &numCell,int &usedCell);
-    
+    /// Return total and used texel counts for an occupancy report
+    void getUtilization(int &totalTexels,int &usedTexels);
+
 protected:
+    /// A free span along a shelf (shelf packing only)
+    class Span
+    {
+    public:
+        Span(int x,int width) : x(x), width(width) { }
+        int x,width;
+    };
+    /// A fixed height row of the texture (shelf packing only)
+    class Shelf
+    {
+    public:
+        Shelf(int y,int height) : y(y), height(height) { }
+        int y,height;
+        /// Free spans along the shelf, sorted by x
+        std::vector<Span> spans;
+    };
+
+    // The two region search strategies
+    bool findGridRegion(int cellsX,int cellsY,Region &region);
+    bool findShelfRegion(int width,int height,Region &region);
+    void setGridRegion(const Region &region,bool enable);
+    void setShelfRegion(const Region &region,bool enable);
+
     /// Used for debugging
     std::string name;
-    
+
     /// If set, this is a compressed format (assume PVRTC4)
     bool compressed;
     /// Texture memory format
@@ -98,7 +137,24 @@ protected:
     
     // Use to track where sub textures are
     bool *layoutGrid;
-    
+
+    /// Packing strategy we're using
+    PackingMode packing;
+    /// Shelves in use (shelf packing)
+    std::vector<Shelf> shelves;
+    /// First row not yet given to a shelf
+    int shelfTop;
+    /// Texels currently covered by active regions
+    int usedTexels;
+    /// Set once the full constructor has run
+    bool valid;
+    /// Bytes we reported to the memory census at creation
+    size_t trackedMemSize;
+    /// If set, we keep a mipmap chain for minification
+    bool usesMipmaps;
+    /// Regions have come in since the chain was last rebuilt
+    bool mipDirty;
+
     pthread_mutex_t regionLock;
     /// These regions have been released by the renderer
     std::vector<Region> releasedRegions;
@@ -124,13 +180,31 @@ public:
 
     /// Add the region.  Never call this.
 	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
-    
+
+    /// Size of the region we'll copy in, for the frame upload budget
+    virtual size_t uploadSize() { return data ? [data length] : 0; }
+
 protected:
     SimpleIdentity texId;
     int startX,startY,width,height;
     NSData *data;
 };
     
+/// Rebuild a dynamic texture's mip chain if it's out of date.
+/// The tile loader batches one of these per atlas texture per flush,
+///  rather than regenerating after every region add.
+class DynamicTextureGenMipsRequest : public ChangeRequest
+{
+public:
+    DynamicTextureGenMipsRequest(SimpleIdentity texId) : texId(texId) { }
+
+    /// Regenerate the mip chain.  Never call this.
+	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+protected:
+    SimpleIdentity texId;
+};
+
 /// Tell a dynamic texture that a region has been released for use
 class DynamicTextureClearRegion : public ChangeRequest
 {
@@ -154,10 +228,27 @@ protected:
 class DynamicTextureAtlas
 {
 public:
-    /// Construct with the square size of the textures, the cell size (in pixels) and the pixel format
-    DynamicTextureAtlas(int texSize,int cellSize,GLenum format,int imageDepth=1);
+    /// Construct with the square size of the textures, the cell size (in pixels) and the pixel format.
+    /// Shelf packing ignores the cell grid and packs rows at texel granularity.
+    DynamicTextureAtlas(int texSize,int cellSize,GLenum format,int imageDepth=1,DynamicTexture::PackingMode packing=DynamicTexture::GridPacking,bool usesMipmaps=false);
     ~DynamicTextureAtlas();
 
+    /// Occupancy report for the atlas
+    class Utilization
+    {
+    public:
+        Utilization() : numTextures(0), bytesAllocated(0), bytesUsed(0) { }
+        /// Number of textures we're holding, counting image depth
+        int numTextures;
+        /// Total texture memory allocated
+        size_t bytesAllocated;
+        /// Portion covered by active regions
+        size_t bytesUsed;
+    };
+
+    /// Fill in an occupancy report covering all our textures
+    void getUtilization(Utilization &util);
+
     /// Try to add the texture to one of our dynamic textures, or create one.
     bool addTexture(const std::vector<Texture *> &textures,Point2f *realSize,Point2f *realOffset,SubTexture &subTex,OpenGLMemManager *memManager,ChangeSet &changes,int borderPixels,int bufferPixels=0);
     
@@ -170,6 +261,10 @@ public:
     /// Look for any textures that should be cleaned up
     void cleanup(ChangeSet &changes);
 
+    /// Queue up mip chain rebuilds for any textures that took new
+    ///  regions since the last call.  Call once per flush, not per add.
+    void regenMipmaps(ChangeSet &changes);
+
     /// Clear out the active dynamic textures.  Caller deals with the
     ///  change requests.
     void shutdown(ChangeSet &changes);
@@ -189,11 +284,18 @@ protected:
         DynamicTexture::Region region;
     };
 
+    // Bytes per texel for our format
+    int texelBytes();
+
     int imageDepth;
     int texSize;
     int cellSize;
     GLenum format;
-    
+    DynamicTexture::PackingMode packing;
+    bool usesMipmaps;
+    /// Regions have been added since the last regenMipmaps()
+    bool mipsDirty;
+
     typedef std::set<TextureRegion> TextureRegionSet;
     TextureRegionSet regions;
     typedef std::set<DynamicTextureVec *,DynamicTextureVecSorter> DynamicTextureSet;
@@ -21,13 +21,18 @@
 #import <UIKit/UIKit.h>
 
 #import "SceneRendererES.h"
+#import "WhirlyKitView.h"
+
+// Posted when the adaptive pacing moves to a new rate.  The userInfo
+//  carries the interval under @"frameInterval".
+#define kWKFrameIntervalChanged @"WKFrameIntervalChanged"
 
 /** OpenGL View is a
 	base class for implementing an open GL rendering view.
 	This is modeled off of the example.  We subclass this for
     our own purposes.
  */
-@interface WhirlyKitEAGLView  : UIView 
+@interface WhirlyKitEAGLView  : UIView <WhirlyKitViewWatcherDelegate>
 
 /// We're only expecting this to be set once
 @property (nonatomic,weak) WhirlyKitSceneRendererES *renderer;
@@ -42,6 +47,30 @@
 ///  display link will be less aggressive.  This works well with UIScrollView.
 @property (nonatomic) bool reactiveMode;
 
+/// If set, the display link goes to sleep when nothing in the scene
+///  needs drawing.  View changes, animations and incoming change
+///  requests wake it back up within a frame.  Good for kiosks and
+///  mostly static maps.
+@property (nonatomic) bool renderOnDemand;
+
+/// If set, we watch recent frame cost and step the display link down
+///  to a steady divisor rate (30, 20, 15) when frames run long, which
+///  reads better than oscillating around 60.  We step back up once
+///  frames have been comfortably cheap for a while.  frameInterval
+///  acts as the fastest rate we'll return to.
+@property (nonatomic) bool adaptiveFrameRate;
+
+/// The frame interval we're actually running, in units of
+///  60/frameRate.  Matches frameInterval unless adaptiveFrameRate has
+///  stepped things down.  kWKFrameIntervalChanged posts when it moves.
+@property (nonatomic,readonly) NSInteger currentFrameInterval;
+
+/// If set, the layer hangs on to its backbuffer between frames.
+/// The renderer's scissor damage mode needs this.  Set it before
+///  the view goes on screen, since it only takes effect when the
+///  render buffers are allocated.
+@property (nonatomic) BOOL retainedBacking;
+
 /// Start animating.  Typically right before we're displayed
 - (void) startAnimation;
 /// Stop animating.  It can be restarted or destroyed after this.
@@ -50,4 +79,7 @@
 /// Draw into the actual view
 - (void) drawView:(id)sender;
 
+/// Wake a sleeping display link.  Safe to call from the main thread any time.
+- (void) wakeRendering;
+
 @end
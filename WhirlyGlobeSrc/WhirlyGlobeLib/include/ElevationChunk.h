@@ -21,6 +21,7 @@
 #import <math.h>
 #import "WhirlyVector.h"
 #import "GlobeMath.h"
+#import "Texture.h"
 
 @interface WhirlyKitElevationChunk : NSObject
 
@@ -46,4 +47,16 @@
 /// Interpolate an elevation at the given location
 - (float)interpolateElevationAtX:(float)x y:(float)y;
 
+/// Fingerprint of the samples, computed once on first use.  The tile
+///  builder folds this into its mesh cache keys.
+- (long long)dataHash;
+
+/** Build a normal map texture from the height field.
+    Normals come from a Sobel over the heights and are in tangent space
+    (x east, y north, z up), packed into RGBA bytes, one texel per
+    sample.  Pass in the size of a cell in meters so the slopes scale
+    right.  The caller owns the texture.  Returns NULL if there's no data.
+  */
+- (WhirlyKit::Texture *)buildNormalMapTexture:(float)cellSizeX cellSizeY:(float)cellSizeY;
+
 @end
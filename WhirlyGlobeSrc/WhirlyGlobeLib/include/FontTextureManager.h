@@ -70,7 +70,8 @@ public:
 - (id)initWithScene:(WhirlyKit::Scene *)scene;
 
 /// Add the given string.  Caller is responsible for deleting
-///  the DrawableString
+///  the DrawableString.  Shaped results are cached, so repeated
+///  strings skip the CoreText layout entirely.
 - (WhirlyKit::DrawableString *)addString:(NSAttributedString *)str changes:(std::vector<WhirlyKit::ChangeRequest *> &)changes;
 
 /// Remove resources associated with the given string
@@ -0,0 +1,49 @@
+/*
+ *  GlobeAnimatePath.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <UIKit/UIKit.h>
+#import "WhirlyVector.h"
+#import "WhirlyGeometry.h"
+#import "GlobeView.h"
+
+/** Animate the globe view along a great circle with a height profile.
+    We precompute a table of samples along the path up front, so the
+    per frame update is a table lookup and a short interpolation rather
+    than a full slerp and height curve evaluation on the main thread.
+    The path can also be sampled directly, for things like predicting
+    where the viewer is headed.
+ */
+@interface WhirlyGlobeAnimateViewPath : NSObject<WhirlyGlobeAnimationDelegate>
+
+/// When to start the animation.  Can be in the past
+@property (nonatomic,assign) NSTimeInterval startDate;
+/// When to finish the animation.
+@property (nonatomic,assign) NSTimeInterval endDate;
+
+/// Fly to the given position over the given time, rising to peakHeight
+///  in the middle of the path and settling at endHeight.
+/// Assign this to the globe view's delegate and it'll do the rest
+- (id)initWithView:(WhirlyGlobeView *)globeView toPosition:(WhirlyKit::GeoCoord)coord endHeight:(double)endHeight peakHeight:(double)peakHeight howLong:(float)howLong;
+
+/// Sample the path at parametric t in [0,1].  Interpolates between the
+///  precomputed samples, so it's cheap enough to call speculatively.
+- (void)sampleAtT:(double)t rot:(Eigen::Quaterniond &)rot height:(double &)height;
+
+@end
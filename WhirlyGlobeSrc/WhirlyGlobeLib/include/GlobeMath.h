@@ -49,7 +49,16 @@ public:
     /// Static version for convenience
     static Point3f GeocentricToLocal(Point3f);
     static Point3d GeocentricToLocal(Point3d);
-    
+
+    /// Batch versions.  These run one Proj-4 transform over the whole
+    ///  array instead of one per point.
+    void localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    void geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    /// Static versions of the batch conversions
+    static void LocalToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    static void GeocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+
+
     /// Convenience routine to convert a whole MBR to local coordinates
     static Mbr GeographicMbrToLocal(GeoMbr);
 
@@ -85,17 +94,23 @@ public:
     /// Static version
     static Point3f DisplayToLocal(Point3f);
     static Point3d DisplayToLocal(Point3d);
-    
+
+    /// Batch version for the mesh builders.  Just the trig, no
+    ///  virtual call per vertex.
+    virtual void localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    /// Static version of the batch conversion
+    static void LocalToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+
     /// Return a normal for the given point
     virtual Point3f normalForLocal(Point3f);
     virtual Point3d normalForLocal(Point3d);
-    
+
     /// Get a reference to the coordinate system
     virtual CoordSystem *getCoordSystem() { return &geoCoordSys; }
-    
+
     /// This system is round
     bool isFlat() { return false; }
-    
+
 protected:
     GeoCoordSystem geoCoordSys;
 };
@@ -126,7 +141,10 @@ public:
     /// Static version
     static Point3f DisplayToLocal(Point3f);
     static Point3d DisplayToLocal(Point3d);
-    
+
+    /// Batch version, one Proj-4 transform for the whole array
+    virtual void localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+
     /// Return a normal for the given point
     virtual Point3f normalForLocal(Point3f);
     virtual Point3d normalForLocal(Point3d);
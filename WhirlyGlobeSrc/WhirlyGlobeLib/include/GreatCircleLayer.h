@@ -0,0 +1,73 @@
+/*
+ *  GreatCircleLayer.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "Identifiable.h"
+#import "WhirlyVector.h"
+#import "DataLayer.h"
+#import "layerThread.h"
+#import "LayerViewWatcher.h"
+#import "ShapeManager.h"
+
+/** The analytic description of a single great circle route.  We keep
+    this around rather than a fixed tessellation so the layer can
+    resample it as the viewer moves.
+  */
+@interface WhirlyKitGreatCircle : NSObject
+
+/// Starting point in geographic
+@property (nonatomic,assign) WhirlyKit::GeoCoord &startLoc;
+/// End point in geographic
+@property (nonatomic,assign) WhirlyKit::GeoCoord &endLoc;
+/// Height of the arc at its midpoint (in display units)
+@property (nonatomic,assign) float height;
+/// Line width in pixels
+@property (nonatomic,assign) float lineWidth;
+/// If set, we'll use the local color
+@property (nonatomic,assign) bool useColor;
+/// Local color, which will override the default
+@property (nonatomic,assign) WhirlyKit::RGBAColor &color;
+
+@end
+
+/**  The Great Circle Layer displays a set of great circle routes and keeps
+     their subdivision matched to the viewer height.  Rather than sampling
+     each curve once at creation, we watch the view and resample when the
+     viewer crosses into a different height bucket, so routes stay smooth
+     up close without carrying all those segments when zoomed out.
+
+     Samplings are cached per bucket, so moving back and forth between
+     heights doesn't redo the subdivision.  The shape related attributes
+     in the description dictionary are the same as the Shape Layer's.
+  */
+@interface WhirlyKitGreatCircleLayer : NSObject<WhirlyKitLayer>
+
+/// Called in the layer thread
+- (void)startWithThread:(WhirlyKitLayerThread *)layerThread scene:(WhirlyKit::Scene *)scene;
+
+/// Called in the layer thread
+- (void)shutdown;
+
+/// Add a group of great circles.  The returned ID can be used to remove them.
+- (WhirlyKit::SimpleIdentity)addGreatCircles:(NSArray *)circles desc:(NSDictionary *)desc;
+
+/// Remove a group of great circles by ID
+- (void)removeGreatCircles:(WhirlyKit::SimpleIdentity)circleID;
+
+@end
@@ -25,10 +25,31 @@
 namespace WhirlyKit
 {
 
+/** Scratch buffers for the axis aligned clipper.  The clipper ping pongs
+    between these rather than allocating per loop, so make one of these
+    and reuse it across a whole dice.
+  */
+class ClipWorkspace
+{
+public:
+    VectorRing scratchA,scratchB;
+};
+
 /** Clip Loop to Grid will clip the given areal loop to a grid specified by the origin and spacing
     and return the results as individual loops.  This is used by the loft layer.
+    A concave loop that crosses a cell more than once comes back as a single
+    loop with coincident bridging edges along the cell boundary; those are
+    zero area, so the tessellator eats them.
   */
 bool ClipLoopToGrid(const VectorRing &ring,Point2f org,Point2f spacing,std::vector<VectorRing> &rets);
 bool ClipLoopToMbr(const VectorRing &ring,const Mbr &mbr, const bool closed,std::vector<VectorRing> &rets);
+
+/** Clip a single closed loop to an axis aligned rectangle.  This runs
+    Sutherland-Hodgman against the four edges using the workspace buffers,
+    so it doesn't allocate once the workspace is warmed up.  Much cheaper
+    than ClipLoopToMbr when the clip region is just a rectangle.
+    Returns true if anything was left, with the result in ret.
+  */
+bool ClipLoopToMbrFast(const VectorRing &ring,const Mbr &mbr,ClipWorkspace &ws,VectorRing &ret);
   
 }
@@ -21,6 +21,7 @@
 #import <math.h>
 #import "DataLayer.h"
 #import "GlobeScene.h"
+#import "LayerViewWatcher.h"
 
 namespace WhirlyKit
 {
@@ -29,7 +30,11 @@ static const float GridCellSize = 3*(float)M_PI/180.0;
 }
 
 /** Grid Layer will create some overlaid grid lines on the
-    globe.
+    globe.  The graticule is view dependent: we only build the bands
+    under the viewer, at a cell size that follows the viewer height.
+    So zoomed in views get a fine local grid without paying for fine
+    global geometry, and zoomed out views stay coarse.  Bands are
+    cached and toggled as the viewer moves around.
  */
 @interface WhirlyKitGridLayer : NSObject<WhirlyKitLayer>
 
@@ -115,6 +115,11 @@ public:
 
     /// Add the given set of labels, returning an ID that represents the whole thing
     SimpleIdentity addLabels(NSArray *labels,NSDictionary *desc,ChangeSet &changes);
+
+    /// Same, but with the description already parsed.  Callers adding
+    ///  labels repeatedly with an identical desc can parse it into a
+    ///  WhirlyKitLabelInfo once and reuse it.  We won't modify it.
+    SimpleIdentity addLabels(NSArray *labels,WhirlyKitLabelInfo *labelInfo,ChangeSet &changes);
     
     /// Change visual attributes (just the visibility range)
     void changeLabel(SimpleIdentity labelID,NSDictionary *desc,ChangeSet &changes);
@@ -124,7 +129,10 @@ public:
     
     /// Enable/disable labels
     void enableLabels(SimpleIDSet labelID,bool enable,ChangeSet &changes);
-    
+
+    /// Report the bookkeeping we're holding to the memory census
+    virtual void memoryCensus(MemoryCensusEntry &entry);
+
 protected:
     pthread_mutex_t labelLock;
     
@@ -92,6 +92,9 @@ typedef enum {WhirlyKitLabelMiddle,WhirlyKitLabelLeft,WhirlyKitLabelRight} Whirl
 
 /// Description of the labels
 @property (nonatomic) WhirlyKitLabelInfo *labelInfo;
+/// The labels to lay out.  Kept separate from the labelInfo so one
+///  parsed labelInfo can serve many adds.
+@property (nonatomic) NSArray *strs;
 /// How big texture atlases should be if we're not using fonts
 @property (nonatomic,assign) int textureAtlasSize;
 /// Coordinate system display adapater
@@ -25,6 +25,94 @@
 #import "LayerViewWatcher.h"
 #import "SceneRendererES.h"
 
+namespace WhirlyKit
+{
+
+/** Bump allocator for short lived scratch memory on a layer thread.
+    Allocation is just a pointer increment and there's no per object
+    free.  Whoever owns the work loop resets the whole arena between
+    work units (e.g. tiles), so a steady workload stops touching
+    malloc entirely.  Not thread safe.  Each layer thread has its own.
+  */
+class ScratchArena
+{
+public:
+    ScratchArena(size_t blockSize = 256*1024);
+    ~ScratchArena();
+
+    /// Allocate the given number of bytes (16 byte aligned).
+    /// There is no free.  The memory is valid until the next reset.
+    void *alloc(size_t size);
+
+    /// Reclaim everything allocated since the last reset.
+    /// The regular size blocks stick around for reuse; oversize
+    ///  allocations are given back.
+    void reset();
+
+    /// Total bytes the arena is holding
+    size_t totalSize();
+
+protected:
+    class Block
+    {
+    public:
+        unsigned char *data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    // Oversize allocations that go away on reset
+    std::vector<Block> bigBlocks;
+    size_t blockSize;
+    int curBlock;
+    size_t curPos;
+};
+
+/** STL style allocator that hands out memory from a scratch arena.
+    Use it for containers that live no longer than the current work
+    unit.  Deallocate is a no-op; the arena reset takes it all back.
+    With a NULL arena it falls through to regular malloc/free.
+  */
+template <typename T>
+class ScratchAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <typename U> struct rebind { typedef ScratchAllocator<U> other; };
+
+    ScratchAllocator(ScratchArena *arena = NULL) : arena(arena) { }
+    template <typename U> ScratchAllocator(const ScratchAllocator<U> &that) : arena(that.arena) { }
+
+    pointer allocate(size_type n,const void * = NULL)
+    {
+        if (arena)
+            return (pointer)arena->alloc(n*sizeof(T));
+        return (pointer)malloc(n*sizeof(T));
+    }
+    void deallocate(pointer p,size_type)
+    {
+        if (!arena)
+            free(p);
+    }
+    size_type max_size() const { return ((size_type)-1)/sizeof(T); }
+    void construct(pointer p,const T &val) { new ((void *)p) T(val); }
+    void destroy(pointer p) { p->~T(); }
+
+    ScratchArena *arena;
+};
+
+template <typename T,typename U>
+bool operator==(const ScratchAllocator<T> &a,const ScratchAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T,typename U>
+bool operator!=(const ScratchAllocator<T> &a,const ScratchAllocator<U> &b) { return a.arena != b.arena; }
+
+}
+
 /** The Layer Thread manages the objects that put data into a scene
     and take it out later.  These objects also handle the interaction
     with the user, if there is significant calculation or lookup involved.
@@ -47,6 +135,13 @@
 @property (nonatomic,assign) bool allowFlush;
 /// Set if this is the main layer thread, responsible for shutting down the scene
 @property (nonatomic,assign) bool mainLayerThread;
+/// On by default.  Turn it off for a main layer thread whose scene
+///  belongs to another view, so shutting this view down doesn't tear
+///  down GL resources the scene's owner is still drawing.
+@property (nonatomic,assign) bool teardownScene;
+/// Scratch arena for transient allocations on this thread.
+/// Layers reset it between work units (tiles, usually).
+@property (nonatomic,readonly) WhirlyKit::ScratchArena *scratchArena;
 
 /// Set up with a scene and a view
 - (id)initWithScene:(WhirlyKit::Scene *)inScene view:(WhirlyKitView *)inView renderer:(WhirlyKitSceneRendererES *)renderer mainLayerThread:(bool)mainLayerThread;
@@ -54,7 +149,9 @@
 /// Add these before you kick off the thread
 - (void)addLayer:(NSObject<WhirlyKitLayer> *)layer;
 
-/// Remove the given layer.
+/// Remove the given layer.  The shutdown happens over on the layer
+///  thread, so the layer may still be letting go of things when this
+///  returns.
 - (void)removeLayer:(NSObject<WhirlyKitLayer> *)layer;
 
 /// Add a C++ object to be deleted after the thread has stopped
@@ -69,6 +166,14 @@
 /// Doing it like this avoids any problems we may have with shutdown synchronization
 - (void)addThreadToShutdown:(WhirlyKitLayerThread *)thread;
 
+/// Shared concurrent pool for work units from any of the layer
+/// threads: tile builds, tessellation, label rendering and so on.
+/// GCD sizes it to the hardware, so several busy layers share the
+/// cores rather than each getting a couple of private threads.
+/// Layer state still belongs to the layer thread; hop back there
+/// with performSelector when the work unit finishes.
++ (dispatch_queue_t)sharedWorkQueue;
+
 /// Layers need to send their change requests throgh here.
 /// You can call this from any thread.
 - (void)addChangeRequest:(WhirlyKit::ChangeRequest *)changeRequest;
@@ -77,6 +182,12 @@
 /// You can call this from any thread.
 - (void)addChangeRequests:(std::vector<WhirlyKit::ChangeRequest *> &)changeRequests;
 
+/// Like addChangeRequests, but these land in the scene's warm up
+/// queue.  Use for resources built ahead of need, such as the tiles
+/// of a layer that hasn't been enabled yet.
+/// You can call this from any thread.
+- (void)addPreheatChangeRequests:(std::vector<WhirlyKit::ChangeRequest *> &)changeRequests;
+
 /// Called by a layer to request a flush at the next opportunity.
 /// Presumably the layer did something worth flushing
 /// You can call this from any thread.
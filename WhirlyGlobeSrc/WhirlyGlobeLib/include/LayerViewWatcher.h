@@ -69,6 +69,10 @@
 /// Calculate where the eye is in model coordinates
 @property (nonatomic,readonly) WhirlyKit::Point3d eyePos;
 
+/// The view change this state was built from.  The watchers use it
+///  to share one snapshot per change across the layer threads.
+@property (nonatomic,assign) long long version;
+
 /// Called by the subclasses
 - (id)initWithView:(WhirlyKitView *)view renderer:(WhirlyKitSceneRendererES *)renderer;
 
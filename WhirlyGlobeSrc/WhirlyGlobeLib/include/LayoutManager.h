@@ -73,6 +73,10 @@ public:
     /// Options for where to place this object:  WhirlyKitLayoutPlacementLeft, WhirlyKitLayoutPlacementRight,
     ///  WhirlyKitLayoutPlacementAbove, WhirlyKitLayoutPlacementBelow
     int acceptablePlacement;
+    /// Cluster group this object belongs to, or -1 for no clustering.
+    /// Objects in the same group that land in the same cluster grid cell
+    ///  collapse down to the most important one.
+    int clusterGroup;
     /// Debugging hint
     NSString *hint;
 };
@@ -86,23 +90,51 @@ public:
     {
         currentEnable = newEnable = false;
         offset = Point2d(MAXFLOAT,MAXFLOAT);
+        lastScreenPt = Point2d(MAXFLOAT,MAXFLOAT);
         changed = true;
+        clusterCellX = clusterCellY = -1;
+        clusterHidden = false;
     }
-    
+
     // The layout objects as passed in by the original caller
     LayoutObject obj;
-    
+
     // Set if it's currently on
     bool currentEnable;
     // Set if it's going to be on
     bool newEnable;
     // The offset, as calculated
     WhirlyKit::Point2d offset;
+    // Screen point the last time we ran full placement (MAXFLOAT if we haven't)
+    WhirlyKit::Point2d lastScreenPt;
+    // Rectangle we placed it at last time, empty if it lost out
+    std::vector<WhirlyKit::Point2d> lastObjPts;
     // Set if we changed something during evaluation
     bool changed;
+    // Cluster grid cell we were last assigned to (-1,-1 for none)
+    int clusterCellX,clusterCellY;
+    // Set if clustering hid us behind a more important object
+    bool clusterHidden;
 };
 
 typedef std::set<LayoutObjectEntry *,IdentifiableSorter> LayoutEntrySet;
+
+/// One cell in the cluster quad grid
+class ClusterCell
+{
+public:
+    ClusterCell(int group,int ix,int iy) : group(group), ix(ix), iy(iy) { }
+    bool operator < (const ClusterCell &that) const
+    {
+        if (group != that.group)  return group < that.group;
+        if (ix != that.ix)  return ix < that.ix;
+        return iy < that.iy;
+    }
+    int group,ix,iy;
+};
+
+// Objects in each occupied cluster cell
+typedef std::map<ClusterCell,std::set<LayoutObjectEntry *> > ClusterGrid;
     
 #define kWKLayoutManager "WKLayoutManager"
 
@@ -120,7 +152,15 @@ public:
     
     /// If set, the maximum number of objects to display
     void setMaxDisplayObjects(int numObjects);
-    
+
+    /// Size (in points) of a cluster grid cell
+    void setClusterCellSize(float sizeInPoints);
+
+    /// Maximum cluster objects we'll reproject in a single update.
+    /// Reclustering after a view change spreads over several updates
+    ///  past this; the rest keep their old cells in the meantime.
+    void setClusterWorkBudget(int maxObjects);
+
     /// Add objects for layout (thread safe)
     void addLayoutObjects(const std::vector<LayoutObject> &newObjects);
     
@@ -138,7 +178,8 @@ public:
         
 protected:
     void runLayoutRules(WhirlyKitViewState *viewState);
-    
+    void runClusterRules(WhirlyKitViewState *viewState,const Point2f &frameBufferSize,float resScale);
+
     pthread_mutex_t layoutLock;
     /// If non-zero the maximum number of objects we'll display at once
     int maxDisplayObjects;
@@ -146,6 +187,18 @@ protected:
     bool hasUpdates;
     /// Objects we're controlling the placement for
     LayoutEntrySet layoutObjects;
+    /// Cluster grid cell size in points
+    float clusterCellSize;
+    /// Max cluster objects to reproject per update
+    int clusterWorkBudget;
+    /// Cluster cell membership for objects with a cluster group
+    ClusterGrid clusterGrid;
+    // Where the incremental recluster scan picks up next update
+    SimpleIdentity clusterScanPos;
+    // Set if the cluster grid still needs reprojection
+    bool clusterDirty;
+    // View matrix the cluster grid was last built against
+    Eigen::Matrix4d clusterMatrix;
 };
 
 }
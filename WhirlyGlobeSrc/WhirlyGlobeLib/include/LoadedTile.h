@@ -20,6 +20,7 @@
 
 #import <Foundation/Foundation.h>
 #import <math.h>
+#import <list>
 #import "WhirlyVector.h"
 #import "TextureGroup.h"
 #import "Scene.h"
@@ -94,6 +95,11 @@ typedef enum {WKTileScaleUp,WKTileScaleDown,WKTileScaleFixed,WKTileScaleNone} Wh
 /// You could overload this, just be sure to respect the border pixels.
 - (WhirlyKit::Texture *)buildTexture:(int)borderSize destWidth:(int)width destHeight:(int)height;
 
+/// Same thing, but decodes straight into a single luminance byte per
+///  pixel for GL_ALPHA layers, skipping the 32 bit intermediate.
+/// Falls back on the regular path for content that isn't a UIImage.
+- (WhirlyKit::Texture *)buildSingleByteTexture:(int)borderSize destWidth:(int)width destHeight:(int)height;
+
 /// This will extract the pixels out of an image or NSData and store them for later use
 - (bool)convertToRawData:(int)borderTexel;
 
@@ -123,6 +129,63 @@ typedef enum {WKTileScaleUp,WKTileScaleDown,WKTileScaleFixed,WKTileScaleNone} Wh
 namespace WhirlyKit
 {
     
+// Scratch containers used while building a single tile.
+// The memory comes out of the layer thread's scratch arena.
+typedef std::vector<Point3f,ScratchAllocator<Point3f> > ScratchPoint3fVector;
+typedef std::vector<TexCoord,ScratchAllocator<TexCoord> > ScratchTexCoordVector;
+typedef std::vector<float,ScratchAllocator<float> > ScratchFloatVector;
+
+/// The displaced grid for one elevation tile, shared out of the mesh cache
+class ElevMesh
+{
+public:
+    std::vector<Point3f> locs;
+    std::vector<float> elevs;
+};
+typedef boost::shared_ptr<ElevMesh> ElevMeshRef;
+
+/** Cache of elevation displaced tile grids.  Keyed by a fingerprint of
+    the tile, its texture mapping, and the elevation samples, so a tile
+    paged back in after eviction reuses the grid it had before instead
+    of interpolating and projecting every vertex again.  Least recently
+    used grids go when the byte budget runs out.  Safe to hit from any
+    thread, and the grids it hands back are shared, so don't modify them.
+  */
+class ElevMeshCache
+{
+public:
+    ElevMeshCache(long long maxBytes);
+    ~ElevMeshCache();
+
+    /// The shared cache the tile builders use
+    static ElevMeshCache *getShared();
+
+    /// Fingerprint helpers.  Start from hashSeed() and fold in
+    ///  everything that shapes the grid.
+    static long long hashSeed();
+    static long long hashInt(long long hash,long long val);
+    static long long hashFloat(long long hash,float val);
+
+    /// Return the grid stored under the given fingerprint, or an empty ref
+    ElevMeshRef get(long long key);
+
+    /// Hang on to a freshly built grid
+    void add(long long key,ElevMeshRef mesh);
+
+protected:
+    typedef struct
+    {
+        long long key;
+        long long cost;
+        ElevMeshRef mesh;
+    } CacheEntry;
+
+    pthread_mutex_t lock;
+    long long maxBytes,usedBytes;
+    std::list<CacheEntry> entries;
+    std::map<long long,std::list<CacheEntry>::iterator> entryMap;
+};
+
 /** The Tile Builder stores data needed to build individual tiles.
     This includes the texture and drawable atlases.
   */
@@ -142,12 +205,21 @@ public:
     void initAtlases(WhirlyKitTileImageType imageType,int numImages,int textureAtlasSize,int sampleSizeX,int sampleSizeY);
     
     // Build the edge matching skirt
-    void buildSkirt(BasicDrawable *draw,std::vector<Point3f> &pts,std::vector<TexCoord> &texCoords,float skirtFactor,bool haveElev);
+    void buildSkirt(BasicDrawable *draw,ScratchPoint3fVector &pts,ScratchTexCoordVector &texCoords,float skirtFactor,bool haveElev);
     
-    // Build a given tile
+    // Build a given tile.  If cancel is set and flips true the build
+    //  bails out early, cleans up after itself and returns false.
+    // In edge stitching mode stitchLevels carries the levels of the
+    //  bottom, top, left and right neighbors (-1 where there isn't a
+    //  coarser one) so the edge vertices can be snapped to match.
     bool buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,BasicDrawable **skirtDraw,std::vector<Texture *> *texs,
-              Point2f texScale,Point2f texOffset,std::vector<WhirlyKitLoadedImage *> *loadImages,WhirlyKitElevationChunk *elevData);
-    
+              Point2f texScale,Point2f texOffset,std::vector<WhirlyKitLoadedImage *> *loadImages,WhirlyKitElevationChunk *elevData,const bool *cancel = NULL,const int *stitchLevels = NULL);
+
+    // Build one standalone texture from its source image, applying the
+    //  usual format, mipmap and conversion settings.  Used by buildTile
+    //  and by the frame residency rebuilds.
+    Texture *buildSingleTexture(WhirlyKitLoadedImage *loadImage,int destWidth,int destHeight,const bool *cancel = NULL);
+
     // Flush updates out into the change requests
     bool flushUpdates(ChangeSet &changes);
     
@@ -185,13 +257,34 @@ public:
     
     // If set, no skirts
     bool ignoreEdgeMatching;
-    
+
+    // If set, tile edges are snapped onto their coarser neighbors
+    //  instead of getting skirts.  No skirt geometry, no skirt fill.
+    bool stitchEdges;
+
+    // If set, tiles with elevation get a normal map in the second
+    //  texture unit for per fragment lighting.  Non-atlas path only.
+    bool buildNormalMaps;
+
+    // If set, tile vertices are stored relative to the tile's center,
+    //  which rides on the drawable as a double translation.  The
+    //  renderer composes that in double, so deep zooms on flat maps
+    //  don't jitter.  Flat coordinate systems and non-atlas path only.
+    bool useTileCenters;
+
     // Set if we want pole geometry
     bool coverPoles;
     
     // Image format for textures
     GLenum glFormat;
     WKSingleByteSource singleByteSource;
+
+    // If set, tile textures get converted to their target format on the
+    //  build thread rather than at upload.  Small textures skip it.
+    bool convertFormatOnBuild;
+
+    // If set, tile textures carry mipmap chains for minification
+    bool useMipmaps;
     
     // Whether we start new drawables enabled or disabled
     bool enabled;
@@ -232,6 +325,15 @@ public:
     
     // Set if we're in single level mode.  That is, we're only trying to display a single level.
     bool singleLevel;
+
+    // If set, tile drawables use half float texture coordinates and packed
+    //  byte normals to cut vertex fetch bandwidth
+    bool compactVertexFormat;
+
+    // Scratch arena for per tile build memory, usually the layer
+    //  thread's.  Reset wholesale at the start of each tile build.
+    //  NULL means the scratch containers fall back on malloc.
+    ScratchArena *scratchArena;
 };
     
 /** The Loaded Tile is used to track tiles that have been
@@ -250,16 +352,38 @@ public:
     
     /// Build the data needed for a scene representation
     bool addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoadedImage *>loadImages,int currentImage0,int currentImage1,WhirlyKitElevationChunk *loadElev,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
-    
+
+    /// Add geometry and textures that were already built, presumably on
+    ///  another thread.  This is the back half of addToScene and must be
+    ///  called on the layer thread; it consumes the drawables and textures.
+    bool addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoadedImage *> &loadImages,WhirlyKit::BasicDrawable *draw,WhirlyKit::BasicDrawable *skirtDraw,std::vector<WhirlyKit::Texture *> &texs,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
+
     /// Remove data from scene.  This just sets up the changes requests.
     /// They must still be passed to the scene
     void clearContents(TileBuilder *tileBuilder,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
+
+    /// Teardown version of clearContents.  Collects the IDs for a bulk
+    ///  removal rather than making a change request per resource.
+    /// Atlas managed resources still go through the atlas as changes.
+    void dropContents(TileBuilder *tileBuilder,WhirlyKit::SimpleIDSet &drawIDs,WhirlyKit::SimpleIDSet &texIDs,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
     
     /// Update what we're displaying based on the quad tree, particulary for children
     void updateContents(TileBuilder *tileBuilder,LoadedTile *childTiles[],std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
+
+    /// Rebuild our geometry snapped against the given neighbor levels.
+    /// Used in edge stitching mode when a neighbor loads or unloads.
+    /// Does nothing if the levels haven't changed since the last stitch.
+    void restitchContents(TileBuilder *tileBuilder,const int newStitchLevels[4],std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
     
     /// Switch to the given images
     void setCurrentImages(TileBuilder *tileBuilder,int whichImage0,int whichImage1,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
+
+    /// Keep only the frames within the given distance of the play head
+    ///  resident as textures, rebuilding from the retained source images
+    ///  and dropping the rest.  The window wraps around the ends, so a
+    ///  looping animation always has its next frames ready.  Points the
+    ///  geometry at whichImage0.  Non-atlas path only.
+    void updateFrameResidency(TileBuilder *tileBuilder,int frameResidency,int whichImage0,int whichImage1,std::vector<WhirlyKit::ChangeRequest *> &changeRequests);
     
     /// Turn drawables on/off
     void setEnable(TileBuilder *tileBuilder, bool enable, ChangeSet &theChanges);
@@ -280,10 +404,15 @@ public:
     WhirlyKit::SimpleIdentity drawId;
     // Optional ID for the skirts
     WhirlyKit::SimpleIdentity skirtDrawId;
+    // Optional ID for the normal map texture
+    WhirlyKit::SimpleIdentity normalTexId;
     // Texture IDs for the parent tile
     std::vector<WhirlyKit::SimpleIdentity> texIds;
     /// If set, these are subsets of a larger dynamic texture
     std::vector<WhirlyKit::SubTexture> subTexs;
+    /// Source images retained (still compressed) when a frame residency
+    ///  window is active, so dropped frames can be rebuilt
+    std::vector<WhirlyKitLoadedImage *> sourceImages;
     /// If here, the elevation data needed to build geometry
     WhirlyKitElevationChunk *elevData;
     /// Center of the tile in display coordinates
@@ -294,6 +423,21 @@ public:
     // IDs for the various fake child geometry
     WhirlyKit::SimpleIdentity childDrawIds[4];
     WhirlyKit::SimpleIdentity childSkirtDrawIds[4];
+
+    /// Neighbor levels our edges were last stitched against (bottom,
+    ///  top, left, right; -1 for none).  Only used in stitching mode.
+    int stitchLevels[4];
+
+    /// Which of the fake children are currently showing.  We hang on to
+    ///  the rest, turned off, so covering a child again is an enable
+    ///  rather than a geometry rebuild.
+    bool childIsOn[4];
+    /// Set if our own geometry is currently showing
+    bool selfIsOn;
+
+    /// Shared flag set when this tile is unloaded, so fetches and
+    ///  builds still in flight for it can bail out early
+    boost::shared_ptr<bool> cancelled;
 };
 
 /// This is a comparison operator for sorting loaded tile pointers by
@@ -18,10 +18,13 @@
  *
  */
 
+#import <vector>
 #import "QuadDisplayLayer.h"
 #import "SphericalMercator.h"
 #import "TileQuadLoader.h"
 
+@class WhirlyGlobeAnimateViewPath;
+
 /** MabBox Tile Quad Data source.
     This implements the data source protocol for MapBox Tiles.
     Initialize with an archive, hand it a quad display layer and it'll
@@ -51,6 +54,15 @@
 /// Maximum available zoom level.  Can be read from mb tiles db or assigned
 @property (nonatomic,assign) int maxZoom;
 
+/// Batch read the given tiles into the RAM cache on a background thread.
+/// Fetches for those tiles then skip the database entirely.
+- (void)readaheadTiles:(const std::vector<WhirlyKit::Quadtree::Identifier> &)tileIDs;
+
+/// Sample a flyover path and read ahead the tiles it's going to pass over.
+/// Call this when the animation starts and the fetches along the way come
+///  out of memory instead of stuttering on disk.
+- (void)readaheadForPath:(WhirlyGlobeAnimateViewPath *)path numSamples:(int)numSamples;
+
 /// Called by the layer to shut things down
 - (void)shutdown;
 
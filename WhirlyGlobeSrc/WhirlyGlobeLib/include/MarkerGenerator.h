@@ -70,7 +70,7 @@ public:
     /// Called by the renderer to add a marker from a layer
     void addMarker(Marker *marker);
     /// Called to add a whole group of markers
-    void addMarkers(std::vector<Marker *> markers);
+    void addMarkers(const std::vector<Marker *> &markers);
     
     /// Enable/disable markers
     void enableMarkers(std::vector<SimpleIdentity> &markerIDs,bool enable);
@@ -103,6 +103,8 @@ public:
     MarkerGeneratorAddRequest(SimpleIdentity genID,MarkerGenerator::Marker *marker);
     /// Construct with a vector of markers to add
     MarkerGeneratorAddRequest(SimpleIdentity genID,const std::vector<MarkerGenerator::Marker *> &markers);
+    /// Same, but takes the marker list rather than copying it
+    MarkerGeneratorAddRequest(SimpleIdentity genID,std::vector<MarkerGenerator::Marker *> &&markers);
     ~MarkerGeneratorAddRequest();
     
     virtual void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,Generator *gen);
@@ -60,6 +60,7 @@ public:
     SimpleIDSet selectIDs;  // IDs used for selection
     SimpleIDSet markerIDs;  // IDs for markers sent to the generator
     SimpleIDSet screenShapeIDs;  // IDs for screen space objects
+    std::vector<SimpleIdentity> screenShapeOrder;  // Screen shape IDs in the order the markers came in, for in place updates
     float fade;   // Time to fade away for deletion
 };
 typedef std::set<MarkerSceneRep *,IdentifiableSorter> MarkerSceneRepSet;
@@ -126,6 +127,11 @@ typedef std::set<MarkerSceneRep *,IdentifiableSorter> MarkerSceneRepSet;
 /// Value to use for the layout engine.  Set to MAXFLOAT by
 ///  default, which will always display.
 @property (nonatomic,assign) float layoutImportance;
+/// Cluster group for the layout engine.  Markers in the same group that
+///  crowd together on screen collapse down to the most important one.
+///  Set to -1 by default, which disables clustering.  Only applies to
+///  markers the layout engine controls (layoutImportance set).
+@property (nonatomic,assign) int layoutClusterGroup;
 
 /// Add a texture ID to be displayed
 - (void)addTexID:(WhirlyKit::SimpleIdentity)texID;
@@ -134,21 +140,59 @@ typedef std::set<MarkerSceneRep *,IdentifiableSorter> MarkerSceneRepSet;
 
 namespace WhirlyKit
 {
-    
+
 #define kWKMarkerManager "WKMarkerManager"
 
+/** Plain data version of WhirlyKitMarker for the bulk add path.
+    Callers feeding us very large batches (vehicle fleets and the like)
+    fill in a vector of these rather than allocating an NSObject per marker.
+  */
+class SimpleMarker
+{
+public:
+    SimpleMarker() : texID(EmptyIdentity), width(0.0), height(0.0), selectID(EmptyIdentity) { }
+
+    /// The location for the center of the marker
+    GeoCoord loc;
+    /// Single texture to display, or EmptyIdentity for none
+    SimpleIdentity texID;
+    /// Size in the units implied by the description dictionary.
+    /// Leave at 0.0 to use the default from the description.
+    float width,height;
+    /// Set this to make the marker selectable
+    SimpleIdentity selectID;
+};
+
 /** The Marker Manager is used to create and destroy geometry for 2D and 3D markers.
-    It's entirely thread safe except for the 
+    It's entirely thread safe except for the
   */
 class MarkerManager : public SceneManager
 {
 public:
     MarkerManager();
     virtual ~MarkerManager();
-    
+
     /// Add an array of markers, returning the identity that corresponds
     SimpleIdentity addMarkers(NSArray *markers,NSDictionary *desc,ChangeSet &changes);
+
+    /// Same, but with the description already parsed.  Callers that add
+    ///  markers over and over with an identical desc can parse it into a
+    ///  WhirlyKitMarkerInfo once and reuse it.  We won't modify it.
+    SimpleIdentity addMarkers(NSArray *markers,WhirlyKitMarkerInfo *markerInfo,ChangeSet &changes);
+
+    /// Bulk version of the above.  Each unique sub-texture is resolved once,
+    ///  the geometry comes out of one tight loop and everything lands in a
+    ///  single set of change requests.  Bulk markers don't do the texture
+    ///  switching or layout that WhirlyKitMarker supports.
+    SimpleIdentity addMarkers(const std::vector<SimpleMarker> &markers,NSDictionary *desc,ChangeSet &changes);
     
+    /// Update the positions (and optionally colors) of existing screen
+    ///  markers in place.  Locations are in display space and run in the
+    ///  same order the markers were added.  The geometry is left alone,
+    ///  so this is far cheaper than a remove and re-add for things that
+    ///  just move, but selection shapes and layout placement don't follow.
+    void updateScreenMarkers(SimpleIDSet &markerIDs,const std::vector<Point3d> &worldLocs,const std::vector<RGBAColor> &colors,ChangeSet &changes);
+
     /// Remove the given set of markers
     void removeMarkers(SimpleIDSet &markerIDs,ChangeSet &changes);
     
@@ -157,7 +201,10 @@ public:
     
     /// Called by the scene once things are set up
     virtual void setScene(Scene *inScene);
-    
+
+    /// Report the bookkeeping we're holding to the memory census
+    virtual void memoryCensus(MemoryCensusEntry &entry);
+
 protected:
     pthread_mutex_t markerLock;
     /// Resources associated with given markers
@@ -115,11 +115,19 @@ public:
     virtual ~OpenGLES2Program();
     
     /// Used only for comparison
-    OpenGLES2Program(SimpleIdentity theId) : Identifiable(theId), lightsLastUpdated(0.0) { }
+    OpenGLES2Program(SimpleIdentity theId) : Identifiable(theId), lightsLastUpdated(0.0), lastFramePrepared(0.0) { }
 
     /// Initialize with both shader programs
     OpenGLES2Program(const std::string &name,const std::string &vShaderString,const std::string &fShaderString);
-    
+
+    /// Point the program binary cache at a directory (created if need be).
+    /// Once set, construction checks for a cached binary before compiling
+    ///  and writes one after a successful link.  The files are keyed off
+    ///  the shader source and the driver's version strings, so a stale or
+    ///  foreign binary just falls back to the compiler.  Call this with
+    ///  a GL context current, before the default shaders get built.
+    static void SetBinaryCacheDir(NSString *cacheDir);
+
     /// Return true if it was built correctly
     bool isValid();
         
@@ -134,7 +142,16 @@ public:
     bool setUniform(const std::string &name,const Eigen::Vector4f &vec);
     bool setUniform(const std::string &name,const Eigen::Matrix4f &mat);
     bool setUniform(const std::string &name,int val);
-    
+
+    /// Same, but with the uniform already resolved via findUniform().
+    /// Draw loops cache those, so they're not doing name lookups per call.
+    bool setUniform(OpenGLESUniform *uni,float val);
+    bool setUniform(OpenGLESUniform *uni,const Eigen::Vector2f &vec);
+    bool setUniform(OpenGLESUniform *uni,const Eigen::Vector3f &vec);
+    bool setUniform(OpenGLESUniform *uni,const Eigen::Vector4f &vec);
+    bool setUniform(OpenGLESUniform *uni,const Eigen::Matrix4f &mat);
+    bool setUniform(OpenGLESUniform *uni,int val);
+
     /// Tie a given texture ID to the given name.
     /// We have to set these up each time before drawing
     bool setTexture(const std::string &name,GLuint val);
@@ -145,7 +162,13 @@ public:
     /// Set the attributes associated with lighting.
     /// We'll check their last updated time against ours.
     bool setLights(NSArray *lights,CFTimeInterval lastUpdated,WhirlyKitMaterial *mat,Eigen::Matrix4f &modelMat);
-        
+
+    /// Bind the frame-constant state (lights and material) for this frame.
+    /// The frame time stamps the work, so however often the draw sort
+    ///  bounces between programs, each one pays for this once per frame.
+    void prepareFrame(CFTimeInterval frameTime,NSArray *lights,CFTimeInterval lightsUpdated,WhirlyKitMaterial *mat,Eigen::Matrix4f &modelMat);
+
+
     /// Search for the given attribute name and return the info.  NULL on failure.
     const OpenGLESAttribute *findAttribute(const std::string &attrName);
     
@@ -163,11 +186,20 @@ public:
     void cleanUp();
 
 protected:
+    /// Try to bring the program up from a cached binary.  Returns false
+    ///  (and leaves the program object untouched) if anything doesn't
+    ///  check out, in which case we compile normally.
+    bool tryLoadBinary(const std::string &vShaderString,const std::string &fShaderString);
+    /// Stash the linked program's binary for the next launch
+    void trySaveBinary(const std::string &vShaderString,const std::string &fShaderString);
+
     std::string name;
     GLuint program;
     GLuint vertShader;
     GLuint fragShader;
     CFTimeInterval lightsLastUpdated;
+    // The frame prepareFrame() last ran for
+    CFTimeInterval lastFramePrepared;
     // Uniforms sorted for fast lookup
     std::set<OpenGLESUniform *,UniformNameSortStruct> uniforms;
     // Attributes sorted for fast lookup
@@ -0,0 +1,66 @@
+/*
+ *  ParticleDrawable.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "Drawable.h"
+
+namespace WhirlyKit
+{
+
+// Shader name for accessing within the scene
+#define kParticleShaderName "Particle Shader"
+
+/// Construct and return the particle shader program
+OpenGLES2Program *BuildParticleProgram();
+
+/** The drawable class for GPU evaluated particles.
+    Each vertex carries its emission point, its direction scaled by
+    velocity, and when it was born and how long it lives.  The vertex
+    shader integrates position from the current frame time, so once a
+    batch of particles is uploaded the CPU never touches it again.
+  */
+class ParticleDrawable : public BasicDrawable
+{
+public:
+    ParticleDrawable();
+
+    /// Direction the particle is heading, scaled by its velocity
+    void addDir(const Eigen::Vector3f &dir);
+
+    /// When the particle was emitted, relative to the base time
+    void addStartTime(float startTime);
+
+    /// How long the particle lives after its start time
+    void addLifetime(float lifetime);
+
+    /// The per vertex times are offsets from here, to keep them
+    ///  within float precision
+    void setBaseTime(NSTimeInterval inBaseTime) { baseTime = inBaseTime; }
+
+    /// We pass in the current frame time here
+    virtual void draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+
+protected:
+    NSTimeInterval baseTime;
+    int dirIndex;
+    int startTimeIndex;
+    int lifetimeIndex;
+};
+
+}
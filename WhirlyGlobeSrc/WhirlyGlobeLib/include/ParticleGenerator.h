@@ -30,8 +30,9 @@ namespace WhirlyKit
     
 /** The Particle Generator handles creation and update for particle systems.
     You don't create them here, that's what the ParticleSystemLayer is for.
-    This class just manages them and creates their associated Drawables at
-    every frame.
+    The CPU only runs the emitters: each frame's new particles are uploaded
+    once as a batch and the particle shader integrates their positions from
+    then on.  A batch hangs around until its last particle expires.
   */
 class ParticleGenerator : public Generator
 {
@@ -99,13 +100,25 @@ public:
     void removeParticleSystem(SimpleIdentity systemId);
     
 protected:
+    /// One uploaded batch of particles.  The drawable lives in its own
+    ///  VBOs until the longest lived particle in it expires.
+    class ParticleBatch
+    {
+    public:
+        DrawableRef draw;
+        // When the last particle in the batch dies
+        NSTimeInterval expiration;
+        int numParticles;
+    };
+
     // All times are offset from here
     NSTimeInterval startTime;
     // When we last updated
     NSTimeInterval lastUpdateTime;
 
     int maxNumParticles;  // All the particles we can have at once.  Ever.
-    std::vector<Particle> particles;
+    int numLiveParticles;
+    std::vector<ParticleBatch> batches;
     typedef std::set<ParticleSystem *,IdentifiableSorter> ParticleSystemSet;
     ParticleSystemSet particleSystems;
 };
@@ -19,8 +19,16 @@
  */
 
 #import <Foundation/Foundation.h>
+#import <OpenGLES/ES2/gl.h>
+#import <OpenGLES/ES2/glext.h>
 #import <string>
 #import <map>
+#import <vector>
+
+// Only defined if we've got the disjoint timer query extension
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
 
 namespace WhirlyKit
 {
@@ -29,6 +37,7 @@ namespace WhirlyKit
 class PerformanceTimer
 {
 public:
+    PerformanceTimer();
     /// Used to track a category of timing
     class TimeEntry
     {
@@ -58,6 +67,65 @@ public:
         int numRuns;
     };
     
+    /// One frame's worth of timing and counts, kept in a ring buffer
+    ///  so we can look back at recent spikes in production builds
+    class FrameSample
+    {
+    public:
+        FrameSample();
+
+        /// When the frame started
+        NSTimeInterval frameStart;
+        /// Wall clock time the frame took on the CPU
+        NSTimeInterval cpuDuration;
+        /// GPU elapsed time for the frame, if the hardware can tell us (0.0 if not)
+        NSTimeInterval gpuDuration;
+        /// Drawables drawn this frame
+        int numDrawables;
+        /// Change requests processed this frame
+        int numChanges;
+    };
+
+    /// How many frames back the sample ring buffer reaches
+    static const int FrameSampleRingSize = 120;
+
+    /// Process wide counters cheap enough to leave on in shipping builds.
+    ///  They're bumped with lock free atomics, so any thread can touch them.
+    class TelemetryCounters
+    {
+    public:
+        /// The counters we keep.  The gauges (queue depth, texture memory)
+        ///  are overwritten with set(), the rest are running totals.
+        typedef enum {TelemTileLoads=0,TelemTileLoadTimeUs,TelemNetRequests,TelemNetBytes,TelemLoadQueueDepth,TelemTexMemory,TelemMax} Counter;
+
+        /// Add to the given counter from any thread
+        static void add(Counter which,int64_t by);
+        /// Overwrite the given counter (used for the gauges)
+        static void set(Counter which,int64_t to);
+        /// Copy the counters out, zeroing them as we go if asked
+        static void snapshot(int64_t outValues[TelemMax],bool reset);
+    };
+
+    /// Compact summary of recent performance an app can ship to its
+    ///  analytics.  Cheap enough to take every few seconds in production.
+    class TelemetrySnapshot
+    {
+    public:
+        TelemetrySnapshot();
+
+        /// Frame time percentiles over the recent sample ring (ms)
+        double frameTimeP50,frameTimeP95,frameTimeP99,frameTimeMax;
+        /// Average drawables and change requests per frame over the ring
+        float avgDrawables,avgChanges;
+        /// How many frames went into the percentiles
+        int numFrames;
+        /// Telemetry counter values at the time of the snapshot
+        int64_t counters[TelemetryCounters::TelemMax];
+    };
+
+    /// Callback for the frame time alert below
+    typedef void (*FrameTimeAlertCallback)(double p95Ms,void *userData);
+
     /// Start timing the given thing
     void startTiming(const std::string &);
     
@@ -66,17 +134,66 @@ public:
     
     /// Add a count for a particular instance
     void addCount(const std::string &what,int count);
+
+    /// Start a GPU elapsed time query for the frame, if the hardware supports it.
+    /// Call this with the GL context active, bracketing the draw calls.
+    void startGpuTiming();
+
+    /// Finish the GPU query.  The result shows up in the frame samples
+    ///  a frame or two later, when the GPU gets around to answering.
+    void stopGpuTiming();
+
+    /// Most recent GPU frame duration (seconds).  Zero if the timer
+    ///  extension isn't around or no query has answered yet.
+    NSTimeInterval getLastGpuDuration() const { return lastGpuDuration; }
+
+    /// Record the given frame in the sample ring buffer
+    void addFrameSample(const FrameSample &sample);
+
+    /// Copy out the recent frame samples, oldest first
+    void getFrameSamples(std::vector<FrameSample> &samples) const;
+
+    /// Fill in a telemetry snapshot from the frame sample ring and the
+    ///  telemetry counters, optionally zeroing the counters
+    void getTelemetrySnapshot(TelemetrySnapshot &snapshot,bool resetCounters);
+
+    /// Ask for a callback when frame time p95 crosses the given threshold (ms),
+    ///  so the app can shed load proactively.  We check every few frames on the
+    ///  render thread and fire once per crossing.  Pass NULL to turn it off.
+    void setFrameTimeAlert(double thresholdMs,FrameTimeAlertCallback callback,void *userData);
     
     /// Clean out existing timings
     void clear();
     
     /// Write out the timings to NSLog
     void log();
+
+    /// Write out the timings and counts as JSON, for benchmark tooling
+    void report(std::string &outJson);
     
 protected:
     std::map<std::string,NSTimeInterval> actives;
     std::map<std::string,TimeEntry> timeEntries;
     std::map<std::string,CountEntry> countEntries;
+
+    /// GPU timer query state.  We rotate through a couple of queries
+    ///  so we never wait on the GPU for an answer.
+    bool gpuTimingChecked,gpuTimingAvailable;
+    GLuint gpuQueries[2];
+    bool gpuQueryPending[2];
+    int curGpuQuery;
+    NSTimeInterval lastGpuDuration;
+
+    /// Ring buffer of recent frames
+    std::vector<FrameSample> frameSamples;
+    int frameSampleAt;
+
+    /// Frame time alert state
+    double alertThresholdMs;
+    FrameTimeAlertCallback alertCallback;
+    void *alertUserData;
+    int framesSinceAlertCheck;
+    bool alertTripped;
 };
     
 }
@@ -63,7 +63,7 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 - (int)maxZoom;
 
 /// Return an importance value for the given tile
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(NSMutableDictionary *)attrs;
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr viewInfo:(WhirlyKitViewState *) viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs;
 
 /// Called when the layer is shutting down.  Clean up any drawable data and clear out caches.
 - (void)shutdown;
@@ -125,6 +125,11 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 /// (e.g. matching frame boundaries), let's at least get all the work done.
 - (void)updateWithoutFlush;
 
+/// The view is moving steadily and the layer expects it to shift by about
+///  this much, in local coordinates, over the next little while.  Loaders
+///  can use this to warm up fetches for tiles about to come on screen.
+- (void)quadDisplayLayer:(WhirlyKitQuadDisplayLayer *)layer prefetchForShift:(WhirlyKit::Point2d)shift;
+
 /// Number of network fetches outstanding.  Used by the pager for optimization.
 - (int)networkFetches;
 
@@ -137,6 +142,35 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 @end
 
 
+/** The tile scheduler coordinates loading across multiple quad display
+    layers sharing the fetch and build pipeline.  Hand the same scheduler
+    to each layer and give them priorities (a basemap should outrank its
+    overlays).  A high priority layer can use the whole in-flight budget;
+    lower priority layers get what's left over, but never less than a
+    small floor, so they can't be starved outright.
+    All the calls are thread safe, since layers may be spread across
+    more than one layer thread.
+ */
+@interface WhirlyKitQuadTileScheduler : NSObject
+
+/// Total tile fetches we'll allow in flight across all the layers.  16 by default.
+@property (nonatomic,assign) int maxFetches;
+/// Fetches a layer can keep in flight even when higher priority layers
+///  have claimed the rest of the budget.  2 by default.
+@property (nonatomic,assign) int minFetchesPerLayer;
+
+/// Layers call this each evaluation pass to report how many fetches they
+///  have outstanding.  Registers the layer the first time through.
+- (void)layer:(WhirlyKitQuadDisplayLayer *)layer priority:(int)priority updateFetchCount:(int)numFetches;
+
+/// Check if the given layer is allowed to start another tile load.
+- (bool)layerCanLoad:(WhirlyKitQuadDisplayLayer *)layer;
+
+/// Called when a layer shuts down
+- (void)removeLayer:(WhirlyKitQuadDisplayLayer *)layer;
+
+@end
+
 /** This data layer displays image data organized in a quad tree.
     It will swap data in and out as required.
  */
@@ -166,10 +200,21 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 /// If not set, we'll just stop loading at that tile
 // Note: Note unimplemented
 @property (nonatomic,assign) bool drawEmpty;
+/// If set we'll watch how the view is moving and warm up tiles just past
+///  the screen edge in that direction.  On by default.
+@property (nonatomic,assign) bool prefetchTiles;
+/// How far ahead (in seconds) the prefetch projects the view motion
+@property (nonatomic,assign) float prefetchTime;
 /// How often this layer gets notified of view changes.  1s by default.
 @property (nonatomic,assign) float viewUpdatePeriod;
 /// How far the viewer has to move to force an update (if non-zero)
 @property (nonatomic,assign) float minUpdateDist;
+/** Most time (in seconds) a single evaluation step will spend working
+    through the eval queue before yielding the layer thread.  Whatever's
+    left stays queued, in importance order, and we pick it up on the next
+    pass.  8ms by default; set to 0 to evaluate without a budget.
+  */
+@property (nonatomic,assign) NSTimeInterval evalBudget;
 /// Data source for the quad tree structure
 @property (nonatomic,strong,readonly) NSObject<WhirlyKitQuadDataStructure> *dataStructure;
 /// Loader that may be creating and deleting data as the quad tiles load
@@ -183,6 +228,21 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 @property (nonatomic,assign) bool fullLoad;
 /// If fullLoad is on, we need a timeout.  Otherwise changes just pile up until we run out of memory
 @property (nonatomic,assign) NSTimeInterval fullLoadTimeout;
+/// Tile state captured from another layer's loadedTileState.  Set this
+///  before the layer starts up and it will evaluate its prior tile set
+///  in one go rather than churning down from minZoom.
+@property (nonatomic,strong) NSData *initialTileState;
+/// If set, a scheduler shared with other quad display layers.  We'll ask
+///  it before starting tile loads so the layers don't trample each other.
+@property (nonatomic,strong) WhirlyKitQuadTileScheduler *scheduler;
+/// Priority tier when sharing a scheduler.  Lower numbers outrank higher
+///  ones (give the basemap 0 and the overlays something bigger).  0 by default.
+@property (nonatomic,assign) int loadPriority;
+/// How many times to quietly retry a tile that failed to load, with
+///  increasing delays, before giving up on it.  Transient network errors
+///  otherwise leave permanent holes until the quad tree re-evaluates.
+///  Set it to 0 to turn retries off.  3 by default.
+@property (nonatomic,assign) int maxTileRetries;
 
 /// Construct with a renderer and data source for the tiles
 - (id)initWithDataSource:(NSObject<WhirlyKitQuadDataStructure> *)dataSource loader:(NSObject<WhirlyKitQuadLoader> *)loader renderer:(WhirlyKitSceneRendererES *)renderer;
@@ -208,5 +268,10 @@ typedef std::set<WhirlyKit::Quadtree::Identifier> QuadIdentSet;
 /// Call this to nudge the quad display layer awake.
 - (void)wakeUp;
 
+/// Capture which tiles the layer currently has loaded.  Hand the result
+///  to a replacement layer's initialTileState to rebuild the same
+///  arrangement on startup.  Call this on the layer thread.
+- (NSData *)loadedTileState;
+
 @end
 
@@ -23,6 +23,7 @@
 
 /// @cond
 @class WhirlyKitViewState;
+@class WhirlyKitDisplaySolid;
 @protocol WhirlyKitQuadTreeImportanceDelegate;
 /// @endcond
 
@@ -61,16 +62,45 @@ public:
         int level;
     };
 
+    /** Typed per-node attributes.  This used to be an open ended
+        NSMutableDictionary, but NodeInfo gets copied constantly during
+        evaluation and the per copy dictionary allocations added up.
+        The fields the system actually uses live here directly and the
+        whole thing copies by simple assignment (the cached values are
+        shared between copies, which is what we want).  Anything open
+        ended goes in the lazily created dictionary.
+      */
+    class NodeAttrs
+    {
+    public:
+        NodeAttrs() : dispSolid(nil), dispSolidSet(false), cachedImport(0.0), importGeneration(-1), extra(nil) { }
+        /// Cached solid used for screen importance.  May legitimately
+        ///  be nil with dispSolidSet on; that marks a degenerate tile.
+        WhirlyKitDisplaySolid *dispSolid;
+        bool dispSolidSet;
+        /// Last importance we calculated and which evaluation pass it
+        ///  belongs to.  The display layer bumps its generation when the
+        ///  view moves far enough to matter.
+        double cachedImport;
+        long importGeneration;
+        /// Open ended storage for data sources that want to keep
+        ///  something per tile.  Created on demand.
+        NSMutableDictionary *dict() { if (!extra) extra = [NSMutableDictionary dictionary];  return extra; }
+    protected:
+        NSMutableDictionary *extra;
+    };
+
     /// Quad tree node with bounding box and importance, which is possibly screen size
     class NodeInfo
     {
     public:
-        NodeInfo() { attrs = [NSMutableDictionary dictionary]; phantom = false;  importance = 0; loading = false; childrenLoading = 0; childrenEval = 0; eval = false; failed = false; childCoverage = false;}
-        NodeInfo(const NodeInfo &that) : ident(that.ident), mbr(that.mbr), importance(that.importance),phantom(that.phantom),loading(that.loading),childrenLoading(that.childrenLoading),eval(that.eval), failed(that.failed), childrenEval(that.childrenEval), childCoverage(that.childCoverage) { attrs = [NSMutableDictionary dictionaryWithDictionary:that.attrs]; }
-        NodeInfo(const Identifier &ident) : ident(ident), importance(0.0), phantom(false), loading(false), eval(false), failed(false), childrenLoading(0), childrenEval(0), childCoverage(false) { attrs = nil; }
-        NodeInfo & operator = (const NodeInfo &that) { ident = that.ident;  mbr = that.mbr;  importance = that.importance;  phantom = that.phantom; loading = that.loading; eval = that.eval;  failed = that.failed; childrenLoading = that.childrenLoading; childrenEval = that.childrenEval;  childCoverage = that.childCoverage; attrs = [NSMutableDictionary dictionaryWithDictionary:that.attrs]; return *this; }
-        ~NodeInfo() { attrs = nil; }
-        
+        NodeInfo() { phantom = false;  importance = 0; loading = false; childrenLoading = 0; childrenEval = 0; eval = false; failed = false; childCoverage = false;}
+        NodeInfo(const NodeInfo &that) : ident(that.ident), mbr(that.mbr), importance(that.importance),phantom(that.phantom),loading(that.loading),childrenLoading(that.childrenLoading),eval(that.eval), failed(that.failed), childrenEval(that.childrenEval), childCoverage(that.childCoverage), attrs(that.attrs) { }
+        NodeInfo(NodeInfo &&that) : ident(that.ident), mbr(that.mbr), importance(that.importance),phantom(that.phantom),loading(that.loading),childrenLoading(that.childrenLoading),eval(that.eval), failed(that.failed), childrenEval(that.childrenEval), childCoverage(that.childCoverage), attrs(that.attrs) { }
+        NodeInfo(const Identifier &ident) : ident(ident), importance(0.0), phantom(false), loading(false), eval(false), failed(false), childrenLoading(0), childrenEval(0), childCoverage(false) { }
+        NodeInfo & operator = (const NodeInfo &that) { ident = that.ident;  mbr = that.mbr;  importance = that.importance;  phantom = that.phantom; loading = that.loading; eval = that.eval;  failed = that.failed; childrenLoading = that.childrenLoading; childrenEval = that.childrenEval;  childCoverage = that.childCoverage; attrs = that.attrs; return *this; }
+        NodeInfo & operator = (NodeInfo &&that) { ident = that.ident;  mbr = that.mbr;  importance = that.importance;  phantom = that.phantom; loading = that.loading; eval = that.eval;  failed = that.failed; childrenLoading = that.childrenLoading; childrenEval = that.childrenEval;  childCoverage = that.childCoverage; attrs = that.attrs; return *this; }
+
         /// Compare based on importance.  Used for sorting
         bool operator < (const NodeInfo &that) const;
         
@@ -95,9 +125,9 @@ public:
         /// This tile is covered by loaded children.
         bool childCoverage;
 
-        /// Put any attributes you'd like to keep track of here.
-        /// There are things you might calculate for a given tile over and over.
-        NSMutableDictionary *attrs;
+        /// Attributes we calculate for a given tile over and over.
+        /// Copies share the cached values rather than recalculating.
+        NodeAttrs attrs;
     };
 
     /// Check if the given tile is already present
@@ -175,6 +205,10 @@ public:
     
     /// Return the IDs for this node's children.  Doesn't check if they're there
     void childrenForNode(const Identifier &ident,std::vector<Identifier> &childIdents);
+
+    /// Fill in the identifiers of every node that's actually loaded
+    ///  (not a phantom).  Used to snapshot a layer's state.
+    void getLoadedNodeIdents(std::vector<Identifier> &idents);
     
     /// Check if a parent is in the process of loading
     bool parentIsLoading(const Identifier &ident);
@@ -238,9 +272,12 @@ protected:
         friend class Quadtree;
     public:
         Node(Quadtree *tree);
-        
+        /// Reset to a fresh state.  Used when a node comes back out
+        ///  of the free pool.
+        void init(Quadtree *tree);
+
         NodeInfo nodeInfo;
-        
+
         void addChild(Quadtree *tree,Node *child);
         void removeChild(Quadtree *tree,Node *child);
         bool hasChildren();
@@ -260,6 +297,11 @@ protected:
         
     Node *getNode(const Identifier &ident);
     void removeNode(Node *);
+    /// Nodes come from here rather than new/delete.  Fast navigation
+    ///  adds and removes tiles thousands of times a second, so at
+    ///  steady state the churn shouldn't be allocating at all.
+    Node *allocNode();
+    void freeNode(Node *node);
     /// Recalculate child coverage for a node and its parents
     void recalcCoverage(Node *node);
 
@@ -277,6 +319,8 @@ protected:
     NodesBySizeType nodesBySize;
     // Nodes we're evaluating
     NodesBySizeType evalNodes;
+    // Nodes waiting to be reused
+    std::vector<Node *> freeNodes;
 };
 
 }
@@ -284,6 +328,6 @@ protected:
 /// Fill in this protocol to return the importance value for a given tile.
 @protocol WhirlyKitQuadTreeImportanceDelegate
 /// Return a number signifying importance.  MAXFLOAT is very important, 0 is not at all
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr tree:(WhirlyKit::Quadtree *)tree attrs:(NSMutableDictionary *)attrs;
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)mbr tree:(WhirlyKit::Quadtree *)tree attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs;
 @end
 
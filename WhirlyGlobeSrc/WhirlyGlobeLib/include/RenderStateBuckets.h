@@ -0,0 +1,89 @@
+/*
+ *  RenderStateBuckets.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 5/14/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <map>
+#import <set>
+#import <vector>
+#import "Identifiable.h"
+#import "Drawable.h"
+
+namespace WhirlyKit
+{
+
+/** The state key captures the OpenGL state a drawable binds when it
+    draws.  Drawables that share a key can be drawn back to back with
+    almost no state changes between them.
+  */
+class DrawStateKey
+{
+public:
+    DrawStateKey() : drawPriority(0), requestZBuffer(false), programId(EmptyIdentity), texId(EmptyIdentity) { }
+    /// Pull the state out of the given drawable
+    DrawStateKey(Drawable *draw);
+
+    /// Draw priority is a hard ordering requirement, so that goes first.
+    /// After that we just group like state together.
+    bool operator < (const DrawStateKey &that) const;
+
+    unsigned int drawPriority;
+    bool requestZBuffer;
+    SimpleIdentity programId;
+    SimpleIdentity texId;
+};
+
+/** The render state buckets keep the scene's drawables sorted by the
+    GL state they'll bind (program, texture, z buffer mode).  The
+    buckets persist between frames and are patched incrementally as
+    drawables come and go, so the frame loop can walk them in order
+    rather than re-sorting and re-binding the whole scene every frame.
+  */
+class RenderStateBuckets
+{
+public:
+    RenderStateBuckets() { }
+
+    /// Add a drawable to the bucket its current state implies
+    void addDrawable(DrawableRef draw);
+    /// Remove a drawable from whichever bucket we filed it under
+    void remDrawable(DrawableRef draw);
+    /// Call this after a change request modifies a drawable.
+    /// If its state key changed we'll move it to the right bucket.
+    void updateDrawable(DrawableRef draw);
+
+    /// Append all the drawables to the given list, walking buckets in
+    ///  sorted key order.  The result is ordered by draw priority with
+    ///  state changes minimized within each priority.
+    void appendDrawables(std::vector<DrawableRef> &drawList) const;
+
+    /// Number of drawables we're tracking
+    unsigned int getCount() const { return (unsigned int)keyMap.size(); }
+
+protected:
+    typedef std::set<DrawableRef,IdentifiableRefSorter> DrawableSet;
+    typedef std::map<DrawStateKey,DrawableSet> BucketMap;
+    BucketMap buckets;
+
+    /// The bucket each drawable is currently filed under.  Removal
+    ///  goes through this so it doesn't depend on drawable state that
+    ///  may have changed since the add.
+    std::map<SimpleIdentity,DrawStateKey> keyMap;
+};
+
+}
@@ -28,6 +28,11 @@
 
 #import <vector>
 #import <set>
+#import <unordered_map>
+
+/// Posted on the main thread when tracked GPU memory passes the budget.
+/// Layers that can shed something should.
+#define kWKGPUMemPressureNotification @"WKGPUMemPressureNotification"
 #import "WhirlyVector.h"
 #import "Texture.h"
 #import "Cullable.h"
@@ -35,6 +40,7 @@
 #import "Generator.h"
 #import "ActiveModel.h"
 #import "CoordSystem.h"
+#import "RenderStateBuckets.h"
 #import "OpenGLES2Program.h"
 
 /// How the scene refers to the default triangle shader (and how you replace it)
@@ -42,6 +48,11 @@
 /// How the scene refers to the default line shader (and how you replace it)
 #define kSceneDefaultLineShader "Default Line Shader"
 
+/// Notification posted (on the submitting thread) when a change request
+///  lands on an empty queue.  The on demand render scheduler listens for
+///  this so tile loads and such wake a sleeping display link.
+#define kWhirlyKitSceneChangesPending @"WhirlyKitSceneChangesPending"
+
 /// @cond
 @class WhirlyKitSceneRendererES;
 @class WhirlyKitFontTextureManager;
@@ -54,6 +65,7 @@ class Scene;
 class SubTexture;
 class ScreenSpaceGenerator;
 class ViewPlacementGenerator;
+class SceneSnapshotWriter;
 
 /// Request that the renderer add the given texture.
 /// This will make it available for use, referenced by ID.
@@ -68,6 +80,9 @@ public:
 
     /// Texture creation generally wants a flush
     virtual bool needsFlush() { return true; }
+
+    /// Pass along the texture's upload cost for the frame budget
+    virtual size_t uploadSize() { return tex ? tex->uploadSize() : 0; }
     
     /// Create the texture on its native thread
     virtual void setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memManager) { if (tex) tex->createInGL(memManager); };
@@ -82,6 +97,25 @@ protected:
 	TextureBase *tex;
 };
 
+/** Replace the image behind an existing texture.  The texture keeps its
+    ID and GL storage, so the drawables using it pick the new image up
+    without any retexture requests.  The data must match the original
+    texture's size and format.
+  */
+class UpdateTextureReq : public ChangeRequest
+{
+public:
+    /// Construct with the texture ID and the new raw image data
+    UpdateTextureReq(SimpleIdentity texId,NSData *texData) : texture(texId), texData(texData) { }
+
+    /// Update the texture.  Never call this.
+    void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+protected:
+    SimpleIdentity texture;
+    NSData *texData;
+};
+
 /// Remove a texture referred to by ID
 class RemTextureReq : public ChangeRequest
 {
@@ -89,13 +123,34 @@ public:
     /// Construct with the ID
 	RemTextureReq(SimpleIdentity texId) : texture(texId) { }
 
+    /// Deletions can wait a frame when we're busy
+    int priority() { return PriorityDeletion; }
+
     /// Remove from the renderer.  Never call this.
 	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
-	
+
 protected:
 	SimpleIdentity texture;
 };
 
+/// Remove a whole set of textures in one request.  Layer teardown
+///  uses this so dropping a loaded layer is one change, not thousands.
+class RemTextureSetReq : public ChangeRequest
+{
+public:
+    /// Construct with the IDs to remove
+    RemTextureSetReq(const SimpleIDSet &texIDs) : textures(texIDs) { }
+
+    /// Deletions can wait a frame when we're busy
+    int priority() { return PriorityDeletion; }
+
+    /// Remove from the renderer.  Never call this.
+    void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+protected:
+    SimpleIDSet textures;
+};
+
 /// Ask the renderer to add the drawable to the scene
 class AddDrawableReq : public ChangeRequest
 {
@@ -112,8 +167,11 @@ public:
     virtual void setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memManager) { if (drawable) drawable->setupGL(setupInfo, memManager); };
 
 	/// Add to the renderer.  Never call this
-	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);	
-	
+	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+    /// Only use this if you've thought it out
+    Drawable *getDrawable() { return drawable; }
+
 protected:
 	Drawable *drawable;
 };
@@ -125,12 +183,33 @@ public:
     /// Construct with the drawable ID and an optional fade interval
 	RemDrawableReq(SimpleIdentity drawId) : drawable(drawId) { }
 
+    /// Deletions can wait a frame when we're busy
+    int priority() { return PriorityDeletion; }
+
     /// Remove the drawable.  Never call this
 	void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
-	
-protected:	
+
+protected:
 	SimpleIdentity drawable;
-};	
+};
+
+/// Remove a whole set of drawables in one request, the drawable
+///  counterpart to RemTextureSetReq
+class RemDrawableSetReq : public ChangeRequest
+{
+public:
+    /// Construct with the IDs to remove
+    RemDrawableSetReq(const SimpleIDSet &drawIDs) : drawables(drawIDs) { }
+
+    /// Deletions can wait a frame when we're busy
+    int priority() { return PriorityDeletion; }
+
+    /// Remove the drawables.  Never call this
+    void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view);
+
+protected:
+    SimpleIDSet drawables;
+};
 
 /// Add a Drawable Generator to the scene
 class AddGeneratorReq : public ChangeRequest
@@ -222,14 +301,82 @@ protected:
     NSObject * __strong noteObj;
 };
         
+/** Lock free multiple producer, single consumer queue for change
+    requests.  Producers push whole batches as single nodes with an
+    atomic swap, so layer threads don't contend on a mutex, and the
+    render thread drains everything once a frame.
+  */
+class ChangeRequestQueue
+{
+public:
+    ChangeRequestQueue();
+    ~ChangeRequestQueue();
+
+    /// Add a batch of changes as a single node.  Any thread, no locking.
+    void push(const ChangeSet &changes);
+    /// Add a single change.  Any thread, no locking.
+    void push(ChangeRequest *change);
+
+    /// True if there's anything waiting
+    bool hasChanges() const;
+    /// Rough count of the requests waiting, for the perf timers
+    int count() const;
+
+    /// Bumped on every push and never reset.  Renderers sharing a
+    ///  scene use it to notice content another renderer already drained.
+    int32_t getGeneration() const { return generation; }
+
+    /// Pull everything off the queue in submission order.
+    /// Only the render thread should call this.
+    void drain(ChangeSet &changes);
+
+protected:
+    /// One node per submitted batch
+    class Node
+    {
+    public:
+        ChangeSet changes;
+        /// When the batch was submitted, so the profiling builds can
+        ///  report how long changes sit before the renderer runs them
+        NSTimeInterval when;
+        Node *next;
+    };
+    Node * volatile head;
+    volatile int32_t numChanges;
+    volatile int32_t generation;
+};
+
 /// Sorted set of generators
 typedef std::set<Generator *,IdentifiableSorter> GeneratorSet;
     
-typedef std::set<DrawableRef,IdentifiableRefSorter> DrawableRefSet;
+/// Drawables hashed by ID.  Change processing looks these up for
+///  every request, so we want O(1) rather than a tree walk.
+typedef std::unordered_map<SimpleIdentity,DrawableRef> DrawableRefSet;
 
 typedef std::set<OpenGLES2Program *,IdentifiableSorter> OpenGLES2ProgramSet;
 typedef std::map<std::string,OpenGLES2Program *> OpenGLES2ProgramMap;
-    
+
+/** One subsystem's slice of the memory census.  The census comes back
+    as a tree: the scene at the root, the subsystems below it, and
+    whatever breakdown a subsystem cares to report below that.  The
+    byte counts are estimates, not ground truth.
+ */
+class MemoryCensusEntry
+{
+public:
+    MemoryCensusEntry() : bytes(0), count(0) { }
+    MemoryCensusEntry(const std::string &name) : name(name), bytes(0), count(0) { }
+
+    /// What this entry covers
+    std::string name;
+    /// Estimated bytes retained
+    size_t bytes;
+    /// How many objects that covers, where counting makes sense
+    int count;
+    /// Breakdown within the subsystem, if it has one
+    std::vector<MemoryCensusEntry> children;
+};
+
 /** The scene manager is a base class for various functionality managers
     associated with a scene.  These are the objects that build geometry,
     manage layout, selection, and so forth for a scene.  They typically
@@ -247,7 +394,11 @@ public:
 
     /// Set the scene we're part of
     virtual void setScene(Scene *inScene) { scene = inScene; }
-    
+
+    /// Fill in the given census entry with what this manager is holding.
+    /// Managers sitting on real bookkeeping should override this.
+    virtual void memoryCensus(MemoryCensusEntry &entry) { }
+
 protected:
     Scene *scene;
     WhirlyKitSceneRendererES * __weak renderer;
@@ -292,7 +443,35 @@ public:
     
     /// True if there are pending updates
     bool hasChanges();
-    
+
+    /// Generation number that bumps whenever changes come in and never
+    ///  goes down.  Each renderer sharing the scene compares it against
+    ///  the last generation it drew, so all of them notice new content,
+    ///  not just the one that drains the queue.
+    int32_t getChangeGeneration() { return changeRequests.getGeneration() + preheatRequests.getGeneration(); }
+
+    /// Set the texture upload byte budget per frame (0 for no limit).
+    /// Changes past the budget hold over to the next frame in submission
+    ///  order, so geometry enables still follow the uploads they need.
+    void setPerFrameUploadBudget(size_t bytes) { perFrameUploadBudget = bytes; }
+
+    /// Cap the number of changes we'll execute in one frame (0 for no
+    ///  limit).  The rest carry over in submission order, except that
+    ///  interactive toggles aimed at drawables already in the scene
+    ///  still go through, so a big load burst can't freeze the UI.
+    void setPerFrameChangeLimit(int numChanges) { perFrameChangeLimit = numChanges; }
+
+    /// Rough count of changes waiting on the render thread.  The layer
+    ///  threads use this to back off merging when we're buried.
+    int changeQueueDepth() { return changeRequests.count() + (int)deferredChanges.size(); }
+
+    /// Add changes that warm resources up ahead of need, such as the
+    ///  tile loads for a layer that hasn't been enabled yet.  These
+    ///  drain ahead of the regular changes each frame, so anything
+    ///  submitted later that references them stays correct, and the
+    ///  upload budget spreads the actual GL work over several frames.
+    void addPreheatChangeRequests(const ChangeSet &newChanges);
+
     /// Add sub texture mappings.
     /// These are mappings from images to parts of texture atlases.
     /// They're here so we can use SimpleIdentity's to point into larger
@@ -338,6 +517,9 @@ public:
     
     /// Return the top level cullable
     CullTree *getCullTree() { return cullTree; }
+
+    /// Return the render state buckets.  Only the renderer should walk these.
+    RenderStateBuckets *getRenderStateBuckets() { return &renderStateBuckets; }
     
     /// Explicitly tear everything down in OpenGL ES.
     /// We're assuming the context has been set.
@@ -351,13 +533,30 @@ public:
     /// The idea here is we'll wait for these to drain when we tear down.
     dispatch_queue_t getDispatchQueue() { return dispatchQueue; }
     
-    // Return all the drawables in a list.  Only call this on the main thread.
+    // Return all the drawables, hashed by ID.  Only call this on the main thread.
     const DrawableRefSet &getDrawables();
 	
     /// Dump out stats on what is currently in the scene.
     /// Use this sparingly, as it writes to the log.
     void dumpStats();
-	
+
+    /// Fill in a tree of estimated bytes by subsystem.  Cheap enough to
+    ///  run on a timer when chasing memory pressure.  Call it on the
+    ///  main thread, since it walks the drawables.
+    void memoryCensus(MemoryCensusEntry &rootEntry);
+
+    /// Point the layer threads' change request tap at a snapshot writer.
+    /// Pass NULL to stop capturing.  We don't own the writer.
+    void setSnapshotWriter(SceneSnapshotWriter *newWriter) { snapshotWriter = newWriter; }
+
+    /// The snapshot writer capturing changes, if there is one
+    SceneSnapshotWriter *getSnapshotWriter() { return snapshotWriter; }
+
+    /// Reverse lookup of the scene name (if any) for a program ID.
+    /// The scene snapshot uses this so drawables can name their shader
+    ///  in a way that survives a relaunch.
+    std::string getSceneNameForProgramID(SimpleIdentity progId);
+
 public:
     /// Don't be calling this
     void setDisplayAdapter(CoordSystemDisplayAdapter *newCoordAdapter);
@@ -385,21 +584,34 @@ public:
     /// Top level of Cullable quad tree
     CullTree *cullTree;
 	
-	/// All the drawables we've been handed, sorted by ID
+	/// All the drawables we've been handed, hashed by ID
 	DrawableRefSet drawables;
+
+    /// Drawables bucketed by render state, kept up to date by the subclasses
+    RenderStateBuckets renderStateBuckets;
 	
-	typedef std::set<TextureBase *,IdentifiableSorter> TextureSet;
-	/// Textures, sorted by ID
+	typedef std::unordered_map<SimpleIdentity,TextureBase *> TextureSet;
+	/// Textures, hashed by ID
 	TextureSet textures;
     
     /// Mutex for accessing textures
     pthread_mutex_t textureLock;
 	
-	pthread_mutex_t changeRequestLock;
-	/// We keep a list of change requests to execute
-	/// This can be accessed in multiple threads, so we lock it
-	ChangeSet changeRequests;
-    
+	/// We keep a queue of change requests to execute.
+	/// Any thread can push on to this without locking.
+	ChangeRequestQueue changeRequests;
+
+    /// Changes held over when uploads ran past the frame budget.
+    /// Render thread only.
+    ChangeSet deferredChanges;
+    /// Texture upload bytes we'll allow per frame (0 means no limit)
+    size_t perFrameUploadBudget;
+    /// Changes we'll execute per frame (0 means no limit)
+    int perFrameChangeLimit;
+
+    /// Warm up changes.  Drained ahead of the regular queue.
+    ChangeRequestQueue preheatRequests;
+
     pthread_mutex_t subTexLock;
     typedef std::set<SubTexture> SubTextureSet;
     /// Mappings from images to parts of texture atlases
@@ -424,7 +636,11 @@ public:
     ViewPlacementGenerator *vpGen;
     
     /// Lock for accessing managers
-    pthread_mutex_t managerLock;
+    /** Guards the manager table.  Lookups far outnumber registration,
+        so readers share the lock.  Lock order for anyone touching more
+        than one: managerLock first, then any individual manager's own
+        lock.  Never take managerLock while holding a manager's lock. */
+    pthread_rwlock_t managerLock;
 
     /// Managers for various functionality
     std::map<std::string,SceneManager *> managers;
@@ -478,6 +694,10 @@ protected:
     /// Init call used by the base class to set things up
     void Init(WhirlyKit::CoordSystemDisplayAdapter *adapter,Mbr localMbr,unsigned int depth);
 
+    /// Snapshot writer tapping the change requests, if there is one.
+    /// We don't own it.
+    SceneSnapshotWriter *snapshotWriter;
+
     /// All the OpenGL ES 2.0 shader programs we know about
     OpenGLES2ProgramSet glPrograms;
     
@@ -0,0 +1,49 @@
+/*
+ *  SceneGraphLayer.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import "DataLayer.h"
+#import "LayerThread.h"
+#import "SceneGraphManager.h"
+
+/** The scene graph layer drives a SceneGraphManager from the layer
+    thread.  It watches the view and re-runs the scene graph traversal
+    as the viewer moves, which is what makes the LOD nodes switch.
+    Hand it scene graph fragments built out of the node classes in
+    SceneGraphManager.h.  The drawables the fragments refer to can be
+    owned elsewhere (e.g. by the shape or vector managers); this layer
+    just turns them on and off.
+  */
+@interface WhirlyKitSceneGraphLayer : NSObject<WhirlyKitLayer>
+
+/// Called in the layer thread
+- (void)startWithThread:(WhirlyKitLayerThread *)layerThread scene:(WhirlyKit::Scene *)scene;
+
+/// Add the given fragment at the top level (or at attachID if it's set).
+/// The layer takes over ownership of the nodes.  Layer thread only.
+- (void)addSceneFragment:(WhirlyKit::SceneGraphNode *)node attachID:(WhirlyKit::SimpleIdentity)attachID;
+
+/// Remove the given fragment and everything under it.  Layer thread only.
+- (void)removeSceneFragment:(WhirlyKit::SimpleIdentity)nodeID;
+
+/// Clean up after ourselves
+- (void)shutdown;
+
+@end
@@ -153,10 +153,17 @@ public:
 @property (nonatomic,strong) NSArray *lights;
 /// State optimizer.  Used when setting state for drawing
 @property (nonatomic,strong) WhirlyKitOpenGLStateOptimizer *stateOpt;
+/// Set when the renderer is visualizing overdraw.  Drawables render at
+///  a fixed dim level so the additive blend adds up per pixel.
+@property (nonatomic,assign) bool overdrawMode;
 
 // Make a copy of the frame info
 - (id)initWithFrameInfo:(WhirlyKitRendererFrameInfo *)info;
 
+// Copy the fields in from another frame info, reusing this object.
+// The renderer pools frame infos to keep the frame loop off the heap
+- (void)setFromFrameInfo:(WhirlyKitRendererFrameInfo *)info;
+
 @end
 
 /** We support three different ways of using z buffer.  (1) Regular mode where it's on.
@@ -179,13 +186,21 @@ typedef enum {zBufferOn,zBufferOff,zBufferOffDefault} WhirlyKitSceneRendererZBuf
 	unsigned int frameCount;
 	NSTimeInterval frameCountStart;
     WhirlyKit::PerformanceTimer perfTimer;
-        
+    /// Block the frame time alert calls, if one is set
+    void (^frameTimeAlertBlock)(double p95Ms);
+
     /// Last time we rendered
     NSTimeInterval lastDraw;
     
     /// Something wants to make sure we render until at least this point.
     NSTimeInterval renderUntil;
-    
+
+    /// Screen region the current frame's changes will touch, if we're
+    ///  tracking damage.  Invalid if nothing has been declared yet.
+    WhirlyKit::Mbr damageMbr;
+    /// Set if something changed that we can't bound on screen
+    bool fullDamage;
+
     WhirlyKit::RGBAColor _clearColor;
 }
 
@@ -230,9 +245,34 @@ typedef enum {zBufferOn,zBufferOff,zBufferOffDefault} WhirlyKitSceneRendererZBuf
 /// Force a draw at the next opportunity
 @property (nonatomic,assign) bool triggerDraw;
 
+/// If set, we'll try to limit a frame to the screen regions its change
+///  requests declare, using the scissor test.  The EAGL layer must have
+///  retained backing turned on or the rest of the screen is garbage.
+/// Any change we can't bound (and any view movement) falls back to a
+///  full redraw, so it's safe to leave on for mostly static content.
+@property (nonatomic,assign) bool scissorDamageMode;
+
+/// Diagnostic overdraw mode.  Depth testing is forced off and every
+///  drawable renders additively at a fixed dim level, so the brightness
+///  of a pixel is a direct read of how many layers drew there.  While
+///  it's on, the culling pass also feeds an estimated fragment cost
+///  (cull node screen area times drawables merged) to the profiler,
+///  so runs before and after a change can be compared by number.
+@property (nonatomic,assign) bool overdrawMode;
+
+/// Scene change generation the last drawn frame included.  Several
+///  renderers can share one scene; each tracks its own generation so
+///  all of them pick up content whichever one drained the change queue.
+@property (nonatomic,assign) int32_t lastDrawnGeneration;
+
 /// Initialize with API version
 - (id) initWithOpenGLESVersion:(EAGLRenderingAPI)apiVersion;
 
+/// Initialize with API version, joining the given sharegroup (may be
+///  nil).  Renderers in one sharegroup draw the same GL resources, so
+///  a second view onto a scene doesn't duplicate its memory.
+- (id) initWithOpenGLESVersion:(EAGLRenderingAPI)apiVersion sharegroup:(EAGLSharegroup *)sharegroup;
+
 /// Render to the screen, ideally within the given duration.
 /// The subclasses fill this in
 - (void)render:(NSTimeInterval)duration;
@@ -240,6 +280,16 @@ typedef enum {zBufferOn,zBufferOff,zBufferOffDefault} WhirlyKitSceneRendererZBuf
 /// Called when the layer gets resized.  Need to resize ourselves
 - (BOOL)resizeFromLayer:(CAEAGLLayer *)layer;
 
+/// Size the framebuffer for offscreen rendering, with no CAEAGLLayer
+///  behind it.  Used for headless rendering (e.g. the benchmark harness).
+- (BOOL)resizeToWidth:(int)width height:(int)height;
+
+/// Clear the performance timers ahead of a measured run
+- (void)resetPerfTimer;
+
+/// JSON report from the performance timers, for benchmark tooling
+- (NSString *)perfTimerReport;
+
 /// Call this before defining things within the OpenGL context
 - (void)useContext;
 
@@ -251,6 +301,33 @@ typedef enum {zBufferOn,zBufferOff,zBufferOffDefault} WhirlyKitSceneRendererZBuf
 /// This turns off the draw optimization, but just for one frame.
 - (void)forceDrawNextFrame;
 
+/// Check if anything wants to draw, without consuming the draw trigger.
+/// The on demand render scheduler in the EAGL view uses this.
+- (bool)hasRenderWork;
+
+/// Copy out the recent frame samples (CPU/GPU time and counts), oldest first.
+/// Cheap enough to call from production diagnostics.
+- (void)getFrameSamples:(std::vector<WhirlyKit::PerformanceTimer::FrameSample> &)samples;
+
+/// Compact telemetry snapshot as a dictionary the app can ship to its
+///  analytics: frame time percentiles over the recent sample ring, per
+///  frame averages, and the process wide telemetry counters.  Cheap
+///  enough to call every few seconds in production.
+- (NSDictionary *)telemetrySnapshot;
+
+/// Ask for the block to be called (on the rendering thread) when frame
+///  time p95 crosses the given threshold in ms, so the app can shed load
+///  proactively.  Pass nil to turn the alert off.
+- (void)setFrameTimeAlertThreshold:(double)thresholdMs callback:(void (^)(double p95Ms))callback;
+
+/// Declare a screen region (framebuffer coordinates) the current frame's
+///  changes will touch.  Only means anything in scissor damage mode.
+- (void)addDamageRect:(WhirlyKit::Mbr)damage;
+
+/// Note that something changed this frame that we can't bound on screen.
+/// Forces a full redraw.
+- (void)addFullDamage;
+
 /// Use this to set the clear color for the screen.  Defaults to black
 - (void)setClearColor:(UIColor *)inClearColor;
 
@@ -92,10 +92,36 @@
 ///  but it does mean you can't mess with the rendering context.
 @property (nonatomic,assign) bool dispatchRendering;
 
+/// If set before the scene is assigned, the default shaders compile on
+///  a worker thread (in a sharegroup context) while startup continues.
+/// The first frame waits for them if they're not done yet.
+@property (nonatomic,assign) bool asyncShaderSetup;
+
 /// Set if we want a screenshot on the next draw
 @property (nonatomic,weak) NSObject<WhirlyKitSnapshot> *snapshotDelegate;
 
+/// Dynamic resolution.  When the measured GPU frame cost runs past the
+///  target below, the scene renders into a scaled color buffer and a
+///  final blit upscales it to the screen, trading a little sharpness
+///  for fragment time on heavy scenes.  Needs the GPU timer extension;
+///  without it (and under scissorDamageMode) we stay at native.
+@property (nonatomic,assign) bool dynamicResolution;
+
+/// GPU frame budget (seconds) dynamic resolution steers toward
+@property (nonatomic,assign) NSTimeInterval dynamicResTargetGPUTime;
+
+/// The scale dynamic resolution is currently rendering at (1 = native)
+@property (nonatomic,readonly) float renderScale;
+
 // Used by a subclass
 - (id) initWithVersion:(EAGLRenderingAPI)apiVersion;
 
+// Used by a subclass
+- (id) initWithVersion:(EAGLRenderingAPI)apiVersion sharegroup:(EAGLSharegroup *)sharegroup;
+
+/// Like init, but the GL context joins the given sharegroup.  Use this
+///  for a second renderer drawing the same scene, so drawables and
+///  textures are shared rather than duplicated per view.
+- (id) initWithSharegroup:(EAGLSharegroup *)sharegroup;
+
 @end
@@ -24,6 +24,10 @@
 #import <OpenGLES/ES3/glext.h>
 
 /** OpenGL ES 3.0 support.
+    Rendering runs through the ES2 code paths, but the drawables pick
+    up the ES3 extras when this context is current: core instanced
+    draws, glMapBufferRange uploads, and sync fences guarding the big
+    drawable buffer rings.
   */
 @interface WhirlyKitSceneRendererES3 : WhirlyKitSceneRendererES2
 
@@ -31,4 +35,7 @@
 //  then create a 2.0 version
 - (id)init;
 
+// Same, but joining the given sharegroup for multi-view rendering
+- (id)initWithSharegroup:(EAGLSharegroup *)sharegroup;
+
 @end
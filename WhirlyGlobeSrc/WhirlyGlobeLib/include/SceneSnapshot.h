@@ -0,0 +1,122 @@
+/*
+ *  SceneSnapshot.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 5/19/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import <vector>
+#import <string>
+#import "Scene.h"
+#import "Texture.h"
+#import "Drawable.h"
+
+namespace WhirlyKit
+{
+
+/// Append raw bytes to a snapshot buffer.
+/// These little helpers are shared by everyone who writes snapshot records.
+void SnapshotAppend(NSMutableData *data,const void *bytes,size_t len);
+/// Append a length prefixed string
+void SnapshotAppendString(NSMutableData *data,const std::string &str);
+/// Read raw bytes back out, checking we don't run off the end
+bool SnapshotRead(const unsigned char *&ptr,const unsigned char *end,void *bytes,size_t len);
+/// Read a length prefixed string back out
+bool SnapshotReadString(const unsigned char *&ptr,const unsigned char *end,std::string &str);
+
+/** The Scene Snapshot Writer collects textures and drawables as the
+    layer threads hand them over and writes them into a binary warm
+    boot image.  Building our standard scene from API calls is seconds
+    of deterministic layer thread work; reading it back out of a file
+    is one pass over mapped memory.
+
+    Capture works at the change request tap in the layer thread, before
+    setupGL() strips the CPU side arrays.  Only plain Textures and
+    BasicDrawables round trip; atlas contents and the dynamic drawables
+    are skipped and counted.  The invalidation key is compared on load,
+    so bake your style/data versions into it and a stale snapshot is
+    simply ignored.
+ */
+class SceneSnapshotWriter : public DelayedDeletable
+{
+public:
+    /// Construct with the file we'll write on close and the caller's
+    ///  invalidation key
+    SceneSnapshotWriter(NSString *fileName,const std::string &invalidationKey);
+    virtual ~SceneSnapshotWriter();
+
+    /// Look at a change request on its way into the scene and capture
+    ///  anything we know how to serialize.  Called on the layer threads.
+    void captureChange(Scene *scene,ChangeRequest *change);
+
+    /// Write the file out.  Returns false if anything went wrong along
+    ///  the way, in which case no file is left behind.
+    bool close();
+
+    /// Number of changes we saw but couldn't serialize
+    int getNumSkipped() { return numSkipped; }
+
+protected:
+    void addTexture(Texture *tex);
+    void addDrawable(Scene *scene,BasicDrawable *draw);
+
+    NSString *fileName;
+    std::string invalidationKey;
+    /// Several layer threads can feed us at once
+    pthread_mutex_t writeLock;
+    NSMutableData *texData,*drawData;
+    int numTextures,numDrawables;
+    int numSkipped;
+};
+
+/** The Scene Snapshot Reader maps a warm boot image written by the
+    SceneSnapshotWriter and turns it back into add change requests.
+    Run the resulting changes through a layer thread so the GL setup
+    happens in the usual place.  Texture IDs are assigned fresh on the
+    way in and the drawables remapped to match, so a snapshot composes
+    with anything else the app is loading.
+  */
+class SceneSnapshotReader
+{
+public:
+    /// Construct with the file to map.  Check isValid() before load().
+    SceneSnapshotReader(NSString *fileName);
+    ~SceneSnapshotReader();
+
+    /// True if the file mapped, the header checks out and the
+    ///  invalidation key matches
+    bool isValid(const std::string &invalidationKey);
+
+    /// Rebuild the textures and drawables into change requests.
+    /// We hand back the IDs we created so the caller can tear the
+    ///  snapshot down once the live layers have caught up.
+    bool load(Scene *scene,ChangeSet &changes,SimpleIDSet &texIDs,SimpleIDSet &drawIDs);
+
+protected:
+    /// The mapped file
+    NSData *fileData;
+    /// The decompressed record section.  Records point into this,
+    ///  so it stays around.
+    NSData *recordData;
+    bool valid;
+    std::string fileKey;
+    int numTextures,numDrawables;
+    /// Where the texture records start
+    const unsigned char *recordStart;
+};
+
+}
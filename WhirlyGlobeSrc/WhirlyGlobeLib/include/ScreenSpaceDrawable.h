@@ -0,0 +1,57 @@
+/*
+ *  ScreenSpaceDrawable.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/24/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "Drawable.h"
+
+namespace WhirlyKit
+{
+
+// Shader name for accessing within the scene
+#define kScreenSpaceShaderName "Screen Space Shader"
+
+/// Construct and return the screen space shader program
+OpenGLES2Program *BuildScreenSpaceProgram();
+
+/** The drawable class for screen space objects that are projected
+    on the GPU.  Each vertex carries the world location of its shape's
+    center, its corner offset in screen points and (optionally) a world
+    space rotation direction.  The vertex shader does the projection,
+    so we build this geometry once rather than every frame.
+  */
+class ScreenSpaceDrawable : public BasicDrawable
+{
+public:
+    ScreenSpaceDrawable();
+
+    /// Corner offset from the center, in screen points
+    void addOffset(const Point2f &offset);
+
+    /// World space direction used to work out the screen rotation.
+    /// Pass (0,0,0) for shapes that don't rotate.
+    void addRotDir(const Point3f &dir);
+
+    /// We override draw so we can set our own values
+    virtual void draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+
+protected:
+    int offsetIndex,rotDirIndex;
+};
+
+}
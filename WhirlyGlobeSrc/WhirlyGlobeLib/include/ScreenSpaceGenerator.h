@@ -103,6 +103,9 @@ public:
         Point2d offset;
         /// false if we're not to draw this one
         bool enable;
+        /// Set if the layout engine controls our offset.  Those shapes
+        ///  stay on the CPU projection path.
+        bool layout;
         
         /// List of geometry we'll transform to the destination
         std::vector<SimpleGeometry> geom;
@@ -133,21 +136,71 @@ public:
     /// Use this to change the enable (on/off).  We keep a cache of active shapes,
     ///  so always use this.
     void changeEnable(ConvexShape *shape,bool enable);
+
+    /// Move a shape to a new world location, keeping the spatial index
+    ///  up to date.  Use this rather than poking worldLoc directly.
+    void moveShape(ConvexShape *shape,const Point3d &worldLoc);
     
+    /// Throw out the cached GPU drawables.  The change requests call this
+    ///  when they modify shapes behind our back.
+    void dirtyGPUDrawables();
+
     /// Get the projected points from the last frame.
     /// This will lock, make a copy and unlock so go wild.
     void getProjectedPoints(std::vector<ProjectedPoint> &projPoints);
+
+    /// Return where the given shape last landed on screen, its current 2D
+    ///  offset and a bounding radius (in points) for its geometry.  The
+    ///  change requests use this to work out damage regions.  Returns false
+    ///  if the shape wasn't projected last frame, so the caller has to
+    ///  assume the whole screen.
+    bool getShapeDamage(SimpleIdentity shapeID,Point2d &screenLoc,Point2d &offset,double &radius);
     
     /// Print stats for debugging
     void dumpStats();
     
 protected:
     typedef std::set<ConvexShape *,IdentifiableSorter> ConvexShapeSet;
+
+    /** A single cell in the world space grid.  We test these against
+        the frustum as a group before projecting their shapes, so the
+        far off screen ones never pay for the matrix math.
+      */
+    class ShapeCell
+    {
+    public:
+        ShapeCell() : boundsValid(false) { }
+        /// Active shapes that fall within this cell
+        ConvexShapeSet shapes;
+        /// Derived world space bounding box.  Rebuilt when needed.
+        bool boundsValid;
+        Point3d boundLL,boundUR;
+    };
+    typedef std::map<int,ShapeCell> ShapeCellMap;
+
+    /// Work out which grid cell the given world location lands in
+    int cellKey(const Point3d &worldLoc);
+    /// Add the shape to the world space grid
+    void indexShape(ConvexShape *shape);
+    /// Take the shape back out of the world space grid
+    void unindexShape(ConvexShape *shape);
+    /// Conservative test of a cell's bounding box against the frustum
+    bool cellOnScreen(ShapeCell &cell,const std::vector<Eigen::Matrix4d> &mvpMats);
+    /// True if the shape can be projected in the vertex shader
+    bool shapeOnGPU(ConvexShape *shape);
+    /// Rebuild the cached GPU drawables from the active shapes
+    void buildGPUDrawables(WhirlyKitRendererFrameInfo *frameInfo);
+
     ConvexShapeSet convexShapes;
     ConvexShapeSet activeShapes;
+    ShapeCellMap shapeCells;
     Point2d margin;
 	pthread_mutex_t projectedPtsLock;
     std::vector<ProjectedPoint> projectedPoints;
+    /// Geometry for the GPU projected shapes.  Built once and reused
+    ///  every frame until something changes.
+    std::vector<DrawableRef> gpuDrawables;
+    bool gpuDrawablesValid;
 };
     
 /** A Screen Space Generator Add Request comes from a layer that needs to
@@ -160,6 +213,8 @@ public:
     ScreenSpaceGeneratorAddRequest(SimpleIdentity genID,ScreenSpaceGenerator::ConvexShape *);
     /// Construct with a list of convex shapes to display
     ScreenSpaceGeneratorAddRequest(SimpleIdentity genID,const std::vector<ScreenSpaceGenerator::ConvexShape *> &);
+    /// Same, but takes the shape list rather than copying it
+    ScreenSpaceGeneratorAddRequest(SimpleIdentity genID,std::vector<ScreenSpaceGenerator::ConvexShape *> &&);
     ~ScreenSpaceGeneratorAddRequest();
     
     virtual void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,Generator *gen);
@@ -236,11 +291,42 @@ public:
     
     /// Construct with a generator ID and a list of shapes to change
     ScreenSpaceGeneratorGangChangeRequest(SimpleIdentity genID,const std::vector<ShapeChange> &changes);
-    
+
     virtual void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,Generator *gen);
-    
+
+    /// These come in a steady stream from the layout engine, so we bound
+    ///  the old and new positions of each shape for partial redraw
+    virtual bool getDamageRegion(Scene *scene,WhirlyKitSceneRendererES *renderer,Mbr &damageMbr);
+
 protected:
     std::vector<ShapeChange> changes;
 };
 
+/** Move a batch of shapes to new world locations, and optionally recolor
+    them, without touching their geometry.  This is the steady state path
+    for markers that move every second or so, like vehicles.
+  */
+class ScreenSpaceGeneratorMoveRequest : public GeneratorChangeRequest
+{
+public:
+    // New location (and maybe color) for a single shape
+    class ShapeMove
+    {
+    public:
+        ShapeMove();
+        SimpleIdentity shapeID;
+        Point3d worldLoc;
+        bool hasColor;
+        RGBAColor color;
+    };
+
+    /// Construct with a generator ID and a list of shapes to move
+    ScreenSpaceGeneratorMoveRequest(SimpleIdentity genID,const std::vector<ShapeMove> &moves);
+
+    virtual void execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,Generator *gen);
+
+protected:
+    std::vector<ShapeMove> moves;
+};
+
 }
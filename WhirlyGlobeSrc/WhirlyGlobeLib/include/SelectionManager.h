@@ -161,9 +161,46 @@ public:
     
     /// Pass in the view point where the user touched.  This returns the closest hit within the given distance
     SimpleIdentity pickObject(Point2f touchPt,float maxDist,WhirlyKitView *theView);
-    
+
+    /// Batch version of pickObject.  The projection setup is paid for once
+    ///  and all the touch points are tested together, which is what you want
+    ///  for multi-touch or per-move picking during a drag.  The return IDs
+    ///  parallel the touch points.
+    void pickObjects(const std::vector<Point2f> &touchPts,float maxDist,WhirlyKitView *theView,std::vector<SimpleIdentity> &retIds);
+
 protected:
-    pthread_mutex_t mutex;
+    /// One selectable in the bounding sphere hierarchy below
+    class PickEntry
+    {
+    public:
+        /// Which selectable set the entry lives in
+        typedef enum {Rect3DKind,PolytopeKind,BillboardKind} Kind;
+        Kind kind;
+        SimpleIdentity selectID;
+        /// Bounding sphere in display space
+        Point3f center;
+        float radius;
+    };
+    /// Node in the bounding sphere hierarchy over the 3D selectables
+    class PickNode
+    {
+    public:
+        Point3f center;
+        float radius;
+        bool leaf;
+        /// Indices into pickEntries for leaves, pickNodes otherwise
+        std::vector<unsigned int> children;
+    };
+    /// Rebuild the bounding sphere hierarchy.  Call with the write lock held.
+    void buildPickTree();
+    /// Walk the hierarchy, collecting the entries whose projected bounds
+    ///  come near any of the touch points
+    void pickTreeCandidates(const std::vector<Point2f> &touchPts,float maxDist,Eigen::Matrix4d &modelTrans,Eigen::Matrix4d &projTrans,const Point2f &frameSize,std::vector<unsigned int> &candEntries);
+
+    /// Picks run on the read side so they don't exclude each other,
+    ///  and the adds and removes from the layer threads only block
+    ///  them for the write itself
+    pthread_rwlock_t lock;
     Scene *scene;
     float scale;
     /// The selectable objects themselves
@@ -171,6 +208,12 @@ protected:
     WhirlyKit::RectSelectable2DSet rect2Dselectables;
     WhirlyKit::PolytopeSelectableSet polytopeSelectables;
     WhirlyKit::BillboardSelectableSet billboardSelectables;
+    /// Bounding sphere hierarchy over the 3D selectables.
+    /// The 2D rectangles move with the screen, so they don't get one.
+    std::vector<PickEntry> pickEntries;
+    std::vector<PickNode> pickNodes;
+    /// Root of the hierarchy, -1 if it needs a rebuild
+    int pickRoot;
 };
  
 }
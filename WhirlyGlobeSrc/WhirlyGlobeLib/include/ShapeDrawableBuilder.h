@@ -31,6 +31,7 @@
 @property (nonatomic) UIColor *color;
 @property (nonatomic,assign) float drawOffset;
 @property (nonatomic,assign) float minVis,maxVis;
+@property (nonatomic,assign) float minPix;
 @property (nonatomic,assign) int drawPriority;
 @property (nonatomic,assign) float fade;
 @property (nonatomic,assign) float lineWidth;
@@ -38,6 +39,7 @@
 @property (nonatomic,assign) bool zBufferRead;
 @property (nonatomic,assign) bool zBufferWrite;
 @property (nonatomic,assign) bool enable;
+@property (nonatomic,assign) bool optimizeTris;
 @property (nonatomic,assign) WhirlyKit::SimpleIdentity shaderID;
 
 - (id)initWithShapes:(NSArray *)shapes desc:(NSDictionary *)desc;
@@ -25,6 +25,10 @@
 #import "SelectionManager.h"
 #import "Scene.h"
 
+/// @cond
+@class WhirlyKitShapeInfo;
+/// @endcond
+
 namespace WhirlyKit
 {
     
@@ -145,8 +149,23 @@ public:
     
     /// Enable/disable a group of shapes
     void enableShapes(SimpleIDSet &shapeIDs,bool enable,ChangeSet &changes);
-    
+
+    /// Collect up the drawables behind the given shape groups.  Used when
+    ///  someone else (e.g. the scene graph) wants to run their visibility.
+    void getDrawIDs(const SimpleIDSet &shapeIDs,SimpleIDSet &drawIDs);
+
 protected:
+    /// Build a single unit sphere and per-feature instances for a large group of spheres
+    void buildSphereInstances(NSArray *spheres,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes);
+
+    /// Same idea for circles, as a unit disc.  Flat maps only, since the
+    ///  instances can't carry an orientation.
+    void buildCircleInstances(NSArray *circles,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes);
+
+    /// And for cylinders.  Flat maps only.  These all share a height to
+    ///  radius ratio, since the instances only scale uniformly.
+    void buildCylinderInstances(NSArray *cyls,float heightRatio,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes);
+
     pthread_mutex_t shapeLock;
     ShapeSceneRepSet shapeReps;
 };
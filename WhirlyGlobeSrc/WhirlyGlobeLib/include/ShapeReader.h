@@ -19,6 +19,8 @@
  */
 
 #import <math.h>
+#import <vector>
+#import <string>
 #import "VectorData.h"
 #import "GlobeMath.h"
 
@@ -27,6 +29,9 @@ namespace WhirlyKit
 
 /** Shape File Reader.
 	Open a shapefile and return the features as requested.
+    The .shp and .dbf files are memory mapped and records get decoded
+    straight out of the map on demand, so opening is cheap and memory
+    stays proportional to what you actually look at.
  */
 class ShapeReader : public VectorReader
 {
@@ -34,25 +39,46 @@ public:
     /// Construct with a file name
 	ShapeReader(NSString *fileName);
 	virtual ~ShapeReader();
-	
+
 	/// Return true if we managed to load the file
 	virtual bool isValid();
-	
+
 	/// Return the next feature
 	virtual VectorShapeRef getNextObject(const StringSet *filterAttrs);
-    
+
     /// We can do random seeking
     virtual bool canReadByIndex() { return true; }
-    
+
     /// The total number of shapes in the file
     virtual unsigned int getNumObjects();
 
     /// Fetch an object by the index
     virtual VectorShapeRef getObjectByIndex(unsigned int vecIndex,const StringSet *filter);
-    
+
 protected:
-	void *shp;
-	void *dbf;
+    // Map the given file read only
+    bool mapFile(NSString *fileName,int &fd,const unsigned char *&data,size_t &len);
+
+    // Memory mapped .shp (geometry) and .dbf (attributes)
+    int shpFd,dbfFd;
+    const unsigned char *shpData,*dbfData;
+    size_t shpLen,dbfLen;
+
+    // Offset of each geometry record within the .shp
+    std::vector<size_t> recOffsets;
+
+    // Layout of a single DBF column.  Values get decoded out of the
+    //  map on demand; this is all we ever parse up front.
+    class DbfColumn
+    {
+    public:
+        std::string name;
+        char type;
+        int offset,width,decimals;
+    };
+    std::vector<DbfColumn> dbfColumns;
+    unsigned int dbfNumRecords,dbfHeaderSize,dbfRecordSize;
+
 	int where,numEntity,shapeType;
 	double minBound[4], maxBound[4];
 };
@@ -79,6 +79,12 @@
 // Only call this if you know what you're doing
 - (void)buildDrawable:(WhirlyKit::BasicDrawable **)draw skirtDraw:(WhirlyKit::BasicDrawable **)skirtDraw enabled:(bool)enable adapter:(WhirlyKit::CoordSystemDisplayAdapter *)coordAdapter;
 
+// Append just the chunk geometry to an existing drawable, which may
+//  already contain other chunks.  Sampling density follows the chunk
+//  size when eps is set.  The outputs are for skirt building; pass
+//  NULL if you don't care.
+- (void)appendGeometry:(WhirlyKit::BasicDrawable *)drawable adapter:(WhirlyKit::CoordSystemDisplayAdapter *)coordAdapter locs:(std::vector<WhirlyKit::Point3f> *)retLocs texCoords:(std::vector<WhirlyKit::TexCoord> *)retTexCoords sampleX:(int *)retSampleX sampleY:(int *)retSampleY;
+
 @end
 
 // Used to pass chunks between main and layer threads
@@ -132,6 +138,13 @@ public:
     
     /// Add the given chunk (enabled or disabled)
     SimpleIdentity addChunk(WhirlyKitSphericalChunk *chunk,bool doEdgeMatching,bool enable,ChangeSet &changes);
+
+    /// Bake a static group of chunks down into as few drawables as we
+    ///  can manage, merging the geometry for chunks that share a
+    ///  texture.  Everything comes out as plain textures and basic
+    ///  drawables, which the scene snapshot can capture for warm boots.
+    ///  The returned ID removes the whole group at once.
+    SimpleIdentity bakeChunks(NSArray *chunks,bool enable,ChangeSet &changes);
     
     /// Modify the given chunk (new texture IDs)
     bool modifyChunkTextures(SimpleIdentity chunkID,const std::vector<SimpleIdentity> &texIDs,ChangeSet &changes);
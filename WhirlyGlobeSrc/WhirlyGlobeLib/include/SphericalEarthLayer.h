@@ -52,6 +52,13 @@ static const unsigned int SphereTessX = 10,SphereTessY = 25;
 /// That provides the images and it will generate the geometry.
 - (id)initWithTexGroup:(WhirlyKitTextureGroup *)texGroup;
 
+/// Same, but with a name for the compiled texture cache.  The first run
+///  transcodes the texture group into a single upload-ready file in the
+///  caches directory and later runs feed the GPU straight from the mapped
+///  file, skipping the per image UIImage decode.  Change the name if the
+///  imagery changes.
+- (id)initWithTexGroup:(WhirlyKitTextureGroup *)texGroup cacheName:(NSString *)cacheName;
+
 /// Called in the layer thread
 - (void)startWithThread:(WhirlyKitLayerThread *)layerThread scene:(WhirlyKit::Scene *)scene;
 
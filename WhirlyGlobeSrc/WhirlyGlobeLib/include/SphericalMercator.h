@@ -48,7 +48,16 @@ public:
     /// Convert from display coordinates to geocentric
     Point3f geocentricToLocal(Point3f);
     Point3d geocentricToLocal(Point3d);
-    
+
+    /// Batch versions.  One pass of the projection trig over the
+    ///  array, and one Proj-4 transform for the geocentric legs.
+    void localToGeographic(const Point3f *inPts,GeoCoord *outCoords,unsigned int numPts);
+    void geographicToLocal(const GeoCoord *inCoords,Point3f *outPts,unsigned int numPts);
+    void geographicToLocal(const GeoCoord *inCoords,Point3d *outPts,unsigned int numPts);
+    void localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+    void geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts);
+
+
     /// True if the other system is Spherical Mercator with the same origin
     virtual bool isSameAs(CoordSystem *coordSys);
         
@@ -18,6 +18,9 @@
  *
  */
 
+#import <list>
+#import <map>
+#import <pthread.h>
 #import "WhirlyVector.h"
 #import "WhirlyGeometry.h"
 #import "VectorData.h"
@@ -34,5 +37,60 @@ void TesselateRing(const WhirlyKit::VectorRing &ring,VectorTrianglesRef tris);
   */
 void TesselateLoops(const std::vector<VectorRing> &loops,VectorTrianglesRef tris);
 
+/// Append one triangle mesh to another, fixing up the indices as we go
+void AppendTriMesh(const VectorTrianglesRef &src,VectorTrianglesRef &dest);
+
+/** Content addressed cache of tessellation results.  Keyed by a
+    fingerprint of the ring coordinates (and the grid epsilon they were
+    diced with), so adding the same polygon again -- even as a freshly
+    parsed copy of the shape -- reuses the triangles rather than running
+    the tessellator.  Least recently used meshes go when the byte budget
+    runs out.  Safe to hit from any thread, and the meshes it hands back
+    are shared, so don't modify them.
+  */
+class TessellationCache
+{
+public:
+    TessellationCache(long long maxBytes);
+    ~TessellationCache();
+
+    /// The shared cache the vector and loft paths use
+    static TessellationCache *getShared();
+
+    /// Fingerprint helpers.  Start from hashSeed(), fold in each loop
+    ///  (and any dicing epsilon) and use the result as the key.
+    static long long hashSeed();
+    static long long hashRing(long long hash,const VectorRing &ring);
+    static long long hashFloat(long long hash,float val);
+
+    /// Return the mesh stored under the given fingerprint, or an empty ref
+    VectorTrianglesRef get(long long key);
+
+    /// Hang on to a freshly built mesh
+    void add(long long key,VectorTrianglesRef tris);
+
+protected:
+    typedef struct
+    {
+        long long key;
+        long long cost;
+        VectorTrianglesRef tris;
+    } CacheEntry;
+
+    pthread_mutex_t lock;
+    long long maxBytes,usedBytes;
+    std::list<CacheEntry> entries;
+    std::map<long long,std::list<CacheEntry>::iterator> entryMap;
+};
+
+/** Tesselate a batch of areal features across the available cores.
+    Each shape's triangulation (grid diced if gridEps is non-zero) lands
+    in its cachedTess slot, so whoever builds drawables afterwards picks
+    the meshes up in their own order without touching the tessellator.
+    Shapes already carrying a matching cached tessellation are skipped.
+    Blocks until the whole batch is done.
+  */
+void TesselateAreals(const std::vector<VectorArealRef> &areals,float gridEps);
+
 
 }
@@ -50,10 +50,13 @@ public:
 
     /// Render side only.  Don't call this.  Create the openGL version
 	virtual bool createInGL(OpenGLMemManager *memManager) {  return false; }
-	
+
 	/// Render side only.  Don't call this.  Destroy the openGL version
 	virtual void destroyInGL(OpenGLMemManager *memManager) { }
 
+    /// Bytes we'll hand the driver at creation, if we know
+    virtual size_t uploadSize() { return 0; }
+
 protected:
 	/// OpenGL ES ID
 	/// Set to 0 if we haven't loaded yet
@@ -91,7 +94,12 @@ public:
 	    
     /// Process the data for display based on the format.
     NSData *processData();
-    
+
+    /// Run the format conversion now, on the calling thread, so the
+    ///  upload doesn't have to.  Safe to call from a worker thread as
+    ///  long as no one else is touching this texture yet.
+    void convertForUpload();
+
     /// Set up from raw PKM (ETC2/EAC) data
     void setPKMData(NSData *data);
 	
@@ -111,13 +119,31 @@ public:
     void setFormat(GLenum inFormat) { format = inFormat; }
     /// If we're converting to a single byte, set the source
     void setSingleByteSource(WKSingleByteSource source) { byteSource = source; }
+    /// Tell the texture its data arrived already in the upload format,
+    ///  so there's nothing to convert
+    void setIsConverted() { converted = true; }
 
     /// Render side only.  Don't call this.  Create the openGL version
 	virtual bool createInGL(OpenGLMemManager *memManager);
-	
+
 	/// Render side only.  Don't call this.  Destroy the openGL version
 	virtual void destroyInGL(OpenGLMemManager *memManager);
 
+    /// Render side only.  Don't call this.  Re-upload new image data over
+    ///  the existing GL storage.  The data must match the original width,
+    ///  height and format; the compressed formats can't be updated.
+    bool updateInGL(NSData *newData);
+
+    /// Bytes of image data the creation will upload
+    virtual size_t uploadSize() { return texData ? [texData length] : 0; }
+
+    /// Append our state to a scene snapshot record.  Only valid before
+    ///  createInGL(), which lets go of the data.
+    bool snapshotWrite(NSMutableData *data) const;
+
+    /// Rebuild this texture from a record written by snapshotWrite()
+    bool snapshotRead(const unsigned char *&ptr,const unsigned char *end);
+
     /// Sort the PKM data out from the NSData
     /// This is static so the dynamic (haha) textures can use it
     static unsigned char *ResolvePKM(NSData *texData,int &pkmType,int &size,int &width,int &height);
@@ -131,12 +157,16 @@ protected:
     bool isPKM;
     /// If not PVRTC, the format we'll use for the texture
     GLenum format;
+    /// Set once the data has already been converted to the format
+    bool converted;
     /// If we're converting down to one byte, where do we get it?
     WKSingleByteSource byteSource;
 	
 	unsigned int width,height;
     bool usesMipmaps;
     bool wrapU,wrapV;
+    /// Bytes we reported to the memory census at creation
+    size_t trackedMemSize;
 };
 	
 }
@@ -54,7 +54,12 @@ public:
     
     /// Convert a list of texture coordinates to the dest texture
     void processTexCoords(std::vector<TexCoord> &);
-    
+
+    /// Build a sub texture addressing a piece of this one.  Org and span
+    ///  are in this sub texture's [0,1] space.  Useful for pointing a
+    ///  child tile at a chunk of its parent's imagery.
+    SubTexture subTextureForRegion(const TexCoord &org,const TexCoord &span) const;
+
     /// Sort operator
     bool operator < (const SubTexture &that) const { return this->myId < that.myId; }
     
@@ -0,0 +1,117 @@
+/*
+ *  TilePipelineTrace.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 10/20/12.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+#import <string>
+#import <vector>
+
+namespace WhirlyKit
+{
+
+/** Per tile tracing for the whole load pipeline.  Each stage a tile
+    passes through records an enter/exit span into a process wide
+    lock free ring, so when a tile is slow we can see whether the
+    time went to queueing, the network, inflating, decoding, building
+    geometry or waiting on the render thread.  Off by default;
+    recording a span when it's on is one atomic increment and a few
+    stores, and a single test when it's off.
+  */
+class TilePipelineTrace
+{
+public:
+    /// The stages we track, in the order a tile moves through them.
+    /// Spans overlap the way distributed tracing spans do:  Queued is
+    ///  the whole wait on the data source, Fetch is the network round
+    ///  trip inside it, and the difference between them is dispatch
+    ///  and queue time.
+    typedef enum {StageQueued=0,StageFetch,StageInflate,StageDecode,StageBuild,StageUpload,StageMax} Stage;
+
+    /// A single stage enter/exit for one tile
+    class Span
+    {
+    public:
+        Span();
+
+        /// The tile the span belongs to
+        int level,x,y;
+        /// Which stage it spent the time in
+        Stage stage;
+        /// Enter and exit, from CFAbsoluteTimeGetCurrent()
+        NSTimeInterval enter,exit;
+    };
+
+    /// Everything still in the ring for one tile, assembled by the query
+    class TileTrace
+    {
+    public:
+        TileTrace();
+
+        int level,x,y;
+        /// The tile's spans, ordered by enter time
+        std::vector<Span> spans;
+        /// First enter to last exit
+        NSTimeInterval totalTime;
+        /// Raw time inside each stage.  Stages overlap, so these can
+        ///  sum to more than totalTime.
+        NSTimeInterval stageTime[StageMax];
+        /// The stage that cost the most; where tuning effort goes first
+        Stage longestStage;
+    };
+
+    /// Span durations for one stage, bucketed for a histogram.
+    /// The buckets double from 1ms; the last one catches everything longer.
+    class StageHistogram
+    {
+    public:
+        StageHistogram();
+
+        static const int NumBuckets = 12;
+        int counts[NumBuckets];
+        int numSpans;
+        NSTimeInterval minDur,maxDur,totalDur;
+    };
+
+    /// Turn tracing on or off.  Off by default.
+    static void setEnabled(bool enable);
+    static bool isEnabled();
+
+    /// Record a span from any thread.  Goes into a fixed ring,
+    ///  overwriting the oldest, with no locks taken.
+    static void addSpan(int level,int x,int y,Stage stage,NSTimeInterval enter,NSTimeInterval exit);
+
+    /// Assemble per tile traces from whatever's still in the ring,
+    ///  most recently finished tiles first, up to maxTiles of them.
+    static void getRecentTiles(std::vector<TileTrace> &traces,int maxTiles);
+
+    /// Aggregate histograms per stage over everything still in the ring
+    static void getStageHistograms(StageHistogram histograms[StageMax]);
+
+    /// Printable name for a stage
+    static const char *StageName(Stage stage);
+
+    /// Throw out everything recorded so far
+    static void clear();
+
+    /// Write the recent traces and stage histograms out as JSON,
+    ///  shaped like PerformanceTimer::report() for the same tooling
+    static void report(std::string &outJson,int maxTiles);
+};
+
+}
@@ -109,6 +109,16 @@
 @property (nonatomic,assign) bool useElevAsZ;
 /// The number of image layers we're expecting to be given.  By default, 1
 @property (nonatomic,assign) unsigned int numImages;
+/** Number of frames either side of the current image kept as full
+    resolution textures when animating (numImages > 1).  The other
+    frames hold just their compressed source data in CPU memory and
+    rebuild as the animation cursor approaches, so a deep stack
+    doesn't cost its full depth in texture memory.  The window wraps
+    around the ends, matching looping animations.  Zero (the default)
+    keeps every frame resident.  Only works on the non-atlas path,
+    so turn off useDynamicAtlas.
+  */
+@property (nonatomic,assign) int frameResidency;
 /// Number of active textures we'll have in drawables.  Informational only.
 @property (nonatomic,readonly) int activeTextures;
 /// Base color for the drawables created by the layer
@@ -120,10 +130,40 @@
 /// If set, we'll ignore edge matching.
 /// This can work if you're zoomed in close
 @property (nonatomic,assign) bool ignoreEdgeMatching;
+/** If set, tiles snap their edge vertices onto coarser neighbors
+    instead of getting skirt geometry.  The snapped edges meet exactly,
+    so there are no cracks and none of the skirt fill.  Edges are
+    recomputed incrementally as neighbors load and unload.  Assumes the
+    elevation pyramid is consistent between levels at shared samples.
+    Off by default.
+  */
+@property (nonatomic,assign) bool stitchEdges;
+/** If set, tiles with elevation data get a normal map derived from
+    the height field in their second texture unit.  Pair it with the
+    kToolkitDefaultTriangleNormalMapProgram shader for per fragment
+    lighting, which shades well at much lower vertex density.
+    Only works on the non-atlas path, so turn off useDynamicAtlas.
+  */
+@property (nonatomic,assign) bool buildNormalMaps;
+/** If set, tile vertices are stored relative to the tile's center and
+    the drawable carries the real origin as a double translation, which
+    the renderer composes in double.  That keeps deep zooms on flat maps
+    from jittering.  Only applies to flat coordinate systems and the
+    non-atlas path, so turn off useDynamicAtlas.  Off by default.
+  */
+@property (nonatomic,assign) bool useTileCenters;
 /// If set, we'll fill in the poles for a projection that doesn't go all the way up or down
 @property (nonatomic,assign) bool coverPoles;
 /// The data type of GL textures we'll be creating.  RGBA by default.
 @property (nonatomic,assign) WhirlyKitTileImageType imageType;
+/// If set (the default), tile textures convert to the imageType format
+///  on the tile build threads instead of at upload time.  Turn it off
+///  to favor build throughput over upload cost.
+@property (nonatomic,assign) bool convertFormatOnBuild;
+/// If set, tile textures carry mipmap chains, so tiles minify cleanly
+///  during zoom-out instead of aliasing.  Atlas chains rebuild once
+///  per flush, off the per-tile path.  Off by default.
+@property (nonatomic,assign) bool useMipmaps;
 /// If set (before we start) we'll use dynamic texture and drawable atlases
 @property (nonatomic,assign) bool useDynamicAtlas;
 /// If set we'll scale the input images to the nearest square power of two
@@ -134,6 +174,19 @@
 @property (nonatomic,assign) int textureAtlasSize;
 /// How many texels we put around the borders of each tile
 @property (nonatomic,assign) int borderTexel;
+/** Number of background threads used to build tile geometry.
+    Image decode, mesh generation and skirt construction run out there,
+    with just the atlas insertion and scene changes marshaled back to
+    the layer thread.  Set to 1 to do everything on the layer thread.
+  */
+@property (nonatomic,assign) int numTileBuildThreads;
+
+/** Check if anyone still wants the given tile.  Tile sources running
+    long fetches or decodes on other threads can poll this and abandon
+    work for tiles that have been superseded (e.g. the user zoomed past
+    the level).  Safe to call from any thread.
+  */
+- (bool)tileIsWantedLevel:(int)level col:(int)col row:(int)row;
 
 /// Set this up with an object that'll return an image per tile
 - (id)initWithDataSource:(NSObject<WhirlyKitQuadTileImageDataSource> *)imageSource;
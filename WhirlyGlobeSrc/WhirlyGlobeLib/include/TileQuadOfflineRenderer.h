@@ -35,6 +35,22 @@
 
 @class WhirlyKitQuadTileOfflineLoader;
 
+/** One changed cell of the output grid, when the loader is delivering
+    sub tiles.  The grid is anchored at the canvas origin and stays put
+    between renders, so consumers can patch textures in place.
+  */
+@interface WhirlyKitQuadTileOfflineSubTile : NSObject
+{
+@public
+    /// Position of the cell on the output grid
+    int gridX,gridY;
+    /// Where the cell sits on the full canvas, in pixels
+    CGRect rect;
+    /// One texture per entry in the image stack.  Delegate cleans up.
+    std::vector<WhirlyKit::SimpleIdentity> textures;
+}
+@end
+
 /// The offline renderer passes over images like so
 @interface WhirlyKitQuadTileOfflineImage : NSObject
 {
@@ -52,6 +68,14 @@
 /// Size of the center pixel in meters
 @property (nonatomic) CGSize centerSize;
 
+/// Portion of the image (in pixels) that actually changed since the
+///  last render.  The whole image on a full render.
+@property (nonatomic) CGRect updatedRect;
+
+/// The changed cells (WhirlyKitQuadTileOfflineSubTile) when the loader
+///  has a subTileSize set.  In that mode textures above is empty.
+@property (nonatomic,strong) NSArray *subTiles;
+
 @end
 
 /** Fill in this delegate to receive the UIImage this layer
@@ -95,6 +119,11 @@
 /// When the MBR changes we get a preview render down to this many levels
 @property (nonatomic,assign) int previewLevels;
 
+/// If set (in pixels), the output is delivered as individual textures on
+///  a fixed grid of this cell size and only the changed cells go out.
+///  0 (the default) delivers one monolithic image.
+@property (nonatomic,assign) int subTileSize;
+
 /// If set, the delegate that receives the image we're generating every period seconds
 @property (nonatomic,weak) NSObject<WhirlyKitQuadTileOfflineDelegate> *outputDelegate;
 
@@ -32,6 +32,10 @@
 /// Generate raw data for the image at the given resolution, with the given replicated border
 -(NSData *)rawDataScaleWidth:(unsigned int)width height:(unsigned int)height border:(int)border;
 
+/// Same thing, but decoded straight to one luminance byte per pixel,
+///  skipping the 32 bit intermediate entirely
+-(NSData *)rawDataSingleChannelScaleWidth:(unsigned int)width height:(unsigned int)height border:(int)border;
+
 @end
 
 // A function we can call to force the linker to bring in categories
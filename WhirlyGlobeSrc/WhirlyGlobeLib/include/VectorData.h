@@ -31,25 +31,80 @@
 
 namespace WhirlyKit
 {
-	
+
+class VectorAttrStore;
+/// Reference counted attribute store
+typedef boost::shared_ptr<VectorAttrStore> VectorAttrStoreRef;
+
+/** Interned attribute storage shared by the features of one load.
+    Tiles and files repeat the same attribute keys over and over, so a
+    loader can run its features through one of these:  each key lives
+    once in a shared table and each feature carries a packed row of
+    (key index,value) pairs.  A shape backed by a store only builds its
+    NSMutableDictionary (as a copy) the first time someone asks for it,
+    so features nobody inspects never pay for a dictionary at all.
+  */
+class VectorAttrStore
+{
+public:
+    VectorAttrStore();
+
+    /// One (key table index,value) entry in a feature's row
+    typedef std::pair<int,id> AttrEntry;
+    /// A feature's attributes as stored
+    typedef std::vector<AttrEntry> AttrRow;
+
+    /// Find or add a key, returning its index into the key table
+    int getAddKey(NSString *key);
+    /// Return the key for the given index (nil if out of range)
+    NSString *getKey(int which);
+    /// Intern the given dictionary as a new row.  Returns the row index.
+    int addRow(NSDictionary *dict);
+    /// Look at a row directly, without building a dictionary
+    const AttrRow &getRow(int which);
+    /// Build a mutable dictionary copy of the given row
+    NSMutableDictionary *makeDictionary(int which);
+
+protected:
+    std::vector<NSString *> keys;
+    // Fast lookup from a key back to its index
+    __strong NSMutableDictionary *keyMap;
+    std::vector<AttrRow> rows;
+};
+
 /// The base class for vector shapes.  All shapes
 ///  have attribute and an MBR.
 class VectorShape : public Identifiable
 {
-public:	
+public:
 	/// Set the attribute dictionary
 	void setAttrDict(NSMutableDictionary *newDict);
-	
+
 	/// Return the attr dict
-	NSMutableDictionary *getAttrDict();    
+	NSMutableDictionary *getAttrDict();
+    /// Hand over an archived (NSKeyedArchiver) attribute dictionary to be
+    ///  decoded the first time getAttrDict() is called.  The memory mapped
+    ///  vector files use this, since most shapes' attributes never get looked at.
+    void setLazyAttrData(NSData *attrData);
+    /// Back the shape with a row in a shared attribute store.  The
+    ///  dictionary form is built as a copy the first time getAttrDict()
+    ///  is called, so mutating one shape can't touch its neighbors.
+    void setAttrStore(VectorAttrStoreRef store,int row);
+    /// The shared store backing this shape (and its row), or NULL if it
+    ///  has a real dictionary.  Query code can scan the row directly
+    ///  without materializing anything.
+    VectorAttrStore *getAttrStore(int &row);
     /// Return the geoMbr
     virtual GeoMbr calcGeoMbr() = 0;
-	
+
 protected:
 	VectorShape();
 	virtual ~VectorShape();
 
 	__strong NSMutableDictionary *attrDict;
+    __strong NSData *lazyAttrData;
+    VectorAttrStoreRef attrStore;
+    int attrRow;
 };
 
 class VectorAreal;
@@ -71,6 +126,10 @@ typedef boost::shared_ptr<VectorTriangles> VectorTrianglesRef;
 /// Vector Ring is just a vector of 2D points
 typedef std::vector<Point2f> VectorRing;
 
+/// Per point importance ranks for a ring, parallel to the points.
+/// Filled in by VectorRankPoints; see that for the meaning.
+typedef std::vector<float> VectorRanks;
+
 /// Comparison function for the vector shape.
 /// This is here to ensure we don't put in the same pointer twice
 struct VectorShapeRefCmp
@@ -144,11 +203,29 @@ public:
     
     /// Sudivide to the given tolerance (in degrees)
     void subdivide(float tolerance);
-        
+
     /// Bounding box in geographic coordinates.
 	GeoMbr geoMbr;
 	std::vector<VectorRing> loops;
-    
+
+    /// Per loop importance ranks, filled in on demand by the
+    ///  simplification logic.  Empty until someone asks.
+    std::vector<VectorRanks> loopRanks;
+
+    /// Per loop bounding boxes, built the first time a hit test comes
+    ///  through.  Most taps miss most loops, so these cut the point in
+    ///  polygon work way down on multi-ring features.
+    std::vector<Mbr> loopMbrs;
+
+    /// Tessellation cached the last time this areal was built into
+    ///  drawables.  It's shared by whoever references the shape, so a
+    ///  restyle of the same shape set skips the tessellator entirely.
+    ///  Goes away with the shape when the last reference does.
+    VectorTrianglesRef cachedTess;
+    /// Grid subdivision epsilon the cached tessellation was built with
+    ///  (0 for none).  A build with different subdivision replaces it.
+    float cachedTessEps;
+
 protected:
     VectorAreal();
 };
@@ -170,7 +247,11 @@ public:
 
 	GeoMbr geoMbr;
 	VectorRing pts;
-    
+
+    /// Per point importance ranks, filled in on demand by the
+    ///  simplification logic.  Empty until someone asks.
+    VectorRanks ptRanks;
+
 protected:
     VectorLinear();
 };
@@ -201,6 +282,23 @@ protected:
 /// A set of strings
 typedef std::set<std::string> StringSet;
     
+/** Work out a Visvalingam style importance rank for every point in the
+    ring.  Each rank is the effective triangle area (in square coordinate
+    units) at which the point would be dropped; the areas are forced
+    monotonic as the simplification runs, so the subsets nest -- loosening
+    the tolerance only ever removes more points.  Endpoints (and the
+    last surviving points) get MAXFLOAT, so they're never dropped.
+    Compute the ranks once and you can pull out any level of detail with
+    VectorSimplify.
+  */
+void VectorRankPoints(const VectorRing &ring,bool closed,VectorRanks &ranks);
+
+/** Pull out the points whose importance rank is at least minArea.
+    For a tolerance of eps linear units, pass in something like eps*eps.
+    Just a filter pass, so it's cheap to call per zoom level.
+  */
+void VectorSimplify(const VectorRing &ring,const VectorRanks &ranks,float minArea,VectorRing &outPts);
+
 /// Break any edge longer than the given length.
 /// Returns true if it broke anything
 void SubdivideEdges(const VectorRing &inPts,VectorRing &outPts,bool closed,float maxLen);
@@ -241,6 +339,16 @@ public:
     /// You need to be able to seek in your file format for this.
     /// The filter works the same as for getNextObect()
     virtual VectorShapeRef getObjectByIndex(unsigned int vecIndex,const StringSet *filter)  { return VectorShapeRef(); }
+
+    /// Read a run of objects in one pass, starting at the given index.
+    /// Failed reads come back as empty refs, so shapes[ii] always
+    ///  corresponds to record startIndex+ii.  Readers that can batch
+    ///  their I/O should override this.
+    virtual void getObjects(unsigned int startIndex,unsigned int count,const StringSet *filter,std::vector<VectorShapeRef> &shapes)
+    {
+        for (unsigned int ii=0;ii<count;ii++)
+            shapes.push_back(getObjectByIndex(startIndex+ii,filter));
+    }
 };
 
 /** Helper routine to parse geoJSON into a collection of vectors.
@@ -260,9 +368,31 @@ bool VectorParseGeoJSON(ShapeSet &shapes,NSDictionary *jsonDict);
     OSM server for vectors.
   */
 bool VectorParseGeoJSONAssembly(NSData *data,std::map<std::string,ShapeSet> &shapes);
-    
+
+/** Streaming version of the geoJSON parser.  Rather than materializing a
+    parse tree for the whole document, this tokenizes one feature at a time
+    and hands shapes to the callback in batches of batchSize, with progress
+    running from 0 to 1.  Return false from the callback to cancel.
+    Returns false on parse failure or cancellation.
+  */
+bool VectorParseGeoJSONStreaming(NSData *jsonData,unsigned int batchSize,bool (^shapeBlock)(ShapeSet &shapes,float progress));
+
 bool VectorReadFile(const std::string &fileName,ShapeSet &shapes);
 bool VectorWriteFile(const std::string &fileName,ShapeSet &shapes);
+
+/** Write the given shapes out in the second generation, memory mappable
+    format.  The geometry goes out as contiguous raw point arrays with an
+    offset table up front and the attribute dictionaries in a side table
+    at the end, so a reader can pull the arrays straight out of a mapping.
+  */
+bool VectorWriteMapFile(const std::string &fileName,ShapeSet &shapes);
+
+/** Read a file written by VectorWriteMapFile.  The file is mapped rather
+    than streamed:  point arrays are filled with one block copy each out of
+    the mapping and attribute dictionaries aren't unarchived until the
+    first time someone asks a shape for them.
+  */
+bool VectorReadMapFile(const std::string &fileName,ShapeSet &shapes);
     
 }
 
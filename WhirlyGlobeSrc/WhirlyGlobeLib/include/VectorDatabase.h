@@ -70,9 +70,14 @@ public:
      */
     VectorShapeRef getVector(unsigned int,bool withAttributes=true);
     
-    /// Return a list of all the features that overlap 
+    /// Return a list of all the features that overlap
     void getVectorsWithinMbr(const GeoMbr &mbr,UIntSet &vecIds);
-    
+
+    /// Load up and return the features that overlap the given MBR.
+    /// This is what the paging layers use to pull a tile footprint's
+    ///  worth of features.
+    void getVectorsInMbr(const GeoMbr &mbr,ShapeSet &shapes);
+
     /// Run a SQL query, returning the list of IDs that match.
     /// Pass in the where clause, essentially.
     /// This version returns a set of IDs
@@ -90,13 +95,29 @@ public:
 protected:
     bool buildCaches(NSString *mbrCache,NSString *sqlDb);
     bool readCaches(NSString *mbrCache,NSString *sqlDb);
-    
+
+    /// Build the in memory R-tree over the MBRs
+    void buildSpatialIndex();
+
     VectorReader *reader;
-    
+
     /// Flat list of the vectors and their MBRs.
-    /// Need a spatial index here, ideally an R-Tree
+    /// The R-tree below indexes into this.
     std::vector<GeoMbr> mbrs;
-    
+
+    /// A node in the packed R-tree.  Leaves point at vector indices,
+    ///  interior nodes at other nodes.
+    class SpatialNode
+    {
+    public:
+        GeoMbr mbr;
+        bool leaf;
+        std::vector<unsigned int> children;
+    };
+    /// The R-tree itself, packed flat.  Built once the MBRs load.
+    std::vector<SpatialNode> spatialNodes;
+    int spatialRoot;
+
     /// If we're caching in memory, this is the cache
     bool vecCacheOn;
     std::map<unsigned int,VectorShapeRef> vecCache;
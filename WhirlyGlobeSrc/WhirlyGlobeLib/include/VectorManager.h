@@ -29,6 +29,10 @@
 #import "GlobeMath.h"
 #import "LayerThread.h"
 
+/// @cond
+@class VectorInfo;
+/// @endcond
+
 namespace WhirlyKit
 {
 
@@ -68,7 +72,11 @@ public:
     
     /// Add an array of vectors.  The returned ID can be used for removal.
     SimpleIdentity addVectors(ShapeSet *shapes,NSDictionary *desc,ChangeSet &changes);
-    
+
+    /// Same, but takes the shape set contents rather than copying them.
+    /// Use this when the caller is done with the shapes.
+    SimpleIdentity addVectors(ShapeSet &&shapes,NSDictionary *desc,ChangeSet &changes);
+
     /// Change the vector(s) represented by the given ID
     void changeVectors(SimpleIdentity vecID,NSDictionary *desc,ChangeSet &changes);
     
@@ -80,8 +88,18 @@ public:
     
     /// Enable/disable vector data
     void enableVectors(SimpleIDSet &vecIDs,bool enable,ChangeSet &changes);
-    
+
+    /// Collect up the drawables behind the given vector groups.  Used when
+    ///  someone else (e.g. the scene graph) wants to run their visibility.
+    void getDrawIDs(const SimpleIDSet &vecIDs,SimpleIDSet &drawIDs);
+
+    /// Report the bookkeeping we're holding to the memory census
+    virtual void memoryCensus(MemoryCensusEntry &entry);
+
 protected:
+    /// The add paths above funnel down to this
+    SimpleIdentity addVectors(VectorInfo *vecInfo,NSDictionary *desc,ChangeSet &changes);
+
     pthread_mutex_t vectorLock;
     VectorSceneRepSet vectorReps;
 };
@@ -50,9 +50,9 @@ public:
     public:
         ViewInstance() { }
         ViewInstance(UIView *view) : view(view) { }
-        ViewInstance(WhirlyKit::GeoCoord loc,UIView *view) : loc(loc), view(view), active(true) { offset.x() = view.frame.origin.x;  offset.y() = view.frame.origin.y; }
+        ViewInstance(WhirlyKit::GeoCoord loc,UIView *view) : loc(loc), view(view), active(true), worldLocValid(false), lastHidden(false) { offset.x() = view.frame.origin.x;  offset.y() = view.frame.origin.y; }
         ~ViewInstance() { }
-        
+
         /// Sort by UIView
         bool operator < (const ViewInstance &that) const { return view < that.view; }
 
@@ -68,6 +68,13 @@ public:
         float minVis;
         /// Maximum visibility above globe
         float maxVis;
+        /// Display coordinates for loc, cached so the per frame pass
+        ///  doesn't redo the conversion.  Filled in lazily.
+        mutable bool worldLocValid;
+        mutable Point3d worldLoc;
+        /// Last hidden state we applied, so views that stay off screen
+        ///  don't cost a main thread update every frame
+        mutable bool lastHidden;
     };
     
     /// Add a view to be tracked.
@@ -34,6 +34,11 @@ bool IntersectUnitSphere(Point3d org,Eigen::Vector3d dir,Point3d &hit);
 ///  defined by ring.  Standard winding-ish test.
 bool PointInPolygon(Point2f pt,const std::vector<Point2f> &ring);
 
+/// Same test against a raw contiguous run of points.  On ARM this runs
+///  the edge crossing tests four at a time with NEON, which matters when
+///  a tap has to grind through full resolution parcel rings.
+bool PointInPolygonRing(const Point2f &pt,const Point2f *pts,size_t numPts);
+
 /// Run a convex polygon intersection check.  Returns true if they overlap
 bool ConvexPolyIntersect(const std::vector<Point2f> &pts0,const std::vector<Point2f> &pts1);
 
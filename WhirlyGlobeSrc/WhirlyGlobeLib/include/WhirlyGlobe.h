@@ -28,6 +28,7 @@
 #import "AnimateRotation.h"
 #import "AnimateViewMomentum.h"
 #import "GlobeScene.h"
+#import "SceneSnapshot.h"
 #import "SphericalEarthLayer.h"
 #import "GridLines.h"
 #import "NSString+Stuff.h"
@@ -35,6 +36,7 @@
 #import "TextureGroup.h"
 #import "SceneRendererES.h"
 #import "SceneRendererES2.h"
+#import "TilePipelineTrace.h"
 #import "SceneRendererES3.h"
 #import "EAGLView.h"
 #import "PinchDelegate.h"
@@ -87,6 +89,8 @@
 #import "MaplyScene.h"
 #import "ShapeDrawableBuilder.h"
 #import "ShapeLayer.h"
+#import "GreatCircleLayer.h"
+#import "SceneGraphLayer.h"
 #import "LayoutLayer.h"
 #import "BillboardLayer.h"
 #import "OpenGLES2Program.h"
@@ -55,6 +55,9 @@ typedef std::set<NSObject<WhirlyKitViewWatcherDelegate> * __weak> WhirlyKitViewW
 @property (nonatomic,assign) WhirlyKit::CoordSystemDisplayAdapter *coordAdapter;
 /// If set, we'll scale the near and far clipping planes as we get closer
 @property (nonatomic,assign) bool continuousZoom;
+/// Bumped every time the view changes.  The view watchers use it to
+///  share one view state snapshot per change across layer threads.
+@property (nonatomic,readonly) long long viewStateVersion;
 
 /// Calculate the viewing frustum (which is also the image plane)
 /// Need the framebuffer size in pixels as input
@@ -82,6 +85,13 @@ typedef std::set<NSObject<WhirlyKitViewWatcherDelegate> * __weak> WhirlyKitViewW
 /// Calculate the projection matrix, given the size of the frame buffer
 - (Eigen::Matrix4d)calcProjectionMatrix:(WhirlyKit::Point2f)frameBufferSize margin:(float)margin;
 
+/// Invert the given matrix, reusing a recent result when the matrix
+///  hasn't changed.  The gesture delegates run the same transforms
+///  through the screen to world methods several times per touch event,
+///  so this keeps a 120Hz touch stream from redoing identical 4x4
+///  inverses.  Keyed on the matrix itself, so it can't go stale.
+- (Eigen::Matrix4d)cachedMatrixInverse:(const Eigen::Matrix4d &)mat;
+
 /// Put together one or more offset matrices to express wrapping
 - (void) getOffsetMatrices:(std::vector<Eigen::Matrix4d> &)offsetMatrices frameBuffer:(WhirlyKit::Point2f)frameBufferSize;
 
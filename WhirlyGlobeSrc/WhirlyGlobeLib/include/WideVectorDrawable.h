@@ -25,10 +25,16 @@ namespace WhirlyKit
     
 // Shader name
 #define kWideVectorShaderName "Wide Vector Shader"
-    
+
+// Shader that does the join expansion on the GPU
+#define kWideVectorGPUShaderName "Wide Vector GPU Shader"
+
 /// Construct and return the Billboard shader program
 OpenGLES2Program *BuildWideVectorProgram();
 
+/// Construct and return the GPU extrusion wide vector program
+OpenGLES2Program *BuildWideVectorGPUProgram();
+
 /** This drawable adds convenience functions for
   */
 class WideVectorDrawable : public BasicDrawable
@@ -51,5 +57,35 @@ protected:
     float width,texRepeat;
     int offsetIndex;
 };
-    
+
+/** Wide vector drawable for the GPU extrusion path.  The CPU hands over
+    just the polyline spine: each vertex carries its neighbors and a side
+    sign, and the shader works out the miter expansion per frame.  That
+    makes the line width (and miter limit) uniforms, so changing them
+    doesn't mean rebuilding geometry.
+  */
+class WideVectorGPUDrawable : public BasicDrawable
+{
+public:
+    WideVectorGPUDrawable();
+
+    /// Neighbors for the vertex we just added
+    void addPrevPoint(const Point3d &pt);
+    void addNextPoint(const Point3d &pt);
+    /// Side sign (-1 or +1) and accumulated texture length
+    void addSideTex(float side,float texY);
+
+    /// Set the width we'll use
+    void setWidth(float inWidth) { width = inWidth; }
+    void setTexRepeat(float inTexRepeat) { texRepeat = inTexRepeat; }
+    void setMiterLimit(float inMiterLimit) { miterLimit = inMiterLimit; }
+
+    /// We override draw so we can set our own values
+    virtual void draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene);
+
+protected:
+    float width,texRepeat,miterLimit;
+    int prevIndex,nextIndex,sideTexIndex;
+};
+
 }
@@ -39,7 +39,13 @@ typedef enum {WideVecMiterJoin,WideVecRoundJoin,WideVecBevelJoin} WideVectorLine
     
 /// How the lines begin and end.  See: http://www.w3.org/TR/SVG/painting.html#StrokeLinecapProperty
 typedef enum {WideVecButtCap,WideVecRoundCap,WideVecSquareCap} WideVectorLineCapType;
-    
+
+/// Where the widening happens.  The CPU version builds the joins as real
+///  geometry; the GPU version ships just the spine and lets the shader
+///  do the miter expansion, which is much smaller and makes width a
+///  uniform.  GPU only applies to screen coordinate vectors.
+typedef enum {WideVecImplCPU,WideVecImplGPU} WideVectorImplType;
+
 }
 
 /** Used to pass parameters for the wide vectors around.
@@ -55,6 +61,7 @@ typedef enum {WideVecButtCap,WideVecRoundCap,WideVecSquareCap} WideVectorLineCap
 @property (nonatomic,assign) float width;
 @property (nonatomic,assign) float repeatSize;
 @property (nonatomic,assign) WhirlyKit::WideVectorCoordsType coordType;
+@property (nonatomic,assign) WhirlyKit::WideVectorImplType implType;
 @property (nonatomic,assign) WhirlyKit::WideVectorLineJoinType joinType;
 @property (nonatomic,assign) WhirlyKit::WideVectorLineCapType capType;
 @property (nonatomic,assign) WhirlyKit::SimpleIdentity texID;
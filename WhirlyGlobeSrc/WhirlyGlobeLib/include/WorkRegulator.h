@@ -0,0 +1,59 @@
+/*
+ *  WorkRegulator.h
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 7/8/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <Foundation/Foundation.h>
+
+namespace WhirlyKit
+{
+
+/** Central throttle for droppable background work.
+    Tile prefetch, cache compaction and the like make sustained navigation
+    smoother, but on a hot device they're also part of what pushes the CPU
+    into thermal throttling that then tanks the frame rate.  The OS won't
+    tell us about thermal state directly, so the renderer reports every
+    drawn frame here and sustained over-budget frames are the pressure
+    signal.  Work the screen needs to be right (fetching visible tiles,
+    building geometry, uploads) should never consult this.
+  */
+class WorkRegulator
+{
+public:
+    /// How much appetite we have for droppable work right now
+    typedef enum {WorkNormal=0,WorkReduced,WorkMinimal} Level;
+
+    /// Current level.  Cheap enough to check before every piece of
+    ///  droppable work, from any thread.
+    static Level getLevel();
+
+    /// Scale a full-rate work count for the current level.
+    /// Full when normal, half (at least 1) when reduced, zero when minimal.
+    static int scaleCount(int fullCount);
+
+    /// The renderer calls this once per drawn frame with the frame's CPU
+    ///  cost.  Render thread only.
+    static void noteFrame(NSTimeInterval frameDuration);
+
+    /// Frame duration (seconds) we consider over budget.  The view
+    ///  controller sets this from its frame interval; the default
+    ///  corresponds to missing 60Hz by half a frame.
+    static void setFrameBudget(NSTimeInterval budget);
+};
+
+}
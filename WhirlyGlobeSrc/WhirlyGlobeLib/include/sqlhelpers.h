@@ -19,6 +19,9 @@
  */
 
 #include <Foundation/Foundation.h>
+#include <map>
+#include <string>
+#include <pthread.h>
 #include "sqlite3.h"
 
 namespace sqlhelpers
@@ -30,6 +33,79 @@ void OneShot(sqlite3 *,const char *);
 /// NSString version of OneShot
 void OneShot(sqlite3 *,NSString *);
 
+/// Set the busy timeout (in ms) and optionally switch the journal to WAL.
+/// Call this once right after opening a connection.
+void ConfigureConnection(sqlite3 *db,int busyTimeoutMs,bool useWAL);
+
+/** Caches compiled statements per connection.
+    Hand one of these to StatementRead/StatementWrite instead of the raw
+    connection and the SQL gets compiled once and reset between uses,
+    rather than prepared fresh every time.
+ */
+class StatementCache
+{
+public:
+    StatementCache(sqlite3 *db);
+    /// Destructor finalizes everything in the cache
+    ~StatementCache();
+
+    /// Return a compiled statement, reset and ready to bind.
+    /// NULL if the SQL failed to compile.
+    sqlite3_stmt *get(const char *stmtStr);
+
+    /// The connection we're caching for
+    sqlite3 *getDb() { return db; }
+
+    /// Finalize all the cached statements
+    void flush();
+
+protected:
+    sqlite3 *db;
+    std::map<std::string,sqlite3_stmt *> stmts;
+};
+
+/** Scoped transaction.  Opens on construction, rolls back on
+    destruction unless you called commit().  Wrap write bursts in one
+    of these rather than paying for a sync per statement.
+ */
+class ScopedTransaction
+{
+public:
+    /// Constructor starts the transaction
+    ScopedTransaction(sqlite3 *db);
+    /// Destructor rolls back anything left uncommitted
+    ~ScopedTransaction();
+
+    /// Commit the transaction
+    void commit();
+
+protected:
+    sqlite3 *db;
+    bool isDone;
+};
+
+/** Hands out one connection per calling thread, opened on demand.
+    sqlite connections aren't safe to share across threads, so anything
+    fetching from multiple threads goes through one of these.
+ */
+class ConnectionPool
+{
+public:
+    ConnectionPool(NSString *dbPath,int flags = SQLITE_OPEN_READONLY);
+    /// Destructor closes all the connections
+    ~ConnectionPool();
+
+    /// Return the calling thread's connection, opening it if need be.
+    /// NULL if the open failed.
+    sqlite3 *getForThread();
+
+protected:
+    std::string path;
+    int flags;
+    pthread_mutex_t poolLock;
+    std::map<pthread_t,sqlite3 *> connections;
+};
+
 /** Encapsulates a SQLite3 statement in a way that does not make me
     want to punch someone.
  */
@@ -39,12 +115,23 @@ public:
 	/// Construct with the statement and maybe just run the damn thing
 	StatementRead(sqlite3 *db,const char *,bool justRun=false);
 	StatementRead(sqlite3 *db,NSString *,bool justRun=false);
+    /// These versions pull a compiled statement out of the cache.
+    /// finalize() resets it for the next user instead of destroying it.
+    StatementRead(StatementCache &cache,const char *,bool justRun=false);
+    StatementRead(StatementCache &cache,NSString *,bool justRun=false);
 	/// Destructor will call finalize
 	~StatementRead();
-    
+
     /// Returns false if initialization failed
     bool isValid();
-	
+
+    /// Bind an integer to the next ? parameter.  Do this before stepping
+    void add(int);
+    /// Bind a double to the next ? parameter
+    void add(double);
+    /// Bind a string to the next ? parameter
+    void add(NSString *);
+
 	/// Calls step, expecting a row.
 	/// Returns false if we're done, throws an exception on error
 	bool stepRow();
@@ -65,12 +152,14 @@ public:
 	
 protected:
 	void init(sqlite3 *db,const char *,bool justRun=false);
-	
+
     bool valid;
 	sqlite3 *db;
 	sqlite3_stmt *stmt;
 	bool isFinalized;
+	bool fromCache;
 	int curField;
+	int curBind;
 };
 
 /** This version is for an insert or update.
@@ -80,6 +169,10 @@ class StatementWrite
 public:
 	StatementWrite(sqlite3 *db,const char *);
 	StatementWrite(sqlite3 *db,NSString *);
+    /// These versions pull a compiled statement out of the cache.
+    /// finalize() resets it for the next user instead of destroying it.
+    StatementWrite(StatementCache &cache,const char *);
+    StatementWrite(StatementCache &cache,NSString *);
 	~StatementWrite();
 	
 	/// Run the insert/update.
@@ -100,10 +193,11 @@ public:
 	
 protected:
 	void init(sqlite3 *db,const char *);
-	
+
 	sqlite3_stmt *stmt;
 	bool isFinalized;
+	bool fromCache;
 	int curField;
-};	
+};
 
 }
@@ -32,23 +32,25 @@ BigDrawable::Change::Change(ChangeType type,int whereVert,NSData *vertData,int c
 }
     
 BigDrawable::Buffer::Buffer()
-    : vertexBufferId(0), elementBufferId(0), numElement(0), vertexArrayObj(0)
+    : vertexBufferId(0), elementBufferId(0), numElement(0), vertexArrayObj(0), readFence(NULL)
 {
 }
 
 BigDrawable::BigDrawable(const std::string &name,int singleVertexSize,const std::vector<VertexAttribute> &templateAttributes,int singleElementSize,int numVertexBytes,int numElementBytes)
     : Drawable(name), singleVertexSize(singleVertexSize), vertexAttributes(templateAttributes), singleElementSize(singleElementSize), numVertexBytes(numVertexBytes), numElementBytes(numElementBytes), drawPriority(0), requestZBuffer(false),
-    waitingOnSwap(false), programId(0), elementChunkSize(0), minVis(DrawVisibleInvalid), maxVis(DrawVisibleInvalid), minVisibleFadeBand(0.0), maxVisibleFadeBand(0.0), enable(true), center(0,0,0)
+    pendingSwaps(0), programId(0), elementChunkSize(0), minVis(DrawVisibleInvalid), maxVis(DrawVisibleInvalid), minVisibleFadeBand(0.0), maxVisibleFadeBand(0.0), enable(true), center(0,0,0)
 {
     activeBuffer = -1;
-    
+    writeBuffer = 1;
+
     pthread_mutex_init(&useMutex, nil);
     pthread_cond_init(&useCondition, nil);
-    
+
     // Start with one region that covers the whole thing
     vertexRegions.insert(Region(0,numVertexBytes));
 
-    buffers[1].numElement = buffers[0].numElement = 0;
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
+        buffers[ii].numElement = 0;
 }
     
 BigDrawable::~BigDrawable()
@@ -123,7 +125,7 @@ void BigDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memM
     if (buffers[0].vertexBufferId)
         return;
     
-    for (unsigned int ii=0;ii<2;ii++)
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
     {
         Buffer &theBuffer = buffers[ii];
         theBuffer.vertexBufferId = memManager->getBufferID(numVertexBytes,GL_DYNAMIC_DRAW);
@@ -144,24 +146,30 @@ void BigDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memM
 //        glUnmapBufferOES(GL_ARRAY_BUFFER);
 //        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
+    memManager->addTrackedMem(WKMemDrawAtlas,NumBuffers*(numVertexBytes+numElementBytes));
     activeBuffer = 0;
 }
     
 void BigDrawable::teardownGL(OpenGLMemManager *memManager)
 {
-    for (unsigned int ii=0;ii<2;ii++)
+    if (buffers[0].vertexBufferId)
+        memManager->subTrackedMem(WKMemDrawAtlas,NumBuffers*(numVertexBytes+numElementBytes));
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
     {
         Buffer &theBuffer = buffers[ii];
         if (theBuffer.vertexBufferId)
-            memManager->removeBufferID(theBuffer.vertexBufferId);
+            memManager->recycleBufferID(theBuffer.vertexBufferId,numVertexBytes,GL_DYNAMIC_DRAW);
         if (theBuffer.elementBufferId)
-            memManager->removeBufferID(theBuffer.elementBufferId);
+            memManager->recycleBufferID(theBuffer.elementBufferId,numElementBytes,GL_DYNAMIC_DRAW);
         theBuffer.vertexBufferId = 0;
         theBuffer.elementBufferId = 0;
         theBuffer.changes.clear();
         if (theBuffer.vertexArrayObj)
             glDeleteVertexArraysOES(1,&buffers[ii].vertexArrayObj);
         theBuffer.vertexArrayObj = 0;
+        if (theBuffer.readFence)
+            glDeleteSync(theBuffer.readFence);
+        theBuffer.readFence = NULL;
     }
 }
     
@@ -252,6 +260,10 @@ void BigDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
     prog->setUniform("u_mvMatrix", frameInfo.viewAndModelMat);
     prog->setUniform("u_mvNormalMatrix", frameInfo.viewModelNormalMat);
     
+    // Fixed dim level for the overdraw diagnostic, same as BasicDrawable
+    if (frameInfo.overdrawMode)
+        fade = 0.1;
+
     // Fade is always mixed in
     prog->setUniform("u_fade", fade);
     
@@ -279,6 +291,13 @@ void BigDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
             CheckGLError("BasicDrawable::drawVBO2() glBindTexture");
             prog->setUniform(baseMapName, (int)ii+progTexBound);
             CheckGLError("BasicDrawable::drawVBO2() glUniform1i");
+            // Big drawables share vertex data between regions, so the
+            //  texture coordinate transform stays identity here
+            char texScaleName[40],texOffsetName[40];
+            sprintf(texScaleName,"u_texScale%d",ii);
+            sprintf(texOffsetName,"u_texOffset%d",ii);
+            prog->setUniform(texScaleName, Eigen::Vector2f(1.0,1.0));
+            prog->setUniform(texOffsetName, Eigen::Vector2f(0.0,0.0));
         }
     }
 
@@ -397,7 +416,7 @@ SimpleIdentity BigDrawable::addRegion(NSMutableData *vertData,int &vertPos,NSMut
 
     // Set up the vertex buffer change for processing later
     ChangeRef change (new Change(ChangeAdd,vertPos,vertData));
-    for (unsigned int ii=0;ii<2;ii++)
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
         buffers[ii].changes.push_back(change);
 
     // We know the element data needs to be offset from the position, so let's do that
@@ -422,6 +441,7 @@ SimpleIdentity BigDrawable::addRegion(NSMutableData *vertData,int &vertPos,NSMut
 
     // Toss the element chunk into the set.  It'll be dealt with during the next flush
     ElementChunk elementChunk(elementData);
+    elementChunk.vertData = vertData;
     elementChunk.enabled = enabled;
     elementChunks.insert(elementChunk);
     elementChunkSize += elementSize;
@@ -442,7 +462,7 @@ void BigDrawable::setEnableRegion(SimpleIdentity elementChunkId, bool enabled)
     
     // We just want to force an element rebuild
     ChangeRef change (new Change(ChangeElements,0,nil));
-    for (unsigned int ii=0;ii<2;ii++)
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
         buffers[ii].changes.push_back(change);
 }
  
@@ -503,7 +523,7 @@ void BigDrawable::clearRegion(int vertPos,int vertSize,SimpleIdentity elementChu
 //    memset(emptyBytes, 0, vertSize);
 //    NSData *emptyVerts = [[NSData alloc] initWithBytesNoCopy:emptyBytes length:vertSize freeWhenDone:YES];
 //    ChangeRef change(new Change(ChangeClear,vertPos,emptyVerts,vertSize));
-//    for (unsigned int ii=0;ii<2;ii++)
+//    for (unsigned int ii=0;ii<NumBuffers;ii++)
 //        buffers[ii].changes.push_back(change);
 
     removeRegion(vertexRegions,vertPos,vertSize);
@@ -522,6 +542,67 @@ void BigDrawable::clearRegion(int vertPos,int vertSize,SimpleIdentity elementChu
         elementChunkSize = 0;
 }
 
+bool BigDrawable::moveRegion(int &vertPos,int vertSize,SimpleIdentity elementChunkId)
+{
+    // We need the vertex data we kept around to do the relocation
+    ElementChunkSet::iterator it = elementChunks.find(ElementChunk(elementChunkId));
+    if (it == elementChunks.end() || !it->vertData)
+        return false;
+
+    // Regions are sorted by position, so the first fit is the lowest slot
+    RegionSet::iterator vrit;
+    for (vrit = vertexRegions.begin(); vrit != vertexRegions.end(); ++vrit)
+        if (vrit->len >= vertSize)
+            break;
+    // Nowhere (lower) to go
+    if (vrit == vertexRegions.end() || vrit->pos >= vertPos)
+        return false;
+
+    // Carve the new location out of the free region
+    Region theRegion = *vrit;
+    vertexRegions.erase(vrit);
+    int newPos = theRegion.pos;
+    Region newRegion(theRegion.pos + vertSize,theRegion.len - vertSize);
+    if (newRegion.len > 0)
+        vertexRegions.insert(newRegion);
+
+    // Upload the vertex data at its new home in both buffers
+    ChangeRef change(new Change(ChangeAdd,newPos,it->vertData));
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
+        buffers[ii].changes.push_back(change);
+
+    // Rebase the element indices.  This is the data the flush copies
+    //  into the element buffer, so the next swap picks it up.
+    int delta = newPos/singleVertexSize - vertPos/singleVertexSize;
+    NSMutableData *elementData = (NSMutableData *)it->elementData;
+    size_t elementSize = [elementData length];
+    if (singleElementSize == sizeof(GLushort))
+    {
+        GLushort *elPtr = (GLushort *)[elementData mutableBytes];
+        for (unsigned int ii=0;ii<elementSize/2;ii++,elPtr++)
+            *elPtr += delta;
+    } else {
+        GLuint *elPtr = (GLuint *)[elementData mutableBytes];
+        for (unsigned int ii=0;ii<elementSize/4;ii++,elPtr++)
+            *elPtr += delta;
+    }
+
+    // And give the old location back
+    removeRegion(vertexRegions,vertPos,vertSize);
+    vertPos = newPos;
+
+    return true;
+}
+
+void BigDrawable::getFragmentation(int &numRegions,int &largestFree)
+{
+    numRegions = (int)vertexRegions.size();
+    largestFree = 0;
+    for (RegionSet::iterator it = vertexRegions.begin();
+         it != vertexRegions.end(); ++it)
+        largestFree = std::max(largestFree,it->len);
+}
+
 void BigDrawable::getUtilization(int &vertSize,int &elSize)
 {
     vertSize = numVertexBytes;
@@ -534,9 +615,20 @@ void BigDrawable::getUtilization(int &vertSize,int &elSize)
 }
 
 void BigDrawable::executeFlush(int whichBuffer)
-{    
+{
     Buffer &theBuffer = buffers[whichBuffer];
-    
+
+    // On ES3 the renderer dropped a fence when this buffer went out of
+    //  service.  Wait out any GPU reads still pending against it before
+    //  we start writing.  Sync objects are shared across the sharegroup,
+    //  so the layer thread can wait on the render thread's fence.
+    if (theBuffer.readFence)
+    {
+        glClientWaitSync(theBuffer.readFence, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)(100*1e6));
+        glDeleteSync(theBuffer.readFence);
+        theBuffer.readFence = NULL;
+    }
+
     if (!theBuffer.changes.empty())
     {
         // Run the additions to the vertex buffer
@@ -611,47 +703,55 @@ void BigDrawable::executeFlush(int whichBuffer)
     
 void BigDrawable::swap(ChangeSet &changes,BigDrawableSwap *swapRequest)
 {
-    // If we're waiting on a swap, no flushing
+    // Only if the whole ring is in flight do we have to wait
     if (isWaitingOnSwap())
     {
         NSLog(@"Uh oh, tried to swap while we're waiting on something.");
         return;
     }
-    
-    // Figure out which is the inactive buffer.
-    // That's the one we modify
-    int whichBuffer = (activeBuffer == 0 ? 1 : 0);
-    
+
+    // Flush into the next write buffer in the ring.  The renderer is
+    //  drawing the active buffer and any buffers with swaps in flight
+    //  are about to become active, but this one is free.
+    int whichBuffer = writeBuffer;
+
     // Note: In theory we shouldn't need to swap if there are no changes.
     //       However, this doesn't work right if we turn on this optimization.
     // No changes, no work
 //    Buffer &theBuffer = buffers[whichBuffer];
 //    if (theBuffer.changes.empty())
 //        return;
-    
+
     executeFlush(whichBuffer);
-    
+
     // Ask the renderer to swap buffers
     pthread_mutex_lock(&useMutex);
-    waitingOnSwap = true;
+    pendingSwaps++;
+    writeBuffer = (writeBuffer + 1) % NumBuffers;
     pthread_mutex_unlock(&useMutex);
     swapRequest->addSwap(getId(), whichBuffer);
 }
-    
+
 bool BigDrawable::hasChanges()
 {
-    return !buffers[0].changes.empty() || !buffers[1].changes.empty();
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
+        if (!buffers[ii].changes.empty())
+            return true;
+
+    return false;
 }
-    
+
 bool BigDrawable::isWaitingOnSwap()
 {
     bool ret = false;
     pthread_mutex_lock(&useMutex);
-    ret = waitingOnSwap;
+    // The active buffer plus the in flight ones can't be touched.
+    // We need at least one free to flush into.
+    ret = pendingSwaps >= NumBuffers-1;
     pthread_mutex_unlock(&useMutex);
     return ret;
 }
-    
+
 bool BigDrawable::empty()
 {
     return elementChunks.empty();
@@ -660,12 +760,26 @@ bool BigDrawable::empty()
 void BigDrawable::swapBuffers(int whichBuffer)
 {
     pthread_mutex_lock(&useMutex);
+    int oldActive = activeBuffer;
     activeBuffer = whichBuffer;
-    waitingOnSwap = false;
+    if (pendingSwaps > 0)
+        pendingSwaps--;
     pthread_mutex_unlock(&useMutex);
 
-    // Let's tear down the VAO's for both buffers
-    for (unsigned int ii=0;ii<2;ii++)
+    // Drop a fence behind the buffer going out of service.  The GPU may
+    //  still be chewing on draws against it, so the flush that reuses it
+    //  waits on this rather than trusting the depth of the ring.
+    EAGLContext *context = [EAGLContext currentContext];
+    if (context.API >= kEAGLRenderingAPIOpenGLES3 && oldActive != whichBuffer)
+    {
+        Buffer &oldBuffer = buffers[oldActive];
+        if (oldBuffer.readFence)
+            glDeleteSync(oldBuffer.readFence);
+        oldBuffer.readFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Let's tear down the VAO's for all the buffers
+    for (unsigned int ii=0;ii<NumBuffers;ii++)
     {
         Buffer &theBuffer = buffers[ii];
         if (theBuffer.vertexArrayObj)
@@ -712,8 +826,10 @@ void BigDrawableFlush::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,W
     BigDrawableRef bigDraw = boost::dynamic_pointer_cast<BigDrawable>(draw);
     if (bigDraw)
     {
-        int whichBuffer = (bigDraw->getActiveBuffer() == 0 ? 1 : 0);
-        bigDraw->executeFlush(whichBuffer);
+        // Flush everything but the buffer the renderer is drawing
+        for (int ii=0;ii<BigDrawable::NumBuffers;ii++)
+            if (ii != bigDraw->getActiveBuffer())
+                bigDraw->executeFlush(ii);
     }
 }
     
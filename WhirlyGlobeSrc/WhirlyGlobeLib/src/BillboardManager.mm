@@ -91,7 +91,7 @@ BillboardDrawableBuilder::~BillboardDrawableBuilder()
     flush();
 }
 
-void BillboardDrawableBuilder::addBillboard(Point3f center,float width,float height,UIColor *inColor)
+void BillboardDrawableBuilder::addBillboard(Point3f center,float width,float height,UIColor *inColor,const SubTexture &subTex)
 {
     CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
     
@@ -131,13 +131,15 @@ void BillboardDrawableBuilder::addBillboard(Point3f center,float width,float hei
     texCoords[2] = TexCoord(1,0);
     pts[3] = Point3f(-width2,height,0);
     texCoords[3] = TexCoord(0,0);
-    
+
+    // Map through the atlas region, if there is one
+    SubTexture theSubTex = subTex;
     int startPoint = drawable->getNumPoints();
     for (unsigned int ii=0;ii<4;ii++)
     {
         drawable->addPoint(center);
         drawable->addOffset(pts[ii]);
-        drawable->addTexCoord(0,texCoords[ii]);
+        drawable->addTexCoord(0,theSubTex.processTexCoord(texCoords[ii]));
         drawable->addNormal(axisY);
         drawable->addColor(color);
     }
@@ -168,17 +170,25 @@ void BillboardDrawableBuilder::flush()
 
 
 BillboardManager::BillboardManager()
+    : texAtlas(NULL)
 {
     pthread_mutex_init(&billLock, NULL);
+    pthread_mutex_init(&atlasLock, NULL);
 }
 
 BillboardManager::~BillboardManager()
 {
     pthread_mutex_destroy(&billLock);
+    pthread_mutex_destroy(&atlasLock);
     for (BillboardSceneRepSet::iterator it = sceneReps.begin();
          it != sceneReps.end(); ++it)
         delete *it;
     sceneReps.clear();
+    if (texAtlas)
+    {
+        delete texAtlas;
+        texAtlas = NULL;
+    }
 }
 
 typedef std::map<SimpleIdentity,BillboardDrawableBuilder *> BuilderMap;
@@ -200,17 +210,37 @@ SimpleIdentity BillboardManager::addBillboards(NSArray *billboards,NSDictionary
     // Work through the billboards, constructing as we go
     for (WhirlyKitBillboard *billboard in billboardInfo.billboards)
     {
-        BuilderMap::iterator it = drawBuilders.find(billboard.texId);
+        // Billboards handed over as images go through the shared atlas,
+        //  so a whole pile of different images still lands in one
+        //  drawable per atlas page
+        SubTexture subTex;
+        if (billboard.image)
+        {
+            Texture *newTex = new Texture("Billboard Manager",billboard.image);
+            std::vector<Texture *> newTexs;
+            newTexs.push_back(newTex);
+            pthread_mutex_lock(&atlasLock);
+            if (!texAtlas)
+                texAtlas = new DynamicTextureAtlas(2048,64,GL_UNSIGNED_BYTE);
+            texAtlas->addTexture(newTexs, NULL, NULL, subTex, scene->getMemManager(), changes, 0);
+            pthread_mutex_unlock(&atlasLock);
+            delete newTex;
+            if (subTex.texId != EmptyIdentity)
+                sceneRep->subTexs.push_back(subTex);
+        } else
+            subTex.texId = billboard.texId;
+
+        BuilderMap::iterator it = drawBuilders.find(subTex.texId);
         BillboardDrawableBuilder *drawBuilder = NULL;
         // Need a new one
         if (it == drawBuilders.end())
         {
-            drawBuilder = new BillboardDrawableBuilder(scene,changes,sceneRep,billboardInfo,billShader,billboard.texId);
-            drawBuilders[billboard.texId] = drawBuilder;
+            drawBuilder = new BillboardDrawableBuilder(scene,changes,sceneRep,billboardInfo,billShader,subTex.texId);
+            drawBuilders[subTex.texId] = drawBuilder;
         } else
             drawBuilder = it->second;
-        
-        drawBuilder->addBillboard(billboard.center, billboard.width, billboard.height, billboard.color);
+
+        drawBuilder->addBillboard(billboard.center, billboard.width, billboard.height, billboard.color, subTex);
 
         // While we're at it, let's add this to the selection layer
         if (selectManager && billboard.isSelectable)
@@ -291,9 +321,7 @@ void BillboardManager::removeBillboards(SimpleIDSet &billIDs,ChangeSet &changes)
             
             if (sceneRep->fade > 0.0)
             {
-                for (SimpleIDSet::iterator it = sceneRep->drawIDs.begin();
-                     it != sceneRep->drawIDs.end(); ++it)
-                    changes.push_back(new FadeChangeRequest(*it, curTime, curTime+sceneRep->fade));
+                changes.push_back(new FadeGangChangeRequest(sceneRep->drawIDs, curTime, curTime+sceneRep->fade));
 
                 // Spawn off the deletion for later
                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, sceneRep->fade * NSEC_PER_SEC),
@@ -310,6 +338,14 @@ void BillboardManager::removeBillboards(SimpleIDSet &billIDs,ChangeSet &changes)
                 sceneRep->fade = 0.0;
             } else {
                 sceneRep->clearContents(selectManager,changes);
+                // Hand any atlas regions back
+                if (texAtlas && !sceneRep->subTexs.empty())
+                {
+                    pthread_mutex_lock(&atlasLock);
+                    for (unsigned int ii=0;ii<sceneRep->subTexs.size();ii++)
+                        texAtlas->removeTexture(sceneRep->subTexs[ii], changes);
+                    pthread_mutex_unlock(&atlasLock);
+                }
                 sceneReps.erase(it);
                 delete sceneRep;
             }
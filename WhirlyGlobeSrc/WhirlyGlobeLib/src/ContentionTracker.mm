@@ -0,0 +1,108 @@
+/*
+ *  ContentionTracker.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 6/2/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "ContentionTracker.h"
+
+namespace WhirlyKit
+{
+
+// Upper edge of each histogram bucket, in seconds.  The last bucket
+//  catches everything longer.
+static const NSTimeInterval WaitBucketEdges[ContentionTracker::NumWaitBuckets-1] = {100e-6,1e-3,10e-3,100e-3};
+
+ContentionTracker::WaitEntry::WaitEntry()
+    : numWaits(0), totalWait(0.0), maxWait(0.0)
+{
+    for (unsigned int ii=0;ii<NumWaitBuckets;ii++)
+        buckets[ii] = 0;
+}
+
+void ContentionTracker::WaitEntry::addWait(NSTimeInterval dur)
+{
+    numWaits++;
+    totalWait += dur;
+    maxWait = std::max(maxWait,dur);
+
+    int bucket = NumWaitBuckets-1;
+    for (unsigned int ii=0;ii<NumWaitBuckets-1;ii++)
+        if (dur < WaitBucketEdges[ii])
+        {
+            bucket = ii;
+            break;
+        }
+    buckets[bucket]++;
+}
+
+ContentionTracker::ContentionTracker()
+{
+    pthread_mutex_init(&lock,NULL);
+}
+
+ContentionTracker &ContentionTracker::getInstance()
+{
+    static ContentionTracker *tracker = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        tracker = new ContentionTracker();
+    });
+
+    return *tracker;
+}
+
+void ContentionTracker::addWait(const char *name,NSTimeInterval dur)
+{
+    pthread_mutex_lock(&lock);
+    waitEntries[name].addWait(dur);
+    pthread_mutex_unlock(&lock);
+}
+
+void ContentionTracker::addLatency(const char *name,NSTimeInterval age)
+{
+    pthread_mutex_lock(&lock);
+    latencyEntries[name].addWait(age);
+    pthread_mutex_unlock(&lock);
+}
+
+// One line per entry, histogram buckets left to right
+static void LogEntries(const char *what,std::map<std::string,ContentionTracker::WaitEntry> &entries)
+{
+    for (std::map<std::string,ContentionTracker::WaitEntry>::iterator it = entries.begin();
+         it != entries.end(); ++it)
+    {
+        ContentionTracker::WaitEntry &entry = it->second;
+        if (entry.numWaits == 0)
+            continue;
+        NSLog(@"  %s %s: %d waits, max %.2f ms, total %.2f ms, [<.1|<1|<10|<100|more ms] = %d %d %d %d %d",
+              what,it->first.c_str(),entry.numWaits,1000*entry.maxWait,1000*entry.totalWait,
+              entry.buckets[0],entry.buckets[1],entry.buckets[2],entry.buckets[3],entry.buckets[4]);
+    }
+}
+
+void ContentionTracker::logAndClear()
+{
+    pthread_mutex_lock(&lock);
+    LogEntries("Lock",waitEntries);
+    LogEntries("Queue",latencyEntries);
+    waitEntries.clear();
+    latencyEntries.clear();
+    pthread_mutex_unlock(&lock);
+}
+
+}
@@ -25,6 +25,36 @@ using namespace Eigen;
 namespace WhirlyKit
 {
 
+void CoordSystem::localToGeographic(const Point3f *inPts,GeoCoord *outCoords,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outCoords[ii] = localToGeographic(inPts[ii]);
+}
+
+void CoordSystem::geographicToLocal(const GeoCoord *inCoords,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = geographicToLocal(inCoords[ii]);
+}
+
+void CoordSystem::geographicToLocal(const GeoCoord *inCoords,Point3d *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = geographicToLocal3d(inCoords[ii]);
+}
+
+void CoordSystem::localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = localToGeocentric(inPts[ii]);
+}
+
+void CoordSystem::geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = geocentricToLocal(inPts[ii]);
+}
+
 Point3f CoordSystemConvert(CoordSystem *inSystem,CoordSystem *outSystem,Point3f inCoord)
 {
     // Easy if the coordinate systems are the same
@@ -48,7 +78,36 @@ Point3d CoordSystemConvert3d(CoordSystem *inSystem,CoordSystem *outSystem,Point3
     Point3d outPt = outSystem->geocentricToLocal(geoCPt);
     return outPt;
 }
-    
+
+void CoordSystemConvertArray(CoordSystem *inSystem,CoordSystem *outSystem,const Point3f *inCoords,Point3f *outCoords,unsigned int numCoords)
+{
+    // Easy if the coordinate systems are the same
+    if (inSystem->isSameAs(outSystem))
+    {
+        if (inCoords != outCoords)
+            for (unsigned int ii=0;ii<numCoords;ii++)
+                outCoords[ii] = inCoords[ii];
+        return;
+    }
+
+    // Through geocentric, same as the single point version, but the
+    //  batch methods get to run the whole array at once
+    inSystem->localToGeocentric(inCoords,outCoords,numCoords);
+    outSystem->geocentricToLocal(outCoords,outCoords,numCoords);
+}
+
+void CoordSystemDisplayAdapter::localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = localToDisplay(inPts[ii]);
+}
+
+void CoordSystemDisplayAdapter::localToDisplay(const Point3d *inPts,Point3d *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = localToDisplay(inPts[ii]);
+}
+
 GeneralCoordSystemDisplayAdapter::GeneralCoordSystemDisplayAdapter(CoordSystem *coordSys,Point3d ll,Point3d ur,Point3d inCenter)
     : CoordSystemDisplayAdapter(coordSys,center), ll(ll), ur(ur), coordSys(coordSys)
 {
@@ -25,10 +25,63 @@ namespace WhirlyKit
 {
     
 CullTree::CullTree(WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr localMbr,int depth,int maxDrawPerNode)
-    : coordAdapter(coordAdapter), depth(depth), numCullables(0), maxDrawPerNode(maxDrawPerNode)
+    : coordAdapter(coordAdapter), depth(depth), numCullables(0), maxDrawPerNode(maxDrawPerNode), bulkAdds(false)
 {
     topCullable = new Cullable(coordAdapter,localMbr,depth);
 }
+
+void CullTree::registerDrawable(SimpleIdentity drawId,Cullable *cullable)
+{
+    drawNodeMap[drawId].insert(cullable);
+}
+
+void CullTree::unregisterDrawable(SimpleIdentity drawId,Cullable *cullable)
+{
+    DrawNodeMap::iterator it = drawNodeMap.find(drawId);
+    if (it == drawNodeMap.end())
+        return;
+    it->second.erase(cullable);
+    if (it->second.empty())
+        drawNodeMap.erase(it);
+}
+
+void CullTree::remDrawable(DrawableRef drawable)
+{
+    // Patch the tree using the cached node handles rather than
+    //  descending from the top by bounding box
+    while (true)
+    {
+        DrawNodeMap::iterator it = drawNodeMap.find(drawable->getId());
+        if (it == drawNodeMap.end() || it->second.empty())
+            break;
+        Cullable *node = *(it->second.begin());
+        node->drawables.erase(drawable);
+        unregisterDrawable(drawable->getId(),node);
+
+        // Clear the cached child lists on the way up
+        for (Cullable *anc = node; anc; anc = anc->parent)
+            anc->childDrawables.erase(drawable);
+
+        // Collapse the highest ancestor that's fallen below the threshold
+        Cullable *toCollapse = NULL;
+        for (Cullable *anc = node; anc; anc = anc->parent)
+            if (anc->hasChildren() && anc->childDrawables.size() < maxDrawPerNode)
+                toCollapse = anc;
+        if (toCollapse)
+            toCollapse->collapse(this);
+    }
+}
+
+void CullTree::beginBulkAdds()
+{
+    bulkAdds = true;
+}
+
+void CullTree::endBulkAdds()
+{
+    bulkAdds = false;
+    topCullable->splitIfOverfull(this);
+}
     
 CullTree::~CullTree()
 {
@@ -41,7 +94,7 @@ CullTree::~CullTree()
 }
     
 Cullable::Cullable(WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr localMbr,int depth)
-    : localMbr(localMbr)
+    : parent(NULL), localMbr(localMbr)
 {
     height = depth;
     
@@ -93,7 +146,34 @@ Cullable::Cullable(WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr localM
     // Use just 4 of the normals
     for (unsigned int ii=0;ii<4;ii++)
         cornerNorms[ii] = pts[ii];
-    
+
+    // Wrap a cone around the corner normals so the backface check
+    //  is a single dot product against the eye vector
+    eyeCullGen = -1;
+    eyeFacing = true;
+    coneAxis = Eigen::Vector3f(0,0,1);
+    minEyeDot = WhirlyKitNeverEyeCull;
+    if (!coordAdapter->isFlat())
+    {
+        Eigen::Vector3f axis(0,0,0);
+        for (unsigned int ii=0;ii<WhirlyKitCullableCornerNorms;ii++)
+            axis += cornerNorms[ii].normalized();
+        if (axis.norm() > 1e-6)
+        {
+            axis.normalize();
+            float minDot = 1.0;
+            for (unsigned int ii=0;ii<WhirlyKitCullableCornerNorms;ii++)
+                minDot = std::min(minDot,axis.dot(cornerNorms[ii].normalized()));
+            // Pad the cone so cached results survive small view changes
+            float coneAngle = acosf(std::max(-1.0f,std::min(1.0f,minDot))) + WhirlyKitEyeCullSlop;
+            if (coneAngle < M_PI/2.0)
+            {
+                coneAxis = axis;
+                minEyeDot = -sinf(coneAngle);
+            }
+        }
+    }
+
     // Set the child bounding boxes as well
     // We use these to check for overlap without creating a child
     Point2f mid = (localMbr.ur()+localMbr.ll())/2.0;
@@ -120,6 +200,7 @@ Cullable *Cullable::getOrAddChild(int which, CullTree *cullTree)
         return children[which];
     
     children[which] = new Cullable(cullTree->coordAdapter,childMbr[which],height-1);
+    children[which]->parent = this;
     cullTree->numCullables++;
     
     return children[which];
@@ -151,9 +232,53 @@ void Cullable::split(CullTree *cullTree)
         
         addDrawableToChildren(cullTree,localMbr,draw);
     }
-    
+
+    for (std::set<DrawableRef,IdentifiableRefSorter>::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+        cullTree->unregisterDrawable((*it)->getId(),this);
     drawables.clear();
 }
+
+// Pull all the drawables out of the children and file them here.
+// We do this when the count of everything below falls under the threshold.
+void Cullable::collapse(CullTree *cullTree)
+{
+    for (unsigned int ii=0;ii<4;ii++)
+        if (children[ii])
+        {
+            children[ii]->unregisterSubtree(cullTree);
+            delete children[ii];
+            children[ii] = NULL;
+        }
+
+    drawables = childDrawables;
+    for (std::set<DrawableRef,IdentifiableRefSorter>::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+        cullTree->registerDrawable((*it)->getId(),this);
+}
+
+void Cullable::unregisterSubtree(CullTree *cullTree)
+{
+    for (std::set<DrawableRef,IdentifiableRefSorter>::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+        cullTree->unregisterDrawable((*it)->getId(),this);
+
+    for (unsigned int ii=0;ii<4;ii++)
+        if (children[ii])
+            children[ii]->unregisterSubtree(cullTree);
+
+    cullTree->numCullables--;
+}
+
+void Cullable::splitIfOverfull(CullTree *cullTree)
+{
+    if (drawables.size() > cullTree->maxDrawPerNode && height > 0)
+        split(cullTree);
+
+    for (unsigned int ii=0;ii<4;ii++)
+        if (children[ii])
+            children[ii]->splitIfOverfull(cullTree);
+}
     
 void Cullable::addDrawableToChildren(CullTree *cullTree,Mbr drawLocalMbr,DrawableRef draw)
 {
@@ -177,26 +302,32 @@ void Cullable::addDrawable(CullTree *cullTree,Mbr drawLocalMbr,DrawableRef draw)
     if (draw->getMatrix() || !drawLocalMbr.valid())
     {
         drawables.insert(draw);
+        cullTree->registerDrawable(draw->getId(),this);
         return;
     }
 
-    // Might need to split it
-    if (drawables.size() > cullTree->maxDrawPerNode && height > 0)
+    // Might need to split it (deferred if we're in a bulk add)
+    if (drawables.size() > cullTree->maxDrawPerNode && height > 0 && !cullTree->bulkAdds)
     {
         drawables.insert(draw);
+        cullTree->registerDrawable(draw->getId(),this);
         split(cullTree);
     }
-    
+
     // The drawable is bigger than this node, so just stick it here
     if (localMbr.contained(drawLocalMbr))
+    {
         drawables.insert(draw);
-    else {
+        cullTree->registerDrawable(draw->getId(),this);
+    } else {
         // If there are children, sort it into those, maybe
         if (hasChildren())
             addDrawableToChildren(cullTree, drawLocalMbr, draw);
-        else
+        else {
             // This is where it nominally lives
             drawables.insert(draw);
+            cullTree->registerDrawable(draw->getId(),this);
+        }
     }
 }
     
@@ -205,6 +336,7 @@ void Cullable::remDrawable(CullTree *cullTree,Mbr drawLocalMbr,DrawableRef draw)
     // Remove it from here
     childDrawables.erase(draw);
     drawables.erase(draw);
+    cullTree->unregisterDrawable(draw->getId(),this);
     
     // Remove from the appropriate children
     if (height > 0)
@@ -220,16 +352,8 @@ void Cullable::remDrawable(CullTree *cullTree,Mbr drawLocalMbr,DrawableRef draw)
     }
     
     // Prune the children if they fall below a certain threshold
-    if (childDrawables.size() < cullTree->maxDrawPerNode)
-    {
-        drawables = childDrawables;
-        for (unsigned int ii=0;ii<4;ii++)
-            if (children[ii])
-            {
-                delete children[ii];
-                children[ii] = NULL;
-            }
-    }
+    if (hasChildren() && childDrawables.size() < cullTree->maxDrawPerNode)
+        collapse(cullTree);
 }
 
 int Cullable::countNodes() const
@@ -21,6 +21,8 @@
 #import "DefaultShaderPrograms.h"
 #import "BillboardDrawable.h"
 #import "WideVectorDrawable.h"
+#import "ScreenSpaceDrawable.h"
+#import "ParticleDrawable.h"
 
 namespace WhirlyKit
 {
@@ -105,6 +107,68 @@ static const char *fragmentShaderTri =
 "}                                                   \n"
 ;
 
+static const char *vertexShaderInstancedTri =
+"struct directional_light {\n"
+"  vec3 direction;\n"
+"  vec3 halfplane;\n"
+"  vec4 ambient;\n"
+"  vec4 diffuse;\n"
+"  vec4 specular;\n"
+"  float viewdepend;\n"
+"};\n"
+"\n"
+"struct material_properties {\n"
+"  vec4 ambient;\n"
+"  vec4 diffuse;\n"
+"  vec4 specular;\n"
+"  float specular_exponent;\n"
+"};\n"
+"\n"
+"uniform mat4  u_mvpMatrix;                   \n"
+"uniform float u_fade;                        \n"
+"uniform int u_numLights;                      \n"
+"uniform directional_light light[8];                     \n"
+"uniform material_properties material;       \n"
+"\n"
+"attribute vec3 a_position;                  \n"
+"attribute vec2 a_texCoord0;                  \n"
+"attribute vec4 a_color;                     \n"
+"attribute vec3 a_normal;                    \n"
+"attribute vec3 a_modelCenter;               \n"
+"attribute vec4 a_instanceColor;             \n"
+"attribute float a_instanceScale;            \n"
+"\n"
+"varying vec2 v_texCoord;                    \n"
+"varying vec4 v_color;                       \n"
+"\n"
+"void main()                                 \n"
+"{                                           \n"
+"   v_texCoord = a_texCoord0;                 \n"
+"   vec4 instColor = a_color * a_instanceColor; \n"
+"   v_color = vec4(0.0,0.0,0.0,0.0);         \n"
+"   if (u_numLights > 0)                     \n"
+"   {\n"
+"     vec4 ambient = vec4(0.0,0.0,0.0,0.0);         \n"
+"     vec4 diffuse = vec4(0.0,0.0,0.0,0.0);         \n"
+"     for (int ii=0;ii<8;ii++)                 \n"
+"     {\n"
+"        if (ii>=u_numLights)                  \n"
+"           break;                             \n"
+"        vec3 adjNorm = light[ii].viewdepend > 0.0 ? normalize((u_mvpMatrix * vec4(a_normal.xyz, 0.0)).xyz) : a_normal.xzy;\n"
+"        float ndotl;\n"
+"        ndotl = max(0.0, dot(adjNorm, light[ii].direction));\n"
+"        ambient += light[ii].ambient;\n"
+"        diffuse += ndotl * light[ii].diffuse;\n"
+"     }\n"
+"     v_color = vec4(ambient.xyz * material.ambient.xyz * instColor.xyz + diffuse.xyz * instColor.xyz,instColor.a) * u_fade;\n"
+"   } else {\n"
+"     v_color = instColor * u_fade;\n"
+"   }\n"
+"\n"
+"   gl_Position = u_mvpMatrix * vec4(a_position * a_instanceScale + a_modelCenter,1.0);  \n"
+"}                                           \n"
+;
+
 static const char *vertexShaderTriMultiTex =
 "struct directional_light {\n"
 "  vec3 direction;\n"
@@ -128,6 +192,10 @@ static const char *vertexShaderTriMultiTex =
 "uniform directional_light light[8];                     \n"
 "uniform material_properties material;       \n"
 "uniform float u_interp;"
+"uniform vec2 u_texScale0;"
+"uniform vec2 u_texOffset0;"
+"uniform vec2 u_texScale1;"
+"uniform vec2 u_texOffset1;"
 "\n"
 "attribute vec3 a_position;                  \n"
 "attribute vec2 a_texCoord0;                  \n"
@@ -141,8 +209,8 @@ static const char *vertexShaderTriMultiTex =
 "\n"
 "void main()                                 \n"
 "{                                           \n"
-"   v_texCoord0 = a_texCoord0;                 \n"
-"   v_texCoord1 = a_texCoord1;                 \n"
+"   v_texCoord0 = a_texCoord0 * u_texScale0 + u_texOffset0;  \n"
+"   v_texCoord1 = a_texCoord1 * u_texScale1 + u_texOffset1;  \n"
 "   v_color = vec4(0.0,0.0,0.0,0.0);         \n"
 "   if (u_numLights > 0)                     \n"
 "   {\n"
@@ -189,6 +257,115 @@ static const char *fragmentShaderTriMultiTex =
 "}"
 ;
     
+// Single channel textures come through as GL_ALPHA, so the luminance
+//  lives in .a and rgb samples as zero.  Spread it back out here.
+static const char *fragmentShaderTriMultiTexSingleChannel =
+"precision mediump float;"
+""
+"uniform sampler2D s_baseMap0;"
+"uniform sampler2D s_baseMap1;"
+"uniform float u_interp;"
+""
+"varying vec2      v_texCoord0;"
+"varying vec2      v_texCoord1;"
+"varying vec4      v_color;"
+""
+"void main()"
+"{"
+"  float lum0 = texture2D(s_baseMap0, v_texCoord0).a;"
+"  float lum1 = texture2D(s_baseMap1, v_texCoord1).a;"
+"  float lum = mix(lum0,lum1,u_interp);"
+"  gl_FragColor = v_color * vec4(lum,lum,lum,1.0);"
+"}"
+;
+
+// Terrain with a normal map does its lighting per fragment, so the
+//  vertex side just passes things through
+static const char *vertexShaderTriNormalMap =
+"uniform mat4  u_mvpMatrix;                   \n"
+"uniform float u_fade;                        \n"
+"\n"
+"attribute vec3 a_position;                  \n"
+"attribute vec2 a_texCoord0;                  \n"
+"attribute vec4 a_color;                     \n"
+"attribute vec3 a_normal;                    \n"
+"\n"
+"varying vec2 v_texCoord;                    \n"
+"varying vec4 v_color;                       \n"
+"varying vec3 v_modelPos;                    \n"
+"\n"
+"void main()                                 \n"
+"{                                           \n"
+"   v_texCoord = a_texCoord0;                 \n"
+"   v_color = a_color * u_fade;              \n"
+"   v_modelPos = a_position;                 \n"
+"\n"
+"   gl_Position = u_mvpMatrix * vec4(a_position,1.0);  \n"
+"}                                           \n"
+;
+
+// The normal map holds tangent space normals (x east, y north, z up).
+// We rebuild the surface frame from the model position, which on the
+//  globe is just the direction from the center.
+static const char *fragmentShaderTriNormalMap =
+"precision mediump float;                            \n"
+"\n"
+"struct directional_light {\n"
+"  vec3 direction;\n"
+"  vec3 halfplane;\n"
+"  vec4 ambient;\n"
+"  vec4 diffuse;\n"
+"  vec4 specular;\n"
+"  float viewdepend;\n"
+"};\n"
+"\n"
+"struct material_properties {\n"
+"  vec4 ambient;\n"
+"  vec4 diffuse;\n"
+"  vec4 specular;\n"
+"  float specular_exponent;\n"
+"};\n"
+"\n"
+"uniform mat4 u_mvpMatrix;                           \n"
+"uniform int u_numLights;                            \n"
+"uniform directional_light light[8];                 \n"
+"uniform material_properties material;               \n"
+"uniform sampler2D s_baseMap0;                       \n"
+"uniform sampler2D s_baseMap1;                       \n"
+"uniform bool  u_hasTexture;                         \n"
+"\n"
+"varying vec2      v_texCoord;                       \n"
+"varying vec4      v_color;                          \n"
+"varying vec3      v_modelPos;                       \n"
+"\n"
+"void main()                                         \n"
+"{                                                   \n"
+"  vec4 baseColor = u_hasTexture ? texture2D(s_baseMap0, v_texCoord) : vec4(1.0,1.0,1.0,1.0); \n"
+"  vec3 tangNorm = texture2D(s_baseMap1, v_texCoord).xyz * 2.0 - 1.0; \n"
+"  vec3 up = normalize(v_modelPos);                  \n"
+"  vec3 east = normalize(cross(vec3(0.0,0.0,1.0), up)); \n"
+"  vec3 north = cross(up, east);                     \n"
+"  vec3 norm = normalize(east*tangNorm.x + north*tangNorm.y + up*tangNorm.z); \n"
+"  vec4 color = v_color;                             \n"
+"  if (u_numLights > 0)                              \n"
+"  {\n"
+"    vec4 ambient = vec4(0.0,0.0,0.0,0.0);           \n"
+"    vec4 diffuse = vec4(0.0,0.0,0.0,0.0);           \n"
+"    for (int ii=0;ii<8;ii++)                        \n"
+"    {\n"
+"       if (ii>=u_numLights)                         \n"
+"          break;                                    \n"
+"       vec3 adjNorm = light[ii].viewdepend > 0.0 ? normalize((u_mvpMatrix * vec4(norm.xyz, 0.0)).xyz) : norm.xzy;\n"
+"       float ndotl = max(0.0, dot(adjNorm, light[ii].direction));\n"
+"       ambient += light[ii].ambient;\n"
+"       diffuse += ndotl * light[ii].diffuse;\n"
+"    }\n"
+"    color = vec4(ambient.xyz * material.ambient.xyz * v_color.xyz + diffuse.xyz * v_color.xyz,v_color.a);\n"
+"  }\n"
+"  gl_FragColor = color * baseColor;  \n"
+"}                                                   \n"
+;
+
 static const char *vertexShaderLine =
 "uniform mat4  u_mvpMatrix;"
 "uniform mat4  u_mvMatrix;"
@@ -294,47 +471,52 @@ static const char *fragmentShaderNoLightTri =
 "}                                                   \n"
 ;
     
-/** The vertex shader for screen space drawables
-    a_position: Position in 3-space for the center
-    a_offset:   Offset from the location
-  */
-static const char *vertexShaderScreenSpace =
-"uniform mat4  u_mvMatrix;"
+// Marker animation shader.  All the frames live in one texture and
+//  each vertex carries the tex coordinates for every frame plus its
+//  phase, period, and frame count.  The vertex shader picks the frame
+//  from the time uniform, so animated markers cost nothing per frame
+//  on the CPU.
+static const char *vertexShaderMarkerAnim =
 "uniform mat4  u_mvpMatrix;"
-"uniform mat4  u_mvNormalMatrix;"
 "uniform float u_fade;"
+"uniform float u_currentTime;"
+""
 "attribute vec3 a_position;"
-"attribute vec2 a_offset;"
-"attribute vec3 a_normal;"
-"attribute vec2 a_texCoord0;"
 "attribute vec4 a_color;"
+"attribute vec2 a_texCoord0;"
+"attribute vec2 a_texCoord1;"
+"attribute vec2 a_texCoord2;"
+"attribute vec2 a_texCoord3;"
+// Phase, period, and number of frames for this marker
+"attribute vec3 a_animInfo;"
 ""
-"varying vec2 v_texCoord0;"
+"varying vec2 v_texCoord;"
 "varying vec4 v_color;"
 ""
 "void main()"
 "{"
-"   v_texCoord0 = a_texCoord0;"
+"   float which = floor(fract((u_currentTime - a_animInfo.x) / a_animInfo.y) * a_animInfo.z);"
+"   vec2 texCoord = a_texCoord0;"
+"   if (which > 0.5)  texCoord = a_texCoord1;"
+"   if (which > 1.5)  texCoord = a_texCoord2;"
+"   if (which > 2.5)  texCoord = a_texCoord3;"
+"   v_texCoord = texCoord;"
 "   v_color = a_color * u_fade;"
-"   vec4 testPt = u_mvMatrix * vec4(a_position,1.0);"
-"   vec4 testDir = u_mvNormalMatrix * vec4(a_normal,0.0);"
-"   float res = dot(vec3(-testPt.x/testPt.w,-testPt.y/testPt.w,-testPt.z/testPt.w),vec3(testDir.x,testDir.y,testDir.z));"
-"   gl_Position = (u_mvpMatrix * vec4(a_position,1.0) + vec4(a_offset,0.0,0.0)) * step(0.0,res);"
+"   gl_Position = u_mvpMatrix * vec4(a_position,1.0);"
 "}"
 ;
 
-static const char *fragmentShaderScreenSpace =
+static const char *fragmentShaderMarkerAnim =
 "precision mediump float;"
 ""
 "uniform sampler2D s_baseMap0;"
 ""
-"varying vec2      v_texCoord0;"
+"varying vec2      v_texCoord;"
 "varying vec4      v_color;"
 ""
 "void main()"
 "{"
-"  vec4 baseColor0 = texture2D(s_baseMap0, v_texCoord0);"
-"  gl_FragColor = v_color * baseColor0;"
+"  gl_FragColor = v_color * texture2D(s_baseMap0, v_texCoord);"
 "}"
 ;
 
@@ -387,16 +569,54 @@ void SetupDefaultShaders(Scene *scene)
         scene->addProgram(kToolkitDefaultTriangleMultiTex, triShaderMultiTex);
     }
 
+    // Multitex triangle shader for single channel textures
+    OpenGLES2Program *triShaderMultiTexSingle = new OpenGLES2Program("Triangle shader with multitex for single channel",vertexShaderTriMultiTex,fragmentShaderTriMultiTexSingleChannel);
+    if (!triShaderMultiTexSingle->isValid())
+    {
+        NSLog(@"SetupDefaultShaders: Triangle shader for single channel textures didn't compile.");
+        delete triShaderMultiTexSingle;
+    } else {
+        scene->addProgram(kToolkitDefaultTriangleMultiTexSingleChannel, triShaderMultiTexSingle);
+    }
+
+    // Triangle shader for instanced geometry
+    OpenGLES2Program *triShaderInstanced = new OpenGLES2Program("Triangle shader for instanced geometry",vertexShaderInstancedTri,fragmentShaderTri);
+    if (!triShaderInstanced->isValid())
+    {
+        NSLog(@"SetupDefaultShaders: Triangle shader for instanced geometry didn't compile.");
+        delete triShaderInstanced;
+    } else {
+        scene->addProgram(kToolkitDefaultTriangleInstancedProgram, triShaderInstanced);
+    }
+
+    // Triangle shader that lights from a normal map
+    OpenGLES2Program *triShaderNormalMap = new OpenGLES2Program("Triangle shader with normal map lighting",vertexShaderTriNormalMap,fragmentShaderTriNormalMap);
+    if (!triShaderNormalMap->isValid())
+    {
+        NSLog(@"SetupDefaultShaders: Triangle shader with normal map lighting didn't compile.");
+        delete triShaderNormalMap;
+    } else {
+        scene->addProgram(kToolkitDefaultTriangleNormalMapProgram, triShaderNormalMap);
+    }
+
     // Shader for screen space objects
-    OpenGLES2Program *screenShader = new OpenGLES2Program("Triangle shader for screen space objects",vertexShaderScreenSpace,fragmentShaderScreenSpace);
-    if (!screenShader->isValid())
+    OpenGLES2Program *screenShader = BuildScreenSpaceProgram();
+    if (!screenShader)
     {
         NSLog(@"SetupDefaultShaders: Triangle shader for screen space objects didn't compile.");
-        delete screenShader;
     } else {
         scene->addProgram(kToolkitDefaultScreenSpaceProgram, screenShader);
     }
 
+    // GPU evaluated particle shader
+    OpenGLES2Program *particleShader = BuildParticleProgram();
+    if (!particleShader)
+    {
+        NSLog(@"SetupDefaultShaders: Particle shader didn't compile.");
+    } else {
+        scene->addProgram(kToolkitDefaultParticleProgram, particleShader);
+    }
+
     // Billboard shader
     OpenGLES2Program *billShader = BuildBillboardProgram();
     if (!billShader)
@@ -415,6 +635,25 @@ void SetupDefaultShaders(Scene *scene)
         scene->addProgram(kToolkitDefaultWideVectorProgram, wideVecShader);
     }
 
+    // Widened vector shader that does the join expansion itself
+    OpenGLES2Program *wideVecGPUShader = BuildWideVectorGPUProgram();
+    if (!wideVecGPUShader)
+    {
+        NSLog(@"SetupDefaultShaders: Wide Vector GPU shader didn't compile.");
+    } else {
+        scene->addProgram(kToolkitDefaultWideVectorGPUProgram, wideVecGPUShader);
+    }
+
+    // Time driven marker animation shader
+    OpenGLES2Program *markerAnimShader = new OpenGLES2Program("Marker shader with time driven frames",vertexShaderMarkerAnim,fragmentShaderMarkerAnim);
+    if (!markerAnimShader->isValid())
+    {
+        NSLog(@"SetupDefaultShaders: Marker animation shader didn't compile.");
+        delete markerAnimShader;
+    } else {
+        scene->addProgram(kToolkitDefaultMarkerAnimProgram, markerAnimShader);
+    }
+
 }
 
 }
@@ -24,6 +24,8 @@
 #import "UIImage+Stuff.h"
 #import "SceneRendererES.h"
 #import "TextureAtlas.h"
+#import "ContentionTracker.h"
+#import "SceneSnapshot.h"
 
 using namespace Eigen;
 
@@ -46,8 +48,15 @@ using namespace WhirlyGlobe;
 namespace WhirlyKit
 {
     
+// How many frames a recycled GL object waits for a matching request
+//  before we delete it for real
+static const int RecycleFrameTTL = 120;
+
 OpenGLMemManager::OpenGLMemManager()
+    : frameCount(0), memBudget(0)
 {
+    for (unsigned int ii=0;ii<WKMemMax;ii++)
+        trackedMem[ii] = 0;
     pthread_mutex_init(&idLock,NULL);
 }
     
@@ -58,8 +67,30 @@ OpenGLMemManager::~OpenGLMemManager()
     
 GLuint OpenGLMemManager::getBufferID(unsigned int size,GLenum drawType)
 {
-    pthread_mutex_lock(&idLock);
-    
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+
+    // A recycled buffer of the right size class keeps its storage,
+    //  so the respecify below is a cheap orphan rather than a realloc
+    if (size != 0)
+    {
+        std::map<std::pair<unsigned int,GLenum>,std::vector<RecycledResource> >::iterator it =
+            recycledBuffers.find(std::pair<unsigned int,GLenum>(size,drawType));
+        if (it != recycledBuffers.end() && !it->second.empty())
+        {
+            GLuint which = it->second.back().glId;
+            it->second.pop_back();
+            if (it->second.empty())
+                recycledBuffers.erase(it);
+            pthread_mutex_unlock(&idLock);
+
+            glBindBuffer(GL_ARRAY_BUFFER, which);
+            glBufferData(GL_ARRAY_BUFFER, size, NULL, drawType);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            CheckGLError("OpenGLMemManager::getBufferID() recycle");
+            return which;
+        }
+    }
+
     if (buffIDs.empty())
     {
         GLuint newAlloc[WhirlyKitOpenGLMemCacheAllocUnit];
@@ -95,11 +126,114 @@ GLuint OpenGLMemManager::getBufferID(unsigned int size,GLenum drawType)
 // If set, we'll reuse buffers rather than allocating new ones
 static const bool ReuseBuffers = true;
 
+// Size of the big buffers we sub allocate out of
+static const int MemPoolBufferSize = 1024*1024;
+// Biggest request we'll sub allocate rather than give its own buffer
+static const int MemPoolAllocMax = 64*1024;
+// Alignment for sub allocations.  Covers any vertex attribute type
+static const int MemPoolAlign = 4;
+
+bool OpenGLMemManager::subAllocBuffer(unsigned int size,SubAllocation &subAlloc)
+{
+    if (size == 0 || size > MemPoolAllocMax)
+        return false;
+    int allocSize = (size + MemPoolAlign-1) & ~(MemPoolAlign-1);
+
+    // First fit out of the pool buffers we've already got
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    for (unsigned int ii=0;ii<poolBuffers.size();ii++)
+    {
+        PoolBuffer &pool = poolBuffers[ii];
+        for (std::map<int,int>::iterator it = pool.freeBlocks.begin();
+             it != pool.freeBlocks.end(); ++it)
+            if (it->second >= allocSize)
+            {
+                subAlloc.bufID = pool.bufID;
+                subAlloc.offset = it->first;
+                subAlloc.size = allocSize;
+                // Carve our piece off the front of the block
+                int remaining = it->second - allocSize;
+                int newOffset = it->first + allocSize;
+                pool.freeBlocks.erase(it);
+                if (remaining > 0)
+                    pool.freeBlocks[newOffset] = remaining;
+                pthread_mutex_unlock(&idLock);
+                return true;
+            }
+    }
+    pthread_mutex_unlock(&idLock);
+
+    // Didn't fit anywhere, so spin up another pool buffer
+    PoolBuffer pool;
+    pool.bufID = getBufferID(MemPoolBufferSize,GL_STATIC_DRAW);
+    if (!pool.bufID)
+        return false;
+    pool.freeBlocks[allocSize] = MemPoolBufferSize-allocSize;
+    subAlloc.bufID = pool.bufID;
+    subAlloc.offset = 0;
+    subAlloc.size = allocSize;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    poolBuffers.push_back(pool);
+    pthread_mutex_unlock(&idLock);
+
+    return true;
+}
+
+void OpenGLMemManager::subFreeBuffer(const SubAllocation &subAlloc)
+{
+    if (!subAlloc.bufID)
+        return;
+
+    GLuint releaseBufID = 0;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    for (unsigned int ii=0;ii<poolBuffers.size();ii++)
+    {
+        PoolBuffer &pool = poolBuffers[ii];
+        if (pool.bufID != subAlloc.bufID)
+            continue;
+
+        int offset = subAlloc.offset;
+        int size = subAlloc.size;
+        // Merge with the free block behind us, if it's adjacent
+        std::map<int,int>::iterator it = pool.freeBlocks.lower_bound(offset);
+        if (it != pool.freeBlocks.begin())
+        {
+            std::map<int,int>::iterator prev = it;  --prev;
+            if (prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                size += prev->second;
+                pool.freeBlocks.erase(prev);
+            }
+        }
+        // And the one in front
+        it = pool.freeBlocks.find(subAlloc.offset + subAlloc.size);
+        if (it != pool.freeBlocks.end())
+        {
+            size += it->second;
+            pool.freeBlocks.erase(it);
+        }
+        pool.freeBlocks[offset] = size;
+
+        // If the whole buffer came back, let it go
+        if (size == MemPoolBufferSize)
+        {
+            releaseBufID = pool.bufID;
+            poolBuffers.erase(poolBuffers.begin()+ii);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&idLock);
+
+    if (releaseBufID)
+        removeBufferID(releaseBufID);
+}
+
 void OpenGLMemManager::removeBufferID(GLuint bufID)
 {
     bool doClear = false;
     
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
 
     // Clear out the data to save memory (Note: not sure we need this)
 //    glBindBuffer(GL_ARRAY_BUFFER, bufID);
@@ -119,23 +253,28 @@ void OpenGLMemManager::removeBufferID(GLuint bufID)
 // Clear out any and all buffer IDs that we may have sitting around
 void OpenGLMemManager::clearBufferIDs()
 {
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
     
     std::vector<GLuint> toRemove;
     toRemove.reserve(buffIDs.size());
     for (std::set<GLuint>::iterator it = buffIDs.begin();
          it != buffIDs.end(); ++it)
         toRemove.push_back(*it);
+    buffIDs.clear();
+    for (std::map<std::pair<unsigned int,GLenum>,std::vector<RecycledResource> >::iterator it = recycledBuffers.begin();
+         it != recycledBuffers.end(); ++it)
+        for (unsigned int ii=0;ii<it->second.size();ii++)
+            toRemove.push_back(it->second[ii].glId);
+    recycledBuffers.clear();
     if (!toRemove.empty())
         glDeleteBuffers((GLsizei)toRemove.size(), &toRemove[0]);
-    buffIDs.clear();
-    
+
     pthread_mutex_unlock(&idLock);
 }
 
 GLuint OpenGLMemManager::getTexID()
 {
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
     
     if (texIDs.empty())
     {
@@ -161,7 +300,7 @@ void OpenGLMemManager::removeTexID(GLuint texID)
 {
     bool doClear = false;
     
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
 
     // Clear out the texture data first
     glBindTexture(GL_TEXTURE_2D, texID);
@@ -181,29 +320,205 @@ void OpenGLMemManager::removeTexID(GLuint texID)
 // Clear out any and all texture IDs that we have sitting around
 void OpenGLMemManager::clearTextureIDs()
 {
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
     
     std::vector<GLuint> toRemove;
     toRemove.reserve(texIDs.size());
     for (std::set<GLuint>::iterator it = texIDs.begin();
          it != texIDs.end(); ++it)
         toRemove.push_back(*it);
+    texIDs.clear();
+    for (std::map<std::pair<std::pair<unsigned int,unsigned int>,GLenum>,std::vector<RecycledResource> >::iterator it = recycledTextures.begin();
+         it != recycledTextures.end(); ++it)
+        for (unsigned int ii=0;ii<it->second.size();ii++)
+            toRemove.push_back(it->second[ii].glId);
+    recycledTextures.clear();
     if (!toRemove.empty())
         glDeleteTextures((GLsizei)toRemove.size(), &toRemove[0]);
-    texIDs.clear();
-    
-    pthread_mutex_unlock(&idLock);    
+
+    pthread_mutex_unlock(&idLock);
+}
+
+void OpenGLMemManager::recycleBufferID(GLuint bufID,unsigned int size,GLenum drawType)
+{
+    if (!bufID)
+        return;
+    if (!ReuseBuffers || size == 0)
+    {
+        removeBufferID(bufID);
+        return;
+    }
+
+    RecycledResource recycled;
+    recycled.glId = bufID;
+    recycled.frame = frameCount;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    recycledBuffers[std::pair<unsigned int,GLenum>(size,drawType)].push_back(recycled);
+    pthread_mutex_unlock(&idLock);
+}
+
+void OpenGLMemManager::recycleTexID(GLuint texID,unsigned int width,unsigned int height,GLenum format)
+{
+    if (!texID)
+        return;
+    if (!ReuseBuffers || width == 0 || height == 0)
+    {
+        removeTexID(texID);
+        return;
+    }
+
+    // Note we don't clear the storage the way removeTexID() does.
+    // The whole point is handing the next same size request a texture
+    //  whose storage is already allocated.
+    RecycledResource recycled;
+    recycled.glId = texID;
+    recycled.frame = frameCount;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    recycledTextures[std::pair<std::pair<unsigned int,unsigned int>,GLenum>(std::pair<unsigned int,unsigned int>(width,height),format)].push_back(recycled);
+    pthread_mutex_unlock(&idLock);
+}
+
+GLuint OpenGLMemManager::getRecycledTexID(unsigned int width,unsigned int height,GLenum format)
+{
+    GLuint which = 0;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    std::map<std::pair<std::pair<unsigned int,unsigned int>,GLenum>,std::vector<RecycledResource> >::iterator it =
+        recycledTextures.find(std::pair<std::pair<unsigned int,unsigned int>,GLenum>(std::pair<unsigned int,unsigned int>(width,height),format));
+    if (it != recycledTextures.end() && !it->second.empty())
+    {
+        which = it->second.back().glId;
+        it->second.pop_back();
+        if (it->second.empty())
+            recycledTextures.erase(it);
+    }
+    pthread_mutex_unlock(&idLock);
+
+    return which;
+}
+
+void OpenGLMemManager::updateFrame()
+{
+    std::vector<GLuint> deadBuffers,deadTextures;
+
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    frameCount++;
+
+    // Anything that's been on a recycle list past the TTL isn't
+    //  coming back.  Let the memory go.
+    for (std::map<std::pair<unsigned int,GLenum>,std::vector<RecycledResource> >::iterator it = recycledBuffers.begin();
+         it != recycledBuffers.end(); )
+    {
+        std::vector<RecycledResource> &recycled = it->second;
+        for (unsigned int ii=0;ii<recycled.size(); )
+            if (frameCount - recycled[ii].frame > RecycleFrameTTL)
+            {
+                deadBuffers.push_back(recycled[ii].glId);
+                recycled[ii] = recycled.back();
+                recycled.pop_back();
+            } else
+                ii++;
+        if (recycled.empty())
+            recycledBuffers.erase(it++);
+        else
+            ++it;
+    }
+    for (std::map<std::pair<std::pair<unsigned int,unsigned int>,GLenum>,std::vector<RecycledResource> >::iterator it = recycledTextures.begin();
+         it != recycledTextures.end(); )
+    {
+        std::vector<RecycledResource> &recycled = it->second;
+        for (unsigned int ii=0;ii<recycled.size(); )
+            if (frameCount - recycled[ii].frame > RecycleFrameTTL)
+            {
+                deadTextures.push_back(recycled[ii].glId);
+                recycled[ii] = recycled.back();
+                recycled.pop_back();
+            } else
+                ii++;
+        if (recycled.empty())
+            recycledTextures.erase(it++);
+        else
+            ++it;
+    }
+    pthread_mutex_unlock(&idLock);
+
+    if (!deadBuffers.empty())
+        glDeleteBuffers((GLsizei)deadBuffers.size(), &deadBuffers[0]);
+    if (!deadTextures.empty())
+        glDeleteTextures((GLsizei)deadTextures.size(), &deadTextures[0]);
+}
+
+void OpenGLMemManager::addTrackedMem(WKGPUMemClass memClass,size_t bytes)
+{
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    trackedMem[memClass] += bytes;
+    PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemTexMemory,trackedMem[WKMemTexture]+trackedMem[WKMemTexAtlas]);
+    pthread_mutex_unlock(&idLock);
+}
+
+void OpenGLMemManager::subTrackedMem(WKGPUMemClass memClass,size_t bytes)
+{
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    if (bytes <= trackedMem[memClass])
+        trackedMem[memClass] -= bytes;
+    else
+        trackedMem[memClass] = 0;
+    PerformanceTimer::TelemetryCounters::set(PerformanceTimer::TelemetryCounters::TelemTexMemory,trackedMem[WKMemTexture]+trackedMem[WKMemTexAtlas]);
+    pthread_mutex_unlock(&idLock);
+}
+
+size_t OpenGLMemManager::getTrackedMem(size_t memByClass[WKMemMax])
+{
+    size_t total = 0;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    for (unsigned int ii=0;ii<WKMemMax;ii++)
+    {
+        if (memByClass)
+            memByClass[ii] = trackedMem[ii];
+        total += trackedMem[ii];
+    }
+    pthread_mutex_unlock(&idLock);
+
+    return total;
+}
+
+void OpenGLMemManager::setMemBudget(size_t bytes)
+{
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    memBudget = bytes;
+    pthread_mutex_unlock(&idLock);
+}
+
+bool OpenGLMemManager::isOverBudget()
+{
+    bool over = false;
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
+    if (memBudget > 0)
+    {
+        size_t total = 0;
+        for (unsigned int ii=0;ii<WKMemMax;ii++)
+            total += trackedMem[ii];
+        over = (total > memBudget);
+    }
+    pthread_mutex_unlock(&idLock);
+
+    return over;
 }
 
 void OpenGLMemManager::dumpStats()
 {
     NSLog(@"MemCache: %ld buffers",buffIDs.size());
     NSLog(@"MemCache: %ld textures",texIDs.size());
+    NSLog(@"MemCache: %ld recycled buffer classes, %ld recycled texture classes",recycledBuffers.size(),recycledTextures.size());
+    size_t memByClass[WKMemMax];
+    size_t total = getTrackedMem(memByClass);
+    NSLog(@"MemCache: %.2fMB tracked: %.2fMB textures, %.2fMB texture atlases, %.2fMB drawables, %.2fMB drawable atlases",
+          total / (1024.0*1024.0), memByClass[WKMemTexture] / (1024.0*1024.0), memByClass[WKMemTexAtlas] / (1024.0*1024.0),
+          memByClass[WKMemDrawable] / (1024.0*1024.0), memByClass[WKMemDrawAtlas] / (1024.0*1024.0));
 }
 		
 void OpenGLMemManager::lock()
 {
-    pthread_mutex_lock(&idLock);
+    WK_MUTEX_LOCK(&idLock,"OpenGLMemManager::idLock");
 }
 
 void OpenGLMemManager::unlock()
@@ -223,11 +538,70 @@ Drawable::~Drawable()
 	
 void DrawableChangeRequest::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
 {
-	DrawableRef theDrawable = scene->getDrawable(drawId);
-	if (theDrawable)
-		execute2(scene,renderer,theDrawable);
+    executeParallel(scene,renderer);
+    finishExecute(scene);
+}
+
+void DrawableChangeRequest::executeParallel(Scene *scene,WhirlyKitSceneRendererES *renderer)
+{
+    theDrawable = scene->getDrawable(drawId);
+    if (theDrawable)
+        execute2(scene,renderer,theDrawable);
+}
+
+void DrawableChangeRequest::finishExecute(Scene *scene)
+{
+    if (theDrawable)
+    {
+        // The change may have moved the drawable to a different state bucket
+        scene->getRenderStateBuckets()->updateDrawable(theDrawable);
+        theDrawable = DrawableRef();
+    }
 }
     
+// Convert a 32 bit float to a 16 bit half float bit pattern
+static GLushort FloatToHalf(float val)
+{
+    union { float f; unsigned int i; } conv;
+    conv.f = val;
+    unsigned int sign = (conv.i >> 16) & 0x8000;
+    int exp = ((conv.i >> 23) & 0xff) - 127 + 15;
+    unsigned int mant = conv.i & 0x7fffff;
+    // Flush underflow to zero, clamp overflow to infinity
+    if (exp <= 0)
+        return sign;
+    if (exp >= 31)
+        return sign | 0x7c00;
+    return sign | (exp << 10) | (mant >> 13);
+}
+
+// And back the other way, for the few places that rewrite stored values
+static float HalfToFloat(GLushort val)
+{
+    union { float f; unsigned int i; } conv;
+    unsigned int sign = (val & 0x8000) << 16;
+    int exp = (val >> 10) & 0x1f;
+    unsigned int mant = val & 0x3ff;
+    if (exp == 0)
+    {
+        conv.i = sign;
+        return conv.f;
+    }
+    conv.i = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    return conv.f;
+}
+
+// Pack a unit normal into four signed bytes
+static PackedNormal PackNormal(const Vector3f &norm)
+{
+    PackedNormal packed;
+    packed.x = norm.x() * 127;
+    packed.y = norm.y() * 127;
+    packed.z = norm.z() * 127;
+    packed.w = 0;
+    return packed;
+}
+
 VertexAttribute::VertexAttribute(BDAttributeDataType dataType,const std::string &name)
     : dataType(dataType), name(name), data(NULL), buffer(0)
 {
@@ -296,9 +670,21 @@ void VertexAttribute::addColor(const RGBAColor &color)
 
 void VertexAttribute::addVector2f(const Eigen::Vector2f &vec)
 {
+    if (dataType == BDHalf2Type)
+    {
+        if (!data)
+            data = new std::vector<HalfVec2>();
+        std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+        HalfVec2 halfVec;
+        halfVec.x = FloatToHalf(vec.x());
+        halfVec.y = FloatToHalf(vec.y());
+        (*halfVecs).push_back(halfVec);
+        return;
+    }
+
     if (dataType != BDFloat2Type)
         return;
-    
+
     if (!data)
         data = new std::vector<Vector2f>();
     std::vector<Vector2f> *vecs = (std::vector<Vector2f> *)data;
@@ -307,9 +693,18 @@ void VertexAttribute::addVector2f(const Eigen::Vector2f &vec)
 
 void VertexAttribute::addVector3f(const Eigen::Vector3f &vec)
 {
+    if (dataType == BDChar4nType)
+    {
+        if (!data)
+            data = new std::vector<PackedNormal>();
+        std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+        (*normals).push_back(PackNormal(vec));
+        return;
+    }
+
     if (dataType != BDFloat3Type)
         return;
-    
+
     if (!data)
         data = new std::vector<Vector3f>();
     std::vector<Vector3f> *vecs = (std::vector<Vector3f> *)data;
@@ -364,7 +759,23 @@ void VertexAttribute::reserve(int size)
             floats->reserve(size);
         }
             break;
-    }    
+        case BDHalf2Type:
+        {
+            if (!data)
+                data = new std::vector<HalfVec2>();
+            std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+            halfVecs->reserve(size);
+        }
+            break;
+        case BDChar4nType:
+        {
+            if (!data)
+                data = new std::vector<PackedNormal>();
+            std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+            normals->reserve(size);
+        }
+            break;
+    }
 }
 
 /// Number of elements in our array
@@ -399,7 +810,19 @@ int VertexAttribute::numElements() const
             return (int)floats->size();
         }
             break;
-    }    
+        case BDHalf2Type:
+        {
+            std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+            return (int)halfVecs->size();
+        }
+            break;
+        case BDChar4nType:
+        {
+            std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+            return (int)normals->size();
+        }
+            break;
+    }
 }
 
 /// Return the size of a single element
@@ -419,7 +842,13 @@ int VertexAttribute::size() const
         case BDFloatType:
             return sizeof(GLfloat);
             break;
-    }    
+        case BDHalf2Type:
+            return sizeof(GLushort)*2;
+            break;
+        case BDChar4nType:
+            return sizeof(signed char)*4;
+            break;
+    }
 }
 
 /// Clean out the data array
@@ -453,9 +882,62 @@ void VertexAttribute::clear()
                 delete floats;
             }
                 break;
+            case BDHalf2Type:
+            {
+                std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+                delete halfVecs;
+            }
+                break;
+            case BDChar4nType:
+            {
+                std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+                delete normals;
+            }
+                break;
         }
     }
-    data = NULL;    
+    data = NULL;
+}
+
+// Rebuild a typed data array in the given source index order
+template <typename T>
+static void PermuteDataArray(void *data,const std::vector<unsigned int> &srcIndices)
+{
+    std::vector<T> *vec = (std::vector<T> *)data;
+    std::vector<T> newVec;
+    newVec.reserve(srcIndices.size());
+    for (unsigned int ii=0;ii<srcIndices.size();ii++)
+        newVec.push_back((*vec)[srcIndices[ii]]);
+    vec->swap(newVec);
+}
+
+/// Rebuild the data array in the given source index order
+void VertexAttribute::permute(const std::vector<unsigned int> &srcIndices)
+{
+    if (!data)
+        return;
+
+    switch (dataType)
+    {
+        case BDFloat3Type:
+            PermuteDataArray<Vector3f>(data,srcIndices);
+            break;
+        case BDFloat2Type:
+            PermuteDataArray<Vector2f>(data,srcIndices);
+            break;
+        case BDChar4Type:
+            PermuteDataArray<RGBAColor>(data,srcIndices);
+            break;
+        case BDFloatType:
+            PermuteDataArray<float>(data,srcIndices);
+            break;
+        case BDHalf2Type:
+            PermuteDataArray<HalfVec2>(data,srcIndices);
+            break;
+        case BDChar4nType:
+            PermuteDataArray<PackedNormal>(data,srcIndices);
+            break;
+    }
 }
 
 /// Return a pointer to the given element
@@ -487,48 +969,207 @@ void *VertexAttribute::addressForElement(int which)
             return &(*floats)[which];
         }
             break;
+        case BDHalf2Type:
+        {
+            std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+            return &(*halfVecs)[which];
+        }
+            break;
+        case BDChar4nType:
+        {
+            std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+            return &(*normals)[which];
+        }
+            break;
     }
-    
+
     return NULL;
 }
 
-/// Return the number of components as needed by glVertexAttribPointer
-GLuint VertexAttribute::glEntryComponents() const
+/// Return a pointer to the start of the (contiguous) element array
+const void *VertexAttribute::dataStart() const
 {
+    if (!data || numElements() == 0)
+        return NULL;
+
     switch (dataType)
     {
         case BDFloat3Type:
-            return 3;
+        {
+            std::vector<Vector3f> *vecs = (std::vector<Vector3f> *)data;
+            return &(*vecs)[0];
+        }
             break;
         case BDFloat2Type:
-            return 2;
+        {
+            std::vector<Vector2f> *vecs = (std::vector<Vector2f> *)data;
+            return &(*vecs)[0];
+        }
             break;
         case BDChar4Type:
-            return 4;
+        {
+            std::vector<RGBAColor> *colors = (std::vector<RGBAColor> *)data;
+            return &(*colors)[0];
+        }
             break;
         case BDFloatType:
-            return 1;
+        {
+            std::vector<float> *floats = (std::vector<float> *)data;
+            return &(*floats)[0];
+        }
+            break;
+        case BDHalf2Type:
+        {
+            std::vector<HalfVec2> *halfVecs = (std::vector<HalfVec2> *)data;
+            return &(*halfVecs)[0];
+        }
+            break;
+        case BDChar4nType:
+        {
+            std::vector<PackedNormal> *normals = (std::vector<PackedNormal> *)data;
+            return &(*normals)[0];
+        }
             break;
     }
-    
-    return 0;
+
+    return NULL;
 }
 
-/// Return the data type as required by glVertexAttribPointer
-GLenum VertexAttribute::glType() const
+/// Copy every element into an interleaved buffer in one strided pass
+void VertexAttribute::copyToBuffer(unsigned char *basePtr,int stride) const
 {
+    int num = numElements();
+    if (num == 0)
+        return;
+    const unsigned char *src = (const unsigned char *)dataStart();
+    int elSize = size();
+
+    // If we're the only thing in the buffer it's one big copy
+    if (stride == elSize)
+    {
+        memcpy(basePtr, src, num*elSize);
+        return;
+    }
+
+    // Fixed size copies the compiler can turn into simple stores
     switch (dataType)
     {
         case BDFloat3Type:
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, 3*sizeof(GLfloat));
+            break;
         case BDFloat2Type:
-        case BDFloatType:
-            return GL_FLOAT;
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, 2*sizeof(GLfloat));
             break;
         case BDChar4Type:
-            return GL_UNSIGNED_BYTE;
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, 4*sizeof(unsigned char));
+            break;
+        case BDFloatType:
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, sizeof(GLfloat));
+            break;
+        case BDHalf2Type:
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, 2*sizeof(GLushort));
+            break;
+        case BDChar4nType:
+            for (int ii=0;ii<num;ii++,basePtr+=stride,src+=elSize)
+                memcpy(basePtr, src, 4*sizeof(signed char));
             break;
     }
-    return GL_UNSIGNED_BYTE;
+}
+
+// Bulk append raw elements to a typed data array
+template <typename T>
+static void AppendRawDataArray(void *&data,const void *srcData,int numElems)
+{
+    if (!data)
+        data = new std::vector<T>();
+    std::vector<T> *vec = (std::vector<T> *)data;
+    size_t oldSize = vec->size();
+    vec->resize(oldSize+numElems);
+    memcpy(&(*vec)[oldSize], srcData, numElems*sizeof(T));
+}
+
+void VertexAttribute::appendRawData(const void *srcData,int numElems)
+{
+    if (numElems <= 0)
+        return;
+
+    switch (dataType)
+    {
+        case BDFloat3Type:
+            AppendRawDataArray<Vector3f>(data,srcData,numElems);
+            break;
+        case BDFloat2Type:
+            AppendRawDataArray<Vector2f>(data,srcData,numElems);
+            break;
+        case BDChar4Type:
+            AppendRawDataArray<RGBAColor>(data,srcData,numElems);
+            break;
+        case BDFloatType:
+            AppendRawDataArray<float>(data,srcData,numElems);
+            break;
+        case BDHalf2Type:
+            AppendRawDataArray<HalfVec2>(data,srcData,numElems);
+            break;
+        case BDChar4nType:
+            AppendRawDataArray<PackedNormal>(data,srcData,numElems);
+            break;
+    }
+}
+
+/// Return the number of components as needed by glVertexAttribPointer
+GLuint VertexAttribute::glEntryComponents() const
+{
+    switch (dataType)
+    {
+        case BDFloat3Type:
+            return 3;
+            break;
+        case BDFloat2Type:
+            return 2;
+            break;
+        case BDChar4Type:
+            return 4;
+            break;
+        case BDFloatType:
+            return 1;
+            break;
+        case BDHalf2Type:
+            return 2;
+            break;
+        case BDChar4nType:
+            return 4;
+            break;
+    }
+
+    return 0;
+}
+
+/// Return the data type as required by glVertexAttribPointer
+GLenum VertexAttribute::glType() const
+{
+    switch (dataType)
+    {
+        case BDFloat3Type:
+        case BDFloat2Type:
+        case BDFloatType:
+            return GL_FLOAT;
+            break;
+        case BDChar4Type:
+            return GL_UNSIGNED_BYTE;
+            break;
+        case BDHalf2Type:
+            return GL_HALF_FLOAT_OES;
+            break;
+        case BDChar4nType:
+            return GL_BYTE;
+            break;
+    }
+    return GL_UNSIGNED_BYTE;
 }
 
 /// Whether or not glVertexAttribPointer will normalize the data
@@ -539,9 +1180,11 @@ GLboolean VertexAttribute::glNormalize() const
         case BDFloat3Type:
         case BDFloat2Type:
         case BDFloatType:
+        case BDHalf2Type:
             return GL_FALSE;
             break;
         case BDChar4Type:
+        case BDChar4nType:
             return GL_TRUE;
             break;
     }
@@ -563,6 +1206,12 @@ void VertexAttribute::glSetDefault(int index) const
         case BDChar4Type:
             glVertexAttrib4f(index, defaultData.color[0] / 255.0, defaultData.color[1] / 255.0, defaultData.color[2] / 255.0, defaultData.color[3] / 255.0);
             break;
+        case BDHalf2Type:
+            glVertexAttrib2f(index, defaultData.vec2[0], defaultData.vec2[1]);
+            break;
+        case BDChar4nType:
+            glVertexAttrib3f(index, defaultData.vec3[0], defaultData.vec3[1], defaultData.vec3[2]);
+            break;
     }
 }
 	
@@ -578,11 +1227,14 @@ BasicDrawable::BasicDrawable(const std::string &name)
 	type = 0;
     minVisible = maxVisible = DrawVisibleInvalid;
     minVisibleFadeBand = maxVisibleFadeBand = 0.0;
+    gateWorldRadius = gateMinPix = 0.0;
+    gateWasOn = true;
 
     fadeDown = fadeUp = 0.0;
+    startEnable = endEnable = 0.0;
 	color.r = color.g = color.b = color.a = 255;
     lineWidth = 1.0;
-    
+
     numTris = 0;
     numPoints = 0;
     
@@ -591,11 +1243,14 @@ BasicDrawable::BasicDrawable(const std::string &name)
     vertexSize = 0;
     vertArrayObj = 0;
     sharedBufferIsExternal = false;
+    sharedBufferIsPooled = false;
+    sharedBufferSize = 0;
     requestZBuffer = false;
     writeZBuffer = true;
+    drawVariant = DrawVariantGeneral;
 
     hasMatrix = false;
-    
+
     setupStandardAttributes();
 }
 	
@@ -612,11 +1267,14 @@ BasicDrawable::BasicDrawable(const std::string &name,unsigned int numVert,unsign
     setupStandardAttributes(numVert);
 	tris.reserve(numTri);
     fadeDown = fadeUp = 0.0;
+    startEnable = endEnable = 0.0;
 	color.r = color.g = color.b = color.a = 255;
     lineWidth = 1.0;
 	drawPriority = 0;
     minVisible = maxVisible = DrawVisibleInvalid;
     minVisibleFadeBand = maxVisibleFadeBand = 0.0;
+    gateWorldRadius = gateMinPix = 0.0;
+    gateWasOn = true;
     requestZBuffer = false;
     writeZBuffer = true;
 
@@ -628,6 +1286,9 @@ BasicDrawable::BasicDrawable(const std::string &name,unsigned int numVert,unsign
     vertexSize = 0;
     vertArrayObj = 0;
     sharedBufferIsExternal = false;
+    sharedBufferIsPooled = false;
+    sharedBufferSize = 0;
+    drawVariant = DrawVariantGeneral;
 
     hasMatrix = false;
 }
@@ -686,13 +1347,41 @@ unsigned int BasicDrawable::getDrawPriority() const
     
 bool BasicDrawable::isOn(WhirlyKitRendererFrameInfo *frameInfo) const
 {
-    if (minVisible == DrawVisibleInvalid || !on)
-        return on;
+    // Drawables with an enable window expire on their own
+    if (startEnable != endEnable)
+        if (frameInfo.currentTime < startEnable || endEnable < frameInfo.currentTime)
+            return false;
 
-    double visVal = [frameInfo.theView heightAboveSurface];
-    
-    return ((minVisible <= visVal && visVal <= maxVisible) ||
-             (maxVisible <= visVal && visVal <= minVisible));
+    if (!on)
+        return false;
+
+    if (minVisible != DrawVisibleInvalid)
+    {
+        double visVal = [frameInfo.theView heightAboveSurface];
+
+        if (!((minVisible <= visVal && visVal <= maxVisible) ||
+              (maxVisible <= visVal && visVal <= minVisible)))
+            return false;
+    }
+
+    // Screen space size gate.  If we'd project smaller than the pixel
+    //  cutoff there's no point feeding the vertices to the GPU.
+    //  Coming back on takes a bit more than dropping out did, so we
+    //  don't flicker right at the cutoff.
+    if (gateWorldRadius > 0.0 && gateMinPix > 0.0)
+    {
+        double screenWidth = frameInfo.screenSizeInDisplayCoords.x();
+        if (screenWidth > 0.0)
+        {
+            float pixSize = 2.0*gateWorldRadius * frameInfo.sceneRenderer.framebufferWidth / screenWidth;
+            float cutoff = (gateWasOn ? gateMinPix : 1.5*gateMinPix);
+            gateWasOn = (pixSize > cutoff);
+            if (!gateWasOn)
+                return false;
+        }
+    }
+
+    return true;
 }
     
 void BasicDrawable::setOnOff(bool onOff)
@@ -832,6 +1521,9 @@ RGBAColor BasicDrawable::getColor() const
 void BasicDrawable::setVisibleRange(float minVis,float maxVis,float minVisBand,float maxVisBand)
 { minVisible = minVis;  maxVisible = maxVis;  minVisibleFadeBand = minVisBand; maxVisibleFadeBand = maxVisBand; }
 
+void BasicDrawable::setScreenSpaceGate(float worldRadius,float minPix)
+{ gateWorldRadius = worldRadius;  gateMinPix = minPix;  gateWasOn = true; }
+
 void BasicDrawable::getVisibleRange(float &minVis,float &maxVis)
 { minVis = minVisible;  maxVis = maxVisible; }
 
@@ -841,6 +1533,9 @@ void BasicDrawable::getVisibleRange(float &minVis,float &maxVis,float &minVisBan
 void BasicDrawable::setFade(NSTimeInterval inFadeDown,NSTimeInterval inFadeUp)
 { fadeUp = inFadeUp;  fadeDown = inFadeDown; }
 
+void BasicDrawable::setEnableTimeRange(NSTimeInterval inStartEnable,NSTimeInterval inEndEnable)
+{ startEnable = inStartEnable;  endEnable = inEndEnable; }
+
 void BasicDrawable::setLineWidth(float inWidth)
 { lineWidth = inWidth; }
 
@@ -917,6 +1612,239 @@ void BasicDrawable::addAttributeValue(int attrId,float val)
 void BasicDrawable::addTriangle(Triangle tri)
 { tris.push_back(tri); }
 
+// Vertex cache size we tune the triangle ordering for.  The real caches
+//  are smaller, but the score function falls off smoothly so this works
+//  across the range of GPUs we see.
+static const int VertexCacheSize = 24;
+
+// Tom Forsyth's vertex score.  Recently used vertices are cheap, vertices
+//  with few triangles left get a boost so they finish early.
+static float VertexCacheScore(int cachePos,int numActiveTris)
+{
+    if (numActiveTris <= 0)
+        return -1.0;
+
+    float score = 0.0;
+    if (cachePos >= 0)
+    {
+        if (cachePos < 3)
+        {
+            // The three most recent vertices.  Don't favor any one of them
+            //  or we'd just chew through one long strip.
+            score = 0.75;
+        } else {
+            float scaledPos = 1.0 - (cachePos - 3) / (float)(VertexCacheSize - 3);
+            score = scaledPos * sqrtf(scaledPos);
+        }
+    }
+
+    // Valence boost
+    score += 2.0 / sqrtf((float)numActiveTris);
+
+    return score;
+}
+
+// Rebuild the vertices in the given source index order
+static void PermuteVertexData(std::vector<Eigen::Vector3f> &points,std::vector<VertexAttribute *> &vertexAttributes,const std::vector<unsigned int> &srcIndices)
+{
+    std::vector<Eigen::Vector3f> newPoints;
+    newPoints.reserve(srcIndices.size());
+    for (unsigned int ii=0;ii<srcIndices.size();ii++)
+        newPoints.push_back(points[srcIndices[ii]]);
+    points.swap(newPoints);
+
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+        vertexAttributes[ii]->permute(srcIndices);
+}
+
+void BasicDrawable::optimizeTriangles()
+{
+    if (type != GL_TRIANGLES || tris.empty() || points.empty())
+        return;
+
+    int numVerts = (int)points.size();
+
+    // Weld identical vertices together.  The builders mostly emit three
+    //  vertices per triangle, so for tessellated areals this cuts the
+    //  vertex count way down.  Two vertices are the same only if every
+    //  attribute matches, so we compare the raw bytes.
+    std::vector<unsigned short> remap(numVerts);
+    std::vector<unsigned int> srcIndices;
+    srcIndices.reserve(numVerts);
+    std::map<std::vector<unsigned char>,unsigned short> vertMap;
+    std::vector<unsigned char> key;
+    for (int ii=0;ii<numVerts;ii++)
+    {
+        key.clear();
+        const unsigned char *pt = (const unsigned char *)&points[ii];
+        key.insert(key.end(),pt,pt+sizeof(Eigen::Vector3f));
+        for (unsigned int jj=0;jj<vertexAttributes.size();jj++)
+        {
+            VertexAttribute *attr = vertexAttributes[jj];
+            if (attr->numElements() > ii)
+            {
+                const unsigned char *elem = (const unsigned char *)attr->addressForElement(ii);
+                key.insert(key.end(),elem,elem+attr->size());
+            }
+        }
+        std::map<std::vector<unsigned char>,unsigned short>::iterator it = vertMap.find(key);
+        if (it != vertMap.end())
+            remap[ii] = it->second;
+        else {
+            unsigned short newIdx = (unsigned short)srcIndices.size();
+            vertMap[key] = newIdx;
+            remap[ii] = newIdx;
+            srcIndices.push_back(ii);
+        }
+    }
+    if ((int)srcIndices.size() < numVerts)
+    {
+        PermuteVertexData(points,vertexAttributes,srcIndices);
+        numVerts = (int)srcIndices.size();
+        for (unsigned int ii=0;ii<tris.size();ii++)
+            for (unsigned int jj=0;jj<3;jj++)
+                tris[ii].verts[jj] = remap[tris[ii].verts[jj]];
+    }
+
+    // Forsyth style reorder.  Greedily emit the triangle with the best
+    //  vertex scores, keeping a model of the post transform cache.
+    int numTris = (int)tris.size();
+    std::vector<int> numActiveTris(numVerts,0);
+    for (int ii=0;ii<numTris;ii++)
+        for (unsigned int jj=0;jj<3;jj++)
+            numActiveTris[tris[ii].verts[jj]]++;
+
+    // Triangle lists per vertex, packed into one array
+    std::vector<int> vertTriOffset(numVerts+1,0);
+    for (int ii=0;ii<numVerts;ii++)
+        vertTriOffset[ii+1] = vertTriOffset[ii] + numActiveTris[ii];
+    std::vector<int> vertTris(vertTriOffset[numVerts]);
+    {
+        std::vector<int> vertTriFill(vertTriOffset.begin(),vertTriOffset.end()-1);
+        for (int ii=0;ii<numTris;ii++)
+            for (unsigned int jj=0;jj<3;jj++)
+                vertTris[vertTriFill[tris[ii].verts[jj]]++] = ii;
+    }
+
+    std::vector<int> cachePos(numVerts,-1);
+    std::vector<float> vertScore(numVerts);
+    for (int ii=0;ii<numVerts;ii++)
+        vertScore[ii] = VertexCacheScore(-1,numActiveTris[ii]);
+
+    std::vector<float> triScore(numTris);
+    std::vector<bool> triAdded(numTris,false);
+    for (int ii=0;ii<numTris;ii++)
+        triScore[ii] = vertScore[tris[ii].verts[0]] + vertScore[tris[ii].verts[1]] + vertScore[tris[ii].verts[2]];
+
+    std::vector<Triangle> newTris;
+    newTris.reserve(numTris);
+    // Model of the cache, most recent first, with room for the overflow
+    int cache[VertexCacheSize+3];
+    int cacheSize = 0;
+    int scanPos = 0;
+
+    for (int outTri=0;outTri<numTris;outTri++)
+    {
+        // Best triangle among the ones touching the cache
+        int bestTri = -1;
+        float bestScore = -1.0;
+        for (int ci=0;ci<cacheSize;ci++)
+        {
+            int vert = cache[ci];
+            for (int ti=vertTriOffset[vert];ti<vertTriOffset[vert]+numActiveTris[vert];ti++)
+            {
+                int tri = vertTris[ti];
+                if (triScore[tri] > bestScore)
+                {
+                    bestScore = triScore[tri];
+                    bestTri = tri;
+                }
+            }
+        }
+        // Cache ran dry (start, or an isolated patch).  Scan forward for
+        //  the next unemitted triangle.  scanPos never backs up, so this
+        //  is linear over the whole run.
+        if (bestTri < 0)
+        {
+            while (triAdded[scanPos])
+                scanPos++;
+            bestTri = scanPos;
+        }
+
+        triAdded[bestTri] = true;
+        newTris.push_back(tris[bestTri]);
+
+        for (unsigned int jj=0;jj<3;jj++)
+        {
+            int vert = tris[bestTri].verts[jj];
+            // Pull the triangle out of the vertex's list
+            for (int ti=vertTriOffset[vert];ti<vertTriOffset[vert]+numActiveTris[vert];ti++)
+                if (vertTris[ti] == bestTri)
+                {
+                    vertTris[ti] = vertTris[vertTriOffset[vert]+numActiveTris[vert]-1];
+                    break;
+                }
+            numActiveTris[vert]--;
+
+            // Move the vertex to the front of the cache
+            int oldPos = cachePos[vert];
+            if (oldPos < 0)
+                oldPos = cacheSize < VertexCacheSize+3 ? cacheSize++ : cacheSize-1;
+            for (int ci=oldPos;ci>0;ci--)
+            {
+                cache[ci] = cache[ci-1];
+                cachePos[cache[ci]] = ci;
+            }
+            cache[0] = vert;
+            cachePos[vert] = 0;
+        }
+        // Anything pushed past the end falls out of the cache
+        while (cacheSize > VertexCacheSize)
+        {
+            int vert = cache[cacheSize-1];
+            cachePos[vert] = -1;
+            cacheSize--;
+            float newScore = VertexCacheScore(-1,numActiveTris[vert]);
+            float diff = newScore - vertScore[vert];
+            vertScore[vert] = newScore;
+            for (int ti=vertTriOffset[vert];ti<vertTriOffset[vert]+numActiveTris[vert];ti++)
+                triScore[vertTris[ti]] += diff;
+        }
+
+        // Rescore the cached vertices and the triangles they touch
+        for (int ci=0;ci<cacheSize;ci++)
+        {
+            int vert = cache[ci];
+            float newScore = VertexCacheScore(cachePos[vert],numActiveTris[vert]);
+            float diff = newScore - vertScore[vert];
+            vertScore[vert] = newScore;
+            for (int ti=vertTriOffset[vert];ti<vertTriOffset[vert]+numActiveTris[vert];ti++)
+                triScore[vertTris[ti]] += diff;
+        }
+    }
+    tris.swap(newTris);
+
+    // Lay the vertices out in first use order so the pre transform
+    //  fetch walks forward through the buffer
+    std::vector<int> newIdx(numVerts,-1);
+    std::vector<unsigned int> vertOrder;
+    vertOrder.reserve(numVerts);
+    for (unsigned int ii=0;ii<tris.size();ii++)
+        for (unsigned int jj=0;jj<3;jj++)
+        {
+            unsigned short &vert = tris[ii].verts[jj];
+            if (newIdx[vert] < 0)
+            {
+                newIdx[vert] = (int)vertOrder.size();
+                vertOrder.push_back(vert);
+            }
+            vert = newIdx[vert];
+        }
+    // Vertices no triangle references fall out here, which is fine.
+    // Nothing would have drawn them anyway.
+    PermuteVertexData(points,vertexAttributes,vertOrder);
+}
+
 SimpleIdentity BasicDrawable::getTexId(unsigned int which)
 {
     SimpleIdentity texId = EmptyIdentity;
@@ -926,12 +1854,18 @@ SimpleIdentity BasicDrawable::getTexId(unsigned int which)
     return texId;
 }
 
+SimpleIdentity BasicDrawable::getStateTexId() const
+{
+    return texInfo.empty() ? EmptyIdentity : texInfo[0].texId;
+}
+
 // If we're fading in or out, update the rendering window
 void BasicDrawable::updateRenderer(WhirlyKitSceneRendererES *renderer)
 {
     [renderer setRenderUntil:fadeUp];
     [renderer setRenderUntil:fadeDown];
-    
+    [renderer setRenderUntil:endEnable];
+
     // Let's also pull the default shaders out if need be
     if (programId == EmptyIdentity)
     {
@@ -943,6 +1877,13 @@ void BasicDrawable::updateRenderer(WhirlyKitSceneRendererES *renderer)
 }
         
 // Move the texture coordinates around and apply a new texture
+void BasicDrawable::setTexTransform(unsigned int which,const Point2f &scale,const Point2f &offset)
+{
+    setupTexCoordEntry(which, 0);
+    texInfo[which].texScale = scale;
+    texInfo[which].texOffset = offset;
+}
+
 void BasicDrawable::applySubTexture(int which,SubTexture subTex,int startingAt)
 {
     if (which == -1)
@@ -955,12 +1896,26 @@ void BasicDrawable::applySubTexture(int which,SubTexture subTex,int startingAt)
         
         TexInfo &thisTexInfo = texInfo[which];
         thisTexInfo.texId = subTex.texId;
-        std::vector<TexCoord> *texCoords = (std::vector<TexCoord> *)vertexAttributes[thisTexInfo.texCoordEntry]->data;
-        
-        for (unsigned int ii=startingAt;ii<texCoords->size();ii++)
+        VertexAttribute *texAttr = vertexAttributes[thisTexInfo.texCoordEntry];
+        if (texAttr->getDataType() == BDHalf2Type)
         {
-            Point2f tc = (*texCoords)[ii];
-            (*texCoords)[ii] = subTex.processTexCoord(TexCoord(tc.x(),tc.y()));
+            std::vector<HalfVec2> *texCoords = (std::vector<HalfVec2> *)texAttr->data;
+
+            for (unsigned int ii=startingAt;ii<texCoords->size();ii++)
+            {
+                HalfVec2 &tc = (*texCoords)[ii];
+                TexCoord newCoord = subTex.processTexCoord(TexCoord(HalfToFloat(tc.x),HalfToFloat(tc.y)));
+                tc.x = FloatToHalf(newCoord.x());
+                tc.y = FloatToHalf(newCoord.y());
+            }
+        } else {
+            std::vector<TexCoord> *texCoords = (std::vector<TexCoord> *)texAttr->data;
+
+            for (unsigned int ii=startingAt;ii<texCoords->size();ii++)
+            {
+                Point2f tc = (*texCoords)[ii];
+                (*texCoords)[ii] = subTex.processTexCoord(TexCoord(tc.x(),tc.y()));
+            }
         }
     }
 }
@@ -969,9 +1924,23 @@ int BasicDrawable::addAttribute(BDAttributeDataType dataType,const std::string &
 {
     VertexAttribute *attr = new VertexAttribute(dataType,name);
     vertexAttributes.push_back(attr);
-    
+
     return (unsigned int)(vertexAttributes.size()-1);
 }
+
+void BasicDrawable::setCompactVertexFormat()
+{
+    // We can switch the types around, but only before any data shows up
+    for (unsigned int ii=0;ii<texInfo.size();ii++)
+    {
+        VertexAttribute *texAttr = vertexAttributes[texInfo[ii].texCoordEntry];
+        if (!texAttr->data)
+            texAttr->dataType = BDHalf2Type;
+    }
+    VertexAttribute *normAttr = vertexAttributes[normalEntry];
+    if (!normAttr->data)
+        normAttr->dataType = BDChar4nType;
+}
     
 unsigned int BasicDrawable::getNumPoints() const
 { return (unsigned int)points.size(); }
@@ -1006,6 +1975,20 @@ void BasicDrawable::setMatrix(const Eigen::Matrix4d *inMat)
 const Eigen::Matrix4d *BasicDrawable::getMatrix() const
 { if (hasMatrix) return &mat;  return NULL; }
 
+size_t BasicDrawable::memorySize() const
+{
+    size_t total = sizeof(BasicDrawable);
+    total += points.capacity() * sizeof(Point3f);
+    total += tris.capacity() * sizeof(Triangle);
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+    {
+        const VertexAttribute *attr = vertexAttributes[ii];
+        total += sizeof(VertexAttribute) + attr->numElements() * attr->size();
+    }
+
+    return total;
+}
+
 // Size of a single vertex in an interleaved buffer
 // Note: We're resetting the buffers for no good reason
 GLuint BasicDrawable::singleVertexSize()
@@ -1075,13 +2058,24 @@ void BasicDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *me
 	if (drawOffset != 0 && (points.size() == vertexAttributes[normalEntry]->numElements()))
 	{
 		float scale = setupInfo->minZres*drawOffset;
-        std::vector<Point3f> &norms = *(std::vector<Point3f> *)vertexAttributes[normalEntry]->data;
-        
-		for (unsigned int ii=0;ii<points.size();ii++)
-		{
-			Vector3f pt = points[ii];
-			points[ii] = norms[ii] * scale + pt;
-		}
+        if (vertexAttributes[normalEntry]->getDataType() == BDChar4nType)
+        {
+            std::vector<PackedNormal> &norms = *(std::vector<PackedNormal> *)vertexAttributes[normalEntry]->data;
+
+            for (unsigned int ii=0;ii<points.size();ii++)
+            {
+                PackedNormal &norm = norms[ii];
+                points[ii] += Vector3f(norm.x,norm.y,norm.z) * (scale / 127.0);
+            }
+        } else {
+            std::vector<Point3f> &norms = *(std::vector<Point3f> *)vertexAttributes[normalEntry]->data;
+
+            for (unsigned int ii=0;ii<points.size();ii++)
+            {
+                Vector3f pt = points[ii];
+                points[ii] = norms[ii] * scale + pt;
+            }
+        }
 	}
 	
 	pointBuffer = triBuffer = 0;
@@ -1107,9 +2101,20 @@ void BasicDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *me
         {
                 bufferSize += tris.size()*sizeof(Triangle);
         }
-        sharedBuffer = memManager->getBufferID(bufferSize,GL_STATIC_DRAW);
-        sharedBufferOffset = 0;
         sharedBufferIsExternal = false;
+        // Small drawables share a region of a big pool buffer rather
+        //  than owning a VBO apiece
+        if (memManager->subAllocBuffer(bufferSize,poolAlloc))
+        {
+            sharedBuffer = poolAlloc.bufID;
+            sharedBufferOffset = poolAlloc.offset;
+            sharedBufferIsPooled = true;
+        } else {
+            sharedBuffer = memManager->getBufferID(bufferSize,GL_STATIC_DRAW);
+            sharedBufferOffset = 0;
+            sharedBufferSize = bufferSize;
+        }
+        memManager->addTrackedMem(WKMemDrawable,bufferSize);
 	}
     
     // Now copy in the data
@@ -1119,18 +2124,33 @@ void BasicDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *me
     if (context.API < kEAGLRenderingAPIOpenGLES3)
         glMem = glMapBufferOES(GL_ARRAY_BUFFER, GL_WRITE_ONLY_OES);
     else
-        glMem = glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT);
+        glMem = glMapBufferRange(GL_ARRAY_BUFFER, 0, sharedBufferOffset+bufferSize, GL_MAP_WRITE_BIT);
+    // Fill the buffer attribute major: one strided pass per array,
+    //  rather than revisiting every attribute for every vertex
     unsigned char *basePtr = (unsigned char *)glMem + sharedBufferOffset;
-    for (unsigned int ii=0;ii<numVerts;ii++,basePtr+=vertexSize)
-        addPointToBuffer(basePtr,ii,NULL);
+    if (!points.empty())
+    {
+        if (vertexSize == 3*sizeof(GLfloat))
+            // Nothing but points, so it's one big copy
+            memcpy(basePtr+pointBuffer, &points[0].x(), numVerts*3*sizeof(GLfloat));
+        else {
+            unsigned char *ptr = basePtr+pointBuffer;
+            for (unsigned int ii=0;ii<numVerts;ii++,ptr+=vertexSize)
+                memcpy(ptr, &points[ii].x(), 3*sizeof(GLfloat));
+        }
+    }
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+    {
+        VertexAttribute *attr = vertexAttributes[ii];
+        if (attr->numElements() != 0)
+            attr->copyToBuffer(basePtr+attr->buffer, vertexSize);
+    }
 
     // And copy in the element buffer
 	if (tris.size())
 	{
         triBuffer = vertexSize*numVerts;
-        unsigned char *basePtr = (unsigned char *)glMem + triBuffer + sharedBufferOffset;
-        for (unsigned int ii=0;ii<tris.size();ii++,basePtr+=sizeof(Triangle))
-            memcpy(basePtr, &tris[ii], sizeof(Triangle));
+        memcpy((unsigned char *)glMem + triBuffer + sharedBufferOffset, &tris[0], tris.size()*sizeof(Triangle));
 	}
     if (context.API < kEAGLRenderingAPIOpenGLES3)
         glUnmapBufferOES(GL_ARRAY_BUFFER);
@@ -1146,8 +2166,29 @@ void BasicDrawable::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *me
     tris.clear();
     for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
         vertexAttributes[ii]->clear();
-    
+
     usingBuffers = true;
+
+    chooseDrawVariant();
+}
+
+// Decide which draw path this drawable can take, now that the data's
+//  in GL.  With everything in the shared interleaved buffer, the per
+//  frame feature sniffing in drawOGL2 collapses to straight line code.
+void BasicDrawable::chooseDrawVariant()
+{
+    drawVariant = DrawVariantGeneral;
+    defaultAttrs.clear();
+    if (!sharedBuffer)
+        return;
+
+    // Attributes that never got an offset have no data of their own.
+    // They just want their program default set before the draw.
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+        if (vertexAttributes[ii]->buffer == 0)
+            defaultAttrs.push_back(ii);
+
+    drawVariant = DrawVariantVBO;
 }
 
 // Instead of copying data to an OpenGL buffer, we'll just put it in an NSData
@@ -1182,8 +2223,16 @@ NSData *BasicDrawable::asData(bool dupStart,bool dupEnd)
             addPointToBuffer(basePtr, 0, NULL);
             basePtr += vertexSize;
         }
-        for (unsigned int ii=0;ii<points.size();ii++,basePtr+=vertexSize)
-            addPointToBuffer(basePtr, ii, NULL);
+        // The main run goes in attribute major, a strided pass per array
+        for (unsigned int ii=0;ii<points.size();ii++)
+            memcpy(basePtr+ii*vertexSize+pointBuffer, &points[ii].x(), 3*sizeof(GLfloat));
+        for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+        {
+            VertexAttribute *attr = vertexAttributes[ii];
+            if (attr->numElements() != 0)
+                attr->copyToBuffer(basePtr+attr->buffer, vertexSize);
+        }
+        basePtr += points.size()*vertexSize;
         if (dupEnd)
         {
             addPointToBuffer(basePtr, (int)(points.size()-1), NULL);
@@ -1220,8 +2269,19 @@ void BasicDrawable::asVertexAndElementData(NSMutableData **retVertData,NSMutable
     int numVerts = (int)points.size();
     NSMutableData *vertData = [[NSMutableData alloc] initWithBytesNoCopy:(malloc(vertexSize * numVerts)) length:vertexSize*numVerts freeWhenDone:YES];
     unsigned char *basePtr = (unsigned char *)[vertData mutableBytes];
-    for (unsigned int ii=0;ii<points.size();ii++,basePtr+=vertexSize)
-        addPointToBuffer(basePtr, ii, center);
+    // Points get the center subtracted, everything else is a strided copy
+    for (unsigned int ii=0;ii<points.size();ii++)
+    {
+        Point3f &pt = points[ii];
+        Point3f newPt = center ? Point3f(pt.x()-center->x(),pt.y()-center->y(),pt.z()-center->z()) : pt;
+        memcpy(basePtr+ii*vertexSize+pointBuffer, &newPt.x(), 3*sizeof(GLfloat));
+    }
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+    {
+        VertexAttribute *attr = vertexAttributes[ii];
+        if (attr->numElements() != 0)
+            attr->copyToBuffer(basePtr+attr->buffer, vertexSize);
+    }
         
     // Build up the triangles
     int triSize = singleElementSize * 3;
@@ -1247,19 +2307,229 @@ const std::vector<VertexAttribute *> &BasicDrawable::getVertexAttributes()
 {
     return vertexAttributes;
 }
-    
-// Note: Closed for repaiars
-#if 0
-// Combined vertex used in triangle stripping
-struct TmpVert
+
+bool BasicDrawable::snapshotWrite(NSMutableData *data) const
 {
-    TmpVert() { }
-    TmpVert(BasicDrawable *draw,int which)
+    // Once the arrays have gone to GL there's nothing left to write down
+    if (usingBuffers)
+        return false;
+
+    SnapshotAppendString(data, name);
+    unsigned char flag = on;
+    SnapshotAppend(data, &flag, sizeof(flag));
+    unsigned int uiVal = drawPriority;
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    float fVal = drawOffset;
+    SnapshotAppend(data, &fVal, sizeof(fVal));
+    flag = isAlpha;
+    SnapshotAppend(data, &flag, sizeof(flag));
+    uiVal = type;
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    SnapshotAppend(data, &color, sizeof(color));
+    float visVals[4] = {minVisible,maxVisible,minVisibleFadeBand,maxVisibleFadeBand};
+    SnapshotAppend(data, visVals, sizeof(visVals));
+    float gateVals[2] = {gateWorldRadius,gateMinPix};
+    SnapshotAppend(data, gateVals, sizeof(gateVals));
+    fVal = lineWidth;
+    SnapshotAppend(data, &fVal, sizeof(fVal));
+    flag = requestZBuffer;
+    SnapshotAppend(data, &flag, sizeof(flag));
+    flag = writeZBuffer;
+    SnapshotAppend(data, &flag, sizeof(flag));
+    float mbrVals[4] = {localMbr.ll().x(),localMbr.ll().y(),localMbr.ur().x(),localMbr.ur().y()};
+    SnapshotAppend(data, mbrVals, sizeof(mbrVals));
+    flag = hasMatrix;
+    SnapshotAppend(data, &flag, sizeof(flag));
+    if (hasMatrix)
+        SnapshotAppend(data, mat.data(), 16*sizeof(double));
+    int iVal = colorEntry;
+    SnapshotAppend(data, &iVal, sizeof(iVal));
+    iVal = normalEntry;
+    SnapshotAppend(data, &iVal, sizeof(iVal));
+
+    // Texture entries.  The IDs are this run's, the reader remaps them.
+    uiVal = (unsigned int)texInfo.size();
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    for (unsigned int ii=0;ii<texInfo.size();ii++)
     {
-        vert = draw->getPoint(which);
-        texCoord = draw->getTexCoord(which);
-        norm = draw->getNormal(which);
-        color = draw->getColor(which);
+        const TexInfo &thisTexInfo = texInfo[ii];
+        SimpleIdentity texId = thisTexInfo.texId;
+        SnapshotAppend(data, &texId, sizeof(texId));
+        iVal = thisTexInfo.texCoordEntry;
+        SnapshotAppend(data, &iVal, sizeof(iVal));
+        float texVals[4] = {thisTexInfo.texScale.x(),thisTexInfo.texScale.y(),
+                            thisTexInfo.texOffset.x(),thisTexInfo.texOffset.y()};
+        SnapshotAppend(data, texVals, sizeof(texVals));
+    }
+
+    // The geometry itself, straight out of the vectors
+    uiVal = (unsigned int)points.size();
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    if (!points.empty())
+        SnapshotAppend(data, &points[0], points.size()*sizeof(Vector3f));
+    uiVal = (unsigned int)tris.size();
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    if (!tris.empty())
+        SnapshotAppend(data, &tris[0], tris.size()*sizeof(Triangle));
+
+    // All the vertex attributes, standard ones included
+    uiVal = (unsigned int)vertexAttributes.size();
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+    {
+        const VertexAttribute *attr = vertexAttributes[ii];
+        iVal = attr->dataType;
+        SnapshotAppend(data, &iVal, sizeof(iVal));
+        SnapshotAppendString(data, attr->name);
+        SnapshotAppend(data, &attr->defaultData, sizeof(attr->defaultData));
+        iVal = attr->numElements();
+        SnapshotAppend(data, &iVal, sizeof(iVal));
+        if (iVal > 0)
+            SnapshotAppend(data, attr->dataStart(), iVal*attr->size());
+    }
+
+    return true;
+}
+
+bool BasicDrawable::snapshotRead(const unsigned char *&ptr,const unsigned char *end)
+{
+    if (!SnapshotReadString(ptr, end, name))
+        return false;
+    unsigned char flag;
+    unsigned int uiVal;
+    float fVal;
+    int iVal;
+    if (!SnapshotRead(ptr, end, &flag, sizeof(flag)))
+        return false;
+    on = flag;
+    if (!SnapshotRead(ptr, end, &uiVal, sizeof(uiVal)))
+        return false;
+    drawPriority = uiVal;
+    if (!SnapshotRead(ptr, end, &fVal, sizeof(fVal)))
+        return false;
+    drawOffset = fVal;
+    if (!SnapshotRead(ptr, end, &flag, sizeof(flag)))
+        return false;
+    isAlpha = flag;
+    if (!SnapshotRead(ptr, end, &uiVal, sizeof(uiVal)))
+        return false;
+    type = uiVal;
+    if (!SnapshotRead(ptr, end, &color, sizeof(color)))
+        return false;
+    float visVals[4];
+    if (!SnapshotRead(ptr, end, visVals, sizeof(visVals)))
+        return false;
+    minVisible = visVals[0];  maxVisible = visVals[1];
+    minVisibleFadeBand = visVals[2];  maxVisibleFadeBand = visVals[3];
+    float gateVals[2];
+    if (!SnapshotRead(ptr, end, gateVals, sizeof(gateVals)))
+        return false;
+    gateWorldRadius = gateVals[0];  gateMinPix = gateVals[1];
+    if (!SnapshotRead(ptr, end, &fVal, sizeof(fVal)))
+        return false;
+    lineWidth = fVal;
+    if (!SnapshotRead(ptr, end, &flag, sizeof(flag)))
+        return false;
+    requestZBuffer = flag;
+    if (!SnapshotRead(ptr, end, &flag, sizeof(flag)))
+        return false;
+    writeZBuffer = flag;
+    float mbrVals[4];
+    if (!SnapshotRead(ptr, end, mbrVals, sizeof(mbrVals)))
+        return false;
+    localMbr = Mbr(Point2f(mbrVals[0],mbrVals[1]),Point2f(mbrVals[2],mbrVals[3]));
+    if (!SnapshotRead(ptr, end, &flag, sizeof(flag)))
+        return false;
+    hasMatrix = flag;
+    if (hasMatrix)
+        if (!SnapshotRead(ptr, end, mat.data(), 16*sizeof(double)))
+            return false;
+    if (!SnapshotRead(ptr, end, &colorEntry, sizeof(colorEntry)))
+        return false;
+    if (!SnapshotRead(ptr, end, &normalEntry, sizeof(normalEntry)))
+        return false;
+
+    unsigned int numTexInfo;
+    if (!SnapshotRead(ptr, end, &numTexInfo, sizeof(numTexInfo)))
+        return false;
+    texInfo.resize(numTexInfo);
+    for (unsigned int ii=0;ii<numTexInfo;ii++)
+    {
+        TexInfo &thisTexInfo = texInfo[ii];
+        if (!SnapshotRead(ptr, end, &thisTexInfo.texId, sizeof(thisTexInfo.texId)))
+            return false;
+        if (!SnapshotRead(ptr, end, &thisTexInfo.texCoordEntry, sizeof(thisTexInfo.texCoordEntry)))
+            return false;
+        float texVals[4];
+        if (!SnapshotRead(ptr, end, texVals, sizeof(texVals)))
+            return false;
+        thisTexInfo.texScale = Point2f(texVals[0],texVals[1]);
+        thisTexInfo.texOffset = Point2f(texVals[2],texVals[3]);
+    }
+
+    unsigned int numPts;
+    if (!SnapshotRead(ptr, end, &numPts, sizeof(numPts)))
+        return false;
+    points.resize(numPts);
+    if (numPts > 0)
+        if (!SnapshotRead(ptr, end, &points[0], numPts*sizeof(Vector3f)))
+            return false;
+    numPoints = numPts;
+    unsigned int numTri;
+    if (!SnapshotRead(ptr, end, &numTri, sizeof(numTri)))
+        return false;
+    tris.resize(numTri);
+    if (numTri > 0)
+        if (!SnapshotRead(ptr, end, &tris[0], numTri*sizeof(Triangle)))
+            return false;
+    numTris = numTri;
+
+    // The record has the full attribute list, so toss the standard
+    //  ones the constructor set up and rebuild from scratch
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+        delete vertexAttributes[ii];
+    vertexAttributes.clear();
+    unsigned int numAttrs;
+    if (!SnapshotRead(ptr, end, &numAttrs, sizeof(numAttrs)))
+        return false;
+    for (unsigned int ii=0;ii<numAttrs;ii++)
+    {
+        if (!SnapshotRead(ptr, end, &iVal, sizeof(iVal)))
+            return false;
+        std::string attrName;
+        if (!SnapshotReadString(ptr, end, attrName))
+            return false;
+        VertexAttribute *attr = new VertexAttribute((BDAttributeDataType)iVal,attrName);
+        vertexAttributes.push_back(attr);
+        if (!SnapshotRead(ptr, end, &attr->defaultData, sizeof(attr->defaultData)))
+            return false;
+        int numElems;
+        if (!SnapshotRead(ptr, end, &numElems, sizeof(numElems)))
+            return false;
+        if (numElems > 0)
+        {
+            if (ptr + numElems*attr->size() > end)
+                return false;
+            attr->appendRawData(ptr, numElems);
+            ptr += numElems*attr->size();
+        }
+    }
+
+    return true;
+}
+
+// Note: Closed for repaiars
+#if 0
+// Combined vertex used in triangle stripping
+struct TmpVert
+{
+    TmpVert() { }
+    TmpVert(BasicDrawable *draw,int which)
+    {
+        vert = draw->getPoint(which);
+        texCoord = draw->getTexCoord(which);
+        norm = draw->getNormal(which);
+        color = draw->getColor(which);
     }
     bool operator == (const TmpVert &that)
     {
@@ -1390,8 +2660,18 @@ void BasicDrawable::teardownGL(OpenGLMemManager *memManager)
     
     if (sharedBuffer && !sharedBufferIsExternal)
     {
-        memManager->removeBufferID(sharedBuffer);
+        if (sharedBufferIsPooled)
+        {
+            memManager->subTrackedMem(WKMemDrawable,poolAlloc.size);
+            memManager->subFreeBuffer(poolAlloc);
+            poolAlloc = OpenGLMemManager::SubAllocation();
+            sharedBufferIsPooled = false;
+        } else {
+            memManager->subTrackedMem(WKMemDrawable,sharedBufferSize);
+            memManager->recycleBufferID(sharedBuffer,sharedBufferSize,GL_STATIC_DRAW);
+        }
         sharedBuffer = 0;
+        sharedBufferSize = 0;
     } else {
         if (pointBuffer)
             memManager->removeBufferID(pointBuffer);
@@ -1402,6 +2682,8 @@ void BasicDrawable::teardownGL(OpenGLMemManager *memManager)
     triBuffer = 0;
     for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
         vertexAttributes[ii]->buffer = 0;
+    drawVariant = DrawVariantGeneral;
+    defaultAttrs.clear();
 }
 	
 void BasicDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
@@ -1412,6 +2694,39 @@ void BasicDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
 // Used to pass in buffer offsets
 #define CALCBUFOFF(base,off) ((char *)((long)(base) + (off)))
 
+// Look up all the attribute and uniform slots we use in the program.
+// The lookups are sorted set searches on strings, which adds up when
+//  it's per drawable per frame, so we keep the results around until
+//  the program changes out from under us.
+void BasicDrawable::resolveSlots(OpenGLES2Program *prog)
+{
+    if (slots.progId == prog->getId() && slots.progAttrs.size() == vertexAttributes.size())
+        return;
+
+    slots.progId = prog->getId();
+    slots.vertAttr = prog->findAttribute("a_position");
+    slots.progAttrs.resize(vertexAttributes.size());
+    for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
+        slots.progAttrs[ii] = prog->findAttribute(vertexAttributes[ii]->name);
+    for (unsigned int ii=0;ii<WhirlyKitMaxTextures;ii++)
+    {
+        char uniName[40];
+        sprintf(uniName,"s_baseMap%d",ii);
+        slots.baseMapUni[ii] = prog->findUniform(uniName);
+        sprintf(uniName,"u_texScale%d",ii);
+        slots.texScaleUni[ii] = prog->findUniform(uniName);
+        sprintf(uniName,"u_texOffset%d",ii);
+        slots.texOffsetUni[ii] = prog->findUniform(uniName);
+    }
+    slots.mvpMatUni = prog->findUniform("u_mvpMatrix");
+    slots.mvMatUni = prog->findUniform("u_mvMatrix");
+    slots.mvNormalMatUni = prog->findUniform("u_mvNormalMatrix");
+    slots.pMatUni = prog->findUniform("u_pMatrix");
+    slots.fadeUni = prog->findUniform("u_fade");
+    slots.hasTextureUni = prog->findUniform("u_hasTexture");
+    slots.eyeVecUni = prog->findUniform("u_eyeVec");
+}
+
     
 // Called once to set up a Vertex Array Object
 void BasicDrawable::setupVAO(OpenGLES2Program *prog)
@@ -1476,12 +2791,9 @@ void BasicDrawable::setupVAO(OpenGLES2Program *prog)
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
     
-// Draw Vertex Buffer Objects, OpenGL 2.0
-void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
+// Figure out if we're fading in or out
+float BasicDrawable::calcFade(WhirlyKitRendererFrameInfo *frameInfo)
 {
-    OpenGLES2Program *prog = frameInfo.program;
-
-    // Figure out if we're fading in or out
     float fade = 1.0;
     if (fadeDown < fadeUp)
     {
@@ -1522,10 +2834,21 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
             if (b >= 0.0 && b < 1.0)
                 factor = b;
         }
-        
+
         fade = fade * factor;
     }
-    
+
+    // The overdraw diagnostic draws everything at a fixed dim level, so
+    //  the additive blend sums into a per pixel layer count
+    if (frameInfo.overdrawMode)
+        fade = 0.1;
+
+    return fade;
+}
+
+// Bind the program's and the drawable's textures before the draw
+void BasicDrawable::bindDrawTextures(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene,OpenGLES2Program *prog,bool *hasTexture)
+{
     // GL Texture IDs
     bool anyTextures = false;
     std::vector<GLuint> glTexIDs;
@@ -1540,24 +2863,11 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
         }
         glTexIDs.push_back(glTexID);
     }
-    
-    // Model/View/Projection matrix
-    prog->setUniform("u_mvpMatrix", frameInfo.mvpMat);
-    prog->setUniform("u_mvMatrix", frameInfo.viewAndModelMat);
-    prog->setUniform("u_mvNormalMatrix", frameInfo.viewModelNormalMat);
-    prog->setUniform("u_pMatrix", frameInfo.projMat);
-    
-    // Fade is always mixed in
-    prog->setUniform("u_fade", fade);
-    
+
     // Let the shaders know if we even have a texture
-    prog->setUniform("u_hasTexture", anyTextures);
-    
-    // If this is present, the drawable wants to do something based where the viewer is looking
-    prog->setUniform("u_eyeVec", frameInfo.fullEyeVec);
-    
+    prog->setUniform(slots.hasTextureUni, anyTextures);
+
     // The program itself may have some textures to bind
-    bool hasTexture[WhirlyKitMaxTextures];
     int progTexBound = prog->bindTextures();
     for (unsigned int ii=0;ii<progTexBound;ii++)
         hasTexture[ii] = true;
@@ -1566,27 +2876,124 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
     for (unsigned int ii=0;ii<WhirlyKitMaxTextures-progTexBound;ii++)
     {
         GLuint glTexID = ii < glTexIDs.size() ? glTexIDs[ii] : 0;
-        char baseMapName[40];
-        sprintf(baseMapName,"s_baseMap%d",ii);
-        const OpenGLESUniform *texUni = prog->findUniform(baseMapName);
+        const OpenGLESUniform *texUni = slots.baseMapUni[ii];
         hasTexture[ii+progTexBound] = glTexID != 0 && texUni;
         if (hasTexture[ii+progTexBound])
         {
             [frameInfo.stateOpt setActiveTexture:(GL_TEXTURE0+ii+progTexBound)];
             glBindTexture(GL_TEXTURE_2D, glTexID);
             CheckGLError("BasicDrawable::drawVBO2() glBindTexture");
-            prog->setUniform(baseMapName, (int)ii+progTexBound);
+            prog->setUniform(slots.baseMapUni[ii], (int)ii+progTexBound);
             CheckGLError("BasicDrawable::drawVBO2() glUniform1i");
+            // Optional texture coordinate transform.  Shaders that
+            //  don't declare the uniforms just use the baked coords.
+            // The program caches values, so resetting to identity for
+            //  drawables that don't use it is a compare, not a GL call.
+            if (ii < texInfo.size())
+            {
+                prog->setUniform(slots.texScaleUni[ii], Vector2f(texInfo[ii].texScale.x(),texInfo[ii].texScale.y()));
+                prog->setUniform(slots.texOffsetUni[ii], Vector2f(texInfo[ii].texOffset.x(),texInfo[ii].texOffset.y()));
+            } else {
+                prog->setUniform(slots.texScaleUni[ii], Vector2f(1.0,1.0));
+                prog->setUniform(slots.texOffsetUni[ii], Vector2f(0.0,0.0));
+            }
         }
     }
-    
+}
+
+// Draw Vertex Buffer Objects, OpenGL 2.0
+void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
+{
+    OpenGLES2Program *prog = frameInfo.program;
+    resolveSlots(prog);
+
+    float fade = calcFade(frameInfo);
+
+    // Model/View/Projection matrix
+    prog->setUniform(slots.mvpMatUni, frameInfo.mvpMat);
+    prog->setUniform(slots.mvMatUni, frameInfo.viewAndModelMat);
+    prog->setUniform(slots.mvNormalMatUni, frameInfo.viewModelNormalMat);
+    prog->setUniform(slots.pMatUni, frameInfo.projMat);
+
+    // Fade is always mixed in
+    prog->setUniform(slots.fadeUni, fade);
+
+    // If this is present, the drawable wants to do something based where the viewer is looking
+    prog->setUniform(slots.eyeVecUni, frameInfo.fullEyeVec);
+
+    bool hasTexture[WhirlyKitMaxTextures];
+    bindDrawTextures(frameInfo,scene,prog,hasTexture);
+
+    if (drawVariant == DrawVariantVBO)
+    {
+        // The straight line path.  Everything's in the shared buffer,
+        //  so it's program defaults, the VAO, and the draw call.
+        if (vertArrayObj == 0)
+            setupVAO(prog);
+
+        for (unsigned int ii=0;ii<defaultAttrs.size();ii++)
+        {
+            const OpenGLESAttribute *progAttr = slots.progAttrs[defaultAttrs[ii]];
+            if (progAttr)
+            {
+                vertexAttributes[defaultAttrs[ii]]->glSetDefault(progAttr->index);
+                CheckGLError("BasicDrawable::drawVBO2() glSetDefault");
+            }
+        }
+
+        // Let a subclass bind anything additional
+        bindAdditionalRenderObjects(frameInfo,scene);
+
+        glBindVertexArrayOES(vertArrayObj);
+        switch (type)
+        {
+            case GL_TRIANGLES:
+                glDrawElements(GL_TRIANGLES, numTris*3, GL_UNSIGNED_SHORT, CALCBUFOFF(sharedBufferOffset,triBuffer));
+                CheckGLError("BasicDrawable::drawVBO2() glDrawElements");
+                break;
+            case GL_POINTS:
+            case GL_LINES:
+            case GL_LINE_STRIP:
+            case GL_LINE_LOOP:
+                [frameInfo.stateOpt setLineWidth:lineWidth];
+                glDrawArrays(type, 0, numPoints);
+                CheckGLError("BasicDrawable::drawVBO2() glDrawArrays");
+                break;
+            case GL_TRIANGLE_STRIP:
+                glDrawArrays(type, 0, numPoints);
+                CheckGLError("BasicDrawable::drawVBO2() glDrawArrays");
+                break;
+        }
+        glBindVertexArrayOES(0);
+    } else {
+        // Everything else sorts its state out per draw
+        drawGeneralOGL2(frameInfo,scene,prog);
+    }
+
+    // Unbind any texture
+    for (unsigned int ii=0;ii<WhirlyKitMaxTextures;ii++)
+        if (hasTexture[ii])
+        {
+            [frameInfo.stateOpt setActiveTexture:(GL_TEXTURE0+ii)];
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+    // Let a subclass clean up any remaining state
+    postDrawCallback(frameInfo,scene);
+}
+
+// The general draw path, for drawables whose data hasn't all made it
+//  into GL: bind whatever's still local, draw with or without a VAO,
+//  and tear the bindings back down
+void BasicDrawable::drawGeneralOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene,OpenGLES2Program *prog)
+{
     // If necessary, set up the VAO (once)
     if (vertArrayObj == 0 && sharedBuffer != 0)
         setupVAO(prog);
 
     // Figure out what we're using
-    const OpenGLESAttribute *vertAttr = prog->findAttribute("a_position");
-    
+    const OpenGLESAttribute *vertAttr = slots.vertAttr;
+
     // Vertex array
     bool usedLocalVertices = false;
     if (vertAttr && !(sharedBuffer || pointBuffer))
@@ -1594,16 +3001,16 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
         usedLocalVertices = true;
         glVertexAttribPointer(vertAttr->index, 3, GL_FLOAT, GL_FALSE, 0, &points[0]);
         CheckGLError("BasicDrawable::drawVBO2() glVertexAttribPointer");
-        glEnableVertexAttribArray ( vertAttr->index );            
+        glEnableVertexAttribArray ( vertAttr->index );
         CheckGLError("BasicDrawable::drawVBO2() glEnableVertexAttribArray");
     }
-    
+
     // Other vertex attributes
     const OpenGLESAttribute *progAttrs[vertexAttributes.size()];
     for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
     {
         VertexAttribute *attr = vertexAttributes[ii];
-        const OpenGLESAttribute *progAttr = prog->findAttribute(attr->name);
+        const OpenGLESAttribute *progAttr = slots.progAttrs[ii];
         progAttrs[ii] = NULL;
         if (progAttr)
         {
@@ -1617,7 +3024,7 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
                 CheckGLError("BasicDrawable::drawVBO2() glVertexAttribPointer");
                     glEnableVertexAttribArray ( progAttr->index );
                     CheckGLError("BasicDrawable::drawVBO2() glEnableVertexAttribArray");
-                    
+
                     progAttrs[ii] = progAttr;
                 } else {
                     // The program is expecting it, so we need a default
@@ -1628,10 +3035,10 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
             }
         }
     }
-    
+
     // Let a subclass bind anything additional
     bindAdditionalRenderObjects(frameInfo,scene);
-    
+
     // If we're using a vertex array object, bind it and draw
     if (vertArrayObj)
     {
@@ -1690,14 +3097,6 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
                 break;
         }
     }
-    
-    // Unbind any texture
-    for (unsigned int ii=0;ii<WhirlyKitMaxTextures;ii++)
-        if (hasTexture[ii])
-        {
-            [frameInfo.stateOpt setActiveTexture:(GL_TEXTURE0+ii)];
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
 
     // Tear down the various arrays, if we stood them up
     if (usedLocalVertices)
@@ -1705,9 +3104,6 @@ void BasicDrawable::drawOGL2(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
     for (unsigned int ii=0;ii<vertexAttributes.size();ii++)
         if (progAttrs[ii])
             glDisableVertexAttribArray(progAttrs[ii]->index);
-
-    // Let a subclass clean up any remaining state
-    postDrawCallback(frameInfo,scene);
 }
 
 ColorChangeRequest::ColorChangeRequest(SimpleIdentity drawId,RGBAColor inColor)
@@ -1786,6 +3182,47 @@ void FadeChangeRequest::execute2(Scene *scene,WhirlyKitSceneRendererES *renderer
     [renderer setRenderUntil:fadeUp];
 }
 
+FadeGangChangeRequest::FadeGangChangeRequest(const SimpleIDSet &inDrawIDs,NSTimeInterval fadeUp,NSTimeInterval fadeDown)
+    : fadeUp(fadeUp), fadeDown(fadeDown)
+{
+    drawIDs.reserve(inDrawIDs.size());
+    for (SimpleIDSet::const_iterator it = inDrawIDs.begin();it != inDrawIDs.end();++it)
+        drawIDs.push_back(*it);
+}
+
+void FadeGangChangeRequest::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+{
+    bool fadingOut = (fadeUp < fadeDown);
+    for (unsigned int ii=0;ii<drawIDs.size();ii++)
+    {
+        DrawableRef theDrawable = scene->getDrawable(drawIDs[ii]);
+        BasicDrawableRef basicDrawable = boost::dynamic_pointer_cast<BasicDrawable>(theDrawable);
+        if (!basicDrawable)
+            continue;
+        basicDrawable->setFade(fadeDown, fadeUp);
+        // A fade out expires in isOn() without another change request
+        if (fadingOut)
+            basicDrawable->setEnableTimeRange(0.0, fadeDown);
+        scene->getRenderStateBuckets()->updateDrawable(theDrawable);
+    }
+
+    // And let the renderer know, once for the lot
+    [renderer setRenderUntil:fadeDown];
+    [renderer setRenderUntil:fadeUp];
+}
+
+DrawTexTransformChangeRequest::DrawTexTransformChangeRequest(SimpleIdentity drawId,unsigned int which,const Point2f &scale,const Point2f &offset)
+: DrawableChangeRequest(drawId), which(which), scale(scale), offset(offset)
+{
+}
+
+void DrawTexTransformChangeRequest::execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,DrawableRef draw)
+{
+    BasicDrawableRef basicDrawable = boost::dynamic_pointer_cast<BasicDrawable>(draw);
+    if (basicDrawable)
+        basicDrawable->setTexTransform(which,scale,offset);
+}
+
 DrawTexChangeRequest::DrawTexChangeRequest(SimpleIdentity drawId,unsigned int which,SimpleIdentity newTexId)
 : DrawableChangeRequest(drawId), which(which), newTexId(newTexId)
 {
@@ -1857,7 +3294,7 @@ void LineWidthChangeRequest::execute2(Scene *scene,WhirlyKitSceneRendererES *ren
 }
 
 BasicDrawableInstance::BasicDrawableInstance(const std::string &name,SimpleIdentity masterID)
-    : Drawable(name), enable(true), masterID(masterID)
+    : Drawable(name), enable(true), masterID(masterID), programId(EmptyIdentity), instBuffer(0), vertArrayObj(0), numInstances(0)
 {
 }
 
@@ -1875,6 +3312,8 @@ unsigned int BasicDrawableInstance::getDrawPriority() const
 
 SimpleIdentity BasicDrawableInstance::getProgram() const
 {
+    if (programId != EmptyIdentity)
+        return programId;
     return basicDraw->getProgram();
 }
 
@@ -1910,8 +3349,88 @@ const Eigen::Matrix4d *BasicDrawableInstance::getMatrix() const
     return basicDraw->getMatrix();
 }
 
+void BasicDrawableInstance::addInstances(const std::vector<SingleInstance> &insts)
+{
+    instances.insert(instances.end(), insts.begin(), insts.end());
+}
+
+// Per instance data as we lay it out in the vertex buffer
+typedef struct
+{
+    float center[3];
+    unsigned char color[4];
+    float scale;
+} InstanceVertex;
+
+void BasicDrawableInstance::setupGL(WhirlyKitGLSetupInfo *setupInfo,OpenGLMemManager *memManager)
+{
+    // If we're already setup, don't do it twice
+    if (instances.empty() || instBuffer)
+        return;
+
+    numInstances = (int)instances.size();
+    std::vector<InstanceVertex> instData(numInstances);
+    for (unsigned int ii=0;ii<instances.size();ii++)
+    {
+        const SingleInstance &inst = instances[ii];
+        InstanceVertex &vert = instData[ii];
+        vert.center[0] = inst.center.x();
+        vert.center[1] = inst.center.y();
+        vert.center[2] = inst.center.z();
+        RGBAColor theColor = (inst.colorOverride ? inst.color : (hasColor ? color : basicDraw->getColor()));
+        vert.color[0] = theColor.r;  vert.color[1] = theColor.g;
+        vert.color[2] = theColor.b;  vert.color[3] = theColor.a;
+        vert.scale = inst.scale;
+    }
+
+    instBuffer = memManager->getBufferID(numInstances*sizeof(InstanceVertex),GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, instBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numInstances*sizeof(InstanceVertex), &instData[0]);
+    CheckGLError("BasicDrawableInstance::setupGL() glBufferSubData");
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BasicDrawableInstance::teardownGL(OpenGLMemManager *memManager)
+{
+    if (vertArrayObj)
+        glDeleteVertexArraysOES(1,&vertArrayObj);
+    vertArrayObj = 0;
+
+    if (instBuffer)
+    {
+        memManager->removeBufferID(instBuffer);
+        instBuffer = 0;
+    }
+}
+
+// Set if we've checked for the instancing extensions
+static bool instancingChecked = false;
+static bool instancingAvailable = false;
+
 void BasicDrawableInstance::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
 {
+    // With actual instances present we replicate the master rather than tweak it
+    if (!instances.empty())
+    {
+        // Check for the instancing extensions once
+        if (!instancingChecked)
+        {
+            instancingChecked = true;
+            const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+            instancingAvailable = extensions && strstr(extensions,"GL_EXT_draw_instanced") &&
+                                    strstr(extensions,"GL_EXT_instanced_arrays");
+        }
+
+        // The single-call path needs the extensions, the master's data down in
+        //  a buffer, and a shader that declares the per-instance attributes
+        if (instancingAvailable && instBuffer && basicDraw->sharedBuffer &&
+            frameInfo.program->findAttribute("a_modelCenter"))
+            drawInstanced(frameInfo,scene);
+        else
+            drawInstancesByHand(frameInfo,scene);
+        return;
+    }
+
     int oldDrawPriority = basicDraw->getDrawPriority();
     RGBAColor oldColor = basicDraw->getColor();
     float oldLineWidth = basicDraw->getLineWidth();
@@ -1940,5 +3459,264 @@ void BasicDrawableInstance::draw(WhirlyKitRendererFrameInfo *frameInfo,Scene *sc
     if (hasMinVis || hasMaxVis)
         basicDraw->setVisibleRange(oldMinVis, oldMaxVis);
 }
-    
+
+// Instancing entry points.  Core on ES3, the EXT versions on ES2.
+static void wkVertexAttribDivisor(GLuint index,GLuint divisor)
+{
+    if ([EAGLContext currentContext].API >= kEAGLRenderingAPIOpenGLES3)
+        glVertexAttribDivisor(index, divisor);
+    else
+        glVertexAttribDivisorEXT(index, divisor);
+}
+
+static void wkDrawElementsInstanced(GLenum mode,GLsizei count,GLenum type,const GLvoid *indices,GLsizei instanceCount)
+{
+    if ([EAGLContext currentContext].API >= kEAGLRenderingAPIOpenGLES3)
+        glDrawElementsInstanced(mode, count, type, indices, instanceCount);
+    else
+        glDrawElementsInstancedEXT(mode, count, type, indices, instanceCount);
+}
+
+static void wkDrawArraysInstanced(GLenum mode,GLint first,GLsizei count,GLsizei instanceCount)
+{
+    if ([EAGLContext currentContext].API >= kEAGLRenderingAPIOpenGLES3)
+        glDrawArraysInstanced(mode, first, count, instanceCount);
+    else
+        glDrawArraysInstancedEXT(mode, first, count, instanceCount);
+}
+
+// Called once to set up a VAO with the master's vertex data plus our instance attributes
+void BasicDrawableInstance::setupInstanceVAO(OpenGLES2Program *prog)
+{
+    const OpenGLESAttribute *vertAttr = prog->findAttribute("a_position");
+
+    glGenVertexArraysOES(1, &vertArrayObj);
+    glBindVertexArrayOES(vertArrayObj);
+
+    // The master's vertex data comes out of its shared buffer
+    glBindBuffer(GL_ARRAY_BUFFER,basicDraw->sharedBuffer);
+    CheckGLError("BasicDrawableInstance::setupInstanceVAO() glBindBuffer");
+    if (vertAttr)
+    {
+        glVertexAttribPointer(vertAttr->index, 3, GL_FLOAT, GL_FALSE, basicDraw->vertexSize, CALCBUFOFF(basicDraw->sharedBufferOffset,0));
+        glEnableVertexAttribArray ( vertAttr->index );
+    }
+    for (unsigned int ii=0;ii<basicDraw->vertexAttributes.size();ii++)
+    {
+        VertexAttribute *attr = basicDraw->vertexAttributes[ii];
+        const OpenGLESAttribute *thisAttr = prog->findAttribute(attr->name);
+        if (thisAttr && (attr->buffer != 0 || attr->numElements() != 0))
+        {
+            glVertexAttribPointer(thisAttr->index, attr->glEntryComponents(), attr->glType(), attr->glNormalize(), basicDraw->vertexSize, CALCBUFOFF(basicDraw->sharedBufferOffset,attr->buffer));
+            glEnableVertexAttribArray(thisAttr->index);
+        }
+    }
+
+    // Our per-instance attributes advance once per instance, not per vertex
+    glBindBuffer(GL_ARRAY_BUFFER,instBuffer);
+    CheckGLError("BasicDrawableInstance::setupInstanceVAO() glBindBuffer");
+    const OpenGLESAttribute *centerAttr = prog->findAttribute("a_modelCenter");
+    if (centerAttr)
+    {
+        glVertexAttribPointer(centerAttr->index, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceVertex), CALCBUFOFF(0,0));
+        wkVertexAttribDivisor(centerAttr->index, 1);
+        glEnableVertexAttribArray(centerAttr->index);
+    }
+    const OpenGLESAttribute *colorAttr = prog->findAttribute("a_instanceColor");
+    if (colorAttr)
+    {
+        glVertexAttribPointer(colorAttr->index, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceVertex), CALCBUFOFF(0,offsetof(InstanceVertex,color)));
+        wkVertexAttribDivisor(colorAttr->index, 1);
+        glEnableVertexAttribArray(colorAttr->index);
+    }
+    const OpenGLESAttribute *scaleAttr = prog->findAttribute("a_instanceScale");
+    if (scaleAttr)
+    {
+        glVertexAttribPointer(scaleAttr->index, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceVertex), CALCBUFOFF(0,offsetof(InstanceVertex,scale)));
+        wkVertexAttribDivisor(scaleAttr->index, 1);
+        glEnableVertexAttribArray(scaleAttr->index);
+    }
+
+    // Bind the element array
+    if (basicDraw->type == GL_TRIANGLES && basicDraw->triBuffer)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, basicDraw->sharedBuffer);
+        CheckGLError("BasicDrawableInstance::setupInstanceVAO() glBindBuffer");
+    }
+
+    glBindVertexArrayOES(0);
+
+    // Now tear down all that state
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Draw all the instances with a single instanced call
+void BasicDrawableInstance::drawInstanced(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
+{
+    OpenGLES2Program *prog = frameInfo.program;
+
+    // Figure out the fade, same rules as the master uses
+    float fade = 1.0;
+    NSTimeInterval fadeUp = basicDraw->fadeUp, fadeDown = basicDraw->fadeDown;
+    if (fadeDown < fadeUp)
+    {
+        if (frameInfo.currentTime < fadeDown)
+            fade = 0.0;
+        else if (frameInfo.currentTime <= fadeUp)
+            fade = (frameInfo.currentTime - fadeDown)/(fadeUp - fadeDown);
+    } else if (fadeUp < fadeDown)
+    {
+        if (frameInfo.currentTime > fadeDown)
+            fade = 0.0;
+        else if (frameInfo.currentTime >= fadeUp)
+            fade = 1.0-(frameInfo.currentTime - fadeUp)/(fadeDown - fadeUp);
+    }
+
+    // GL Texture IDs from the master
+    bool anyTextures = false;
+    std::vector<GLuint> glTexIDs;
+    for (unsigned int ii=0;ii<basicDraw->texInfo.size();ii++)
+    {
+        const BasicDrawable::TexInfo &thisTexInfo = basicDraw->texInfo[ii];
+        GLuint glTexID = EmptyIdentity;
+        if (thisTexInfo.texId != EmptyIdentity)
+        {
+            glTexID = scene->getGLTexture(thisTexInfo.texId);
+            anyTextures = true;
+        }
+        glTexIDs.push_back(glTexID);
+    }
+
+    // Model/View/Projection matrix and friends, same as the master would set
+    prog->setUniform("u_mvpMatrix", frameInfo.mvpMat);
+    prog->setUniform("u_mvMatrix", frameInfo.viewAndModelMat);
+    prog->setUniform("u_mvNormalMatrix", frameInfo.viewModelNormalMat);
+    prog->setUniform("u_pMatrix", frameInfo.projMat);
+    if (frameInfo.overdrawMode)
+        fade = 0.1;
+    prog->setUniform("u_fade", fade);
+    prog->setUniform("u_hasTexture", anyTextures);
+    prog->setUniform("u_eyeVec", frameInfo.fullEyeVec);
+
+    // The program itself may have some textures to bind
+    bool hasTexture[WhirlyKitMaxTextures];
+    int progTexBound = prog->bindTextures();
+    for (unsigned int ii=0;ii<progTexBound;ii++)
+        hasTexture[ii] = true;
+
+    // Zero or more textures in the master
+    for (unsigned int ii=0;ii<WhirlyKitMaxTextures-progTexBound;ii++)
+    {
+        GLuint glTexID = ii < glTexIDs.size() ? glTexIDs[ii] : 0;
+        char baseMapName[40];
+        sprintf(baseMapName,"s_baseMap%d",ii);
+        const OpenGLESUniform *texUni = prog->findUniform(baseMapName);
+        hasTexture[ii+progTexBound] = glTexID != 0 && texUni;
+        if (hasTexture[ii+progTexBound])
+        {
+            [frameInfo.stateOpt setActiveTexture:(GL_TEXTURE0+ii+progTexBound)];
+            glBindTexture(GL_TEXTURE_2D, glTexID);
+            CheckGLError("BasicDrawableInstance::drawInstanced() glBindTexture");
+            prog->setUniform(baseMapName, (int)ii+progTexBound);
+        }
+    }
+
+    // If necessary, set up the VAO (once)
+    if (vertArrayObj == 0)
+        setupInstanceVAO(prog);
+
+    glBindVertexArrayOES(vertArrayObj);
+    switch (basicDraw->type)
+    {
+        case GL_TRIANGLES:
+            wkDrawElementsInstanced(GL_TRIANGLES, basicDraw->numTris*3, GL_UNSIGNED_SHORT, CALCBUFOFF(basicDraw->sharedBufferOffset,basicDraw->triBuffer), numInstances);
+            CheckGLError("BasicDrawableInstance::drawInstanced() drawElementsInstanced");
+            break;
+        case GL_POINTS:
+        case GL_LINES:
+        case GL_LINE_STRIP:
+        case GL_LINE_LOOP:
+            [frameInfo.stateOpt setLineWidth:basicDraw->lineWidth];
+            wkDrawArraysInstanced(basicDraw->type, 0, basicDraw->numPoints, numInstances);
+            CheckGLError("BasicDrawableInstance::drawInstanced() drawArraysInstanced");
+            break;
+        case GL_TRIANGLE_STRIP:
+            wkDrawArraysInstanced(basicDraw->type, 0, basicDraw->numPoints, numInstances);
+            CheckGLError("BasicDrawableInstance::drawInstanced() drawArraysInstanced");
+            break;
+    }
+    glBindVertexArrayOES(0);
+
+    // Unbind any texture
+    for (unsigned int ii=0;ii<WhirlyKitMaxTextures;ii++)
+        if (hasTexture[ii])
+        {
+            [frameInfo.stateOpt setActiveTexture:(GL_TEXTURE0+ii)];
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+}
+
+// No instancing support, so draw the master once per instance
+void BasicDrawableInstance::drawInstancesByHand(WhirlyKitRendererFrameInfo *frameInfo,Scene *scene)
+{
+    OpenGLES2Program *prog = frameInfo.program;
+
+    // If the shader declares the instance attributes, give them
+    //  defaults that leave the geometry alone
+    const OpenGLESAttribute *centerAttr = prog->findAttribute("a_modelCenter");
+    if (centerAttr)
+        glVertexAttrib3f(centerAttr->index, 0.0, 0.0, 0.0);
+    const OpenGLESAttribute *colorAttr = prog->findAttribute("a_instanceColor");
+    if (colorAttr)
+        glVertexAttrib4f(colorAttr->index, 1.0, 1.0, 1.0, 1.0);
+    const OpenGLESAttribute *scaleAttr = prog->findAttribute("a_instanceScale");
+    if (scaleAttr)
+        glVertexAttrib1f(scaleAttr->index, 1.0);
+
+    // Change the master like the single-instance path does
+    int oldDrawPriority = basicDraw->getDrawPriority();
+    RGBAColor oldColor = basicDraw->getColor();
+    float oldLineWidth = basicDraw->getLineWidth();
+    float oldMinVis,oldMaxVis;
+    basicDraw->getVisibleRange(oldMinVis, oldMaxVis);
+
+    if (hasDrawPriority)
+        basicDraw->setDrawPriority(drawPriority);
+    if (hasLineWidth)
+        basicDraw->setLineWidth(lineWidth);
+    if (hasMinVis || hasMaxVis)
+        basicDraw->setVisibleRange(minVis, maxVis);
+
+    // Walk through the instances, offsetting the matrix for each
+    Eigen::Matrix4f oldMvpMat = frameInfo.mvpMat;
+    for (unsigned int ii=0;ii<instances.size();ii++)
+    {
+        const SingleInstance &inst = instances[ii];
+        Eigen::Affine3f instTrans(Eigen::Translation3f(inst.center.x(),inst.center.y(),inst.center.z()) * Eigen::Scaling((float)inst.scale));
+        Eigen::Matrix4f newMvpMat = oldMvpMat * instTrans.matrix();
+        frameInfo.mvpMat = newMvpMat;
+        if (colorAttr)
+        {
+            // The master's colors are already down on the GPU, so the
+            //  per-instance color has to ride along as a constant attribute
+            RGBAColor theColor = (inst.colorOverride ? inst.color : (hasColor ? color : oldColor));
+            glVertexAttrib4f(colorAttr->index, theColor.r/255.0, theColor.g/255.0, theColor.b/255.0, theColor.a/255.0);
+        } else {
+            if (inst.colorOverride)
+                basicDraw->setColor(inst.color);
+            else if (hasColor)
+                basicDraw->setColor(color);
+        }
+        basicDraw->draw(frameInfo,scene);
+    }
+    frameInfo.mvpMat = oldMvpMat;
+
+    // Set it back
+    basicDraw->setDrawPriority(oldDrawPriority);
+    basicDraw->setColor(oldColor);
+    basicDraw->setLineWidth(oldLineWidth);
+    basicDraw->setVisibleRange(oldMinVis, oldMaxVis);
+}
+
 }
@@ -276,6 +276,57 @@ void DynamicDrawableAtlas::getDrawableIDs(SimpleIDSet &drawIDs)
         drawIDs.insert(it->bigDraw->getId());
 }
     
+int DynamicDrawableAtlas::compact(int maxBytes)
+{
+    // Moves get confusing if a swap is still in flight
+    if (waitingOnSwap())
+        return 0;
+
+    int bytesMoved = 0;
+    for (DrawRepresentSet::iterator it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        if (bytesMoved + it->vertexSize > maxBytes)
+            continue;
+
+        // Find the big drawable this one is in
+        BigDrawable *bigDraw = NULL;
+        for (BigDrawableSet::iterator bit = bigDrawables.begin(); bit != bigDrawables.end(); ++bit)
+            if (bit->bigDraw->getId() == it->bigDrawId)
+            {
+                bigDraw = bit->bigDraw;
+                break;
+            }
+        if (!bigDraw)
+            continue;
+
+        // Try to slide it down into a lower free slot.
+        // vertexPos isn't part of the set ordering, so we can patch it in place.
+        DrawRepresent &represent = const_cast<DrawRepresent &>(*it);
+        if (bigDraw->moveRegion(represent.vertexPos,represent.vertexSize,represent.elementChunkId))
+        {
+            bytesMoved += represent.vertexSize;
+            hasChanges = true;
+        }
+    }
+
+    return bytesMoved;
+}
+
+void DynamicDrawableAtlas::getUsage(int &totalFree,int &largestFree,int &numRegions)
+{
+    totalFree = 0;  largestFree = 0;  numRegions = 0;
+    for (BigDrawableSet::iterator it = bigDrawables.begin(); it != bigDrawables.end(); ++it)
+    {
+        int thisVertSize,thisElSize;
+        it->bigDraw->getUtilization(thisVertSize,thisElSize);
+        totalFree += numVertexBytes - thisVertSize;
+        int thisNumRegions,thisLargestFree;
+        it->bigDraw->getFragmentation(thisNumRegions,thisLargestFree);
+        numRegions += thisNumRegions;
+        largestFree = std::max(largestFree,thisLargestFree);
+    }
+}
+
 bool DynamicDrawableAtlas::hasUpdates()
 {
     if (hasChanges)
@@ -363,6 +414,9 @@ void DynamicDrawableAtlas::log()
         elTotal += thisElSize;
     }
     NSLog(@"Drawable Atlas: using (%.2f MB) for vertices, (%.2f MB) for elements.",vertTotal/(float)(1024*1024),elTotal/(float)(1024*1024));
+    int totalFree,largestFree,numRegions;
+    getUsage(totalFree,largestFree,numRegions);
+    NSLog(@"Drawable Atlas: %.2f MB free in %d regions, largest block %.2f MB",totalFree/(float)(1024*1024),numRegions,largestFree/(float)(1024*1024));
 }
     
 }
@@ -26,8 +26,9 @@ using namespace Eigen;
 namespace WhirlyKit
 {
  
-DynamicTexture::DynamicTexture(const std::string &name,int texSize,int cellSize,GLenum inFormat)
-    : TextureBase(name), texSize(texSize), cellSize(cellSize), numCell(0), numRegions(0), compressed(false), layoutGrid(NULL)
+DynamicTexture::DynamicTexture(const std::string &name,int texSize,int cellSize,GLenum inFormat,PackingMode packing)
+    : TextureBase(name), texSize(texSize), cellSize(cellSize), numCell(0), numRegions(0), compressed(false), layoutGrid(NULL),
+    packing(packing), shelfTop(0), usedTexels(0), valid(false), trackedMemSize(0), usesMipmaps(false), mipDirty(false)
 {
     if (texSize <= 0 || cellSize <= 0)
         return;
@@ -94,22 +95,29 @@ DynamicTexture::DynamicTexture(const std::string &name,int texSize,int cellSize,
             break;
     }
     
-    numCell = texSize/cellSize;
-    layoutGrid = new bool[numCell * numCell];
-    for (unsigned int ii=0;ii<numCell * numCell;ii++)
-        layoutGrid[ii] = false;
-    
+    if (packing == GridPacking)
+    {
+        numCell = texSize/cellSize;
+        layoutGrid = new bool[numCell * numCell];
+        for (unsigned int ii=0;ii<numCell * numCell;ii++)
+            layoutGrid[ii] = false;
+    }
+
     pthread_mutex_init(&regionLock,NULL);
+    valid = true;
 }
-    
+
 DynamicTexture::~DynamicTexture()
 {
-    if (!layoutGrid)
+    if (!valid)
         return;
-    
-    delete [] layoutGrid;
-    layoutGrid = NULL;
-    
+
+    if (layoutGrid)
+    {
+        delete [] layoutGrid;
+        layoutGrid = NULL;
+    }
+
     pthread_mutex_destroy(&regionLock);
 }
 
@@ -120,15 +128,23 @@ bool DynamicTexture::createInGL(OpenGLMemManager *memManager)
     if (glId != 0)
         return true;
     
-    glId = memManager->getTexID();
+    // Atlas textures come in a few fixed sizes, so an atlas that went
+    //  away recently usually hands us its storage right back
+    if (!compressed)
+        glId = memManager->getRecycledTexID(texSize,texSize,format);
+    if (!glId)
+        glId = memManager->getTexID();
     if (!glId)
         return false;
     glBindTexture(GL_TEXTURE_2D, glId);
     CheckGLError("DynamicTexture::createInGL() glBindTexture()");
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if (usesMipmaps && !compressed)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
+
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     CheckGLError("DynamicTexture::createInGL() glTexParameteri()");
@@ -152,6 +168,7 @@ bool DynamicTexture::createInGL(OpenGLMemManager *memManager)
         }
         
 		glCompressedTexImage2D(GL_TEXTURE_2D, 0, type, texSize, texSize, 0, (GLsizei)size, NULL);
+        trackedMemSize = size;
     } else {
         // Turn this on to provide glTexImage2D with empty memory so Instruments doesn't complain
 //        size_t size = texSize*texSize*4;
@@ -160,25 +177,57 @@ bool DynamicTexture::createInGL(OpenGLMemManager *memManager)
 //        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texSize, texSize, 0, GL_RGBA, format, zeroMem);
 //        free(zeroMem);
         glTexImage2D(GL_TEXTURE_2D, 0, format, texSize, texSize, 0, format, type, NULL);
+        // Allocate the rest of the chain up front so the per-region
+        //  rebuilds are respecifies, not allocations
+        if (usesMipmaps)
+            glGenerateMipmap(GL_TEXTURE_2D);
     }
     CheckGLError("DynamicTexture::createInGL() glTexImage2D()");
-    
+
     glBindTexture(GL_TEXTURE_2D, 0);
-    
+
+    // Report the full allocation to the memory census
+    if (!compressed)
+        switch (type)
+        {
+            case GL_UNSIGNED_BYTE:
+                trackedMemSize = texSize*texSize * (format == GL_ALPHA ? 1 : 4);
+                break;
+            default:
+                trackedMemSize = texSize*texSize * 2;
+                break;
+        }
+    // The mip chain runs another third
+    if (usesMipmaps && !compressed)
+        trackedMemSize += trackedMemSize/3;
+    memManager->addTrackedMem(WKMemTexAtlas,trackedMemSize);
+
     return true;
 }
     
 void DynamicTexture::destroyInGL(OpenGLMemManager *memManager)
 {
 	if (glId)
-        memManager->removeTexID(glId);    
+    {
+        if (compressed)
+            memManager->removeTexID(glId);
+        else
+            memManager->recycleTexID(glId,texSize,texSize,format);
+        memManager->subTrackedMem(WKMemTexAtlas,trackedMemSize);
+        trackedMemSize = 0;
+    }
     glId = 0;
 }
     
 void DynamicTexture::addTexture(Texture *tex,const Region &region)
 {
-    int startX = region.sx * cellSize;
-    int startY = region.sy * cellSize;
+    int startX = region.sx;
+    int startY = region.sy;
+    if (packing == GridPacking)
+    {
+        startX *= cellSize;
+        startY *= cellSize;
+    }
     int width = tex->getWidth();
     int height = tex->getHeight();
     
@@ -207,22 +256,117 @@ void DynamicTexture::addTextureData(int startX,int startY,int width,int height,N
         } else
             glTexSubImage2D(GL_TEXTURE_2D, 0, startX, startY, width, height, format, type, [data bytes]);
         CheckGLError("DynamicTexture::addTexture() glTexSubImage2D()");
+        // The chain rebuild waits for the flush, not the region
+        if (usesMipmaps)
+            mipDirty = true;
         glBindTexture(GL_TEXTURE_2D, 0);
     }    
 }
 
+void DynamicTexture::generateMipmaps()
+{
+    if (!glId || !usesMipmaps || !mipDirty)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, glId);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    CheckGLError("DynamicTexture::generateMipmaps() glGenerateMipmap()");
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mipDirty = false;
+}
+
 void DynamicTexture::setRegion(const Region &region, bool enable)
+{
+    if (packing == ShelfPacking)
+        setShelfRegion(region,enable);
+    else
+        setGridRegion(region,enable);
+}
+
+void DynamicTexture::setGridRegion(const Region &region, bool enable)
 {
     int sx = std::max(region.sx,0), sy = std::max(region.sy,0);
     int ex = std::min(region.ex,numCell-1), ey = std::min(region.ey,numCell-1);
-    
+
     for (unsigned int ix=sx;ix<=ex;ix++)
         for (unsigned int iy=sy;iy<=ey;iy++)
         {
-            layoutGrid[iy*numCell+ix] = enable;
+            if (layoutGrid[iy*numCell+ix] != enable)
+            {
+                layoutGrid[iy*numCell+ix] = enable;
+                usedTexels += (enable ? 1 : -1) * cellSize * cellSize;
+            }
         }
 }
-    
+
+// Give a region back to (or carve it out of) the shelf it sits on
+void DynamicTexture::setShelfRegion(const Region &region,bool enable)
+{
+    int width = region.ex - region.sx + 1;
+    int height = region.ey - region.sy + 1;
+
+    // Find the shelf this region sits on.  We may be mirroring an
+    //  allocation made in another texture of the atlas, so create it
+    //  if it isn't there yet.
+    int which = -1;
+    for (unsigned int ii=0;ii<shelves.size();ii++)
+        if (shelves[ii].y == region.sy)
+        {
+            which = ii;
+            break;
+        }
+    if (which < 0)
+    {
+        if (!enable)
+            return;
+        shelves.push_back(Shelf(region.sy,height));
+        shelves.back().spans.push_back(Span(0,texSize));
+        if (region.sy + height > shelfTop)
+            shelfTop = region.sy + height;
+        which = (int)(shelves.size()-1);
+    }
+    Shelf &shelf = shelves[which];
+
+    if (enable)
+    {
+        // Carve the region out of whichever free span contains it
+        for (unsigned int ii=0;ii<shelf.spans.size();ii++)
+        {
+            Span &span = shelf.spans[ii];
+            if (span.x <= region.sx && region.ex < span.x + span.width)
+            {
+                Span before(span.x,region.sx - span.x);
+                Span after(region.ex+1,span.x + span.width - (region.ex+1));
+                shelf.spans.erase(shelf.spans.begin()+ii);
+                if (after.width > 0)
+                    shelf.spans.insert(shelf.spans.begin()+ii,after);
+                if (before.width > 0)
+                    shelf.spans.insert(shelf.spans.begin()+ii,before);
+                usedTexels += width * height;
+                break;
+            }
+        }
+    } else {
+        // Hand the span back and merge with its neighbors
+        unsigned int ii;
+        for (ii=0;ii<shelf.spans.size();ii++)
+            if (region.sx < shelf.spans[ii].x)
+                break;
+        shelf.spans.insert(shelf.spans.begin()+ii,Span(region.sx,width));
+        for (int jj=(int)shelf.spans.size()-2;jj>=0;jj--)
+        {
+            Span &span = shelf.spans[jj];
+            Span &next = shelf.spans[jj+1];
+            if (span.x + span.width == next.x)
+            {
+                span.width += next.width;
+                shelf.spans.erase(shelf.spans.begin()+jj+1);
+            }
+        }
+        usedTexels -= width * height;
+    }
+}
+
 bool DynamicTexture::findRegion(int sizeX,int sizeY,Region &region)
 {
     // First thing we need to do is clear any outstanding regions
@@ -234,7 +378,14 @@ bool DynamicTexture::findRegion(int sizeX,int sizeY,Region &region)
     pthread_mutex_unlock(&regionLock);
     for (unsigned int ii=0;ii<toClear.size();ii++)
         setRegion(toClear[ii], false);
-    
+
+    if (packing == ShelfPacking)
+        return findShelfRegion(sizeX,sizeY,region);
+    return findGridRegion(sizeX,sizeY,region);
+}
+
+bool DynamicTexture::findGridRegion(int sizeX,int sizeY,Region &region)
+{
     // Now look for a region that'll fit
     // Look for a spot big enough
     bool found = false;
@@ -263,10 +414,53 @@ bool DynamicTexture::findRegion(int sizeX,int sizeY,Region &region)
     // Found one, so fill it in
     region.sx = foundX;  region.sy = foundY;
     region.ex = foundX+sizeX-1;  region.ey = foundY+sizeY-1;
-    
+
     return true;
 }
-    
+
+// Shelf packing: find the shelf that wastes the least height and has room
+bool DynamicTexture::findShelfRegion(int width,int height,Region &region)
+{
+    if (width > texSize || height > texSize)
+        return false;
+
+    int bestShelf = -1,bestSpan = -1,bestWaste = 0;
+    for (unsigned int ii=0;ii<shelves.size();ii++)
+    {
+        Shelf &shelf = shelves[ii];
+        if (shelf.height < height)
+            continue;
+        int waste = shelf.height - height;
+        if (bestShelf >= 0 && waste >= bestWaste)
+            continue;
+        for (unsigned int jj=0;jj<shelf.spans.size();jj++)
+            if (shelf.spans[jj].width >= width)
+            {
+                bestShelf = ii;
+                bestSpan = jj;
+                bestWaste = waste;
+                break;
+            }
+    }
+
+    if (bestShelf >= 0)
+    {
+        Shelf &shelf = shelves[bestShelf];
+        Span &span = shelf.spans[bestSpan];
+        region.sx = span.x;  region.sy = shelf.y;
+        region.ex = span.x + width - 1;  region.ey = shelf.y + height - 1;
+        return true;
+    }
+
+    // No existing shelf will take it, so open a new one
+    if (shelfTop + height > texSize)
+        return false;
+    region.sx = 0;  region.sy = shelfTop;
+    region.ex = width - 1;  region.ey = shelfTop + height - 1;
+
+    return true;
+}
+
 void DynamicTexture::addRegionToClear(const Region &region)
 {
     pthread_mutex_lock(&regionLock);
@@ -279,15 +473,10 @@ bool DynamicTexture::empty()
     return numRegions == 0;
 }
 
-void DynamicTexture::getUtilization(int &outNumCell,int &usedCell)
+void DynamicTexture::getUtilization(int &totalTexels,int &usedOut)
 {
-    outNumCell = numCell*numCell;
-    usedCell = 0;
-    for (unsigned int ii=0;ii<numCell*numCell;ii++)
-    {
-        if (layoutGrid[ii])
-            usedCell++;
-    }
+    totalTexels = texSize*texSize;
+    usedOut = usedTexels;
 }
     
 void DynamicTextureClearRegion::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
@@ -307,11 +496,21 @@ void DynamicTextureAddRegion::execute(Scene *scene,WhirlyKitSceneRendererES *ren
     if (dynTex)
     {
         dynTex->addTextureData(startX, startY, width, height, data);
-    }    
+    }
 }
-    
-DynamicTextureAtlas::DynamicTextureAtlas(int texSize,int cellSize,GLenum format,int imageDepth)
-    : texSize(texSize), cellSize(cellSize), format(format), imageDepth(imageDepth)
+
+void DynamicTextureGenMipsRequest::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+{
+    TextureBase *tex = scene->getTexture(texId);
+    DynamicTexture *dynTex = dynamic_cast<DynamicTexture *>(tex);
+    if (dynTex)
+    {
+        dynTex->generateMipmaps();
+    }
+}
+
+DynamicTextureAtlas::DynamicTextureAtlas(int texSize,int cellSize,GLenum format,int imageDepth,DynamicTexture::PackingMode packing,bool usesMipmaps)
+    : texSize(texSize), cellSize(cellSize), format(format), imageDepth(imageDepth), packing(packing), usesMipmaps(usesMipmaps), mipsDirty(false)
 {
 }
     
@@ -343,14 +542,23 @@ bool DynamicTextureAtlas::addTexture(const std::vector<Texture *> &newTextures,P
     // Now look for space
     DynamicTextureVec *dynTexVec = NULL;
     bool found = false;
-    int numCellX = ceil((firstTex->getWidth()+bufferPixels) / (float)cellSize), numCellY = ceil((firstTex->getHeight()+bufferPixels) / (float)cellSize);
+    // Grid packing deals in cells, shelf packing in texels
+    int sizeX,sizeY;
+    if (packing == DynamicTexture::ShelfPacking)
+    {
+        sizeX = firstTex->getWidth()+bufferPixels;
+        sizeY = firstTex->getHeight()+bufferPixels;
+    } else {
+        sizeX = ceil((firstTex->getWidth()+bufferPixels) / (float)cellSize);
+        sizeY = ceil((firstTex->getHeight()+bufferPixels) / (float)cellSize);
+    }
     for (DynamicTextureSet::iterator it = textures.begin();
          it != textures.end(); ++it)
     {
         DynamicTextureVec *dynTex = *it;
         DynamicTexture *firstDynTex = dynTex->at(0);
         DynamicTexture::Region thisRegion;
-        if (firstDynTex->findRegion(numCellX, numCellY, thisRegion))
+        if (firstDynTex->findRegion(sizeX, sizeY, thisRegion))
         {
             texRegion.region = thisRegion;
             texRegion.dynTexId = firstDynTex->getId();
@@ -367,7 +575,8 @@ bool DynamicTextureAtlas::addTexture(const std::vector<Texture *> &newTextures,P
         dynTexVec = new std::vector<DynamicTexture *>();
         for (unsigned int ii=0;ii<imageDepth;ii++)
         {
-            DynamicTexture *dynTex = new DynamicTexture("Dynamic Texture Atlas",texSize,cellSize,format);
+            DynamicTexture *dynTex = new DynamicTexture("Dynamic Texture Atlas",texSize,cellSize,format,packing);
+            dynTex->setUsesMipmaps(usesMipmaps);
             dynTexVec->push_back(dynTex);
             dynTex->createInGL(memManager);
         }
@@ -375,7 +584,7 @@ bool DynamicTextureAtlas::addTexture(const std::vector<Texture *> &newTextures,P
 //        NSLog(@"Added dynamic texture %ld (%ld)",dynTex->getId(),textures.size());
         textures.insert(dynTexVec);
         DynamicTexture::Region thisRegion;
-        if (dynTexVec->at(0)->findRegion(numCellX, numCellY, thisRegion))
+        if (dynTexVec->at(0)->findRegion(sizeX, sizeY, thisRegion))
         {
             texRegion.region = thisRegion;
             texRegion.dynTexId = dynTexVec->at(0)->getId();
@@ -388,6 +597,14 @@ bool DynamicTextureAtlas::addTexture(const std::vector<Texture *> &newTextures,P
     
     if (found)
     {
+        // Where the region starts in texels
+        int pixX = texRegion.region.sx, pixY = texRegion.region.sy;
+        if (packing == DynamicTexture::GridPacking)
+        {
+            pixX *= cellSize;
+            pixY *= cellSize;
+        }
+
         for (unsigned int ii=0;ii<dynTexVec->size();ii++)
         {
             Texture *tex = newTextures[ii];
@@ -398,17 +615,20 @@ bool DynamicTextureAtlas::addTexture(const std::vector<Texture *> &newTextures,P
             // Make the main thread do the merge
             if (MainThreadMerge)
                 changes.push_back(new DynamicTextureAddRegion(dynTex->getId(),
-                                                              texRegion.region.sx * cellSize, texRegion.region.sy * cellSize, tex->getWidth(), tex->getHeight(),
+                                                              pixX, pixY, tex->getWidth(), tex->getHeight(),
                                                               tex->processData()));
             else
                 dynTex->addTexture(tex, texRegion.region);
         }
 
+        if (usesMipmaps)
+            mipsDirty = true;
+
         // This asks for a flush
         changes.push_back(NULL);
 
         // This way does not take into account borders
-        TexCoord org((texRegion.region.sx * cellSize) / (float)texSize, (texRegion.region.sy * cellSize) / (float)texSize);
+        TexCoord org(pixX / (float)texSize, pixY / (float)texSize);
 //        texRegion.subTex.setFromTex(TexCoord(org.x(),org.y()),
 //                                    TexCoord(org.x() + tex->getWidth() / (float)texSize , org.y() + tex->getHeight() / (float)texSize));
         
@@ -462,6 +682,22 @@ void DynamicTextureAtlas::removeTexture(const SubTexture &subTex,ChangeSet &chan
     }
 }
     
+void DynamicTextureAtlas::regenMipmaps(ChangeSet &changes)
+{
+    if (!usesMipmaps || !mipsDirty)
+        return;
+
+    // One rebuild per texture per flush.  The textures themselves
+    //  skip the ones that haven't actually changed.
+    for (DynamicTextureSet::iterator it = textures.begin();it != textures.end(); ++it)
+    {
+        DynamicTextureVec *texVec = *it;
+        for (unsigned int ii=0;ii<texVec->size();ii++)
+            changes.push_back(new DynamicTextureGenMipsRequest(texVec->at(ii)->getId()));
+    }
+    mipsDirty = false;
+}
+
 void DynamicTextureAtlas::cleanup(ChangeSet &changes)
 {
     DynamicTextureSet::iterator itNext;
@@ -507,19 +743,8 @@ void DynamicTextureAtlas::shutdown(ChangeSet &changes)
     regions.clear();
 }
 
-void DynamicTextureAtlas::log()
+int DynamicTextureAtlas::texelBytes()
 {
-    int numCells=0,usedCells=0;
-    for (DynamicTextureSet::iterator it = textures.begin();
-         it != textures.end(); ++it)
-    {
-        DynamicTextureVec *texVec = *it;
-        int thisNumCells,thisUsedCells;
-        texVec->at(0)->getUtilization(thisNumCells,thisUsedCells);
-        numCells += thisNumCells;
-        usedCells += thisUsedCells;
-    }
-
     int texelSize = 4;
     switch (format)
     {
@@ -544,12 +769,37 @@ void DynamicTextureAtlas::log()
             break;
         default:
             break;
-            
+
     }
-    
-    NSLog(@"DynamicTextureAtlas: %ld textures, (%.2f MB)",textures.size(),textures.size() * texSize*texSize*texelSize/(float)(1024*1024));
-    if (numCells > 0)
-        NSLog(@"DynamicTextureAtlas: using %.2f%% of the cells",100 * usedCells / (float)numCells);
+
+    return texelSize;
+}
+
+void DynamicTextureAtlas::getUtilization(Utilization &util)
+{
+    int texelSize = texelBytes();
+    for (DynamicTextureSet::iterator it = textures.begin();
+         it != textures.end(); ++it)
+    {
+        DynamicTextureVec *texVec = *it;
+        int totalTexels,usedTexels;
+        texVec->at(0)->getUtilization(totalTexels,usedTexels);
+        util.numTextures += texVec->size();
+        util.bytesAllocated += (size_t)totalTexels * texelSize * texVec->size();
+        util.bytesUsed += (size_t)usedTexels * texelSize * texVec->size();
+    }
+}
+
+void DynamicTextureAtlas::log()
+{
+    Utilization util;
+    getUtilization(util);
+
+    NSLog(@"DynamicTextureAtlas: %d textures, (%.2f MB)",util.numTextures,util.bytesAllocated/(float)(1024*1024));
+    if (util.bytesAllocated > 0)
+        NSLog(@"DynamicTextureAtlas: using %.2f%% of the texels (%.2f MB unused)",
+              100 * util.bytesUsed / (double)util.bytesAllocated,
+              (util.bytesAllocated-util.bytesUsed)/(float)(1024*1024));
 }
 
 }
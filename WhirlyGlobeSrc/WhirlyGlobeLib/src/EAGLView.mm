@@ -21,12 +21,31 @@
 #import "EAGLView.h"
 #import <QuartzCore/QuartzCore.h>
 
+// How many idle frames we draw before the display link goes to sleep
+static const int kWKRenderIdleFrames = 3;
+
+// How many frames the pacing governor averages before making a call
+static const int kWKPaceWindow = 30;
+// Step down a rate when frames cost more than this much of their budget
+static const float kWKPaceDegradeFraction = 0.9;
+// Step back up when frames would fit the faster rate this comfortably
+static const float kWKPaceUpgradeFraction = 0.6;
+// Windows a new rate holds before we'll consider speeding up again
+static const int kWKPaceHoldWindows = 4;
+// Slowest we'll pace down to.  4 is 15 frames/sec on a 60Hz display.
+static const NSInteger kWKPaceMaxInterval = 4;
+
 @implementation WhirlyKitEAGLView 
 {
     CADisplayLink *displayLink;
     bool resizeFail;
     int resizeFailRetry;
     NSInteger _frameInterval;
+    int idleFrames;
+    NSInteger paceFrameInterval;
+    NSTimeInterval frameCostAccum;
+    int frameCostSamples;
+    int paceHoldWindows;
 }
 
 @synthesize frameInterval=_frameInterval;
@@ -53,6 +72,14 @@
 		
         _animating = FALSE;
         _frameInterval = 1;
+        _adaptiveFrameRate = false;
+        paceFrameInterval = 1;
+        frameCostAccum = 0.0;
+        frameCostSamples = 0;
+        paceHoldWindows = 0;
+        _renderOnDemand = false;
+        _retainedBacking = FALSE;
+        idleFrames = 0;
         self.useRetina = TRUE;
         resizeFail = false;
         resizeFailRetry = 0;        
@@ -63,9 +90,68 @@
 
 - (void)dealloc
 {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
     [displayLink invalidate];
 }
 
+- (void)setRenderOnDemand:(bool)newVal
+{
+    if (_renderOnDemand == newVal)
+        return;
+    _renderOnDemand = newVal;
+
+    if (_renderOnDemand)
+    {
+        // Gestures and animations come through the view watcher,
+        //  change requests through the pending changes notification
+        [_renderer.theView addWatcherDelegate:self];
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(sceneChangesPending:) name:kWhirlyKitSceneChangesPending object:nil];
+    } else {
+        [_renderer.theView removeWatcherDelegate:self];
+        [[NSNotificationCenter defaultCenter] removeObserver:self name:kWhirlyKitSceneChangesPending object:nil];
+        [self wakeRendering];
+    }
+}
+
+- (void)setRetainedBacking:(BOOL)newVal
+{
+    if (_retainedBacking == newVal)
+        return;
+    _retainedBacking = newVal;
+
+    // This only matters if the render buffers haven't been allocated yet
+    CAEAGLLayer *eaglLayer = (CAEAGLLayer *)self.layer;
+    eaglLayer.drawableProperties = [NSDictionary dictionaryWithObjectsAndKeys:
+                                    [NSNumber numberWithBool:_retainedBacking], kEAGLDrawablePropertyRetainedBacking,
+                                    kEAGLColorFormatRGBA8, kEAGLDrawablePropertyColorFormat,
+                                    nil];
+}
+
+// Change requests can come in from any thread
+- (void)sceneChangesPending:(NSNotification *)note
+{
+    if ([NSThread isMainThread])
+        [self wakeRendering];
+    else
+        dispatch_async(dispatch_get_main_queue(),
+                       ^{
+                           [self wakeRendering];
+                       });
+}
+
+// The view updated, probably a gesture or an animation
+- (void)viewUpdated:(WhirlyKitView *)view
+{
+    [self wakeRendering];
+}
+
+- (void)wakeRendering
+{
+    idleFrames = 0;
+    if (_animating && displayLink.paused)
+        displayLink.paused = NO;
+}
+
 - (void)setUseRetina:(BOOL)newVal
 {
     _useRetina = newVal;
@@ -89,8 +175,78 @@
     if (newFrameInterval >= 1)
     {
         _frameInterval = newFrameInterval;
+        // A new ceiling resets the pacing, which will degrade again
+        //  if it has to
+        paceFrameInterval = _frameInterval;
+        frameCostAccum = 0.0;
+        frameCostSamples = 0;
+        paceHoldWindows = 0;
+        [displayLink setFrameInterval:_frameInterval];
+    }
+}
+
+- (NSInteger)currentFrameInterval
+{
+    return paceFrameInterval;
+}
+
+- (void)setAdaptiveFrameRate:(bool)newVal
+{
+    if (_adaptiveFrameRate == newVal)
+        return;
+    _adaptiveFrameRate = newVal;
+
+    if (!_adaptiveFrameRate && paceFrameInterval != _frameInterval)
+    {
+        // Hand the display link back to the rate the caller asked for
+        paceFrameInterval = _frameInterval;
         [displayLink setFrameInterval:_frameInterval];
     }
+    frameCostAccum = 0.0;
+    frameCostSamples = 0;
+    paceHoldWindows = 0;
+}
+
+// Called every frame with what the frame cost us.  Every window of
+//  frames we decide whether the current rate is holding up.
+- (void)updatePacing:(NSTimeInterval)frameCost
+{
+    frameCostAccum += frameCost;
+    if (++frameCostSamples < kWKPaceWindow)
+        return;
+
+    NSTimeInterval avgCost = frameCostAccum / frameCostSamples;
+    frameCostAccum = 0.0;
+    frameCostSamples = 0;
+
+    // One tick of the display link, normally 1/60s
+    NSTimeInterval tickLen = displayLink.duration;
+    if (tickLen <= 0.0)
+        return;
+
+    NSInteger newInterval = paceFrameInterval;
+    if (avgCost > kWKPaceDegradeFraction * tickLen * paceFrameInterval)
+    {
+        // Not keeping up.  A steady slower rate reads better than
+        //  missing deadlines at this one.
+        if (paceFrameInterval < kWKPaceMaxInterval)
+            newInterval = paceFrameInterval + 1;
+    } else if (paceHoldWindows > 0)
+    {
+        // Just moved.  Let things settle before we consider going back.
+        paceHoldWindows--;
+    } else if (paceFrameInterval > _frameInterval &&
+               avgCost < kWKPaceUpgradeFraction * tickLen * (paceFrameInterval - 1))
+        newInterval = paceFrameInterval - 1;
+
+    if (newInterval != paceFrameInterval)
+    {
+        paceFrameInterval = newInterval;
+        paceHoldWindows = kWKPaceHoldWindows;
+        [displayLink setFrameInterval:paceFrameInterval];
+        [[NSNotificationCenter defaultCenter] postNotificationName:kWKFrameIntervalChanged object:self
+                                                          userInfo:@{@"frameInterval": @(paceFrameInterval)}];
+    }
 }
 
 - (void)startAnimation
@@ -100,6 +256,9 @@
         if (!displayLink)
         {
             displayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(drawView:)];
+            // A fresh display link starts back at the requested rate
+            //  and the pacing degrades again if it needs to
+            paceFrameInterval = _frameInterval;
             [displayLink setFrameInterval:_frameInterval];
             if (_reactiveMode)
             {
@@ -133,7 +292,24 @@
     if (resizeFail)
         [self layoutSubviews];
 
+    NSTimeInterval frameStart = CFAbsoluteTimeGetCurrent();
     [_renderer render:displayLink.duration*displayLink.frameInterval];
+    if (_adaptiveFrameRate)
+        [self updatePacing:CFAbsoluteTimeGetCurrent()-frameStart];
+
+    // If nothing needs drawing, let the display link sleep.
+    // We give it a few frames of grace so trailing animation
+    //  frames don't get clipped.
+    if (_renderOnDemand && _animating)
+    {
+        if ([_renderer hasRenderWork])
+            idleFrames = 0;
+        else {
+            idleFrames++;
+            if (idleFrames > kWKRenderIdleFrames && !displayLink.paused)
+                displayLink.paused = YES;
+        }
+    }
 }
 
 - (void) setFrame:(CGRect)newFrame
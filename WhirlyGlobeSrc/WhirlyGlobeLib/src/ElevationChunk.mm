@@ -29,6 +29,8 @@ typedef enum {WhirlyKitElevationFloats,WhirlyKitElevationShorts} WhirlyKitElevat
 {
     WhirlyKitElevationFormat dataType;
     NSData *data;
+    long long dataHash;
+    bool hasDataHash;
 }
 
 + (WhirlyKitElevationChunk *)ElevationChunkWithRandomData
@@ -125,5 +127,59 @@ typedef enum {WhirlyKitElevationFloats,WhirlyKitElevationShorts} WhirlyKitElevat
     return ret;
 }
 
+- (WhirlyKit::Texture *)buildNormalMapTexture:(float)cellSizeX cellSizeY:(float)cellSizeY
+{
+    if (!data || _numX <= 0 || _numY <= 0 || cellSizeX <= 0.0 || cellSizeY <= 0.0)
+        return NULL;
+
+    NSMutableData *normData = [NSMutableData dataWithLength:4*_numX*_numY];
+    unsigned char *out = (unsigned char *)[normData mutableBytes];
+    for (int iy=0;iy<_numY;iy++)
+        for (int ix=0;ix<_numX;ix++)
+        {
+            // Sobel over the heights; elevationAtX:y: clamps at the borders
+            float gx = (([self elevationAtX:ix+1 y:iy-1] + 2*[self elevationAtX:ix+1 y:iy] + [self elevationAtX:ix+1 y:iy+1]) -
+                        ([self elevationAtX:ix-1 y:iy-1] + 2*[self elevationAtX:ix-1 y:iy] + [self elevationAtX:ix-1 y:iy+1])) / (8.0*cellSizeX);
+            float gy = (([self elevationAtX:ix-1 y:iy+1] + 2*[self elevationAtX:ix y:iy+1] + [self elevationAtX:ix+1 y:iy+1]) -
+                        ([self elevationAtX:ix-1 y:iy-1] + 2*[self elevationAtX:ix y:iy-1] + [self elevationAtX:ix+1 y:iy-1])) / (8.0*cellSizeY);
+            Point3f norm(-gx,-gy,1.0);
+            norm.normalize();
+
+            // Textures put row 0 at the top (north), the sample grid has it at the bottom
+            unsigned char *texel = &out[4*((_numY-1-iy)*_numX+ix)];
+            texel[0] = (norm.x()+1.0)*127.5;
+            texel[1] = (norm.y()+1.0)*127.5;
+            texel[2] = (norm.z()+1.0)*127.5;
+            texel[3] = 255;
+        }
+
+    Texture *newTex = new Texture("Elevation Normal Map",normData,false);
+    newTex->setWidth(_numX);
+    newTex->setHeight(_numY);
+    newTex->setFormat(GL_UNSIGNED_BYTE);
+
+    return newTex;
+}
+
+- (long long)dataHash
+{
+    if (!hasDataHash)
+    {
+        // Plain FNV-1a over the samples.  Worst case a concurrent
+        //  caller computes the same value twice.
+        unsigned long long hash = 14695981039346656037ULL;
+        const unsigned char *bytes = (const unsigned char *)[data bytes];
+        NSUInteger len = [data length];
+        for (NSUInteger ii=0;ii<len;ii++)
+        {
+            hash ^= bytes[ii];
+            hash *= 1099511628211ULL;
+        }
+        dataHash = (long long)hash;
+        hasDataHash = true;
+    }
+
+    return dataHash;
+}
 
 @end
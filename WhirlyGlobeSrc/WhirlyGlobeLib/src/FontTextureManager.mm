@@ -18,6 +18,13 @@
  *
  */
 
+#import <map>
+#import <string>
+#import <pthread.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
 #import "FontTextureManager.h"
 #import "UIImage+Stuff.h"
 #import "UIColor+Stuff.h"
@@ -33,7 +40,274 @@ typedef std::set<CGGlyph> GlyphSet;
 
 // We scale the fonts up so they look better sampled down.
 static const float BogusFontScale = 2.0;
-    
+
+// Magic number and version for the glyph cache file
+static const unsigned int GlyphCacheMagic = 0x57476763;
+static const unsigned int GlyphCacheVersion = 1;
+// If the cache file gets this big we throw it out and start over
+static const unsigned int GlyphCacheMaxSize = 16*1024*1024;
+
+// What we store on disk for each glyph, besides the key and the bitmap
+typedef struct
+{
+    float texWidth,texHeight;
+    float glyphWidth,glyphHeight;
+    float offsetX,offsetY;
+    float textureOffsetX,textureOffsetY;
+    unsigned int dataLen;
+} GlyphRecord;
+
+/** Persistent glyph cache.
+    Rasterizing a glyph through CoreText costs a lot more than reading
+    the finished bitmap back, and an app tends to need the same glyphs
+    session after session.  So we keep every glyph we render in a flat
+    file keyed by font, size, color and glyph, map that in on first use
+    and only rasterize true misses.
+  */
+class GlyphCache
+{
+public:
+    /// Everything that controls what a rendered glyph looks like
+    class GlyphKey
+    {
+    public:
+        GlyphKey(const std::string &fontName,float pointSize,unsigned int color,unsigned int outlineColor,float outlineSize,CGGlyph glyph)
+            : fontName(fontName), pointSize(pointSize), color(color), outlineColor(outlineColor), outlineSize(outlineSize), glyph(glyph) { }
+        bool operator < (const GlyphKey &that) const
+        {
+            if (glyph != that.glyph)  return glyph < that.glyph;
+            if (pointSize != that.pointSize)  return pointSize < that.pointSize;
+            if (color != that.color)  return color < that.color;
+            if (outlineColor != that.outlineColor)  return outlineColor < that.outlineColor;
+            if (outlineSize != that.outlineSize)  return outlineSize < that.outlineSize;
+            return fontName < that.fontName;
+        }
+        std::string fontName;
+        float pointSize;
+        unsigned int color,outlineColor;
+        float outlineSize;
+        CGGlyph glyph;
+    };
+
+    GlyphCache(NSString *fileName)
+        : appendFp(NULL), mapAddr(NULL), mapLen(0)
+    {
+        pthread_mutex_init(&lock,NULL);
+
+        const char *cName = [fileName cStringUsingEncoding:NSASCIIStringEncoding];
+
+        // If it's grown past reason, toss it and start over
+        struct stat statBuf;
+        if (stat(cName,&statBuf) == 0 && statBuf.st_size > GlyphCacheMaxSize)
+            unlink(cName);
+
+        // Map in whatever we rendered in earlier sessions
+        int fd = open(cName,O_RDONLY);
+        if (fd >= 0)
+        {
+            if (fstat(fd,&statBuf) == 0 && statBuf.st_size > 0)
+            {
+                mapLen = statBuf.st_size;
+                mapAddr = (unsigned char *)mmap(NULL,mapLen,PROT_READ,MAP_PRIVATE,fd,0);
+                if (mapAddr == MAP_FAILED)
+                {
+                    mapAddr = NULL;
+                    mapLen = 0;
+                }
+            }
+            close(fd);
+        }
+        if (mapAddr && !readEntries())
+        {
+            // Bad cache file.  Start over
+            munmap(mapAddr,mapLen);
+            mapAddr = NULL;
+            mapLen = 0;
+            entries.clear();
+            unlink(cName);
+        }
+
+        // New glyphs get appended on the end
+        appendFp = fopen(cName,"ab");
+        if (appendFp && ftello(appendFp) == 0)
+        {
+            unsigned int header[2];
+            header[0] = GlyphCacheMagic;
+            header[1] = GlyphCacheVersion;
+            fwrite(header,sizeof(header),1,appendFp);
+            fflush(appendFp);
+        }
+    }
+
+    ~GlyphCache()
+    {
+        if (appendFp)
+            fclose(appendFp);
+        if (mapAddr)
+            munmap(mapAddr,mapLen);
+        pthread_mutex_destroy(&lock);
+    }
+
+    /// There's one glyph cache, shared by anyone rendering text
+    static GlyphCache *getShared()
+    {
+        static GlyphCache *shared = NULL;
+        static dispatch_once_t onceToken;
+        dispatch_once(&onceToken,
+        ^{
+            NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,NSUserDomainMask,YES);
+            NSString *fileName = [[paths objectAtIndex:0] stringByAppendingPathComponent:@"whirlyglyphcache"];
+            shared = new GlyphCache(fileName);
+        });
+
+        return shared;
+    }
+
+    /// Return the rendered bitmap and metrics for a glyph, if we have them
+    NSData *lookup(const GlyphKey &key,CGSize &texSize,CGSize &glyphSize,CGPoint &offset,CGPoint &textureOffset)
+    {
+        pthread_mutex_lock(&lock);
+        std::map<GlyphKey,GlyphEntry>::iterator it = entries.find(key);
+        if (it == entries.end())
+        {
+            pthread_mutex_unlock(&lock);
+            return nil;
+        }
+        GlyphEntry &entry = it->second;
+        texSize = entry.texSize;
+        glyphSize = entry.glyphSize;
+        offset = entry.offset;
+        textureOffset = entry.textureOffset;
+        NSData *data = entry.data;
+        pthread_mutex_unlock(&lock);
+
+        return data;
+    }
+
+    /// Hang on to a freshly rendered glyph
+    void add(const GlyphKey &key,NSData *glyphImage,CGSize texSize,CGSize glyphSize,CGPoint offset,CGPoint textureOffset)
+    {
+        pthread_mutex_lock(&lock);
+        if (!appendFp || entries.find(key) != entries.end())
+        {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+
+        GlyphEntry entry;
+        entry.texSize = texSize;
+        entry.glyphSize = glyphSize;
+        entry.offset = offset;
+        entry.textureOffset = textureOffset;
+        entry.data = glyphImage;
+        entries[key] = entry;
+
+        // And write it through for next session
+        unsigned int fontNameLen = (unsigned int)key.fontName.size();
+        unsigned int glyph = key.glyph;
+        GlyphRecord rec;
+        rec.texWidth = texSize.width;  rec.texHeight = texSize.height;
+        rec.glyphWidth = glyphSize.width;  rec.glyphHeight = glyphSize.height;
+        rec.offsetX = offset.x;  rec.offsetY = offset.y;
+        rec.textureOffsetX = textureOffset.x;  rec.textureOffsetY = textureOffset.y;
+        rec.dataLen = (unsigned int)[glyphImage length];
+        fwrite(&fontNameLen,sizeof(fontNameLen),1,appendFp);
+        fwrite(key.fontName.c_str(),fontNameLen,1,appendFp);
+        fwrite(&key.pointSize,sizeof(float),1,appendFp);
+        fwrite(&key.color,sizeof(unsigned int),1,appendFp);
+        fwrite(&key.outlineColor,sizeof(unsigned int),1,appendFp);
+        fwrite(&key.outlineSize,sizeof(float),1,appendFp);
+        fwrite(&glyph,sizeof(glyph),1,appendFp);
+        fwrite(&rec,sizeof(rec),1,appendFp);
+        fwrite([glyphImage bytes],[glyphImage length],1,appendFp);
+        fflush(appendFp);
+
+        pthread_mutex_unlock(&lock);
+    }
+
+protected:
+    /// Metrics and bitmap for one cached glyph
+    class GlyphEntry
+    {
+    public:
+        CGSize texSize,glyphSize;
+        CGPoint offset,textureOffset;
+        NSData *data;
+    };
+
+    // Bounds checked read out of the mapping
+    bool readBytes(unsigned char *&at,unsigned char *end,void *dest,size_t len)
+    {
+        if (len > (size_t)(end-at))
+            return false;
+        memcpy(dest,at,len);
+        at += len;
+        return true;
+    }
+
+    // Walk the records in the mapped file
+    bool readEntries()
+    {
+        unsigned char *at = mapAddr;
+        unsigned char *end = mapAddr + mapLen;
+        unsigned int header[2];
+        if (!readBytes(at,end,header,sizeof(header)) ||
+            header[0] != GlyphCacheMagic || header[1] != GlyphCacheVersion)
+            return false;
+
+        while (at < end)
+        {
+            // A truncated record at the end just means we died mid write
+            //  last session.  Keep what we've got.
+            unsigned int fontNameLen;
+            if (!readBytes(at,end,&fontNameLen,sizeof(fontNameLen)))
+                break;
+            if (fontNameLen > (size_t)(end-at))
+                break;
+            std::string fontName((char *)at,fontNameLen);
+            at += fontNameLen;
+            float pointSize,outlineSize;
+            unsigned int color,outlineColor,glyph;
+            GlyphRecord rec;
+            if (!readBytes(at,end,&pointSize,sizeof(pointSize)) ||
+                !readBytes(at,end,&color,sizeof(color)) ||
+                !readBytes(at,end,&outlineColor,sizeof(outlineColor)) ||
+                !readBytes(at,end,&outlineSize,sizeof(outlineSize)) ||
+                !readBytes(at,end,&glyph,sizeof(glyph)) ||
+                !readBytes(at,end,&rec,sizeof(rec)))
+                break;
+            if (rec.dataLen > (size_t)(end-at))
+                break;
+
+            GlyphKey key(fontName,pointSize,color,outlineColor,outlineSize,glyph);
+            GlyphEntry entry;
+            entry.texSize = CGSizeMake(rec.texWidth,rec.texHeight);
+            entry.glyphSize = CGSizeMake(rec.glyphWidth,rec.glyphHeight);
+            entry.offset = CGPointMake(rec.offsetX,rec.offsetY);
+            entry.textureOffset = CGPointMake(rec.textureOffsetX,rec.textureOffsetY);
+            // The bitmap stays in the mapping rather than getting copied
+            entry.data = [NSData dataWithBytesNoCopy:at length:rec.dataLen freeWhenDone:NO];
+            at += rec.dataLen;
+            entries[key] = entry;
+        }
+
+        return true;
+    }
+
+    pthread_mutex_t lock;
+    FILE *appendFp;
+    unsigned char *mapAddr;
+    size_t mapLen;
+    std::map<GlyphKey,GlyphEntry> entries;
+};
+
+// Pack a color up for the glyph cache key
+static unsigned int GlyphCacheColor(UIColor *color,RGBAColor ifNil)
+{
+    RGBAColor rgba = color ? [color asRGBAColor] : ifNil;
+    return (rgba.r << 24) | (rgba.g << 16) | (rgba.b << 8) | rgba.a;
+}
+
 /// Manages the glyphs for a single font
 class FontManager
 {
@@ -168,6 +442,23 @@ typedef std::set<FontManager *,FontManagerSorter> FontManagerSet;
             
 typedef std::map<CTFontRef,GlyphSet> SimpleIDGlyphMap;
 
+// If the shaped string cache gets this big we throw it out and start over
+static const unsigned int ShapedStringCacheMaxSize = 2000;
+
+/** Shaped version of a string we've already run through CoreText.
+    Label heavy apps repeat the same strings constantly (road names,
+    say), so we keep the glyph placements around and just copy them
+    out on the next request.
+  */
+class ShapedString
+{
+public:
+    std::vector<DrawableString::Rect> glyphPolys;
+    Mbr mbr;
+    // Glyphs we reference in each font, so the cache can hold its own refs
+    SimpleIDGlyphMap fontGlyphs;
+};
+
 // Used to track the draw strings' representations in terms of fonts
 //  and glyphs
 class DrawStringRep : public Identifiable
@@ -200,6 +491,8 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
     DynamicTextureAtlas *texAtlas;
     FontManagerSet fontManagers;
     DrawStringRepSet drawStringReps;
+    // Maps attributed strings to ShapedString pointers
+    NSMutableDictionary *shapedStrings;
     pthread_mutex_t lock;
 }
 
@@ -210,8 +503,9 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
         return nil;
     
     scene = inScene;
+    shapedStrings = [NSMutableDictionary dictionary];
     pthread_mutex_init(&lock, NULL);
-    
+
     return self;
 }
 
@@ -220,6 +514,9 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
     if (texAtlas)
         delete texAtlas;
     texAtlas = NULL;
+    for (NSValue *shapedVal in [shapedStrings allValues])
+        delete (ShapedString *)[shapedVal pointerValue];
+    [shapedStrings removeAllObjects];
     for (DrawStringRepSet::iterator it = drawStringReps.begin();
          it != drawStringReps.end(); ++it)
         delete *it;
@@ -240,6 +537,10 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
         delete texAtlas;
         texAtlas = NULL;
     }
+    // The font managers go wholesale below, so no need to drop refs one by one
+    for (NSValue *shapedVal in [shapedStrings allValues])
+        delete (ShapedString *)[shapedVal pointerValue];
+    [shapedStrings removeAllObjects];
     for (DrawStringRepSet::iterator it = drawStringReps.begin();
          it != drawStringReps.end(); ++it)
         delete *it;
@@ -369,15 +670,75 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
     return fm;
 }
 
+// Drop every glyph reference the shaped string cache is holding.
+// Caller should be holding the lock.
+- (void)flushShapedStrings:(ChangeSet &)changes
+{
+    for (NSValue *shapedVal in [shapedStrings allValues])
+    {
+        ShapedString *shaped = (ShapedString *)[shapedVal pointerValue];
+        for (SimpleIDGlyphMap::iterator fit = shaped->fontGlyphs.begin();
+             fit != shaped->fontGlyphs.end(); ++fit)
+        {
+            FontManager dummyFm(fit->first);
+            FontManagerSet::iterator fmIt = fontManagers.find(&dummyFm);
+            if (fmIt != fontManagers.end())
+            {
+                FontManager *fm = *fmIt;
+                std::vector<SubTexture> texRemove;
+                fm->removeGlyphRefs(fit->second,texRemove);
+                if (!texRemove.empty())
+                    for (unsigned int ii=0;ii<texRemove.size();ii++)
+                        texAtlas->removeTexture(texRemove[ii], changes);
+                if (fm->refCount <= 0)
+                {
+                    fontManagers.erase(fmIt);
+                    delete fm;
+                }
+            }
+        }
+        delete shaped;
+    }
+    [shapedStrings removeAllObjects];
+}
+
 - (WhirlyKit::DrawableString *)addString:(NSAttributedString *)str changes:(ChangeSet &)changes
 {
-    // We could make this more granular
+    // We hold the lock for the bookkeeping, but drop it around the actual
+    //  glyph rendering so concurrent callers can overlap the expensive part
     pthread_mutex_lock(&lock);
 
+    // If we've already shaped this string, copy out the placements and
+    //  just take out glyph references.  Most label workloads repeat a
+    //  small set of strings endlessly.
+    NSValue *shapedVal = [shapedStrings objectForKey:str];
+    if (shapedVal)
+    {
+        ShapedString *shaped = (ShapedString *)[shapedVal pointerValue];
+        DrawableString *drawString = new DrawableString();
+        drawString->glyphPolys = shaped->glyphPolys;
+        drawString->mbr = shaped->mbr;
+        DrawStringRep *drawStringRep = new DrawStringRep(drawString->getId());
+        for (SimpleIDGlyphMap::iterator fit = shaped->fontGlyphs.begin();
+             fit != shaped->fontGlyphs.end(); ++fit)
+        {
+            FontManager dummyFm(fit->first);
+            FontManagerSet::iterator fmIt = fontManagers.find(&dummyFm);
+            if (fmIt != fontManagers.end())
+                (*fmIt)->addGlyphRefs(fit->second);
+            drawStringRep->addGlyphs(fit->first,fit->second);
+        }
+        drawStringReps.insert(drawStringRep);
+        pthread_mutex_unlock(&lock);
+
+        return drawString;
+    }
+
     if (!texAtlas)
     {
-        // Let's do the biggest possible texture with small cells 32 bits deep
-        texAtlas = new DynamicTextureAtlas(2048,16,GL_UNSIGNED_BYTE);
+        // Biggest possible texture, 32 bits deep.  Glyphs come in all
+        //  sizes, so shelf packing wastes far less of it than the cell grid.
+        texAtlas = new DynamicTextureAtlas(2048,16,GL_UNSIGNED_BYTE,1,DynamicTexture::ShelfPacking);
     }
     
     DrawableString *drawString = new DrawableString();
@@ -441,8 +802,29 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
                     // We need to render that Glyph and add it
                     CGSize texSize,glyphSize;
                     CGPoint offset,textureOffset;
-                    NSData *glyphImage = [self renderGlyph:glyph font:fm texSize:texSize glyphSize:glyphSize offset:offset textureOffset:textureOffset];
-                    if (glyphImage)
+                    // Check the persistent cache first.  Odds are we rendered
+                    //  this same glyph in an earlier session.
+                    GlyphCache::GlyphKey cacheKey([fm->fontName UTF8String],fm->pointSize,
+                                                  GlyphCacheColor(fm->color,RGBAColor(255,255,255,255)),
+                                                  GlyphCacheColor(fm->outlineColor,RGBAColor(0,0,0,0)),
+                                                  fm->outlineSize,glyph);
+                    // The rendering itself is pure Core Text, so drop the lock
+                    //  and let other strings through while we do it.  The ref
+                    //  keeps the font manager from being deleted under us.
+                    fm->refCount++;
+                    pthread_mutex_unlock(&lock);
+                    NSData *glyphImage = GlyphCache::getShared()->lookup(cacheKey,texSize,glyphSize,offset,textureOffset);
+                    if (!glyphImage)
+                    {
+                        glyphImage = [self renderGlyph:glyph font:fm texSize:texSize glyphSize:glyphSize offset:offset textureOffset:textureOffset];
+                        if (glyphImage)
+                            GlyphCache::getShared()->add(cacheKey,glyphImage,texSize,glyphSize,offset,textureOffset);
+                    }
+                    pthread_mutex_lock(&lock);
+                    fm->refCount--;
+                    // Someone else may have gotten to it while we were rendering
+                    glyphInfo = fm->findGlyph(glyph);
+                    if (!glyphInfo && glyphImage && texAtlas)
                     {
                         Texture *tex = new Texture("Font Texture Manager",glyphImage,false);
                         tex->setWidth(texSize.width);
@@ -503,7 +885,29 @@ typedef std::set<DrawStringRep *,IdentifiableSorter> DrawStringRepSet;
         delete drawStringRep;
         drawString = NULL;
     }
-    
+
+    // Hang on to the shaped result for the next time this string comes up.
+    // Someone else may have beaten us to it while the lock was down.
+    if (drawString && ![shapedStrings objectForKey:str])
+    {
+        if ([shapedStrings count] >= ShapedStringCacheMaxSize)
+            [self flushShapedStrings:changes];
+        ShapedString *shaped = new ShapedString();
+        shaped->glyphPolys = drawString->glyphPolys;
+        shaped->mbr = drawString->mbr;
+        shaped->fontGlyphs = drawStringRep->fontGlyphs;
+        // The cache holds its own glyph references so the sub textures stay put
+        for (SimpleIDGlyphMap::iterator fit = shaped->fontGlyphs.begin();
+             fit != shaped->fontGlyphs.end(); ++fit)
+        {
+            FontManager dummyFm(fit->first);
+            FontManagerSet::iterator fmIt = fontManagers.find(&dummyFm);
+            if (fmIt != fontManagers.end())
+                (*fmIt)->addGlyphRefs(fit->second);
+        }
+        [shapedStrings setObject:[NSValue valueWithPointer:shaped] forKey:[str copy]];
+    }
+
     // We need to track the glyphs we're using
     drawStringReps.insert(drawStringRep);
 
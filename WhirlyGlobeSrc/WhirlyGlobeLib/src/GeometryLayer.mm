@@ -36,9 +36,7 @@ void GeomSceneRep::removeFromScene(std::vector<WhirlyKit::ChangeRequest *> &chan
 void GeomSceneRep::fadeOutScene(std::vector<WhirlyKit::ChangeRequest *> &changeRequests)
 {
     NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
-    for (SimpleIDSet::iterator it = drawIDs.begin();
-         it != drawIDs.end(); ++it)
-        changeRequests.push_back(new FadeChangeRequest(*it, curTime, curTime+fade));
+    changeRequests.push_back(new FadeGangChangeRequest(drawIDs, curTime, curTime+fade));
 }
 
 // Used to pass geometry around internally
@@ -0,0 +1,133 @@
+/*
+ *  GlobeAnimatePath.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <vector>
+#import "GlobeAnimatePath.h"
+
+using namespace Eigen;
+using namespace WhirlyKit;
+
+// Samples along the path.  Enough that the linear interpolation
+//  between them is well below a pixel of error at typical heights
+static const int NumPathSamples = 64;
+
+namespace WhirlyGlobe
+{
+// One precomputed point along the path
+class PathSample
+{
+public:
+    Eigen::Quaterniond rot;
+    double height;
+};
+}
+
+@implementation WhirlyGlobeAnimateViewPath
+{
+    std::vector<WhirlyGlobe::PathSample> samples;
+}
+
+- (id)initWithView:(WhirlyGlobeView *)globeView toPosition:(GeoCoord)coord endHeight:(double)endHeight peakHeight:(double)peakHeight howLong:(float)howLong
+{
+    if ((self = [super init]))
+    {
+        _startDate = CFAbsoluteTimeGetCurrent();
+        _endDate = _startDate + howLong;
+
+        Eigen::Quaterniond startRot = [globeView rotQuat];
+        Eigen::Quaterniond endRot = [globeView makeRotationToGeoCoord:coord keepNorthUp:YES];
+        double startHeight = globeView.heightAboveGlobe;
+
+        // How much we rise above the higher endpoint mid-path
+        double hump = peakHeight - std::max(startHeight,endHeight);
+        if (hump < 0.0)
+            hump = 0.0;
+
+        // Work out the whole path up front.  The slerps and the height
+        //  curve only run here, not per frame
+        samples.resize(NumPathSamples+1);
+        for (unsigned int ii=0;ii<=NumPathSamples;ii++)
+        {
+            double t = (double)ii/(double)NumPathSamples;
+            WhirlyGlobe::PathSample &sample = samples[ii];
+            sample.rot = startRot.slerp(t,endRot);
+            sample.height = (1.0-t)*startHeight + t*endHeight + sin(M_PI*t)*hump;
+        }
+    }
+
+    return self;
+}
+
+- (void)sampleAtT:(double)t rot:(Eigen::Quaterniond &)rot height:(double &)height
+{
+    if (t <= 0.0)
+    {
+        rot = samples.front().rot;  height = samples.front().height;
+        return;
+    }
+    if (t >= 1.0)
+    {
+        rot = samples.back().rot;  height = samples.back().height;
+        return;
+    }
+
+    // Find the segment and where we are within it
+    double where = t * NumPathSamples;
+    int seg = (int)where;
+    double segT = where - seg;
+    const WhirlyGlobe::PathSample &s0 = samples[seg];
+    const WhirlyGlobe::PathSample &s1 = samples[seg+1];
+
+    // The samples are close together, so a normalized lerp is
+    //  indistinguishable from the slerp and much cheaper
+    rot.coeffs() = ((1.0-segT)*s0.rot.coeffs() + segT*s1.rot.coeffs()).normalized();
+    height = (1.0-segT)*s0.height + segT*s1.height;
+}
+
+// Called by the view when it's time to update
+- (void)updateView:(WhirlyGlobeView *)globeView
+{
+    if (_startDate == 0.0)
+        return;
+
+    CFTimeInterval now = CFAbsoluteTimeGetCurrent();
+    float span = _endDate-_startDate;
+    float remain = _endDate - now;
+
+    // All done.  Snap to the end
+    if (remain < 0)
+    {
+        [globeView setRotQuat:samples.back().rot updateWatchers:false];
+        globeView.heightAboveGlobe = samples.back().height;
+        _startDate = 0;
+        _endDate = 0;
+        [globeView cancelAnimation];
+    } else {
+        // Interpolate somewhere along the path
+        double t = (span-remain)/span;
+        Eigen::Quaterniond rot;
+        double height;
+        [self sampleAtT:t rot:rot height:height];
+        [globeView setRotQuat:rot updateWatchers:false];
+        globeView.heightAboveGlobe = height;
+    }
+}
+
+@end
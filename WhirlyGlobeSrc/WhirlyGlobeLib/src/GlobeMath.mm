@@ -22,6 +22,7 @@
 #import "GlobeMath.h"
 #import "FlatMath.h"
 #import "proj_api.h"
+#import <vector>
 
 using namespace Eigen;
 using namespace WhirlyKit;
@@ -132,6 +133,48 @@ Point3d GeoCoordSystem::geocentricToLocal(Point3d geocPt)
 }
     
 
+void GeoCoordSystem::LocalToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    if (numPts == 0)
+        return;
+    InitProj4();
+
+    std::vector<double> xs(numPts),ys(numPts),zs(numPts);
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        xs[ii] = inPts[ii].x();  ys[ii] = inPts[ii].y();  zs[ii] = inPts[ii].z();
+    }
+    pj_transform( pj_latlon, pj_geocentric, numPts, 1, &xs[0], &ys[0], &zs[0] );
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = Point3f(xs[ii],ys[ii],zs[ii]);
+}
+
+void GeoCoordSystem::GeocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    if (numPts == 0)
+        return;
+    InitProj4();
+
+    std::vector<double> xs(numPts),ys(numPts),zs(numPts);
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        xs[ii] = inPts[ii].x();  ys[ii] = inPts[ii].y();  zs[ii] = inPts[ii].z();
+    }
+    pj_transform( pj_geocentric, pj_latlon, numPts, 1, &xs[0], &ys[0], &zs[0] );
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = Point3f(xs[ii],ys[ii],zs[ii]);
+}
+
+void GeoCoordSystem::localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    LocalToGeocentric(inPts,outPts,numPts);
+}
+
+void GeoCoordSystem::geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    GeocentricToLocal(inPts,outPts,numPts);
+}
+
 Mbr GeoCoordSystem::GeographicMbrToLocal(GeoMbr geoMbr)
 {
     Mbr localMbr;
@@ -174,11 +217,33 @@ Point3d FakeGeocentricDisplayAdapter::LocalToDisplay(Point3d geoPt)
     return pt;
 }
     
+void FakeGeocentricDisplayAdapter::LocalToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        const Point3f &geoPt = inPts[ii];
+        float z = sinf(geoPt.y());
+        float rad = sqrtf(1.0-z*z);
+        Point3f pt(rad*cosf(geoPt.x()),rad*sinf(geoPt.x()),z);
+        // Scale outward with the z value
+        if (geoPt.z() != 0.0)
+        {
+            pt *= 1.0 + geoPt.z() / EarthRadius;
+        }
+        outPts[ii] = pt;
+    }
+}
+
 Point3f FakeGeocentricDisplayAdapter::localToDisplay(Point3f geoPt)
 {
     return LocalToDisplay(geoPt);
 }
 
+void FakeGeocentricDisplayAdapter::localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    LocalToDisplay(inPts,outPts,numPts);
+}
+
 Point3d FakeGeocentricDisplayAdapter::localToDisplay(Point3d geoPt)
 {
     return LocalToDisplay(geoPt);
@@ -246,6 +311,13 @@ Point3f GeocentricDisplayAdapter::localToDisplay(Point3f geoPt)
     return LocalToDisplay(geoPt);
 }
 
+void GeocentricDisplayAdapter::localToDisplay(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    GeoCoordSystem::LocalToGeocentric(inPts,outPts,numPts);
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] /= EarthRadius;
+}
+
 Point3d GeocentricDisplayAdapter::localToDisplay(Point3d geoPt)
 {
     return LocalToDisplay(geoPt);
@@ -39,7 +39,8 @@ GlobeScene::~GlobeScene()
     
 void GlobeScene::addDrawable(DrawableRef draw)
 {
-    drawables.insert(draw);
+    drawables[draw->getId()] = draw;
+    renderStateBuckets.addDrawable(draw);
 
     // Account for the geo coordinate wrapping
     Mbr localMbr = draw->getLocalMbr();
@@ -57,15 +58,12 @@ void GlobeScene::addDrawable(DrawableRef draw)
 
 void GlobeScene::remDrawable(DrawableRef draw)
 {
-    Mbr localMbr = draw->getLocalMbr();
-    GeoMbr geoMbr(GeoCoord(localMbr.ll().x(),localMbr.ll().y()),GeoCoord(localMbr.ur().x(),localMbr.ur().y()));
-    std::vector<Mbr> localMbrs;
-    geoMbr.splitIntoMbrs(localMbrs);
-    
-    for (unsigned int ii=0;ii<localMbrs.size();ii++)
-        cullTree->getTopCullable()->remDrawable(cullTree,localMbrs[ii],draw);
+    // The cull tree remembers where the drawable went, including the
+    //  geographic wrapping cases, so it can patch itself directly
+    cullTree->remDrawable(draw);
 
-    drawables.erase(draw);
+    renderStateBuckets.remDrawable(draw);
+    drawables.erase(draw->getId());
 }
 
 }
@@ -202,8 +202,8 @@ using namespace Eigen;
 
 - (Vector3d)currentUp
 {
-	Eigen::Matrix4d modelMat = [self calcModelMatrix].inverse();
-	
+	Eigen::Matrix4d modelMat = [self cachedMatrixInverse:[self calcModelMatrix]];
+
 	Vector4d newUp = modelMat * Vector4d(0,0,1,0);
 	return Vector3d(newUp.x(),newUp.y(),newUp.z());
 }
@@ -223,8 +223,7 @@ using namespace Eigen;
 	
 	// Run the screen point and the eye point (origin) back through
 	//  the model matrix to get a direction and origin in model space
-	Eigen::Matrix4d modelTrans = *transform;
-	Matrix4d invModelMat = modelTrans.inverse();
+	Matrix4d invModelMat = [self cachedMatrixInverse:*transform];
 	Point3d eyePt(0,0,0);
 	Vector4d modelEye = invModelMat * Vector4d(eyePt.x(),eyePt.y(),eyePt.z(),1.0);
 	Vector4d modelScreenPt = invModelMat * Vector4d(screenPt.x(),screenPt.y(),screenPt.z(),1.0);
@@ -436,8 +435,8 @@ using namespace Eigen;
 
 - (Eigen::Vector3d)eyePos
 {
-	Eigen::Matrix4d modelMat = [self calcModelMatrix].inverse();
-	
+	Eigen::Matrix4d modelMat = [self cachedMatrixInverse:[self calcModelMatrix]];
+
 	Vector4d newUp = modelMat * Vector4d(0,0,1,1);
 	return Vector3d(newUp.x(),newUp.y(),newUp.z());
 }
@@ -0,0 +1,299 @@
+/*
+ *  GreatCircleLayer.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "GreatCircleLayer.h"
+#import "VectorData.h"
+#import "GlobeMath.h"
+
+using namespace WhirlyKit;
+
+// Viewer height buckets we'll resample for.  One bucket per power of
+//  two of height, clamped to this range.
+static const int MinHeightBucket = -8;
+static const int MaxHeightBucket = 1;
+
+// Subdivision tolerance (in display units) at a bucket height of 1.0.
+// Screen error scales roughly linearly with height, so each bucket
+//  down halves the tolerance.
+static const float BaseSubdivEps = 0.001;
+
+@implementation WhirlyKitGreatCircle
+@end
+
+// Everything we need to track one group of great circles
+@interface GreatCircleGroup : NSObject
+
+// The analytic curves, for resampling
+@property (nonatomic) NSArray *circles;
+// Shape related attributes, passed through to the shape manager
+@property (nonatomic) NSDictionary *desc;
+// Our ID, handed back to the caller
+@property (nonatomic,assign) WhirlyKit::SimpleIdentity groupId;
+// ID of the shapes currently in the shape manager
+@property (nonatomic,assign) WhirlyKit::SimpleIdentity shapeID;
+// Cached tessellations per height bucket (bucket -> NSArray of WhirlyKitShapeLinear)
+@property (nonatomic) NSMutableDictionary *linearsByBucket;
+
+@end
+
+@implementation GreatCircleGroup
+
+- (id)init
+{
+    self = [super init];
+    if (self)
+    {
+        _groupId = Identifiable::genId();
+        _shapeID = EmptyIdentity;
+        _linearsByBucket = [NSMutableDictionary dictionary];
+    }
+
+    return self;
+}
+
+@end
+
+@implementation WhirlyKitGreatCircleLayer
+{
+    /// Layer thread this belongs to
+    WhirlyKitLayerThread * __weak layerThread;
+    /// Scene we're modifying
+    WhirlyKit::Scene *scene;
+
+    // Groups we're tracking, by group ID
+    NSMutableDictionary *groups;
+    // Height bucket everything is currently sampled for
+    int curBucket;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self)
+    {
+        groups = [NSMutableDictionary dictionary];
+        curBucket = 0;
+    }
+
+    return self;
+}
+
+// Called in the layer thread
+- (void)startWithThread:(WhirlyKitLayerThread *)inLayerThread scene:(Scene *)inScene
+{
+    layerThread = inLayerThread;
+    scene = inScene;
+
+    // We want view updates, but not too often
+    if (layerThread.viewWatcher)
+        [layerThread.viewWatcher addWatcherTarget:self selector:@selector(viewUpdate:) minTime:0.1 minDist:0.0 maxLagTime:0.0];
+}
+
+- (void)shutdown
+{
+    if (layerThread.viewWatcher)
+        [layerThread.viewWatcher removeWatcherTarget:self selector:@selector(viewUpdate:)];
+
+    ChangeSet changes;
+    ShapeManager *shapeManager = (ShapeManager *)scene->getManager(kWKShapeManager);
+    if (shapeManager)
+    {
+        SimpleIDSet toRemove;
+        for (GreatCircleGroup *group in [groups allValues])
+            if (group.shapeID != EmptyIdentity)
+                toRemove.insert(group.shapeID);
+        shapeManager->removeShapes(toRemove, changes);
+    }
+    [groups removeAllObjects];
+
+    [layerThread addChangeRequests:changes];
+}
+
+// Decide which height bucket the viewer is in
+- (int)bucketForViewState:(WhirlyKitViewState *)viewState
+{
+    double height;
+    if (viewState.coordAdapter->isFlat())
+        height = [viewState eyePos].z();
+    else
+        height = [viewState eyePos].norm() - 1.0;
+    height = std::max(height,1e-6);
+
+    int bucket = (int)ceil(log2(height));
+    if (bucket < MinHeightBucket)  bucket = MinHeightBucket;
+    if (bucket > MaxHeightBucket)  bucket = MaxHeightBucket;
+
+    return bucket;
+}
+
+// Sample a great circle at the given tolerance and throw in an
+//  interpolated height at each point
+static void SampleGreatCircle(WhirlyKitGreatCircle *circle,std::vector<Point3f> &pts,CoordSystemDisplayAdapter *coordAdapter,float eps)
+{
+    bool isFlat = coordAdapter->isFlat();
+
+    if (isFlat)
+    {
+        // No curvature to chase on a flat map
+        pts.resize(2);
+        pts[0] = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal(circle.startLoc));
+        pts[1] = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal(circle.endLoc));
+    } else {
+        VectorRing inPts;
+        inPts.push_back(Point2f(circle.startLoc.x(),circle.startLoc.y()));
+        inPts.push_back(Point2f(circle.endLoc.x(),circle.endLoc.y()));
+        SubdivideEdgesToSurfaceGC(inPts, pts, false, coordAdapter, eps);
+
+        // To apply the height, we'll need the total length
+        float totLen = 0;
+        for (int ii=0;ii<pts.size()-1;ii++)
+        {
+            float len = (pts[ii+1]-pts[ii]).norm();
+            totLen += len;
+        }
+
+        // Now we'll walk along, apply the height (max at the middle)
+        float lenSoFar = 0.0;
+        for (unsigned int ii=0;ii<pts.size();ii++)
+        {
+            Point3f &pt = pts[ii];
+            float len = (pts[ii+1]-pt).norm();
+            float t = lenSoFar/totLen;
+            lenSoFar += len;
+
+            // Parabolic curve
+            float b = 4*circle.height;
+            float a = -b;
+            float thisHeight = a*(t*t) + b*t;
+
+            pt *= 1.0+thisHeight;
+        }
+    }
+}
+
+// Build (or fetch) the tessellation of a group for the given bucket
+- (NSArray *)linearsForGroup:(GreatCircleGroup *)group bucket:(int)bucket
+{
+    NSArray *linears = group.linearsByBucket[@(bucket)];
+    if (linears)
+        return linears;
+
+    float eps = BaseSubdivEps * powf(2.0,bucket);
+
+    NSMutableArray *newLinears = [NSMutableArray array];
+    for (WhirlyKitGreatCircle *circle in group.circles)
+    {
+        WhirlyKitShapeLinear *lin = [[WhirlyKitShapeLinear alloc] init];
+        SampleGreatCircle(circle,lin.pts,scene->getCoordAdapter(),eps);
+        lin.lineWidth = circle.lineWidth;
+        if (circle.useColor)
+        {
+            lin.useColor = true;
+            RGBAColor color = circle.color;
+            lin.color = color;
+        }
+        [newLinears addObject:lin];
+    }
+    group.linearsByBucket[@(bucket)] = newLinears;
+
+    return newLinears;
+}
+
+// Swap a group's shapes out for the given bucket's tessellation
+- (void)updateGroup:(GreatCircleGroup *)group bucket:(int)bucket changes:(ChangeSet &)changes
+{
+    ShapeManager *shapeManager = (ShapeManager *)scene->getManager(kWKShapeManager);
+    if (!shapeManager)
+        return;
+
+    if (group.shapeID != EmptyIdentity)
+    {
+        SimpleIDSet toRemove;
+        toRemove.insert(group.shapeID);
+        shapeManager->removeShapes(toRemove, changes);
+    }
+    group.shapeID = shapeManager->addShapes([self linearsForGroup:group bucket:bucket], group.desc, changes);
+}
+
+// Called when the viewer moves enough to care about
+- (void)viewUpdate:(WhirlyKitViewState *)viewState
+{
+    int bucket = [self bucketForViewState:viewState];
+    if (bucket == curBucket)
+        return;
+    curBucket = bucket;
+
+    // Resample everything for the new bucket
+    ChangeSet changes;
+    for (GreatCircleGroup *group in [groups allValues])
+        [self updateGroup:group bucket:bucket changes:changes];
+
+    [layerThread addChangeRequests:changes];
+}
+
+// Add a group of great circles
+- (SimpleIdentity)addGreatCircles:(NSArray *)circles desc:(NSDictionary *)desc
+{
+    if (!layerThread || !scene || [NSThread currentThread] != layerThread)
+    {
+        NSLog(@"GreatCircleLayer: Tried to call layer before it was initialized or in wrong thread.  Dropping circles on floor.");
+        return EmptyIdentity;
+    }
+
+    GreatCircleGroup *group = [[GreatCircleGroup alloc] init];
+    group.circles = circles;
+    group.desc = desc;
+
+    ChangeSet changes;
+    [self updateGroup:group bucket:curBucket changes:changes];
+    groups[@(group.groupId)] = group;
+
+    [layerThread addChangeRequests:changes];
+
+    return group.groupId;
+}
+
+// Remove a group of great circles
+- (void)removeGreatCircles:(WhirlyKit::SimpleIdentity)circleID
+{
+    if (!layerThread || !scene || [NSThread currentThread] != layerThread)
+    {
+        NSLog(@"GreatCircleLayer: Tried to call layer before it was initialized or in wrong thread.  Dropping remove on floor.");
+        return;
+    }
+
+    GreatCircleGroup *group = groups[@(circleID)];
+    if (!group)
+        return;
+
+    ChangeSet changes;
+    ShapeManager *shapeManager = (ShapeManager *)scene->getManager(kWKShapeManager);
+    if (shapeManager && group.shapeID != EmptyIdentity)
+    {
+        SimpleIDSet toRemove;
+        toRemove.insert(group.shapeID);
+        shapeManager->removeShapes(toRemove, changes);
+    }
+    [groups removeObjectForKey:@(circleID)];
+
+    [layerThread addChangeRequests:changes];
+}
+
+@end
@@ -77,47 +77,92 @@ bool ClipLoopToMbr(const VectorRing &ring,const Mbr &mbr, const bool closed,std:
     return true;
 }
 
+// One Sutherland-Hodgman pass against a single axis aligned edge.
+// Inside is where sign*(coord-bound) <= 0.  Kept flat and branch-light
+//  so the compiler can vectorize the distance tests.
+static void ClipEdge(const VectorRing &inPts,VectorRing &outPts,int axis,float bound,float sign)
+{
+    outPts.clear();
+    unsigned int numPts = (unsigned int)inPts.size();
+    if (numPts == 0)
+        return;
+
+    const Point2f *pts = &inPts[0];
+    Point2f p0 = pts[numPts-1];
+    float d0 = sign * (p0[axis] - bound);
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        const Point2f &p1 = pts[ii];
+        float d1 = sign * (p1[axis] - bound);
+        if (d1 <= 0.0)
+        {
+            // Crossing in:  add the intersection first
+            if (d0 > 0.0)
+                outPts.push_back(p0 + (d0/(d0-d1))*(p1-p0));
+            outPts.push_back(p1);
+        } else if (d0 <= 0.0)
+        {
+            // Crossing out
+            outPts.push_back(p0 + (d0/(d0-d1))*(p1-p0));
+        }
+        p0 = p1;
+        d0 = d1;
+    }
+}
+
+bool ClipLoopToMbrFast(const VectorRing &ring,const Mbr &mbr,ClipWorkspace &ws,VectorRing &ret)
+{
+    ret.clear();
+    if (ring.size() < 3)
+        return false;
+
+    ClipEdge(ring,ws.scratchA,0,mbr.ll().x(),-1.0);
+    ClipEdge(ws.scratchA,ws.scratchB,0,mbr.ur().x(),1.0);
+    ClipEdge(ws.scratchB,ws.scratchA,1,mbr.ll().y(),-1.0);
+    ClipEdge(ws.scratchA,ret,1,mbr.ur().y(),1.0);
+
+    return ret.size() > 2;
+}
+
 // Clip the given loop to the given grid (org and spacing)
 // Return true on success and the new polygons in the rets
-// Note: Not deeply efficient
 bool ClipLoopToGrid(const VectorRing &ring,Point2f org,Point2f spacing,std::vector<VectorRing> &rets)
 {
+    if (ring.size() < 3)
+        return false;
     Mbr mbr(ring);
-    int startRet = (int)(rets.size());
-    
+
     int ll_ix = (int)std::floor((mbr.ll().x()-org.x())/spacing.x());
     int ll_iy = (int)std::floor((mbr.ll().y()-org.y())/spacing.y());
     int ur_ix = (int)std::ceil((mbr.ur().x()-org.x())/spacing.x());
     int ur_iy = (int)std::ceil((mbr.ur().y()-org.y())/spacing.y());
-    
-    // Clip in strips from left to right
+
+    ClipWorkspace ws;
+    VectorRing strip,cell;
+    ws.scratchA.reserve(ring.size()+8);
+    ws.scratchB.reserve(ring.size()+8);
+    strip.reserve(ring.size()+8);
+
+    // Clip in strips from left to right.  Each strip only needs the two
+    //  x edges, then each cell within it just the two y edges, so a cell
+    //  costs four edge passes total and no allocations.
     for (int ix=ll_ix;ix<=ur_ix;ix++)
     {
-        Point2f l0(ix*spacing.x()+org.x(),mbr.ll().y());
-        Point2f l1((ix+1)*spacing.x()+org.x(),mbr.ur().y());
-        Mbr left(l0,l1);
-        
-        std::vector<VectorRing> leftStrip;
-        ClipLoopToMbr(ring,left, true, leftStrip);
-        
-        // Now clip the left strip vertically
+        ClipEdge(ring,ws.scratchA,0,ix*spacing.x()+org.x(),-1.0);
+        ClipEdge(ws.scratchA,strip,0,(ix+1)*spacing.x()+org.x(),1.0);
+        if (strip.size() < 3)
+            continue;
+
+        // Now clip the strip vertically
         for (int iy=ll_iy;iy<=ur_iy;iy++)
         {
-            
-            Point2f b0(mbr.ll().x(),iy*spacing.y()+org.y());
-            Point2f b1(mbr.ur().x(),(iy+1)*spacing.y()+org.y());
-            Mbr bot(b0,b1);
-            for (unsigned int ic=0;ic<leftStrip.size();ic++)
-                ClipLoopToMbr(leftStrip[ic], bot, true, rets);
+            ClipEdge(strip,ws.scratchA,1,iy*spacing.y()+org.y(),-1.0);
+            ClipEdge(ws.scratchA,cell,1,(iy+1)*spacing.y()+org.y(),1.0);
+            if (cell.size() > 2)
+                rets.push_back(cell);
         }
     }
-    
-    for (unsigned int ii=startRet;ii<rets.size();ii++)
-    {
-        VectorRing &theRing = rets[ii];
-        std::reverse(theRing.begin(),theRing.end());
-    }
-    
+
     return true;
 }
 
@@ -25,14 +25,63 @@
 using namespace WhirlyKit;
 using namespace WhirlyGlobe;
 
+namespace WhirlyKit
+{
+
+// Number of grid cells a single band drawable covers on a side
+static const int GridBandCells = 16;
+
+// Range of viewer height buckets we'll pick a grid density for.
+// Bucket 0 is the old fixed 3 degree grid, each bucket down halves the cell size.
+static const int MinGridBucket = -6;
+static const int MaxGridBucket = 0;
+
+// Most bands we'll keep cached before we start throwing out the hidden ones
+static const unsigned int MaxGridBands = 256;
+
+// Identifies one cached band of grid lines at a given density
+class GridBand
+{
+public:
+    GridBand(int bucket,int bx,int by) : bucket(bucket), bx(bx), by(by) { }
+    bool operator < (const GridBand &that) const
+    {
+        if (bucket == that.bucket)
+        {
+            if (bx == that.bx)
+                return by < that.by;
+            return bx < that.bx;
+        }
+        return bucket < that.bucket;
+    }
+
+    int bucket,bx,by;
+};
+
+// What we've built for a band
+class GridBandInfo
+{
+public:
+    GridBandInfo() : drawID(EmptyIdentity), enabled(false) { }
+
+    SimpleIdentity drawID;
+    bool enabled;
+};
+
+typedef std::map<GridBand,GridBandInfo> GridBandMap;
+
+}
+
 @implementation WhirlyKitGridLayer
 {
     WhirlyKitLayerThread * __weak layerThread;
+    // Note: These used to drive incremental chunking of a global grid.
+    //       The bands under the viewer drive generation now.
     unsigned int numX,numY;
-    unsigned int chunkX,chunkY;
     WhirlyKit::Scene *scene;
-    
-    std::vector<WhirlyKit::SimpleIdentity> drawIDs;
+
+    // Bands we've built so far, some of them turned off
+    WhirlyKit::GridBandMap bands;
 }
 
 - (id)initWithX:(unsigned int)inNumX Y:(unsigned int)inNumY
@@ -42,62 +91,64 @@ using namespace WhirlyGlobe;
 		numX = inNumX;
 		numY = inNumY;
 	}
-	
+
 	return self;
 }
 
 - (void)startWithThread:(WhirlyKitLayerThread *)inLayerThread scene:(Scene *)inScene
 {
-	chunkX = 0;  chunkY = 0;
 	scene = inScene;
     layerThread = inLayerThread;
-	[self performSelector:@selector(process:) withObject:nil afterDelay:0.0];
+    [layerThread.viewWatcher addWatcherTarget:self selector:@selector(viewUpdate:) minTime:0.1 minDist:0.0 maxLagTime:0.0];
 }
 
 - (void)shutdown
 {
+    if (layerThread.viewWatcher)
+        [layerThread.viewWatcher removeWatcherTarget:self selector:@selector(viewUpdate:)];
+
     ChangeSet changeRequests;
-    for (unsigned int ii=0;ii<drawIDs.size();ii++)
-        changeRequests.push_back(new RemDrawableReq(drawIDs[ii]));
+    for (GridBandMap::iterator it = bands.begin();it != bands.end();++it)
+        changeRequests.push_back(new RemDrawableReq(it->second.drawID));
     [layerThread addChangeRequests:changeRequests];
-    
-    drawIDs.clear();
+
+    bands.clear();
     scene = NULL;
 }
 
-// Generate grid lines covering the earth model
-- (void)process:(id)sender
+// Generate the grid lines for a single band
+- (BasicDrawable *)buildBand:(GridBand)band cellSize:(float)cellSize
 {
     CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
-	GeoCoord geoIncr(2*M_PI/numX,M_PI/numY);
-	GeoCoord geoLL(-M_PI + chunkX*geoIncr.x(),-M_PI/2.0 + chunkY*geoIncr.y());
-	GeoMbr geoMbr(geoLL,geoLL+geoIncr);
-		
+
 	// Drawable containing just lines
 	// Note: Not deeply efficient here
 	BasicDrawable *drawable = new BasicDrawable("Grid Lines");
 	drawable->setType(GL_LINES);
-	
-	int startX = std::ceil(geoMbr.ll().x()/GridCellSize);
-	int endX = std::floor(geoMbr.ur().x()/GridCellSize);
-	int startY = std::ceil(geoMbr.ll().y()/GridCellSize);
-	int endY = std::floor(geoMbr.ur().y()/GridCellSize);
-	
+
+    int startX = band.bx*GridBandCells,endX = (band.bx+1)*GridBandCells-1;
+    int startY = band.by*GridBandCells,endY = (band.by+1)*GridBandCells-1;
+    // Clamp to the extents of the earth
+    startX = std::max(startX,(int)std::ceil(-M_PI/cellSize));
+    endX = std::min(endX,(int)std::floor(M_PI/cellSize));
+    startY = std::max(startY,(int)std::ceil(-M_PI/2.0/cellSize));
+    endY = std::min(endY,(int)std::floor(M_PI/2.0/cellSize));
+
 	for (int x = startX;x <= endX; x++)
 		for (int y = startY;y <= endY; y++)
 		{
 			// Start out with the points in 3-space
 			// Note: Duplicating work
 			Point3f norms[4],pts[4];
-			norms[0] = coordAdapter->localToDisplay(Point3f(x*GridCellSize,y*GridCellSize,0.0));
-			norms[1] = coordAdapter->localToDisplay(Point3f((x+1)*GridCellSize,y*GridCellSize,0.0));
-			norms[2] = coordAdapter->localToDisplay(Point3f((x+1)*GridCellSize,GridCellSize*(y+1),0.0));
-			norms[3] = coordAdapter->localToDisplay(Point3f(GridCellSize*x,GridCellSize*(y+1),0.0));
-			
+			norms[0] = coordAdapter->localToDisplay(Point3f(x*cellSize,y*cellSize,0.0));
+			norms[1] = coordAdapter->localToDisplay(Point3f((x+1)*cellSize,y*cellSize,0.0));
+			norms[2] = coordAdapter->localToDisplay(Point3f((x+1)*cellSize,cellSize*(y+1),0.0));
+			norms[3] = coordAdapter->localToDisplay(Point3f(cellSize*x,cellSize*(y+1),0.0));
+
 			// Nudge them out a little bit
 			for (unsigned int ii=0;ii<4;ii++)
 				pts[ii] = norms[ii] * (1.0 + GlobeLineOffset);
-			
+
 			// Add to drawable
 			drawable->addPoint(pts[0]);
 			drawable->addNormal(norms[0]);
@@ -107,22 +158,98 @@ using namespace WhirlyGlobe;
 			drawable->addNormal(norms[0]);
 			drawable->addPoint(pts[3]);
 			drawable->addNormal(norms[3]);
-			
+
 		}
-	
-	[layerThread addChangeRequest:(new AddDrawableReq(drawable))];
-    drawIDs.push_back(drawable->getId());
-	
-	// Move on to the next chunk
-	if (++chunkX >= numX)
-	{
-		chunkX = 0;
-		chunkY++;
-	}
-	
-	// Schedule the next chunk
-	if (chunkY < numY)
-		[self performSelector:@selector(process:) withObject:nil afterDelay:0.0];	
+
+    return drawable;
+}
+
+// Figure out which bands the viewer can see and make sure they're built
+- (void)viewUpdate:(WhirlyKitViewState *)viewState
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+
+    // Viewer height and the point under the viewer
+    Point3d eyePos = viewState.eyePos;
+    double height;
+    Point3d surfPt;
+    if (coordAdapter->isFlat())
+    {
+        height = eyePos.z();
+        surfPt = Point3d(eyePos.x(),eyePos.y(),0.0);
+    } else {
+        height = eyePos.norm()-1.0;
+        surfPt = eyePos.normalized();
+    }
+    if (height <= 0.0)
+        return;
+
+    // Pick a grid density for the height
+    int bucket = std::ceil(log2(height));
+    bucket = std::min(std::max(bucket,MinGridBucket),MaxGridBucket);
+    float cellSize = GridCellSize * powf(2.0,bucket);
+    float bandSize = GridBandCells * cellSize;
+
+    // Rough footprint of what the viewer can see
+    Point3f localPt = coordAdapter->displayToLocal(Point3f(surfPt.x(),surfPt.y(),surfPt.z()));
+    float radius = std::min(2.0*height,(double)M_PI);
+    int bandX0 = std::floor((localPt.x()-radius)/bandSize),bandX1 = std::floor((localPt.x()+radius)/bandSize);
+    int bandY0 = std::floor((localPt.y()-radius)/bandSize),bandY1 = std::floor((localPt.y()+radius)/bandSize);
+    bandX0 = std::max(bandX0,(int)std::floor(-M_PI/bandSize));
+    bandX1 = std::min(bandX1,(int)std::floor(M_PI/bandSize));
+    bandY0 = std::max(bandY0,(int)std::floor(-M_PI/2.0/bandSize));
+    bandY1 = std::min(bandY1,(int)std::floor(M_PI/2.0/bandSize));
+
+    ChangeSet changes;
+
+    // Build anything we're missing and turn on what we can see
+    std::set<GridBand> visBands;
+    for (int bx = bandX0;bx <= bandX1;bx++)
+        for (int by = bandY0;by <= bandY1;by++)
+        {
+            GridBand band(bucket,bx,by);
+            visBands.insert(band);
+            GridBandMap::iterator it = bands.find(band);
+            if (it == bands.end())
+            {
+                BasicDrawable *drawable = [self buildBand:band cellSize:cellSize];
+                GridBandInfo bandInfo;
+                bandInfo.drawID = drawable->getId();
+                bandInfo.enabled = true;
+                bands[band] = bandInfo;
+                changes.push_back(new AddDrawableReq(drawable));
+            } else if (!it->second.enabled)
+            {
+                it->second.enabled = true;
+                changes.push_back(new OnOffChangeRequest(it->second.drawID,true));
+            }
+        }
+
+    // Turn off everything else
+    for (GridBandMap::iterator it = bands.begin();it != bands.end();++it)
+        if (it->second.enabled && visBands.find(it->first) == visBands.end())
+        {
+            it->second.enabled = false;
+            changes.push_back(new OnOffChangeRequest(it->second.drawID,false));
+        }
+
+    // If the cache has gotten too big, throw out hidden bands
+    if (bands.size() > MaxGridBands)
+    {
+        GridBandMap::iterator it = bands.begin();
+        while (it != bands.end() && bands.size() > MaxGridBands)
+        {
+            GridBandMap::iterator next = it;  ++next;
+            if (!it->second.enabled)
+            {
+                changes.push_back(new RemDrawableReq(it->second.drawID));
+                bands.erase(it);
+            }
+            it = next;
+        }
+    }
+
+    [layerThread addChangeRequests:changes];
 }
 
 @end
@@ -25,14 +25,16 @@ namespace WhirlyKit
 	
 static unsigned long curId = 0;
 
+// Note: IDs get generated on multiple threads these days, so keep the counter atomic
+
 Identifiable::Identifiable()
-{ 
-	myId = ++curId; 
+{
+	myId = __sync_add_and_fetch(&curId, 1);
 }
-	
+
 SimpleIdentity Identifiable::genId()
 {
-	return ++curId;
+	return __sync_add_and_fetch(&curId, 1);
 }
 
 }
@@ -222,8 +222,13 @@ LabelManager::~LabelManager()
     
 SimpleIdentity LabelManager::addLabels(NSArray *labels,NSDictionary *desc,ChangeSet &changes)
 {
-    WhirlyKitLabelInfo *labelInfo = [[WhirlyKitLabelInfo alloc] initWithStrs:labels desc:desc];
-    
+    WhirlyKitLabelInfo *labelInfo = [[WhirlyKitLabelInfo alloc] initWithStrs:nil desc:desc];
+
+    return addLabels(labels,labelInfo,changes);
+}
+
+SimpleIdentity LabelManager::addLabels(NSArray *labels,WhirlyKitLabelInfo *labelInfo,ChangeSet &changes)
+{
     // Set up the representation (but then hand it off)
     LabelSceneRep *labelRep = new LabelSceneRep();
     labelRep->fade = labelInfo.fade;
@@ -235,6 +240,7 @@ SimpleIdentity LabelManager::addLabels(NSArray *labels,NSDictionary *desc,Change
     // Set up the label renderer
     WhirlyKitLabelRenderer *labelRenderer = [[WhirlyKitLabelRenderer alloc] init];
     labelRenderer.labelInfo = labelInfo;
+    labelRenderer.strs = labels;
     labelRenderer.textureAtlasSize = textureAtlasSize;
     labelRenderer.coordAdapter = scene->getCoordAdapter();
     labelRenderer.labelRep = labelRep;
@@ -366,9 +372,7 @@ void LabelManager::removeLabels(SimpleIDSet &labelIDs,ChangeSet &changes)
             if (labelRep->fade > 0.0)
             {
                 NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
-                for (SimpleIDSet::iterator idIt = labelRep->drawIDs.begin();
-                     idIt != labelRep->drawIDs.end(); ++idIt)
-                    changes.push_back(new FadeChangeRequest(*idIt,curTime,curTime+labelRep->fade));
+                changes.push_back(new FadeGangChangeRequest(labelRep->drawIDs,curTime,curTime+labelRep->fade));
                 
                 for (SimpleIDSet::iterator idIt = labelRep->screenIDs.begin();
                      idIt != labelRep->screenIDs.end(); ++idIt)
@@ -418,4 +422,21 @@ void LabelManager::removeLabels(SimpleIDSet &labelIDs,ChangeSet &changes)
     pthread_mutex_unlock(&labelLock);
 }
 
+void LabelManager::memoryCensus(MemoryCensusEntry &entry)
+{
+    pthread_mutex_lock(&labelLock);
+
+    entry.count = labelReps.size();
+    for (LabelSceneRepSet::iterator it = labelReps.begin();
+         it != labelReps.end(); ++it)
+    {
+        LabelSceneRep *labelRep = *it;
+        entry.bytes += sizeof(LabelSceneRep) +
+            (labelRep->drawIDs.size() + labelRep->texIDs.size() +
+             labelRep->drawStrIDs.size() + labelRep->screenIDs.size()) * sizeof(SimpleIdentity);
+    }
+
+    pthread_mutex_unlock(&labelLock);
+}
+
 }
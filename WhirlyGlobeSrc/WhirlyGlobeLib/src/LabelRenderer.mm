@@ -233,28 +233,60 @@ public:
 
 typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
 
+// Output one worker builds up during the parallel font render.
+// We merge these when all the workers are done.
+class LabelRenderResults
+{
+public:
+    LabelRenderResults() : selectID(EmptyIdentity) { }
+
+    ChangeSet changes;
+    std::vector<ScreenSpaceGenerator::ConvexShape *> screenObjects;
+    std::vector<WhirlyKit::LayoutObject> layoutObjects;
+    std::vector<WhirlyKit::RectSelectable2D> selectables2D;
+    SimpleIDSet drawStrIDs,screenIDs;
+    SimpleIdentity selectID;
+};
+
 - (void)renderWithFonts
 {
     NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
 
-    // Screen space objects to create
-    std::vector<ScreenSpaceGenerator::ConvexShape *> screenObjects;
-    
-    // Drawables used for the icons
-    IconDrawables iconDrawables;
-    
-    // Drawables we build up as we go
-    DrawableIDMap drawables;
+    NSArray *strs = _strs;
+    size_t numLabels = [strs count];
+    if (numLabels == 0)
+        return;
+
+    // Quad generation and the glyph rendering underneath it are the
+    //  expensive part, and the font texture manager can handle concurrent
+    //  callers, so we spread the labels over a few workers.  Each worker
+    //  strides through the batch with its own output.
+    size_t numWorkers = [[NSProcessInfo processInfo] processorCount];
+    if (numWorkers > numLabels)
+        numWorkers = numLabels;
 
-    for (WhirlyKitSingleLabel *label in _labelInfo.strs)
+    std::vector<LabelRenderResults> results(numWorkers);
+    LabelRenderResults *resultPtr = &results[0];
+    WhirlyKitLabelInfo *labelInfo = _labelInfo;
+    WhirlyKitFontTextureManager *fontTexManager = _fontTexManager;
+    WhirlyKit::LabelSceneRep *labelRep = _labelRep;
+    CoordSystemDisplayAdapter *coordAdapter = _coordAdapter;
+    Scene *scene = _scene;
+
+    dispatch_apply(numWorkers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+    ^(size_t worker)
+    {
+    LabelRenderResults &result = resultPtr[worker];
+    for (size_t li=worker;li<numLabels;li+=numWorkers)
     {
-        UIColor *theTextColor = _labelInfo.textColor;
-        UIColor *theBackColor = _labelInfo.backColor;
-        UIFont *theFont = _labelInfo.font;
-        UIColor *theShadowColor = _labelInfo.shadowColor;
-        float theShadowSize = _labelInfo.shadowSize;
-        UIColor *theOutlineColor = _labelInfo.outlineColor;
-        float theOutlineSize = _labelInfo.outlineSize;
+        WhirlyKitSingleLabel *label = [strs objectAtIndex:li];
+        UIColor *theTextColor = labelInfo.textColor;
+        UIColor *theBackColor = labelInfo.backColor;
+        UIFont *theFont = labelInfo.font;
+        UIColor *theShadowColor = labelInfo.shadowColor;
+        float theShadowSize = labelInfo.shadowSize;
+        UIColor *theOutlineColor = labelInfo.outlineColor;
+        float theOutlineSize = labelInfo.outlineSize;
         if (label.desc)
         {
             theTextColor = [label.desc objectForKey:@"textColor" checkType:[UIColor class] default:theTextColor];
@@ -269,7 +301,7 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
             theShadowColor = [UIColor blackColor];
         if (theOutlineColor == nil)
             theOutlineColor = [UIColor blackColor];
-        
+
         // We set this if the color is embedded in the "font"
         bool embeddedColor = false;
 
@@ -288,13 +320,13 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
         ScreenSpaceGenerator::ConvexShape *screenShape = NULL;
         if (attrStr && strLen > 0)
         {
-            DrawableString *drawStr = [_fontTexManager addString:attrStr changes:_changeRequests];
+            DrawableString *drawStr = [fontTexManager addString:attrStr changes:result.changes];
             if (drawStr)
             {
-                _labelRep->drawStrIDs.insert(drawStr->getId());
+                result.drawStrIDs.insert(drawStr->getId());
 
                 Point2d justifyOff(0,0);
-                switch (_labelInfo.justify)
+                switch (labelInfo.justify)
                 {
                     case WhirlyKitLabelLeft:
                         justifyOff = Point2d(0,0);
@@ -306,20 +338,20 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
                         justifyOff = Point2d(-(drawStr->mbr.ur().x()-drawStr->mbr.ll().x()),0.0);
                         break;
                 }
-                
-                if (_labelInfo.screenObject)
+
+                if (labelInfo.screenObject)
                 {
                     // Set if we're letting the layout engine control placement
-                    bool layoutEngine = (_labelInfo.layoutEngine || [label.desc boolForKey:@"layout" default:false]);
-                    
+                    bool layoutEngine = (labelInfo.layoutEngine || [label.desc boolForKey:@"layout" default:false]);
+
                     // If we're doing layout, don't justify it
                     if (layoutEngine)
                         justifyOff = Point2d(0,0);
-                    
+
                     screenShape = new ScreenSpaceGenerator::ConvexShape();
-                    screenShape->drawPriority = _labelInfo.drawPriority;
-                    screenShape->minVis = _labelInfo.minVis;
-                    screenShape->maxVis = _labelInfo.maxVis;
+                    screenShape->drawPriority = labelInfo.drawPriority;
+                    screenShape->minVis = labelInfo.minVis;
+                    screenShape->maxVis = labelInfo.maxVis;
                     screenShape->offset.x() = 0.0;
                     screenShape->offset.y() = 0.0;
                     screenShape->keepUpright = label.keepUpright;
@@ -328,21 +360,21 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
                         screenShape->useRotation = true;
                         screenShape->rotation = label.rotation;
                     }
-                    if (_labelInfo.fade > 0.0)
+                    if (labelInfo.fade > 0.0)
                     {
                         screenShape->fadeDown = curTime;
-                        screenShape->fadeUp = curTime+_labelInfo.fade;
+                        screenShape->fadeUp = curTime+labelInfo.fade;
                     }
                     if (label.isSelectable && label.selectID != EmptyIdentity)
                         screenShape->setId(label.selectID);
-                    _labelRep->screenIDs.insert(screenShape->getId());
-                    screenShape->worldLoc = _coordAdapter->localToDisplay(_coordAdapter->getCoordSystem()->geographicToLocal3d(label.loc));
+                    result.screenIDs.insert(screenShape->getId());
+                    screenShape->worldLoc = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal3d(label.loc));
 
                     // If there's an icon, we need to offset
                     float height = drawStr->mbr.ur().y()-drawStr->mbr.ll().y();
                     Point2d iconSize = (label.iconTexture==EmptyIdentity ? Point2d(0,0) : (label.iconSize.width == 0.0 ? Point2d(height,height) : Point2d(label.iconSize.width,label.iconSize.height)));
                     iconOff = iconSize;
-                    
+
                     // Throw a rectangle in the background
                     RGBAColor backColor = [theBackColor asRGBAColor];
                     if (backColor.a != 0.0)
@@ -353,7 +385,7 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
                         Point2d ll = Point2d(drawStr->mbr.ll().x(),drawStr->mbr.ll().y())+iconOff+Point2d(-backBorder,-backBorder), ur = Point2d(drawStr->mbr.ur().x(),drawStr->mbr.ur().y())+iconOff+Point2d(backBorder,backBorder);
                         smGeom.coords.push_back(Point2d(ll.x()+label.screenOffset.width,-ll.y()+label.screenOffset.height)+justifyOff);
                         smGeom.texCoords.push_back(TexCoord(0,0));
-                       
+
                         smGeom.coords.push_back(Point2d(ll.x()+label.screenOffset.width,-ur.y()+label.screenOffset.height)+justifyOff);
                         smGeom.texCoords.push_back(TexCoord(1,0));
 
@@ -367,7 +399,7 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
                         // Note: This would be a great place for a texture
                         screenShape->geom.push_back(smGeom);
                     }
-                    
+
                     // Turn the glyph polys into simple geometry
                     // We do this in a weird order to stick the shadow underneath
                     for (int ss=((theShadowSize > 0.0) ? 0: 1);ss<2;ss++)
@@ -398,74 +430,75 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
 
                             smGeom.coords.push_back(Point2d(poly.pts[1].x()+label.screenOffset.width,-poly.pts[0].y()+label.screenOffset.height) + soff + iconOff + justifyOff);
                             smGeom.texCoords.push_back(TexCoord(poly.texCoords[1].u(),poly.texCoords[0].v()));
-                            
+
                             smGeom.texID = poly.subTex.texId;
                             smGeom.color = color;
                             poly.subTex.processTexCoords(smGeom.texCoords);
                             screenShape->geom.push_back(smGeom);
                         }
                     }
-                    
+
                     // If it's being passed to the layout engine, do that as well
                     if (layoutEngine)
                     {
-                        float layoutImportance = [label.desc floatForKey:@"layoutImportance" default:_labelInfo.layoutImportance];
+                        float layoutImportance = [label.desc floatForKey:@"layoutImportance" default:labelInfo.layoutImportance];
                         int layoutPlacement = [label.desc intForKey:@"layoutPlacement" default:(int)(WhirlyKitLayoutPlacementLeft | WhirlyKitLayoutPlacementRight | WhirlyKitLayoutPlacementAbove | WhirlyKitLayoutPlacementBelow)];
-                        
+
                         // Put together the layout info
                         WhirlyKit::LayoutObject layoutObj(screenShape->getId());
                         layoutObj.hint = label.text;
                         layoutObj.dispLoc = screenShape->worldLoc;
                         layoutObj.size = drawStr->mbr.ur() - drawStr->mbr.ll();
-                        
+
 //                        layoutObj->iconSize = Point2f(iconSize,iconSize);
                         layoutObj.importance = layoutImportance;
-                        layoutObj.minVis = _labelInfo.minVis;
-                        layoutObj.maxVis = _labelInfo.maxVis;
+                        layoutObj.minVis = labelInfo.minVis;
+                        layoutObj.maxVis = labelInfo.maxVis;
                         layoutObj.acceptablePlacement = layoutPlacement;
-                        layoutObj.enable = _labelInfo.enable;
+                        layoutObj.enable = labelInfo.enable;
                         layoutObj.rotation = label.rotation;
                         layoutObj.keepUpright = label.keepUpright;
-                        _layoutObjects.push_back(layoutObj);
-                        
+                        result.layoutObjects.push_back(layoutObj);
+
                         // The shape starts out disabled
-                        screenShape->enable = _labelInfo.enable;
+                        screenShape->enable = labelInfo.enable;
+                        screenShape->layout = true;
                         screenShape->offset = Point2d(MAXFLOAT,MAXFLOAT);
                     } else
-                        screenShape->enable = _labelInfo.enable;
-                    
+                        screenShape->enable = labelInfo.enable;
+
                     // Register the main label as selectable
                     if (label.isSelectable)
                     {
                         // If the label doesn't already have an ID, it needs one
                         if (!label.selectID)
                             label.selectID = Identifiable::genId();
-                        
+
                         RectSelectable2D select2d;
-                        select2d.enable = _labelInfo.enable;
+                        select2d.enable = labelInfo.enable;
                         Point2f ll = drawStr->mbr.ll(), ur = drawStr->mbr.ur();
                         select2d.pts[0] = Point2f(ll.x(),-ll.y());
                         select2d.pts[1] = Point2f(ll.x(),-ur.y());
                         select2d.pts[2] = Point2f(ur.x(),-ur.y());
                         select2d.pts[3] = Point2f(ur.x(),-ll.y());
-                        
+
                         select2d.selectID = label.selectID;
-                        select2d.minVis = _labelInfo.minVis;
-                        select2d.maxVis = _labelInfo.maxVis;
-                        _selectables2D.push_back(select2d);
-                        _labelRep->selectID = label.selectID;
+                        select2d.minVis = labelInfo.minVis;
+                        select2d.maxVis = labelInfo.maxVis;
+                        result.selectables2D.push_back(select2d);
+                        result.selectID = label.selectID;
                     }
-                    
-                    screenObjects.push_back(screenShape);
+
+                    result.screenObjects.push_back(screenShape);
                 }
-            
+
                 delete drawStr;
             }
         }
-        
+
         if (label.iconTexture != EmptyIdentity && screenShape)
         {
-            SubTexture subTex = _scene->getSubTexture(label.iconTexture);
+            SubTexture subTex = scene->getSubTexture(label.iconTexture);
             std::vector<TexCoord> texCoord;
             texCoord.resize(4);
             texCoord[0].u() = 0.0;  texCoord[0].v() = 0.0;
@@ -502,33 +535,30 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
 //            } else {
                 screenShape->geom.push_back(iconGeom);
 //            }
-            
+
         }
     }
-    
-    // Flush out any drawables we created for the labels
-    for (DrawableIDMap::iterator it = drawables.begin(); it != drawables.end(); ++it)
-        _changeRequests.push_back(new AddDrawableReq(it->second));
+    });
 
-    // Flush out the icon drawables as well
-    for (IconDrawables::iterator it = iconDrawables.begin();
-         it != iconDrawables.end(); ++it)
+    // Merge the workers' output back together
+    std::vector<ScreenSpaceGenerator::ConvexShape *> screenObjects;
+    for (unsigned int ii=0;ii<numWorkers;ii++)
     {
-        BasicDrawable *iconDrawable = it->second;
-        
-        if (_labelInfo.fade > 0.0)
-        {
-            NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
-            iconDrawable->setFade(curTime,curTime+_labelInfo.fade);
-        }
-        _changeRequests.push_back(new AddDrawableReq(iconDrawable));
-        _labelRep->drawIDs.insert(iconDrawable->getId());
+        LabelRenderResults &result = results[ii];
+        _changeRequests.insert(_changeRequests.end(),result.changes.begin(),result.changes.end());
+        screenObjects.insert(screenObjects.end(),result.screenObjects.begin(),result.screenObjects.end());
+        _layoutObjects.insert(_layoutObjects.end(),result.layoutObjects.begin(),result.layoutObjects.end());
+        _selectables2D.insert(_selectables2D.end(),result.selectables2D.begin(),result.selectables2D.end());
+        labelRep->drawStrIDs.insert(result.drawStrIDs.begin(),result.drawStrIDs.end());
+        labelRep->screenIDs.insert(result.screenIDs.begin(),result.screenIDs.end());
+        if (result.selectID != EmptyIdentity)
+            labelRep->selectID = result.selectID;
     }
-    
+
     SimpleIdentity screenGenId = _scene->getScreenSpaceGeneratorID();
-    
+
     // Send the screen objects to the generator
-    _changeRequests.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,screenObjects));
+    _changeRequests.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,std::move(screenObjects)));
 }
 
 - (void)renderWithImages
@@ -547,13 +577,13 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
     
     // Let's only bother for more than one label and if we're not using
     //  the font manager
-    bool texAtlasOn = [_labelInfo.strs count] > 1 && (_fontTexManager == nil);
+    bool texAtlasOn = [_strs count] > 1 && (_fontTexManager == nil);
     
     // Keep track of images rendered from text
     std::map<std::string,RenderedImage> renderedImages;
     
     // Work through the labels
-    for (WhirlyKitSingleLabel *label in _labelInfo.strs)
+    for (WhirlyKitSingleLabel *label in _strs)
     {
         TexCoord texOrg,texDest;
         CGSize textSize;
@@ -735,6 +765,7 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
                 
                 // The shape starts out disabled
                 screenShape->enable = _labelInfo.enable;
+                screenShape->layout = true;
                 screenShape->offset = Point2d(MAXFLOAT,MAXFLOAT);
             } else
                 screenShape->enable = _labelInfo.enable;
@@ -943,7 +974,7 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableIDMap;
         SimpleIdentity screenGenId = _scene->getScreenSpaceGeneratorID();
         
         // Send the screen objects to the generator
-        _changeRequests.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,screenObjects));
+        _changeRequests.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,std::move(screenObjects)));
     }
 }
 
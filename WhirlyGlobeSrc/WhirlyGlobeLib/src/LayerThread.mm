@@ -24,9 +24,86 @@
 #import "GlobeScene.h"
 #import "MaplyScene.h"
 #import "GlobeView.h"
+#import "SceneSnapshot.h"
 
 using namespace WhirlyKit;
 
+namespace WhirlyKit
+{
+
+ScratchArena::ScratchArena(size_t blockSize)
+    : blockSize(blockSize), curBlock(-1), curPos(0)
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+    for (unsigned int ii=0;ii<blocks.size();ii++)
+        free(blocks[ii].data);
+    for (unsigned int ii=0;ii<bigBlocks.size();ii++)
+        free(bigBlocks[ii].data);
+}
+
+void *ScratchArena::alloc(size_t size)
+{
+    // Keep everything aligned the way malloc would
+    size = (size + 15) & ~(size_t)15;
+
+    // Anything bigger than a block gets its own and goes away on reset
+    if (size > blockSize)
+    {
+        Block block;
+        block.data = (unsigned char *)malloc(size);
+        block.size = size;
+        bigBlocks.push_back(block);
+        return block.data;
+    }
+
+    if (curBlock < 0 || curPos + size > blocks[curBlock].size)
+    {
+        curBlock++;
+        if (curBlock >= (int)blocks.size())
+        {
+            Block block;
+            block.data = (unsigned char *)malloc(blockSize);
+            block.size = blockSize;
+            blocks.push_back(block);
+        }
+        curPos = 0;
+    }
+
+    void *ret = blocks[curBlock].data + curPos;
+    curPos += size;
+    return ret;
+}
+
+void ScratchArena::reset()
+{
+    for (unsigned int ii=0;ii<bigBlocks.size();ii++)
+        free(bigBlocks[ii].data);
+    bigBlocks.clear();
+    curBlock = (blocks.empty() ? -1 : 0);
+    curPos = 0;
+}
+
+size_t ScratchArena::totalSize()
+{
+    size_t total = 0;
+    for (unsigned int ii=0;ii<blocks.size();ii++)
+        total += blocks[ii].size;
+    for (unsigned int ii=0;ii<bigBlocks.size();ii++)
+        total += bigBlocks[ii].size;
+    return total;
+}
+
+}
+
+// When the scene's change queue backs up past this, the layer threads
+//  hold their merges back a beat instead of piling on
+static const int ChangeQueueBackoffDepth = 10000;
+// How long to hold a merge back when the render thread is buried
+static const NSTimeInterval ChangeQueueBackoffDelay = 0.05;
+
 @implementation WhirlyKitLayerThread
 {
     WhirlyKitGLSetupInfo *glSetupInfo;
@@ -44,7 +121,10 @@ using namespace WhirlyKit;
     
     /// Change requests to merge soonish
     std::vector<WhirlyKit::ChangeRequest *> changeRequests;
-    
+
+    /// Change requests headed for the scene's warm up queue
+    std::vector<WhirlyKit::ChangeRequest *> preheatChangeRequests;
+
     /// We can get change requests from other threads (!)
     pthread_mutex_t changeLock;
     
@@ -53,11 +133,23 @@ using namespace WhirlyKit;
     pthread_mutex_t existenceLock;
 }
 
++ (dispatch_queue_t)sharedWorkQueue
+{
+    static dispatch_queue_t sharedWorkQueue = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedWorkQueue = dispatch_queue_create("WhirlyKit Layer Work", DISPATCH_QUEUE_CONCURRENT);
+    });
+
+    return sharedWorkQueue;
+}
+
 - (id)initWithScene:(WhirlyKit::Scene *)inScene view:(WhirlyKitView *)inView renderer:(WhirlyKitSceneRendererES *)inRenderer mainLayerThread:(bool)mainLayerThread
 {
 	if ((self = [super init]))
 	{
         _mainLayerThread = mainLayerThread;
+        _teardownScene = true;
 		_scene = inScene;
         _renderer = inRenderer;
 		layers = [NSMutableArray array];
@@ -78,6 +170,8 @@ using namespace WhirlyKit;
         glSetupInfo->minZres = [inView calcZbufferRes];
         _allowFlush = true;
         
+        _scratchArena = new ScratchArena();
+
         pthread_mutex_init(&changeLock,NULL);
         pthread_mutex_init(&existenceLock,NULL);
 	}
@@ -87,6 +181,11 @@ using namespace WhirlyKit;
 
 - (void)dealloc
 {
+    if (_scratchArena)
+    {
+        delete _scratchArena;
+        _scratchArena = NULL;
+    }
     pthread_mutex_destroy(&changeLock);
     pthread_mutex_destroy(&existenceLock);
     // Note: It's not clear why we'd do this here.
@@ -110,7 +209,10 @@ using namespace WhirlyKit;
 
 - (void)removeLayer:(NSObject<WhirlyKitLayer> *)layer
 {
-    [self performSelector: @selector(removeLayerThread:) onThread: self withObject:layer waitUntilDone:YES];
+    // Don't wait around for it.  The layer drops its scene resources
+    //  on this thread behind the caller, who is usually the main
+    //  thread navigating away from the map.
+    [self performSelector: @selector(removeLayerThread:) onThread: self withObject:layer waitUntilDone:NO];
 }
 
 // This runs in the layer thread
@@ -153,21 +255,36 @@ using namespace WhirlyKit;
     pthread_mutex_lock(&changeLock);
 
     // If we don't have one coming, schedule a merge
-    if (changeRequests.empty())
+    if (changeRequests.empty() && preheatChangeRequests.empty())
         [self performSelector:@selector(runAddChangeRequests) onThread:self withObject:nil waitUntilDone:NO];
-    
+
     changeRequests.insert(changeRequests.end(), newChangeRequests.begin(), newChangeRequests.end());
-    
+
+    pthread_mutex_unlock(&changeLock);
+}
+
+- (void)addPreheatChangeRequests:(std::vector<WhirlyKit::ChangeRequest *> &)newChangeRequests
+{
+    pthread_mutex_lock(&changeLock);
+
+    // If we don't have one coming, schedule a merge
+    if (changeRequests.empty() && preheatChangeRequests.empty())
+        [self performSelector:@selector(runAddChangeRequests) onThread:self withObject:nil waitUntilDone:NO];
+
+    preheatChangeRequests.insert(preheatChangeRequests.end(), newChangeRequests.begin(), newChangeRequests.end());
+
     pthread_mutex_unlock(&changeLock);
 }
 
 - (void)flushChangeRequests
 {
     pthread_mutex_lock(&changeLock);
-    
-    [self runAddChangeRequests];
+
+    // A flush pushes no matter how deep the other side is.  The layer
+    //  asking for one may be shutting down and these have to make it.
+    [self pushChangeRequests];
     [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(runAddChangeRequests) object:nil];
-    
+
     pthread_mutex_unlock(&changeLock);
 }
 
@@ -177,18 +294,38 @@ using namespace WhirlyKit;
 }
 
 - (void)runAddChangeRequests
+{
+    // If the render thread is already buried, hold this batch back a
+    //  beat.  The work queued behind us on this thread waits with it,
+    //  which is the backpressure we want during a load burst.
+    if (_scene->changeQueueDepth() > ChangeQueueBackoffDepth)
+    {
+        [self performSelector:@selector(runAddChangeRequests) withObject:nil afterDelay:ChangeQueueBackoffDelay];
+        return;
+    }
+
+    [self pushChangeRequests];
+}
+
+// Set the changes up in our GL context and hand them over to the scene
+- (void)pushChangeRequests
 {
     [EAGLContext setCurrentContext:_glContext];
 
     bool requiresFlush = false;
     // Set up anything that needs to be set up
     ChangeSet changesToAdd;
+    // If a scene snapshot is being written, it gets to look at the adds
+    //  here, while the CPU side data is still around
+    SceneSnapshotWriter *snapWriter = _scene->getSnapshotWriter();
     for (unsigned int ii=0;ii<changeRequests.size();ii++)
     {
         ChangeRequest *change = changeRequests[ii];
         if (change)
         {
             requiresFlush |= change->needsFlush();
+            if (snapWriter)
+                snapWriter->captureChange(_scene, change);
             change->setupGL(glSetupInfo, _scene->getMemManager());
             changesToAdd.push_back(changeRequests[ii]);
         } else
@@ -204,6 +341,28 @@ using namespace WhirlyKit;
     
     _scene->addChangeRequests(changesToAdd);
     changeRequests.clear();
+
+    // Same deal for the warm up changes, they just land in a
+    //  different queue on the other side
+    if (!preheatChangeRequests.empty())
+    {
+        ChangeSet preheatToAdd;
+        for (unsigned int ii=0;ii<preheatChangeRequests.size();ii++)
+        {
+            ChangeRequest *change = preheatChangeRequests[ii];
+            if (change)
+            {
+                if (snapWriter)
+                    snapWriter->captureChange(_scene, change);
+                change->setupGL(glSetupInfo, _scene->getMemManager());
+                preheatToAdd.push_back(change);
+            }
+        }
+        if (_allowFlush)
+            glFlush();
+        _scene->addPreheatChangeRequests(preheatToAdd);
+        preheatChangeRequests.clear();
+    }
 }
 
 - (void)log
@@ -301,8 +460,11 @@ using namespace WhirlyKit;
             }
         }
 
-        // Tear the scene down.  It's unsafe to do it elsewhere
-        _scene->teardownGL();
+        // Tear the scene down.  It's unsafe to do it elsewhere.
+        // Unless the scene is another view's, in which case it's theirs
+        //  to tear down
+        if (_teardownScene)
+            _scene->teardownGL();
     }
     
     // Delete outstanding change requests
@@ -128,11 +128,31 @@ using namespace WhirlyKit;
     }
 }
 
+// Every layer thread's watcher hears about the same view changes, so
+//  the snapshot (and its pile of matrix inversions) gets built once
+//  per change and shared.  The states are immutable once built.
+static WhirlyKitViewState *sharedViewState = nil;
+static WhirlyKitView * __weak sharedViewStateView = nil;
+
+- (WhirlyKitViewState *)sharedViewStateForView:(WhirlyKitView *)inView
+{
+    @synchronized([WhirlyKitLayerViewWatcher class])
+    {
+        if (sharedViewState && sharedViewStateView == inView &&
+            sharedViewState.version == inView.viewStateVersion &&
+            [sharedViewState isMemberOfClass:_viewStateClass])
+            return sharedViewState;
+
+        WhirlyKitViewState *viewState = [[_viewStateClass alloc] initWithView:inView renderer:layerThread.renderer];
+        sharedViewState = viewState;
+        sharedViewStateView = inView;
+        return viewState;
+    }
+}
+
 // This is called in the main thread
 - (void)viewUpdated:(WhirlyKitView *)inView
 {
-    WhirlyKitViewState *viewState = [[_viewStateClass alloc] initWithView:inView renderer:layerThread.renderer];
-
     // The view has to be valid first
     if (layerThread.renderer.framebufferWidth <= 0.0)
     {
@@ -141,7 +161,9 @@ using namespace WhirlyKit;
         [self performSelector:@selector(viewUpdated:) withObject:inView afterDelay:0.1];
         return;
     }
-    
+
+    WhirlyKitViewState *viewState = [self sharedViewStateForView:inView];
+
 //    lastViewState = viewState;
     @synchronized(self)
     {
@@ -337,7 +359,8 @@ public:
     _ll.x() = _ur.x() = 0.0;
     
     _coordAdapter = view.coordAdapter;
-    
+    _version = view.viewStateVersion;
+
     return self;
 }
 
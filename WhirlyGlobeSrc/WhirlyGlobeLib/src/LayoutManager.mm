@@ -46,14 +46,8 @@ public:
         Mbr objMbr;
         for (unsigned int ii=0;ii<pts.size();ii++)
             objMbr.addPoint(pts[ii]);
-        int sx = floorf((objMbr.ll().x()-mbr.ll().x())/cellSize.x());
-        if (sx < 0) sx = 0;
-        int sy = floorf((objMbr.ll().y()-mbr.ll().y())/cellSize.y());
-        if (sy < 0) sy = 0;
-        int ex = ceilf((objMbr.ur().x()-mbr.ll().x())/cellSize.x());
-        if (ex >= sizeX)  ex = sizeX-1;
-        int ey = ceilf((objMbr.ur().y()-mbr.ll().y())/cellSize.y());
-        if (ey >= sizeY)  ey = sizeY-1;
+        int sx,sy,ex,ey;
+        calcCells(objMbr,sx,sy,ex,ey);
         for (int ix=sx;ix<=ex;ix++)
             for (int iy=sy;iy<=ey;iy++)
             {
@@ -66,8 +60,42 @@ public:
                         return false;
                 }
             }
-        
+
         // Okay, so it doesn't overlap.  Let's add it where needed.
+        addToCells(pts,sx,sy,ex,ey);
+
+        return true;
+    }
+
+    // Add an object whose placement we've already settled.  No overlap check,
+    //  we just want everyone else to keep avoiding it.
+    void addObjectAlways(const std::vector<Point2d> &pts)
+    {
+        Mbr objMbr;
+        for (unsigned int ii=0;ii<pts.size();ii++)
+            objMbr.addPoint(pts[ii]);
+        int sx,sy,ex,ey;
+        calcCells(objMbr,sx,sy,ex,ey);
+        addToCells(pts,sx,sy,ex,ey);
+    }
+
+protected:
+    // Work out the range of grid cells the given bounding box covers
+    void calcCells(const Mbr &objMbr,int &sx,int &sy,int &ex,int &ey)
+    {
+        sx = floorf((objMbr.ll().x()-mbr.ll().x())/cellSize.x());
+        if (sx < 0) sx = 0;
+        sy = floorf((objMbr.ll().y()-mbr.ll().y())/cellSize.y());
+        if (sy < 0) sy = 0;
+        ex = ceilf((objMbr.ur().x()-mbr.ll().x())/cellSize.x());
+        if (ex >= sizeX)  ex = sizeX-1;
+        ey = ceilf((objMbr.ur().y()-mbr.ll().y())/cellSize.y());
+        if (ey >= sizeY)  ey = sizeY-1;
+    }
+
+    // Drop the object into the cells it covers
+    void addToCells(const std::vector<Point2d> &pts,int sx,int sy,int ex,int ey)
+    {
         objects.resize(objects.size()+1);
         int newId = (int)(objects.size()-1);
         BoundedObject &newObj = objects[newId];
@@ -78,11 +106,8 @@ public:
                 std::vector<int> &objList = grid[iy*sizeX + ix];
                 objList.push_back(newId);
             }
-        
-        return true;
     }
-    
-protected:
+
     // Object and its bounds
     class BoundedObject
     {
@@ -102,20 +127,28 @@ protected:
 LayoutObject::LayoutObject()
     : Identifiable(),
         enable(true), dispLoc(0,0,0), size(0,0), iconSize(0,0), rotation(0.0), keepUpright(false), minVis(DrawVisibleInvalid),
-        maxVis(DrawVisibleInvalid), importance(MAXFLOAT), acceptablePlacement(WhirlyKitLayoutPlacementLeft | WhirlyKitLayoutPlacementRight | WhirlyKitLayoutPlacementAbove | WhirlyKitLayoutPlacementBelow)
+        maxVis(DrawVisibleInvalid), importance(MAXFLOAT), acceptablePlacement(WhirlyKitLayoutPlacementLeft | WhirlyKitLayoutPlacementRight | WhirlyKitLayoutPlacementAbove | WhirlyKitLayoutPlacementBelow),
+        clusterGroup(-1)
 {
 }    
     
 LayoutObject::LayoutObject(SimpleIdentity theId) : Identifiable(theId),
     enable(true), dispLoc(0,0,0), size(0,0), iconSize(0,0), rotation(0.0), minVis(DrawVisibleInvalid),
-    maxVis(DrawVisibleInvalid), importance(MAXFLOAT), acceptablePlacement(WhirlyKitLayoutPlacementLeft | WhirlyKitLayoutPlacementRight | WhirlyKitLayoutPlacementAbove | WhirlyKitLayoutPlacementBelow)
+    maxVis(DrawVisibleInvalid), importance(MAXFLOAT), acceptablePlacement(WhirlyKitLayoutPlacementLeft | WhirlyKitLayoutPlacementRight | WhirlyKitLayoutPlacementAbove | WhirlyKitLayoutPlacementBelow),
+    clusterGroup(-1)
 {
     
 }
     
+// Default cluster grid tuning
+static const float DefaultClusterCellSize = 32.0;
+static const int DefaultClusterWorkBudget = 2000;
+
 LayoutManager::LayoutManager()
-    : maxDisplayObjects(0), hasUpdates(false)
+    : maxDisplayObjects(0), hasUpdates(false), clusterCellSize(DefaultClusterCellSize),
+    clusterWorkBudget(DefaultClusterWorkBudget), clusterScanPos(EmptyIdentity), clusterDirty(false)
 {
+    clusterMatrix = Eigen::Matrix4d::Zero();
     pthread_mutex_init(&layoutLock, NULL);
 }
     
@@ -137,6 +170,28 @@ void LayoutManager::setMaxDisplayObjects(int numObjects)
 
     pthread_mutex_unlock(&layoutLock);
 }
+
+void LayoutManager::setClusterCellSize(float sizeInPoints)
+{
+    pthread_mutex_lock(&layoutLock);
+
+    clusterCellSize = sizeInPoints;
+    // The old cell assignments don't mean anything now
+    clusterDirty = true;
+    clusterScanPos = EmptyIdentity;
+    hasUpdates = true;
+
+    pthread_mutex_unlock(&layoutLock);
+}
+
+void LayoutManager::setClusterWorkBudget(int maxObjects)
+{
+    pthread_mutex_lock(&layoutLock);
+
+    clusterWorkBudget = maxObjects;
+
+    pthread_mutex_unlock(&layoutLock);
+}
     
 void LayoutManager::addLayoutObjects(const std::vector<LayoutObject> &newObjects)
 {
@@ -148,6 +203,8 @@ void LayoutManager::addLayoutObjects(const std::vector<LayoutObject> &newObjects
         LayoutObjectEntry *entry = new LayoutObjectEntry(layoutObj.getId());
         entry->obj = newObjects[ii];
         layoutObjects.insert(entry);
+        if (entry->obj.clusterGroup >= 0)
+            clusterDirty = true;
     }
     hasUpdates = true;
 
@@ -183,7 +240,19 @@ void LayoutManager::removeLayoutObjects(const SimpleIDSet &oldObjects)
         LayoutEntrySet::iterator eit = layoutObjects.find(&entry);
         if (eit != layoutObjects.end())
         {
-            delete *eit;
+            LayoutObjectEntry *theEntry = *eit;
+            // Pull it out of the cluster grid as well
+            if (theEntry->clusterCellX >= 0)
+            {
+                ClusterGrid::iterator cit = clusterGrid.find(ClusterCell(theEntry->obj.clusterGroup,theEntry->clusterCellX,theEntry->clusterCellY));
+                if (cit != clusterGrid.end())
+                {
+                    cit->second.erase(theEntry);
+                    if (cit->second.empty())
+                        clusterGrid.erase(cit);
+                }
+            }
+            delete theEntry;
             layoutObjects.erase(eit);
         }
     }
@@ -197,9 +266,9 @@ bool LayoutManager::hasChanges()
     bool ret = false;
     
     pthread_mutex_lock(&layoutLock);
-    
-    ret = hasUpdates;
-    
+
+    ret = hasUpdates || clusterDirty;
+
     pthread_mutex_unlock(&layoutLock);
     
     return ret;
@@ -223,15 +292,104 @@ static const int OverlapSampleY = 60;
 
 // Now much around the screen we'll take into account
 static const float ScreenBuffer = 0.1;
+
+// How far (in points) an object's screen position has to move before
+//  we bother rerunning its placement
+static const float ScreenMoveThreshold = 3.0;
     
+// Collapse each occupied cluster cell down to its most important object
+void LayoutManager::runClusterRules(WhirlyKitViewState *viewState,const Point2f &frameBufferSize,float resScale)
+{
+    // Any view movement means the cells need rebuilding
+    Eigen::Matrix4d curMatrix = viewState.fullMatrices[0];
+    if ((curMatrix.array() != clusterMatrix.array()).any())
+    {
+        clusterMatrix = curMatrix;
+        clusterDirty = true;
+        clusterScanPos = EmptyIdentity;
+    }
+
+    // Reassign objects to cells, up to the work budget.  If we run out
+    //  we pick up where we left off next update and the stragglers keep
+    //  their old cells for a frame or two.
+    if (clusterDirty)
+    {
+        float cellSize = clusterCellSize * resScale;
+        int numSoFar = 0;
+        LayoutObjectEntry scanEntry(clusterScanPos);
+        LayoutEntrySet::iterator it = layoutObjects.lower_bound(&scanEntry);
+        for (;it != layoutObjects.end();++it)
+        {
+            LayoutObjectEntry *entry = *it;
+            if (entry->obj.clusterGroup < 0)
+                continue;
+            if (clusterWorkBudget > 0 && numSoFar >= clusterWorkBudget)
+                break;
+            numSoFar++;
+
+            CGPoint objPt = [viewState pointOnScreenFromDisplay:entry->obj.dispLoc transform:&curMatrix frameSize:frameBufferSize];
+            int cellX = -1,cellY = -1;
+            if (objPt.x >= 0.0 && objPt.y >= 0.0 && objPt.x < frameBufferSize.x() && objPt.y < frameBufferSize.y())
+            {
+                cellX = objPt.x / cellSize;
+                cellY = objPt.y / cellSize;
+            }
+            if (cellX != entry->clusterCellX || cellY != entry->clusterCellY)
+            {
+                if (entry->clusterCellX >= 0)
+                {
+                    ClusterGrid::iterator cit = clusterGrid.find(ClusterCell(entry->obj.clusterGroup,entry->clusterCellX,entry->clusterCellY));
+                    if (cit != clusterGrid.end())
+                    {
+                        cit->second.erase(entry);
+                        if (cit->second.empty())
+                            clusterGrid.erase(cit);
+                    }
+                }
+                if (cellX >= 0)
+                    clusterGrid[ClusterCell(entry->obj.clusterGroup,cellX,cellY)].insert(entry);
+                else
+                    // Off screen, so the regular culling takes over
+                    entry->clusterHidden = false;
+                entry->clusterCellX = cellX;  entry->clusterCellY = cellY;
+            }
+        }
+        if (it == layoutObjects.end())
+        {
+            clusterDirty = false;
+            clusterScanPos = EmptyIdentity;
+        } else
+            clusterScanPos = (*it)->getId();
+    }
+
+    // Each cell keeps its most important member and hides the rest
+    for (ClusterGrid::iterator cit = clusterGrid.begin();cit != clusterGrid.end();++cit)
+    {
+        std::set<LayoutObjectEntry *> &members = cit->second;
+        LayoutObjectEntry *winner = NULL;
+        for (std::set<LayoutObjectEntry *>::iterator mit = members.begin();
+             mit != members.end(); ++mit)
+        {
+            LayoutObjectEntry *entry = *mit;
+            if (!entry->obj.enable)
+                continue;
+            if (!winner || entry->obj.importance > winner->obj.importance)
+                winner = entry;
+        }
+        for (std::set<LayoutObjectEntry *>::iterator mit = members.begin();
+             mit != members.end(); ++mit)
+            (*mit)->clusterHidden = (*mit != winner);
+    }
+}
+
 // Do the actual layout logic.  We'll modify the offset and on value in place.
 void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
 {
     if (layoutObjects.empty())
         return;
-    
+
     LayoutSortingSet layoutObjs;
-    
+
     // Turn everything off and sort by importance
     WhirlyGlobeViewState *globeViewState = nil;
     if ([viewState isKindOfClass:[WhirlyGlobeViewState class]])
@@ -266,7 +424,10 @@ void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
     frameBufferSize.y() = renderer.framebufferHeight;
     Mbr screenMbr(Point2f(-ScreenBuffer * frameBufferSize.x(),-ScreenBuffer * frameBufferSize.y()),frameBufferSize * (1.0 + ScreenBuffer));
     OverlapManager overlapMan(screenMbr,OverlapSampleX,OverlapSampleY);
-    
+
+    // Let clustering thin the herd before we place anything
+    runClusterRules(viewState,frameBufferSize,resScale);
+
     Matrix4d modelTrans = viewState.fullMatrices[0];
     Matrix4f fullMatrix4f = Matrix4dToMatrix4f(viewState.fullMatrices[0]);
     Matrix4f fullNormalMatrix4f = Matrix4dToMatrix4f(viewState.fullNormalMatrices[0]);
@@ -286,6 +447,9 @@ void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
         isActive = true;
         if (maxDisplayObjects != 0 && (numSoFar >= maxDisplayObjects))
             isActive = false;
+        // Clustering may have hidden it behind a more important object
+        if (isActive && layoutObj->clusterHidden)
+            isActive = false;
         // Start with a back face check
         if (isActive && globeViewState)
         {
@@ -312,9 +476,35 @@ void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
                 }
             }
             isActive &= isInside;
-            
+
+            // If it's barely moved since the last time we placed it, reuse
+            //  the decision we made then rather than laying it out again
+            bool reusedOldPlacement = false;
+            if (isActive && layoutObj->obj.size.x() != 0.0 && layoutObj->obj.size.y() != 0.0 &&
+                layoutObj->lastScreenPt.x() != MAXFLOAT)
+            {
+                Point2d screenDelta = Point2d(objPt.x,objPt.y) - layoutObj->lastScreenPt;
+                if (fabs(screenDelta.x()) < ScreenMoveThreshold*resScale &&
+                    fabs(screenDelta.y()) < ScreenMoveThreshold*resScale)
+                {
+                    if (layoutObj->lastObjPts.empty())
+                    {
+                        // It lost out last time and nothing's really moved
+                        isActive = false;
+                    } else {
+                        // Drag the old rectangle along so everyone else keeps avoiding it
+                        std::vector<Point2d> oldPts = layoutObj->lastObjPts;
+                        for (unsigned int oi=0;oi<oldPts.size();oi++)
+                            oldPts[oi] += screenDelta;
+                        overlapMan.addObjectAlways(oldPts);
+                        objOffset = layoutObj->offset;
+                    }
+                    reusedOldPlacement = true;
+                }
+            }
+
             // Deal with the rotation
-            if (layoutObj->obj.rotation != 0.0)
+            if (!reusedOldPlacement && layoutObj->obj.rotation != 0.0)
             {
                 Point3d norm,right,up;
                 
@@ -348,7 +538,7 @@ void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
             }
             
             // Now for the overlap checks
-            if (isActive)
+            if (isActive && !reusedOldPlacement)
             {
                 // Try the four different orientations
                 if (layoutObj->obj.size.x() != 0.0 && layoutObj->obj.size.y() != 0.0)
@@ -414,6 +604,13 @@ void LayoutManager::runLayoutRules(WhirlyKitViewState *viewState)
                         }
                     }
                     
+                    // Remember where we put it (or that we couldn't) for next time
+                    layoutObj->lastScreenPt = Point2d(objPt.x,objPt.y);
+                    if (validOrient)
+                        layoutObj->lastObjPts = objPts;
+                    else
+                        layoutObj->lastObjPts.clear();
+
                     isActive = validOrient;
                 }
             }
@@ -20,12 +20,14 @@
 
 #import "LoadedTile.h"
 #import "GlobeMath.h"
+#import "FlatMath.h"
 #import "GlobeLayerViewWatcher.h"
 #import "UIImage+Stuff.h"
 #import <boost/math/special_functions/fpclassify.hpp>
 #import "TileQuadLoader.h"
 #import "DynamicTextureAtlas.h"
 #import "DynamicDrawableAtlas.h"
+#import "TilePipelineTrace.h"
 
 using namespace WhirlyKit;
 
@@ -176,6 +178,25 @@ using namespace WhirlyKit;
     return newTex;
 }
 
+- (WhirlyKit::Texture *)buildSingleByteTexture:(int)reqBorderTexel destWidth:(int)destWidth destHeight:(int)destHeight
+{
+    // Only the UIImage path can pick its decode format
+    if (_type != WKLoadedImageUIImage)
+        return [self buildTexture:reqBorderTexel destWidth:destWidth destHeight:destHeight];
+
+    destWidth = (destWidth <= 0 ? _width : destWidth);
+    destHeight = (destHeight <= 0 ? _height : destHeight);
+    NSData *rawData = [(UIImage *)_imageData rawDataSingleChannelScaleWidth:destWidth height:destHeight border:reqBorderTexel];
+    Texture *newTex = [self textureFromRawData:rawData width:destWidth height:destHeight];
+    if (newTex)
+    {
+        newTex->setFormat(GL_ALPHA);
+        newTex->setIsConverted();
+    }
+
+    return newTex;
+}
+
 - (bool)convertToRawData:(int)borderTexel
 {
     switch (_type)
@@ -219,7 +240,105 @@ using namespace WhirlyKit;
 
 namespace WhirlyKit
 {
-    
+
+// How much memory the elevation mesh cache will use before it starts
+//  dropping the stalest grids
+static const long long ElevMeshCacheSize = 8*1024*1024;
+
+ElevMeshCache::ElevMeshCache(long long maxBytes)
+    : maxBytes(maxBytes), usedBytes(0)
+{
+    pthread_mutex_init(&lock,NULL);
+}
+
+ElevMeshCache::~ElevMeshCache()
+{
+    pthread_mutex_destroy(&lock);
+}
+
+ElevMeshCache *ElevMeshCache::getShared()
+{
+    static ElevMeshCache *shared = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken,
+    ^{
+        shared = new ElevMeshCache(ElevMeshCacheSize);
+    });
+    return shared;
+}
+
+// Plain FNV-1a, folded a byte at a time
+static unsigned long long HashBytes(unsigned long long hash,const void *bytes,size_t len)
+{
+    const unsigned char *data = (const unsigned char *)bytes;
+    for (size_t ii=0;ii<len;ii++)
+    {
+        hash ^= data[ii];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+long long ElevMeshCache::hashSeed()
+{
+    return (long long)14695981039346656037ULL;
+}
+
+long long ElevMeshCache::hashInt(long long hash,long long val)
+{
+    return (long long)HashBytes((unsigned long long)hash,&val,sizeof(val));
+}
+
+long long ElevMeshCache::hashFloat(long long hash,float val)
+{
+    return (long long)HashBytes((unsigned long long)hash,&val,sizeof(val));
+}
+
+ElevMeshRef ElevMeshCache::get(long long key)
+{
+    ElevMeshRef ret;
+
+    pthread_mutex_lock(&lock);
+    std::map<long long,std::list<CacheEntry>::iterator>::iterator it = entryMap.find(key);
+    if (it != entryMap.end())
+    {
+        entries.splice(entries.begin(),entries,it->second);
+        ret = it->second->mesh;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
+
+void ElevMeshCache::add(long long key,ElevMeshRef mesh)
+{
+    if (!mesh.get())
+        return;
+    long long cost = mesh->locs.size()*sizeof(Point3f) + mesh->elevs.size()*sizeof(float);
+
+    pthread_mutex_lock(&lock);
+    if (entryMap.find(key) == entryMap.end())
+    {
+        CacheEntry entry;
+        entry.key = key;
+        entry.cost = cost;
+        entry.mesh = mesh;
+        entries.push_front(entry);
+        entryMap[key] = entries.begin();
+        usedBytes += cost;
+
+        // Toss the stalest grids when we're over budget
+        while (usedBytes > maxBytes && !entries.empty())
+        {
+            CacheEntry &oldEntry = entries.back();
+            usedBytes -= oldEntry.cost;
+            entryMap.erase(oldEntry.key);
+            entries.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
 // Figure out the target size for an image based on our settings
 void TileBuilder::textureSize(int width, int height,int *destWidth,int *destHeight)
 {
@@ -260,6 +379,9 @@ void TileBuilder::textureSize(int width, int height,int *destWidth,int *destHeig
     }
 }
 
+// Textures smaller than this aren't worth converting on the build thread
+static const int MinTexelsForBuildConversion = 64*64;
+
 TileBuilder::TileBuilder(CoordSystem *coordSys,Mbr mbr,WhirlyKit::Quadtree *quadTree)
     : coordSys(coordSys), mbr(mbr), tree(quadTree),
     tileScale(WKTileScaleNone), fixedTileSize(128),
@@ -267,8 +389,13 @@ TileBuilder::TileBuilder(CoordSystem *coordSys,Mbr mbr,WhirlyKit::Quadtree *quad
     color(255,255,255,255), programId(EmptyIdentity),
     includeElev(false), useElevAsZ(true),
     ignoreEdgeMatching(false),
+    stitchEdges(false),
+    buildNormalMaps(false),
+    useTileCenters(false),
     coverPoles(true),
     glFormat(WKTileIntRGBA), singleByteSource(WKSingleRGB),
+    convertFormatOnBuild(true),
+    useMipmaps(false),
     defaultSphereTessX(10), defaultSphereTessY(10),
     texelBinSize(64),
     drawAtlas(NULL),
@@ -279,7 +406,9 @@ TileBuilder::TileBuilder(CoordSystem *coordSys,Mbr mbr,WhirlyKit::Quadtree *quad
     enabled(true),
     texAtlas(NULL),
     newDrawables(false),
-    singleLevel(false)
+    singleLevel(false),
+    compactVertexFormat(true),
+    scratchArena(NULL)
 {
     pthread_mutex_init(&texAtlasMappingLock, NULL);
 }
@@ -325,7 +454,7 @@ void TileBuilder::initAtlases(WhirlyKitTileImageType imageType,int numImages,int
         int texSortSize = (tileScale == WKTileScaleFixed ? fixedTileSize : texelBinSize);
         
         imageDepth = numImages;
-        texAtlas = new DynamicTextureAtlas(textureAtlasSize,texSortSize,glFormat,numImages);
+        texAtlas = new DynamicTextureAtlas(textureAtlasSize,texSortSize,glFormat,numImages,DynamicTexture::GridPacking,useMipmaps);
         drawAtlas = new DynamicDrawableAtlas("Tile Quad Loader",SingleElementSize,DrawBufferSize,ElementBufferSize,scene->getMemManager(),NULL,programId);
         newDrawables = true;
     }
@@ -353,7 +482,7 @@ void TileBuilder::clearAtlases(ChangeSet &theChangeRequests)
 }
 
 // Helper routine for constructing the skirt around a tile
-void TileBuilder::buildSkirt(BasicDrawable *draw,std::vector<Point3f> &pts,std::vector<TexCoord> &texCoords,float skirtFactor,bool haveElev)
+void TileBuilder::buildSkirt(BasicDrawable *draw,ScratchPoint3fVector &pts,ScratchTexCoordVector &texCoords,float skirtFactor,bool haveElev)
 {
     for (unsigned int ii=0;ii<pts.size()-1;ii++)
     {
@@ -392,11 +521,48 @@ void TileBuilder::buildSkirt(BasicDrawable *draw,std::vector<Point3f> &pts,std::
 }
 
     
+Texture *TileBuilder::buildSingleTexture(WhirlyKitLoadedImage *loadImage,int destWidth,int destHeight,const bool *cancel)
+{
+    // Single channel layers (hillshades, weather) decode
+    //  straight to one byte per pixel
+    Texture *newTex;
+    if (glFormat == GL_ALPHA && singleByteSource == WKSingleRGB)
+        newTex = [loadImage buildSingleByteTexture:borderTexel destWidth:destWidth destHeight:destHeight];
+    else
+        newTex = [loadImage buildTexture:borderTexel destWidth:destWidth destHeight:destHeight];
+
+    if (newTex)
+    {
+        newTex->setFormat(glFormat);
+        newTex->setSingleByteSource(singleByteSource);
+        // Standalone textures build their own chain; atlased
+        //  tiles share the atlas texture's
+        if (useMipmaps)
+            newTex->setUsesMipmaps(true);
+        // Do the format conversion out here where we can afford it,
+        //  unless the tile's already dead or too small to matter
+        if (convertFormatOnBuild && !(cancel && *cancel) &&
+            newTex->getWidth()*newTex->getHeight() >= MinTexelsForBuildConversion)
+            newTex->convertForUpload();
+    }
+
+    return newTex;
+}
+
 bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,BasicDrawable **skirtDraw,std::vector<Texture *> *texs,
-                            Point2f texScale,Point2f texOffset,std::vector<WhirlyKitLoadedImage *> *loadImages,WhirlyKitElevationChunk *elevData)
+                            Point2f texScale,Point2f texOffset,std::vector<WhirlyKitLoadedImage *> *loadImages,WhirlyKitElevationChunk *elevData,const bool *cancel,const int *stitchLevels)
 {
+    // The tile may have been superseded while this sat on a queue
+    if (cancel && *cancel)
+        return false;
+
+    // Everything we allocate for this tile build is scratch,
+    //  so take back whatever the last build used
+    if (scratchArena)
+        scratchArena->reset();
+
     Mbr theMbr = nodeInfo->mbr;
-    
+
     // Make sure this overlaps the area we care about
     if (!theMbr.overlaps(mbr))
     {
@@ -453,6 +619,18 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
     CoordSystem *sceneCoordSys = coordAdapter->getCoordSystem();
     GeoCoord geoLL(coordSys->localToGeographic(Point3f(chunkLL.x(),chunkLL.y(),0.0)));
     GeoCoord geoUR(coordSys->localToGeographic(Point3f(chunkUR.x(),chunkUR.y(),0.0)));
+
+    // In tile center mode we store vertices relative to the tile's center
+    //  and hang the real origin on the drawable as a double translation.
+    //  Only makes sense on flat systems, where deep zoom jitter lives.
+    bool tileCenterValid = useTileCenters && coordAdapter->isFlat();
+    Point3d dispCenter(0,0,0);
+    if (tileCenterValid)
+    {
+        Point2f chunkMid = (chunkLL+chunkUR)/2.0;
+        dispCenter = coordAdapter->localToDisplay(CoordSystemConvert3d(coordSys,sceneCoordSys,Point3d(chunkMid.x(),chunkMid.y(),0.0)));
+        dispCenter.z() = 0.0;
+    }
     
     // Get textures (locally)
     if (texs)
@@ -464,22 +642,20 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
             WhirlyKitLoadedImage *loadImage = (*loadImages)[0];
             int destWidth,destHeight;
             textureSize(loadImage.width,loadImage.height,&destWidth,&destHeight);
-            
+
             // Create a texture for each
+            NSTimeInterval decodeStart = CFAbsoluteTimeGetCurrent();
             for (unsigned int ii=0;ii<loadImages->size();ii++)
             {
-                Texture *newTex = [(*loadImages)[ii] buildTexture:borderTexel destWidth:destWidth destHeight:destHeight];
-                
+                Texture *newTex = buildSingleTexture((*loadImages)[ii],destWidth,destHeight,cancel);
                 if (newTex)
-                {
-                    newTex->setFormat(glFormat);
-                    newTex->setSingleByteSource(singleByteSource);
                     (*texs)[ii] = newTex;
-                } else {
+                else {
                     texturesClean = false;
                     (*texs)[ii] = NULL;
                 }
             }
+            TilePipelineTrace::addSpan(nodeInfo->ident.level,nodeInfo->ident.x,nodeInfo->ident.y,TilePipelineTrace::StageDecode,decodeStart,CFAbsoluteTimeGetCurrent());
         } else {
             for (unsigned int ii=0;ii<texs->size();ii++)
                 (*texs)[ii] = NULL;
@@ -498,7 +674,20 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
             return false;
         }
     }
-    
+
+    // Image decode can take a while, so check again before the mesh
+    if (cancel && *cancel)
+    {
+        if (texs)
+            for (unsigned int ii=0;ii<texs->size();ii++)
+                if ((*texs)[ii])
+                {
+                    delete (*texs)[ii];
+                    (*texs)[ii] = NULL;
+                }
+        return false;
+    }
+
     if (draw)
     {
         // We'll set up and fill in the drawable
@@ -515,6 +704,8 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
         chunk->setColor(color);
         chunk->setLocalMbr(Mbr(Point2f(geoLL.x(),geoLL.y()),Point2f(geoUR.x(),geoUR.y())));
         chunk->setProgram(programId);
+        if (compactVertexFormat)
+            chunk->setCompactVertexFormat();
         int elevEntry = 0;
         if (includeElev)
             elevEntry = chunk->addAttribute(BDFloatType, "a_elev");
@@ -556,44 +747,166 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
                 }
         } else {
             chunk->setType(GL_TRIANGLES);
+            // The real origin rides on the drawable in double and the
+            //  renderer composes it in double too
+            if (tileCenterValid)
+            {
+                Eigen::Affine3d trans(Eigen::Translation3d(dispCenter.x(),dispCenter.y(),dispCenter.z()));
+                Eigen::Matrix4d transMat = trans.matrix();
+                chunk->setMatrix(&transMat);
+            }
             // Generate point, texture coords, and normals
-            std::vector<Point3f> locs((sphereTessX+1)*(sphereTessY+1));
-            std::vector<float> elevs;
+            ScratchPoint3fVector locs((sphereTessX+1)*(sphereTessY+1),Point3f(),ScratchAllocator<Point3f>(scratchArena));
+            ScratchFloatVector elevs((ScratchAllocator<float>(scratchArena)));
             if (includeElev || useElevAsZ)
                 elevs.resize((sphereTessX+1)*(sphereTessY+1));
-            std::vector<TexCoord> texCoords((sphereTessX+1)*(sphereTessY+1));
+            ScratchTexCoordVector texCoords((sphereTessX+1)*(sphereTessY+1),TexCoord(),ScratchAllocator<TexCoord>(scratchArena));
             for (unsigned int iy=0;iy<sphereTessY+1;iy++)
                 for (unsigned int ix=0;ix<sphereTessX+1;ix++)
                 {
-                    float locZ = 0.0;
-                    if (!elevs.empty())
+                    TexCoord texCoord(ix*texIncr.x()*texScale.x()+texOffset.x(),1.0-(iy*texIncr.y()*texScale.y()+texOffset.y()));
+                    texCoords[iy*(sphereTessX+1)+ix] = texCoord;
+                }
+
+            // Displacing the grid means interpolating and projecting
+            //  every vertex, so an elevation tile paged back in picks
+            //  its grid up from the mesh cache instead
+            long long meshKey = 0;
+            ElevMeshRef cachedMesh;
+            if (elevData)
+            {
+                meshKey = ElevMeshCache::hashSeed();
+                meshKey = ElevMeshCache::hashInt(meshKey,nodeInfo->ident.level);
+                meshKey = ElevMeshCache::hashInt(meshKey,nodeInfo->ident.x);
+                meshKey = ElevMeshCache::hashInt(meshKey,nodeInfo->ident.y);
+                meshKey = ElevMeshCache::hashFloat(meshKey,texScale.x());
+                meshKey = ElevMeshCache::hashFloat(meshKey,texScale.y());
+                meshKey = ElevMeshCache::hashFloat(meshKey,texOffset.x());
+                meshKey = ElevMeshCache::hashFloat(meshKey,texOffset.y());
+                // These all change what lands in the grid
+                meshKey = ElevMeshCache::hashInt(meshKey,(includeElev ? 1 : 0) | (useElevAsZ ? 2 : 0) | (tileCenterValid ? 4 : 0));
+                meshKey = ElevMeshCache::hashInt(meshKey,(long long)coordAdapter);
+                meshKey = ElevMeshCache::hashInt(meshKey,[elevData dataHash]);
+                cachedMesh = ElevMeshCache::getShared()->get(meshKey);
+            }
+
+            if (cachedMesh && cachedMesh->locs.size() == locs.size() && cachedMesh->elevs.size() == elevs.size())
+            {
+                std::copy(cachedMesh->locs.begin(),cachedMesh->locs.end(),locs.begin());
+                std::copy(cachedMesh->elevs.begin(),cachedMesh->elevs.end(),elevs.begin());
+            } else {
+                for (unsigned int iy=0;iy<sphereTessY+1;iy++)
+                    for (unsigned int ix=0;ix<sphereTessX+1;ix++)
                     {
-                        if (elevData)
+                        float locZ = 0.0;
+                        if (!elevs.empty())
                         {
-                            float whereX = ix*texScale.x() + (elevData.numX-1)*texOffset.x();
-                            float whereY = iy*texScale.y() + (elevData.numY-1)*texOffset.y();
-                            locZ = [elevData interpolateElevationAtX:whereX y:whereY];
+                            if (elevData)
+                            {
+                                float whereX = ix*texScale.x() + (elevData.numX-1)*texOffset.x();
+                                float whereY = iy*texScale.y() + (elevData.numY-1)*texOffset.y();
+                                locZ = [elevData interpolateElevationAtX:whereX y:whereY];
+                            }
+                            elevs[iy*(sphereTessX+1)+ix] = locZ;
                         }
-                        elevs[iy*(sphereTessX+1)+ix] = locZ;
+                        // We don't want real elevations in the mesh, just off in another attribute
+                        if (!useElevAsZ)
+                            locZ = 0.0;
+                        locs[iy*(sphereTessX+1)+ix] = Point3f(chunkLL.x()+ix*incr.x(),chunkLL.y()+iy*incr.y(),locZ);
+
+                        // Use Z priority to sort the levels
+//                        if (singleLevel != -1)
+//                            loc3D.z() = (drawPriority + nodeInfo->ident.level * 0.01)/10000;
                     }
-                    // We don't want real elevations in the mesh, just off in another attribute
-                    if (!useElevAsZ)
-                        locZ = 0.0;
-                    Point3f loc3D = coordAdapter->localToDisplay(CoordSystemConvert(coordSys,sceneCoordSys,Point3f(chunkLL.x()+ix*incr.x(),chunkLL.y()+iy*incr.y(),locZ)));
+
+                if (tileCenterValid)
+                {
+                    // Relative mode runs the projection in double, so the
+                    //  floats we hand the drawable are small deltas off the
+                    //  tile center rather than big absolute coordinates
+                    double incrX = ((double)chunkUR.x()-(double)chunkLL.x())/sphereTessX;
+                    double incrY = ((double)chunkUR.y()-(double)chunkLL.y())/sphereTessY;
+                    for (unsigned int iy=0;iy<sphereTessY+1;iy++)
+                        for (unsigned int ix=0;ix<sphereTessX+1;ix++)
+                        {
+                            int idx = iy*(sphereTessX+1)+ix;
+                            Point3d dispLoc = coordAdapter->localToDisplay(CoordSystemConvert3d(coordSys,sceneCoordSys,Point3d(chunkLL.x()+ix*incrX,chunkLL.y()+iy*incrY,locs[idx].z())));
+                            locs[idx] = Point3f(dispLoc.x()-dispCenter.x(),dispLoc.y()-dispCenter.y(),(useElevAsZ && !elevs.empty()) ? elevs[idx] : 0.0);
+                        }
+                } else {
+                    // Project the whole grid in two batch calls rather than
+                    //  running every vertex through the virtual methods
+                    CoordSystemConvertArray(coordSys,sceneCoordSys,&locs[0],&locs[0],(unsigned int)locs.size());
+                    coordAdapter->localToDisplay(&locs[0],&locs[0],(unsigned int)locs.size());
                     if (coordAdapter->isFlat())
-                        loc3D.z() = locZ;
+                        for (unsigned int ii=0;ii<locs.size();ii++)
+                            locs[ii].z() = (useElevAsZ && !elevs.empty()) ? elevs[ii] : 0.0;
+                }
 
-                    // Use Z priority to sort the levels
-//                    if (singleLevel != -1)
-//                        loc3D.z() = (drawPriority + nodeInfo->ident.level * 0.01)/10000;
-                    
-                    locs[iy*(sphereTessX+1)+ix] = loc3D;
-                    
-                    // Do the texture coordinate seperately
-                    TexCoord texCoord(ix*texIncr.x()*texScale.x()+texOffset.x(),1.0-(iy*texIncr.y()*texScale.y()+texOffset.y()));
-                    texCoords[iy*(sphereTessX+1)+ix] = texCoord;
+                if (elevData)
+                {
+                    ElevMeshRef newMesh(new ElevMesh());
+                    newMesh->locs.assign(locs.begin(),locs.end());
+                    newMesh->elevs.assign(elevs.begin(),elevs.end());
+                    ElevMeshCache::getShared()->add(meshKey,newMesh);
                 }
-            
+            }
+
+            // In stitching mode we snap our edge vertices onto a coarser
+            //  neighbor's geometry.  The neighbor renders straight lines
+            //  between its samples, so interpolating along our own edge
+            //  in display space lands exactly on its edge.  No cracks and
+            //  no skirts to cover them with.
+            // This runs after the mesh cache, which stores the unsnapped grid.
+            if (stitchEdges && stitchLevels)
+            {
+                for (unsigned int side=0;side<4;side++)
+                {
+                    int neighborLevel = stitchLevels[side];
+                    if (neighborLevel < 0 || neighborLevel >= nodeInfo->ident.level)
+                        continue;
+                    int sampleStep = 1 << (nodeInfo->ident.level - neighborLevel);
+                    int tess = (side < 2) ? sphereTessX : sphereTessY;
+                    // The neighbor's samples only line up with ours if
+                    //  they divide our edge evenly
+                    if (sampleStep >= tess || (tess % sampleStep) != 0)
+                        continue;
+                    for (int is=1;is<tess;is++)
+                    {
+                        if (is % sampleStep == 0)
+                            continue;
+                        int is0 = (is/sampleStep)*sampleStep;
+                        int is1 = is0 + sampleStep;
+                        float t = (is-is0) / (float)sampleStep;
+                        int idx,idx0,idx1;
+                        switch (side)
+                        {
+                            case 0:  // bottom
+                                idx = is;  idx0 = is0;  idx1 = is1;
+                                break;
+                            case 1:  // top
+                                idx = sphereTessY*(sphereTessX+1)+is;
+                                idx0 = sphereTessY*(sphereTessX+1)+is0;
+                                idx1 = sphereTessY*(sphereTessX+1)+is1;
+                                break;
+                            case 2:  // left
+                                idx = is*(sphereTessX+1);
+                                idx0 = is0*(sphereTessX+1);
+                                idx1 = is1*(sphereTessX+1);
+                                break;
+                            default:  // right
+                                idx = is*(sphereTessX+1)+sphereTessX;
+                                idx0 = is0*(sphereTessX+1)+sphereTessX;
+                                idx1 = is1*(sphereTessX+1)+sphereTessX;
+                                break;
+                        }
+                        locs[idx] = locs[idx0] + t*(locs[idx1]-locs[idx0]);
+                        if (!elevs.empty())
+                            elevs[idx] = elevs[idx0] + t*(elevs[idx1]-elevs[idx0]);
+                    }
+                }
+            }
+
             // If there's elevation data, we need per triangle normals, which means more vertices
             if (!elevs.empty())
             {
@@ -709,7 +1022,22 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
                 }
             }
             
-            if (!ignoreEdgeMatching && !coordAdapter->isFlat() && skirtDraw)
+            // One more check before we take on the skirts
+            if (cancel && *cancel)
+            {
+                delete chunk;
+                if (texs)
+                    for (unsigned int ii=0;ii<texs->size();ii++)
+                        if ((*texs)[ii])
+                        {
+                            delete (*texs)[ii];
+                            (*texs)[ii] = NULL;
+                        }
+                return false;
+            }
+
+            // Stitched edges meet their neighbors exactly, so no skirts there
+            if (!ignoreEdgeMatching && !stitchEdges && !coordAdapter->isFlat() && skirtDraw)
             {
                 // We'll set up and fill in the drawable
                 BasicDrawable *skirtChunk = new BasicDrawable("Tile Quad Loader Skirt");
@@ -725,6 +1053,8 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
                 // We need the skirts rendered with the z buffer on, even if we're doing (mostly) pure sorting
                 skirtChunk->setRequestZBuffer(true);
                 skirtChunk->setProgram(programId);
+                if (compactVertexFormat)
+                    skirtChunk->setCompactVertexFormat();
                 
                 // We'll vary the skirt size a bit.  Otherwise the fill gets ridiculous when we're looking
                 //  at the very highest levels.  On the other hand, this doesn't fix a really big large/small
@@ -736,8 +1066,8 @@ bool TileBuilder::buildTile(Quadtree::NodeInfo *nodeInfo,BasicDrawable **draw,Ba
                     skirtFactor = 1.0 - 0.2 / (1<<nodeInfo->ident.level);
                 
                 // Bottom skirt
-                std::vector<Point3f> skirtLocs;
-                std::vector<TexCoord> skirtTexCoords;
+                ScratchPoint3fVector skirtLocs((ScratchAllocator<Point3f>(scratchArena)));
+                ScratchTexCoordVector skirtTexCoords((ScratchAllocator<TexCoord>(scratchArena)));
                 for (unsigned int ix=0;ix<=sphereTessX;ix++)
                 {
                     skirtLocs.push_back(locs[ix]);
@@ -927,12 +1257,17 @@ LoadedTile::LoadedTile()
     placeholder = false;
     drawId = EmptyIdentity;
     skirtDrawId = EmptyIdentity;
+    normalTexId = EmptyIdentity;
     dispCenter = Point3d(0,0,0);
     tileSize = 0.0;
+    cancelled = boost::shared_ptr<bool>(new bool(false));
+    selfIsOn = false;
     for (unsigned int ii=0;ii<4;ii++)
     {
         childDrawIds[ii] = EmptyIdentity;
         childSkirtDrawIds[ii] = EmptyIdentity;
+        childIsOn[ii] = false;
+        stitchLevels[ii] = -1;
     }
 }
 
@@ -943,14 +1278,19 @@ LoadedTile::LoadedTile(const WhirlyKit::Quadtree::Identifier &ident)
     placeholder = false;
     drawId = EmptyIdentity;
     skirtDrawId = EmptyIdentity;
+    normalTexId = EmptyIdentity;
     elevData = nil;
     dispCenter = Point3d(0,0,0);
     tileSize = 0.0;
+    cancelled = boost::shared_ptr<bool>(new bool(false));
     for (unsigned int ii=0;ii<4;ii++)
     {
         childDrawIds[ii] = EmptyIdentity;
         childSkirtDrawIds[ii] = EmptyIdentity;
+        childIsOn[ii] = false;
+        stitchLevels[ii] = -1;
     }
+    selfIsOn = false;
 }
     
 void LoadedTile::calculateSize(Quadtree *quadTree,CoordSystemDisplayAdapter *coordAdapt,CoordSystem *coordSys)
@@ -976,10 +1316,18 @@ bool LoadedTile::addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoaded
     BasicDrawable *draw = NULL;
     BasicDrawable *skirtDraw = NULL;
     std::vector<Texture *> texs(loadImages.size(),NULL);
-    if (tileBuilder->texAtlas)
-        subTexs.resize(loadImages.size());
     if (!tileBuilder->buildTile(&nodeInfo, &draw, &skirtDraw, (!loadImages.empty() ? &texs : NULL), Point2f(1.0,1.0), Point2f(0.0,0.0), &loadImages, loadElev))
         return false;
+
+    return addToScene(tileBuilder,loadImages,draw,skirtDraw,texs,changeRequests);
+}
+
+// The back half of addToScene.  The geometry is built (possibly on another
+//  thread), so insert it into the atlases and set up the change requests.
+bool LoadedTile::addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoadedImage *> &loadImages,BasicDrawable *draw,BasicDrawable *skirtDraw,std::vector<Texture *> &texs,std::vector<WhirlyKit::ChangeRequest *> &changeRequests)
+{
+    if (tileBuilder->texAtlas)
+        subTexs.resize(loadImages.size());
     drawId = draw->getId();
     skirtDrawId = (skirtDraw ? skirtDraw->getId() : EmptyIdentity);
 
@@ -1012,6 +1360,24 @@ bool LoadedTile::addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoaded
             texIds.push_back(EmptyIdentity);
     }
     
+    // Derive a normal map from the elevation so a shader can light per
+    //  fragment (kToolkitDefaultTriangleNormalMap).  The atlas path
+    //  can't take a second per tile texture, so it sits this out.
+    if (tileBuilder->buildNormalMaps && elevData && draw && !tileBuilder->texAtlas)
+    {
+        GeoCoord geoNormLL = tileBuilder->coordSys->localToGeographic(Point3f(nodeInfo.mbr.ll().x(),nodeInfo.mbr.ll().y(),0.0));
+        GeoCoord geoNormUR = tileBuilder->coordSys->localToGeographic(Point3f(nodeInfo.mbr.ur().x(),nodeInfo.mbr.ur().y(),0.0));
+        float cellY = (geoNormUR.y()-geoNormLL.y())*EarthRadius/(elevData.numY-1);
+        float cellX = (geoNormUR.x()-geoNormLL.x())*cosf((geoNormLL.y()+geoNormUR.y())/2.0)*EarthRadius/(elevData.numX-1);
+        Texture *normTex = [elevData buildNormalMapTexture:cellX cellSizeY:cellY];
+        if (normTex)
+        {
+            normalTexId = normTex->getId();
+            draw->setTexId(1,normalTexId);
+            changeRequests.push_back(new AddTextureReq(normTex));
+        }
+    }
+
     // Now for the changes to the scene
     if (tileBuilder->drawAtlas)
     {
@@ -1036,7 +1402,9 @@ bool LoadedTile::addToScene(TileBuilder *tileBuilder,std::vector<WhirlyKitLoaded
     {
         childDrawIds[ii] = EmptyIdentity;
         childSkirtDrawIds[ii] = EmptyIdentity;
+        childIsOn[ii] = false;
     }
+    selfIsOn = true;
     
     return true;
 }
@@ -1072,6 +1440,12 @@ void LoadedTile::clearContents(TileBuilder *tileBuilder,ChangeSet &changeRequest
             changeRequests.push_back(new RemTextureReq(texIds[ii]));
         }
     texIds.clear();
+    sourceImages.clear();
+    if (normalTexId != EmptyIdentity)
+    {
+        changeRequests.push_back(new RemTextureReq(normalTexId));
+        normalTexId = EmptyIdentity;
+    }
     for (unsigned int ii=0;ii<4;ii++)
     {
         if (childDrawIds[ii] != EmptyIdentity)
@@ -1088,7 +1462,68 @@ void LoadedTile::clearContents(TileBuilder *tileBuilder,ChangeSet &changeRequest
             else
                 changeRequests.push_back(new RemDrawableReq(childSkirtDrawIds[ii]));
         }
+        childDrawIds[ii] = EmptyIdentity;
+        childSkirtDrawIds[ii] = EmptyIdentity;
+        childIsOn[ii] = false;
+    }
+    selfIsOn = false;
+}
+
+void LoadedTile::dropContents(TileBuilder *tileBuilder,SimpleIDSet &drawIDs,SimpleIDSet &texIDs,ChangeSet &changeRequests)
+{
+    if (drawId != EmptyIdentity)
+    {
+        if (tileBuilder->drawAtlas)
+            tileBuilder->drawAtlas->removeDrawable(drawId, changeRequests);
+        else
+            drawIDs.insert(drawId);
+        drawId = EmptyIdentity;
+    }
+    if (skirtDrawId != EmptyIdentity)
+    {
+        if (tileBuilder->drawAtlas)
+            tileBuilder->drawAtlas->removeDrawable(skirtDrawId, changeRequests);
+        else
+            drawIDs.insert(skirtDrawId);
+        skirtDrawId = EmptyIdentity;
+    }
+    if (tileBuilder)
+    {
+        if (!subTexs.empty() && subTexs[0].texId != EmptyIdentity && tileBuilder->texAtlas)
+            tileBuilder->texAtlas->removeTexture(subTexs[0], changeRequests);
+        subTexs.clear();
+    }
+    for (unsigned int ii=0;ii<texIds.size();ii++)
+        if (texIds[ii] != EmptyIdentity)
+            texIDs.insert(texIds[ii]);
+    texIds.clear();
+    sourceImages.clear();
+    if (normalTexId != EmptyIdentity)
+    {
+        texIDs.insert(normalTexId);
+        normalTexId = EmptyIdentity;
+    }
+    for (unsigned int ii=0;ii<4;ii++)
+    {
+        if (childDrawIds[ii] != EmptyIdentity)
+        {
+            if (tileBuilder->drawAtlas)
+                tileBuilder->drawAtlas->removeDrawable(childDrawIds[ii], changeRequests);
+            else
+                drawIDs.insert(childDrawIds[ii]);
+        }
+        if (childSkirtDrawIds[ii] != EmptyIdentity)
+        {
+            if (tileBuilder->drawAtlas)
+                tileBuilder->drawAtlas->removeDrawable(childSkirtDrawIds[ii], changeRequests);
+            else
+                drawIDs.insert(childSkirtDrawIds[ii]);
+        }
+        childDrawIds[ii] = EmptyIdentity;
+        childSkirtDrawIds[ii] = EmptyIdentity;
+        childIsOn[ii] = false;
     }
+    selfIsOn = false;
 }
 
 // Make sure a given tile overlaps the real world
@@ -1120,29 +1555,46 @@ void LoadedTile::updateContents(TileBuilder *tileBuilder,LoadedTile *childTiles[
             // If it exists, make sure we're not representing it here
             if (isPresent)
             {
-                // Turn the child back off
-                if (childDrawIds[whichChild] != EmptyIdentity)
+                // Turn the stand-in off, but hang on to it.  If the child
+                //  goes away again this becomes an enable rather than a
+                //  geometry rebuild.
+                if (childDrawIds[whichChild] != EmptyIdentity && childIsOn[whichChild])
                 {
                     if (tileBuilder->drawAtlas)
                     {
-                        tileBuilder->drawAtlas->removeDrawable(childDrawIds[whichChild], changeRequests);
+                        tileBuilder->drawAtlas->setEnableDrawable(childDrawIds[whichChild], false);
                         if (childSkirtDrawIds[whichChild])
-                            tileBuilder->drawAtlas->removeDrawable(childSkirtDrawIds[whichChild], changeRequests);
+                            tileBuilder->drawAtlas->setEnableDrawable(childSkirtDrawIds[whichChild], false);
                     } else {
-                        changeRequests.push_back(new RemDrawableReq(childDrawIds[whichChild]));
+                        changeRequests.push_back(new OnOffChangeRequest(childDrawIds[whichChild],false));
                         if (childSkirtDrawIds[whichChild])
-                            changeRequests.push_back(new RemDrawableReq(childSkirtDrawIds[whichChild]));
+                            changeRequests.push_back(new OnOffChangeRequest(childSkirtDrawIds[whichChild],false));
                     }
-                    childDrawIds[whichChild] = EmptyIdentity;
-                    childSkirtDrawIds[whichChild] = EmptyIdentity;
+                    childIsOn[whichChild] = false;
                 }
                 
                 childrenExist = true;
             } else {
                 // It's not there, so make sure we're faking it with our texture
-                // May need to build the geometry
-                if (childDrawIds[whichChild] == EmptyIdentity)
+                if (childDrawIds[whichChild] != EmptyIdentity)
                 {
+                    // Still have the geometry from last time, just turn it back on
+                    if (!childIsOn[whichChild])
+                    {
+                        if (tileBuilder->drawAtlas)
+                        {
+                            tileBuilder->drawAtlas->setEnableDrawable(childDrawIds[whichChild], true);
+                            if (childSkirtDrawIds[whichChild])
+                                tileBuilder->drawAtlas->setEnableDrawable(childSkirtDrawIds[whichChild], true);
+                        } else {
+                            changeRequests.push_back(new OnOffChangeRequest(childDrawIds[whichChild],true));
+                            if (childSkirtDrawIds[whichChild])
+                                changeRequests.push_back(new OnOffChangeRequest(childSkirtDrawIds[whichChild],true));
+                        }
+                        childIsOn[whichChild] = true;
+                    }
+                } else {
+                    // May need to build the geometry
                     Quadtree::NodeInfo childInfo = tileBuilder->tree->generateNode(childIdent);
                     if (tileBuilder->isValidTile(childInfo.mbr) && !placeholder)
                     {
@@ -1152,6 +1604,7 @@ void LoadedTile::updateContents(TileBuilder *tileBuilder,LoadedTile *childTiles[
                         // Set this to change the color of child drawables.  Helpfull for debugging
                         //                        childDraw->setColor(RGBAColor(64,64,64,255));
                         childDrawIds[whichChild] = childDraw->getId();
+                        childIsOn[whichChild] = true;
                         if (childSkirtDraw)
                             childSkirtDrawIds[whichChild] = childSkirtDraw->getId();
                         if (!tileBuilder->lineMode && !texIds.empty())
@@ -1194,12 +1647,27 @@ void LoadedTile::updateContents(TileBuilder *tileBuilder,LoadedTile *childTiles[
     // No children, so turn the geometry for this tile back on
     if (!childrenExist)
     {
-        if (drawId == EmptyIdentity && !placeholder)
+        if (drawId != EmptyIdentity && !selfIsOn)
+        {
+            // Still have our geometry, just turn it back on
+            if (tileBuilder->drawAtlas)
+            {
+                tileBuilder->drawAtlas->setEnableDrawable(drawId, true);
+                if (skirtDrawId != EmptyIdentity)
+                    tileBuilder->drawAtlas->setEnableDrawable(skirtDrawId, true);
+            } else {
+                changeRequests.push_back(new OnOffChangeRequest(drawId,true));
+                if (skirtDrawId != EmptyIdentity)
+                    changeRequests.push_back(new OnOffChangeRequest(skirtDrawId,true));
+            }
+            selfIsOn = true;
+        } else if (drawId == EmptyIdentity && !placeholder)
         {
             BasicDrawable *draw = NULL;
             BasicDrawable *skirtDraw = NULL;
             tileBuilder->buildTile(&nodeInfo, &draw, &skirtDraw, NULL, Point2f(1.0,1.0), Point2f(0.0,0.0), nil, elevData);
             drawId = draw->getId();
+            selfIsOn = true;
             if (!texIds.empty())
                 draw->setTexId(0,texIds[0]);
             if (skirtDraw)
@@ -1236,44 +1704,86 @@ void LoadedTile::updateContents(TileBuilder *tileBuilder,LoadedTile *childTiles[
         // Also turn off any children that may have been on
         for (unsigned int ii=0;ii<4;ii++)
         {
-            if (childDrawIds[ii] != EmptyIdentity)
+            if (childDrawIds[ii] != EmptyIdentity && childIsOn[ii])
             {
                 if (tileBuilder->drawAtlas)
                 {
-                    tileBuilder->drawAtlas->removeDrawable(childDrawIds[ii], changeRequests);
+                    tileBuilder->drawAtlas->setEnableDrawable(childDrawIds[ii], false);
                     if (childSkirtDrawIds[ii] != EmptyIdentity)
-                        tileBuilder->drawAtlas->removeDrawable(childSkirtDrawIds[ii], changeRequests);
+                        tileBuilder->drawAtlas->setEnableDrawable(childSkirtDrawIds[ii], false);
                 } else {
-                    changeRequests.push_back(new RemDrawableReq(childDrawIds[ii]));
+                    changeRequests.push_back(new OnOffChangeRequest(childDrawIds[ii],false));
                     if (childSkirtDrawIds[ii] != EmptyIdentity)
-                        changeRequests.push_back(new RemDrawableReq(childSkirtDrawIds[ii]));
+                        changeRequests.push_back(new OnOffChangeRequest(childSkirtDrawIds[ii],false));
                 }
-                childDrawIds[ii] = EmptyIdentity;
-                childSkirtDrawIds[ii] = EmptyIdentity;
+                childIsOn[ii] = false;
             }
         }
     } else {
-        // Make sure our representation is off
-        if (drawId != EmptyIdentity)
+        // Make sure our representation is off, but keep it around
+        if (drawId != EmptyIdentity && selfIsOn)
         {
             if (tileBuilder->drawAtlas)
             {
-                tileBuilder->drawAtlas->removeDrawable(drawId, changeRequests);
+                tileBuilder->drawAtlas->setEnableDrawable(drawId, false);
                 if (skirtDrawId != EmptyIdentity)
-                    tileBuilder->drawAtlas->removeDrawable(skirtDrawId, changeRequests);
+                    tileBuilder->drawAtlas->setEnableDrawable(skirtDrawId, false);
             } else {
-                changeRequests.push_back(new RemDrawableReq(drawId));
+                changeRequests.push_back(new OnOffChangeRequest(drawId,false));
                 if (skirtDrawId != EmptyIdentity)
-                    changeRequests.push_back(new RemDrawableReq(skirtDrawId));
+                    changeRequests.push_back(new OnOffChangeRequest(skirtDrawId,false));
             }
-            drawId = EmptyIdentity;
-            skirtDrawId = EmptyIdentity;
+            selfIsOn = false;
         }
     }
     
     //    tree->Print();
 }
-    
+
+// Rebuild our geometry against the neighbor levels we're given.
+// Textures stay where they are; only the mesh changes.
+void LoadedTile::restitchContents(TileBuilder *tileBuilder,const int newStitchLevels[4],ChangeSet &changeRequests)
+{
+    if (placeholder || isLoading || drawId == EmptyIdentity)
+        return;
+
+    // Nothing moved, so leave the geometry alone
+    if (newStitchLevels[0] == stitchLevels[0] && newStitchLevels[1] == stitchLevels[1] &&
+        newStitchLevels[2] == stitchLevels[2] && newStitchLevels[3] == stitchLevels[3])
+        return;
+    for (unsigned int ii=0;ii<4;ii++)
+        stitchLevels[ii] = newStitchLevels[ii];
+
+    BasicDrawable *draw = NULL;
+    if (!tileBuilder->buildTile(&nodeInfo,&draw,NULL,NULL,Point2f(1.0,1.0),Point2f(0.0,0.0),nil,elevData,NULL,stitchLevels) || !draw)
+        return;
+
+    // Swap the new mesh in for the old one
+    if (tileBuilder->drawAtlas)
+        tileBuilder->drawAtlas->removeDrawable(drawId, changeRequests);
+    else
+        changeRequests.push_back(new RemDrawableReq(drawId));
+    drawId = draw->getId();
+
+    if (!texIds.empty() && texIds[0] != EmptyIdentity)
+        draw->setTexId(0,texIds[0]);
+    if (normalTexId != EmptyIdentity)
+        draw->setTexId(1,normalTexId);
+    if (tileBuilder->texAtlas && !subTexs.empty())
+        draw->applySubTexture(-1,subTexs[0]);
+    if (tileBuilder->drawAtlas)
+    {
+        bool addedBigDrawable = false;
+        tileBuilder->drawAtlas->addDrawable(draw,changeRequests,selfIsOn,EmptyIdentity,&addedBigDrawable,&dispCenter,tileSize);
+        tileBuilder->newDrawables |= addedBigDrawable;
+        delete draw;
+    } else {
+        if (!selfIsOn)
+            draw->setOnOff(false);
+        changeRequests.push_back(new AddDrawableReq(draw));
+    }
+}
+
 void LoadedTile::setCurrentImages(TileBuilder *tileBuilder,int whichImage0,int whichImage1,ChangeSet &changeRequests)
 {
     std::vector<unsigned int> whichImages;
@@ -1306,19 +1816,89 @@ void LoadedTile::setCurrentImages(TileBuilder *tileBuilder,int whichImage0,int w
         }
     }
 }
-    
+
+void LoadedTile::updateFrameResidency(TileBuilder *tileBuilder,int frameResidency,int whichImage0,int whichImage1,ChangeSet &changeRequests)
+{
+    // Only makes sense for standalone textures with retained sources
+    if (tileBuilder->texAtlas || placeholder || sourceImages.empty())
+        return;
+
+    int numFrames = (int)texIds.size();
+    if (numFrames < 2)
+        return;
+
+    for (int ii=0;ii<numFrames;ii++)
+    {
+        // Animations loop, so measure distance to the play head around
+        //  the circle.  That keeps the next few frames resident ahead
+        //  of the cursor as well as behind it.
+        int dist = std::abs(ii-whichImage0);
+        dist = std::min(dist,numFrames-dist);
+        if (whichImage1 != whichImage0)
+        {
+            int dist1 = std::abs(ii-whichImage1);
+            dist1 = std::min(dist1,numFrames-dist1);
+            dist = std::min(dist,dist1);
+        }
+        bool resident = dist <= frameResidency;
+
+        if (resident && texIds[ii] == EmptyIdentity)
+        {
+            // Coming into the window.  Rebuild the texture from the
+            //  compressed source we held on to.
+            if (ii < (int)sourceImages.size() && sourceImages[ii])
+            {
+                int destWidth,destHeight;
+                tileBuilder->textureSize(sourceImages[ii].width,sourceImages[ii].height,&destWidth,&destHeight);
+                Texture *newTex = tileBuilder->buildSingleTexture(sourceImages[ii],destWidth,destHeight);
+                if (newTex)
+                {
+                    texIds[ii] = newTex->getId();
+                    changeRequests.push_back(new AddTextureReq(newTex));
+                }
+            }
+        } else if (!resident && texIds[ii] != EmptyIdentity)
+        {
+            // Leaving the window.  The source sticks around, so this
+            //  just sheds the GL memory.
+            changeRequests.push_back(new RemTextureReq(texIds[ii]));
+            texIds[ii] = EmptyIdentity;
+        }
+    }
+
+    // Point the geometry at the frame being displayed
+    if (whichImage0 >= 0 && whichImage0 < numFrames)
+    {
+        SimpleIdentity newTexId = texIds[whichImage0];
+        if (drawId != EmptyIdentity)
+            changeRequests.push_back(new DrawTexChangeRequest(drawId,0,newTexId));
+        if (skirtDrawId != EmptyIdentity)
+            changeRequests.push_back(new DrawTexChangeRequest(skirtDrawId,0,newTexId));
+
+        for (unsigned int jj=0;jj<4;jj++)
+        {
+            if (childDrawIds[jj] != EmptyIdentity)
+                changeRequests.push_back(new DrawTexChangeRequest(childDrawIds[jj],0,newTexId));
+            if (childSkirtDrawIds[jj] != EmptyIdentity)
+                changeRequests.push_back(new DrawTexChangeRequest(childSkirtDrawIds[jj],0,newTexId));
+        }
+    }
+}
+
 void LoadedTile::setEnable(TileBuilder *tileBuilder, bool enable, ChangeSet &theChanges)
 {
-    if (drawId != EmptyIdentity)
+    // Only touch the drawables that are supposed to be showing.  The
+    //  retained stand-ins stay off either way.
+    if (drawId != EmptyIdentity && selfIsOn)
         theChanges.push_back(new OnOffChangeRequest(drawId,enable));
-    if (skirtDrawId != EmptyIdentity)
+    if (skirtDrawId != EmptyIdentity && selfIsOn)
         theChanges.push_back(new OnOffChangeRequest(skirtDrawId,enable));
 
     for (unsigned int ii=0;ii<4;ii++)
     {
-        if (childDrawIds[ii] != EmptyIdentity)
+        if (childDrawIds[ii] != EmptyIdentity && childIsOn[ii])
             theChanges.push_back(new OnOffChangeRequest(childDrawIds[ii],enable));
-        if (childSkirtDrawIds[ii] != EmptyIdentity)
+        if (childSkirtDrawIds[ii] != EmptyIdentity && childIsOn[ii])
             theChanges.push_back(new OnOffChangeRequest(childSkirtDrawIds[ii],enable));
     }
 }
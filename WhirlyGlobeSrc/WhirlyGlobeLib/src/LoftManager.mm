@@ -47,6 +47,7 @@ using namespace WhirlyKit;
     bool        readZBuffer;
     bool        writeZBuffer;
     bool        enable;
+    bool        optimizeTris;
     NSObject<WhirlyKitLoftedPolyCache> *cache;
 }
 
@@ -103,6 +104,7 @@ using namespace WhirlyKit;
     readZBuffer = [dict boolForKey:@"zbufferread" default:YES];
     writeZBuffer = [dict boolForKey:@"zbufferwrite" default:NO];
     enable = [dict boolForKey:@"enable" default:true];
+    optimizeTris = [dict boolForKey:@"optimizetriangles" default:true];
     self.key = inKey;
 }
 
@@ -113,94 +115,157 @@ namespace WhirlyKit
 {
 
 // Read the lofted poly representation from a cache file
-// We're just saving the MBR and triangle mesh here
+// We're saving the MBR, triangle mesh, and outlines here
 bool LoftedPolySceneRep::readFromCache(NSObject<WhirlyKitLoftedPolyCache> *cache,NSString *key)
 {
     if (!cache)
         return false;
-    
-    // Note: Cache no longer working
-    return false;
-    
-//    NSData *data = [cache readLoftedPolyData:key];
-//    if (!data)
-//        return false;
-//    
-//    try {
-//        // MBR first
-//        float ll_x,ll_y,ur_x,ur_y;
-//        unsigned int loc = 0;
-//        [data getBytes:&ll_x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//        [data getBytes:&ll_y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//        [data getBytes:&ur_x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//        [data getBytes:&ur_y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//        shapeMbr.addGeoCoord(GeoCoord(ll_x,ll_y));
-//        shapeMbr.addGeoCoord(GeoCoord(ur_x,ur_y));
-//        
-//        // Triangle meshes
-//        unsigned int numMesh = 0;
-//        [data getBytes:&numMesh range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
-//        triMesh.resize(numMesh);
-//        for (unsigned int ii=0;ii<numMesh;ii++)
-//        {
-//            VectorRing &ring = triMesh[ii];
-//            unsigned int numPt = 0;
-//            [data getBytes:&numPt range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
-//            ring.resize(numPt);
-//            for (unsigned int jj=0;jj<numPt;jj++)
-//            {
-//                Point2f &pt = ring[jj];
-//                float x,y;
-//                [data getBytes:&x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//                [data getBytes:&y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
-//                pt.x() = x;
-//                pt.y() = y;
-//            }
-//        }
-//    }
-//    catch (...)
-//    {
-//        return false;
-//    }
-    
+
+    NSData *data = [cache readLoftedPolyData:key];
+    if (!data)
+        return false;
+
+    try {
+        // MBR first
+        float ll_x,ll_y,ur_x,ur_y;
+        unsigned int loc = 0;
+        [data getBytes:&ll_x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+        [data getBytes:&ll_y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+        [data getBytes:&ur_x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+        [data getBytes:&ur_y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+        shapeMbr.addGeoCoord(GeoCoord(ll_x,ll_y));
+        shapeMbr.addGeoCoord(GeoCoord(ur_x,ur_y));
+
+        // Triangle mesh points
+        unsigned int numPt = 0;
+        [data getBytes:&numPt range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
+        triMesh->pts.resize(numPt);
+        for (unsigned int ii=0;ii<numPt;ii++)
+        {
+            Point3f &pt = triMesh->pts[ii];
+            float x,y,z;
+            [data getBytes:&x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+            [data getBytes:&y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+            [data getBytes:&z range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+            pt = Point3f(x,y,z);
+        }
+
+        // And the triangles
+        unsigned int numTri = 0;
+        [data getBytes:&numTri range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
+        triMesh->tris.resize(numTri);
+        for (unsigned int ii=0;ii<numTri;ii++)
+        {
+            VectorTriangles::Triangle &tri = triMesh->tris[ii];
+            [data getBytes:&tri.pts[0] range:NSMakeRange(loc, 3*sizeof(int))];  loc += 3*sizeof(int);  if (loc > [data length])  throw 1;
+        }
+        triMesh->initGeoMbr();
+
+        // Outlines, if they were built
+        unsigned int numOutline = 0;
+        [data getBytes:&numOutline range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
+        outlines.resize(numOutline);
+        for (unsigned int ii=0;ii<numOutline;ii++)
+        {
+            VectorRing &ring = outlines[ii];
+            unsigned int ringPt = 0;
+            [data getBytes:&ringPt range:NSMakeRange(loc, sizeof(unsigned int))];  loc += sizeof(unsigned int);  if (loc > [data length])  throw 1;
+            ring.resize(ringPt);
+            for (unsigned int jj=0;jj<ringPt;jj++)
+            {
+                Point2f &pt = ring[jj];
+                float x,y;
+                [data getBytes:&x range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+                [data getBytes:&y range:NSMakeRange(loc, sizeof(float))];  loc += sizeof(float);  if (loc > [data length])  throw 1;
+                pt.x() = x;
+                pt.y() = y;
+            }
+        }
+    }
+    catch (...)
+    {
+        return false;
+    }
+
     return true;
 }
 
 // Write the lofted poly representation to a cache
-// Just the MBR and triangle mesh
+// Just the MBR, triangle mesh, and outlines
 bool LoftedPolySceneRep::writeToCache(NSObject<WhirlyKitLoftedPolyCache> *cache,NSString *key)
 {
-    // Note: Cache no longer working
-    return false;
-    
-//    NSMutableData *data = [NSMutableData dataWithCapacity:0];
-//    
-//    // MBR first
-//    GeoCoord ll = shapeMbr.ll(), ur = shapeMbr.ur();
-//    [data appendBytes:&ll.x() length:sizeof(float)];
-//    [data appendBytes:&ll.y() length:sizeof(float)];
-//    [data appendBytes:&ur.x() length:sizeof(float)];
-//    [data appendBytes:&ur.y() length:sizeof(float)];
-//    
-//    // Triangle meshes
-//    unsigned int numMesh = triMesh.size();
-//    [data appendBytes:&numMesh length:sizeof(unsigned int)];
-//    for (unsigned int ii=0;ii<numMesh;ii++)
-//    {
-//        VectorRing &ring = triMesh[ii];
-//        unsigned int numPt = ring.size();
-//        [data appendBytes:&numPt length:sizeof(unsigned int)];
-//        for (unsigned int jj=0;jj<numPt;jj++)
-//        {
-//            Point2f &pt = ring[jj];
-//            [data appendBytes:&pt.x() length:sizeof(float)];
-//            [data appendBytes:&pt.y() length:sizeof(float)];
-//        }
-//    }
-//    
-//    return [cache writeLoftedPolyData:data cacheName:key];
+    if (!cache)
+        return false;
+
+    NSMutableData *data = [NSMutableData dataWithCapacity:0];
+
+    // MBR first
+    GeoCoord ll = shapeMbr.ll(), ur = shapeMbr.ur();
+    [data appendBytes:&ll.x() length:sizeof(float)];
+    [data appendBytes:&ll.y() length:sizeof(float)];
+    [data appendBytes:&ur.x() length:sizeof(float)];
+    [data appendBytes:&ur.y() length:sizeof(float)];
+
+    // Triangle mesh points
+    unsigned int numPt = (unsigned int)triMesh->pts.size();
+    [data appendBytes:&numPt length:sizeof(unsigned int)];
+    for (unsigned int ii=0;ii<numPt;ii++)
+    {
+        Point3f &pt = triMesh->pts[ii];
+        [data appendBytes:&pt.x() length:sizeof(float)];
+        [data appendBytes:&pt.y() length:sizeof(float)];
+        [data appendBytes:&pt.z() length:sizeof(float)];
+    }
+
+    // And the triangles
+    unsigned int numTri = (unsigned int)triMesh->tris.size();
+    [data appendBytes:&numTri length:sizeof(unsigned int)];
+    for (unsigned int ii=0;ii<numTri;ii++)
+        [data appendBytes:&triMesh->tris[ii].pts[0] length:3*sizeof(int)];
+
+    // Outlines, if they were built
+    unsigned int numOutline = (unsigned int)outlines.size();
+    [data appendBytes:&numOutline length:sizeof(unsigned int)];
+    for (unsigned int ii=0;ii<numOutline;ii++)
+    {
+        VectorRing &ring = outlines[ii];
+        unsigned int ringPt = (unsigned int)ring.size();
+        [data appendBytes:&ringPt length:sizeof(unsigned int)];
+        for (unsigned int jj=0;jj<ringPt;jj++)
+        {
+            Point2f &pt = ring[jj];
+            [data appendBytes:&pt.x() length:sizeof(float)];
+            [data appendBytes:&pt.y() length:sizeof(float)];
+        }
+    }
+
+    return [cache writeLoftedPolyData:data cacheName:key];
 }
 
+// Directed boundary segment, used to spot walls shared between polygons
+class LoftEdge
+{
+public:
+    LoftEdge(const Point2f &a,const Point2f &b) : x0(a.x()), y0(a.y()), x1(b.x()), y1(b.y()) { }
+    bool operator < (const LoftEdge &that) const
+    {
+        if (x0 == that.x0)
+        {
+            if (y0 == that.y0)
+            {
+                if (x1 == that.x1)
+                    return y1 < that.y1;
+                return x1 < that.x1;
+            }
+            return y0 < that.y0;
+        }
+        return x0 < that.x0;
+    }
+
+    float x0,y0,x1,y1;
+};
+typedef std::set<LoftEdge> LoftEdgeSet;
+
 /* Drawable Builder
  Used to construct drawables with multiple shapes in them.
  Eventually, will move this out to be a more generic object.
@@ -345,15 +410,15 @@ public:
         }
     }
     
-    void addSkirtPoints(VectorRing &pts)
+    void addSkirtPoints(VectorRing &pts,const LoftEdgeSet *interiorEdges)
     {
         CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
-        
+
         // Decide if we'll appending to an existing drawable or
         //  create a new one
         int ptCount = (int)(4*(pts.size()+1));
         setupDrawable(ptCount);
-        
+
         Point3f prevPt0,prevPt1,prevNorm,firstPt0,firstPt1,firstNorm;
         for (unsigned int jj=0;jj<pts.size();jj++)
         {
@@ -366,9 +431,12 @@ public:
             Point3f pt1 = pt0 + norm * polyInfo->height;
             if (polyInfo->base > 0.0)
                 pt0 = pt0 + norm * polyInfo->base;
-            
-            // Add to drawable
-            if (jj > 0)
+
+            // Add to drawable.  A wall shared with another polygon in the
+            //  group shows up once in each direction, so we look for the
+            //  same segment going the other way and drop the pair.
+            if (jj > 0 &&
+                !(interiorEdges && interiorEdges->find(LoftEdge(pts[jj],pts[jj-1])) != interiorEdges->end()))
             {
                 int startVert = drawable->getNumPoints();
                 drawable->addPoint(prevPt0);
@@ -444,6 +512,8 @@ public:
                     NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
                     drawable->setFade(curTime,curTime+polyInfo.fade);
                 }
+                if (polyInfo->optimizeTris)
+                    drawable->optimizeTriangles();
                 changes.push_back(new AddDrawableReq(drawable));
             } else
                 delete drawable;
@@ -488,6 +558,26 @@ void LoftManager::addGeometryToBuilder(LoftedPolySceneRep *sceneRep,WhirlyKitLof
     // Toss in the polygons for the sides
     if (polyInfo->height != 0.0)
     {
+        // Gather up all the boundary segments first.  Stacked polygons
+        //  (e.g. adjacent states) repeat their shared edges with opposite
+        //  winding and we can skip those walls entirely.
+        LoftEdgeSet edges;
+        if (polyInfo->side && sceneRep->shapes.size() > 1)
+        {
+            for (ShapeSet::iterator it = sceneRep->shapes.begin();
+                 it != sceneRep->shapes.end(); ++it)
+            {
+                VectorArealRef theAreal = boost::dynamic_pointer_cast<VectorAreal>(*it);
+                if (theAreal.get())
+                    for (unsigned int ri=0;ri<theAreal->loops.size();ri++)
+                    {
+                        VectorRing &ring = theAreal->loops[ri];
+                        for (unsigned int jj=1;jj<ring.size();jj++)
+                            edges.insert(LoftEdge(ring[jj-1],ring[jj]));
+                    }
+            }
+        }
+
         for (ShapeSet::iterator it = sceneRep->shapes.begin();
              it != sceneRep->shapes.end(); ++it)
         {
@@ -498,7 +588,7 @@ void LoftManager::addGeometryToBuilder(LoftedPolySceneRep *sceneRep,WhirlyKitLof
                 {
                     if (polyInfo->side)
                     {
-                        drawBuild.addSkirtPoints(theAreal->loops[ri]);
+                        drawBuild.addSkirtPoints(theAreal->loops[ri],(edges.empty() ? NULL : &edges));
                         numShapes++;
                     }
                 }
@@ -557,23 +647,41 @@ SimpleIdentity LoftManager::addLoftedPolys(WhirlyKit::ShapeSet *shapes,NSDiction
                     
                     if (coordAdapter->isFlat())
                     {
-                        // No grid to worry about, just tesselate
-                        TesselateRing(ring, sceneRep->triMesh);
+                        // No grid to worry about, just tesselate.  The
+                        //  shared cache covers the same ring coming back
+                        //  after a toggle.
+                        long long tessKey = TessellationCache::hashRing(TessellationCache::hashSeed(),ring);
+                        VectorTrianglesRef mesh = TessellationCache::getShared()->get(tessKey);
+                        if (!mesh.get())
+                        {
+                            mesh = VectorTriangles::createTriangles();
+                            TesselateRing(ring, mesh);
+                            TessellationCache::getShared()->add(tessKey,mesh);
+                        }
+                        AppendTriMesh(mesh,sceneRep->triMesh);
                     } else {
-                        // Clip the polys for the top
-                        std::vector<VectorRing> clippedMesh;
-                        ClipLoopToGrid(ring,Point2f(0.f,0.f),Point2f(gridSize,gridSize),clippedMesh);
-                        
                         // May need to add the outline as well
                         if (polyInfo->outline)
                             sceneRep->outlines.push_back(ring);
-                        
-                        for (unsigned int ii=0;ii<clippedMesh.size();ii++)
+
+                        long long tessKey = TessellationCache::hashFloat(TessellationCache::hashRing(TessellationCache::hashSeed(),ring),gridSize);
+                        VectorTrianglesRef mesh = TessellationCache::getShared()->get(tessKey);
+                        if (!mesh.get())
                         {
-                            VectorRing &ring = clippedMesh[ii];
-                            // Tesselate the ring, even if it's concave (it's concave a lot)
-                            TesselateRing(ring,sceneRep->triMesh);
+                            // Clip the polys for the top
+                            std::vector<VectorRing> clippedMesh;
+                            ClipLoopToGrid(ring,Point2f(0.f,0.f),Point2f(gridSize,gridSize),clippedMesh);
+
+                            mesh = VectorTriangles::createTriangles();
+                            for (unsigned int ii=0;ii<clippedMesh.size();ii++)
+                            {
+                                VectorRing &clipRing = clippedMesh[ii];
+                                // Tesselate the ring, even if it's concave (it's concave a lot)
+                                TesselateRing(clipRing,mesh);
+                            }
+                            TessellationCache::getShared()->add(tessKey,mesh);
                         }
+                        AppendTriMesh(mesh,sceneRep->triMesh);
                     }
                 }
             }
@@ -635,9 +743,7 @@ void LoftManager::removeLoftedPolys(SimpleIDSet &polyIDs,ChangeSet &changes)
             {
                 NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
                                 
-                for (SimpleIDSet::iterator idIt = sceneRep->drawIDs.begin();
-                     idIt != sceneRep->drawIDs.end(); ++idIt)
-                    changes.push_back(new FadeChangeRequest(*idIt,curTime,curTime+sceneRep->fade));
+                changes.push_back(new FadeGangChangeRequest(sceneRep->drawIDs,curTime,curTime+sceneRep->fade));
                 
                 // Kick off the delete in a bit
                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, sceneRep->fade * NSEC_PER_SEC),
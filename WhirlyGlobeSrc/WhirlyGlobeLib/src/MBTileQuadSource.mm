@@ -18,14 +18,28 @@
  *
  */
 
+#import <algorithm>
+#import <map>
+#import <set>
 #import "MBTileQuadSource.h"
 #import "GlobeLayerViewWatcher.h"
+#import "GlobeAnimatePath.h"
 
 using namespace WhirlyKit;
 
+// Most tiles the readahead cache will hold at once
+static const unsigned int MaxTileCacheSize = 512;
+
 @implementation WhirlyKitMBTileQuadSource
 {
     bool tilesStyles;
+    NSString *dbPath;
+    // Tiles the readahead pass has pulled into memory
+    pthread_mutex_t cacheLock;
+    std::map<Quadtree::Identifier,NSData *> tileCache;
+    // Background readahead runs here on its own connections
+    dispatch_queue_t readQueue;
+    sqlhelpers::ConnectionPool *readPool;
 }
 
 - (id)initWithPath:(NSString *)path
@@ -34,7 +48,11 @@ using namespace WhirlyKit;
     if (self)
     {
         _coordSys = new SphericalMercatorCoordSystem();
-        
+        dbPath = path;
+        pthread_mutex_init(&cacheLock,NULL);
+        readQueue = dispatch_queue_create("MBTiles readahead",NULL);
+        readPool = NULL;
+
         // Open the sqlite DB
         if (sqlite3_open([path cStringUsingEncoding:NSASCIIStringEncoding],&_sqlDb) != SQLITE_OK)
         {
@@ -109,14 +127,22 @@ using namespace WhirlyKit;
     if (_coordSys)
         delete _coordSys;
     _coordSys = nil;
-    
+
     if (_sqlDb)
-        sqlite3_close(_sqlDb);        
+        sqlite3_close(_sqlDb);
+
+    if (readPool)
+        delete readPool;
+    readPool = NULL;
+    pthread_mutex_destroy(&cacheLock);
 }
 
 - (void)shutdown
 {
-    // Nothing much to do here
+    // Drop whatever the readahead pulled in
+    pthread_mutex_lock(&cacheLock);
+    tileCache.clear();
+    pthread_mutex_unlock(&cacheLock);
 }
 
 - (WhirlyKit::CoordSystem *)coordSystem
@@ -134,7 +160,7 @@ using namespace WhirlyKit;
     return _mbr;
 }
 
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)tileMbr viewInfo:(WhirlyKitViewState *)viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(NSMutableDictionary *)attrs
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)tileMbr viewInfo:(WhirlyKitViewState *)viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs
 {
     // Everything at the top is loaded in, so be careful
     if (ident.level == _minZoom)
@@ -156,23 +182,36 @@ using namespace WhirlyKit;
 - (void)quadTileLoader:(WhirlyKitQuadTileLoader *)quadLoader startFetchForLevel:(int)level col:(int)col row:(int)row attrs:(NSMutableDictionary *)attrs
 {
     NSData *imageData = nil;
-    
-    if (tilesStyles)
+
+    // If the readahead got there first, we never touch the database
+    pthread_mutex_lock(&cacheLock);
+    std::map<Quadtree::Identifier,NSData *>::iterator it = tileCache.find(Quadtree::Identifier(col,row,level));
+    if (it != tileCache.end())
     {
-        sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from tiles where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",level,col,row]);
-        if (readStmt.stepRow())
-            imageData = readStmt.getBlob();
-    } else {
-        sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_id from map where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",level,col,row]);
-        if (readStmt.stepRow())
+        imageData = it->second;
+        tileCache.erase(it);
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    if (!imageData)
+    {
+        if (tilesStyles)
         {
-            NSString *tile_id = readStmt.getString();
-            sqlhelpers::StatementRead readStmt2(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from images where tile_id='%@';",tile_id]);
-            if (readStmt2.stepRow())
-                imageData = readStmt2.getBlob();
+            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from tiles where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",level,col,row]);
+            if (readStmt.stepRow())
+                imageData = readStmt.getBlob();
+        } else {
+            sqlhelpers::StatementRead readStmt(_sqlDb,[NSString stringWithFormat:@"SELECT tile_id from map where zoom_level='%d' AND tile_column='%d' AND tile_row='%d';",level,col,row]);
+            if (readStmt.stepRow())
+            {
+                NSString *tile_id = readStmt.getString();
+                sqlhelpers::StatementRead readStmt2(_sqlDb,[NSString stringWithFormat:@"SELECT tile_data from images where tile_id='%@';",tile_id]);
+                if (readStmt2.stepRow())
+                    imageData = readStmt2.getBlob();
+            }
         }
     }
-    
+
 //    if (!imageData)
 //        NSLog(@"Missing tile: (%d,%d,%d)",col,row,level);
     
@@ -185,5 +224,107 @@ using namespace WhirlyKit;
     [quadLoader dataSource:self loadedImage:tileData forLevel:level col:col row:row];
 }
 
+// Pull the given tiles into the RAM cache in one background pass
+- (void)readaheadTiles:(const std::vector<WhirlyKit::Quadtree::Identifier> &)tileIDs
+{
+    if (tileIDs.empty())
+        return;
+    // The readahead runs on its own connections, away from the fetch path
+    if (!readPool)
+        readPool = new sqlhelpers::ConnectionPool(dbPath);
+
+    // Copy for the block.  Sorted order keeps the page reads sequential
+    std::vector<Quadtree::Identifier> tiles = tileIDs;
+    std::sort(tiles.begin(),tiles.end());
+
+    dispatch_async(readQueue,
+    ^{
+        sqlite3 *conn = readPool->getForThread();
+        if (!conn)
+            return;
+        sqlhelpers::StatementCache stmtCache(conn);
+        for (unsigned int ii=0;ii<tiles.size();ii++)
+        {
+            const Quadtree::Identifier &tileID = tiles[ii];
+
+            // Skip what we already have and stop stuffing the cache if it's full
+            pthread_mutex_lock(&cacheLock);
+            bool skip = (tileCache.find(tileID) != tileCache.end() || tileCache.size() >= MaxTileCacheSize);
+            pthread_mutex_unlock(&cacheLock);
+            if (skip)
+                continue;
+
+            NSData *imageData = nil;
+            if (tilesStyles)
+            {
+                sqlhelpers::StatementRead readStmt(stmtCache,"SELECT tile_data from tiles where zoom_level=? AND tile_column=? AND tile_row=?;");
+                readStmt.add(tileID.level);  readStmt.add(tileID.x);  readStmt.add(tileID.y);
+                if (readStmt.stepRow())
+                    imageData = readStmt.getBlob();
+            } else {
+                sqlhelpers::StatementRead readStmt(stmtCache,"SELECT tile_id from map where zoom_level=? AND tile_column=? AND tile_row=?;");
+                readStmt.add(tileID.level);  readStmt.add(tileID.x);  readStmt.add(tileID.y);
+                if (readStmt.stepRow())
+                {
+                    NSString *tile_id = readStmt.getString();
+                    sqlhelpers::StatementRead readStmt2(stmtCache,"SELECT tile_data from images where tile_id=?;");
+                    readStmt2.add(tile_id);
+                    if (readStmt2.stepRow())
+                        imageData = readStmt2.getBlob();
+                }
+            }
+
+            if (imageData)
+            {
+                pthread_mutex_lock(&cacheLock);
+                if (tileCache.size() < MaxTileCacheSize)
+                    tileCache[tileID] = imageData;
+                pthread_mutex_unlock(&cacheLock);
+            }
+        }
+    });
+}
+
+// Figure out which tiles a flyover is going to want and read them ahead
+- (void)readaheadForPath:(WhirlyGlobeAnimateViewPath *)path numSamples:(int)numSamples
+{
+    if (!path || numSamples < 2)
+        return;
+
+    std::set<Quadtree::Identifier> tileSet;
+    for (int ii=0;ii<numSamples;ii++)
+    {
+        double t = ii / (double)(numSamples-1);
+        Eigen::Quaterniond rot;
+        double height;
+        [path sampleAtT:t rot:rot height:height];
+
+        // Point under the viewer on the unit sphere
+        Vector3d up = [WhirlyGlobeView prospectiveUp:rot];
+        GeoCoord geoCoord(atan2(up.y(),up.x()),asin(up.z()));
+
+        // Pick a zoom level that roughly matches what's on screen at that height
+        int level = (int)floor(log2(2*M_PI/height));
+        level = std::min(_maxZoom,std::max(_minZoom,level));
+        int numTiles = 1<<level;
+
+        // The tile under the sample and its neighbors cover the view
+        Point3f local = _coordSys->geographicToLocal(geoCoord);
+        int tileX = (local.x()-_mbr.ll().x())/(_mbr.ur().x()-_mbr.ll().x())*numTiles;
+        int tileY = (local.y()-_mbr.ll().y())/(_mbr.ur().y()-_mbr.ll().y())*numTiles;
+        for (int ix=tileX-1;ix<=tileX+1;ix++)
+            for (int iy=tileY-1;iy<=tileY+1;iy++)
+            {
+                if (ix < 0 || iy < 0 || ix >= numTiles || iy >= numTiles)
+                    continue;
+                tileSet.insert(Quadtree::Identifier(ix,iy,level));
+            }
+    }
+
+    std::vector<Quadtree::Identifier> tileIDs;
+    tileIDs.insert(tileIDs.end(),tileSet.begin(),tileSet.end());
+    [self readaheadTiles:tileIDs];
+}
+
 
 @end
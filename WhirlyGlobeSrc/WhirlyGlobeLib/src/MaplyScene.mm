@@ -32,7 +32,8 @@ MapScene::MapScene(WhirlyKit::CoordSystemDisplayAdapter *coordAdapter)
     
 void MapScene::addDrawable(DrawableRef draw)
 {
-    drawables.insert(draw);
+    drawables[draw->getId()] = draw;
+    renderStateBuckets.addDrawable(draw);
     
     // Dump it in the top level for now
     Mbr localMbr = draw->getLocalMbr();
@@ -41,11 +42,11 @@ void MapScene::addDrawable(DrawableRef draw)
 
 void MapScene::remDrawable(DrawableRef draw)
 {
-    // We're expecting it to just be at the top level
-    Mbr localMbr = draw->getLocalMbr();
-    cullTree->getTopCullable()->remDrawable(cullTree, localMbr, draw);
-    
-    drawables.erase(draw);
+    // The cull tree remembers where the drawable went
+    cullTree->remDrawable(draw);
+
+    renderStateBuckets.remDrawable(draw);
+    drawables.erase(draw->getId());
 }
     
 }
@@ -210,8 +210,7 @@ using namespace WhirlyKit;
     
     // Run the screen point and the eye point (origin) back through
     //  the model matrix to get a direction and origin in model space
-    Eigen::Matrix4d modelTrans = *transform;
-    Matrix4d invModelMat = modelTrans.inverse();
+    Matrix4d invModelMat = [self cachedMatrixInverse:*transform];
     Point3d eyePt(0,0,0);
     Vector4d modelEye = invModelMat * Vector4d(eyePt.x(),eyePt.y(),eyePt.z(),1.0);
     Vector4d modelScreenPt = invModelMat * Vector4d(screenPt.x(),screenPt.y(),screenPt.z(),1.0);
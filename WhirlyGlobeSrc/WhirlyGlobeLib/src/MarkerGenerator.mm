@@ -140,7 +140,7 @@ void MarkerGenerator::addMarker(Marker *marker)
     markers.insert(marker);
 }
     
-void MarkerGenerator::addMarkers(std::vector<Marker *> inMarkers)
+void MarkerGenerator::addMarkers(const std::vector<Marker *> &inMarkers)
 {
     markers.insert(inMarkers.begin(),inMarkers.end());
 }
@@ -223,7 +223,13 @@ MarkerGeneratorAddRequest::MarkerGeneratorAddRequest(SimpleIdentity genId,Marker
 
 MarkerGeneratorAddRequest::MarkerGeneratorAddRequest(SimpleIdentity genId,const std::vector<MarkerGenerator::Marker *> &markers)
     : GeneratorChangeRequest(genId), markers(markers)
-{    
+{
+}
+
+MarkerGeneratorAddRequest::MarkerGeneratorAddRequest(SimpleIdentity genId,std::vector<MarkerGenerator::Marker *> &&inMarkers)
+    : GeneratorChangeRequest(genId)
+{
+    markers.swap(inMarkers);
 }
 
 MarkerGeneratorAddRequest::~MarkerGeneratorAddRequest()
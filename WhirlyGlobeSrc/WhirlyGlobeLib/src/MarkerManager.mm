@@ -24,10 +24,14 @@
 #import "MarkerGenerator.h"
 #import "ScreenSpaceGenerator.h"
 #import "LayoutManager.h"
+#import "DefaultShaderPrograms.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
 
+// Most animation frames the marker animation shader carries per vertex
+static const unsigned int MaxAnimShaderFrames = 4;
+
 namespace WhirlyKit
 {
     
@@ -91,6 +95,7 @@ void MarkerSceneRep::clearContents(SelectionManager *selectManager,LayoutManager
         changes.push_back(new ScreenSpaceGeneratorRemRequest(screenGenId, screenIDVec));
     }
     screenShapeIDs.clear();
+    screenShapeOrder.clear();
     
     if (selectManager && !selectIDs.empty())
         selectManager->removeSelectables(selectIDs);
@@ -112,6 +117,7 @@ void MarkerSceneRep::clearContents(SelectionManager *selectManager,LayoutManager
         _isSelectable = false;
         _selectID = EmptyIdentity;
         _layoutImportance = MAXFLOAT;
+        _layoutClusterGroup = -1;
     }
     
     return self;
@@ -179,28 +185,39 @@ typedef std::map<SimpleIdentity,BasicDrawable *> DrawableMap;
 
 SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,ChangeSet &changes)
 {
-    WhirlyKitMarkerInfo *markerInfo = [[WhirlyKitMarkerInfo alloc] initWithMarkers:markers desc:desc];
+    WhirlyKitMarkerInfo *markerInfo = [[WhirlyKitMarkerInfo alloc] initWithMarkers:nil desc:desc];
+
+    return addMarkers(markers,markerInfo,changes);
+}
 
+SimpleIdentity MarkerManager::addMarkers(NSArray *markers,WhirlyKitMarkerInfo *markerInfo,ChangeSet &changes)
+{
     SelectionManager *selectManager = (SelectionManager *)scene->getManager(kWKSelectionManager);
     LayoutManager *layoutManager = (LayoutManager *)scene->getManager(kWKLayoutManager);
     NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
-    
+
     CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
     MarkerSceneRep *markerRep = new MarkerSceneRep();
     markerRep->fade = markerInfo.fade;
-    markerRep->setId(markerInfo.markerId);
+    // The info may be shared across adds, so the rep gets its own ID
+    markerRep->setId(Identifiable::genId());
     
     // For static markers, sort by texture
     DrawableMap drawables;
     std::vector<MarkerGenerator::Marker *> markersToAdd;
     
+    // Markers the animation shader can run, also sorted by texture
+    DrawableMap animDrawables;
+    std::map<SimpleIdentity,int> animAttrIds;
+    SimpleIdentity animProgID = scene->getProgramIDBySceneName(kToolkitDefaultMarkerAnimProgram);
+    
     // Screen space markers
     std::vector<ScreenSpaceGenerator::ConvexShape *> screenShapes;
     
     // Objects to be controlled by the layout layer
     std::vector<LayoutObject> layoutObjects;
     
-    for (WhirlyKitMarker *marker in markerInfo.markers)
+    for (WhirlyKitMarker *marker in markers)
     {
         // Build the rectangle for this one
         Point3f pts[4];
@@ -310,6 +327,7 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
                 shape->geom.push_back(smGeom);
                 screenShapes.push_back(shape);
                 markerRep->screenShapeIDs.insert(shape->getId());
+                markerRep->screenShapeOrder.push_back(shape->getId());
                 
                 // Set up for the layout layer
                 if (layoutManager && marker.layoutImportance != MAXFLOAT)
@@ -320,6 +338,7 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
                     layoutObj.size = Point2f(2*width2,2*height2);
                     layoutObj.iconSize = Point2f(0.0,0.0);
                     layoutObj.importance = marker.layoutImportance;
+                    layoutObj.clusterGroup = marker.layoutClusterGroup;
                     layoutObj.minVis = markerInfo.minVis;
                     layoutObj.maxVis = markerInfo.maxVis;
                     // No moving it around
@@ -329,6 +348,7 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
                     
                     // Start out off, let the layout layer handle the rest
                     shape->enable = markerInfo.enable;
+                    shape->layout = true;
                     shape->offset = Point2d(MAXFLOAT,MAXFLOAT);
                 } else
                     shape->offset = marker.offset;
@@ -370,6 +390,98 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
                 draw->addTriangle(BasicDrawable::Triangle(2+vOff,3+vOff,0+vOff));
             }
         } else {
+            // The marker changes textures over time.  If the frames all
+            //  live in the same texture and there aren't too many, the
+            //  shader can pick the frame off the time uniform and we pay
+            //  no per-frame CPU at all.  Otherwise it goes to the generator.
+            bool useAnimShader = !markerInfo.screenObject && animProgID != EmptyIdentity &&
+                marker.period > 0.0 && marker.texIDs.size() <= MaxAnimShaderFrames;
+            std::vector<SubTexture> subTexes;
+            if (useAnimShader)
+                for (unsigned int ii=0;ii<marker.texIDs.size();ii++)
+                {
+                    SubTexture subTex = scene->getSubTexture(marker.texIDs.at(ii));
+                    if (!subTexes.empty() && subTex.texId != subTexes[0].texId)
+                    {
+                        useAnimShader = false;
+                        break;
+                    }
+                    subTexes.push_back(subTex);
+                }
+
+            if (useAnimShader)
+            {
+                unsigned int numFrames = (unsigned int)subTexes.size();
+
+                // One set of texture coordinates per frame
+                std::vector<TexCoord> baseTexCoord;
+                baseTexCoord.resize(4);
+                baseTexCoord[0].u() = 0.0;  baseTexCoord[0].v() = 0.0;
+                baseTexCoord[1].u() = 1.0;  baseTexCoord[1].v() = 0.0;
+                baseTexCoord[2].u() = 1.0;  baseTexCoord[2].v() = 1.0;
+                baseTexCoord[3].u() = 0.0;  baseTexCoord[3].v() = 1.0;
+                std::vector<std::vector<TexCoord> > frameTexCoords;
+                for (unsigned int ii=0;ii<numFrames;ii++)
+                {
+                    std::vector<TexCoord> theseTexCoord = baseTexCoord;
+                    subTexes[ii].processTexCoords(theseTexCoord);
+                    frameTexCoords.push_back(theseTexCoord);
+                }
+
+                // We're sorting these by texture, like the static drawables
+                DrawableMap::iterator it = animDrawables.find(subTexes[0].texId);
+                BasicDrawable *draw = NULL;
+                int animAttrId = -1;
+                if (it != animDrawables.end())
+                {
+                    draw = it->second;
+                    animAttrId = animAttrIds[subTexes[0].texId];
+                } else {
+                    draw = new BasicDrawable("Marker Layer Anim");
+                    draw->setType(GL_TRIANGLES);
+                    draw->setDrawOffset(markerInfo.drawOffset);
+                    draw->setDrawPriority(markerInfo.drawPriority);
+                    draw->setVisibleRange(markerInfo.minVis, markerInfo.maxVis);
+                    draw->setTexId(0,subTexes[0].texId);
+                    draw->setProgram(animProgID);
+                    draw->setOnOff(markerInfo.enable);
+                    animAttrId = draw->addAttribute(BDFloat3Type,"a_animInfo");
+                    animDrawables[subTexes[0].texId] = draw;
+                    animAttrIds[subTexes[0].texId] = animAttrId;
+                    markerRep->drawIDs.insert(draw->getId());
+                }
+
+                RGBAColor color = [markerInfo.color asRGBAColor];
+                if (marker.color)
+                    color = [marker.color asRGBAColor];
+
+                // Phase stays within a period so it survives the float attribute
+                float phase = fmod(marker.timeOffset,marker.period);
+
+                // Toss the geometry into the drawable
+                int vOff = draw->getNumPoints();
+                for (unsigned int ii=0;ii<4;ii++)
+                {
+                    Point3f &pt = pts[ii];
+                    draw->addPoint(pt);
+                    draw->addNormal(Vector3dToVector3f(norm));
+                    draw->addColor(color);
+                    // Unused frame channels just repeat the first frame
+                    for (unsigned int ff=0;ff<MaxAnimShaderFrames;ff++)
+                        draw->addTexCoord(ff,frameTexCoords[ff < numFrames ? ff : 0][ii]);
+                    draw->addAttributeValue(animAttrId,Vector3f(phase,marker.period,(float)numFrames));
+                    Mbr localMbr = draw->getLocalMbr();
+                    Point3f localLoc = coordAdapter->getCoordSystem()->geographicToLocal(marker.loc);
+                    localMbr.addPoint(Point2f(localLoc.x(),localLoc.y()));
+                    draw->setLocalMbr(localMbr);
+                }
+
+                draw->addTriangle(BasicDrawable::Triangle(0+vOff,1+vOff,2+vOff));
+                draw->addTriangle(BasicDrawable::Triangle(2+vOff,3+vOff,0+vOff));
+
+                continue;
+            }
+
             // The marker changes textures, so we need to pass it to the generator
             MarkerGenerator::Marker *newMarker = new MarkerGenerator::Marker();
             newMarker->enable = true;
@@ -417,7 +529,7 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
     
     // Add all the new markers at once
     if (!markersToAdd.empty())
-        changes.push_back(new MarkerGeneratorAddRequest(generatorId,markersToAdd));
+        changes.push_back(new MarkerGeneratorAddRequest(generatorId,std::move(markersToAdd)));
         
     // Flush out any drawables for the static geometry
     for (DrawableMap::iterator it = drawables.begin();
@@ -432,9 +544,22 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
     }
     drawables.clear();
     
+    // And the drawables the animation shader runs
+    for (DrawableMap::iterator it = animDrawables.begin();
+         it != animDrawables.end(); ++it)
+    {
+        if (markerInfo.fade > 0.0)
+        {
+            NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
+            it->second->setFade(curTime,curTime+markerInfo.fade);
+        }
+        changes.push_back(new AddDrawableReq(it->second));
+    }
+    animDrawables.clear();
+    
     // Add all the screen space markers at once
     if (!screenShapes.empty())
-        changes.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,screenShapes));
+        changes.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,std::move(screenShapes)));
     screenShapes.clear();
             
     // And any layout constraints to the layout engine
@@ -444,7 +569,196 @@ SimpleIdentity MarkerManager::addMarkers(NSArray *markers,NSDictionary *desc,Cha
     pthread_mutex_lock(&markerLock);
     markerReps.insert(markerRep);
     pthread_mutex_unlock(&markerLock);
-    
+
+    return markerRep->getId();
+}
+
+// Sub-texture info we look up once per unique texture in the bulk add path
+class MarkerTexInfo
+{
+public:
+    SubTexture subTex;
+    std::vector<TexCoord> texCoords;
+};
+typedef std::map<SimpleIdentity,MarkerTexInfo> MarkerTexInfoMap;
+
+SimpleIdentity MarkerManager::addMarkers(const std::vector<SimpleMarker> &markers,NSDictionary *desc,ChangeSet &changes)
+{
+    WhirlyKitMarkerInfo *markerInfo = [[WhirlyKitMarkerInfo alloc] initWithMarkers:nil desc:desc];
+
+    SelectionManager *selectManager = (SelectionManager *)scene->getManager(kWKSelectionManager);
+    NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
+
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+    MarkerSceneRep *markerRep = new MarkerSceneRep();
+    markerRep->fade = markerInfo.fade;
+    markerRep->setId(markerInfo.markerId);
+
+    // Resolve each unique sub-texture exactly once.
+    // With a big batch the per-marker lookup is all mutex traffic.
+    MarkerTexInfoMap texInfoMap;
+    for (unsigned int ii=0;ii<markers.size();ii++)
+    {
+        SimpleIdentity texID = markers[ii].texID;
+        if (texInfoMap.find(texID) == texInfoMap.end())
+        {
+            MarkerTexInfo texInfo;
+            texInfo.subTex = scene->getSubTexture(texID);
+            texInfo.texCoords.push_back(TexCoord(0.0,0.0));
+            texInfo.texCoords.push_back(TexCoord(1.0,0.0));
+            texInfo.texCoords.push_back(TexCoord(1.0,1.0));
+            texInfo.texCoords.push_back(TexCoord(0.0,1.0));
+            texInfo.subTex.processTexCoords(texInfo.texCoords);
+            texInfoMap[texID] = texInfo;
+        }
+    }
+
+    // For static markers, sort by texture
+    DrawableMap drawables;
+
+    // Screen space markers
+    std::vector<ScreenSpaceGenerator::ConvexShape *> screenShapes;
+    if (markerInfo.screenObject)
+        screenShapes.reserve(markers.size());
+
+    for (unsigned int mi=0;mi<markers.size();mi++)
+    {
+        const SimpleMarker &marker = markers[mi];
+
+        // Build the rectangle for this one
+        Point3f pts[4];
+        Vector3d norm;
+        float width2 = (marker.width == 0.0 ? markerInfo.width : marker.width)/2.0;
+        float height2 = (marker.height == 0.0 ? markerInfo.height : marker.height)/2.0;
+
+        Point3d localPt = coordAdapter->getCoordSystem()->geographicToLocal3d(marker.loc);
+        norm = coordAdapter->normalForLocal(localPt);
+
+        if (markerInfo.screenObject)
+        {
+            pts[0] = Point3f(-width2,-height2,0.0);
+            pts[1] = Point3f(width2,-height2,0.0);
+            pts[2] = Point3f(width2,height2,0.0);
+            pts[3] = Point3f(-width2,height2,0.0);
+        } else {
+            Point3d center = coordAdapter->localToDisplay(localPt);
+            Vector3d up(0,0,1);
+            Point3d horiz,vert;
+            if (coordAdapter->isFlat())
+            {
+                horiz = Point3d(1,0,0);
+                vert = Point3d(0,1,0);
+            } else {
+                horiz = up.cross(norm).normalized();
+                vert = norm.cross(horiz).normalized();
+            }
+
+            Point3d ll = center - width2*horiz - height2*vert;
+            pts[0] = Vector3dToVector3f(ll);
+            pts[1] = Vector3dToVector3f(ll + 2 * width2 * horiz);
+            pts[2] = Vector3dToVector3f(ll + 2 * width2 * horiz + 2 * height2 * vert);
+            pts[3] = Vector3dToVector3f(ll + 2 * height2 * vert);
+        }
+
+        // While we're at it, let's add this to the selection layer
+        if (selectManager && marker.selectID != EmptyIdentity)
+        {
+            markerRep->selectIDs.insert(marker.selectID);
+            if (markerInfo.screenObject)
+            {
+                Point2f pts2d[4];
+                for (unsigned int jj=0;jj<4;jj++)
+                    pts2d[jj] = Point2f(pts[jj].x(),pts[jj].y());
+                selectManager->addSelectableScreenRect(marker.selectID,pts2d,markerInfo.minVis,markerInfo.maxVis,markerInfo.enable);
+            } else
+                selectManager->addSelectableRect(marker.selectID,pts,markerInfo.minVis,markerInfo.maxVis,markerInfo.enable);
+        }
+
+        const MarkerTexInfo &texInfo = texInfoMap[marker.texID];
+
+        if (markerInfo.screenObject)
+        {
+            ScreenSpaceGenerator::SimpleGeometry smGeom;
+            smGeom.texID = texInfo.subTex.texId;
+            smGeom.programID = markerInfo.programId;
+            smGeom.color = [markerInfo.color asRGBAColor];
+            for (unsigned int ii=0;ii<4;ii++)
+            {
+                smGeom.coords.push_back(Point2d(pts[ii].x(),pts[ii].y()));
+                smGeom.texCoords.push_back(texInfo.texCoords[ii]);
+            }
+            ScreenSpaceGenerator::ConvexShape *shape = new ScreenSpaceGenerator::ConvexShape();
+            if (marker.selectID != EmptyIdentity)
+                shape->setId(marker.selectID);
+            shape->worldLoc = coordAdapter->localToDisplay(localPt);
+            if (markerInfo.fade > 0.0)
+            {
+                shape->fadeDown = curTime;
+                shape->fadeUp = curTime+markerInfo.fade;
+            }
+            shape->minVis = markerInfo.minVis;
+            shape->maxVis = markerInfo.maxVis;
+            shape->drawPriority = markerInfo.drawPriority;
+            shape->enable = markerInfo.enable;
+            shape->geom.push_back(smGeom);
+            screenShapes.push_back(shape);
+            markerRep->screenShapeIDs.insert(shape->getId());
+            markerRep->screenShapeOrder.push_back(shape->getId());
+        } else {
+            // We're sorting the static drawables by texture, so look for that
+            DrawableMap::iterator it = drawables.find(texInfo.subTex.texId);
+            BasicDrawable *draw = NULL;
+            if (it != drawables.end())
+                draw = it->second;
+            else {
+                draw = new BasicDrawable("Marker Layer");
+                draw->setType(GL_TRIANGLES);
+                draw->setDrawOffset(markerInfo.drawOffset);
+                draw->setColor([markerInfo.color asRGBAColor]);
+                draw->setDrawPriority(markerInfo.drawPriority);
+                draw->setVisibleRange(markerInfo.minVis, markerInfo.maxVis);
+                draw->setTexId(0,texInfo.subTex.texId);
+                draw->setOnOff(markerInfo.enable);
+                drawables[texInfo.subTex.texId] = draw;
+                markerRep->drawIDs.insert(draw->getId());
+            }
+
+            // Toss the geometry into the drawable
+            int vOff = draw->getNumPoints();
+            for (unsigned int ii=0;ii<4;ii++)
+            {
+                draw->addPoint(pts[ii]);
+                draw->addNormal(Vector3dToVector3f(norm));
+                draw->addTexCoord(0,texInfo.texCoords[ii]);
+            }
+            Mbr localMbr = draw->getLocalMbr();
+            localMbr.addPoint(Point2f(localPt.x(),localPt.y()));
+            draw->setLocalMbr(localMbr);
+
+            draw->addTriangle(BasicDrawable::Triangle(0+vOff,1+vOff,2+vOff));
+            draw->addTriangle(BasicDrawable::Triangle(2+vOff,3+vOff,0+vOff));
+        }
+    }
+
+    // Flush out any drawables for the static geometry
+    for (DrawableMap::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+    {
+        if (markerInfo.fade > 0.0)
+            it->second->setFade(curTime,curTime+markerInfo.fade);
+        changes.push_back(new AddDrawableReq(it->second));
+    }
+    drawables.clear();
+
+    // Add all the screen space markers at once
+    if (!screenShapes.empty())
+        changes.push_back(new ScreenSpaceGeneratorAddRequest(screenGenId,std::move(screenShapes)));
+    screenShapes.clear();
+
+    pthread_mutex_lock(&markerLock);
+    markerReps.insert(markerRep);
+    pthread_mutex_unlock(&markerLock);
+
     return markerInfo.markerId;
 }
 
@@ -470,6 +784,48 @@ void MarkerManager::enableMarkers(SimpleIDSet &markerIDs,bool enable,ChangeSet &
     pthread_mutex_unlock(&markerLock);
 }
 
+void MarkerManager::updateScreenMarkers(SimpleIDSet &markerIDs,const std::vector<Point3d> &worldLocs,const std::vector<RGBAColor> &colors,ChangeSet &changes)
+{
+    std::vector<ScreenSpaceGeneratorMoveRequest::ShapeMove> moves;
+    moves.reserve(worldLocs.size());
+
+    pthread_mutex_lock(&markerLock);
+
+    // Walk the marker sets in the order they were created, handing out
+    //  the new locations as we go
+    unsigned int which = 0;
+    for (SimpleIDSet::iterator mit = markerIDs.begin();mit != markerIDs.end(); ++mit)
+    {
+        MarkerSceneRep dummyRep;
+        dummyRep.setId(*mit);
+        MarkerSceneRepSet::iterator it = markerReps.find(&dummyRep);
+        if (it != markerReps.end())
+        {
+            MarkerSceneRep *markerRep = *it;
+            for (unsigned int si=0;si<markerRep->screenShapeOrder.size();si++)
+            {
+                if (which >= worldLocs.size())
+                    break;
+                ScreenSpaceGeneratorMoveRequest::ShapeMove move;
+                move.shapeID = markerRep->screenShapeOrder[si];
+                move.worldLoc = worldLocs[which];
+                if (which < colors.size())
+                {
+                    move.hasColor = true;
+                    move.color = colors[which];
+                }
+                moves.push_back(move);
+                which++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&markerLock);
+
+    if (!moves.empty())
+        changes.push_back(new ScreenSpaceGeneratorMoveRequest(screenGenId,moves));
+}
+
 void MarkerManager::removeMarkers(SimpleIDSet &markerIDs,ChangeSet &changes)
 {
     SelectionManager *selectManager = (SelectionManager *)scene->getManager(kWKSelectionManager);
@@ -490,9 +846,7 @@ void MarkerManager::removeMarkers(SimpleIDSet &markerIDs,ChangeSet &changes)
             if (markerRep->fade > 0.0)
             {
                 NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
-                for (SimpleIDSet::iterator idIt = markerRep->drawIDs.begin();
-                     idIt != markerRep->drawIDs.end(); ++idIt)
-                    changes.push_back(new FadeChangeRequest(*idIt,curTime,curTime+markerRep->fade));
+                changes.push_back(new FadeGangChangeRequest(markerRep->drawIDs,curTime,curTime+markerRep->fade));
                 
                 if (!markerRep->markerIDs.empty())
                 {
@@ -536,6 +890,24 @@ void MarkerManager::removeMarkers(SimpleIDSet &markerIDs,ChangeSet &changes)
     pthread_mutex_unlock(&markerLock);
 }
 
+void MarkerManager::memoryCensus(MemoryCensusEntry &entry)
+{
+    pthread_mutex_lock(&markerLock);
+
+    entry.count = markerReps.size();
+    for (MarkerSceneRepSet::iterator it = markerReps.begin();
+         it != markerReps.end(); ++it)
+    {
+        MarkerSceneRep *markerRep = *it;
+        entry.bytes += sizeof(MarkerSceneRep) +
+            (markerRep->drawIDs.size() + markerRep->selectIDs.size() +
+             markerRep->markerIDs.size() + markerRep->screenShapeIDs.size() +
+             markerRep->screenShapeOrder.size()) * sizeof(SimpleIdentity);
+    }
+
+    pthread_mutex_unlock(&markerLock);
+}
+
 void MarkerManager::setScene(Scene *inScene)
 {
     SceneManager::setScene(inScene);
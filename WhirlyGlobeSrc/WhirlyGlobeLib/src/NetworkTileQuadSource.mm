@@ -75,7 +75,7 @@ using namespace WhirlyKit;
     return maxZoom;
 }
 
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)tileMbr viewInfo:(WhirlyKitViewState *)viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(NSMutableDictionary *)attrs
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(WhirlyKit::Mbr)tileMbr viewInfo:(WhirlyKitViewState *)viewState frameSize:(WhirlyKit::Point2f)frameSize attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs
 {
     // Everything at the top is loaded in, so be careful
     if (ident.level == minZoom)
@@ -144,8 +144,12 @@ using namespace WhirlyKit;
     // Let's just do this in a block
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), 
                    ^{
+                       // The tile may have been unloaded while we sat in the queue
+                       if (![quadLoader tileIsWantedLevel:level col:col row:row])
+                           return;
+
                        NSData *imgData;
-                       
+
                        // Look for it in the local cache first
                        NSString *localName = nil;
                        if (self.cacheDir)
@@ -175,12 +179,16 @@ using namespace WhirlyKit;
                            if (imgData && localName)
                                [imgData writeToFile:localName atomically:YES];
                        }
-                       
+
+                       // Check again after the fetch.  No point handing back a tile nobody wants.
+                       if (![quadLoader tileIsWantedLevel:level col:col row:row])
+                           return;
+
                        // Look for elevation
                        WhirlyKitElevationChunk *elevChunk = nil;
                        if (self.elevDelegate)
                            elevChunk = [self.elevDelegate elevForLevel:level col:col row:row];
-                       
+
                        // Let the loader know what's up
                        NSArray *args = [NSArray arrayWithObjects:quadLoader, (imgData ? imgData : [NSNull null]), (elevChunk ? elevChunk : [NSNull null]),
                                         [NSNumber numberWithInt:level], [NSNumber numberWithInt:col], [NSNumber numberWithInt:row], nil];
@@ -277,8 +285,12 @@ using namespace WhirlyKit;
     // Let's just do this in a block
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
                    ^{
+                       // The tile may have been unloaded while we sat in the queue
+                       if (![quadLoader tileIsWantedLevel:level col:col row:row])
+                           return;
+
                        NSData *imgData = nil;
-                       
+
                        // Look for it in the local cache first
                        NSString *localName = nil;
                        if (self.cacheDir)
@@ -311,6 +323,10 @@ using namespace WhirlyKit;
                                [imgData writeToFile:localName atomically:YES];
                        }
 
+                       // Check again after the fetch.  No point handing back a tile nobody wants.
+                       if (![quadLoader tileIsWantedLevel:level col:col row:row])
+                           return;
+
                        // Look for elevation
                        WhirlyKitElevationChunk *elevChunk = nil;
                        if (self.elevDelegate)
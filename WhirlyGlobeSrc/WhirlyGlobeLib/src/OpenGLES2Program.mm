@@ -29,7 +29,7 @@ namespace WhirlyKit
 {
     
 OpenGLES2Program::OpenGLES2Program()
-    : lightsLastUpdated(0.0)
+    : lightsLastUpdated(0.0), lastFramePrepared(0.0)
 {
 }
     
@@ -47,10 +47,14 @@ OpenGLES2Program::~OpenGLES2Program()
     
 bool OpenGLES2Program::setUniform(const std::string &name,float val)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),val);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,float val)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_FLOAT)
         return false;
     
@@ -67,10 +71,14 @@ bool OpenGLES2Program::setUniform(const std::string &name,float val)
 
 bool OpenGLES2Program::setUniform(const std::string &name,int val)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),val);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,int val)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_INT && uni->type != GL_SAMPLER_2D && uni->type != GL_UNSIGNED_INT && uni->type != GL_BOOL)
         return false;
     
@@ -104,10 +112,14 @@ bool OpenGLES2Program::setTexture(const std::string &name,GLuint val)
 
 bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector2f &vec)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),vec);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,const Eigen::Vector2f &vec)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_FLOAT_VEC2)
         return false;
     
@@ -124,10 +136,14 @@ bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector2f
 
 bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector3f &vec)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),vec);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,const Eigen::Vector3f &vec)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_FLOAT_VEC3)
         return false;
     if (uni->isSet && uni->val.fVals[0] == vec.x() && uni->val.fVals[1] == vec.y() && uni->val.fVals[2] == vec.z())
@@ -144,10 +160,14 @@ bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector3f
 
 bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector4f &vec)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),vec);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,const Eigen::Vector4f &vec)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_FLOAT_VEC4)
         return false;
     if (uni->isSet && uni->val.fVals[0] == vec.x() && uni->val.fVals[1] == vec.y() &&
@@ -164,10 +184,14 @@ bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Vector4f
 
 bool OpenGLES2Program::setUniform(const std::string &name,const Eigen::Matrix4f &mat)
 {
-    OpenGLESUniform *uni = findUniform(name);
+    return setUniform(findUniform(name),mat);
+}
+
+bool OpenGLES2Program::setUniform(OpenGLESUniform *uni,const Eigen::Matrix4f &mat)
+{
     if (!uni)
         return false;
-    
+
     if (uni->type != GL_FLOAT_MAT4)
         return false;
     
@@ -223,58 +247,162 @@ bool compileShader(const std::string &name,const char *shaderTypeStr,GLuint *sha
     return status == GL_TRUE;
 }
 
-// Construct the program, compile and link
-OpenGLES2Program::OpenGLES2Program(const std::string &inName,const std::string &vShaderString,const std::string &fShaderString)
-    : name(inName), lightsLastUpdated(0.0)
+// Where the program binaries go, if the cache is turned on
+static NSString *binaryCacheDir = nil;
+// Whether the driver supports GL_OES_get_program_binary
+static bool checkedBinaryExtension = false,hasBinaryExtension = false;
+
+void OpenGLES2Program::SetBinaryCacheDir(NSString *cacheDir)
 {
-    program = glCreateProgram();
-    
-    if (!compileShader(name,"vertex",&vertShader,GL_VERTEX_SHADER,vShaderString))
+    if (cacheDir)
+        [[NSFileManager defaultManager] createDirectoryAtPath:cacheDir withIntermediateDirectories:YES attributes:nil error:nil];
+    binaryCacheDir = cacheDir;
+
+    checkedBinaryExtension = false;
+    hasBinaryExtension = false;
+}
+
+// Simple FNV-1a, plenty for a cache file name
+static unsigned long long HashString(unsigned long long hash,const char *str)
+{
+    if (!str)
+        return hash;
+    while (*str)
     {
-        cleanUp();
-        return;
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
     }
-    if (!compileShader(name,"fragment",&fragShader,GL_FRAGMENT_SHADER,fShaderString))
+    return hash;
+}
+
+// The binaries are driver specific, so the file name carries a hash of
+//  the source and the driver's version strings.  A driver update just
+//  misses the cache and we compile.
+static NSString *BinaryCacheFile(const std::string &vShaderString,const std::string &fShaderString)
+{
+    if (!binaryCacheDir)
+        return nil;
+
+    if (!checkedBinaryExtension)
     {
-        cleanUp();
-        return;
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        hasBinaryExtension = extensions && strstr(extensions,"GL_OES_get_program_binary");
+        checkedBinaryExtension = true;
     }
+    if (!hasBinaryExtension)
+        return nil;
+
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = HashString(hash,vShaderString.c_str());
+    hash = HashString(hash,fShaderString.c_str());
+    hash = HashString(hash,(const char *)glGetString(GL_VERSION));
+    hash = HashString(hash,(const char *)glGetString(GL_RENDERER));
+
+    return [binaryCacheDir stringByAppendingPathComponent:[NSString stringWithFormat:@"prog_%llx.bin",hash]];
+}
+
+bool OpenGLES2Program::tryLoadBinary(const std::string &vShaderString,const std::string &fShaderString)
+{
+    NSString *cacheFile = BinaryCacheFile(vShaderString,fShaderString);
+    if (!cacheFile)
+        return false;
+    NSData *binData = [NSData dataWithContentsOfFile:cacheFile];
+    if ([binData length] <= sizeof(GLenum))
+        return false;
+
+    GLenum binFormat;
+    memcpy(&binFormat, [binData bytes], sizeof(binFormat));
+    glProgramBinaryOES(program, binFormat, (const unsigned char *)[binData bytes]+sizeof(binFormat), (GLint)([binData length]-sizeof(binFormat)));
 
-    glAttachShader(program, vertShader);
-    glAttachShader(program, fragShader);
-    
-    // Now link it
     GLint status;
-    glLinkProgram(program);
-    glValidateProgram(program);
-    
     glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (status == GL_FALSE)
+
+    return status == GL_TRUE;
+}
+
+void OpenGLES2Program::trySaveBinary(const std::string &vShaderString,const std::string &fShaderString)
+{
+    NSString *cacheFile = BinaryCacheFile(vShaderString,fShaderString);
+    if (!cacheFile)
+        return;
+
+    GLint binLen = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &binLen);
+    if (binLen <= 0)
+        return;
+
+    NSMutableData *binData = [NSMutableData dataWithLength:sizeof(GLenum)+binLen];
+    GLenum binFormat = 0;
+    GLsizei outLen = 0;
+    glGetProgramBinaryOES(program, binLen, &outLen, &binFormat, (unsigned char *)[binData mutableBytes]+sizeof(binFormat));
+    if (outLen != binLen)
+        return;
+    memcpy([binData mutableBytes], &binFormat, sizeof(binFormat));
+
+    [binData writeToFile:cacheFile atomically:YES];
+}
+
+// Construct the program, compile and link
+OpenGLES2Program::OpenGLES2Program(const std::string &inName,const std::string &vShaderString,const std::string &fShaderString)
+    : name(inName), lightsLastUpdated(0.0), lastFramePrepared(0.0)
+{
+    program = glCreateProgram();
+    vertShader = 0;
+    fragShader = 0;
+
+    // A binary cached on an earlier launch skips the compile entirely
+    bool fromBinary = tryLoadBinary(vShaderString,fShaderString);
+    if (!fromBinary)
     {
-        GLint len;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
-        if (len > 0)
+        if (!compileShader(name,"vertex",&vertShader,GL_VERTEX_SHADER,vShaderString))
         {
-            GLchar *logStr = (GLchar *)malloc(len);
-            glGetProgramInfoLog(program, len, &len, logStr);
-            NSLog(@"Link error for shader program %s:\n%s",name.c_str(),logStr);
-            free(logStr);
+            cleanUp();
+            return;
         }
-        cleanUp();
-        return;
-    }
-    
-    if (vertShader)
-    {
-        glDeleteShader(vertShader);
-        vertShader = 0;
-    }
-    if (fragShader)
-    {
-        glDeleteShader(fragShader);
-        fragShader = 0;
+        if (!compileShader(name,"fragment",&fragShader,GL_FRAGMENT_SHADER,fShaderString))
+        {
+            cleanUp();
+            return;
+        }
+
+        glAttachShader(program, vertShader);
+        glAttachShader(program, fragShader);
+
+        // Now link it
+        GLint status;
+        glLinkProgram(program);
+        glValidateProgram(program);
+
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE)
+        {
+            GLint len;
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+            if (len > 0)
+            {
+                GLchar *logStr = (GLchar *)malloc(len);
+                glGetProgramInfoLog(program, len, &len, logStr);
+                NSLog(@"Link error for shader program %s:\n%s",name.c_str(),logStr);
+                free(logStr);
+            }
+            cleanUp();
+            return;
+        }
+
+        if (vertShader)
+        {
+            glDeleteShader(vertShader);
+            vertShader = 0;
+        }
+        if (fragShader)
+        {
+            glDeleteShader(fragShader);
+            fragShader = 0;
+        }
+
+        trySaveBinary(vShaderString,fShaderString);
     }
-    
+
     // Convert the uniforms into a more friendly form
     GLint numUniform;
     glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniform);
@@ -386,6 +514,28 @@ bool OpenGLES2Program::setLights(NSArray *lights,CFTimeInterval lastUpdate,Whirl
     return lightsSet;
 }
 
+void OpenGLES2Program::prepareFrame(CFTimeInterval frameTime,NSArray *lights,CFTimeInterval lightsUpdated,WhirlyKitMaterial *mat,Eigen::Matrix4f &modelMat)
+{
+    if (lastFramePrepared == frameTime)
+        return;
+    lastFramePrepared = frameTime;
+
+    if (hasLights() && [lights count] > 0)
+        setLights(lights, lightsUpdated, mat, modelMat);
+    setUniform(kWKOGLNumLights, (int)[lights count]);
+
+    // Time for shaders that animate.  We rebase against startup so the
+    //  value survives the trip through a 32 bit float.
+    OpenGLESUniform *timeUni = findUniform("u_currentTime");
+    if (timeUni)
+    {
+        static CFTimeInterval shaderTimeEpoch = 0.0;
+        if (shaderTimeEpoch == 0.0)
+            shaderTimeEpoch = frameTime;
+        glUniform1f(timeUni->index, (float)(frameTime - shaderTimeEpoch));
+    }
+}
+
 int OpenGLES2Program::bindTextures()
 {
     int numTextures = 0;
@@ -0,0 +1,121 @@
+/*
+ *  ParticleDrawable.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "ParticleDrawable.h"
+#import "OpenGLES2Program.h"
+#import "SceneRendererES.h"
+
+namespace WhirlyKit
+{
+
+ParticleDrawable::ParticleDrawable() : BasicDrawable("Particles"), baseTime(0.0)
+{
+    setType(GL_POINTS);
+    dirIndex = addAttribute(BDFloat3Type, "a_dir");
+    startTimeIndex = addAttribute(BDFloatType, "a_startTime");
+    lifetimeIndex = addAttribute(BDFloatType, "a_lifetime");
+}
+
+void ParticleDrawable::addDir(const Eigen::Vector3f &dir)
+{
+    addAttributeValue(dirIndex, dir);
+}
+
+void ParticleDrawable::addStartTime(float startTime)
+{
+    addAttributeValue(startTimeIndex, startTime);
+}
+
+void ParticleDrawable::addLifetime(float lifetime)
+{
+    addAttributeValue(lifetimeIndex, lifetime);
+}
+
+void ParticleDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo, Scene *scene)
+{
+    if (frameInfo.program)
+        frameInfo.program->setUniform("u_currentTime", (float)(frameInfo.currentTime - baseTime));
+
+    BasicDrawable::draw(frameInfo,scene);
+}
+
+static const char *vertexShaderParticle =
+"uniform mat4  u_mvpMatrix;"
+"uniform float u_fade;"
+"uniform float u_currentTime;"
+"uniform float u_pointSize;"
+""
+"attribute vec3 a_position;"
+"attribute vec4 a_color;"
+"attribute vec3 a_dir;"
+"attribute float a_startTime;"
+"attribute float a_lifetime;"
+""
+"varying vec4 v_color;"
+""
+"void main()"
+"{"
+"   float age = u_currentTime - a_startTime;"
+// Expired (or unborn) particles go transparent and the fragment
+//  shader throws them out
+"   float alive = (age >= 0.0 && age <= a_lifetime) ? 1.0 : 0.0;"
+"   v_color = a_color * u_fade;"
+"   v_color.a = v_color.a * alive;"
+"   vec3 thePos = a_position + a_dir * age;"
+"   gl_PointSize = u_pointSize * alive;"
+"   gl_Position = u_mvpMatrix * vec4(thePos,1.0);"
+"}"
+;
+
+static const char *fragmentShaderParticle =
+"precision mediump float;"
+""
+"varying vec4 v_color;"
+""
+"void main()"
+"{"
+"  if (v_color.a < 0.01)"
+"      discard;"
+"  gl_FragColor = v_color;"
+"}"
+;
+
+WhirlyKit::OpenGLES2Program *BuildParticleProgram()
+{
+    OpenGLES2Program *shader = new OpenGLES2Program(kParticleShaderName,vertexShaderParticle,fragmentShaderParticle);
+    if (!shader->isValid())
+    {
+        delete shader;
+        shader = NULL;
+    }
+
+    // Set some reasonable defaults
+    if (shader)
+    {
+        glUseProgram(shader->getProgram());
+
+        shader->setUniform("u_currentTime", 0.0f);
+        shader->setUniform("u_pointSize", 4.0f);
+    }
+
+    return shader;
+}
+
+}
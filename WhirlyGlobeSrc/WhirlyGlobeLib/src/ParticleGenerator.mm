@@ -19,6 +19,8 @@
  */
 
 #import "ParticleGenerator.h"
+#import "ParticleDrawable.h"
+#import "DefaultShaderPrograms.h"
 #import "SceneRendererES.h"
 
 using namespace Eigen;
@@ -74,18 +76,17 @@ ParticleGenerator::Particle ParticleGenerator::ParticleSystem::generateParticle(
 
 
 ParticleGenerator::ParticleGenerator(int maxNumParticles)
-    : maxNumParticles(maxNumParticles), lastUpdateTime(0.0)
+    : maxNumParticles(maxNumParticles), lastUpdateTime(0.0), numLiveParticles(0)
 {
-    particles.reserve(maxNumParticles);
     startTime = CFAbsoluteTimeGetCurrent();
 }
-    
+
 ParticleGenerator::~ParticleGenerator()
 {
     for (ParticleSystemSet::iterator it = particleSystems.begin();
          it != particleSystems.end(); ++it)
         delete (*it);
-    particles.clear();
+    batches.clear();
 }
     
 void ParticleGenerator::addParticleSystem(ParticleSystem *particleSystem)
@@ -118,25 +119,30 @@ void ParticleGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frameInfo,
         return;
     }
 
-    // Update the current particles
-    int numFull = 0;
     float deltaT = frameInfo.frameLen;
-    for (unsigned int ii=0;ii<particles.size();ii++)
-    {
-        Particle &particle = particles[ii];
-        if (particle.expiration > currentTime)
-        {            
-            particle.loc += particle.dir * particle.velocity * deltaT;
-            numFull++;
+
+    // Retire batches whose last particle has expired
+    for (int ii=(int)batches.size()-1;ii>=0;ii--)
+        if (batches[ii].expiration < currentTime)
+        {
+            ParticleBatch &batch = batches[ii];
+            batch.draw->teardownGL(frameInfo.scene->getMemManager());
+            numLiveParticles -= batch.numParticles;
+            batches.erase(batches.begin()+ii);
         }
-    }
-   
+
     // The maximum we can add
-    int maxToAdd = maxNumParticles-numFull;
-    int addPoint = 0;
+    int maxToAdd = maxNumParticles-numLiveParticles;
 
-    if (maxToAdd > 0)
+    if (maxToAdd > 0 && !particleSystems.empty())
     {
+        // This frame's new particles, uploaded once.  The shader moves
+        //  them from here on, so we never touch them again
+        std::vector<ParticleDrawable *> newDraws;
+        ParticleDrawable *draw = NULL;
+        NSTimeInterval batchExpiration = currentTime;
+        int numAdded = 0;
+
         // Work through the particle systems, adding new particles
         for (ParticleSystemSet::iterator it = particleSystems.begin();
              it != particleSystems.end(); ++it)
@@ -146,48 +152,53 @@ void ParticleGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frameInfo,
             numPerSecDiff = std::max(1,numPerSecDiff);
             int numToAddPerSec = random()%numPerSecDiff+system->numPerSecMin;
             int numToAddNow = numToAddPerSec * deltaT;
-            
+
             // Add as many new particles as we can
             for (unsigned int ii=0;ii<numToAddNow && (maxToAdd > 0);ii++)
             {
                 Particle newParticle = system->generateParticle();
-                newParticle.expiration += currentTime;
-                // Now find a spot for it
-                while (addPoint < particles.size() && particles[addPoint].expiration > currentTime)
-                    addPoint++;
-                if (addPoint < particles.size())
+                if (!draw || draw->getNumPoints() >= MaxDrawablePoints)
                 {
-                    particles[addPoint] = newParticle;
-                    addPoint++;
-                } else
-                    particles.push_back(newParticle);
+                    draw = new ParticleDrawable();
+                    draw->setBaseTime(startTime);
+                    draw->setProgram(frameInfo.scene->getProgramIDByName(kToolkitDefaultParticleProgram));
+                    newDraws.push_back(draw);
+                }
+                draw->addPoint(newParticle.loc);
+                draw->addColor(newParticle.color);
+                draw->addDir(newParticle.dir * newParticle.velocity);
+                draw->addStartTime(currentTime-startTime);
+                // Expiration hasn't been offset yet, so it's a lifetime here
+                draw->addLifetime(newParticle.expiration);
+                batchExpiration = std::max(batchExpiration,currentTime+newParticle.expiration);
                 maxToAdd--;
-                numFull++;
+                numAdded++;
             }
         }
-    }
-    
-    // Note: Should shrink the particles vector
 
-    // Build a drawable containing all the active particles
-    // Note: Should possibly build more than one
-    BasicDrawable *draw = NULL;
-    for (unsigned int ii=0;ii<particles.size();ii++)
-    {
-        Particle &particle = particles[ii];
-        if (particle.expiration > currentTime)
+        if (!newDraws.empty())
         {
-            if (!draw || draw->getNumPoints() >= MaxDrawablePoints)
+            // We're on the rendering thread with the context current,
+            //  so we can push the batch straight into its buffers
+            WhirlyKitGLSetupInfo *setupInfo = [[WhirlyKitGLSetupInfo alloc] init];
+            setupInfo->minZres = [frameInfo.theView calcZbufferRes];
+            for (unsigned int ii=0;ii<newDraws.size();ii++)
             {
-                draw = new BasicDrawable("Particle Generator",(numFull > MaxDrawablePoints ? MaxDrawablePoints : numFull),0);                
-                draw->setType(GL_POINTS);
-                drawables.push_back(DrawableRef(draw));
+                ParticleBatch batch;
+                batch.draw = DrawableRef(newDraws[ii]);
+                newDraws[ii]->setupGL(setupInfo,frameInfo.scene->getMemManager());
+                batch.expiration = batchExpiration;
+                batch.numParticles = newDraws[ii]->getNumPoints();
+                batches.push_back(batch);
             }
-            draw->addPoint(particle.loc);
-            draw->addColor(particle.color);
+            numLiveParticles += numAdded;
         }
     }
-    
+
+    // Every live batch draws every frame; the shader hides the dead
+    for (unsigned int ii=0;ii<batches.size();ii++)
+        drawables.push_back(batches[ii].draw);
+
     lastUpdateTime = currentTime;
 }
     
@@ -19,11 +19,59 @@
  */
 
 #import "PerformanceTimer.h"
+#import <libkern/OSAtomic.h>
 #import <vector>
 
 namespace WhirlyKit
 {
-    
+
+// The telemetry counters live outside any one timer, so every subsystem
+//  can bump them without plumbing a pointer around
+static volatile int64_t TelemCounters[PerformanceTimer::TelemetryCounters::TelemMax] = {0};
+
+void PerformanceTimer::TelemetryCounters::add(Counter which,int64_t by)
+{
+    OSAtomicAdd64(by,(int64_t *)&TelemCounters[which]);
+}
+
+void PerformanceTimer::TelemetryCounters::set(Counter which,int64_t to)
+{
+    // Aligned 64 bit stores are atomic on the hardware we run on and
+    //  telemetry tolerates a stale read, so no barrier needed
+    TelemCounters[which] = to;
+}
+
+void PerformanceTimer::TelemetryCounters::snapshot(int64_t outValues[TelemMax],bool reset)
+{
+    for (unsigned int ii=0;ii<TelemMax;ii++)
+    {
+        outValues[ii] = TelemCounters[ii];
+        if (reset)
+            OSAtomicAdd64(-outValues[ii],(int64_t *)&TelemCounters[ii]);
+    }
+}
+
+PerformanceTimer::TelemetrySnapshot::TelemetrySnapshot()
+    : frameTimeP50(0.0), frameTimeP95(0.0), frameTimeP99(0.0), frameTimeMax(0.0),
+    avgDrawables(0.0), avgChanges(0.0), numFrames(0)
+{
+    for (unsigned int ii=0;ii<TelemetryCounters::TelemMax;ii++)
+        counters[ii] = 0;
+}
+
+PerformanceTimer::PerformanceTimer()
+    : gpuTimingChecked(false), gpuTimingAvailable(false), curGpuQuery(0), lastGpuDuration(0.0), frameSampleAt(0),
+    alertThresholdMs(0.0), alertCallback(NULL), alertUserData(NULL), framesSinceAlertCheck(0), alertTripped(false)
+{
+    gpuQueries[0] = gpuQueries[1] = 0;
+    gpuQueryPending[0] = gpuQueryPending[1] = false;
+}
+
+PerformanceTimer::FrameSample::FrameSample()
+    : frameStart(0.0), cpuDuration(0.0), gpuDuration(0.0), numDrawables(0), numChanges(0)
+{
+}
+
 PerformanceTimer::TimeEntry::TimeEntry()
 {
     name = "";
@@ -117,6 +165,145 @@ void PerformanceTimer::addCount(const std::string &what,int count)
     }
 }
 
+void PerformanceTimer::startGpuTiming()
+{
+    // Check for the extension once
+    if (!gpuTimingChecked)
+    {
+        gpuTimingChecked = true;
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        if (extensions && strstr(extensions,"GL_EXT_disjoint_timer_query"))
+        {
+            gpuTimingAvailable = true;
+            glGenQueriesEXT(2,gpuQueries);
+        }
+    }
+    if (!gpuTimingAvailable)
+        return;
+
+    // Collect the answer from a previous frame, if it's ready
+    int lastQuery = 1 - curGpuQuery;
+    if (gpuQueryPending[lastQuery])
+    {
+        GLuint available = 0;
+        glGetQueryObjectuivEXT(gpuQueries[lastQuery],GL_QUERY_RESULT_AVAILABLE_EXT,&available);
+        if (available)
+        {
+            // Note: The headers don't declare the 64 bit version, so we
+            //       settle for 32 bits of nanoseconds (~4s per frame, plenty)
+            GLuint timeElapsed = 0;
+            glGetQueryObjectuivEXT(gpuQueries[lastQuery],GL_QUERY_RESULT_EXT,&timeElapsed);
+            lastGpuDuration = timeElapsed / 1.0e9;
+            gpuQueryPending[lastQuery] = false;
+        }
+    }
+
+    if (!gpuQueryPending[curGpuQuery])
+        glBeginQueryEXT(GL_TIME_ELAPSED_EXT,gpuQueries[curGpuQuery]);
+}
+
+void PerformanceTimer::stopGpuTiming()
+{
+    if (!gpuTimingAvailable)
+        return;
+
+    if (!gpuQueryPending[curGpuQuery])
+    {
+        glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+        gpuQueryPending[curGpuQuery] = true;
+    }
+    curGpuQuery = 1 - curGpuQuery;
+
+    if (lastGpuDuration > 0.0)
+        addCount("GPU frame time (us)",(int)(lastGpuDuration * 1.0e6));
+}
+
+// Pull a percentile (in ms) out of a sorted set of durations
+static double PercentileMs(const std::vector<NSTimeInterval> &sorted,double pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    int idx = (int)(pct * (sorted.size()-1));
+    return 1000.0 * sorted[idx];
+}
+
+void PerformanceTimer::addFrameSample(const FrameSample &sample)
+{
+    FrameSample newSample = sample;
+    // The GPU answers on its own schedule, so the duration we have
+    //  is from a frame or two back.  Close enough for spike hunting.
+    newSample.gpuDuration = lastGpuDuration;
+
+    if (frameSamples.size() < FrameSampleRingSize)
+        frameSamples.push_back(newSample);
+    else {
+        frameSamples[frameSampleAt] = newSample;
+        frameSampleAt = (frameSampleAt + 1) % FrameSampleRingSize;
+    }
+
+    // Watch for frame time p95 crossing the alert threshold.  We only
+    //  check every so often and only fire once per crossing.
+    if (alertCallback && ++framesSinceAlertCheck >= 30)
+    {
+        framesSinceAlertCheck = 0;
+        std::vector<NSTimeInterval> durations;
+        durations.reserve(frameSamples.size());
+        for (unsigned int ii=0;ii<frameSamples.size();ii++)
+            durations.push_back(frameSamples[ii].cpuDuration);
+        std::sort(durations.begin(),durations.end());
+        double p95Ms = PercentileMs(durations,0.95);
+        if (p95Ms > alertThresholdMs)
+        {
+            if (!alertTripped)
+            {
+                alertTripped = true;
+                (*alertCallback)(p95Ms,alertUserData);
+            }
+        } else
+            alertTripped = false;
+    }
+}
+
+void PerformanceTimer::getFrameSamples(std::vector<FrameSample> &samples) const
+{
+    samples.reserve(samples.size()+frameSamples.size());
+    for (unsigned int ii=0;ii<frameSamples.size();ii++)
+        samples.push_back(frameSamples[(frameSampleAt + ii) % frameSamples.size()]);
+}
+
+void PerformanceTimer::getTelemetrySnapshot(TelemetrySnapshot &snapshot,bool resetCounters)
+{
+    std::vector<NSTimeInterval> durations;
+    durations.reserve(frameSamples.size());
+    double totDraw = 0.0, totChanges = 0.0;
+    for (unsigned int ii=0;ii<frameSamples.size();ii++)
+    {
+        const FrameSample &sample = frameSamples[ii];
+        durations.push_back(sample.cpuDuration);
+        totDraw += sample.numDrawables;
+        totChanges += sample.numChanges;
+    }
+    std::sort(durations.begin(),durations.end());
+
+    snapshot.numFrames = durations.size();
+    snapshot.frameTimeP50 = PercentileMs(durations,0.50);
+    snapshot.frameTimeP95 = PercentileMs(durations,0.95);
+    snapshot.frameTimeP99 = PercentileMs(durations,0.99);
+    snapshot.frameTimeMax = (durations.empty() ? 0.0 : 1000.0 * durations.back());
+    snapshot.avgDrawables = (durations.empty() ? 0.0 : totDraw / durations.size());
+    snapshot.avgChanges = (durations.empty() ? 0.0 : totChanges / durations.size());
+    TelemetryCounters::snapshot(snapshot.counters,resetCounters);
+}
+
+void PerformanceTimer::setFrameTimeAlert(double thresholdMs,FrameTimeAlertCallback callback,void *userData)
+{
+    alertThresholdMs = thresholdMs;
+    alertCallback = callback;
+    alertUserData = userData;
+    framesSinceAlertCheck = 0;
+    alertTripped = false;
+}
+
 void PerformanceTimer::clear()
 {
     actives.clear();
@@ -152,5 +339,55 @@ void PerformanceTimer::log()
             NSLog(@"  %s: min, max, avg = (%d,%d,%2.f,  %d) count",entry.name.c_str(),entry.minCount,entry.maxCount,(float)entry.avgCount / (float)entry.numRuns,entry.avgCount);
     }
 }
-    
+
+// Escape a string on its way into JSON output
+static std::string JsonEscape(const std::string &str)
+{
+    std::string outStr;
+    outStr.reserve(str.size());
+    for (unsigned int ii=0;ii<str.size();ii++)
+    {
+        char c = str[ii];
+        if (c == '"' || c == '\\')
+            outStr += '\\';
+        outStr += c;
+    }
+    return outStr;
+}
+
+void PerformanceTimer::report(std::string &outJson)
+{
+    char line[1024];
+
+    outJson += "{\"timers\":[";
+    bool first = true;
+    for (std::map<std::string,TimeEntry>::iterator it = timeEntries.begin();
+         it != timeEntries.end(); ++it)
+    {
+        TimeEntry &entry = it->second;
+        if (entry.numRuns == 0)
+            continue;
+        sprintf(line,"%s{\"name\":\"%s\",\"runs\":%d,\"minMs\":%f,\"maxMs\":%f,\"avgMs\":%f}",
+                (first ? "" : ","),JsonEscape(entry.name).c_str(),entry.numRuns,
+                1000*entry.minDur,1000*entry.maxDur,1000*entry.avgDur / entry.numRuns);
+        outJson += line;
+        first = false;
+    }
+    outJson += "],\"counters\":[";
+    first = true;
+    for (std::map<std::string,CountEntry>::iterator it = countEntries.begin();
+         it != countEntries.end(); ++it)
+    {
+        CountEntry &entry = it->second;
+        if (entry.numRuns == 0)
+            continue;
+        sprintf(line,"%s{\"name\":\"%s\",\"runs\":%d,\"min\":%d,\"max\":%d,\"avg\":%f,\"total\":%d}",
+                (first ? "" : ","),JsonEscape(entry.name).c_str(),entry.numRuns,
+                entry.minCount,entry.maxCount,(float)entry.avgCount / (float)entry.numRuns,entry.avgCount);
+        outJson += line;
+        first = false;
+    }
+    outJson += "]}";
+}
+
 }
@@ -18,6 +18,7 @@
  *
  */
 
+#import <map>
 #import "QuadDisplayLayer.h"
 #import "GlobeMath.h"
 #import "GlobeLayerViewWatcher.h"
@@ -30,6 +31,94 @@
 using namespace Eigen;
 using namespace WhirlyKit;
 
+// What the scheduler tracks for each registered layer
+class LayerLoadState
+{
+public:
+    LayerLoadState() : priority(0), fetches(0) { }
+
+    int priority;
+    int fetches;
+};
+
+@implementation WhirlyKitQuadTileScheduler
+{
+    pthread_mutex_t layerLock;
+    // Keyed by the layer pointer.  We don't hold the layers themselves.
+    std::map<void *,LayerLoadState> layers;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self)
+    {
+        _maxFetches = 16;
+        _minFetchesPerLayer = 2;
+        pthread_mutex_init(&layerLock,NULL);
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&layerLock);
+}
+
+- (void)layer:(WhirlyKitQuadDisplayLayer *)layer priority:(int)priority updateFetchCount:(int)numFetches
+{
+    pthread_mutex_lock(&layerLock);
+    LayerLoadState &state = layers[(__bridge void *)layer];
+    state.priority = priority;
+    state.fetches = numFetches;
+    pthread_mutex_unlock(&layerLock);
+}
+
+- (bool)layerCanLoad:(WhirlyKitQuadDisplayLayer *)layer
+{
+    bool canLoad = true;
+
+    pthread_mutex_lock(&layerLock);
+    std::map<void *,LayerLoadState>::iterator it = layers.find((__bridge void *)layer);
+    if (it != layers.end())
+    {
+        const LayerLoadState &mine = it->second;
+
+        // Everyone gets the floor, no matter who else is busy
+        if (mine.fetches >= _minFetchesPerLayer)
+        {
+            // Count up what's in flight, and how much of it outranks us
+            int total = 0, higher = 0;
+            for (std::map<void *,LayerLoadState>::iterator lit = layers.begin();
+                 lit != layers.end(); ++lit)
+            {
+                total += lit->second.fetches;
+                if (lit->second.priority < mine.priority)
+                    higher += lit->second.fetches;
+            }
+
+            // We can use whatever the higher tiers aren't
+            int allowed = std::max(_maxFetches - higher,_minFetchesPerLayer);
+            canLoad = total < _maxFetches && mine.fetches < allowed;
+        }
+    }
+    pthread_mutex_unlock(&layerLock);
+
+    return canLoad;
+}
+
+- (void)removeLayer:(WhirlyKitQuadDisplayLayer *)layer
+{
+    pthread_mutex_lock(&layerLock);
+    std::map<void *,LayerLoadState>::iterator it = layers.find((__bridge void *)layer);
+    if (it != layers.end())
+        layers.erase(it);
+    pthread_mutex_unlock(&layerLock);
+}
+
+@end
+
 @implementation WhirlyKitQuadDisplayLayer
 {
     /// [minZoom,maxZoom] range
@@ -56,6 +145,24 @@ using namespace WhirlyKit;
     
     // In metered mode, we'll only flush if something happened
     bool somethingHappened;
+
+    /// Bumped when the view moves far enough to invalidate cached importance
+    long importGeneration;
+
+    /// The view state the current importance generation was calculated against
+    WhirlyKitViewState *importGenViewState;
+
+    /// Frame size shared by all the importance calculations in a pass
+    WhirlyKit::Point2f importFrameSize;
+
+    /// Where the eye was (in local coordinates) the last time we looked,
+    ///  used to guess where the view is headed for prefetch
+    WhirlyKit::Point3d lastEyeLocal;
+    NSTimeInterval lastEyeTime;
+    bool hasLastEye;
+
+    /// How many times each failed tile has been retried
+    std::map<WhirlyKit::Quadtree::Identifier,int> tileRetries;
 }
 
 - (id)initWithDataSource:(NSObject<WhirlyKitQuadDataStructure> *)inDataStructure loader:(NSObject<WhirlyKitQuadLoader> *)inLoader renderer:(WhirlyKitSceneRendererES *)inRenderer;
@@ -72,6 +179,7 @@ using namespace WhirlyKit;
         _maxTiles = 128;
         _minImportance = 1.0;
         _viewUpdatePeriod = 0.1;
+        _evalBudget = 0.008;
         _quadtree = new Quadtree([_dataStructure totalExtents],minZoom,maxZoom,_maxTiles,_minImportance,self);
         _renderer = (WhirlyKitSceneRendererES2 *)inRenderer;
         _lineMode = false;
@@ -81,8 +189,15 @@ using namespace WhirlyKit;
         _meteredMode = true;
         _fullLoad = false;
         _fullLoadTimeout = 4.0;
+        _loadPriority = 0;
+        _maxTileRetries = 3;
         waitForLocalLoads = false;
         somethingHappened = false;
+        importGeneration = 0;
+        importGenViewState = nil;
+        _prefetchTiles = true;
+        _prefetchTime = 1.0;
+        hasLastEye = false;
     }
     
     return self;
@@ -126,7 +241,10 @@ using namespace WhirlyKit;
 
     if (_fullLoad)
         waitForLocalLoads = true;
-    
+
+    // Jump in when the renderer says we're over the GPU memory budget
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(gpuMemPressureNote:) name:kWKGPUMemPressureNotification object:nil];
+
 //    [self performSelector:@selector(dumpInfo) withObject:nil afterDelay:15.0];
 }
 
@@ -134,6 +252,7 @@ using namespace WhirlyKit;
 {
     [_renderer removeFrameObserver:self];
     [_loader quadDisplayLayerEndUpdates:self];
+    [_scheduler removeLayer:self];
 
     [NSObject cancelPreviousPerformRequestsWithTarget:self];
     [[NSNotificationCenter defaultCenter] removeObserver:self];
@@ -187,6 +306,41 @@ using namespace WhirlyKit;
     somethingHappened = false;
 }
 
+// How far the eye has to move, as a fraction of its height, before we
+//  throw out the cached importance values
+static const double ImportanceMoveEps = 0.01;
+// Same idea for the view direction (catches tilt and spin in place)
+static const double ImportanceAngleEps = 0.001;
+// Don't let the height scale collapse to nothing near the surface
+static const double ImportanceMinHeight = 1e-5;
+
+// Check if the view has moved far enough from the last importance pass
+//  that the cached values are no good
+- (bool)viewMovedSignificantly:(WhirlyKitViewState *)newState
+{
+    if (!importGenViewState)
+        return true;
+
+    Point3d newEye = newState.eyePos;
+    Point3d oldEye = importGenViewState.eyePos;
+
+    // Eye height depends on the kind of display space we're in
+    CoordSystemDisplayAdapter *coordAdapter = newState.coordAdapter;
+    double height;
+    if (coordAdapter && coordAdapter->isFlat())
+        height = std::abs(newEye.z());
+    else
+        height = std::abs(newEye.norm() - 1.0);
+    double scale = std::max(height,ImportanceMinHeight);
+
+    if ((newEye - oldEye).norm() > ImportanceMoveEps * scale)
+        return true;
+    if ((newState.eyeVec - importGenViewState.eyeVec).norm() > ImportanceAngleEps)
+        return true;
+
+    return false;
+}
+
 // Called every so often by the view watcher
 // It's here that we evaluate what to load
 - (void)viewUpdate:(WhirlyKitViewState *)inViewState
@@ -212,6 +366,16 @@ using namespace WhirlyKit;
     if (_fullLoad)
         waitForLocalLoads = true;
         
+    // Only invalidate the cached importance values if the view actually
+    //  moved.  Momentum pans hand us a steady stream of updates and
+    //  recalculating every node each time is the bulk of our work.
+    if ([self viewMovedSignificantly:inViewState])
+    {
+        importGeneration++;
+        importGenViewState = inViewState;
+    }
+    importFrameSize = Point2f(_renderer.framebufferWidth,_renderer.framebufferHeight);
+
     viewState = inViewState;
     _quadtree->clearEvals();
     toPhantom.clear();
@@ -221,9 +385,58 @@ using namespace WhirlyKit;
     for (int ix=0;ix<1<<minZoom;ix++)
         for (int iy=0;iy<1<<minZoom;iy++)
             _quadtree->addTile(Quadtree::Identifier(ix,iy,minZoom),true,false);
-    
+
+    // If we were handed a previous session's tile state, get all of it
+    //  into the eval queue now rather than churning down from the top
+    if (_initialTileState)
+    {
+        [self seedTileState:_initialTileState];
+        _initialTileState = nil;
+    }
+
     [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evalStep:) object:nil];
     [self performSelector:@selector(evalStep:) withObject:nil afterDelay:0.0];
+
+    [self runPrefetch:inViewState];
+}
+
+// Ignore view deltas older than this when estimating motion
+static const NSTimeInterval PrefetchMaxAge = 2.0;
+
+// Watch how the view is moving and tell the loader which way to warm up
+- (void)runPrefetch:(WhirlyKitViewState *)inViewState
+{
+    CoordSystemDisplayAdapter *coordAdapter = inViewState.coordAdapter;
+    if (!coordAdapter)
+        return;
+
+    // Note where the eye is in our local coordinates so we can difference it
+    Point3d eyeLocal = CoordSystemConvert3d(coordAdapter->getCoordSystem(),_coordSys,coordAdapter->displayToLocal(inViewState.eyePos));
+    NSTimeInterval now = CFAbsoluteTimeGetCurrent();
+    Point3d oldEyeLocal = lastEyeLocal;
+    NSTimeInterval oldEyeTime = lastEyeTime;
+    bool haveOld = hasLastEye;
+    lastEyeLocal = eyeLocal;
+    lastEyeTime = now;
+    hasLastEye = true;
+
+    if (!_prefetchTiles || ![_loader respondsToSelector:@selector(quadDisplayLayer:prefetchForShift:)])
+        return;
+    if (!haveOld)
+        return;
+
+    // If the samples are too far apart the estimate is junk
+    NSTimeInterval howLong = now - oldEyeTime;
+    if (howLong <= 0.0 || howLong > PrefetchMaxAge)
+        return;
+
+    // Project that motion forward and let the loader decide what to warm up
+    Point3d shift3d = (eyeLocal - oldEyeLocal) * (_prefetchTime / howLong);
+    Point2d shift(shift3d.x(),shift3d.y());
+    if (shift.x() == 0.0 && shift.y() == 0.0)
+        return;
+
+    [_loader quadDisplayLayer:self prefetchForShift:shift];
 }
 
 // Dump out info about what we've got loaded in
@@ -270,13 +483,17 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
 - (void)evalStep:(id)Sender
 {
     bool didSomething = false;
-    
+    NSTimeInterval evalStart = CFAbsoluteTimeGetCurrent();
+
     // If the renderer hasn't been set up, punt and try again later
     if (_renderer.framebufferWidth == 0 || _renderer.framebufferHeight == 0 || viewState == nil)
     {
         [self performSelector:@selector(evalStep:) withObject:nil afterDelay:0.1];
         return;
-    }    
+    }
+    // The view update may have run before the renderer had a size
+    if (importFrameSize.x() == 0)
+        importFrameSize = Point2f(_renderer.framebufferWidth,_renderer.framebufferHeight);
 
     // If the loader isn't ready, it's up to it to wake us up when it is
     if (![_loader isReady])
@@ -284,6 +501,11 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
         return;
     }
 
+    // Keep the shared scheduler (if any) apprised of what we've got in flight
+    if (_scheduler)
+        [_scheduler layer:self priority:_loadPriority updateFetchCount:([_loader respondsToSelector:@selector(networkFetches)] ? [_loader networkFetches] : 0)];
+    bool loadsDeferred = false;
+
     if (!_meteredMode)
         [_loader quadDisplayLayerStartUpdates:self];
     
@@ -347,6 +569,16 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
                 }
             }
             
+            // If we're sharing a scheduler with other layers, the load may
+            //  have to wait its turn behind higher priority layers
+            if (shouldLoad && _scheduler && ![_scheduler layerCanLoad:self])
+            {
+                // Back in the queue; we'll get another look as fetches drain
+                _quadtree->setEvaluating(nodeInfo->ident, true);
+                loadsDeferred = true;
+                break;
+            }
+
             // Evaluate children at some point soon
             if (addChildren)
             {
@@ -407,6 +639,10 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
                 if (now-frameStart > AvailableFrame*frameInterval || ![_loader isReady])
                     break;
             }
+            // Either way, don't hog the layer thread.  The rest of the queue
+            //  keeps its importance order and we'll be rescheduled below.
+            if (_evalBudget > 0.0 && now-evalStart > _evalBudget)
+                break;
         }
         
         didSomething = true;
@@ -419,8 +655,13 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
 //        NSLog(@"Unload tile: %d: (%d,%d) phantom = %@, import = %f",remNodeInfo.ident.level,remNodeInfo.ident.x,remNodeInfo.ident.y,(remNodeInfo.phantom ? @"YES" : @"NO"), remNodeInfo.importance);
         _quadtree->removeTile(remNodeInfo.ident);
         [_loader quadDisplayLayer:self unloadTile:&remNodeInfo];
-        
+
         didSomething = true;
+
+        // A big view change can obsolete a lot of tiles at once.  Spread the
+        //  unloads over a few passes rather than stalling this one.
+        if (_evalBudget > 0.0 && CFAbsoluteTimeGetCurrent()-evalStart > 2.0*_evalBudget)
+            break;
     }
 
     // Deal with outstanding phantom nodes
@@ -464,7 +705,8 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
         [self dumpInfo];
     
     if (didSomething)
-        [self performSelector:@selector(evalStep:) withObject:nil afterDelay:0.0];
+        // If the scheduler made us wait, poll rather than spin on the same node
+        [self performSelector:@selector(evalStep:) withObject:nil afterDelay:(loadsDeferred ? 0.1 : 0.0)];
     else {
         // If we're not waiting for local reloads, we may be done
         if (!_meteredMode && ![self waitingForLocalLoads])
@@ -495,6 +737,7 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
 {
     _quadtree->setLoading(tileIdent, false);
     _quadtree->setFailed(tileIdent, false);
+    tileRetries.erase(tileIdent);
     
     // Update the parent coverage and then make those tiles phantoms if
     //  they're now fully covered
@@ -550,8 +793,12 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     somethingHappened = true;
 }
 
+// Base delay before we take another run at a failed tile.  Doubles each
+//  attempt, with jitter, so a blip doesn't come back all at once.
+static const NSTimeInterval TileRetryBaseDelay = 2.0;
+
 // Tile failed to load.
-// At the moment we don't care, but we won't look at the children
+// We won't look at the children, but we will quietly try it again
 - (void)loader:(NSObject<WhirlyKitQuadLoader> *)loader tileDidNotLoad:(WhirlyKit::Quadtree::Identifier)tileIdent
 {
 //    NSLog(@"Tile failed to load: %d: (%d,%d)",tileIdent.level,tileIdent.x,tileIdent.y);
@@ -559,7 +806,19 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     _quadtree->setLoading(tileIdent, false);
     _quadtree->setPhantom(tileIdent, true);
     _quadtree->setFailed(tileIdent, true);
-    
+
+    // Schedule another try, backing off as the tile keeps failing
+    if (_maxTileRetries > 0)
+    {
+        int &attempts = tileRetries[tileIdent];
+        if (attempts < _maxTileRetries)
+        {
+            attempts++;
+            NSTimeInterval delay = TileRetryBaseDelay * (1 << (attempts-1)) * (0.5 + drand48());
+            [self performSelector:@selector(retryFailedTile:) withObject:@[@(tileIdent.x),@(tileIdent.y),@(tileIdent.level)] afterDelay:delay];
+        }
+    }
+
     // Let's try to load the parent if we're in target level mode
     if (!_targetLevels.empty() && tileIdent.level > 0)
     {
@@ -579,6 +838,29 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     somethingHappened = true;
 }
 
+// A failed tile's turn to try again.  Runs on the layer thread a while
+//  after the failure.
+- (void)retryFailedTile:(NSArray *)args
+{
+    if (!_scene)
+        return;
+
+    Quadtree::Identifier tileIdent([args[0] intValue],[args[1] intValue],[args[2] intValue]);
+    // Only if it's still sitting there failed
+    if (!_quadtree->isTilePresent(tileIdent) || !_quadtree->didFail(tileIdent))
+        return;
+
+    // Put it back in front of the evaluation.  It competes on importance
+    //  like anything else, so fresh tiles aren't stuck behind it.
+    _quadtree->setFailed(tileIdent, false);
+    _quadtree->addTile(tileIdent, true, true);
+
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evalStep:) object:nil];
+    [self performSelector:@selector(evalStep:) withObject:nil afterDelay:0.0];
+
+    somethingHappened = true;
+}
+
 // Clear out all the existing tiles and start over
 - (void)refresh
 {
@@ -596,6 +878,7 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evalStep:) object:nil];
     _quadtree->clearEvals();
     _quadtree->clearFails();
+    tileRetries.clear();
 
     // Remove nodes until we run out
     Quadtree::NodeInfo remNodeInfo;
@@ -638,6 +921,7 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evalStep:) object:nil];
     _quadtree->clearEvals();
     _quadtree->clearFails();
+    tileRetries.clear();
     
     // Remove nodes until we run out
     Quadtree::NodeInfo remNodeInfo;
@@ -654,6 +938,39 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     [self poke];
 }
 
+// The renderer says we're over the GPU memory budget
+- (void)gpuMemPressureNote:(NSNotification *)note
+{
+    if ([NSThread currentThread] != _layerThread)
+    {
+        [self performSelector:@selector(gpuMemPressureNote:) onThread:_layerThread withObject:note waitUntilDone:NO];
+        return;
+    }
+
+    // Shed the least important half of what we've got loaded.
+    // Distant and over-zoomed tiles go first and the evaluation will
+    //  bring back anything the current view still wants.
+    std::vector<Quadtree::Identifier> loadedIdents;
+    _quadtree->getLoadedNodeIdents(loadedIdents);
+    int numToDrop = (int)loadedIdents.size()/2;
+    if (numToDrop == 0)
+        return;
+
+    Quadtree::NodeInfo remNodeInfo;
+    [_loader quadDisplayLayerStartUpdates:self];
+    for (int ii=0;ii<numToDrop;ii++)
+    {
+        if (!_quadtree->leastImportantNode(remNodeInfo,true))
+            break;
+        _quadtree->removeTile(remNodeInfo.ident);
+        [_loader quadDisplayLayer:self unloadTile:&remNodeInfo];
+    }
+    somethingHappened = true;
+
+    // Take another look at what ought to be loaded
+    [self poke];
+}
+
 - (void)poke
 {
     if ([NSThread currentThread] != _layerThread)
@@ -665,6 +982,67 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
     [self viewUpdate:viewState];
 }
 
+- (NSData *)loadedTileState
+{
+    std::vector<Quadtree::Identifier> idents;
+    _quadtree->getLoadedNodeIdents(idents);
+
+    NSMutableData *tileState = [NSMutableData data];
+    for (unsigned int ii=0;ii<idents.size();ii++)
+    {
+        int32_t entry[3];
+        entry[0] = idents[ii].level;  entry[1] = idents[ii].x;  entry[2] = idents[ii].y;
+        [tileState appendBytes:entry length:sizeof(entry)];
+    }
+
+    return tileState;
+}
+
+// Used to sort the saved tiles into level order for reinsertion
+static bool TileStateLevelSort(const Quadtree::Identifier &a,const Quadtree::Identifier &b)
+{
+    if (a.level == b.level)
+        return a < b;
+    return a.level < b.level;
+}
+
+// Push a previous session's tiles into the quad tree for evaluation
+- (void)seedTileState:(NSData *)tileState
+{
+    int numEntries = (int)([tileState length] / (3*sizeof(int32_t)));
+    const int32_t *entries = (const int32_t *)[tileState bytes];
+
+    // Toss anything outside our zoom range.  The data source may have changed.
+    std::vector<Quadtree::Identifier> idents;
+    for (int ii=0;ii<numEntries;ii++)
+    {
+        const int32_t *entry = &entries[3*ii];
+        if (entry[0] >= minZoom && entry[0] <= maxZoom)
+            idents.push_back(Quadtree::Identifier(entry[1],entry[2],entry[0]));
+    }
+
+    // Parents have to be in the tree before their children
+    std::sort(idents.begin(),idents.end(),TileStateLevelSort);
+
+    for (unsigned int ii=0;ii<idents.size();ii++)
+    {
+        const Quadtree::Identifier &ident = idents[ii];
+
+        // Make sure the chain of parents exists, even if the saved
+        //  state didn't happen to include them
+        for (int level=minZoom;level<ident.level;level++)
+        {
+            Quadtree::Identifier parentIdent(ident.x >> (ident.level-level),ident.y >> (ident.level-level),level);
+            if (!_quadtree->getNodeInfo(parentIdent))
+                _quadtree->addTile(parentIdent,false,false);
+        }
+
+        // The importance check drops tiles the view has moved away from
+        if (!_quadtree->getNodeInfo(ident))
+            _quadtree->addTile(ident,true,true);
+    }
+}
+
 - (void)wakeUp
 {
     if ([NSThread currentThread] != _layerThread)
@@ -681,9 +1059,18 @@ static const NSTimeInterval AvailableFrame = 4.0/5.0;
 
 #pragma mark - Quad Tree Importance Delegate
 
-- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(Mbr)theMbr tree:(WhirlyKit::Quadtree *)tree attrs:(NSMutableDictionary *)attrs
+- (double)importanceForTile:(WhirlyKit::Quadtree::Identifier)ident mbr:(Mbr)theMbr tree:(WhirlyKit::Quadtree *)tree attrs:(WhirlyKit::Quadtree::NodeAttrs &)attrs
 {
-    return [_dataStructure importanceForTile:ident mbr:theMbr viewInfo:viewState frameSize:Point2f(_renderer.framebufferWidth,_renderer.framebufferHeight) attrs:attrs];
+    // The view usually hasn't moved meaningfully since the last pass,
+    //  so hand back the importance we already calculated for this node
+    if (attrs.importGeneration == importGeneration)
+        return attrs.cachedImport;
+
+    double import = [_dataStructure importanceForTile:ident mbr:theMbr viewInfo:viewState frameSize:importFrameSize attrs:attrs];
+    attrs.cachedImport = import;
+    attrs.importGeneration = importGeneration;
+
+    return import;
 }
 
 @end
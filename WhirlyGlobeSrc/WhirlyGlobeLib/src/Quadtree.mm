@@ -47,11 +47,18 @@ bool Quadtree::NodeInfo::operator<(const NodeInfo &that) const
     
 Quadtree::Node::Node(Quadtree *tree)
 {
+    init(tree);
+}
+
+void Quadtree::Node::init(Quadtree *tree)
+{
+    nodeInfo = NodeInfo();
     parent = NULL;
     for (unsigned int ii=0;ii<4;ii++)
         children[ii] = NULL;
     identPos = tree->nodesByIdent.end();
     sizePos = tree->nodesBySize.end();
+    evalPos = tree->evalNodes.end();
 }
     
 void Quadtree::Node::addChild(Quadtree *tree,Node *child)
@@ -147,6 +154,9 @@ Quadtree::~Quadtree()
         delete *it;
     nodesByIdent.clear();
     nodesBySize.clear();
+    for (unsigned int ii=0;ii<freeNodes.size();ii++)
+        delete freeNodes[ii];
+    freeNodes.clear();
 }
     
 bool Quadtree::isTilePresent(const Identifier &ident)
@@ -553,7 +563,7 @@ const Quadtree::NodeInfo *Quadtree::addTile(const Identifier &ident,bool newEval
             return NULL;
         
         // Set up the node first, so we don't remove the parent
-        node = new Node(this);
+        node = allocNode();
         node->nodeInfo = nodeInfo;
         node->parent = parent;
         node->nodeInfo.phantom = true;
@@ -696,7 +706,15 @@ void Quadtree::childrenForNode(const Quadtree::Identifier &ident,std::vector<Qua
         for (unsigned int iy=0;iy<2;iy++)
             childIdents.push_back(Identifier(2*ident.x+ix,2*ident.y+iy,ident.level+1));
 }
-    
+
+void Quadtree::getLoadedNodeIdents(std::vector<Quadtree::Identifier> &idents)
+{
+    for (NodesByIdentType::iterator it = nodesByIdent.begin();
+         it != nodesByIdent.end(); ++it)
+        if (!(*it)->nodeInfo.phantom)
+            idents.push_back((*it)->nodeInfo.ident);
+}
+
 bool Quadtree::parentIsLoading(const Identifier &ident)
 {
     Node *node = getNode(ident);
@@ -792,8 +810,27 @@ void Quadtree::removeNode(Node *node)
     // Remove from the parent
     if (node->parent)
         node->parent->removeChild(this, node);
-    
-    delete node;
+
+    freeNode(node);
+}
+
+Quadtree::Node *Quadtree::allocNode()
+{
+    if (freeNodes.empty())
+        return new Node(this);
+
+    Node *node = freeNodes.back();
+    freeNodes.pop_back();
+    node->init(this);
+    return node;
+}
+
+void Quadtree::freeNode(Node *node)
+{
+    // Drop the attribute references now rather than holding on to
+    //  them until the node comes back around
+    node->nodeInfo = NodeInfo();
+    freeNodes.push_back(node);
 }
     
 void Quadtree::setMaxNodes(int newMaxNodes)
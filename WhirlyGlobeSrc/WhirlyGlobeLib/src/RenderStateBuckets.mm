@@ -0,0 +1,92 @@
+/*
+ *  RenderStateBuckets.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 5/14/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "RenderStateBuckets.h"
+
+namespace WhirlyKit
+{
+
+DrawStateKey::DrawStateKey(Drawable *draw)
+{
+    drawPriority = draw->getDrawPriority();
+    requestZBuffer = draw->getRequestZBuffer();
+    programId = draw->getProgram();
+    texId = draw->getStateTexId();
+}
+
+bool DrawStateKey::operator < (const DrawStateKey &that) const
+{
+    if (drawPriority != that.drawPriority)
+        return drawPriority < that.drawPriority;
+    // Z buffer comes before the grouping state so the bucket walk
+    //  matches what the draw list sort would have produced
+    if (requestZBuffer != that.requestZBuffer)
+        return !requestZBuffer;
+    if (programId != that.programId)
+        return programId < that.programId;
+    return texId < that.texId;
+}
+
+void RenderStateBuckets::addDrawable(DrawableRef draw)
+{
+    DrawStateKey key(draw.get());
+    buckets[key].insert(draw);
+    keyMap[draw->getId()] = key;
+}
+
+void RenderStateBuckets::remDrawable(DrawableRef draw)
+{
+    std::map<SimpleIdentity,DrawStateKey>::iterator kit = keyMap.find(draw->getId());
+    if (kit == keyMap.end())
+        return;
+
+    BucketMap::iterator bit = buckets.find(kit->second);
+    if (bit != buckets.end())
+    {
+        bit->second.erase(draw);
+        if (bit->second.empty())
+            buckets.erase(bit);
+    }
+    keyMap.erase(kit);
+}
+
+void RenderStateBuckets::updateDrawable(DrawableRef draw)
+{
+    std::map<SimpleIdentity,DrawStateKey>::iterator kit = keyMap.find(draw->getId());
+    if (kit == keyMap.end())
+        return;
+
+    // Most change requests don't touch the state we key on
+    DrawStateKey newKey(draw.get());
+    if (!(kit->second < newKey) && !(newKey < kit->second))
+        return;
+
+    remDrawable(draw);
+    addDrawable(draw);
+}
+
+void RenderStateBuckets::appendDrawables(std::vector<DrawableRef> &drawList) const
+{
+    for (BucketMap::const_iterator bit = buckets.begin(); bit != buckets.end(); ++bit)
+        for (DrawableSet::const_iterator it = bit->second.begin(); it != bit->second.end(); ++it)
+            drawList.push_back(*it);
+}
+
+}
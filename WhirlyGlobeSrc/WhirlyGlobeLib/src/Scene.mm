@@ -18,7 +18,9 @@
  *
  */
 
+#import <libkern/OSAtomic.h>
 #import "Scene.h"
+#import "SceneRendererES.h"
 #import "GlobeView.h"
 #import "GlobeMath.h"
 #import "TextureAtlas.h"
@@ -36,16 +38,65 @@
 #import "ParticleSystemManager.h"
 #import "BillboardManager.h"
 #import "WideVectorManager.h"
+#import "LayerThread.h"
+#import "ContentionTracker.h"
 
 namespace WhirlyKit
 {
-    
+
+// Texture upload bytes we'll do in a single frame by default.
+// A burst of arriving tiles spreads over a few frames instead of
+//  stalling one of them.
+static const size_t DefaultPerFrameUploadBudget = 2*1024*1024;
+
+// Changes we'll execute in a single frame by default.  A vector add
+//  that lands thousands of requests at once spreads over a few frames
+//  rather than producing one very long one.
+static const int DefaultPerFrameChangeLimit = 2500;
+
+// Below this many independent changes, the pool dispatch costs more
+//  than it saves and we just run them in place
+static const unsigned int MinParallelChanges = 8;
+
+// Run the CPU side of a batch of independent drawable changes on the
+//  shared pool, then do their shared state follow ups in order.
+// Render thread only.
+static void FlushParallelRun(std::vector<DrawableChangeRequest *> &parallelRun,SimpleIDSet &parallelTags,Scene *scene,WhirlyKitSceneRendererES *renderer)
+{
+    if (parallelRun.empty())
+        return;
+
+    if (parallelRun.size() < MinParallelChanges)
+    {
+        for (unsigned int ii=0;ii<parallelRun.size();ii++)
+            parallelRun[ii]->executeParallel(scene,renderer);
+    } else {
+        std::vector<DrawableChangeRequest *> *run = &parallelRun;
+        dispatch_apply(parallelRun.size(), [WhirlyKitLayerThread sharedWorkQueue],
+                       ^(size_t ii) {
+                           (*run)[ii]->executeParallel(scene,renderer);
+                       });
+    }
+
+    // The render state buckets are shared, so those updates stay here
+    for (unsigned int ii=0;ii<parallelRun.size();ii++)
+    {
+        parallelRun[ii]->finishExecute(scene);
+        delete parallelRun[ii];
+    }
+    parallelRun.clear();
+    parallelTags.clear();
+}
+
 Scene::Scene()
 {
 }
-    
+
 void Scene::Init(WhirlyKit::CoordSystemDisplayAdapter *adapter,Mbr localMbr,unsigned int depth)
 {
+    perFrameUploadBudget = DefaultPerFrameUploadBudget;
+    perFrameChangeLimit = DefaultPerFrameChangeLimit;
+    snapshotWriter = NULL;
     pthread_mutex_init(&coordAdapterLock,NULL);
     coordAdapter = adapter;
     cullTree = new CullTree(adapter,localMbr,depth);
@@ -60,7 +111,7 @@ void Scene::Init(WhirlyKit::CoordSystemDisplayAdapter *adapter,Mbr localMbr,unsi
 
     dispatchQueue = dispatch_queue_create("WhirlyKit Scene", 0);
 
-    pthread_mutex_init(&managerLock,NULL);
+    pthread_rwlock_init(&managerLock,NULL);
     // Selection manager is used for object selection from any thread
     addManager(kWKSelectionManager,new SelectionManager(this,[UIScreen mainScreen].scale));
     // Layout manager handles text and icon layout
@@ -89,7 +140,6 @@ void Scene::Init(WhirlyKit::CoordSystemDisplayAdapter *adapter,Mbr localMbr,unsi
     
     activeModels = [NSMutableArray array];
     
-    pthread_mutex_init(&changeRequestLock,NULL);        
     pthread_mutex_init(&subTexLock, NULL);
     pthread_mutex_init(&textureLock,NULL);
     pthread_mutex_init(&generatorLock,NULL);
@@ -123,19 +173,21 @@ Scene::~Scene()
     
     fontTexManager = nil;
     
-    pthread_mutex_destroy(&managerLock);
-    pthread_mutex_destroy(&changeRequestLock);
+    pthread_rwlock_destroy(&managerLock);
     pthread_mutex_destroy(&subTexLock);
     pthread_mutex_destroy(&textureLock);
     pthread_mutex_destroy(&generatorLock);
     pthread_mutex_destroy(&programLock);
     
-    for (unsigned int ii=0;ii<changeRequests.size();ii++)
+    ChangeSet leftoverChanges = deferredChanges;
+    deferredChanges.clear();
+    preheatRequests.drain(leftoverChanges);
+    changeRequests.drain(leftoverChanges);
+    for (unsigned int ii=0;ii<leftoverChanges.size();ii++)
     {
         // Note: Tear down change requests?
-        delete changeRequests[ii];
+        delete leftoverChanges[ii];
     }
-    changeRequests.clear();
     
     activeModels = nil;
     
@@ -156,14 +208,14 @@ CoordSystemDisplayAdapter *Scene::getCoordAdapter()
     
 void Scene::setDisplayAdapter(CoordSystemDisplayAdapter *newCoordAdapter)
 {
-    pthread_mutex_lock(&coordAdapterLock);
+    WK_MUTEX_LOCK(&coordAdapterLock,"Scene::coordAdapterLock");
     coordAdapter = newCoordAdapter;
     pthread_mutex_unlock(&coordAdapterLock);
 }
     
 SimpleIdentity Scene::getGeneratorIDByName(const std::string &name)
 {
-    pthread_mutex_lock(&generatorLock);
+    WK_MUTEX_LOCK(&generatorLock,"Scene::generatorLock");
     
     SimpleIdentity retId = EmptyIdentity;
     for (GeneratorSet::iterator it = generators.begin();
@@ -182,24 +234,121 @@ SimpleIdentity Scene::getGeneratorIDByName(const std::string &name)
     return retId;
 }
 
+ChangeRequestQueue::ChangeRequestQueue()
+    : head(NULL), numChanges(0), generation(0)
+{
+}
+
+ChangeRequestQueue::~ChangeRequestQueue()
+{
+    // Anything left should have been drained and deleted by the scene
+    Node *node = head;
+    while (node)
+    {
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+    head = NULL;
+}
+
+void ChangeRequestQueue::push(const ChangeSet &changes)
+{
+    if (changes.empty())
+        return;
+
+    Node *node = new Node();
+    node->changes = changes;
+    node->when = CFAbsoluteTimeGetCurrent();
+    bool wasEmpty;
+    do {
+        node->next = head;
+        wasEmpty = (node->next == NULL);
+    } while (!OSAtomicCompareAndSwapPtrBarrier(node->next,node,(void * volatile *)&head));
+    OSAtomicAdd32((int32_t)changes.size(),&numChanges);
+    OSAtomicAdd32(1,&generation);
+
+    // Wake anyone waiting on an empty queue (e.g. a sleeping display link)
+    if (wasEmpty)
+        [[NSNotificationCenter defaultCenter] postNotificationName:kWhirlyKitSceneChangesPending object:nil];
+}
+
+void ChangeRequestQueue::push(ChangeRequest *change)
+{
+    Node *node = new Node();
+    node->changes.push_back(change);
+    node->when = CFAbsoluteTimeGetCurrent();
+    bool wasEmpty;
+    do {
+        node->next = head;
+        wasEmpty = (node->next == NULL);
+    } while (!OSAtomicCompareAndSwapPtrBarrier(node->next,node,(void * volatile *)&head));
+    OSAtomicAdd32(1,&numChanges);
+    OSAtomicAdd32(1,&generation);
+
+    if (wasEmpty)
+        [[NSNotificationCenter defaultCenter] postNotificationName:kWhirlyKitSceneChangesPending object:nil];
+}
+
+bool ChangeRequestQueue::hasChanges() const
+{
+    return head != NULL;
+}
+
+int ChangeRequestQueue::count() const
+{
+    return numChanges;
+}
+
+void ChangeRequestQueue::drain(ChangeSet &changes)
+{
+    // Grab the whole list at once
+    Node *list;
+    do {
+        list = head;
+        if (!list)
+            return;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(list,NULL,(void * volatile *)&head));
+
+    // The list comes off in reverse submission order
+    std::vector<Node *> nodes;
+    for (Node *node = list; node; node = node->next)
+        nodes.push_back(node);
+
+    int numDrained = 0;
+#if WK_LOCK_PROFILING
+    NSTimeInterval now = CFAbsoluteTimeGetCurrent();
+#endif
+    for (int ii=(int)nodes.size()-1;ii>=0;ii--)
+    {
+        Node *node = nodes[ii];
+        changes.insert(changes.end(),node->changes.begin(),node->changes.end());
+        numDrained += node->changes.size();
+#if WK_LOCK_PROFILING
+        // Enqueue to drain.  The execute might still wait out a budget.
+        ContentionTracker::getInstance().addLatency("Scene change queue",now - node->when);
+#endif
+        delete node;
+    }
+    OSAtomicAdd32(-numDrained,&numChanges);
+}
+
 // Add change requests to our list
 void Scene::addChangeRequests(const ChangeSet &newChanges)
 {
-    pthread_mutex_lock(&changeRequestLock);
-    
-    changeRequests.insert(changeRequests.end(),newChanges.begin(),newChanges.end());
-    
-    pthread_mutex_unlock(&changeRequestLock);
+    // The whole batch goes on the queue as one node
+    changeRequests.push(newChanges);
+}
+
+void Scene::addPreheatChangeRequests(const ChangeSet &newChanges)
+{
+    preheatRequests.push(newChanges);
 }
 
 // Add a single change request
 void Scene::addChangeRequest(ChangeRequest *newChange)
 {
-    pthread_mutex_lock(&changeRequestLock);
-    
-    changeRequests.push_back(newChange);
-    
-    pthread_mutex_unlock(&changeRequestLock);
+    changeRequests.push(newChange);
 }
 
 GLuint Scene::getGLTexture(SimpleIdentity texIdent)
@@ -209,12 +358,11 @@ GLuint Scene::getGLTexture(SimpleIdentity texIdent)
     
     GLuint ret = 0;
     
-    pthread_mutex_lock(&textureLock);
-    TextureBase dumbTex(texIdent);
-    TextureSet::iterator it = textures.find(&dumbTex);
+    WK_MUTEX_LOCK(&textureLock,"Scene::textureLock");
+    TextureSet::iterator it = textures.find(texIdent);
     if (it != textures.end())
     {
-        ret = (*it)->getGLId();
+        ret = it->second->getGLId();
     }
     
     pthread_mutex_unlock(&textureLock);
@@ -224,18 +372,16 @@ GLuint Scene::getGLTexture(SimpleIdentity texIdent)
 
 DrawableRef Scene::getDrawable(SimpleIdentity drawId)
 {
-    BasicDrawable *dumbDraw = new BasicDrawable("None");
-    dumbDraw->setId(drawId);
-    DrawableRefSet::iterator it = drawables.find(DrawableRef(dumbDraw));
+    DrawableRefSet::iterator it = drawables.find(drawId);
     if (it != drawables.end())
-        return *it;
-    
+        return it->second;
+
     return DrawableRef();
 }
 
 Generator *Scene::getGenerator(SimpleIdentity genId)
 {
-    pthread_mutex_lock(&generatorLock);
+    WK_MUTEX_LOCK(&generatorLock,"Scene::generatorLock");
     
     Generator *retGen = NULL;
     Generator dumbGen;
@@ -253,34 +399,35 @@ Generator *Scene::getGenerator(SimpleIdentity genId)
     
 void Scene::setRenderer(WhirlyKitSceneRendererES *renderer)
 {
-    pthread_mutex_lock(&managerLock);
-    
+    WK_RWLOCK_RDLOCK(&managerLock,"Scene::managerLock");
+
     for (std::map<std::string,SceneManager *>::iterator it = managers.begin();
          it != managers.end(); ++it)
         it->second->setRenderer(renderer);
-    
-    pthread_mutex_unlock(&managerLock);
+
+    pthread_rwlock_unlock(&managerLock);
 }
 
 
 SceneManager *Scene::getManager(const char *name)
 {
     SceneManager *ret = NULL;
-    
-    pthread_mutex_lock(&managerLock);
-    
+
+    // Lookups happen from every thread, so they share the read side
+    WK_RWLOCK_RDLOCK(&managerLock,"Scene::managerLock");
+
     std::map<std::string,SceneManager *>::iterator it = managers.find((std::string)name);
     if (it != managers.end())
         ret = it->second;
-    
-    pthread_mutex_unlock(&managerLock);
-    
+
+    pthread_rwlock_unlock(&managerLock);
+
     return ret;
 }
 
 void Scene::addManager(const char *name,SceneManager *manager)
 {
-    pthread_mutex_lock(&managerLock);
+    WK_RWLOCK_WRLOCK(&managerLock,"Scene::managerLock");
 
     // If there's one here, we'll clear it out first
     std::map<std::string,SceneManager *>::iterator it = managers.find((std::string)name);
@@ -288,8 +435,8 @@ void Scene::addManager(const char *name,SceneManager *manager)
         managers.erase(it);
     managers[(std::string)name] = manager;
     manager->setScene(this);
-    
-    pthread_mutex_unlock(&managerLock);
+
+    pthread_rwlock_unlock(&managerLock);
 }
 
 void Scene::addActiveModel(NSObject<WhirlyKitActiveModel> *activeModel)
@@ -313,7 +460,7 @@ void Scene::teardownGL()
     // Note: Tear down active models
     for (DrawableRefSet::iterator it = drawables.begin();
          it != drawables.end(); ++it)
-        (*it)->teardownGL(&memManager);
+        it->second->teardownGL(&memManager);
     if (cullTree)
     {
         delete cullTree;
@@ -323,7 +470,7 @@ void Scene::teardownGL()
     for (TextureSet::iterator it = textures.begin();
          it != textures.end(); ++it)
     {
-        TextureBase *texture = *it;
+        TextureBase *texture = it->second;
         texture->destroyInGL(&memManager);
         delete texture;
     }
@@ -335,13 +482,12 @@ void Scene::teardownGL()
 
 TextureBase *Scene::getTexture(SimpleIdentity texId)
 {
-    pthread_mutex_lock(&textureLock);
+    WK_MUTEX_LOCK(&textureLock,"Scene::textureLock");
     
     TextureBase *retTex = NULL;
-    TextureBase dumbTex(texId);
-    Scene::TextureSet::iterator it = textures.find(&dumbTex);
+    Scene::TextureSet::iterator it = textures.find(texId);
     if (it != textures.end())
-        retTex = *it;
+        retTex = it->second;
     
     pthread_mutex_unlock(&textureLock);
     
@@ -357,34 +503,110 @@ const DrawableRefSet &Scene::getDrawables()
 // We'll grab the lock and we're only expecting to be called in the rendering thread
 void Scene::processChanges(WhirlyKitView *view,WhirlyKitSceneRendererES *renderer)
 {
-    // We're not willing to wait in the rendering thread
-    if (!pthread_mutex_trylock(&changeRequestLock))
+    // Changes held over from last frame go first to keep submission order
+    ChangeSet changes;
+    changes.swap(deferredChanges);
+
+    // Warm up changes drain ahead of the regular stream, so later
+    //  changes that reference the resources they create stay correct
+    preheatRequests.drain(changes);
+
+    // Then pull everything waiting off the queue in one go
+    changeRequests.drain(changes);
+
+    // Only bother working out damage regions if the renderer cares
+    bool trackDamage = renderer.scissorDamageMode;
+
+    // A tile layer flush hands us hundreds of drawables at once,
+    //  so defer the cull tree splits until we've added them all
+    size_t uploadedBytes = 0;
+    int numExecuted = 0;
+    bool overBudget = false;
+    // Consecutive changes tagged with distinct resources do their CPU
+    //  side work together on the shared pool.  A tile flush hands us
+    //  long runs of drawable attribute changes that qualify.  Anything
+    //  untagged, or a second change to the same resource, breaks the
+    //  run so submission order holds per resource.
+    std::vector<DrawableChangeRequest *> parallelRun;
+    SimpleIDSet parallelTags;
+    cullTree->beginBulkAdds();
+    for (unsigned int ii=0;ii<changes.size();ii++)
     {
-        for (unsigned int ii=0;ii<changeRequests.size();ii++)
-        {
-            ChangeRequest *req = changeRequests[ii];
-            if (req) {
-                req->execute(this,renderer,view);
-                delete req;
+        ChangeRequest *req = changes[ii];
+        if (req) {
+            // Once the uploads run past the byte budget or the count
+            //  limit, the rest of the changes wait for the next frame.
+            //  In order, so geometry enables still come after the
+            //  uploads they depend on.
+            if (!overBudget)
+            {
+                size_t reqBytes = req->uploadSize();
+                if ((perFrameUploadBudget > 0 && uploadedBytes > 0 &&
+                     uploadedBytes + reqBytes > perFrameUploadBudget) ||
+                    (perFrameChangeLimit > 0 && numExecuted >= perFrameChangeLimit))
+                    overBudget = true;
+                else
+                    uploadedBytes += reqBytes;
+            }
+            if (overBudget)
+            {
+                // Interactive toggles still slip through if what they
+                //  touch is already in the scene.  Ones aimed at a
+                //  deferred add carry over with everything else, so
+                //  they can't run ahead of it.
+                DrawableChangeRequest *drawReq = NULL;
+                if (req->priority() == ChangeRequest::PriorityInteractive)
+                    drawReq = dynamic_cast<DrawableChangeRequest *>(req);
+                if (!drawReq || !getDrawable(drawReq->getDrawId()))
+                {
+                    deferredChanges.push_back(req);
+                    continue;
+                }
+            }
+            numExecuted++;
+
+            // Damage tracking wants to look at state in order, so the
+            //  parallel path sits out in scissor damage mode
+            DrawableChangeRequest *parReq = NULL;
+            if (!trackDamage && req->resourceTag() != EmptyIdentity)
+                parReq = dynamic_cast<DrawableChangeRequest *>(req);
+            if (parReq)
+            {
+                if (parallelTags.find(parReq->resourceTag()) != parallelTags.end())
+                    FlushParallelRun(parallelRun,parallelTags,this,renderer);
+                parallelTags.insert(parReq->resourceTag());
+                parallelRun.push_back(parReq);
+                continue;
+            }
+
+            // Everything else runs in place, after the run ahead of it
+            FlushParallelRun(parallelRun,parallelTags,this,renderer);
+
+            if (trackDamage)
+            {
+                // Ask before execute(), while the old state is still around
+                Mbr damageMbr;
+                if (req->getDamageRegion(this,renderer,damageMbr))
+                    [renderer addDamageRect:damageMbr];
+                else
+                    [renderer addFullDamage];
             }
+            req->execute(this,renderer,view);
+            delete req;
         }
-        changeRequests.clear();
-        
-        pthread_mutex_unlock(&changeRequestLock);
     }
+    FlushParallelRun(parallelRun,parallelTags,this,renderer);
+    cullTree->endBulkAdds();
 }
     
 bool Scene::hasChanges()
 {
-    bool changes = false;
-    if (!pthread_mutex_trylock(&changeRequestLock))
-    {
-        changes = !changeRequests.empty();
-        
-        pthread_mutex_unlock(&changeRequestLock);            
-    }        
-    if (changes)
+    // Anything held over from an over-budget frame
+    if (!deferredChanges.empty())
+        return true;
+    if (preheatRequests.hasChanges() || changeRequests.hasChanges())
         return true;
+    bool changes = false;
     
     // How about the active models?
     for (NSObject<WhirlyKitActiveModel> *model in activeModels)
@@ -397,7 +619,7 @@ bool Scene::hasChanges()
 // Add a single sub texture map
 void Scene::addSubTexture(const SubTexture &subTex)
 {
-    pthread_mutex_lock(&subTexLock);
+    WK_MUTEX_LOCK(&subTexLock,"Scene::subTexLock");
     subTextureMap.insert(subTex);
     pthread_mutex_unlock(&subTexLock);
 }
@@ -405,7 +627,7 @@ void Scene::addSubTexture(const SubTexture &subTex)
 // Add a whole group of sub textures maps
 void Scene::addSubTextures(const std::vector<SubTexture> &subTexes)
 {
-    pthread_mutex_lock(&subTexLock);
+    WK_MUTEX_LOCK(&subTexLock,"Scene::subTexLock");
     subTextureMap.insert(subTexes.begin(),subTexes.end());
     pthread_mutex_unlock(&subTexLock);
 }
@@ -413,7 +635,7 @@ void Scene::addSubTextures(const std::vector<SubTexture> &subTexes)
 // Look for a sub texture by ID
 SubTexture Scene::getSubTexture(SimpleIdentity subTexId)
 {
-    pthread_mutex_lock(&subTexLock);
+    WK_MUTEX_LOCK(&subTexLock,"Scene::subTexLock");
     SubTexture dumbTex;
     dumbTex.setId(subTexId);
     SubTextureSet::iterator it = subTextureMap.find(dumbTex);
@@ -449,9 +671,63 @@ void Scene::dumpStats()
         (*it)->dumpStats();
 }
 
+void Scene::memoryCensus(MemoryCensusEntry &rootEntry)
+{
+    rootEntry.name = "scene";
+
+    // Drawables, by their own estimates
+    MemoryCensusEntry drawEntry("drawables");
+    for (DrawableRefSet::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+    {
+        drawEntry.bytes += it->second->memorySize();
+        drawEntry.count++;
+    }
+    rootEntry.children.push_back(drawEntry);
+
+    // Textures still hanging on to a system memory copy
+    MemoryCensusEntry texEntry("textures");
+    WK_MUTEX_LOCK(&textureLock,"Scene::textureLock");
+    for (TextureSet::iterator it = textures.begin();
+         it != textures.end(); ++it)
+    {
+        texEntry.bytes += it->second->uploadSize();
+        texEntry.count++;
+    }
+    pthread_mutex_unlock(&textureLock);
+    rootEntry.children.push_back(texEntry);
+
+    // GPU side allocations, as tracked by the memory manager
+    MemoryCensusEntry gpuEntry("gpu");
+    size_t memByClass[WKMemMax];
+    gpuEntry.bytes = memManager.getTrackedMem(memByClass);
+    static const char *MemClassNames[WKMemMax] = {"textures","texAtlases","drawables","drawAtlases"};
+    for (unsigned int ii=0;ii<WKMemMax;ii++)
+    {
+        MemoryCensusEntry classEntry(MemClassNames[ii]);
+        classEntry.bytes = memByClass[ii];
+        gpuEntry.children.push_back(classEntry);
+    }
+    rootEntry.children.push_back(gpuEntry);
+
+    // The managers know what bookkeeping they're sitting on
+    WK_RWLOCK_RDLOCK(&managerLock,"Scene::managerLock");
+    for (std::map<std::string,SceneManager *>::iterator it = managers.begin();
+         it != managers.end(); ++it)
+    {
+        MemoryCensusEntry managerEntry(it->first);
+        it->second->memoryCensus(managerEntry);
+        rootEntry.children.push_back(managerEntry);
+    }
+    pthread_rwlock_unlock(&managerLock);
+
+    for (unsigned int ii=0;ii<rootEntry.children.size();ii++)
+        rootEntry.bytes += rootEntry.children[ii].bytes;
+}
+
 OpenGLES2Program *Scene::getProgram(SimpleIdentity progId)
 {
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
 
     OpenGLES2Program *prog = NULL;
     OpenGLES2Program dummy(progId);
@@ -470,7 +746,7 @@ OpenGLES2Program *Scene::getProgramBySceneName(const std::string &sceneName)
 {
     OpenGLES2Program *prog = NULL;
 
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
     
     OpenGLES2ProgramMap::iterator it = glProgramMap.find(sceneName);
     if (it != glProgramMap.end())
@@ -486,12 +762,32 @@ SimpleIdentity Scene::getProgramIDBySceneName(const std::string &sceneName)
     OpenGLES2Program *prog = getProgramBySceneName(sceneName);
     return prog ? prog->getId() : EmptyIdentity;
 }
+
+std::string Scene::getSceneNameForProgramID(SimpleIdentity progId)
+{
+    std::string sceneName = "";
+
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
+
+    // The map is small, so a walk beats maintaining a reverse map
+    for (OpenGLES2ProgramMap::iterator it = glProgramMap.begin();
+         it != glProgramMap.end(); ++it)
+        if (it->second->getId() == progId)
+        {
+            sceneName = it->first;
+            break;
+        }
+
+    pthread_mutex_unlock(&programLock);
+
+    return sceneName;
+}
     
 OpenGLES2Program *Scene::getProgramByName(const std::string &name)
 {
     OpenGLES2Program *prog = NULL;
     
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
     
     OpenGLES2ProgramMap::iterator it = glProgramMap.find(name);
     if (it != glProgramMap.end())
@@ -511,7 +807,7 @@ SimpleIdentity Scene::getProgramIDByName(const std::string &name)
     
 void Scene::addProgram(OpenGLES2Program *prog)
 {
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
     
     if (glPrograms.find(prog) == glPrograms.end())
         glPrograms.insert(prog);
@@ -522,7 +818,7 @@ void Scene::addProgram(OpenGLES2Program *prog)
 
 void Scene::addProgram(const std::string &sceneName,OpenGLES2Program *prog)
 {
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
 
     if (glPrograms.find(prog) == glPrograms.end())
         glPrograms.insert(prog);
@@ -533,7 +829,7 @@ void Scene::addProgram(const std::string &sceneName,OpenGLES2Program *prog)
     
 void Scene::setSceneProgram(const std::string &sceneName,SimpleIdentity progId)
 {
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
     
     OpenGLES2Program *prog = NULL;
     OpenGLES2Program dummy(progId);
@@ -551,7 +847,7 @@ void Scene::setSceneProgram(const std::string &sceneName,SimpleIdentity progId)
     
 void Scene::removeProgram(SimpleIdentity progId)
 {
-    pthread_mutex_lock(&programLock);
+    WK_MUTEX_LOCK(&programLock,"Scene::programLock");
     
     OpenGLES2Program *prog = NULL;
     OpenGLES2Program dummy(progId);
@@ -581,23 +877,45 @@ void AddTextureReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,Whir
 {
     if (!tex->getGLId())
         tex->createInGL(scene->getMemManager());
-    scene->textures.insert(tex);
+    scene->textures[tex->getId()] = tex;
     tex = NULL;
 }
 
+void UpdateTextureReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+{
+    Texture *tex = dynamic_cast<Texture *>(scene->getTexture(texture));
+    if (tex)
+        tex->updateInGL(texData);
+    texData = nil;
+}
+
 void RemTextureReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
 {
-    TextureBase dumbTex(texture);
-    Scene::TextureSet::iterator it = scene->textures.find(&dumbTex);
+    Scene::TextureSet::iterator it = scene->textures.find(texture);
     if (it != scene->textures.end())
     {
-        TextureBase *tex = *it;
+        TextureBase *tex = it->second;
         tex->destroyInGL(scene->getMemManager());
         scene->textures.erase(it);
         delete tex;
     }
 }
 
+void RemTextureSetReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+{
+    for (SimpleIDSet::iterator sit = textures.begin(); sit != textures.end(); ++sit)
+    {
+        Scene::TextureSet::iterator it = scene->textures.find(*sit);
+        if (it != scene->textures.end())
+        {
+            TextureBase *tex = it->second;
+            tex->destroyInGL(scene->getMemManager());
+            scene->textures.erase(it);
+            delete tex;
+        }
+    }
+}
+
 void AddDrawableReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
 {
     // If this is an instance, deal with that madness
@@ -630,15 +948,33 @@ void AddDrawableReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,Whi
 
 void RemDrawableReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
 {
-    BasicDrawable *dumbDraw = new BasicDrawable("None");
-    dumbDraw->setId(drawable);
-    DrawableRefSet::iterator it = scene->drawables.find(DrawableRef(dumbDraw));
+    DrawableRefSet::iterator it = scene->drawables.find(drawable);
     if (it != scene->drawables.end())
     {
+        // Hang on to the drawable, since remDrawable() invalidates the iterator
+        DrawableRef draw = it->second;
+
         // Teardown OpenGL foo
-        (*it)->teardownGL(scene->getMemManager());
+        draw->teardownGL(scene->getMemManager());
 
-        scene->remDrawable(*it);        
+        scene->remDrawable(draw);
+    }
+}
+
+void RemDrawableSetReq::execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+{
+    for (SimpleIDSet::iterator sit = drawables.begin(); sit != drawables.end(); ++sit)
+    {
+        DrawableRefSet::iterator it = scene->drawables.find(*sit);
+        if (it != scene->drawables.end())
+        {
+            DrawableRef draw = it->second;
+
+            // Teardown OpenGL foo
+            draw->teardownGL(scene->getMemManager());
+
+            scene->remDrawable(draw);
+        }
     }
 }
 
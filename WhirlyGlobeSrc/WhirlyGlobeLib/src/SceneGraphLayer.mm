@@ -0,0 +1,108 @@
+/*
+ *  SceneGraphLayer.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/26/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "SceneGraphLayer.h"
+
+using namespace WhirlyKit;
+
+@implementation WhirlyKitSceneGraphLayer
+{
+    WhirlyKitLayerThread * __weak layerThread;
+    WhirlyKit::Scene *scene;
+    WhirlyKit::SceneGraphManager *sceneGraphManager;
+    WhirlyKitViewState *lastViewState;
+}
+
+- (void)startWithThread:(WhirlyKitLayerThread *)inLayerThread scene:(WhirlyKit::Scene *)inScene
+{
+    layerThread = inLayerThread;
+    scene = inScene;
+    // Not in atlas mode.  The drawables are owned by someone else
+    sceneGraphManager = new SceneGraphManager(NULL);
+    [layerThread.viewWatcher addWatcherTarget:self selector:@selector(viewUpdate:) minTime:0.1 minDist:0.0 maxLagTime:0.0];
+}
+
+- (void)shutdown
+{
+    if (layerThread.viewWatcher)
+        [layerThread.viewWatcher removeWatcherTarget:self selector:@selector(viewUpdate:)];
+
+    if (sceneGraphManager)
+    {
+        delete sceneGraphManager;
+        sceneGraphManager = NULL;
+    }
+    lastViewState = nil;
+    scene = NULL;
+}
+
+// Re-run the traversal and hand the results off to the scene
+- (void)runUpdate
+{
+    if (!sceneGraphManager || !lastViewState)
+        return;
+
+    ChangeSet changes;
+    sceneGraphManager->update(lastViewState, changes);
+    [layerThread addChangeRequests:changes];
+}
+
+- (void)viewUpdate:(WhirlyKitViewState *)viewState
+{
+    lastViewState = viewState;
+    [self runUpdate];
+}
+
+- (void)addSceneFragment:(WhirlyKit::SceneGraphNode *)node attachID:(WhirlyKit::SimpleIdentity)attachID
+{
+    if (!layerThread || ([NSThread currentThread] != layerThread))
+    {
+        NSLog(@"WhirlyKitSceneGraphLayer: addSceneFragment:attachID: called outside layer thread.  Dropping fragment.");
+        return;
+    }
+
+    sceneGraphManager->attachSceneFragment(attachID, node);
+    // Get the new nodes' visibility sorted out right away
+    [self runUpdate];
+}
+
+- (void)removeSceneFragmentNum:(NSNumber *)nodeID
+{
+    [self removeSceneFragment:[nodeID longLongValue]];
+}
+
+- (void)removeSceneFragment:(WhirlyKit::SimpleIdentity)nodeID
+{
+    if (!layerThread)
+        return;
+    // This one we can marshal over ourselves
+    if ([NSThread currentThread] != layerThread)
+    {
+        [self performSelector:@selector(removeSceneFragmentNum:) onThread:layerThread withObject:@(nodeID) waitUntilDone:NO];
+        return;
+    }
+
+    ChangeSet changes;
+    sceneGraphManager->removeSceneFragment(nodeID, changes);
+    [layerThread addChangeRequests:changes];
+    [self runUpdate];
+}
+
+@end
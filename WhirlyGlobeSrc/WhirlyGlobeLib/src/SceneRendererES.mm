@@ -50,7 +50,13 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
 - (id)initWithFrameInfo:(WhirlyKitRendererFrameInfo *)info
 {
     self = [super init];
-    
+    [self setFromFrameInfo:info];
+
+    return self;
+}
+
+- (void)setFromFrameInfo:(WhirlyKitRendererFrameInfo *)info
+{
     _oglVersion = info.oglVersion;
     _sceneRenderer = info.sceneRenderer;
     _theView = info.theView;
@@ -75,8 +81,7 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
     _program = info.program;
     _lights = info.lights;
     _stateOpt = info.stateOpt;
-    
-    return self;
+    _overdrawMode = info.overdrawMode;
 }
 
 @end
@@ -175,10 +180,20 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
 @implementation WhirlyKitSceneRendererES
 {
     // View state from the last render, for comparison
-    Eigen::Matrix4d modelMat,viewMat,projMat;    
+    Eigen::Matrix4d modelMat,viewMat,projMat;
+
+    // Eye vector the cached backface culling results were stamped with
+    bool eyeCullValid;
+    Eigen::Vector3f cullEyeVec;
+    int eyeCullGen;
 }
 
 - (id) initWithOpenGLESVersion:(EAGLRenderingAPI)apiVersion
+{
+    return [self initWithOpenGLESVersion:apiVersion sharegroup:nil];
+}
+
+- (id) initWithOpenGLESVersion:(EAGLRenderingAPI)apiVersion sharegroup:(EAGLSharegroup *)sharegroup
 {
 	if ((self = [super init]))
 	{
@@ -192,8 +207,13 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
         _perfInterval = -1;
         _scale = [[UIScreen mainScreen] scale];
 		
-		_context = [[EAGLContext alloc] initWithAPI:apiVersion];
-        
+        // Joining another context's sharegroup lets several renderers
+        //  draw one scene's buffers and textures
+        if (sharegroup)
+            _context = [[EAGLContext alloc] initWithAPI:apiVersion sharegroup:sharegroup];
+        else
+            _context = [[EAGLContext alloc] initWithAPI:apiVersion];
+
         EAGLContext *oldContext = [EAGLContext currentContext];
         if (!_context || ![EAGLContext setCurrentContext:_context])
 		{
@@ -270,6 +290,18 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
     renderUntil = std::max(renderUntil,newRenderUntil);
 }
 
+- (void)addDamageRect:(WhirlyKit::Mbr)damage
+{
+    if (!_scissorDamageMode || fullDamage)
+        return;
+    damageMbr.expand(damage);
+}
+
+- (void)addFullDamage
+{
+    fullDamage = true;
+}
+
 - (void)setTriggerDraw
 {
     _triggerDraw = true;
@@ -331,6 +363,60 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
 	return YES;
 }
 
+- (BOOL) resizeToWidth:(int)width height:(int)height
+{
+    EAGLContext *oldContext = [EAGLContext currentContext];
+    if (oldContext != _context)
+        [EAGLContext setCurrentContext:_context];
+
+    // Same setup as resizeFromLayer:, but the color buffer gets its own
+    //  storage rather than sharing a drawable
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    CheckGLError("SceneRendererES: glBindRenderbuffer");
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8_OES, width, height);
+    CheckGLError("SceneRendererES: glRenderbufferStorage");
+    _framebufferWidth = width;
+    _framebufferHeight = height;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    CheckGLError("SceneRendererES: glBindRenderbuffer");
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, _framebufferWidth, _framebufferHeight);
+    CheckGLError("SceneRendererES: glRenderbufferStorage");
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+    CheckGLError("SceneRendererES: glFramebufferRenderbuffer");
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        NSLog(@"Failed to make complete framebuffer object %x", glCheckFramebufferStatus(GL_FRAMEBUFFER));
+        if (oldContext != _context)
+            [EAGLContext setCurrentContext:oldContext];
+        return NO;
+    }
+
+    lastDraw = 0;
+
+    if (oldContext != _context)
+        [EAGLContext setCurrentContext:oldContext];
+
+    // If we've resized, we're looking at different content
+    if (_theView)
+        [_theView runViewUpdates];
+
+    return YES;
+}
+
+- (void)resetPerfTimer
+{
+    perfTimer.clear();
+}
+
+- (NSString *)perfTimerReport
+{
+    std::string json;
+    perfTimer.report(json);
+    return [NSString stringWithUTF8String:json.c_str()];
+}
+
 - (void) setClearColor:(UIColor *)color
 {
     _clearColor = [color asRGBAColor];
@@ -371,22 +457,30 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
 {
     CoordSystemDisplayAdapter *coordAdapter = _scene->getCoordAdapter();
     
-    // Check the four corners of the cullable to see if they're pointed away
+    // Check if the cullable is pointed away from us entirely
     // But just for the globe case
     bool inView = false;
     if (coordAdapter->isFlat() || isTopLevel)
     {
         inView = true;
-    } else {
-        for (unsigned int ii=0;ii<WhirlyKitCullableCornerNorms;ii++)
-        {
-            Vector3f norm = cullable->cornerNorms[ii];
-            if (norm.dot(eyeVec) > 0)
+        // If the eye moved past the slop angle, the cached backface
+        //  results below us are stale, so bump the generation
+        if (isTopLevel && !coordAdapter->isFlat())
+            if (!eyeCullValid || cullEyeVec.dot(eyeVec) < cosf(WhirlyKitEyeCullSlop))
             {
-                inView = true;
-                break;
+                eyeCullValid = true;
+                cullEyeVec = eyeVec;
+                eyeCullGen++;
             }
+    } else {
+        // One dot product against the node's bounding cone, cached
+        //  until the view moves past the slop angle
+        if (cullable->eyeCullGen != eyeCullGen)
+        {
+            cullable->eyeFacing = (cullEyeVec.dot(cullable->coneAxis) > cullable->minEyeDot);
+            cullable->eyeCullGen = eyeCullGen;
         }
+        inView = cullable->eyeFacing;
     }
     if (_doCulling && !inView)
         return;
@@ -403,11 +497,16 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
     //  the screen area, keep going down (if we can).
     float localScreenArea = localScreenMbr.area();
     float screenArea = screenMbr.area();
+    int numBefore = (int)toDraw->size();
     if (isTopLevel || (localScreenArea > screenArea/4 && cullable->hasChildren()))
     {
         // Grab the drawables at this level
         [self mergeDrawableSet:cullable->getDrawables() globeView:globeView frameSize:frameSize modelTrans:modelTrans frameInfo:frameInfo screenMbr:screenMbr toDraw:toDraw considered:drawablesConsidered];
-        
+
+        // Overdraw estimate before we recurse, so children count their own
+        if (_overdrawMode && localScreenMbr.valid())
+            perfTimer.addCount("Estimated frag cost (Kpx)", (int)(localScreenMbr.area() * ((int)toDraw->size() - numBefore) / 1000));
+
         // And recurse downward for the rest
         for (unsigned int ii=0;ii<4;ii++)
         {
@@ -418,6 +517,12 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
     } else {
         // If not, then just return what we found here
         [self mergeDrawableSet:cullable->getChildDrawables() globeView:globeView frameSize:frameSize modelTrans:modelTrans frameInfo:frameInfo screenMbr:screenMbr toDraw:toDraw considered:drawablesConsidered];
+
+        // Rough fragment cost: this node's footprint times how many
+        //  drawables will run over it.  It's an upper bound, but it
+        //  moves the same direction the real fill rate does.
+        if (_overdrawMode && localScreenMbr.valid())
+            perfTimer.addCount("Estimated frag cost (Kpx)", (int)(localScreenMbr.area() * ((int)toDraw->size() - numBefore) / 1000));
     }
 }
 
@@ -457,6 +562,83 @@ bool matrixAisSameAsB(Matrix4d &a,Matrix4d &b)
     return true;
 }
 
+// Check if anything wants to draw, without consuming the draw trigger.
+// The on demand render scheduler uses this to decide if the display
+//  link can go to sleep.
+- (bool)hasRenderWork
+{
+    if (!_useViewChanged)
+        return true;
+
+    if (lastDraw == 0.0 || _triggerDraw)
+        return true;
+
+    // An animation is still running
+    if (lastDraw < renderUntil)
+        return true;
+
+    // Outstanding change requests, or content another renderer sharing
+    //  the scene already drained that we haven't drawn yet
+    if (_scene && (_scene->hasChanges() || _scene->getChangeGeneration() != _lastDrawnGeneration))
+        return true;
+
+    // Compare against the view state the last frame drew with,
+    //  but don't update it -- that's viewDidChange's job
+    Matrix4d newModelMat = [_theView calcModelMatrix];
+    Matrix4d newViewMat = [_theView calcViewMatrix];
+    Matrix4d newProjMat = [_theView calcProjectionMatrix:Point2f(_framebufferWidth,_framebufferHeight) margin:0.0];
+
+    return !(matrixAisSameAsB(newModelMat,modelMat) && matrixAisSameAsB(newViewMat,viewMat) && matrixAisSameAsB(newProjMat, projMat));
+}
+
+- (void)getFrameSamples:(std::vector<WhirlyKit::PerformanceTimer::FrameSample> &)samples
+{
+    perfTimer.getFrameSamples(samples);
+}
+
+// Names for the telemetry counters, in the order the enum declares them
+static NSString * const TelemCounterNames[PerformanceTimer::TelemetryCounters::TelemMax] =
+    {@"tileLoads",@"tileLoadTimeUs",@"netRequests",@"netBytes",@"loadQueueDepth",@"texMemory"};
+
+- (NSDictionary *)telemetrySnapshot
+{
+    PerformanceTimer::TelemetrySnapshot snapshot;
+    perfTimer.getTelemetrySnapshot(snapshot,false);
+
+    NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+    [dict setObject:@(snapshot.frameTimeP50) forKey:@"frameTimeP50"];
+    [dict setObject:@(snapshot.frameTimeP95) forKey:@"frameTimeP95"];
+    [dict setObject:@(snapshot.frameTimeP99) forKey:@"frameTimeP99"];
+    [dict setObject:@(snapshot.frameTimeMax) forKey:@"frameTimeMax"];
+    [dict setObject:@(snapshot.avgDrawables) forKey:@"avgDrawables"];
+    [dict setObject:@(snapshot.avgChanges) forKey:@"avgChanges"];
+    [dict setObject:@(snapshot.numFrames) forKey:@"numFrames"];
+    for (unsigned int ii=0;ii<PerformanceTimer::TelemetryCounters::TelemMax;ii++)
+        [dict setObject:@(snapshot.counters[ii]) forKey:TelemCounterNames[ii]];
+
+    return dict;
+}
+
+- (void)frameTimeAlert:(double)p95Ms
+{
+    if (frameTimeAlertBlock)
+        frameTimeAlertBlock(p95Ms);
+}
+
+// Trampoline from the C++ alert callback into the block the caller gave us
+static void FrameTimeAlertTrampoline(double p95Ms,void *userData)
+{
+    WhirlyKitSceneRendererES *renderer = (__bridge WhirlyKitSceneRendererES *)userData;
+    [renderer frameTimeAlert:p95Ms];
+}
+
+- (void)setFrameTimeAlertThreshold:(double)thresholdMs callback:(void (^)(double p95Ms))callback
+{
+    frameTimeAlertBlock = callback;
+    // The timer holds a bare pointer back to us, which is fine since we own it
+    perfTimer.setFrameTimeAlert(thresholdMs,(callback ? FrameTimeAlertTrampoline : NULL),(__bridge void *)self);
+}
+
 - (void)forceDrawNextFrame
 {
     lastDraw = 0;
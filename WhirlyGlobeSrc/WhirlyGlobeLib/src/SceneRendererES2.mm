@@ -26,10 +26,33 @@
 #import "NSDictionary+Stuff.h"
 #import "NSString+Stuff.h"
 #import "MaplyView.h"
+#import "LayerThread.h"
+#import "ContentionTracker.h"
+#import "WorkRegulator.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
 
+// Biggest fraction of the screen we'll bother scissoring down to.
+// Past this the full redraw is cheaper than the bookkeeping.
+static const float kWKScissorDamageFraction = 0.5;
+// Pixels of padding around a damage region, to cover rounding
+static const int kWKScissorDamagePad = 2;
+
+// Minimum time between GPU memory pressure notifications, so the
+//  layers get a chance to react before we nag them again
+static const NSTimeInterval GPUMemPressurePeriod = 5.0;
+
+// How long the active models get to update themselves each frame.
+// Anyone left over picks up at the front of the line next frame.
+static const NSTimeInterval ActiveModelUpdateBudget = 0.5/1000.0;
+
+// The snapshot data provider owns the pixel buffer once it's handed over
+static void ReleaseSnapshotData(void *info,const void *data,size_t size)
+{
+    free((void *)data);
+}
+
 namespace WhirlyKit
 {
 
@@ -105,6 +128,37 @@ public:
     bool renderSetup;
     WhirlyKitOpenGLStateOptimizer *renderStateOptimizer;
     std::set<__weak NSObject<WhirlyKitFrameBoundaryObserver> *> frameObservers;
+
+    // Frame-scoped state we reuse from frame to frame, so the steady
+    //  state render loop doesn't touch the heap.  The vectors hang on
+    //  to their capacity between frames.
+    WhirlyKitRendererFrameInfo *frameInfoPool;
+    NSMutableArray *offFrameInfoPool;
+    std::vector<DrawableContainer> frameDrawList;
+    std::vector<DrawableRef> frameScreenDrawables;
+    std::vector<DrawableRef> frameGeneratedDrawables;
+    std::vector<DrawableRef> frameBucketDrawables;
+    std::vector<Eigen::Matrix4d> frameMvpMats;
+    std::vector<Eigen::Matrix4f> frameMvpMats4f;
+
+    // Last time we told anyone we're over the GPU memory budget
+    NSTimeInterval lastMemPressureNote;
+
+    // Which active model gets to update first this frame
+    int activeModelOffset;
+
+    // Outstanding background shader setup, if asyncShaderSetup is on
+    dispatch_group_t shaderSetupGroup;
+
+    // Dynamic resolution state.  The scene renders into this scaled
+    //  framebuffer when the render scale drops below native, and the
+    //  blit shader upscales it to the screen at the end of the frame.
+    GLuint scaledFramebuffer;
+    GLuint scaledColorTex;
+    GLuint scaledDepthRb;
+    int scaledWidth,scaledHeight;
+    int framesAtRenderScale;
+    WhirlyKit::OpenGLES2Program *blitProgram;
 }
 
 - (id) init
@@ -112,7 +166,17 @@ public:
     return [self initWithVersion:kEAGLRenderingAPIOpenGLES2];
 }
 
+- (id) initWithSharegroup:(EAGLSharegroup *)sharegroup
+{
+    return [self initWithVersion:kEAGLRenderingAPIOpenGLES2 sharegroup:sharegroup];
+}
+
 - (id) initWithVersion:(EAGLRenderingAPI)apiVersion
+{
+    return [self initWithVersion:apiVersion sharegroup:nil];
+}
+
+- (id) initWithVersion:(EAGLRenderingAPI)apiVersion sharegroup:(EAGLSharegroup *)sharegroup
 {
     // We do this to pull in the categories without the -ObjC flag.
     // It's dumb, but it works
@@ -126,7 +190,7 @@ public:
         dummyInit = true;
     }
     
-    self = [super initWithOpenGLESVersion:apiVersion];
+    self = [super initWithOpenGLESVersion:apiVersion sharegroup:sharegroup];
     if (!self)
         return nil;
     lights = [NSMutableArray array];
@@ -153,16 +217,53 @@ public:
     // Note: Try to turn this back on at some point
     _dispatchRendering = false;
 
+    _asyncShaderSetup = false;
+
+    _dynamicResolution = false;
+    // One frame at 60Hz, with a little headroom for the present
+    _dynamicResTargetGPUTime = 0.014;
+    _renderScale = 1.0;
+    scaledFramebuffer = scaledColorTex = scaledDepthRb = 0;
+    scaledWidth = scaledHeight = 0;
+    framesAtRenderScale = 0;
+    blitProgram = NULL;
+
     return self;
 }
 
 - (void) dealloc
 {
+    EAGLContext *oldContext = [EAGLContext currentContext];
+    if (oldContext != super.context)
+        [EAGLContext setCurrentContext:super.context];
+    if (scaledFramebuffer)
+        glDeleteFramebuffers(1, &scaledFramebuffer);
+    if (scaledColorTex)
+        glDeleteTextures(1, &scaledColorTex);
+    if (scaledDepthRb)
+        glDeleteRenderbuffers(1, &scaledDepthRb);
+    if (blitProgram)
+    {
+        blitProgram->cleanUp();
+        delete blitProgram;
+    }
+    if (oldContext != super.context)
+        [EAGLContext setCurrentContext:oldContext];
+
 #if __IPHONE_OS_VERSION_MIN_REQUIRED < 60000
     dispatch_release(contextQueue);
 #endif
 }
 
+- (void)setDynamicResolution:(bool)newVal
+{
+    _dynamicResolution = newVal;
+    if (!newVal)
+        _renderScale = 1.0;
+    framesAtRenderScale = 0;
+    renderSetup = false;
+}
+
 - (void)forceRenderSetup
 {
     renderSetup = false;
@@ -176,17 +277,40 @@ public:
 
     if (!super.scene)
         return;
-    
-    EAGLContext *oldContext = [EAGLContext currentContext];
-    if (oldContext != super.context)
-        [EAGLContext setCurrentContext:super.context];
-    
-    SetupDefaultShaders(super.scene);
-    
+
+    // Cached program binaries take shader compilation off the cold start
+    NSString *cachesDir = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) objectAtIndex:0];
+    OpenGLES2Program::SetBinaryCacheDir([cachesDir stringByAppendingPathComponent:@"whirlykit_shaders"]);
+
     lightsLastUpdated = CFAbsoluteTimeGetCurrent();
 
-    if (oldContext != super.context)
-        [EAGLContext setCurrentContext:oldContext];
+    if (_asyncShaderSetup)
+    {
+        // Compile on a worker with its own context in our sharegroup,
+        //  so startup can keep assembling the rest of the view.
+        // The first frame waits on this group if it gets there first.
+        Scene *theScene = super.scene;
+        EAGLContext *context = super.context;
+        shaderSetupGroup = dispatch_group_create();
+        dispatch_group_async(shaderSetupGroup,dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0),
+        ^{
+            EAGLContext *workContext = [[EAGLContext alloc] initWithAPI:context.API sharegroup:context.sharegroup];
+            [EAGLContext setCurrentContext:workContext];
+            SetupDefaultShaders(theScene);
+            // Make sure the programs are visible to the rendering context
+            glFlush();
+            [EAGLContext setCurrentContext:nil];
+        });
+    } else {
+        EAGLContext *oldContext = [EAGLContext currentContext];
+        if (oldContext != super.context)
+            [EAGLContext setCurrentContext:super.context];
+
+        SetupDefaultShaders(super.scene);
+
+        if (oldContext != super.context)
+            [EAGLContext setCurrentContext:oldContext];
+    }
 }
 
 /// Add a light to the existing set
@@ -246,6 +370,166 @@ public:
     }
 }
 
+// Dynamic resolution bounds and step size.  The scale moves one step
+//  at a time and then sits for a stretch of frames so the GPU timing
+//  can catch up with the change.
+static const float kWKDynamicResMinScale = 0.5;
+static const float kWKDynamicResStep = 0.1;
+static const float kWKDynamicResUpFraction = 0.7;
+static const int kWKDynamicResSettleFrames = 20;
+
+// Shaders for the dynamic resolution blit.  Just a textured quad
+//  covering the screen.
+static const char *vertexShaderBlit =
+"attribute vec2 a_position;                  \n"
+"attribute vec2 a_texCoord0;                  \n"
+"\n"
+"varying vec2 v_texCoord;                    \n"
+"\n"
+"void main()                                 \n"
+"{                                           \n"
+"   v_texCoord = a_texCoord0;                 \n"
+"   gl_Position = vec4(a_position,0.0,1.0);  \n"
+"}                                           \n"
+;
+
+static const char *fragmentShaderBlit =
+"precision mediump float;                            \n"
+"\n"
+"uniform sampler2D s_baseMap0;                        \n"
+"\n"
+"varying vec2      v_texCoord;                       \n"
+"\n"
+"void main()                                         \n"
+"{                                                   \n"
+"  gl_FragColor = texture2D(s_baseMap0, v_texCoord); \n"
+"}                                                   \n"
+;
+
+// Steer the render scale toward the GPU frame budget
+- (void)updateRenderScale
+{
+    NSTimeInterval gpuTime = perfTimer.getLastGpuDuration();
+    // Without the GPU timer extension we don't guess
+    if (gpuTime <= 0.0 || _dynamicResTargetGPUTime <= 0.0)
+        return;
+
+    // Give a new scale some frames to show up in the measurement
+    framesAtRenderScale++;
+    if (framesAtRenderScale < kWKDynamicResSettleFrames)
+        return;
+
+    if (gpuTime > _dynamicResTargetGPUTime && _renderScale > kWKDynamicResMinScale)
+    {
+        _renderScale = std::max(kWKDynamicResMinScale,_renderScale - kWKDynamicResStep);
+        framesAtRenderScale = 0;
+    } else if (gpuTime < kWKDynamicResUpFraction * _dynamicResTargetGPUTime && _renderScale < 1.0)
+    {
+        _renderScale = std::min(1.0f,_renderScale + kWKDynamicResStep);
+        framesAtRenderScale = 0;
+    }
+}
+
+// Make sure the scaled framebuffer matches the current scale and
+//  screen size.  Returns false (and shuts the feature off) on failure.
+- (bool)setupScaledFramebuffer:(int)width height:(int)height
+{
+    int newWidth = std::max(1,(int)(width * _renderScale + 0.5));
+    int newHeight = std::max(1,(int)(height * _renderScale + 0.5));
+    if (scaledFramebuffer && newWidth == scaledWidth && newHeight == scaledHeight)
+        return true;
+
+    if (!scaledFramebuffer)
+    {
+        glGenFramebuffers(1, &scaledFramebuffer);
+        glGenTextures(1, &scaledColorTex);
+        glGenRenderbuffers(1, &scaledDepthRb);
+        CheckGLError("SceneRendererES2: scaled framebuffer gen");
+    }
+    scaledWidth = newWidth;
+    scaledHeight = newHeight;
+
+    glBindTexture(GL_TEXTURE_2D, scaledColorTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, scaledWidth, scaledHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CheckGLError("SceneRendererES2: scaled color setup");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scaledFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scaledColorTex, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, scaledDepthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, scaledWidth, scaledHeight);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scaledDepthRb);
+    CheckGLError("SceneRendererES2: scaled framebuffer setup");
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        NSLog(@"SceneRendererES2: Incomplete scaled framebuffer.  Turning dynamic resolution off.");
+        _dynamicResolution = false;
+        _renderScale = 1.0;
+        return false;
+    }
+
+    return true;
+}
+
+// Upscale the scaled color buffer to the screen framebuffer
+- (void)blitScaledFramebuffer
+{
+    if (!blitProgram)
+    {
+        blitProgram = new OpenGLES2Program("Dynamic resolution blit",vertexShaderBlit,fragmentShaderBlit);
+        if (!blitProgram->isValid())
+        {
+            NSLog(@"SceneRendererES2: Failed to build the blit shader.  Turning dynamic resolution off.");
+            delete blitProgram;
+            blitProgram = NULL;
+            _dynamicResolution = false;
+            _renderScale = 1.0;
+            return;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebuffer);
+    CheckGLError("SceneRendererES2: glBindFramebuffer");
+    glViewport(0, 0, super.framebufferWidth, super.framebufferHeight);
+    CheckGLError("SceneRendererES2: glViewport");
+
+    // Straight opaque copy, no depth
+    [renderStateOptimizer setEnableDepthTest:false];
+    glDisable(GL_BLEND);
+
+    glUseProgram(blitProgram->getProgram());
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scaledColorTex);
+    blitProgram->setUniform("s_baseMap0", 0);
+
+    static const GLfloat quadVerts[] = { -1,-1, 0,0,  1,-1, 1,0,  -1,1, 0,1,  1,1, 1,1 };
+    const OpenGLESAttribute *posAttr = blitProgram->findAttribute("a_position");
+    const OpenGLESAttribute *texAttr = blitProgram->findAttribute("a_texCoord0");
+    if (posAttr)
+    {
+        glVertexAttribPointer(posAttr->index, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), quadVerts);
+        glEnableVertexAttribArray(posAttr->index);
+    }
+    if (texAttr)
+    {
+        glVertexAttribPointer(texAttr->index, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), quadVerts+2);
+        glEnableVertexAttribArray(texAttr->index);
+    }
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    CheckGLError("SceneRendererES2: blit glDrawArrays");
+    if (posAttr)
+        glDisableVertexAttribArray(posAttr->index);
+    if (texAttr)
+        glDisableVertexAttribArray(texAttr->index);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_BLEND);
+}
+
 // Make the screen a bit bigger for testing
 static const float ScreenOverlap = 0.1;
 
@@ -293,12 +577,25 @@ static const float ScreenOverlap = 0.1;
     if (!renderStateOptimizer)
         renderStateOptimizer = [[WhirlyKitOpenGLStateOptimizer alloc] init];
 
+    // If the default shaders are still compiling on the setup worker,
+    //  the first frame waits for them here
+    if (shaderSetupGroup)
+    {
+        dispatch_group_wait(shaderSetupGroup, DISPATCH_TIME_FOREVER);
+        shaderSetupGroup = nil;
+    }
+
 	[super.theView animate];
 
-    // Decide if we even need to draw
-    if (!scene->hasChanges() && ![self viewDidChange])
+    // Decide if we even need to draw.  Another renderer sharing the
+    //  scene may have drained the change queue already, so compare
+    //  generations rather than just checking the queue.
+    bool viewChanged = [self viewDidChange];
+    int32_t changeGen = scene->getChangeGeneration();
+    if (!scene->hasChanges() && changeGen == super.lastDrawnGeneration && !viewChanged)
         return;
-    
+    super.lastDrawnGeneration = changeGen;
+
     NSTimeInterval perfInterval = super.perfInterval;
     
     lastDraw = CFAbsoluteTimeGetCurrent();
@@ -318,9 +615,14 @@ static const float ScreenOverlap = 0.1;
     if (!renderSetup)
     {
         // Turn on blending
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         glEnable(GL_BLEND);
     }
+    // The overdraw diagnostic swaps in additive blending, so the blend
+    //  function is set per frame rather than once at setup
+    if (super.overdrawMode)
+        glBlendFunc(GL_ONE, GL_ONE);
+    else
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
     // See if we're dealing with a globe view
     WhirlyGlobeView *globeView = nil;
@@ -332,7 +634,31 @@ static const float ScreenOverlap = 0.1;
 
     GLint framebufferWidth = super.framebufferWidth;
     GLint framebufferHeight = super.framebufferHeight;
-    if (!renderSetup)
+
+    // Dynamic resolution draws the scene into a scaled buffer and
+    //  upscales it to the screen at the end of the frame.  Scissor
+    //  damage tracking works in screen pixels, so it sits this out.
+    bool scaledPass = false;
+    if (_dynamicResolution && !super.scissorDamageMode)
+    {
+        [self updateRenderScale];
+        if (_renderScale < 0.995)
+            scaledPass = [self setupScaledFramebuffer:framebufferWidth height:framebufferHeight];
+    }
+    if (scaledPass)
+    {
+        // Everything downstream sizes itself off the framebuffer, so
+        //  screen space content stays proportioned through the upscale
+        framebufferWidth = scaledWidth;
+        framebufferHeight = scaledHeight;
+        glBindFramebuffer(GL_FRAMEBUFFER, scaledFramebuffer);
+        CheckGLError("SceneRendererES2: glBindFramebuffer");
+        glViewport(0, 0, framebufferWidth,framebufferHeight);
+        CheckGLError("SceneRendererES2: glViewport");
+        // The blit rebinds the screen framebuffer at the end of the
+        //  frame, so the setup shortcut doesn't apply
+        renderSetup = false;
+    } else if (!renderSetup)
     {
         glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebuffer);
         CheckGLError("SceneRendererES2: glBindFramebuffer");
@@ -380,8 +706,13 @@ static const float ScreenOverlap = 0.1;
         glClearColor(_clearColor.r / 255.0, _clearColor.g / 255.0, _clearColor.b / 255.0, _clearColor.a / 255.0);
         CheckGLError("SceneRendererES2: glClearColor");
     }
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    CheckGLError("SceneRendererES2: glClear");
+    // In scissor damage mode we hold off on the clear until we know
+    //  what the frame's changes touch
+    if (!super.scissorDamageMode)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        CheckGLError("SceneRendererES2: glClear");
+    }
 
     if (!renderSetup)
     {
@@ -392,9 +723,12 @@ static const float ScreenOverlap = 0.1;
     if (perfInterval > 0)
         perfTimer.stopTiming("Render Setup");
     
+    int numDrawables = 0;
+    int numChangesProcessed = 0;
+    bool scissorOn = false;
+
 	if (scene)
 	{
-		int numDrawables = 0;
         
         SimpleIdentity defaultTriShader = scene->getProgramIDBySceneName(kSceneDefaultTriShader);
         SimpleIdentity defaultLineShader = scene->getProgramIDBySceneName(kSceneDefaultLineShader);
@@ -404,7 +738,11 @@ static const float ScreenOverlap = 0.1;
             return;
         }
         
-        WhirlyKitRendererFrameInfo *baseFrameInfo = [[WhirlyKitRendererFrameInfo alloc] init];
+        // Reuse the same frame info frame to frame.
+        // Everything in it gets assigned below, so there's no stale state
+        if (!frameInfoPool)
+            frameInfoPool = [[WhirlyKitRendererFrameInfo alloc] init];
+        WhirlyKitRendererFrameInfo *baseFrameInfo = frameInfoPool;
         baseFrameInfo.oglVersion = kEAGLRenderingAPIOpenGLES2;
         baseFrameInfo.sceneRenderer = self;
         baseFrameInfo.theView = super.theView;
@@ -425,24 +763,100 @@ static const float ScreenOverlap = 0.1;
         baseFrameInfo.screenSizeInDisplayCoords = screenSize;
         baseFrameInfo.lights = lights;
         baseFrameInfo.stateOpt = renderStateOptimizer;
-		
+        baseFrameInfo.overdrawMode = super.overdrawMode;
+
         if (perfInterval > 0)
             perfTimer.startTiming("Scene processing");
-        
+
+        // Start the damage tracking over for this frame.
+        // View movement and animations touch everything, so don't bother
+        damageMbr.reset();
+        fullDamage = !super.scissorDamageMode || viewChanged || lastDraw < renderUntil;
+
         // Let the active models to their thing
-        // That thing had better not take too long
-        for (NSObject<WhirlyKitActiveModel> *activeModel in scene->activeModels)
-            [activeModel updateForFrame:baseFrameInfo];
+        // That thing had better not take too long, so we only talk to the
+        //  dirty ones and cut the whole group off at a budget.  Anyone we
+        //  don't get to stays dirty, so hasChanges() buys them another frame.
+        int numActiveModels = (int)[scene->activeModels count];
+        if (numActiveModels > 0)
+        {
+            NSTimeInterval updateStart = CFAbsoluteTimeGetCurrent();
+            int numModelsUpdated = 0;
+            for (int ii=0;ii<numActiveModels;ii++)
+            {
+                NSObject<WhirlyKitActiveModel> *activeModel = [scene->activeModels objectAtIndex:(activeModelOffset+ii)%numActiveModels];
+                // Clean models don't need to hear from us at all
+                if (![activeModel hasUpdate])
+                    continue;
+                // Active models don't tell us what they touch on screen
+                fullDamage = true;
+                [activeModel updateForFrame:baseFrameInfo];
+                numModelsUpdated++;
+                if (CFAbsoluteTimeGetCurrent() - updateStart > ActiveModelUpdateBudget)
+                    break;
+            }
+            // Rotate who goes first so a budget busting model can't starve the rest
+            activeModelOffset = (activeModelOffset+1)%numActiveModels;
+            if (perfInterval > 0)
+                perfTimer.addCount("Active models updated", numModelsUpdated);
+        }
         
+        numChangesProcessed = scene->changeRequests.count();
         if (perfInterval > 0)
-            perfTimer.addCount("Scene changes", (int)scene->changeRequests.size());
+        {
+            perfTimer.addCount("Scene changes", numChangesProcessed);
+            // Includes whatever the budget held over from earlier frames
+            perfTimer.addCount("Change queue depth", scene->changeQueueDepth());
+        }
         
 		// Merge any outstanding changes into the scenegraph
 		// Or skip it if we don't acquire the lock
 		scene->processChanges(super.theView,self);
-        
+
+        // Age out recycled GL objects nobody has asked for in a while
+        scene->getMemManager()->updateFrame();
+
+        // If there's a GPU memory budget and we've blown past it, let
+        //  the layers know.  They're the ones who can drop things.
+        if (scene->getMemManager()->isOverBudget() && lastDraw - lastMemPressureNote > GPUMemPressurePeriod)
+        {
+            lastMemPressureNote = lastDraw;
+            dispatch_async(dispatch_get_main_queue(),
+                           ^{
+                               [[NSNotificationCenter defaultCenter] postNotificationName:kWKGPUMemPressureNotification object:nil];
+                           });
+        }
+
         if (perfInterval > 0)
             perfTimer.stopTiming("Scene processing");
+
+        // If everything the frame touches fits in a small screen region,
+        //  scissor down to it and let the retained backbuffer keep the rest.
+        // This is where the deferred clear happens for scissor damage mode.
+        if (super.scissorDamageMode)
+        {
+            if (!fullDamage && damageMbr.valid())
+            {
+                // Pad for rounding and clamp to the framebuffer.
+                // Damage comes in with the origin upper left, GL wants lower left
+                int llx = std::max(0,(int)floorf(damageMbr.ll().x())-kWKScissorDamagePad);
+                int lly = std::max(0,(int)floorf(damageMbr.ll().y())-kWKScissorDamagePad);
+                int urx = std::min((int)framebufferWidth,(int)ceilf(damageMbr.ur().x())+kWKScissorDamagePad);
+                int ury = std::min((int)framebufferHeight,(int)ceilf(damageMbr.ur().y())+kWKScissorDamagePad);
+                int width = std::max(0,urx-llx);
+                int height = std::max(0,ury-lly);
+                if (width*height < kWKScissorDamageFraction*framebufferWidth*framebufferHeight)
+                {
+                    glScissor(llx, framebufferHeight-ury, width, height);
+                    CheckGLError("SceneRendererES2: glScissor");
+                    glEnable(GL_SCISSOR_TEST);
+                    CheckGLError("SceneRendererES2: glEnable(GL_SCISSOR_TEST)");
+                    scissorOn = true;
+                }
+            }
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            CheckGLError("SceneRendererES2: glClear");
+        }
         
         if (perfInterval > 0)
             perfTimer.startTiming("Culling");
@@ -481,17 +895,31 @@ static const float ScreenOverlap = 0.1;
 		      
         // Work through the available offset matrices (only 1 if we're not wrapping)
         std::vector<Matrix4d> &offsetMats = baseFrameInfo.offsetMatrices;
-        // Turn these drawables in to a vector
-        std::vector<DrawableContainer> drawList;
-        std::vector<DrawableRef> screenDrawables;
-        std::vector<DrawableRef> generatedDrawables;
-        std::vector<Matrix4d> mvpMats;
-        std::vector<Matrix4f> mvpMats4f;
+        // Turn these drawables in to a vector.
+        // These are the persistent versions, so they keep their capacity
+        std::vector<DrawableContainer> &drawList = frameDrawList;
+        std::vector<DrawableRef> &screenDrawables = frameScreenDrawables;
+        std::vector<DrawableRef> &generatedDrawables = frameGeneratedDrawables;
+        std::vector<Matrix4d> &mvpMats = frameMvpMats;
+        std::vector<Matrix4f> &mvpMats4f = frameMvpMats4f;
+        drawList.clear();
+        screenDrawables.clear();
+        generatedDrawables.clear();
         mvpMats.resize(offsetMats.size());
         mvpMats4f.resize(offsetMats.size());
+        if (!offFrameInfoPool)
+            offFrameInfoPool = [NSMutableArray array];
         for (unsigned int off=0;off<offsetMats.size();off++)
         {
-            WhirlyKitRendererFrameInfo *offFrameInfo = [[WhirlyKitRendererFrameInfo alloc] initWithFrameInfo:baseFrameInfo];
+            // The per offset matrix frame infos are pooled as well
+            WhirlyKitRendererFrameInfo *offFrameInfo = nil;
+            if (off < [offFrameInfoPool count])
+                offFrameInfo = [offFrameInfoPool objectAtIndex:off];
+            else {
+                offFrameInfo = [[WhirlyKitRendererFrameInfo alloc] init];
+                [offFrameInfoPool addObject:offFrameInfo];
+            }
+            [offFrameInfo setFromFrameInfo:baseFrameInfo];
             // Tweak with the appropriate offset matrix
             modelAndViewMat4d = viewTrans4d * offsetMats[off] * modelTrans4d;
             modelAndViewMat = Matrix4dToMatrix4f(modelAndViewMat4d);
@@ -537,10 +965,14 @@ static const float ScreenOverlap = 0.1;
                 }
                 cullTreeCount = cullTree->getCount();
             } else {
-                DrawableRefSet rawDrawables = scene->getDrawables();
-                for (DrawableRefSet::iterator it = rawDrawables.begin(); it != rawDrawables.end(); ++it)
+                // The scene keeps its drawables bucketed by render state,
+                //  so we can walk them in draw order with minimal state churn
+                std::vector<DrawableRef> &bucketDrawables = frameBucketDrawables;
+                bucketDrawables.clear();
+                scene->getRenderStateBuckets()->appendDrawables(bucketDrawables);
+                for (unsigned int dd=0;dd<bucketDrawables.size();dd++)
                 {
-                    Drawable *theDrawable = it->get();
+                    Drawable *theDrawable = bucketDrawables[dd].get();
                     if (theDrawable->isOn(offFrameInfo))
                     {
                         const Matrix4d *localMat = theDrawable->getMatrix();
@@ -573,6 +1005,7 @@ static const float ScreenOverlap = 0.1;
                     (*it)->generateDrawables(baseFrameInfo, generatedDrawables, screenDrawables);
                 
                 // Add the generated drawables and sort them all together
+                int numBucketDrawables = (int)drawList.size();
                 for (unsigned int ii=0;ii<generatedDrawables.size();ii++)
                 {
                     Drawable *theDrawable = generatedDrawables[ii].get();
@@ -580,7 +1013,16 @@ static const float ScreenOverlap = 0.1;
                         drawList.push_back(DrawableContainer(theDrawable,thisMvpMat));
                 }
                 bool sortLinesToEnd = (super.zBufferMode == zBufferOffDefault);
-                std::sort(drawList.begin(),drawList.end(),DrawListSortStruct2(super.sortAlphaToEnd,sortLinesToEnd,baseFrameInfo));
+                if (!self.doCulling && !super.sortAlphaToEnd && offsetMats.size() == 1)
+                {
+                    // The draw list came straight out of the state buckets, so
+                    //  it's already in priority order with state changes kept
+                    //  to a minimum.  Sort just the generated drawables and
+                    //  merge them in.
+                    std::sort(drawList.begin()+numBucketDrawables,drawList.end(),DrawListSortStruct2(false,sortLinesToEnd,baseFrameInfo));
+                    std::inplace_merge(drawList.begin(),drawList.begin()+numBucketDrawables,drawList.end(),DrawListSortStruct2(false,sortLinesToEnd,baseFrameInfo));
+                } else
+                    std::sort(drawList.begin(),drawList.end(),DrawListSortStruct2(super.sortAlphaToEnd,sortLinesToEnd,baseFrameInfo));
             }
             
             if (perfInterval > 0)
@@ -595,46 +1037,57 @@ static const float ScreenOverlap = 0.1;
 
         if (perfInterval > 0)
         perfTimer.startTiming("Draw Execution");
-        
+
+        // Bracket the draw calls with a GPU timer query, if we can
+        perfTimer.startGpuTiming();
+
         SimpleIdentity curProgramId = EmptyIdentity;
         
         bool depthMaskOn = (super.zBufferMode == zBufferOn);
         for (unsigned int ii=0;ii<drawList.size();ii++)
         {
             DrawableContainer &drawContain = drawList[ii];
-            
-            // The first time we hit an explicitly alpha drawable
-            //  turn off the depth buffer
-            if (super.depthBufferOffForAlpha && !(super.zBufferMode == zBufferOffDefault))
+
+            if (super.overdrawMode)
             {
-                if (depthMaskOn && super.depthBufferOffForAlpha && drawContain.drawable->hasAlpha(baseFrameInfo))
+                // Nothing occludes in overdraw mode.  We want the cost
+                //  of every layer, not just the winners.
+                [renderStateOptimizer setDepthFunc:GL_ALWAYS];
+                [renderStateOptimizer setDepthMask:GL_FALSE];
+            } else {
+                // The first time we hit an explicitly alpha drawable
+                //  turn off the depth buffer
+                if (super.depthBufferOffForAlpha && !(super.zBufferMode == zBufferOffDefault))
                 {
-                    depthMaskOn = false;
-                    [renderStateOptimizer setEnableDepthTest:false];
+                    if (depthMaskOn && super.depthBufferOffForAlpha && drawContain.drawable->hasAlpha(baseFrameInfo))
+                    {
+                        depthMaskOn = false;
+                        [renderStateOptimizer setEnableDepthTest:false];
+                    }
                 }
-            }
-            
-            // For this mode we turn the z buffer off until we get a request to turn it on
-            if (super.zBufferMode == zBufferOffDefault)
-            {
-                if (drawContain.drawable->getRequestZBuffer())
+
+                // For this mode we turn the z buffer off until we get a request to turn it on
+                if (super.zBufferMode == zBufferOffDefault)
                 {
-                    [renderStateOptimizer setDepthFunc:GL_LESS];
-                    depthMaskOn = true;
-                } else {
-                    [renderStateOptimizer setDepthFunc:GL_ALWAYS];
+                    if (drawContain.drawable->getRequestZBuffer())
+                    {
+                        [renderStateOptimizer setDepthFunc:GL_LESS];
+                        depthMaskOn = true;
+                    } else {
+                        [renderStateOptimizer setDepthFunc:GL_ALWAYS];
+                    }
+                }
+
+                // If we're drawing lines or points we don't want to update the z buffer
+                if (super.zBufferMode != zBufferOff)
+                {
+                    if (drawContain.drawable->getWriteZbuffer())
+                        [renderStateOptimizer setDepthMask:GL_TRUE];
+                    else
+                        [renderStateOptimizer setDepthMask:GL_FALSE];
                 }
             }
-            
-            // If we're drawing lines or points we don't want to update the z buffer
-            if (super.zBufferMode != zBufferOff)
-            {
-                if (drawContain.drawable->getWriteZbuffer())
-                    [renderStateOptimizer setDepthMask:GL_TRUE];
-                else
-                    [renderStateOptimizer setDepthMask:GL_FALSE];
-            }
-            
+
             // Transform to use
             Matrix4f currentMvpMat = Matrix4dToMatrix4f(drawContain.mat);
             
@@ -660,12 +1113,11 @@ static const float ScreenOverlap = 0.1;
                 {
                     //                    [renderStateOptimizer setUseProgram:program->getProgram()];
                     glUseProgram(program->getProgram());
-                    // Assign the lights if we need to
-                    if (program->hasLights() && ([lights count] > 0))
-                    program->setLights(lights, lightsLastUpdated, defaultMat, currentMvpMat);
-                    // Explicitly turn the lights on
-                    program->setUniform(kWKOGLNumLights, (int)[lights count]);
-                    
+                    // Frame constant state (lights, material) binds once
+                    //  per program per frame, however often the draw sort
+                    //  bounces between programs
+                    program->prepareFrame(lastDraw, lights, lightsLastUpdated, defaultMat, currentMvpMat);
+
                     baseFrameInfo.program = program;
                 }
             }
@@ -770,6 +1222,8 @@ static const float ScreenOverlap = 0.1;
     if (perfInterval > 0)
         perfTimer.stopTiming("Generators - Draw 2D");
 
+    perfTimer.stopGpuTiming();
+
 //    if (perfInterval > 0)
 //        perfTimer.startTiming("glFinish");
 
@@ -782,6 +1236,12 @@ static const float ScreenOverlap = 0.1;
     if (perfInterval > 0)
         perfTimer.startTiming("Present Renderbuffer");
 
+    if (scissorOn)
+    {
+        glDisable(GL_SCISSOR_TEST);
+        CheckGLError("SceneRendererES2: glDisable(GL_SCISSOR_TEST)");
+    }
+
     // Explicitly discard the depth buffer
     const GLenum discards[]  = {GL_DEPTH_ATTACHMENT};
     if (context.API < kEAGLRenderingAPIOpenGLES3)
@@ -790,6 +1250,10 @@ static const float ScreenOverlap = 0.1;
         glInvalidateFramebuffer(GL_FRAMEBUFFER,1,discards);
     CheckGLError("SceneRendererES2: glDiscardFramebufferEXT");
 
+    // Upscale the scaled buffer to the screen before we present
+    if (scaledPass)
+        [self blitScaledFramebuffer];
+
     if (!renderSetup)
     {
         glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
@@ -799,63 +1263,69 @@ static const float ScreenOverlap = 0.1;
     // The user wants help with a screen snapshot
     if (_snapshotDelegate)
     {
-        // Courtesy: https://developer.apple.com/library/ios/qa/qa1704/_index.html
+        // The read back has to happen on this thread, but nothing else
+        //  does.  The image conversion goes to the pool, so a periodic
+        //  thumbnail costs the frame no more than the glReadPixels.
         NSInteger dataLength = framebufferWidth * framebufferHeight * 4;
         GLubyte *data = (GLubyte*)malloc(dataLength * sizeof(GLubyte));
-        
+
         // Read pixel data from the framebuffer
         glPixelStorei(GL_PACK_ALIGNMENT, 4);
         glReadPixels(0, 0, framebufferWidth, framebufferHeight, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        
-        // Create a CGImage with the pixel data
-        // If your OpenGL ES content is opaque, use kCGImageAlphaNoneSkipLast to ignore the alpha channel
-        // otherwise, use kCGImageAlphaPremultipliedLast
-        CGDataProviderRef ref = CGDataProviderCreateWithData(NULL, data, dataLength, NULL);
-        CGColorSpaceRef colorspace = CGColorSpaceCreateDeviceRGB();
-        CGImageRef iref = CGImageCreate(framebufferWidth, framebufferHeight, 8, 32, framebufferWidth * 4, colorspace, kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast,
-                                        ref, NULL, true, kCGRenderingIntentDefault);
-        
-        // OpenGL ES measures data in PIXELS
-        // Create a graphics context with the target size measured in POINTS
-        NSInteger widthInPoints, heightInPoints;
-        if (NULL != UIGraphicsBeginImageContextWithOptions) {
-            // On iOS 4 and later, use UIGraphicsBeginImageContextWithOptions to take the scale into consideration
-            // Set the scale parameter to your OpenGL ES view's contentScaleFactor
-            // so that you get a high-resolution snapshot when its value is greater than 1.0
-            CGFloat scale = self.scale;
-            widthInPoints = framebufferWidth / scale;
-            heightInPoints = framebufferHeight / scale;
-            UIGraphicsBeginImageContextWithOptions(CGSizeMake(widthInPoints, heightInPoints), NO, scale);
-        }
-        else {
-            // On iOS prior to 4, fall back to use UIGraphicsBeginImageContext
-            widthInPoints = framebufferWidth;
-            heightInPoints = framebufferHeight;
-            UIGraphicsBeginImageContext(CGSizeMake(widthInPoints, heightInPoints));
-        }
-        
-        CGContextRef cgcontext = UIGraphicsGetCurrentContext();
-        
-        // UIKit coordinate system is upside down to GL/Quartz coordinate system
-        // Flip the CGImage by rendering it to the flipped bitmap context
-        // The size of the destination area is measured in POINTS
-        CGContextSetBlendMode(cgcontext, kCGBlendModeCopy);
-        CGContextDrawImage(cgcontext, CGRectMake(0.0, 0.0, widthInPoints, heightInPoints), iref);
-        
-        // Retrieve the UIImage from the current context
-        UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
-        
-        UIGraphicsEndImageContext();
-        
-        // Clean up
-        free(data);
-        CFRelease(ref);
-        CFRelease(colorspace);
-        CGImageRelease(iref);
-        
-        [_snapshotDelegate snapshot:image];
-        
+
+        NSObject<WhirlyKitSnapshot> *snapshotDelegate = _snapshotDelegate;
         _snapshotDelegate = nil;
+        int snapWidth = framebufferWidth,snapHeight = framebufferHeight;
+        CGFloat snapScale = self.scale;
+        dispatch_async([WhirlyKitLayerThread sharedWorkQueue],
+        ^{
+            // Courtesy: https://developer.apple.com/library/ios/qa/qa1704/_index.html
+            // Create a CGImage with the pixel data
+            // If your OpenGL ES content is opaque, use kCGImageAlphaNoneSkipLast to ignore the alpha channel
+            // otherwise, use kCGImageAlphaPremultipliedLast
+            CGDataProviderRef ref = CGDataProviderCreateWithData(NULL, data, snapWidth * snapHeight * 4, ReleaseSnapshotData);
+            CGColorSpaceRef colorspace = CGColorSpaceCreateDeviceRGB();
+            CGImageRef iref = CGImageCreate(snapWidth, snapHeight, 8, 32, snapWidth * 4, colorspace, kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast,
+                                            ref, NULL, true, kCGRenderingIntentDefault);
+
+            // OpenGL ES measures data in PIXELS
+            // Create a graphics context with the target size measured in POINTS
+            NSInteger widthInPoints, heightInPoints;
+            if (NULL != UIGraphicsBeginImageContextWithOptions) {
+                // On iOS 4 and later, use UIGraphicsBeginImageContextWithOptions to take the scale into consideration
+                // Set the scale parameter to your OpenGL ES view's contentScaleFactor
+                // so that you get a high-resolution snapshot when its value is greater than 1.0
+                widthInPoints = snapWidth / snapScale;
+                heightInPoints = snapHeight / snapScale;
+                UIGraphicsBeginImageContextWithOptions(CGSizeMake(widthInPoints, heightInPoints), NO, snapScale);
+            }
+            else {
+                // On iOS prior to 4, fall back to use UIGraphicsBeginImageContext
+                widthInPoints = snapWidth;
+                heightInPoints = snapHeight;
+                UIGraphicsBeginImageContext(CGSizeMake(widthInPoints, heightInPoints));
+            }
+
+            CGContextRef cgcontext = UIGraphicsGetCurrentContext();
+
+            // UIKit coordinate system is upside down to GL/Quartz coordinate system
+            // Flip the CGImage by rendering it to the flipped bitmap context
+            // The size of the destination area is measured in POINTS
+            CGContextSetBlendMode(cgcontext, kCGBlendModeCopy);
+            CGContextDrawImage(cgcontext, CGRectMake(0.0, 0.0, widthInPoints, heightInPoints), iref);
+
+            // Retrieve the UIImage from the current context
+            UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+
+            UIGraphicsEndImageContext();
+
+            // Clean up.  The provider owns the pixel data now.
+            CFRelease(ref);
+            CFRelease(colorspace);
+            CGImageRelease(iref);
+
+            [snapshotDelegate snapshot:image];
+        });
     }
 
     [context presentRenderbuffer:GL_RENDERBUFFER];
@@ -866,6 +1336,19 @@ static const float ScreenOverlap = 0.1;
     
     if (perfInterval > 0)
         perfTimer.stopTiming("Render Frame");
+
+    // Keep a record of the frame in the sample ring buffer, so recent
+    //  spikes can be diagnosed without attaching Instruments
+    PerformanceTimer::FrameSample frameSample;
+    frameSample.frameStart = lastDraw;
+    frameSample.cpuDuration = CFAbsoluteTimeGetCurrent() - lastDraw;
+    frameSample.numDrawables = numDrawables;
+    frameSample.numChanges = numChangesProcessed;
+    perfTimer.addFrameSample(frameSample);
+
+    // Feed the background work regulator, so droppable work (prefetch,
+    //  cache compaction) backs off when frames run over budget for a while
+    WorkRegulator::noteFrame(frameSample.cpuDuration);
     
 	// Update the frames per sec
 	if (super.perfInterval > 0 && frameCount > perfInterval)
@@ -880,6 +1363,9 @@ static const float ScreenOverlap = 0.1;
         NSLog(@" Frames per sec = %.2f",super.framesPerSec);
         perfTimer.log();
         perfTimer.clear();
+#if WK_LOCK_PROFILING
+        ContentionTracker::getInstance().logAndClear();
+#endif
 	}
     
     if (oldContext != context)
@@ -27,4 +27,9 @@
     return [super initWithVersion:kEAGLRenderingAPIOpenGLES3];
 }
 
+- (id)initWithSharegroup:(EAGLSharegroup *)sharegroup
+{
+    return [super initWithVersion:kEAGLRenderingAPIOpenGLES3 sharegroup:sharegroup];
+}
+
 @end
@@ -0,0 +1,308 @@
+/*
+ *  SceneSnapshot.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 5/19/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <map>
+#import "SceneSnapshot.h"
+#import "DataCompressor.h"
+#import "ContentionTracker.h"
+
+namespace WhirlyKit
+{
+
+// 'WGSS', for WhirlyGlobe Scene Snapshot
+static const unsigned int SnapshotMagic = 0x57475353;
+// Bump this whenever a record format changes and old files go stale
+static const unsigned int SnapshotVersion = 3;
+
+void SnapshotAppend(NSMutableData *data,const void *bytes,size_t len)
+{
+    [data appendBytes:bytes length:len];
+}
+
+void SnapshotAppendString(NSMutableData *data,const std::string &str)
+{
+    unsigned int len = (unsigned int)str.length();
+    SnapshotAppend(data, &len, sizeof(len));
+    if (len > 0)
+        SnapshotAppend(data, str.data(), len);
+}
+
+bool SnapshotRead(const unsigned char *&ptr,const unsigned char *end,void *bytes,size_t len)
+{
+    if (ptr + len > end)
+        return false;
+    memcpy(bytes, ptr, len);
+    ptr += len;
+    return true;
+}
+
+bool SnapshotReadString(const unsigned char *&ptr,const unsigned char *end,std::string &str)
+{
+    unsigned int len;
+    if (!SnapshotRead(ptr, end, &len, sizeof(len)))
+        return false;
+    if (ptr + len > end)
+        return false;
+    str.assign((const char *)ptr, len);
+    ptr += len;
+    return true;
+}
+
+SceneSnapshotWriter::SceneSnapshotWriter(NSString *inFileName,const std::string &invalidationKey)
+    : fileName(inFileName), invalidationKey(invalidationKey),
+      numTextures(0), numDrawables(0), numSkipped(0)
+{
+    pthread_mutex_init(&writeLock,NULL);
+    texData = [NSMutableData data];
+    drawData = [NSMutableData data];
+}
+
+SceneSnapshotWriter::~SceneSnapshotWriter()
+{
+    pthread_mutex_destroy(&writeLock);
+}
+
+void SceneSnapshotWriter::captureChange(Scene *scene,ChangeRequest *change)
+{
+    AddTextureReq *texReq = dynamic_cast<AddTextureReq *>(change);
+    if (texReq)
+    {
+        // Only the plain textures round trip.  The dynamic ones
+        //  (atlases and such) rebuild themselves anyway.
+        Texture *tex = dynamic_cast<Texture *>(texReq->getTex());
+        if (tex)
+            addTexture(tex);
+        else {
+            WK_MUTEX_LOCK(&writeLock,"SceneSnapshotWriter::writeLock");
+            numSkipped++;
+            pthread_mutex_unlock(&writeLock);
+        }
+        return;
+    }
+
+    AddDrawableReq *drawReq = dynamic_cast<AddDrawableReq *>(change);
+    if (drawReq)
+    {
+        BasicDrawable *draw = dynamic_cast<BasicDrawable *>(drawReq->getDrawable());
+        if (draw)
+            addDrawable(scene,draw);
+        else {
+            WK_MUTEX_LOCK(&writeLock,"SceneSnapshotWriter::writeLock");
+            numSkipped++;
+            pthread_mutex_unlock(&writeLock);
+        }
+    }
+}
+
+void SceneSnapshotWriter::addTexture(Texture *tex)
+{
+    // Build the record outside the lock, append under it
+    NSMutableData *record = [NSMutableData data];
+    SimpleIdentity texId = tex->getId();
+    SnapshotAppend(record, &texId, sizeof(texId));
+    bool ok = tex->snapshotWrite(record);
+
+    WK_MUTEX_LOCK(&writeLock,"SceneSnapshotWriter::writeLock");
+    if (ok)
+    {
+        [texData appendData:record];
+        numTextures++;
+    } else
+        numSkipped++;
+    pthread_mutex_unlock(&writeLock);
+}
+
+void SceneSnapshotWriter::addDrawable(Scene *scene,BasicDrawable *draw)
+{
+    NSMutableData *record = [NSMutableData data];
+    // Shaders can't go in the file, but their scene names can
+    std::string progName = "";
+    if (draw->getProgram() != EmptyIdentity)
+        progName = scene->getSceneNameForProgramID(draw->getProgram());
+    SnapshotAppendString(record, progName);
+    bool ok = draw->snapshotWrite(record);
+
+    WK_MUTEX_LOCK(&writeLock,"SceneSnapshotWriter::writeLock");
+    if (ok)
+    {
+        [drawData appendData:record];
+        numDrawables++;
+    } else
+        numSkipped++;
+    pthread_mutex_unlock(&writeLock);
+}
+
+bool SceneSnapshotWriter::close()
+{
+    WK_MUTEX_LOCK(&writeLock,"SceneSnapshotWriter::writeLock");
+
+    NSMutableData *outData = [NSMutableData data];
+    SnapshotAppend(outData, &SnapshotMagic, sizeof(SnapshotMagic));
+    SnapshotAppend(outData, &SnapshotVersion, sizeof(SnapshotVersion));
+    SnapshotAppendString(outData, invalidationKey);
+    SnapshotAppend(outData, &numTextures, sizeof(numTextures));
+    SnapshotAppend(outData, &numDrawables, sizeof(numDrawables));
+
+    // The records go out as one codec frame.  LZ4 because the read
+    //  side is what we're optimizing for; the frame says what it is,
+    //  so the codec can change without another version bump
+    NSMutableData *payload = [NSMutableData data];
+    [payload appendData:texData];
+    [payload appendData:drawData];
+    NSData *compPayload = CodecCompress(payload,DataCodecLZ4);
+    if (!compPayload)
+        compPayload = CodecCompress(payload,DataCodecNone);
+    [outData appendData:compPayload];
+    bool ok = [outData writeToFile:fileName atomically:YES];
+
+    pthread_mutex_unlock(&writeLock);
+
+    return ok;
+}
+
+SceneSnapshotReader::SceneSnapshotReader(NSString *inFileName)
+    : valid(false), numTextures(0), numDrawables(0), recordStart(NULL)
+{
+    // Map rather than read.  The big payloads stream straight out of
+    //  the page cache this way.
+    fileData = [NSData dataWithContentsOfFile:inFileName options:NSDataReadingMappedIfSafe error:NULL];
+    if (!fileData)
+        return;
+
+    const unsigned char *ptr = (const unsigned char *)[fileData bytes];
+    const unsigned char *end = ptr + [fileData length];
+    unsigned int magic,version;
+    if (!SnapshotRead(ptr, end, &magic, sizeof(magic)) || magic != SnapshotMagic)
+        return;
+    if (!SnapshotRead(ptr, end, &version, sizeof(version)) || version != SnapshotVersion)
+        return;
+    if (!SnapshotReadString(ptr, end, fileKey))
+        return;
+    if (!SnapshotRead(ptr, end, &numTextures, sizeof(numTextures)))
+        return;
+    if (!SnapshotRead(ptr, end, &numDrawables, sizeof(numDrawables)))
+        return;
+
+    // The records are one codec frame.  Decompressing here keeps
+    //  load() a straight pass over the result
+    std::vector<unsigned char> rawRecords;
+    if (!CodecDecompressBuffer(ptr, end-ptr, rawRecords))
+        return;
+    recordData = (rawRecords.empty() ? [NSData data] : [NSData dataWithBytes:&rawRecords[0] length:rawRecords.size()]);
+
+    recordStart = (const unsigned char *)[recordData bytes];
+    valid = true;
+}
+
+SceneSnapshotReader::~SceneSnapshotReader()
+{
+    fileData = nil;
+    recordData = nil;
+}
+
+bool SceneSnapshotReader::isValid(const std::string &invalidationKey)
+{
+    return valid && fileKey == invalidationKey;
+}
+
+bool SceneSnapshotReader::load(Scene *scene,ChangeSet &changes,SimpleIDSet &texIDs,SimpleIDSet &drawIDs)
+{
+    if (!valid)
+        return false;
+
+    const unsigned char *ptr = recordStart;
+    const unsigned char *end = (const unsigned char *)[recordData bytes] + [recordData length];
+
+    // Everything gets a fresh ID on the way in, so the snapshot
+    //  composes with whatever else the app is building
+    ChangeSet newChanges;
+    std::map<SimpleIdentity,SimpleIdentity> texMap;
+    bool ok = true;
+    for (int ii=0;ii<numTextures && ok;ii++)
+    {
+        SimpleIdentity oldTexId;
+        if (!SnapshotRead(ptr, end, &oldTexId, sizeof(oldTexId)))
+        {
+            ok = false;
+            break;
+        }
+        Texture *tex = new Texture("Scene Snapshot");
+        if (tex->snapshotRead(ptr, end))
+        {
+            texMap[oldTexId] = tex->getId();
+            newChanges.push_back(new AddTextureReq(tex));
+        } else {
+            delete tex;
+            ok = false;
+        }
+    }
+
+    for (int ii=0;ii<numDrawables && ok;ii++)
+    {
+        std::string progName;
+        if (!SnapshotReadString(ptr, end, progName))
+        {
+            ok = false;
+            break;
+        }
+        BasicDrawable *draw = new BasicDrawable("Scene Snapshot");
+        if (!draw->snapshotRead(ptr, end))
+        {
+            delete draw;
+            ok = false;
+            break;
+        }
+        if (!progName.empty())
+            draw->setProgram(scene->getProgramIDBySceneName(progName));
+        // Swap the old texture IDs for the ones we just made
+        const std::vector<BasicDrawable::TexInfo> &texInfo = draw->getTexInfo();
+        for (unsigned int ti=0;ti<texInfo.size();ti++)
+            if (texInfo[ti].texId != EmptyIdentity)
+            {
+                std::map<SimpleIdentity,SimpleIdentity>::iterator it = texMap.find(texInfo[ti].texId);
+                draw->setTexId(ti, (it != texMap.end() ? it->second : EmptyIdentity));
+            }
+        newChanges.push_back(new AddDrawableReq(draw));
+    }
+
+    if (!ok)
+    {
+        // A truncated or corrupt file gets us nothing.  The add
+        //  requests own their payloads, so this cleans everything up.
+        for (unsigned int ii=0;ii<newChanges.size();ii++)
+            delete newChanges[ii];
+        return false;
+    }
+
+    for (std::map<SimpleIdentity,SimpleIdentity>::iterator it = texMap.begin();
+         it != texMap.end(); ++it)
+        texIDs.insert(it->second);
+    for (unsigned int ii=0;ii<newChanges.size();ii++)
+    {
+        AddDrawableReq *drawReq = dynamic_cast<AddDrawableReq *>(newChanges[ii]);
+        if (drawReq)
+            drawIDs.insert(drawReq->getDrawable()->getId());
+        changes.push_back(newChanges[ii]);
+    }
+
+    return true;
+}
+
+}
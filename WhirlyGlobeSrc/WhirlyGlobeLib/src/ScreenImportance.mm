@@ -404,44 +404,36 @@ double PolyImportance(const std::vector<Point3d> &poly,const Point3d &norm,Whirl
 namespace WhirlyKit
 {
     
-bool TileIsOnScreen(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,WhirlyKit::Mbr nodeMbr,WhirlyKit::Quadtree::Identifier &nodeIdent,NSMutableDictionary *attrs)
+bool TileIsOnScreen(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,WhirlyKit::Mbr nodeMbr,WhirlyKit::Quadtree::Identifier &nodeIdent,WhirlyKit::Quadtree::NodeAttrs &attrs)
 {
-    WhirlyKitDisplaySolid *dispSolid = attrs[@"DisplaySolid"];
-    if (!dispSolid)
+    if (!attrs.dispSolidSet)
     {
-        dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:0.0 maxZ:0.0 srcSystem:srcSystem adapter:coordAdapter];
-        if (dispSolid)
-        attrs[@"DisplaySolid"] = dispSolid;
-        else
-        attrs[@"DisplaySolid"] = [NSNull null];
+        attrs.dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:0.0 maxZ:0.0 srcSystem:srcSystem adapter:coordAdapter];
+        attrs.dispSolidSet = true;
     }
-    
+
     // This means the tile is degenerate (as far as we're concerned)
-    if ([dispSolid isKindOfClass:[NSNull null]])
+    if (!attrs.dispSolid)
         return false;
 
-    return [dispSolid isOnScreenForViewState:viewState frameSize:frameSize];
+    return [attrs.dispSolid isOnScreenForViewState:viewState frameSize:frameSize];
 }
 
 
 // Calculate the max pixel size for a tile
-double ScreenImportance(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,const Point3d &notUsed,int pixelsSquare,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr nodeMbr,WhirlyKit::Quadtree::Identifier &nodeIdent,NSMutableDictionary *attrs)
+double ScreenImportance(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,const Point3d &notUsed,int pixelsSquare,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr nodeMbr,WhirlyKit::Quadtree::Identifier &nodeIdent,WhirlyKit::Quadtree::NodeAttrs &attrs)
 {
-    WhirlyKitDisplaySolid *dispSolid = attrs[@"DisplaySolid"];
-    if (!dispSolid)
+    if (!attrs.dispSolidSet)
     {
-        dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:0.0 maxZ:0.0 srcSystem:srcSystem adapter:coordAdapter];
-        if (dispSolid)
-            attrs[@"DisplaySolid"] = dispSolid;
-        else
-            attrs[@"DisplaySolid"] = [NSNull null];
+        attrs.dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:0.0 maxZ:0.0 srcSystem:srcSystem adapter:coordAdapter];
+        attrs.dispSolidSet = true;
     }
-    
+
     // This means the tile is degenerate (as far as we're concerned)
-    if ([dispSolid isKindOfClass:[NSNull class]])
+    if (!attrs.dispSolid)
         return 0.0;
-    
-    double import = [dispSolid importanceForViewState:viewState frameSize:frameSize];
+
+    double import = [attrs.dispSolid importanceForViewState:viewState frameSize:frameSize];
     // The system is expecting an estimate of pixel size on screen
     import = import/(pixelsSquare * pixelsSquare);
     
@@ -451,23 +443,19 @@ double ScreenImportance(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSi
 }
 
 // This version is for volumes with height
-double ScreenImportance(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,int pixelsSquare,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr nodeMbr,double minZ,double maxZ,WhirlyKit::Quadtree::Identifier &nodeIdent,NSMutableDictionary *attrs)
+double ScreenImportance(WhirlyKitViewState *viewState,WhirlyKit::Point2f frameSize,int pixelsSquare,WhirlyKit::CoordSystem *srcSystem,WhirlyKit::CoordSystemDisplayAdapter *coordAdapter,Mbr nodeMbr,double minZ,double maxZ,WhirlyKit::Quadtree::Identifier &nodeIdent,WhirlyKit::Quadtree::NodeAttrs &attrs)
 {
-    WhirlyKitDisplaySolid *dispSolid = attrs[@"DisplaySolid"];
-    if (!dispSolid)
+    if (!attrs.dispSolidSet)
     {
-        dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:minZ maxZ:maxZ srcSystem:srcSystem adapter:coordAdapter];
-        if (dispSolid)
-            attrs[@"DisplaySolid"] = dispSolid;
-        else
-            attrs[@"DisplaySolid"] = [NSNull null];
+        attrs.dispSolid = [WhirlyKitDisplaySolid displaySolidWithNodeIdent:nodeIdent mbr:nodeMbr minZ:minZ maxZ:maxZ srcSystem:srcSystem adapter:coordAdapter];
+        attrs.dispSolidSet = true;
     }
-    
+
     // This means the tile is degenerate (as far as we're concerned)
-    if ([dispSolid isKindOfClass:[NSNull class]])
+    if (!attrs.dispSolid)
         return 0.0;
-    
-    double import = [dispSolid importanceForViewState:viewState frameSize:frameSize];
+
+    double import = [attrs.dispSolid importanceForViewState:viewState frameSize:frameSize];
     // The system is expecting an estimate of pixel size on screen
     import = import/(pixelsSquare * pixelsSquare);
     
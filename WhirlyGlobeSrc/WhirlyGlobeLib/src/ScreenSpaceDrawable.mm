@@ -0,0 +1,139 @@
+/*
+ *  ScreenSpaceDrawable.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 8/24/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "ScreenSpaceDrawable.h"
+#import "OpenGLES2Program.h"
+#import "SceneRendererES.h"
+
+namespace WhirlyKit
+{
+
+ScreenSpaceDrawable::ScreenSpaceDrawable() : BasicDrawable("ScreenSpace")
+{
+    offsetIndex = addAttribute(BDFloat2Type, "a_offset");
+    rotDirIndex = addAttribute(BDFloat3Type, "a_rotDir");
+}
+
+void ScreenSpaceDrawable::addOffset(const Point2f &offset)
+{
+    addAttributeValue(offsetIndex, offset);
+}
+
+void ScreenSpaceDrawable::addRotDir(const Point3f &dir)
+{
+    addAttributeValue(rotDirIndex, dir);
+}
+
+void ScreenSpaceDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo, Scene *scene)
+{
+    if (frameInfo.program)
+    {
+        frameInfo.program->setUniform("u_frameSize", Point2f(frameInfo.sceneRenderer.framebufferWidth,frameInfo.sceneRenderer.framebufferHeight));
+    }
+
+    BasicDrawable::draw(frameInfo,scene);
+}
+
+// The projection the CPU used to do per frame lives in here.  We project
+//  the center of the shape, then push the vertex out by its offset in
+//  screen space.  Rotating shapes carry a world space direction we project
+//  to get the screen angle.
+static const char *vertexShaderTri =
+"uniform mat4  u_mvMatrix;"
+"uniform mat4  u_mvpMatrix;"
+"uniform mat4  u_mvNormalMatrix;"
+"uniform float u_fade;"
+"uniform vec2  u_frameSize;"
+""
+"attribute vec3 a_position;"
+"attribute vec2 a_offset;"
+"attribute vec3 a_rotDir;"
+"attribute vec3 a_normal;"
+"attribute vec2 a_texCoord0;"
+"attribute vec4 a_color;"
+""
+"varying vec2 v_texCoord;"
+"varying vec4 v_color;"
+""
+"void main()"
+"{"
+"   v_texCoord = a_texCoord0;"
+"   v_color = a_color * u_fade;"
+// Toss anything facing away from the viewer
+"   vec4 testPt = u_mvMatrix * vec4(a_position,1.0);"
+"   vec4 testDir = u_mvNormalMatrix * vec4(a_normal,0.0);"
+"   float res = step(0.0,dot(-testPt.xyz,testDir.xyz));"
+// Project the center and work in NDC from here on
+"   vec4 centerPt = u_mvpMatrix * vec4(a_position,1.0);"
+"   centerPt /= centerPt.w;"
+"   vec2 offset = a_offset;"
+"   if (dot(a_rotDir,a_rotDir) > 0.0)"
+"   {"
+// Throw a point out along the rotation direction to get the screen angle
+"     vec4 outPt = u_mvpMatrix * vec4(a_position + a_rotDir * 0.00001,1.0);"
+"     outPt /= outPt.w;"
+"     vec2 d = (outPt.xy - centerPt.xy) * vec2(u_frameSize.x,-u_frameSize.y);"
+"     float rot = 1.5707963 - atan(-d.y,d.x);"
+"     float sinRot = sin(rot);"
+"     float cosRot = cos(rot);"
+"     offset = vec2(cosRot*offset.x - sinRot*offset.y,sinRot*offset.x + cosRot*offset.y);"
+"   }"
+// Offsets are in pixels with y down, NDC has y up
+"   gl_Position = (centerPt + vec4(2.0*offset.x/u_frameSize.x,-2.0*offset.y/u_frameSize.y,0.0,0.0)) * res;"
+"}"
+;
+
+static const char *fragmentShaderTri =
+"precision mediump float;                            \n"
+"\n"
+"uniform sampler2D s_baseMap0;                        \n"
+"uniform bool  u_hasTexture;                         \n"
+"\n"
+"varying vec2      v_texCoord;                       \n"
+"varying vec4      v_color;                          \n"
+"\n"
+"void main()                                         \n"
+"{                                                   \n"
+"  vec4 baseColor = u_hasTexture ? texture2D(s_baseMap0, v_texCoord) : vec4(1.0,1.0,1.0,1.0); \n"
+"  gl_FragColor = v_color * baseColor;  \n"
+"}                                                   \n"
+;
+
+WhirlyKit::OpenGLES2Program *BuildScreenSpaceProgram()
+{
+    OpenGLES2Program *shader = new OpenGLES2Program(kScreenSpaceShaderName,vertexShaderTri,fragmentShaderTri);
+    if (!shader->isValid())
+    {
+        delete shader;
+        shader = NULL;
+    }
+
+    // Set some reasonable defaults
+    if (shader)
+    {
+        glUseProgram(shader->getProgram());
+
+        shader->setUniform("u_frameSize", Point2f(1024,768));
+    }
+
+    return shader;
+}
+
+}
@@ -19,6 +19,8 @@
  */
 
 #import "ScreenSpaceGenerator.h"
+#import "ScreenSpaceDrawable.h"
+#import "DefaultShaderPrograms.h"
 #import "SceneRendererES.h"
 #import "GlobeView.h"
 #import "MaplyView.h"
@@ -50,6 +52,7 @@ ScreenSpaceGenerator::ConvexShape::ConvexShape()
     offset.y() = 0.0;
     keepUpright = false;
     enable = true;
+    layout = false;
 }
 
 // Calculate its position and add this feature to the appropriate drawable
@@ -253,7 +256,7 @@ void ScreenSpaceGenerator::addToDrawables(ConvexShape *shape,WhirlyKitRendererFr
 }
     
 ScreenSpaceGenerator::ScreenSpaceGenerator(const std::string &name,Point2d margin)
-    : Generator(name), margin(margin)
+    : Generator(name), margin(margin), gpuDrawablesValid(false)
 {
     pthread_mutex_init(&projectedPtsLock,NULL);    
 }
@@ -271,6 +274,90 @@ ScreenSpaceGenerator::~ScreenSpaceGenerator()
     activeShapes.clear();
 }
     
+// Size of the cells in the world space grid, in display units
+static const double ShapeCellSize = 0.1;
+
+int ScreenSpaceGenerator::cellKey(const Point3d &worldLoc)
+{
+    int ix = (int)floor(worldLoc.x()/ShapeCellSize)+512;
+    int iy = (int)floor(worldLoc.y()/ShapeCellSize)+512;
+    int iz = (int)floor(worldLoc.z()/ShapeCellSize)+512;
+    // Clamp the odd locations so the key stays well formed
+    ix = std::max(0,std::min(1023,ix));
+    iy = std::max(0,std::min(1023,iy));
+    iz = std::max(0,std::min(1023,iz));
+    return (iz*1024+iy)*1024+ix;
+}
+
+void ScreenSpaceGenerator::indexShape(ConvexShape *shape)
+{
+    ShapeCell &cell = shapeCells[cellKey(shape->worldLoc)];
+    cell.shapes.insert(shape);
+    cell.boundsValid = false;
+}
+
+void ScreenSpaceGenerator::unindexShape(ConvexShape *shape)
+{
+    ShapeCellMap::iterator it = shapeCells.find(cellKey(shape->worldLoc));
+    if (it == shapeCells.end())
+        return;
+    it->second.shapes.erase(shape);
+    if (it->second.shapes.empty())
+        shapeCells.erase(it);
+    else
+        it->second.boundsValid = false;
+}
+
+bool ScreenSpaceGenerator::cellOnScreen(ShapeCell &cell,const std::vector<Eigen::Matrix4d> &mvpMats)
+{
+    // Bring the bounding box up to date if need be
+    if (!cell.boundsValid)
+    {
+        cell.boundLL = Point3d(MAXFLOAT,MAXFLOAT,MAXFLOAT);
+        cell.boundUR = Point3d(-MAXFLOAT,-MAXFLOAT,-MAXFLOAT);
+        for (ConvexShapeSet::iterator it = cell.shapes.begin();
+             it != cell.shapes.end(); ++it)
+        {
+            const Point3d &loc = (*it)->worldLoc;
+            cell.boundLL.x() = std::min(cell.boundLL.x(),loc.x());
+            cell.boundLL.y() = std::min(cell.boundLL.y(),loc.y());
+            cell.boundLL.z() = std::min(cell.boundLL.z(),loc.z());
+            cell.boundUR.x() = std::max(cell.boundUR.x(),loc.x());
+            cell.boundUR.y() = std::max(cell.boundUR.y(),loc.y());
+            cell.boundUR.z() = std::max(cell.boundUR.z(),loc.z());
+        }
+        cell.boundsValid = true;
+    }
+
+    // Run the corners of the box through each projection.  Only if all
+    //  of them land outside the same frustum plane can we toss the cell.
+    double marginX = 1.0 + 2.0*margin.x(), marginY = 1.0 + 2.0*margin.y();
+    for (unsigned int mi=0;mi<mvpMats.size();mi++)
+    {
+        const Eigen::Matrix4d &mvpMat = mvpMats[mi];
+        int outLeft=0,outRight=0,outBottom=0,outTop=0,outNear=0,outFar=0;
+        for (unsigned int ci=0;ci<8;ci++)
+        {
+            Eigen::Vector4d clip = mvpMat * Eigen::Vector4d((ci&1) ? cell.boundUR.x() : cell.boundLL.x(),
+                                                            (ci&2) ? cell.boundUR.y() : cell.boundLL.y(),
+                                                            (ci&4) ? cell.boundUR.z() : cell.boundLL.z(),1.0);
+            // A corner behind the eye could be anywhere, so keep the cell
+            if (clip.w() <= 0.0)
+                continue;
+            if (clip.x() < -clip.w()*marginX)  outLeft++;
+            if (clip.x() > clip.w()*marginX)  outRight++;
+            if (clip.y() < -clip.w()*marginY)  outBottom++;
+            if (clip.y() > clip.w()*marginY)  outTop++;
+            if (clip.z() < -clip.w())  outNear++;
+            if (clip.z() > clip.w())  outFar++;
+        }
+        if (outLeft < 8 && outRight < 8 && outBottom < 8 && outTop < 8 && outNear < 8 && outFar < 8)
+            return true;
+    }
+
+    return false;
+}
+
 void ScreenSpaceGenerator::addConvexShapes(std::vector<ConvexShape *> inShapes)
 {
     convexShapes.insert(inShapes.begin(),inShapes.end());
@@ -278,8 +365,12 @@ void ScreenSpaceGenerator::addConvexShapes(std::vector<ConvexShape *> inShapes)
     {
         ConvexShape *shape = inShapes[ii];
         if (shape->enable && shape->offset.x() != MAXFLOAT)
+        {
             activeShapes.insert(shape);
+            indexShape(shape);
+        }
     }
+    gpuDrawablesValid = false;
 }
 
 void ScreenSpaceGenerator::removeConvexShape(SimpleIdentity shapeID)
@@ -299,6 +390,8 @@ void ScreenSpaceGenerator::removeConvexShape(SimpleIdentity shapeID)
         if (it != activeShapes.end())
         {
             activeShapes.erase(it);
+            unindexShape(theShape);
+            gpuDrawablesValid = false;
         }
         delete theShape;
     }
@@ -310,11 +403,141 @@ void ScreenSpaceGenerator::removeConvexShapes(std::vector<SimpleIdentity> &shape
         removeConvexShape(shapeIDs[ii]);
 }
     
+// Decide whether the vertex shader can handle the given shape.
+// Layout controlled shapes have their offsets changed out from under us
+//  and fading shapes need their colors rescaled every frame, so those
+//  stay on the CPU path.
+bool ScreenSpaceGenerator::shapeOnGPU(ConvexShape *shape)
+{
+    if (shape->layout || shape->keepUpright)
+        return false;
+    if (shape->fadeUp != 0.0 || shape->fadeDown != 0.0)
+        return false;
+    // A custom program expects the CPU built geometry
+    for (unsigned int si=0;si<shape->geom.size();si++)
+        if (shape->geom[si].programID != EmptyIdentity)
+            return false;
+
+    return true;
+}
+
+// Used to sort the GPU drawables by texture and visibility range
+class GPUShapeKey
+{
+public:
+    GPUShapeKey(SimpleIdentity texID,float minVis,float maxVis) : texID(texID), minVis(minVis), maxVis(maxVis) { }
+
+    SimpleIdentity texID;
+    float minVis,maxVis;
+
+    bool operator < (const GPUShapeKey &that) const
+    {
+        if (texID == that.texID)
+        {
+            if (minVis == that.minVis)
+                return maxVis < that.maxVis;
+            return minVis < that.minVis;
+        }
+        return texID < that.texID;
+    }
+};
+typedef std::map<GPUShapeKey,ScreenSpaceDrawable *> GPUDrawableMap;
+
+void ScreenSpaceGenerator::buildGPUDrawables(WhirlyKitRendererFrameInfo *frameInfo)
+{
+    gpuDrawables.clear();
+
+    SimpleIdentity screenProgID = frameInfo.scene->getProgramIDBySceneName(kToolkitDefaultScreenSpaceProgram);
+    CoordSystemDisplayAdapter *coordAdapter = frameInfo.scene->getCoordAdapter();
+    float resScale = frameInfo.sceneRenderer.scale;
+
+    GPUDrawableMap drawMap;
+    for (ConvexShapeSet::iterator it = activeShapes.begin();
+         it != activeShapes.end(); ++it)
+    {
+        ConvexShape *shape = *it;
+        if (!shapeOnGPU(shape))
+            continue;
+
+        Point3f worldLoc(shape->worldLoc.x(),shape->worldLoc.y(),shape->worldLoc.z());
+        Point3f norm = coordAdapter->isFlat() ? Point3f(0,0,1) : worldLoc.normalized();
+
+        // Rotating shapes carry the world space direction their up vector
+        //  points.  The shader projects it to get the screen angle.
+        Point3f rotDir(0,0,0);
+        if (shape->useRotation)
+        {
+            Point3d right,up;
+            if (coordAdapter->isFlat())
+            {
+                right = Point3d(1,0,0);
+                up = Point3d(0,1,0);
+            } else {
+                Point3d simpleUp(0,0,1);
+                Point3d norm3d = shape->worldLoc;
+                norm3d.normalize();
+                right = simpleUp.cross(norm3d);
+                up = norm3d.cross(right);
+                right.normalize();
+                up.normalize();
+            }
+            Point3d dir = right * sin(shape->rotation) + up * cos(shape->rotation);
+            rotDir = Point3f(dir.x(),dir.y(),dir.z());
+        }
+
+        for (unsigned int si=0;si<shape->geom.size();si++)
+        {
+            SimpleGeometry &geom = shape->geom[si];
+
+            GPUShapeKey key(geom.texID,shape->minVis,shape->maxVis);
+            GPUDrawableMap::iterator dit = drawMap.find(key);
+            ScreenSpaceDrawable *draw = NULL;
+            if (dit == drawMap.end())
+            {
+                draw = new ScreenSpaceDrawable();
+                draw->setType(GL_TRIANGLES);
+                draw->setTexId(0,geom.texID);
+                draw->setProgram(screenProgID);
+                draw->setVisibleRange(shape->minVis,shape->maxVis);
+                draw->setAlpha(true);
+                draw->setRequestZBuffer(false);
+                draw->setWriteZBuffer(false);
+                drawMap[key] = draw;
+            } else
+                draw = dit->second;
+
+            int vOff = draw->getNumPoints();
+            for (unsigned int ii=0;ii<geom.coords.size();ii++)
+            {
+                Point2d coord = geom.coords[ii] + shape->offset;
+                draw->addPoint(worldLoc);
+                draw->addOffset(Point2f(coord.x()*resScale,coord.y()*resScale));
+                draw->addRotDir(rotDir);
+                draw->addNormal(norm);
+                draw->addTexCoord(0,geom.texCoords[ii]);
+                draw->addColor(geom.color);
+            }
+            for (unsigned int ii=2;ii<geom.coords.size();ii++)
+                draw->addTriangle(BasicDrawable::Triangle(0+vOff,ii+vOff,ii-1+vOff));
+
+            int oldDrawPriority = draw->getDrawPriority();
+            draw->setDrawPriority((shape->drawPriority > oldDrawPriority) ? shape->drawPriority : oldDrawPriority);
+        }
+    }
+
+    for (GPUDrawableMap::iterator it = drawMap.begin();
+         it != drawMap.end(); ++it)
+        gpuDrawables.push_back(DrawableRef(it->second));
+}
+
 void ScreenSpaceGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frameInfo, std::vector<DrawableRef> &outDrawables, std::vector<DrawableRef> &screenDrawables)
 {
     if (activeShapes.empty())
         return;
-    
+
+    // If the shader is missing everyone goes down the CPU path
+    bool useGPU = frameInfo.scene->getProgramIDBySceneName(kToolkitDefaultScreenSpaceProgram) != EmptyIdentity;
+
     // Keep drawables sorted by destination texture ID
     DrawableMap drawables;
     
@@ -325,22 +548,52 @@ void ScreenSpaceGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frameIn
     frameMbr.ll() = Point2f(0 - marginX,0 - marginY);
     frameMbr.ur() = Point2f(frameInfo.sceneRenderer.framebufferWidth + marginX,frameInfo.sceneRenderer.framebufferHeight + marginY);
     
+    // Matrices we'll use to cull the grid cells
+    std::vector<Eigen::Matrix4d> mvpMats;
+    mvpMats.reserve(frameInfo.offsetMatrices.size());
+    Eigen::Matrix4d projMat4d = Matrix4fToMatrix4d(frameInfo.projMat);
+    for (unsigned int offi=0;offi<frameInfo.offsetMatrices.size();offi++)
+        mvpMats.push_back(projMat4d * frameInfo.viewTrans4d * frameInfo.offsetMatrices[offi] * frameInfo.modelTrans4d);
+
     // Keep track of where the shapes wound up
     std::vector<ProjectedPoint> newProjPts;
-    
-    // Work through the markers, asking each to generate its content
-    for (ConvexShapeSet::iterator it = activeShapes.begin();
-         it != activeShapes.end(); ++it)
+
+    // Work through the cells, tossing the ones that can't be on screen.
+    // Only the shapes in the survivors pay for the projection math.
+    for (ShapeCellMap::iterator cit = shapeCells.begin();
+         cit != shapeCells.end(); ++cit)
     {
-        ConvexShape *shape = *it;
-        addToDrawables(shape,frameInfo,drawables,frameMbr,newProjPts);
+        ShapeCell &cell = cit->second;
+        if (!cellOnScreen(cell,mvpMats))
+            continue;
+        for (ConvexShapeSet::iterator it = cell.shapes.begin();
+             it != cell.shapes.end(); ++it)
+        {
+            ConvexShape *shape = *it;
+            if (useGPU && shapeOnGPU(shape))
+                continue;
+            addToDrawables(shape,frameInfo,drawables,frameMbr,newProjPts);
+        }
     }
-    
+
     // Copy the drawables out
     for (DrawableMap::iterator it = drawables.begin();
          it != drawables.end(); ++it)
         screenDrawables.push_back(DrawableRef(it->second));
-    
+
+    // The GPU projected shapes only get rebuilt when something changes.
+    // They go out with the world pass, since their shader does the projection.
+    if (useGPU)
+    {
+        if (!gpuDrawablesValid)
+        {
+            buildGPUDrawables(frameInfo);
+            gpuDrawablesValid = true;
+        }
+        for (unsigned int ii=0;ii<gpuDrawables.size();ii++)
+            outDrawables.push_back(gpuDrawables[ii]);
+    }
+
     // Now put the projected points in place
     pthread_mutex_lock(&projectedPtsLock);
     projectedPoints = newProjPts;
@@ -365,20 +618,78 @@ ScreenSpaceGenerator::ConvexShape *ScreenSpaceGenerator::getConvexShape(SimpleId
     return NULL;
 }
 
+bool ScreenSpaceGenerator::getShapeDamage(SimpleIdentity shapeID,Point2d &screenLoc,Point2d &offset,double &radius)
+{
+    ConvexShape *shape = getConvexShape(shapeID);
+    if (!shape)
+        return false;
+
+    // Find where it wound up last frame.  If it didn't, we can't bound it.
+    bool found = false;
+    pthread_mutex_lock(&projectedPtsLock);
+    for (unsigned int ii=0;ii<projectedPoints.size();ii++)
+        if (projectedPoints[ii].shapeID == shapeID)
+        {
+            screenLoc = projectedPoints[ii].screenLoc;
+            found = true;
+            break;
+        }
+    pthread_mutex_unlock(&projectedPtsLock);
+    if (!found)
+        return false;
+
+    offset = shape->offset;
+
+    // The geometry can rotate around its center, so a radius is all we claim
+    radius = 0.0;
+    for (unsigned int si=0;si<shape->geom.size();si++)
+    {
+        const SimpleGeometry &geom = shape->geom[si];
+        for (unsigned int ii=0;ii<geom.coords.size();ii++)
+            radius = std::max(radius,(double)geom.coords[ii].norm());
+    }
+
+    return true;
+}
+
 void ScreenSpaceGenerator::changeEnable(ConvexShape *shape,bool enable)
 {
     if (shape->enable)
+    {
         activeShapes.erase(shape);
+        unindexShape(shape);
+    }
     if (enable && shape->offset.x() != MAXFLOAT)
+    {
         activeShapes.insert(shape);
+        indexShape(shape);
+    }
 
     shape->enable = enable;
+    gpuDrawablesValid = false;
+}
+
+void ScreenSpaceGenerator::moveShape(ConvexShape *shape,const Point3d &worldLoc)
+{
+    // Active shapes live in the spatial index by location
+    bool indexed = shape->enable && shape->offset.x() != MAXFLOAT;
+    if (indexed)
+        unindexShape(shape);
+    shape->worldLoc = worldLoc;
+    if (indexed)
+        indexShape(shape);
+    gpuDrawablesValid = false;
+}
+
+void ScreenSpaceGenerator::dirtyGPUDrawables()
+{
+    gpuDrawablesValid = false;
 }
 
 void ScreenSpaceGenerator::dumpStats()
 {
     pthread_mutex_lock(&projectedPtsLock);
-    NSLog(@"ScreenSpace Generator: %ld shapes, %ld active",convexShapes.size(),activeShapes.size());
+    NSLog(@"ScreenSpace Generator: %ld shapes, %ld active in %ld cells",convexShapes.size(),activeShapes.size(),shapeCells.size());
     NSLog(@"ScreenSpace Generator: %ld projected points",projectedPoints.size());
     pthread_mutex_unlock(&projectedPtsLock);
 }
@@ -395,7 +706,13 @@ ScreenSpaceGeneratorAddRequest::ScreenSpaceGeneratorAddRequest(SimpleIdentity ge
 {
     shapes = inShapes;
 }
-    
+
+ScreenSpaceGeneratorAddRequest::ScreenSpaceGeneratorAddRequest(SimpleIdentity genID,std::vector<ScreenSpaceGenerator::ConvexShape *> &&inShapes)
+    : GeneratorChangeRequest(genID)
+{
+    shapes.swap(inShapes);
+}
+
 ScreenSpaceGeneratorAddRequest::~ScreenSpaceGeneratorAddRequest()
 {
     for (unsigned int ii=0;ii<shapes.size();ii++)
@@ -465,7 +782,10 @@ void ScreenSpaceGeneratorFadeRequest::execute2(Scene *scene,WhirlyKitSceneRender
             [renderer setRenderUntil:fadeUp];
             [renderer setRenderUntil:fadeDown];
         }
-    }    
+    }
+
+    // Fading shapes move to the CPU path
+    screenGen->dirtyGPUDrawables();
 }
     
 ScreenSpaceGeneratorEnableRequest::ScreenSpaceGeneratorEnableRequest(SimpleIdentity genID,const std::vector<SimpleIdentity> &shapeIDs,bool enable)
@@ -516,5 +836,67 @@ void ScreenSpaceGeneratorGangChangeRequest::execute2(Scene *scene,WhirlyKitScene
         }
     }
 }
-    
+
+bool ScreenSpaceGeneratorGangChangeRequest::getDamageRegion(Scene *scene,WhirlyKitSceneRendererES *renderer,Mbr &damageMbr)
+{
+    ScreenSpaceGenerator *screenGen = (ScreenSpaceGenerator *)scene->getGenerator(genId);
+    if (!screenGen)
+        return false;
+
+    float scale = renderer.scale;
+    for (unsigned int ii=0;ii<changes.size();ii++)
+    {
+        ShapeChange &change = changes[ii];
+
+        // Fades play out over multiple frames, so we can't bound them here
+        if (change.fadeUp != 0.0 || change.fadeDown != 0.0)
+            return false;
+
+        Point2d screenLoc,offset;
+        double radius;
+        if (!screenGen->getShapeDamage(change.shapeID,screenLoc,offset,radius))
+            return false;
+
+        // Cover where the shape was and where the new offset puts it
+        double rad = radius*scale;
+        Point2d newLoc = screenLoc + (change.offset-offset)*scale;
+        damageMbr.addPoint(Point2d(screenLoc.x()-rad,screenLoc.y()-rad));
+        damageMbr.addPoint(Point2d(screenLoc.x()+rad,screenLoc.y()+rad));
+        damageMbr.addPoint(Point2d(newLoc.x()-rad,newLoc.y()-rad));
+        damageMbr.addPoint(Point2d(newLoc.x()+rad,newLoc.y()+rad));
+    }
+
+    return true;
+}
+
+ScreenSpaceGeneratorMoveRequest::ShapeMove::ShapeMove()
+    : shapeID(EmptyIdentity), worldLoc(0.0,0.0,0.0), hasColor(false), color(255,255,255,255)
+{
+}
+
+ScreenSpaceGeneratorMoveRequest::ScreenSpaceGeneratorMoveRequest(SimpleIdentity genID,const std::vector<ShapeMove> &moves)
+    : GeneratorChangeRequest(genID), moves(moves)
+{
+}
+
+void ScreenSpaceGeneratorMoveRequest::execute2(Scene *scene,WhirlyKitSceneRendererES *renderer,Generator *gen)
+{
+    ScreenSpaceGenerator *screenGen = (ScreenSpaceGenerator *)gen;
+
+    for (unsigned int ii=0;ii<moves.size();ii++)
+    {
+        ShapeMove &move = moves[ii];
+        ScreenSpaceGenerator::ConvexShape *shape = screenGen->getConvexShape(move.shapeID);
+        if (shape)
+        {
+            screenGen->moveShape(shape,move.worldLoc);
+            if (move.hasColor)
+            {
+                for (unsigned int gi=0;gi<shape->geom.size();gi++)
+                    shape->geom[gi].color = move.color;
+            }
+        }
+    }
+}
+
 }
@@ -18,6 +18,7 @@
  *
  */
 
+#import <algorithm>
 #import "SelectionManager.h"
 #import "NSDictionary+Stuff.h"
 #import "UIColor+Stuff.h"
@@ -52,14 +53,14 @@ bool BillboardSelectable::operator < (const BillboardSelectable &that) const
 }
 
 SelectionManager::SelectionManager(Scene *scene,float viewScale)
-    : scene(scene), scale(viewScale)
+    : scene(scene), scale(viewScale), pickRoot(-1)
 {
-    pthread_mutex_init(&mutex,NULL);
+    pthread_rwlock_init(&lock,NULL);
 }
 
 SelectionManager::~SelectionManager()
 {
-    pthread_mutex_destroy(&mutex);
+    pthread_rwlock_destroy(&lock);
 }
 
 // Add a rectangle (in 3-space) available for selection
@@ -76,9 +77,10 @@ void SelectionManager::addSelectableRect(SimpleIdentity selectId,Point3f *pts,bo
     for (unsigned int ii=0;ii<4;ii++)
         newSelect.pts[ii] = pts[ii];
 
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     rect3Dselectables.insert(newSelect);
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+    pthread_rwlock_unlock(&lock);
 }
 
 // Add a rectangle (in 3-space) for selection, but only between the given visibilities
@@ -95,9 +97,10 @@ void SelectionManager::addSelectableRect(SimpleIdentity selectId,Point3f *pts,fl
     for (unsigned int ii=0;ii<4;ii++)
         newSelect.pts[ii] = pts[ii];
     
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     rect3Dselectables.insert(newSelect);
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+    pthread_rwlock_unlock(&lock);
 }
 
 /// Add a screen space rectangle (2D) for selection, between the given visibilities
@@ -114,9 +117,9 @@ void SelectionManager::addSelectableScreenRect(SimpleIdentity selectId,Point2f *
     for (unsigned int ii=0;ii<4;ii++)
         newSelect.pts[ii] = pts[ii];
     
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     rect2Dselectables.insert(newSelect);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&lock);
 }
 
 static const int corners[6][4] = {{0,1,2,3},{7,6,5,4},{1,0,4,5},{1,5,6,2},{2,6,7,3},{3,7,4,0}};
@@ -143,9 +146,10 @@ void SelectionManager::addSelectableRectSolid(SimpleIdentity selectId,Point3f *p
         newSelect.polys.push_back(poly);
     }
     
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     polytopeSelectables.insert(newSelect);
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+    pthread_rwlock_unlock(&lock);
 }
 
 void SelectionManager::addSelectableBillboard(SimpleIdentity selectId,Point3f center,Point3f norm,Point2f size,float minVis,float maxVis,bool enable)
@@ -162,14 +166,15 @@ void SelectionManager::addSelectableBillboard(SimpleIdentity selectId,Point3f ce
     newSelect.minVis = minVis;
     newSelect.maxVis = maxVis;
     
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     billboardSelectables.insert(newSelect);
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+    pthread_rwlock_unlock(&lock);
 }
 
 void SelectionManager::enableSelectable(SimpleIdentity selectID,bool enable)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     
     RectSelectable3DSet::iterator it = rect3Dselectables.find(RectSelectable3D(selectID));
     
@@ -208,12 +213,12 @@ void SelectionManager::enableSelectable(SimpleIdentity selectID,bool enable)
         billboardSelectables.insert(sel);
     }
     
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&lock);
 }
 
 void SelectionManager::enableSelectables(const SimpleIDSet &selectIDs,bool enable)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     
     for (SimpleIDSet::iterator sit = selectIDs.begin(); sit != selectIDs.end(); ++sit)
     {
@@ -256,13 +261,13 @@ void SelectionManager::enableSelectables(const SimpleIDSet &selectIDs,bool enabl
         }
     }
     
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&lock);
 }
 
 // Remove the given selectable from consideration
 void SelectionManager::removeSelectable(SimpleIdentity selectID)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     
     RectSelectable3DSet::iterator it = rect3Dselectables.find(RectSelectable3D(selectID));
     
@@ -281,12 +286,14 @@ void SelectionManager::removeSelectable(SimpleIdentity selectID)
     if (it4 != billboardSelectables.end())
         billboardSelectables.erase(it4);
 
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+
+    pthread_rwlock_unlock(&lock);
 }
 
 void SelectionManager::removeSelectables(const SimpleIDSet &selectIDs)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&lock);
     
     for (SimpleIDSet::iterator sit = selectIDs.begin(); sit != selectIDs.end(); ++sit)
     {
@@ -309,15 +316,207 @@ void SelectionManager::removeSelectables(const SimpleIDSet &selectIDs)
             billboardSelectables.erase(it4);
     }
     
-    pthread_mutex_unlock(&mutex);
+    pickRoot = -1;
+    
+    pthread_rwlock_unlock(&lock);
+}
+
+// How many entries we'll pack into a pick tree node
+static const unsigned int PickNodeSize = 8;
+
+// Used to order the pick entries as the tree builds
+class PickSortEntry
+{
+public:
+    unsigned int index;
+    Point3f center;
+};
+
+typedef struct
+{
+    bool operator () (const PickSortEntry &a,const PickSortEntry &b) const { return a.center.x() < b.center.x(); }
+} PickSortX;
+typedef struct
+{
+    bool operator () (const PickSortEntry &a,const PickSortEntry &b) const { return a.center.y() < b.center.y(); }
+} PickSortY;
+
+// Build the bounding sphere hierarchy over the 3D selectables.
+// Sort-tile-recursive style packing, like the vector database uses.
+// Call this with the lock held.
+void SelectionManager::buildPickTree()
+{
+    pickEntries.clear();
+    pickNodes.clear();
+    pickRoot = -1;
+
+    // Pull bounding spheres out of the various selectable sets
+    for (RectSelectable3DSet::iterator it = rect3Dselectables.begin();
+         it != rect3Dselectables.end(); ++it)
+    {
+        const RectSelectable3D &sel = *it;
+        PickEntry entry;
+        entry.kind = PickEntry::Rect3DKind;
+        entry.selectID = sel.selectID;
+        entry.center = Point3f(0,0,0);
+        for (unsigned int ii=0;ii<4;ii++)
+            entry.center += sel.pts[ii];
+        entry.center /= 4.0;
+        entry.radius = 0.0;
+        for (unsigned int ii=0;ii<4;ii++)
+            entry.radius = std::max(entry.radius,(sel.pts[ii]-entry.center).norm());
+        pickEntries.push_back(entry);
+    }
+    for (PolytopeSelectableSet::iterator it = polytopeSelectables.begin();
+         it != polytopeSelectables.end(); ++it)
+    {
+        const PolytopeSelectable &sel = *it;
+        PickEntry entry;
+        entry.kind = PickEntry::PolytopeKind;
+        entry.selectID = sel.selectID;
+        entry.center = sel.midPt;
+        entry.radius = 0.0;
+        for (unsigned int ii=0;ii<sel.polys.size();ii++)
+            for (unsigned int jj=0;jj<sel.polys[ii].size();jj++)
+                entry.radius = std::max(entry.radius,(sel.polys[ii][jj]-entry.center).norm());
+        pickEntries.push_back(entry);
+    }
+    for (BillboardSelectableSet::iterator it = billboardSelectables.begin();
+         it != billboardSelectables.end(); ++it)
+    {
+        const BillboardSelectable &sel = *it;
+        PickEntry entry;
+        entry.kind = PickEntry::BillboardKind;
+        entry.selectID = sel.selectID;
+        // The billboard turns to face the viewer, so be conservative
+        entry.center = sel.center;
+        entry.radius = sqrtf(sel.size.x()*sel.size.x()/4.0+sel.size.y()*sel.size.y());
+        pickEntries.push_back(entry);
+    }
+
+    if (pickEntries.empty())
+        return;
+
+    // Leaf entries, sorted by X and then sliced by Y
+    std::vector<PickSortEntry> entries(pickEntries.size());
+    for (unsigned int ii=0;ii<pickEntries.size();ii++)
+    {
+        entries[ii].index = ii;
+        entries[ii].center = pickEntries[ii].center;
+    }
+
+    bool leafLevel = true;
+    for (;;)
+    {
+        unsigned int numEntries = (unsigned int)entries.size();
+        if (numEntries == 1 && !leafLevel)
+        {
+            pickRoot = entries[0].index;
+            break;
+        }
+
+        std::sort(entries.begin(),entries.end(),PickSortX());
+        unsigned int numSlices = std::max(1,(int)ceil(sqrt((double)((numEntries+PickNodeSize-1)/PickNodeSize))));
+        unsigned int sliceLen = numSlices*PickNodeSize;
+        for (unsigned int ii=0;ii<numEntries;ii+=sliceLen)
+            std::sort(entries.begin()+ii,entries.begin()+std::min(numEntries,ii+sliceLen),PickSortY());
+
+        // Pack runs of entries into nodes
+        std::vector<PickSortEntry> parents;
+        for (unsigned int ii=0;ii<numEntries;ii+=PickNodeSize)
+        {
+            PickNode node;
+            node.leaf = leafLevel;
+            node.center = Point3f(0,0,0);
+            unsigned int end = std::min(numEntries,ii+PickNodeSize);
+            for (unsigned int jj=ii;jj<end;jj++)
+            {
+                node.children.push_back(entries[jj].index);
+                node.center += entries[jj].center;
+            }
+            node.center /= (end-ii);
+            node.radius = 0.0;
+            for (unsigned int jj=ii;jj<end;jj++)
+            {
+                float childRadius = (leafLevel ? pickEntries[entries[jj].index].radius : pickNodes[entries[jj].index].radius);
+                node.radius = std::max(node.radius,(entries[jj].center-node.center).norm()+childRadius);
+            }
+            pickNodes.push_back(node);
+            PickSortEntry parent;
+            parent.index = (unsigned int)(pickNodes.size()-1);
+            parent.center = node.center;
+            parents.push_back(parent);
+        }
+
+        entries.swap(parents);
+        leafLevel = false;
+    }
+}
+
+// Walk the hierarchy, keeping anything whose projected bounds land near
+//  one of the touch points
+void SelectionManager::pickTreeCandidates(const std::vector<Point2f> &touchPts,float maxDist,Eigen::Matrix4d &modelTrans,Eigen::Matrix4d &projTrans,const Point2f &frameSize,std::vector<unsigned int> &candEntries)
+{
+    if (pickRoot < 0)
+        return;
+
+    // Rough scale from display space to pixels at a given eye distance
+    double projScale = projTrans(1,1) * frameSize.y()/2.0;
+
+    std::vector<unsigned int> toVisit;
+    toVisit.push_back(pickRoot);
+    while (!toVisit.empty())
+    {
+        PickNode &node = pickNodes[toVisit.back()];
+        toVisit.pop_back();
+
+        Vector4d viewPt = modelTrans * Vector4d(node.center.x(),node.center.y(),node.center.z(),1.0);
+        bool anyClose = false;
+        if (viewPt.z() >= 0.0)
+        {
+            // Behind the eye (or wrapped around).  Don't try to prune.
+            anyClose = true;
+        } else {
+            // Project the sphere's center and a conservative pixel radius
+            Vector4d screen4 = projTrans * viewPt;
+            Point2f screenPt((screen4.x()/screen4.w()+1.0)/2.0 * frameSize.x(),
+                             (1.0-screen4.y()/screen4.w())/2.0 * frameSize.y());
+            float pixRadius = node.radius * projScale / (-viewPt.z()) + maxDist;
+            for (unsigned int ti=0;ti<touchPts.size();ti++)
+                if ((touchPts[ti]-screenPt).norm() <= pixRadius)
+                {
+                    anyClose = true;
+                    break;
+                }
+        }
+        if (!anyClose)
+            continue;
+
+        if (node.leaf)
+            candEntries.insert(candEntries.end(),node.children.begin(),node.children.end());
+        else
+            toVisit.insert(toVisit.end(),node.children.begin(),node.children.end());
+    }
 }
 
 /// Pass in the screen point where the user touched.  This returns the closest hit within the given distance
-// Note: Should switch to a view state, rather than a view
 SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,WhirlyKitView *theView)
 {
-    if (!renderer)
-        return EmptyIdentity;
+    std::vector<Point2f> touchPts;
+    touchPts.push_back(touchPt);
+    std::vector<SimpleIdentity> retIds;
+    pickObjects(touchPts,maxDist,theView,retIds);
+
+    return (retIds.empty() ? EmptyIdentity : retIds[0]);
+}
+
+// Note: Should switch to a view state, rather than a view
+void SelectionManager::pickObjects(const std::vector<Point2f> &touchPts,float maxDist,WhirlyKitView *theView,std::vector<SimpleIdentity> &retIds)
+{
+    unsigned int numTouch = (unsigned int)touchPts.size();
+    retIds.assign(numTouch,EmptyIdentity);
+    if (!renderer || numTouch == 0)
+        return;
     
     float maxDist2 = maxDist * maxDist;
     
@@ -331,8 +530,10 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
     Vector4d eyeVec4 = modelTransInv * Vector4d(0,0,1,0);
     Vector3d eyeVec(eyeVec4.x(),eyeVec4.y(),eyeVec4.z());
 
-    SimpleIdentity retId = EmptyIdentity;
-    float closeDist2 = MAXFLOAT;
+    // Closest 2D/3D rectangle edge per touch point
+    std::vector<float> closeDist2(numTouch,MAXFLOAT);
+    // Set when a touch point landed inside a rectangle outright
+    std::vector<bool> exactHit(numTouch,false);
     
     WhirlyGlobeView *globeView = (WhirlyGlobeView *)theView;
     if (![theView isKindOfClass:[WhirlyGlobeView class]])
@@ -342,13 +543,15 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
         mapView = nil;
     
     if (!globeView && !mapView)
-        return EmptyIdentity;
+        return;
     
     // First we need to know where the things wound up, 2D wise
     std::vector<ScreenSpaceGenerator::ProjectedPoint> projPts;
     scene->getScreenSpaceGenerator()->getProjectedPoints(projPts);
-    
-    pthread_mutex_lock(&mutex);
+
+    // Picking only reads, so concurrent picks don't block each other
+    //  and the layer threads only hold us up while they write
+    pthread_rwlock_rdlock(&lock);
     
     // Work through the 2D rectangles
     for (unsigned int ii=0;ii<projPts.size();ii++)
@@ -369,37 +572,80 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
                     (sel.minVis < [theView heightAboveSurface] && [theView heightAboveSurface] < sel.maxVis))
                 {
                     std::vector<Point2f> screenPts;
+                    Mbr screenMbr;
                     for (unsigned int jj=0;jj<4;jj++)
-                        screenPts.push_back(Point2f(sel.pts[jj].x(),sel.pts[jj].y())+Point2f(projPt.screenLoc.x(),projPt.screenLoc.y()));
-
-                    // See if we fall within that polygon
-                    if (PointInPolygon(touchPt, screenPts))
                     {
-                        retId = sel.selectID;
-                        break;
+                        screenPts.push_back(Point2f(sel.pts[jj].x(),sel.pts[jj].y())+Point2f(projPt.screenLoc.x(),projPt.screenLoc.y()));
+                        screenMbr.addPoint(screenPts[jj]);
                     }
-                    
-                    // Now for a proximity check around the edges
-                    for (unsigned int ii=0;ii<4;ii++)
+                    // Room for the proximity check as well
+                    screenMbr.ll() -= Point2f(maxDist,maxDist);
+                    screenMbr.ur() += Point2f(maxDist,maxDist);
+
+                    for (unsigned int ti=0;ti<numTouch;ti++)
                     {
-                        Point2f closePt = ClosestPointOnLineSegment(screenPts[ii],screenPts[(ii+1)%4],touchPt);
-                        float dist2 = (closePt-touchPt).squaredNorm();
-                        if (dist2 <= maxDist2 && (dist2 < closeDist2))
+                        if (exactHit[ti])
+                            continue;
+                        const Point2f &touchPt = touchPts[ti];
+                        // Toss anything not even close before we do real math
+                        if (!screenMbr.inside(touchPt))
+                            continue;
+
+                        // See if we fall within that polygon
+                        if (PointInPolygon(touchPt, screenPts))
                         {
-                            retId = sel.selectID;
-                            closeDist2 = dist2;
+                            retIds[ti] = sel.selectID;
+                            exactHit[ti] = true;
+                            continue;
                         }
-                    }                    
+                        
+                        // Now for a proximity check around the edges
+                        for (unsigned int ei=0;ei<4;ei++)
+                        {
+                            Point2f closePt = ClosestPointOnLineSegment(screenPts[ei],screenPts[(ei+1)%4],touchPt);
+                            float dist2 = (closePt-touchPt).squaredNorm();
+                            if (dist2 <= maxDist2 && (dist2 < closeDist2[ti]))
+                            {
+                                retIds[ti] = sel.selectID;
+                                closeDist2[ti] = dist2;
+                            }
+                        }
+                    }
                 }
             }
         }
     }
 
-    if (retId == EmptyIdentity && !polytopeSelectables.empty())
+    // See who still needs an answer before we bother with the 3D objects
+    bool anyLeft = false;
+    for (unsigned int ti=0;ti<numTouch;ti++)
+        if (retIds[ti] == EmptyIdentity)
+            anyLeft = true;
+
+    // The bounding sphere hierarchy thins out the 3D objects we project
+    std::vector<unsigned int> candEntries;
+    if (anyLeft && (!polytopeSelectables.empty() || !rect3Dselectables.empty() || !billboardSelectables.empty()))
+    {
+        // The rebuild writes, so trade up to the write lock for it and
+        //  back down after.  Someone may dirty the tree again in the
+        //  gap, which is why this loops.
+        while (pickRoot < 0)
+        {
+            pthread_rwlock_unlock(&lock);
+            pthread_rwlock_wrlock(&lock);
+            if (pickRoot < 0)
+                buildPickTree();
+            pthread_rwlock_unlock(&lock);
+            pthread_rwlock_rdlock(&lock);
+        }
+        pickTreeCandidates(touchPts,maxDist,modelTrans,projTrans,frameSize,candEntries);
+    }
+
+    if (!candEntries.empty() && !polytopeSelectables.empty())
     {
         // We'll look for the closest object we can find
-        float distToObj2 = MAXFLOAT;
-        SimpleIdentity foundId = EmptyIdentity;
+        std::vector<float> distToObj2(numTouch,MAXFLOAT);
+        std::vector<SimpleIdentity> foundIds(numTouch,EmptyIdentity);
         Point3f eyePos;
         if (globeView)
             eyePos = Vector3dToVector3f(globeView.eyePos);
@@ -407,9 +653,14 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
             NSLog(@"Need to fill in eyePos for mapView");
         
         // Work through the axis aligned rectangular solids
-        for (PolytopeSelectableSet::iterator it = polytopeSelectables.begin();
-             it != polytopeSelectables.end(); ++it)
+        for (unsigned int ci=0;ci<candEntries.size();ci++)
         {
+            const PickEntry &entry = pickEntries[candEntries[ci]];
+            if (entry.kind != PickEntry::PolytopeKind)
+                continue;
+            PolytopeSelectableSet::iterator it = polytopeSelectables.find(PolytopeSelectable(entry.selectID));
+            if (it == polytopeSelectables.end())
+                continue;
             PolytopeSelectable sel = *it;
             if (sel.selectID != EmptyIdentity && sel.enable)
             {
@@ -433,47 +684,60 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
                         
                         if (screenPts.size() > 3)
                         {
-                            if (PointInPolygon(touchPt, screenPts))
+                            for (unsigned int ti=0;ti<numTouch;ti++)
                             {
-                                float dist2 = (sel.midPt - eyePos).squaredNorm();
-                                if (dist2 < distToObj2)
+                                if (retIds[ti] != EmptyIdentity)
+                                    continue;
+                                const Point2f &touchPt = touchPts[ti];
+                                if (PointInPolygon(touchPt, screenPts))
                                 {
-                                    distToObj2 = dist2;
-                                    foundId = sel.selectID;
+                                    float dist2 = (sel.midPt - eyePos).squaredNorm();
+                                    if (dist2 < distToObj2[ti])
+                                    {
+                                        distToObj2[ti] = dist2;
+                                        foundIds[ti] = sel.selectID;
+                                    }
+                                    continue;
                                 }
-                                break;
-                            }
-                            
-                            for (unsigned int jj=0;jj<screenPts.size();jj++)
-                            {
-                                Point2f closePt = ClosestPointOnLineSegment(screenPts[jj],screenPts[(jj+1)%4],touchPt);
-                                float dist2 = (closePt-touchPt).squaredNorm();
-                                if (dist2 <= maxDist2)
+                                
+                                for (unsigned int jj=0;jj<screenPts.size();jj++)
                                 {
-                                    float objDist2 = (sel.midPt - eyePos).squaredNorm();
-                                    if (objDist2 < distToObj2)
+                                    Point2f closePt = ClosestPointOnLineSegment(screenPts[jj],screenPts[(jj+1)%4],touchPt);
+                                    float dist2 = (closePt-touchPt).squaredNorm();
+                                    if (dist2 <= maxDist2)
                                     {
-                                        distToObj2 = objDist2;
-                                        foundId = sel.selectID;
-                                        break;
+                                        float objDist2 = (sel.midPt - eyePos).squaredNorm();
+                                        if (objDist2 < distToObj2[ti])
+                                        {
+                                            distToObj2[ti] = objDist2;
+                                            foundIds[ti] = sel.selectID;
+                                            break;
+                                        }
                                     }
                                 }
-                            }                            
+                            }
                         }
                     }
                 }
             }
         }
         
-        retId = foundId;
+        for (unsigned int ti=0;ti<numTouch;ti++)
+            if (retIds[ti] == EmptyIdentity)
+                retIds[ti] = foundIds[ti];
     }
     
-    if (retId == EmptyIdentity && !rect3Dselectables.empty())
+    if (!candEntries.empty() && !rect3Dselectables.empty())
     {
         // Work through the 3D rectangles
-        for (RectSelectable3DSet::iterator it = rect3Dselectables.begin();
-             it != rect3Dselectables.end(); ++it)
+        for (unsigned int ci=0;ci<candEntries.size();ci++)
         {
+            const PickEntry &entry = pickEntries[candEntries[ci]];
+            if (entry.kind != PickEntry::Rect3DKind)
+                continue;
+            RectSelectable3DSet::iterator it = rect3Dselectables.find(RectSelectable3D(entry.selectID));
+            if (it == rect3Dselectables.end())
+                continue;
             RectSelectable3D sel = *it;
             if (sel.selectID != EmptyIdentity && sel.enable)
             {
@@ -493,22 +757,29 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
                         screenPts.push_back(Point2f(screenPt.x,screenPt.y));
                     }
                     
-                    // See if we fall within that polygon
-                    if (PointInPolygon(touchPt, screenPts))
+                    for (unsigned int ti=0;ti<numTouch;ti++)
                     {
-                        retId = sel.selectID;
-                        break;
-                    }
-                    
-                    // Now for a proximity check around the edges
-                    for (unsigned int ii=0;ii<4;ii++)
-                    {
-                        Point2f closePt = ClosestPointOnLineSegment(screenPts[ii],screenPts[(ii+1)%4],touchPt);
-                        float dist2 = (closePt-touchPt).squaredNorm();
-                        if (dist2 <= maxDist2 && (dist2 < closeDist2))
+                        if (exactHit[ti] || retIds[ti] != EmptyIdentity)
+                            continue;
+                        const Point2f &touchPt = touchPts[ti];
+                        // See if we fall within that polygon
+                        if (PointInPolygon(touchPt, screenPts))
+                        {
+                            retIds[ti] = sel.selectID;
+                            exactHit[ti] = true;
+                            continue;
+                        }
+                        
+                        // Now for a proximity check around the edges
+                        for (unsigned int ei=0;ei<4;ei++)
                         {
-                            retId = sel.selectID;
-                            closeDist2 = dist2;
+                            Point2f closePt = ClosestPointOnLineSegment(screenPts[ei],screenPts[(ei+1)%4],touchPt);
+                            float dist2 = (closePt-touchPt).squaredNorm();
+                            if (dist2 <= maxDist2 && (dist2 < closeDist2[ti]))
+                            {
+                                retIds[ti] = sel.selectID;
+                                closeDist2[ti] = dist2;
+                            }
                         }
                     }
                 }
@@ -516,11 +787,11 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
         }
     }
     
-    if (retId == EmptyIdentity && !billboardSelectables.empty())
+    if (!candEntries.empty() && !billboardSelectables.empty())
     {
         // We'll look for the closest object we can find
-        float distToObj2 = MAXFLOAT;
-        SimpleIdentity foundId = EmptyIdentity;
+        std::vector<float> distToObj2(numTouch,MAXFLOAT);
+        std::vector<SimpleIdentity> foundIds(numTouch,EmptyIdentity);
         Point3f eyePos;
         if (globeView)
             eyePos = Vector3dToVector3f(globeView.eyePos);
@@ -528,9 +799,14 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
             NSLog(@"Need to fill in eyePos for mapView");
 
         // Work through the billboards
-        for (BillboardSelectableSet::iterator it = billboardSelectables.begin();
-             it != billboardSelectables.end(); ++it)
+        for (unsigned int ci=0;ci<candEntries.size();ci++)
         {
+            const PickEntry &entry = pickEntries[candEntries[ci]];
+            if (entry.kind != PickEntry::BillboardKind)
+                continue;
+            BillboardSelectableSet::iterator it = billboardSelectables.find(BillboardSelectable(entry.selectID));
+            if (it == billboardSelectables.end())
+                continue;
             BillboardSelectable sel = *it;
             if (sel.selectID != EmptyIdentity && sel.enable)
             {
@@ -546,36 +822,40 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
                 poly[2] = -sel.size.x()/2.0 * axisX + sel.size.y() * normal3d + center3d;
                 poly[1] = sel.size.x()/2.0 * axisX + sel.size.y() * normal3d + center3d;
                 
-                BillboardSelectable sel = *it;
-
                 std::vector<Point2f> screenPts;
                 ClipAndProjectPolygon(modelTrans,projTrans,frameSize,poly,screenPts);
                 
                 if (screenPts.size() > 3)
                 {
-                    if (PointInPolygon(touchPt, screenPts))
+                    for (unsigned int ti=0;ti<numTouch;ti++)
                     {
-                        float dist2 = (sel.center - eyePos).squaredNorm();
-                        if (dist2 < distToObj2)
+                        if (retIds[ti] != EmptyIdentity)
+                            continue;
+                        const Point2f &touchPt = touchPts[ti];
+                        if (PointInPolygon(touchPt, screenPts))
                         {
-                            distToObj2 = dist2;
-                            foundId = sel.selectID;
+                            float dist2 = (sel.center - eyePos).squaredNorm();
+                            if (dist2 < distToObj2[ti])
+                            {
+                                distToObj2[ti] = dist2;
+                                foundIds[ti] = sel.selectID;
+                            }
+                            continue;
                         }
-                        break;
-                    }
-                    
-                    for (unsigned int jj=0;jj<screenPts.size();jj++)
-                    {
-                        Point2f closePt = ClosestPointOnLineSegment(screenPts[jj],screenPts[(jj+1)%4],touchPt);
-                        float dist2 = (closePt-touchPt).squaredNorm();
-                        if (dist2 <= maxDist2)
+                        
+                        for (unsigned int jj=0;jj<screenPts.size();jj++)
                         {
-                            float objDist2 = (sel.center - eyePos).squaredNorm();
-                            if (objDist2 < distToObj2)
+                            Point2f closePt = ClosestPointOnLineSegment(screenPts[jj],screenPts[(jj+1)%4],touchPt);
+                            float dist2 = (closePt-touchPt).squaredNorm();
+                            if (dist2 <= maxDist2)
                             {
-                                distToObj2 = objDist2;
-                                foundId = sel.selectID;
-                                break;
+                                float objDist2 = (sel.center - eyePos).squaredNorm();
+                                if (objDist2 < distToObj2[ti])
+                                {
+                                    distToObj2[ti] = objDist2;
+                                    foundIds[ti] = sel.selectID;
+                                    break;
+                                }
                             }
                         }
                     }
@@ -583,10 +863,10 @@ SimpleIdentity SelectionManager::pickObject(Point2f touchPt,float maxDist,Whirly
             }
         }
 
-        retId = foundId;
+        for (unsigned int ti=0;ti<numTouch;ti++)
+            if (retIds[ti] == EmptyIdentity)
+                retIds[ti] = foundIds[ti];
     }
     
-    pthread_mutex_unlock(&mutex);
-    
-    return retId;
+    pthread_rwlock_unlock(&lock);
 }
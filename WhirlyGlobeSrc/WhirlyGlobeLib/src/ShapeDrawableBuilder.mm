@@ -59,12 +59,14 @@ static const int ShapeDrawPriority=1;
     _drawOffset = [desc floatForKey:@"drawOffset" default:0];
     _minVis = [desc floatForKey:@"minVis" default:DrawVisibleInvalid];
     _maxVis = [desc floatForKey:@"maxVis" default:DrawVisibleInvalid];
+    _minPix = [desc floatForKey:@"minpixels" default:0.0];
     _drawPriority = [desc intForKey:@"drawPriority" default:ShapeDrawPriority];
     _lineWidth = [desc floatForKey:@"width" default:1.0];
     _fade = [desc floatForKey:@"fade" default:0.0];
     _zBufferRead = [desc floatForKey:@"zbufferread" default:true];
     _zBufferWrite = [desc floatForKey:@"zbufferwrite" default:true];
     _enable = [desc boolForKey:@"enable" default:true];
+    _optimizeTris = [desc boolForKey:@"optimizetriangles" default:true];
     _shaderID = [desc intForKey:@"shader" default:EmptyIdentity];
 }
 
@@ -164,7 +166,12 @@ void ShapeDrawableBuilder::flush()
         if (drawable->getNumPoints() > 0)
         {
             drawable->setLocalMbr(drawMbr);
-            
+            if (shapeInfo.minPix > 0.0)
+            {
+                Point2f span = drawMbr.ur() - drawMbr.ll();
+                drawable->setScreenSpaceGate(sqrtf(span.x()*span.x()+span.y()*span.y())/2.0,shapeInfo.minPix);
+            }
+
             if (shapeInfo.fade > 0.0)
             {
                 NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
@@ -292,19 +299,26 @@ void ShapeDrawableBuilderTri::flush()
         if (drawable->getNumPoints() > 0)
         {
             drawable->setLocalMbr(drawMbr);
-            
+            if (shapeInfo.minPix > 0.0)
+            {
+                Point2f span = drawMbr.ur() - drawMbr.ll();
+                drawable->setScreenSpaceGate(sqrtf(span.x()*span.x()+span.y()*span.y())/2.0,shapeInfo.minPix);
+            }
+
             if (shapeInfo.fade > 0.0)
             {
                 NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
                 drawable->setFade(curTime,curTime+shapeInfo.fade);
             }
+            if (shapeInfo.optimizeTris)
+                drawable->optimizeTriangles();
             drawables.push_back(drawable);
         } else
             delete drawable;
         drawable = NULL;
     }
 }
-    
+
 void ShapeDrawableBuilderTri::getChanges(ChangeSet &changeRequests,SimpleIDSet &drawIDs)
 {
     flush();
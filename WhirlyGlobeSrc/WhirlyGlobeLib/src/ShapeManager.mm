@@ -23,6 +23,7 @@
 #import "ShapeManager.h"
 #import "ShapeDrawableBuilder.h"
 #import "SelectionManager.h"
+#import "DefaultShaderPrograms.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
@@ -350,22 +351,362 @@ ShapeManager::~ShapeManager()
     pthread_mutex_destroy(&shapeLock);
 }
 
+// With this many of a shape in a group it's cheaper to draw one
+//  unit mesh over and over than to tessellate each of them
+static const int ShapeInstanceThreshold = 16;
+
+void ShapeManager::buildSphereInstances(NSArray *spheres,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes)
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+
+    // The master geometry is a unit sphere at the origin.  The
+    //  instances position, scale, and color it.
+    BasicDrawable *masterDraw = new BasicDrawable("Shape Layer Sphere Master");
+    masterDraw->setType(GL_TRIANGLES);
+    // Only ever drawn through the instances
+    masterDraw->setOnOff(false);
+    masterDraw->setDrawPriority(shapeInfo.drawPriority);
+    masterDraw->setRequestZBuffer(shapeInfo.zBufferRead);
+    masterDraw->setWriteZBuffer(shapeInfo.zBufferWrite);
+    Point2f geoIncr(2*M_PI/SphereTessX,M_PI/SphereTessY);
+    for (unsigned int iy=0;iy<SphereTessY+1;iy++)
+        for (unsigned int ix=0;ix<SphereTessX+1;ix++)
+        {
+            GeoCoord geoLoc(-M_PI+ix*geoIncr.x(),-M_PI/2.0 + iy*geoIncr.y());
+			if (geoLoc.x() < -M_PI)  geoLoc.x() = -M_PI;
+			if (geoLoc.x() > M_PI) geoLoc.x() = M_PI;
+			if (geoLoc.y() < -M_PI/2.0)  geoLoc.y() = -M_PI/2.0;
+			if (geoLoc.y() > M_PI/2.0) geoLoc.y() = M_PI/2.0;
+
+            Point3f spherePt = FakeGeocentricDisplayAdapter::LocalToDisplay(Point3f(geoLoc.lon(),geoLoc.lat(),0.0));
+            masterDraw->addPoint(spherePt);
+            masterDraw->addNormal(spherePt);
+            // The per-instance color multiplies this
+            masterDraw->addColor(RGBAColor(255,255,255,255));
+        }
+    for (unsigned int iy=0;iy<SphereTessY;iy++)
+        for (unsigned int ix=0;ix<SphereTessX;ix++)
+        {
+			BasicDrawable::Triangle triA,triB;
+			triA.verts[0] = iy*(SphereTessX+1)+ix;
+			triA.verts[1] = iy*(SphereTessX+1)+(ix+1);
+			triA.verts[2] = (iy+1)*(SphereTessX+1)+(ix+1);
+			triB.verts[0] = triA.verts[0];
+			triB.verts[1] = triA.verts[2];
+			triB.verts[2] = (iy+1)*(SphereTessX+1)+ix;
+            masterDraw->addTriangle(triA);
+            masterDraw->addTriangle(triB);
+        }
+    if (shapeInfo.fade > 0.0)
+    {
+        NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
+        masterDraw->setFade(curTime,curTime+shapeInfo.fade);
+    }
+
+    BasicDrawableInstance *drawInst = new BasicDrawableInstance("Shape Layer Sphere Instances",masterDraw->getId());
+    drawInst->setProgram(scene->getProgramIDBySceneName(kToolkitDefaultTriangleInstancedProgram));
+    drawInst->setDrawPriority(shapeInfo.drawPriority);
+    drawInst->setVisibleRange(shapeInfo.minVis,shapeInfo.maxVis);
+    drawInst->setEnable(shapeInfo.enable);
+
+    // One instance per sphere
+    Mbr shapeMbr;
+    std::vector<BasicDrawableInstance::SingleInstance> insts;
+    insts.reserve([spheres count]);
+    for (WhirlyKitSphere *sphere in spheres)
+    {
+        Point3f localPt = coordAdapter->getCoordSystem()->geographicToLocal(sphere.loc);
+        Point3f dispPt = coordAdapter->localToDisplay(localPt);
+        Point3f norm = coordAdapter->normalForLocal(localPt);
+        dispPt = dispPt + norm * sphere.height;
+
+        BasicDrawableInstance::SingleInstance inst;
+        inst.center = Point3d(dispPt.x(),dispPt.y(),dispPt.z());
+        inst.scale = sphere.radius;
+        inst.colorOverride = true;
+        inst.color = (sphere.useColor ? sphere.color : [shapeInfo.color asRGBAColor]);
+        insts.push_back(inst);
+
+        // Note: Not handling the radius here
+        shapeMbr.addPoint(Point2f(localPt.x(),localPt.y()));
+
+        // Add a selection region, same as the unshared path
+        if (sphere.isSelectable)
+        {
+            Point3f pts[8];
+            float dist = sphere.radius * sqrt2;
+            pts[0] = dispPt + dist * Point3f(-1,-1,-1);
+            pts[1] = dispPt + dist * Point3f(1,-1,-1);
+            pts[2] = dispPt + dist * Point3f(1,1,-1);
+            pts[3] = dispPt + dist * Point3f(-1,1,-1);
+            pts[4] = dispPt + dist * Point3f(-1,-1,1);
+            pts[5] = dispPt + dist * Point3f(1,-1,1);
+            pts[6] = dispPt + dist * Point3f(1,1,1);
+            pts[7] = dispPt + dist * Point3f(-1,1,1);
+            selectManager->addSelectableRectSolid(sphere.selectID,pts,shapeInfo.minVis,shapeInfo.maxVis,shapeInfo.enable);
+            sceneRep->selectIDs.insert(sphere.selectID);
+        }
+    }
+    drawInst->addInstances(insts);
+    masterDraw->setLocalMbr(shapeMbr);
+
+    // The master has to show up before the instance does
+    changes.push_back(new AddDrawableReq(masterDraw));
+    changes.push_back(new AddDrawableReq(drawInst));
+    sceneRep->drawIDs.insert(masterDraw->getId());
+    sceneRep->drawIDs.insert(drawInst->getId());
+}
+
+void ShapeManager::buildCircleInstances(NSArray *circles,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes)
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+
+    // Unit disc at the origin, facing up.  We only get here on a flat
+    //  map, where every circle faces the same way
+    BasicDrawable *masterDraw = new BasicDrawable("Shape Layer Circle Master");
+    masterDraw->setType(GL_TRIANGLES);
+    // Only ever drawn through the instances
+    masterDraw->setOnOff(false);
+    masterDraw->setDrawPriority(shapeInfo.drawPriority);
+    masterDraw->setRequestZBuffer(shapeInfo.zBufferRead);
+    masterDraw->setWriteZBuffer(shapeInfo.zBufferWrite);
+    Point3f norm(0,0,1);
+    masterDraw->addPoint(Point3f(0,0,0));
+    masterDraw->addNormal(norm);
+    masterDraw->addColor(RGBAColor(255,255,255,255));
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+    {
+        masterDraw->addPoint(Point3f(sinf(2*M_PI*ii/(float)CircleSamples),cosf(2*M_PI*ii/(float)CircleSamples),0.0));
+        masterDraw->addNormal(norm);
+        masterDraw->addColor(RGBAColor(255,255,255,255));
+    }
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+        masterDraw->addTriangle(BasicDrawable::Triangle(0,ii+1,((ii+1)%CircleSamples)+1));
+    if (shapeInfo.fade > 0.0)
+    {
+        NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
+        masterDraw->setFade(curTime,curTime+shapeInfo.fade);
+    }
+
+    BasicDrawableInstance *drawInst = new BasicDrawableInstance("Shape Layer Circle Instances",masterDraw->getId());
+    drawInst->setProgram(scene->getProgramIDBySceneName(kToolkitDefaultTriangleInstancedProgram));
+    drawInst->setDrawPriority(shapeInfo.drawPriority);
+    drawInst->setVisibleRange(shapeInfo.minVis,shapeInfo.maxVis);
+    drawInst->setEnable(shapeInfo.enable);
+
+    // One instance per circle
+    Mbr shapeMbr;
+    std::vector<BasicDrawableInstance::SingleInstance> insts;
+    insts.reserve([circles count]);
+    for (WhirlyKitCircle *circle in circles)
+    {
+        Point3f localPt = coordAdapter->getCoordSystem()->geographicToLocal(circle.loc);
+        Point3f dispPt = coordAdapter->localToDisplay(localPt);
+        dispPt += coordAdapter->normalForLocal(localPt) * circle.height;
+
+        BasicDrawableInstance::SingleInstance inst;
+        inst.center = Point3d(dispPt.x(),dispPt.y(),dispPt.z());
+        inst.scale = circle.radius;
+        inst.colorOverride = true;
+        inst.color = (circle.useColor ? circle.color : [shapeInfo.color asRGBAColor]);
+        insts.push_back(inst);
+
+        // Note: Not handling the radius here
+        shapeMbr.addPoint(Point2f(localPt.x(),localPt.y()));
+    }
+    drawInst->addInstances(insts);
+    masterDraw->setLocalMbr(shapeMbr);
+
+    // The master has to show up before the instance does
+    changes.push_back(new AddDrawableReq(masterDraw));
+    changes.push_back(new AddDrawableReq(drawInst));
+    sceneRep->drawIDs.insert(masterDraw->getId());
+    sceneRep->drawIDs.insert(drawInst->getId());
+}
+
+void ShapeManager::buildCylinderInstances(NSArray *cyls,float heightRatio,WhirlyKitShapeInfo *shapeInfo,SelectionManager *selectManager,ShapeSceneRep *sceneRep,ChangeSet &changes)
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+
+    // Unit cylinder sitting on the origin.  The caller checked that
+    //  all the cylinders share this height to radius ratio, since the
+    //  instances only scale uniformly
+    BasicDrawable *masterDraw = new BasicDrawable("Shape Layer Cylinder Master");
+    masterDraw->setType(GL_TRIANGLES);
+    // Only ever drawn through the instances
+    masterDraw->setOnOff(false);
+    masterDraw->setDrawPriority(shapeInfo.drawPriority);
+    masterDraw->setRequestZBuffer(shapeInfo.zBufferRead);
+    masterDraw->setWriteZBuffer(shapeInfo.zBufferWrite);
+
+    // Top cap, as a fan around its center
+    Point3f topNorm(0,0,1);
+    masterDraw->addPoint(Point3f(0,0,heightRatio));
+    masterDraw->addNormal(topNorm);
+    masterDraw->addColor(RGBAColor(255,255,255,255));
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+    {
+        Point3f rimPt(sinf(2*M_PI*ii/(float)CircleSamples),cosf(2*M_PI*ii/(float)CircleSamples),0.0);
+        masterDraw->addPoint(Point3f(rimPt.x(),rimPt.y(),heightRatio));
+        masterDraw->addNormal(topNorm);
+        masterDraw->addColor(RGBAColor(255,255,255,255));
+    }
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+        masterDraw->addTriangle(BasicDrawable::Triangle(0,ii+1,((ii+1)%CircleSamples)+1));
+
+    // Sides, with the normals pointing outward
+    int sideBase = masterDraw->getNumPoints();
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+    {
+        Point3f rimPt(sinf(2*M_PI*ii/(float)CircleSamples),cosf(2*M_PI*ii/(float)CircleSamples),0.0);
+        masterDraw->addPoint(rimPt);
+        masterDraw->addNormal(rimPt);
+        masterDraw->addColor(RGBAColor(255,255,255,255));
+        masterDraw->addPoint(Point3f(rimPt.x(),rimPt.y(),heightRatio));
+        masterDraw->addNormal(rimPt);
+        masterDraw->addColor(RGBAColor(255,255,255,255));
+    }
+    for (unsigned int ii=0;ii<CircleSamples;ii++)
+    {
+        int thisBot = sideBase+2*ii,thisTop = thisBot+1;
+        int nextBot = sideBase+2*((ii+1)%CircleSamples),nextTop = nextBot+1;
+        masterDraw->addTriangle(BasicDrawable::Triangle(thisBot,nextBot,nextTop));
+        masterDraw->addTriangle(BasicDrawable::Triangle(thisBot,nextTop,thisTop));
+    }
+    if (shapeInfo.fade > 0.0)
+    {
+        NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
+        masterDraw->setFade(curTime,curTime+shapeInfo.fade);
+    }
+
+    BasicDrawableInstance *drawInst = new BasicDrawableInstance("Shape Layer Cylinder Instances",masterDraw->getId());
+    drawInst->setProgram(scene->getProgramIDBySceneName(kToolkitDefaultTriangleInstancedProgram));
+    drawInst->setDrawPriority(shapeInfo.drawPriority);
+    drawInst->setVisibleRange(shapeInfo.minVis,shapeInfo.maxVis);
+    drawInst->setEnable(shapeInfo.enable);
+
+    // One instance per cylinder
+    Mbr shapeMbr;
+    std::vector<BasicDrawableInstance::SingleInstance> insts;
+    insts.reserve([cyls count]);
+    for (WhirlyKitCylinder *cyl in cyls)
+    {
+        Point3f localPt = coordAdapter->getCoordSystem()->geographicToLocal(cyl.loc);
+        Point3f dispPt = coordAdapter->localToDisplay(localPt);
+        Point3f norm = coordAdapter->normalForLocal(localPt);
+        dispPt += norm * cyl.baseHeight;
+
+        BasicDrawableInstance::SingleInstance inst;
+        inst.center = Point3d(dispPt.x(),dispPt.y(),dispPt.z());
+        inst.scale = cyl.radius;
+        inst.colorOverride = true;
+        inst.color = (cyl.useColor ? cyl.color : [shapeInfo.color asRGBAColor]);
+        insts.push_back(inst);
+
+        // Note: Not handling the radius here
+        shapeMbr.addPoint(Point2f(localPt.x(),localPt.y()));
+
+        // Add a selection region, same as the unshared path
+        if (cyl.isSelectable)
+        {
+            Point3f xAxis(1,0,0),yAxis(0,1,0);
+            Point3f pts[8];
+            float dist1 = cyl.radius * sqrt2;
+            pts[0] = dispPt - dist1 * xAxis - dist1 * yAxis;
+            pts[1] = dispPt + dist1 * xAxis - dist1 * yAxis;
+            pts[2] = dispPt + dist1 * xAxis + dist1 * yAxis;
+            pts[3] = dispPt - dist1 * xAxis + dist1 * yAxis;
+            pts[4] = pts[0] + cyl.height * norm;
+            pts[5] = pts[1] + cyl.height * norm;
+            pts[6] = pts[2] + cyl.height * norm;
+            pts[7] = pts[3] + cyl.height * norm;
+            selectManager->addSelectableRectSolid(cyl.selectID,pts,shapeInfo.minVis,shapeInfo.maxVis,shapeInfo.enable);
+            sceneRep->selectIDs.insert(cyl.selectID);
+        }
+    }
+    drawInst->addInstances(insts);
+    masterDraw->setLocalMbr(shapeMbr);
+
+    // The master has to show up before the instance does
+    changes.push_back(new AddDrawableReq(masterDraw));
+    changes.push_back(new AddDrawableReq(drawInst));
+    sceneRep->drawIDs.insert(masterDraw->getId());
+    sceneRep->drawIDs.insert(drawInst->getId());
+}
+
 /// Add an array of shapes.  The returned ID can be used to remove or modify the group of shapes.
 SimpleIdentity ShapeManager::addShapes(NSArray *shapes,NSDictionary * desc,ChangeSet &changes)
 {
     WhirlyKitShapeInfo *shapeInfo = [[WhirlyKitShapeInfo alloc] initWithShapes:shapes desc:desc];
     SelectionManager *selectManager = (SelectionManager *)scene->getManager(kWKSelectionManager);
-    
+
     ShapeSceneRep *sceneRep = new ShapeSceneRep(shapeInfo.shapeId);
     sceneRep->fade = shapeInfo.fade;
-    
+
     ShapeDrawableBuilderTri drawBuildTri(scene->getCoordAdapter(),shapeInfo);
     ShapeDrawableBuilder drawBuildReg(scene->getCoordAdapter(),shapeInfo,true);
-    
+
+    // If there are enough of a shape we'll instance a single unit mesh
+    //  rather than building each one.  Not if the caller brought their
+    //  own shader, though, since the instances need ours.
+    NSMutableArray *sphereShapes = nil,*circleShapes = nil,*cylShapes = nil;
+    float cylRatio = 0.0;
+    if (shapeInfo.shaderID == EmptyIdentity &&
+        scene->getProgramIDBySceneName(kToolkitDefaultTriangleInstancedProgram) != EmptyIdentity)
+    {
+        // Circles and cylinders only work on flat maps, where every
+        //  shape faces the same way.  The instances can't carry an
+        //  orientation, just a center and a scale.
+        bool isFlat = scene->getCoordAdapter()->isFlat();
+        // And the cylinders all have to be the same shape, since
+        //  the instances only scale uniformly
+        bool cylsMatch = true;
+        int numSpheres = 0,numCircles = 0,numCyls = 0;
+        for (WhirlyKitShape *shape in shapeInfo.shapes)
+        {
+            if ([shape isKindOfClass:[WhirlyKitSphere class]])
+                numSpheres++;
+            else if (isFlat && [shape isKindOfClass:[WhirlyKitCircle class]])
+                numCircles++;
+            else if (isFlat && [shape isKindOfClass:[WhirlyKitCylinder class]])
+            {
+                WhirlyKitCylinder *cyl = (WhirlyKitCylinder *)shape;
+                float thisRatio = (cyl.radius > 0.0 ? cyl.height / cyl.radius : 0.0);
+                if (numCyls == 0)
+                    cylRatio = thisRatio;
+                else if (thisRatio != cylRatio)
+                    cylsMatch = false;
+                numCyls++;
+            }
+        }
+        if (numSpheres >= ShapeInstanceThreshold)
+            sphereShapes = [NSMutableArray array];
+        if (numCircles >= ShapeInstanceThreshold)
+            circleShapes = [NSMutableArray array];
+        if (numCyls >= ShapeInstanceThreshold && cylsMatch && cylRatio > 0.0)
+            cylShapes = [NSMutableArray array];
+    }
+
     // Work through the shapes
     for (WhirlyKitShape *shape in shapeInfo.shapes)
-        [shape makeGeometryWithBuilder:&drawBuildReg triBuilder:&drawBuildTri scene:scene selectManager:selectManager sceneRep:sceneRep];
-    
+    {
+        if (sphereShapes && [shape isKindOfClass:[WhirlyKitSphere class]])
+            [sphereShapes addObject:shape];
+        else if (circleShapes && [shape isKindOfClass:[WhirlyKitCircle class]])
+            [circleShapes addObject:shape];
+        else if (cylShapes && [shape isKindOfClass:[WhirlyKitCylinder class]])
+            [cylShapes addObject:shape];
+        else
+            [shape makeGeometryWithBuilder:&drawBuildReg triBuilder:&drawBuildTri scene:scene selectManager:selectManager sceneRep:sceneRep];
+    }
+
+    if (sphereShapes)
+        buildSphereInstances(sphereShapes,shapeInfo,selectManager,sceneRep,changes);
+    if (circleShapes)
+        buildCircleInstances(circleShapes,shapeInfo,selectManager,sceneRep,changes);
+    if (cylShapes)
+        buildCylinderInstances(cylShapes,cylRatio,shapeInfo,selectManager,sceneRep,changes);
+
     // Flush out remaining geometry
     drawBuildReg.flush();
     drawBuildReg.getChanges(changes, sceneRep->drawIDs);
@@ -396,7 +737,25 @@ void ShapeManager::enableShapes(SimpleIDSet &shapeIDs,bool enable,ChangeSet &cha
             shapeRep->enableContents(selectManager, enable, changes);
         }
     }
-    
+
+    pthread_mutex_unlock(&shapeLock);
+}
+
+void ShapeManager::getDrawIDs(const SimpleIDSet &shapeIDs,SimpleIDSet &drawIDs)
+{
+    pthread_mutex_lock(&shapeLock);
+
+    for (SimpleIDSet::const_iterator it = shapeIDs.begin(); it != shapeIDs.end();++it)
+    {
+        ShapeSceneRep dummyRep(*it);
+        ShapeSceneRepSet::iterator sit = shapeReps.find(&dummyRep);
+        if (sit != shapeReps.end())
+        {
+            ShapeSceneRep *shapeRep = *sit;
+            drawIDs.insert(shapeRep->drawIDs.begin(),shapeRep->drawIDs.end());
+        }
+    }
+
     pthread_mutex_unlock(&shapeLock);
 }
 
@@ -419,9 +778,7 @@ void ShapeManager::removeShapes(SimpleIDSet &shapeIDs,ChangeSet &changes)
             
             if (shapeRep->fade > 0.0)
             {
-                for (SimpleIDSet::iterator idIt = shapeRep->drawIDs.begin();
-                     idIt != shapeRep->drawIDs.end(); ++idIt)
-                    changes.push_back(new FadeChangeRequest(*idIt, curTime, curTime+shapeRep->fade));
+                changes.push_back(new FadeGangChangeRequest(shapeRep->drawIDs, curTime, curTime+shapeRep->fade));
                 
                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, shapeRep->fade * NSEC_PER_SEC),
                                scene->getDispatchQueue(),
@@ -18,37 +18,154 @@
  *
  */
 
+#import <sys/types.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
+#import <fcntl.h>
+#import <unistd.h>
 #import "ShapeReader.h"
-#import "shapefil.h"
 #import "GlobeMath.h"
 
 namespace WhirlyKit
 {
 
+// Shape types from the shapefile spec
+typedef enum {ShapeFileNull=0, ShapeFilePoint=1, ShapeFileArc=3, ShapeFilePolygon=5, ShapeFileMultiPoint=8,
+              ShapeFilePointZ=11, ShapeFileArcZ=13, ShapeFilePolygonZ=15, ShapeFileMultiPointZ=18} ShapeFileType;
+
+// The .shp format mixes big and little endian fields.
+// Doubles may be unaligned within the map, so we copy them out.
+static inline int BigInt32(const unsigned char *p)
+{ return (p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3]; }
+static inline int LittleInt32(const unsigned char *p)
+{ return p[0]|(p[1]<<8)|(p[2]<<16)|(p[3]<<24); }
+static inline unsigned int LittleUInt16(const unsigned char *p)
+{ return p[0]|(p[1]<<8); }
+static inline double LittleDouble(const unsigned char *p)
+{ double val;  memcpy(&val,p,sizeof(val));  return val; }
+
+bool ShapeReader::mapFile(NSString *fileName,int &fd,const unsigned char *&data,size_t &len)
+{
+    fd = open([fileName cStringUsingEncoding:NSASCIIStringEncoding], O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat statBuf;
+    if (fstat(fd, &statBuf) < 0)
+    {
+        close(fd);  fd = -1;
+        return false;
+    }
+    len = statBuf.st_size;
+    data = (const unsigned char *)mmap(NULL, len, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);  fd = -1;
+        data = NULL;
+        return false;
+    }
+
+    return true;
+}
+
 ShapeReader::ShapeReader(NSString *fileName)
+    : shpFd(-1), dbfFd(-1), shpData(NULL), dbfData(NULL), shpLen(0), dbfLen(0),
+      dbfNumRecords(0), dbfHeaderSize(0), dbfRecordSize(0), where(0), numEntity(0), shapeType(0)
 {
-	const char *cFile =  [fileName cStringUsingEncoding:NSASCIIStringEncoding];
-	shp = SHPOpen(cFile, "rb");
-	if (!shp)
-		return;
-	dbf = DBFOpen(cFile, "rb");
-	where = 0;	
-	SHPGetInfo((SHPInfo *)shp, &numEntity, &shapeType, minBound, maxBound);
+    NSString *base = [fileName stringByDeletingPathExtension];
+
+    // Map the geometry.  We decode the records out of the map on demand
+    if (!mapFile([base stringByAppendingPathExtension:@"shp"], shpFd, shpData, shpLen) || shpLen < 100 ||
+        BigInt32(shpData) != 9994)
+    {
+        if (shpData)
+        {
+            munmap((void *)shpData, shpLen);
+            close(shpFd);
+        }
+        shpData = NULL;  shpFd = -1;
+        return;
+    }
+    shapeType = LittleInt32(shpData+32);
+    minBound[0] = LittleDouble(shpData+36);  minBound[1] = LittleDouble(shpData+44);
+    maxBound[0] = LittleDouble(shpData+52);  maxBound[1] = LittleDouble(shpData+60);
+    minBound[2] = LittleDouble(shpData+68);  maxBound[2] = LittleDouble(shpData+76);
+    minBound[3] = LittleDouble(shpData+84);  maxBound[3] = LittleDouble(shpData+92);
+
+    // The .shx index hands us the record offsets directly.
+    // If it's missing, one quick scan of the record headers does it.
+    int shxFd = -1;
+    const unsigned char *shxData = NULL;
+    size_t shxLen = 0;
+    if (mapFile([base stringByAppendingPathExtension:@"shx"], shxFd, shxData, shxLen) && shxLen >= 100)
+    {
+        numEntity = (int)((shxLen-100)/8);
+        recOffsets.reserve(numEntity);
+        for (int ii=0;ii<numEntity;ii++)
+            recOffsets.push_back(2*(size_t)BigInt32(shxData+100+8*ii));
+    } else {
+        size_t offset = 100;
+        while (offset+8 <= shpLen)
+        {
+            recOffsets.push_back(offset);
+            int contentLen = BigInt32(shpData+offset+4);
+            offset += 8 + 2*(size_t)contentLen;
+        }
+        numEntity = (int)recOffsets.size();
+    }
+    if (shxData)
+    {
+        munmap((void *)shxData, shxLen);
+        close(shxFd);
+    }
+
+    // Attributes.  We only parse the column layout here; the values
+    //  stay in the map until somebody asks for them.
+    if (mapFile([base stringByAppendingPathExtension:@"dbf"], dbfFd, dbfData, dbfLen) && dbfLen >= 32)
+    {
+        dbfNumRecords = LittleInt32(dbfData+4);
+        dbfHeaderSize = LittleUInt16(dbfData+8);
+        dbfRecordSize = LittleUInt16(dbfData+10);
+        int colOffset = 1;  // Past the deletion flag
+        for (size_t fieldPos=32; fieldPos+32 <= dbfHeaderSize && fieldPos+32 <= dbfLen && dbfData[fieldPos] != 0x0d; fieldPos+=32)
+        {
+            DbfColumn col;
+            char name[12];
+            memcpy(name,dbfData+fieldPos,11);  name[11] = 0;
+            col.name = name;
+            col.type = dbfData[fieldPos+11];
+            col.width = dbfData[fieldPos+16];
+            col.decimals = dbfData[fieldPos+17];
+            col.offset = colOffset;
+            colOffset += col.width;
+            dbfColumns.push_back(col);
+        }
+    } else if (dbfData)
+    {
+        munmap((void *)dbfData, dbfLen);
+        close(dbfFd);
+        dbfData = NULL;  dbfFd = -1;
+    }
 }
-	
+
 ShapeReader::~ShapeReader()
 {
-	if (shp)
-		SHPClose((SHPHandle)shp);
-	if (dbf)
-		DBFClose((DBFHandle)dbf);
+	if (shpData)
+    {
+        munmap((void *)shpData, shpLen);
+        close(shpFd);
+    }
+	if (dbfData)
+    {
+        munmap((void *)dbfData, dbfLen);
+        close(dbfFd);
+    }
 }
-	
+
 bool ShapeReader::isValid()
 {
-	return shp != NULL;
+	return shpData != NULL;
 }
-    
+
 unsigned int ShapeReader::getNumObjects()
 {
     return numEntity;
@@ -67,139 +184,176 @@ unsigned int ShapeReader::getNumObjects()
     SHPT_POLYGONM       no
     SHPT_MULTIPOINTM    no
     SHPT_MULTIPATCH     no
- */ 
-    
+ */
+
 // Return a single shape by index
 VectorShapeRef ShapeReader::getObjectByIndex(unsigned int vecIndex,const StringSet *filterAttrs)
 {
-    // Read from disk
-	SHPObject *thisShape = SHPReadObject((SHPInfo *)shp, vecIndex);
-    
+    if (!shpData || vecIndex >= recOffsets.size())
+        return VectorShapeRef();
+
+    // Decode the geometry straight out of the map
+    const unsigned char *rec = shpData+recOffsets[vecIndex];
+    int contentLen = BigInt32(rec+4);
+    if (recOffsets[vecIndex]+8+2*(size_t)contentLen > shpLen)
+        return VectorShapeRef();
+    const unsigned char *content = rec+8;
+    int recType = LittleInt32(content);
+
     VectorShapeRef theShape;
-	
-    switch (shapeType)
+
+    switch (recType)
     {
-        case SHPT_POINT:
-        case SHPT_POINTZ:
+        case ShapeFilePoint:
+        case ShapeFilePointZ:
         {
+            if (2*(size_t)contentLen < 20)
+                return VectorShapeRef();
             VectorPointsRef points = VectorPoints::createPoints();
             theShape = points;
-            Point2f pt(WhirlyKit::DegToRad<float>(thisShape->padfX[0]),WhirlyKit::DegToRad<float>(thisShape->padfY[0]));
+            Point2f pt(WhirlyKit::DegToRad<float>(LittleDouble(content+4)),WhirlyKit::DegToRad<float>(LittleDouble(content+12)));
             points->pts.push_back(pt);
         }
             break;
-        case SHPT_MULTIPOINT:
-        case SHPT_MULTIPOINTZ:
+        case ShapeFileMultiPoint:
+        case ShapeFileMultiPointZ:
         {
+            int numPoints = LittleInt32(content+36);
+            // The counts come out of the record, so don't trust them
+            //  any further than the record's own extent
+            if (numPoints < 0 || 40+16*(size_t)numPoints > 2*(size_t)contentLen)
+                return VectorShapeRef();
             VectorPointsRef points = VectorPoints::createPoints();
             theShape = points;
-            for (unsigned int ii=0;ii<thisShape->nParts;ii++)
+            const unsigned char *ptData = content+40;
+            points->pts.reserve(numPoints);
+            for (int ii=0;ii<numPoints;ii++)
             {
-                Point2f pt(WhirlyKit::DegToRad<float>(thisShape->padfX[ii]),WhirlyKit::DegToRad<float>(thisShape->padfY[ii]));
+                Point2f pt(WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*ii)),WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*ii+8)));
                 points->pts.push_back(pt);
             }
         }
             break;
-        case SHPT_ARC:
-        case SHPT_ARCZ:
+        case ShapeFileArc:
+        case ShapeFileArcZ:
         {
+            int numParts = LittleInt32(content+36);
+            int numPoints = LittleInt32(content+40);
+            if (numParts < 0 || numPoints < 0 ||
+                44+4*(size_t)numParts+16*(size_t)numPoints > 2*(size_t)contentLen)
+                return VectorShapeRef();
             VectorLinearRef linear = VectorLinear::createLinear();
             theShape = linear;
-            for (unsigned int ii=0;ii<thisShape->nVertices;ii++)
+            const unsigned char *ptData = content+44+4*numParts;
+            linear->pts.reserve(numPoints);
+            for (int ii=0;ii<numPoints;ii++)
             {
-                Point2f pt(WhirlyKit::DegToRad<float>(thisShape->padfX[ii]),WhirlyKit::DegToRad<float>(thisShape->padfY[ii]));
+                Point2f pt(WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*ii)),WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*ii+8)));
                 linear->pts.push_back(pt);
-            }            
+            }
         }
             break;
-        case SHPT_POLYGON:
-        case SHPT_POLYGONZ:
+        case ShapeFilePolygon:
+        case ShapeFilePolygonZ:
         {
-            // Copy over vertices (in 2d)
-            bool startOne = true;
+            int numParts = LittleInt32(content+36);
+            int numPoints = LittleInt32(content+40);
+            if (numParts < 0 || numPoints < 0 ||
+                44+4*(size_t)numParts+16*(size_t)numPoints > 2*(size_t)contentLen)
+                return VectorShapeRef();
             VectorArealRef areal = VectorAreal::createAreal();
             theShape = areal;
-            VectorRing *ring = NULL;
-            for (unsigned int jj = 0, iPart = 1; jj < thisShape->nVertices; jj++)
+            const unsigned char *partData = content+44;
+            const unsigned char *ptData = partData+4*numParts;
+            areal->loops.resize(numParts);
+            for (int part=0;part<numParts;part++)
             {
-                // Add rings to the given areal until we're done
-                if ( iPart < thisShape->nParts && thisShape->panPartStart[iPart] == jj)
-                {
-                    iPart++;
-                    startOne = true;
-                }
-                
-                if (startOne)
+                // The part offsets are record data too; keep them in range
+                int start = LittleInt32(partData+4*part);
+                int end = (part+1 < numParts ? LittleInt32(partData+4*(part+1)) : numPoints);
+                if (start < 0)
+                    start = 0;
+                if (start > numPoints)
+                    start = numPoints;
+                if (end < start)
+                    end = start;
+                if (end > numPoints)
+                    end = numPoints;
+                VectorRing &ring = areal->loops[part];
+                ring.reserve(end-start);
+                for (int jj=start;jj<end;jj++)
                 {
-                    areal->loops.resize(areal->loops.size()+1);
-                    ring = &areal->loops.back();
-                    startOne = false;
+                    Point2f pt(WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*jj)),WhirlyKit::DegToRad<float>(LittleDouble(ptData+16*jj+8)));
+                    ring.push_back(pt);
                 }
-                
-                Point2f pt(WhirlyKit::DegToRad<float>(thisShape->padfX[jj]),WhirlyKit::DegToRad<float>(thisShape->padfY[jj]));
-                ring->push_back(pt);
             }
             areal->initGeoMbr();
         }
             break;
+        default:
+            return VectorShapeRef();
     }
-	
-	SHPDestroyObject(thisShape);
-	
-	// Attributes
+
+	// Attributes, decoded out of the map and only for the columns we want
     // Note: Probably not complete
-	char attrTitle[12];
-	int attrWidth, numDecimals;
 	NSMutableDictionary *attrDict = [[NSMutableDictionary alloc] init];
 	theShape->setAttrDict(attrDict);
-	DBFHandle dbfHandle = (DBFHandle)dbf;
-	int numDbfRecord = DBFGetRecordCount(dbfHandle);
-	if (vecIndex < numDbfRecord)
-	{
-		for (unsigned int ii = 0; ii < DBFGetFieldCount(dbfHandle); ii++)
-		{
-			DBFFieldType attrType = DBFGetFieldInfo(dbfHandle, ii, attrTitle, &attrWidth, &numDecimals);
-            // If we have a set of filter attrs, skip this one if it's not there
-            if (filterAttrs && (filterAttrs->find(attrTitle) == filterAttrs->end()))
-                continue;
-			NSString *attrTitleStr = [NSString stringWithFormat:@"%s",attrTitle];
-			
-			if (!DBFIsAttributeNULL(dbfHandle, vecIndex, ii))
-			{
-				switch (attrType)
-				{
-					case FTString:
-					{
-						const char *str = DBFReadStringAttribute(dbfHandle, vecIndex, ii);
-                        NSString *newStr = [NSString stringWithCString:str encoding:NSASCIIStringEncoding];
+    if (dbfData && vecIndex < dbfNumRecords)
+    {
+        const unsigned char *recData = dbfData + dbfHeaderSize + (size_t)vecIndex*dbfRecordSize;
+        if (recData+dbfRecordSize <= dbfData+dbfLen && recData[0] != '*')
+        {
+            for (unsigned int ii = 0; ii < dbfColumns.size(); ii++)
+            {
+                const DbfColumn &col = dbfColumns[ii];
+                // If we have a set of filter attrs, skip this one if it's not there
+                if (filterAttrs && (filterAttrs->find(col.name) == filterAttrs->end()))
+                    continue;
+
+                // Trim the space padding.  All spaces is the DBF version of null
+                const char *start = (const char *)recData+col.offset;
+                int valLen = col.width;
+                while (valLen > 0 && (start[valLen-1] == ' ' || start[valLen-1] == 0))
+                    valLen--;
+                int skip = 0;
+                while (skip < valLen && start[skip] == ' ')
+                    skip++;
+                if (skip == valLen)
+                    continue;
+                std::string valStr(start+skip,start+valLen);
+
+                NSString *attrTitleStr = [NSString stringWithFormat:@"%s",col.name.c_str()];
+                switch (col.type)
+                {
+                    case 'C':
+                    {
+                        NSString *newStr = [NSString stringWithCString:valStr.c_str() encoding:NSASCIIStringEncoding];
                         if (newStr)
                             [attrDict setObject:newStr forKey:attrTitleStr];
-                        //						[attrDict setObject:[NSString stringWithFormat:@"%s",str] forKey:attrTitleStr];
-					}
-						break;
-					case FTInteger:
-					{
-						NSNumber *num = [NSNumber numberWithInt:DBFReadIntegerAttribute(dbfHandle, vecIndex, ii)];
-						[attrDict setObject:num forKey:attrTitleStr];
-					}
-						break;
-					case FTDouble:
-					{
-						NSNumber *num = [NSNumber numberWithDouble:DBFReadDoubleAttribute(dbfHandle, vecIndex, ii)];
-						[attrDict setObject:num forKey:attrTitleStr];
-					}
-						break;
+                    }
+                        break;
+                    case 'N':
+                    case 'F':
+                    {
+                        NSNumber *num;
+                        if (col.type == 'N' && col.decimals == 0)
+                            num = [NSNumber numberWithInt:atoi(valStr.c_str())];
+                        else
+                            num = [NSNumber numberWithDouble:atof(valStr.c_str())];
+                        [attrDict setObject:num forKey:attrTitleStr];
+                    }
+                        break;
                     default:
                         break;
-				}
-			}
-		}
-	}
-    
+                }
+            }
+        }
+    }
+
     // Let the user know what index this is
     [attrDict setObject:[NSNumber numberWithInt:vecIndex] forKey:@"wgshapefileidx"];
-	
-	return theShape;    
+
+	return theShape;
 }
 
 // Return the next shape
@@ -208,11 +362,11 @@ VectorShapeRef ShapeReader::getNextObject(const StringSet *filterAttrs)
 	// Reached the end
 	if (where >= numEntity)
 		return VectorShapeRef();
-    
+
     VectorShapeRef retShape = getObjectByIndex(where, filterAttrs);
     where++;
-    
+
     return retShape;
 }
-	
+
 }
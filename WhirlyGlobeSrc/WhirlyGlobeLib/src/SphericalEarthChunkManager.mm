@@ -116,7 +116,7 @@ static const float SkirtFactor = 0.95;
     //    NSLog(@"Sampling: (%d,%d)",thisSampleX,thisSampleY);
 }
 
-- (void)buildDrawable:(BasicDrawable **)draw skirtDraw:(BasicDrawable **)skirtDraw enabled:(bool)enable adapter:(CoordSystemDisplayAdapter *)coordAdapter
+- (void)appendGeometry:(BasicDrawable *)drawable adapter:(CoordSystemDisplayAdapter *)coordAdapter locs:(std::vector<Point3f> *)retLocs texCoords:(std::vector<TexCoord> *)retTexCoords sampleX:(int *)retSampleX sampleY:(int *)retSampleY
 {
     CoordSystem *localSys = coordAdapter->getCoordSystem();
 
@@ -128,22 +128,13 @@ static const float SkirtFactor = 0.95;
     } else {
         srcSystem = &geoSystem;
     }
-    
-    BasicDrawable *drawable = new BasicDrawable("Spherical Earth Chunk");
-    drawable->setType(GL_TRIANGLES);
-//    drawable->setLocalMbr(_mbr);
-    drawable->setDrawPriority(_drawPriority);
-    drawable->setDrawOffset(_drawOffset);
-    drawable->setTexIDs(_texIDs);
-    drawable->setOnOff(enable);
-    drawable->setVisibleRange(_minVis, _maxVis, _minVisBand, _maxVisBand);
-    drawable->setRequestZBuffer(self.readZBuffer);
-    drawable->setWriteZBuffer(self.writeZBuffer);
-    drawable->setProgram(_programID);
-    
+
+    // We may be appending to a drawable that already has geometry in it
+    int baseVert = drawable->getNumPoints();
+
     int thisSampleX = _sampleX, thisSampleY = _sampleY;
-    
-    Mbr localMbr;
+
+    Mbr localMbr = drawable->getLocalMbr();
     Point3f dispPts[4];
     std::vector<Point2f> pts;
     _mbr.asPoints(pts);
@@ -238,25 +229,55 @@ static const float SkirtFactor = 0.95;
             }
     }
     drawable->setLocalMbr(localMbr);
-    
+
     // Two triangles per cell
     for (unsigned int iy=0;iy<thisSampleY;iy++)
     {
         for (unsigned int ix=0;ix<thisSampleX;ix++)
         {
             BasicDrawable::Triangle triA,triB;
-            triA.verts[0] = (iy+1)*(thisSampleX+1)+ix;
-            triA.verts[1] = iy*(thisSampleX+1)+ix;
-            triA.verts[2] = (iy+1)*(thisSampleX+1)+(ix+1);
+            triA.verts[0] = baseVert+(iy+1)*(thisSampleX+1)+ix;
+            triA.verts[1] = baseVert+iy*(thisSampleX+1)+ix;
+            triA.verts[2] = baseVert+(iy+1)*(thisSampleX+1)+(ix+1);
             triB.verts[0] = triA.verts[2];
             triB.verts[1] = triA.verts[1];
-            triB.verts[2] = iy*(thisSampleX+1)+(ix+1);
+            triB.verts[2] = baseVert+iy*(thisSampleX+1)+(ix+1);
             drawable->addTriangle(triA);
             drawable->addTriangle(triB);
         }
     }
+
+    if (retLocs)
+        *retLocs = locs;
+    if (retTexCoords)
+        *retTexCoords = texCoords;
+    if (retSampleX)
+        *retSampleX = thisSampleX;
+    if (retSampleY)
+        *retSampleY = thisSampleY;
+}
+
+- (void)buildDrawable:(BasicDrawable **)draw skirtDraw:(BasicDrawable **)skirtDraw enabled:(bool)enable adapter:(CoordSystemDisplayAdapter *)coordAdapter
+{
+    BasicDrawable *drawable = new BasicDrawable("Spherical Earth Chunk");
+    drawable->setType(GL_TRIANGLES);
+//    drawable->setLocalMbr(_mbr);
+    drawable->setDrawPriority(_drawPriority);
+    drawable->setDrawOffset(_drawOffset);
+    drawable->setTexIDs(_texIDs);
+    drawable->setOnOff(enable);
+    drawable->setVisibleRange(_minVis, _maxVis, _minVisBand, _maxVisBand);
+    drawable->setRequestZBuffer(self.readZBuffer);
+    drawable->setWriteZBuffer(self.writeZBuffer);
+    drawable->setProgram(_programID);
+    drawable->setCompactVertexFormat();
+
+    std::vector<Point3f> locs;
+    std::vector<TexCoord> texCoords;
+    int thisSampleX,thisSampleY;
+    [self appendGeometry:drawable adapter:coordAdapter locs:&locs texCoords:&texCoords sampleX:&thisSampleX sampleY:&thisSampleY];
     *draw = drawable;
-    
+
     // Build the skirts
     if (skirtDraw && !coordAdapter->isFlat())
     {
@@ -271,7 +292,8 @@ static const float SkirtFactor = 0.95;
         skirtDrawable->setRequestZBuffer(true);
         skirtDrawable->setWriteZBuffer(false);
         skirtDrawable->setProgram(_programID);
-        
+        skirtDrawable->setCompactVertexFormat();
+
         // Bottom skirt
         std::vector<Point3f> skirtLocs;
         std::vector<TexCoord> skirtTexCoords;
@@ -436,6 +458,88 @@ SimpleIdentity SphericalChunkManager::addChunk(WhirlyKitSphericalChunk *chunk,bo
     return chunkID;
 }
     
+/// Bake a static group of chunks down into consolidated drawables
+SimpleIdentity SphericalChunkManager::bakeChunks(NSArray *chunks,bool enable,ChangeSet &changes)
+{
+    CoordSystemDisplayAdapter *coordAdapter = scene->getCoordAdapter();
+    ChunkSceneRepRef chunkRep(new ChunkSceneRep(Identifiable::genId()));
+    chunkRep->usesAtlas = false;
+
+    // One active drawable per texture.  Chunks that share a texture
+    //  merge their geometry; the rest at least share the scene rep.
+    std::map<SimpleIdentity,BasicDrawable *> drawables;
+    for (WhirlyKitSphericalChunk *chunk in chunks)
+    {
+        // Set up a plain texture.  We stay away from the atlases here
+        //  so the scene snapshot can capture the results.
+        SimpleIdentity texId = EmptyIdentity;
+        if (chunk.loadImage)
+        {
+            // Let's just deal with square images
+            int square = std::max(chunk.loadImage.width,chunk.loadImage.height);
+            Texture *newTex = [chunk.loadImage buildTexture:borderTexel destWidth:square destHeight:square];
+            if (newTex)
+            {
+                texId = newTex->getId();
+                chunkRep->texIDs.insert(texId);
+                changes.push_back(new AddTextureReq(newTex));
+            }
+        } else if (!chunk.texIDs.empty())
+            texId = chunk.texIDs.at(0);
+
+        BasicDrawable *drawable = NULL;
+        std::map<SimpleIdentity,BasicDrawable *>::iterator it = drawables.find(texId);
+        if (it != drawables.end())
+            drawable = it->second;
+
+        // Flush a drawable that's about to overflow
+        if (drawable && drawable->getNumPoints() + (chunk.sampleX+1)*(chunk.sampleY+1) > MaxDrawablePoints)
+        {
+            chunkRep->drawIDs.insert(drawable->getId());
+            changes.push_back(new AddDrawableReq(drawable));
+            drawables.erase(it);
+            drawable = NULL;
+        }
+
+        if (!drawable)
+        {
+            drawable = new BasicDrawable("Spherical Earth Chunk Baked");
+            drawable->setType(GL_TRIANGLES);
+            drawable->setDrawPriority(chunk.drawPriority);
+            drawable->setDrawOffset(chunk.drawOffset);
+            drawable->setTexId(0,texId);
+            drawable->setOnOff(enable);
+            drawable->setVisibleRange(chunk.minVis, chunk.maxVis, chunk.minVisBand, chunk.maxVisBand);
+            drawable->setRequestZBuffer(chunk.readZBuffer);
+            drawable->setWriteZBuffer(chunk.writeZBuffer);
+            drawable->setProgram(chunk.programID);
+            drawable->setCompactVertexFormat();
+            drawables[texId] = drawable;
+        }
+
+        [chunk appendGeometry:drawable adapter:coordAdapter locs:NULL texCoords:NULL sampleX:NULL sampleY:NULL];
+    }
+
+    // Toss whatever's left over to the scene
+    for (std::map<SimpleIdentity,BasicDrawable *>::iterator it = drawables.begin();
+         it != drawables.end(); ++it)
+    {
+        BasicDrawable *drawable = it->second;
+        if (drawable->getNumPoints() > 0)
+        {
+            chunkRep->drawIDs.insert(drawable->getId());
+            changes.push_back(new AddDrawableReq(drawable));
+        } else
+            delete drawable;
+    }
+
+    pthread_mutex_lock(&repLock);
+    chunkReps.insert(chunkRep);
+    pthread_mutex_unlock(&repLock);
+
+    return chunkRep->getId();
+}
+
 bool SphericalChunkManager::modifyChunkTextures(SimpleIdentity chunkID,const std::vector<SimpleIdentity> &texIDs,ChangeSet &changes)
 {
     SimpleIDSet drawIDs;
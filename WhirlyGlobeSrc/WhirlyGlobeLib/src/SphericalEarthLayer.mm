@@ -19,6 +19,7 @@
  */
 
 #import <UIKit/UIKit.h>
+#import <unistd.h>
 #import "SphericalEarthLayer.h"
 #import "UIImage+Stuff.h"
 #import "GlobeMath.h"
@@ -26,6 +27,18 @@
 using namespace WhirlyKit;
 using namespace WhirlyGlobe;
 
+// Per chunk record in the compiled texture cache index
+typedef struct
+{
+    int offset;
+    int length;
+    int width;
+    int height;
+} CompiledChunkRecord;
+
+// 'WGTG', version, numX, numY, pixelsSquare, format, pvrtc flag
+static const unsigned int CompiledHeaderSize = 4+6*sizeof(int);
+
 @implementation WhirlyGlobeSphericalEarthLayer
 {
     WhirlyKitLayerThread * __weak layerThread;
@@ -35,6 +48,16 @@ using namespace WhirlyGlobe;
 	unsigned int chunkX,chunkY;
     std::vector<WhirlyKit::SimpleIdentity> texIDs;
     std::vector<WhirlyKit::SimpleIdentity> drawIDs;
+    // Compiled texture cache, if we were given a name for one
+    NSString *cacheName;
+    NSString *compilePath,*compileTmpPath;
+    // Mapped compiled file we're reading textures out of
+    NSData *compiledData;
+    int compiledFormat;
+    bool compiledIsPVRTC;
+    // File and index for the compiled form we're writing
+    FILE *compileFp;
+    std::vector<CompiledChunkRecord> compileIndex;
 }
 
 - (id)initWithTexGroup:(WhirlyKitTextureGroup *)inTexGroup
@@ -51,8 +74,10 @@ using namespace WhirlyGlobe;
 		yDim = texGroup.numY;
         _fade = 0.0;
         _drawPriority = 0;
+        cacheName = inCacheName;
+        compileFp = NULL;
 	}
-	
+
 	return self;
 }
 
@@ -60,7 +85,10 @@ using namespace WhirlyGlobe;
 {
     texIDs.clear();
     drawIDs.clear();
-    
+
+    [self abandonCompiledCache];
+    compiledData = nil;
+
     scene = NULL;
 }
 
@@ -69,12 +97,101 @@ using namespace WhirlyGlobe;
     [self clear];
 }
 
+// Try to map an existing compiled texture file and check it against our group
+- (bool)openCompiledCache:(NSString *)path
+{
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+    unsigned int indexLen = CompiledHeaderSize + sizeof(CompiledChunkRecord)*xDim*yDim;
+    if (!data || [data length] < indexLen)
+        return false;
+    const unsigned char *bytes = (const unsigned char *)[data bytes];
+    if (memcmp(bytes,"WGTG",4))
+        return false;
+    const int *fields = (const int *)(bytes+4);
+    if (fields[0] != 1 || fields[1] != xDim || fields[2] != yDim || fields[3] != texGroup.pixelsSquare)
+        return false;
+    compiledFormat = fields[4];
+    compiledIsPVRTC = (fields[5] != 0);
+
+    // Make sure the chunk records stay within the file
+    const CompiledChunkRecord *recs = (const CompiledChunkRecord *)(bytes+CompiledHeaderSize);
+    for (unsigned int ii=0;ii<xDim*yDim;ii++)
+        if (recs[ii].offset < indexLen || recs[ii].length <= 0 ||
+            recs[ii].offset + recs[ii].length > [data length])
+            return false;
+
+    compiledData = data;
+    return true;
+}
+
+// Header and space for the index, which gets patched in at the end
+- (void)writeCompiledHeader
+{
+    fwrite("WGTG",4,1,compileFp);
+    int fields[6];
+    fields[0] = 1;
+    fields[1] = xDim;  fields[2] = yDim;
+    fields[3] = texGroup.pixelsSquare;
+    fields[4] = GL_UNSIGNED_BYTE;
+    fields[5] = ([texGroup.ext isEqualToString:@"pvrtc"] ? 1 : 0);
+    fwrite(fields,sizeof(fields),1,compileFp);
+    std::vector<CompiledChunkRecord> zeroRecs(xDim*yDim);
+    memset(&zeroRecs[0],0,sizeof(CompiledChunkRecord)*zeroRecs.size());
+    fwrite(&zeroRecs[0],sizeof(CompiledChunkRecord)*zeroRecs.size(),1,compileFp);
+}
+
+// Something went wrong mid-write.  Toss the partial file.
+- (void)abandonCompiledCache
+{
+    if (!compileFp)
+        return;
+    fclose(compileFp);
+    compileFp = NULL;
+    unlink([compileTmpPath cStringUsingEncoding:NSASCIIStringEncoding]);
+}
+
+// All the chunks made it out.  Patch the index and move it into place.
+- (void)finishCompiledCache
+{
+    if (!compileFp)
+        return;
+    if (compileIndex.size() != xDim*yDim)
+    {
+        [self abandonCompiledCache];
+        return;
+    }
+    fseek(compileFp,CompiledHeaderSize,SEEK_SET);
+    bool good = (fwrite(&compileIndex[0],sizeof(CompiledChunkRecord)*compileIndex.size(),1,compileFp) == 1);
+    fclose(compileFp);
+    compileFp = NULL;
+    if (good)
+        rename([compileTmpPath cStringUsingEncoding:NSASCIIStringEncoding],
+               [compilePath cStringUsingEncoding:NSASCIIStringEncoding]);
+    else
+        unlink([compileTmpPath cStringUsingEncoding:NSASCIIStringEncoding]);
+}
+
 // Set up the next chunk to build and schedule it
 - (void)startWithThread:(WhirlyKitLayerThread *)inLayerThread scene:(Scene *)inScene
 {
-    layerThread = inLayerThread;	
+    layerThread = inLayerThread;
     scene = (WhirlyGlobe::GlobeScene *)inScene;
 	chunkX = chunkY = 0;
+
+    // Look for the compiled form of the texture group, or set up to build it
+    if (cacheName)
+    {
+        NSString *cacheDir = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) objectAtIndex:0];
+        compilePath = [cacheDir stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.wgtg",cacheName]];
+        if (![self openCompiledCache:compilePath])
+        {
+            compileTmpPath = [compilePath stringByAppendingString:@"_tmp"];
+            compileFp = fopen([compileTmpPath cStringUsingEncoding:NSASCIIStringEncoding],"wb");
+            if (compileFp)
+                [self writeCompiledHeader];
+        }
+    }
+
 	[self performSelector:@selector(startProcess:) withObject:nil];
 }
 
@@ -180,9 +297,42 @@ using namespace WhirlyGlobe;
 	ChangeSet changeRequests;
 	
 	// Ask for a new texture and wire it to the drawable
-	Texture *tex = new Texture("Spherical Earth Layer",[texGroup generateFileNameX:chunkX y:chunkY],texGroup.ext);
-    tex->setWidth(texGroup.pixelsSquare);
-    tex->setHeight(texGroup.pixelsSquare);
+    Texture *tex = NULL;
+    if (compiledData)
+    {
+        // Feed the GPU from the mapped compiled file.  We hang on to the
+        //  mapping until shutdown, so the upload can read straight out of it.
+        const unsigned char *bytes = (const unsigned char *)[compiledData bytes];
+        const CompiledChunkRecord *rec = (const CompiledChunkRecord *)(bytes+CompiledHeaderSize) + (chunkY*xDim+chunkX);
+        NSData *chunkData = [NSData dataWithBytesNoCopy:(void *)(bytes+rec->offset) length:rec->length freeWhenDone:NO];
+        tex = new Texture("Spherical Earth Layer",chunkData,compiledIsPVRTC);
+        tex->setWidth(rec->width);
+        tex->setHeight(rec->height);
+        if (!compiledIsPVRTC)
+        {
+            tex->setFormat(compiledFormat);
+            tex->setIsConverted();
+        }
+    } else {
+        tex = new Texture("Spherical Earth Layer",[texGroup generateFileNameX:chunkX y:chunkY],texGroup.ext);
+        tex->setWidth(texGroup.pixelsSquare);
+        tex->setHeight(texGroup.pixelsSquare);
+
+        // Write the upload-ready bytes into the compiled file as we go
+        if (compileFp)
+        {
+            NSData *outData = tex->processData();
+            CompiledChunkRecord rec;
+            rec.offset = (int)ftell(compileFp);
+            rec.length = (outData ? (int)[outData length] : 0);
+            rec.width = tex->getWidth();
+            rec.height = tex->getHeight();
+            if (outData && fwrite([outData bytes],[outData length],1,compileFp) == 1)
+                compileIndex.push_back(rec);
+            else
+                [self abandonCompiledCache];
+        }
+    }
 	changeRequests.push_back(new AddTextureReq(tex));
     texIDs.push_back(tex->getId());
 	chunk->setTexId(0,tex->getId());
@@ -211,6 +361,9 @@ using namespace WhirlyGlobe;
 	if (chunkY < yDim) {
 		[self performSelector:@selector(process:) withObject:nil afterDelay:0.0];
 	} else {
+        // Last chunk, so the compiled file is complete
+        [self finishCompiledCache];
+
         // If we're done, have the renderer send out a notification.
         // Odds are it's still processing the data right now
         [layerThread addChangeRequest:(new NotificationReq(kWhirlyGlobeSphericalEarthLoaded,self))];
@@ -106,6 +106,57 @@ Point3d SphericalMercatorCoordSystem::geocentricToLocal(Point3d geocPt)
     return Point3d(localPt.x(),localPt.y(),geoCoordPlus.z());
 }
     
+void SphericalMercatorCoordSystem::localToGeographic(const Point3f *inPts,GeoCoord *outCoords,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        outCoords[ii].lon() = inPts[ii].x() + originLon;
+        outCoords[ii].lat() = atanf(sinhf(inPts[ii].y()));
+    }
+}
+
+void SphericalMercatorCoordSystem::geographicToLocal(const GeoCoord *inCoords,Point3f *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        float lat = inCoords[ii].lat();
+        if (lat < -PoleLimit) lat = -PoleLimit;
+        if (lat > PoleLimit) lat = PoleLimit;
+        outPts[ii] = Point3f(inCoords[ii].lon() - originLon,logf((1.0f+sinf(lat))/cosf(lat)),0.0);
+    }
+}
+
+void SphericalMercatorCoordSystem::geographicToLocal(const GeoCoord *inCoords,Point3d *outPts,unsigned int numPts)
+{
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        float lat = inCoords[ii].lat();
+        if (lat < -PoleLimit) lat = -PoleLimit;
+        if (lat > PoleLimit) lat = PoleLimit;
+        outPts[ii] = Point3d(inCoords[ii].lon() - originLon,log((1.0f+sin(lat))/cos(lat)),0.0);
+    }
+}
+
+void SphericalMercatorCoordSystem::localToGeocentric(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    // Inverse projection first, then one transform for the whole array
+    for (unsigned int ii=0;ii<numPts;ii++)
+        outPts[ii] = Point3f(inPts[ii].x() + originLon,atanf(sinhf(inPts[ii].y())),inPts[ii].z());
+    GeoCoordSystem::LocalToGeocentric(outPts,outPts,numPts);
+}
+
+void SphericalMercatorCoordSystem::geocentricToLocal(const Point3f *inPts,Point3f *outPts,unsigned int numPts)
+{
+    GeoCoordSystem::GeocentricToLocal(inPts,outPts,numPts);
+    for (unsigned int ii=0;ii<numPts;ii++)
+    {
+        float lat = outPts[ii].y();
+        if (lat < -PoleLimit) lat = -PoleLimit;
+        if (lat > PoleLimit) lat = PoleLimit;
+        outPts[ii] = Point3f(outPts[ii].x() - originLon,logf((1.0f+sinf(lat))/cosf(lat)),outPts[ii].z());
+    }
+}
+
 bool SphericalMercatorCoordSystem::isSameAs(CoordSystem *coordSys)
 {
     SphericalMercatorCoordSystem *other = dynamic_cast<SphericalMercatorCoordSystem *>(coordSys);
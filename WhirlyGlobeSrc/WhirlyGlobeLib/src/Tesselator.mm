@@ -8,6 +8,7 @@
 
 #import <list>
 #import "Tesselator.h"
+#import "GridClipper.h"
 #import "glues.h"
 
 using namespace Eigen;
@@ -178,4 +179,167 @@ void TesselateLoops(const std::vector<VectorRing> &loops,VectorTrianglesRef tris
     }
 }
 
+void AppendTriMesh(const VectorTrianglesRef &src,VectorTrianglesRef &dest)
+{
+    int basePt = (int)dest->pts.size();
+    dest->pts.insert(dest->pts.end(),src->pts.begin(),src->pts.end());
+    for (unsigned int ii=0;ii<src->tris.size();ii++)
+    {
+        VectorTriangles::Triangle tri = src->tris[ii];
+        for (unsigned int jj=0;jj<3;jj++)
+            tri.pts[jj] += basePt;
+        dest->tris.push_back(tri);
+    }
+}
+
+static const long long TessCacheSize = 16*1024*1024;
+
+TessellationCache::TessellationCache(long long maxBytes)
+    : maxBytes(maxBytes), usedBytes(0)
+{
+    pthread_mutex_init(&lock,NULL);
+}
+
+TessellationCache::~TessellationCache()
+{
+    pthread_mutex_destroy(&lock);
+}
+
+TessellationCache *TessellationCache::getShared()
+{
+    static TessellationCache *shared = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken,
+    ^{
+        shared = new TessellationCache(TessCacheSize);
+    });
+    return shared;
+}
+
+// Plain FNV-1a, folded a byte at a time
+static unsigned long long HashBytes(unsigned long long hash,const void *bytes,size_t len)
+{
+    const unsigned char *data = (const unsigned char *)bytes;
+    for (size_t ii=0;ii<len;ii++)
+    {
+        hash ^= data[ii];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+long long TessellationCache::hashSeed()
+{
+    return (long long)14695981039346656037ULL;
+}
+
+long long TessellationCache::hashRing(long long hash,const VectorRing &ring)
+{
+    unsigned int numPts = (unsigned int)ring.size();
+    hash = (long long)HashBytes((unsigned long long)hash,&numPts,sizeof(numPts));
+    if (numPts > 0)
+        hash = (long long)HashBytes((unsigned long long)hash,&ring[0],numPts*sizeof(Point2f));
+    return hash;
+}
+
+long long TessellationCache::hashFloat(long long hash,float val)
+{
+    return (long long)HashBytes((unsigned long long)hash,&val,sizeof(val));
+}
+
+VectorTrianglesRef TessellationCache::get(long long key)
+{
+    VectorTrianglesRef ret;
+
+    pthread_mutex_lock(&lock);
+    std::map<long long,std::list<CacheEntry>::iterator>::iterator it = entryMap.find(key);
+    if (it != entryMap.end())
+    {
+        entries.splice(entries.begin(),entries,it->second);
+        ret = it->second->tris;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
+
+void TessellationCache::add(long long key,VectorTrianglesRef tris)
+{
+    if (!tris.get())
+        return;
+    long long cost = tris->pts.size()*sizeof(Point3f) + tris->tris.size()*sizeof(VectorTriangles::Triangle);
+
+    pthread_mutex_lock(&lock);
+    if (entryMap.find(key) == entryMap.end())
+    {
+        CacheEntry entry;
+        entry.key = key;
+        entry.cost = cost;
+        entry.tris = tris;
+        entries.push_front(entry);
+        entryMap[key] = entries.begin();
+        usedBytes += cost;
+
+        // Toss the stalest meshes when we're over budget
+        while (usedBytes > maxBytes && !entries.empty())
+        {
+            CacheEntry &oldEntry = entries.back();
+            usedBytes -= oldEntry.cost;
+            entryMap.erase(oldEntry.key);
+            entries.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void TesselateAreals(const std::vector<VectorArealRef> &areals,float gridEps)
+{
+    if (areals.empty())
+        return;
+
+    size_t numAreals = areals.size();
+    size_t numWorkers = [[NSProcessInfo processInfo] processorCount];
+    if (numWorkers > numAreals)
+        numWorkers = numAreals;
+
+    // Blocks want PODs, not references
+    const VectorArealRef *arealPtr = &areals[0];
+
+    // Each worker strides through the batch, keeping its scratch buffers
+    //  warm across features.  Shapes are distinct, so nobody shares a
+    //  cachedTess slot and there's nothing to lock.
+    dispatch_apply(numWorkers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+    ^(size_t worker)
+    {
+        std::vector<VectorRing> inRings;
+        for (size_t ii=worker;ii<numAreals;ii+=numWorkers)
+        {
+            VectorAreal *areal = arealPtr[ii].get();
+            if (areal->loops.empty())
+                continue;
+            if (areal->cachedTess && areal->cachedTessEps == gridEps)
+                continue;
+
+            // Someone may have tessellated this very geometry before
+            long long tessKey = TessellationCache::hashFloat(TessellationCache::hashRing(TessellationCache::hashSeed(),areal->loops[0]),gridEps);
+            VectorTrianglesRef mesh = TessellationCache::getShared()->get(tessKey);
+            if (!mesh.get())
+            {
+                inRings.clear();
+                if (gridEps > 0.0)
+                    ClipLoopToGrid(areal->loops[0],Point2f(0.0,0.0),Point2f(gridEps,gridEps),inRings);
+                else
+                    inRings.push_back(areal->loops[0]);
+                mesh = VectorTriangles::createTriangles();
+                for (unsigned int jj=0;jj<inRings.size();jj++)
+                    TesselateRing(inRings[jj],mesh);
+                TessellationCache::getShared()->add(tessKey,mesh);
+            }
+
+            areal->cachedTess = mesh;
+            areal->cachedTessEps = gridEps;
+        }
+    });
+}
+
 }
@@ -21,6 +21,7 @@
 #import "GLUtils.h"
 #import "Texture.h"
 #import "UIImage+Stuff.h"
+#import "SceneSnapshot.h"
 
 using namespace WhirlyKit;
 
@@ -131,19 +132,19 @@ namespace WhirlyKit
 {
 	
 Texture::Texture(const std::string &name)
-	: TextureBase(name), texData(NULL), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), byteSource(WKSingleRGB)
+	: TextureBase(name), texData(NULL), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), converted(false), byteSource(WKSingleRGB), trackedMemSize(0)
 {
 }
 	
 // Construct with raw texture data
 Texture::Texture(const std::string &name,NSData *texData,bool isPVRTC)
-	: TextureBase(name), texData(texData), isPVRTC(isPVRTC), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), byteSource(WKSingleRGB)
+	: TextureBase(name), texData(texData), isPVRTC(isPVRTC), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), converted(false), byteSource(WKSingleRGB), trackedMemSize(0)
 { 
 }
 
 // Set up the texture from a filename
 Texture::Texture(const std::string &name,NSString *baseName,NSString *ext)
-    : TextureBase(name), texData(nil), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), byteSource(WKSingleRGB)
+    : TextureBase(name), texData(nil), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), converted(false), byteSource(WKSingleRGB), trackedMemSize(0)
 {	
 	if (![ext compare:@"pvrtc"])
 	{
@@ -176,7 +177,7 @@ Texture::Texture(const std::string &name,NSString *baseName,NSString *ext)
 
 // Construct with a UIImage
 Texture::Texture(const std::string &name,UIImage *inImage,bool roundUp)
-    : TextureBase(name), texData(nil), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), byteSource(WKSingleRGB)
+    : TextureBase(name), texData(nil), isPVRTC(false), isPKM(false), usesMipmaps(false), wrapU(false), wrapV(false), format(GL_UNSIGNED_BYTE), converted(false), byteSource(WKSingleRGB), trackedMemSize(0)
 {
 	texData = [inImage rawDataRetWidth:&width height:&height roundUp:roundUp];
 }
@@ -188,6 +189,10 @@ Texture::~Texture()
 
 NSData *Texture::processData()
 {
+    // Someone already did the conversion for us
+    if (converted)
+        return texData;
+
 	if (isPVRTC || isPKM)
 	{
         return texData;
@@ -221,6 +226,20 @@ NSData *Texture::processData()
     return nil;
 }
     
+// Same conversion the upload would do, just on the caller's thread
+void Texture::convertForUpload()
+{
+    if (converted || isPVRTC || isPKM || !texData)
+        return;
+
+    NSData *newData = processData();
+    if (newData)
+    {
+        texData = newData;
+        converted = true;
+    }
+}
+
 void Texture::setPKMData(NSData *inData)
 {
     texData = inData;
@@ -300,8 +319,14 @@ bool Texture::createInGL(OpenGLMemManager *memManager)
 	if (glId)
         return true;
 	
-	// Allocate a texture and set up the various params
-    glId = memManager->getTexID();
+	// Allocate a texture and set up the various params.
+	// A recycled texture with matching storage makes the upload below
+	//  an in place respecify instead of an allocation.
+	// Compressed formats specify their size differently, so they skip it.
+    if (!isPVRTC && !isPKM)
+        glId = memManager->getRecycledTexID(width,height,format);
+    if (!glId)
+        glId = memManager->getTexID();
     CheckGLError("Texture::createInGL() glGenTextures()");
 
 	glBindTexture(GL_TEXTURE_2D, glId);
@@ -366,18 +391,156 @@ bool Texture::createInGL(OpenGLMemManager *memManager)
     
     if (usesMipmaps)
         glGenerateMipmap(GL_TEXTURE_2D);
-	
+
+    // Report what we just put on the GPU to the memory census
+    trackedMemSize = [convertedData length];
+    memManager->addTrackedMem(WKMemTexture,trackedMemSize);
+
     // Once we've moved it over to OpenGL, let's get rid of this copy
     texData = nil;
-	
+
 	return true;
 }
 
+bool Texture::snapshotWrite(NSMutableData *data) const
+{
+    // Once it's in GL the bits are gone
+    if (!texData)
+        return false;
+
+    SnapshotAppendString(data, name);
+    unsigned int uiVal = width;
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    uiVal = height;
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    uiVal = format;
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    unsigned char flags[6] = {isPVRTC,isPKM,converted,usesMipmaps,wrapU,wrapV};
+    SnapshotAppend(data, flags, sizeof(flags));
+    int iVal = byteSource;
+    SnapshotAppend(data, &iVal, sizeof(iVal));
+    uiVal = (unsigned int)[texData length];
+    SnapshotAppend(data, &uiVal, sizeof(uiVal));
+    SnapshotAppend(data, [texData bytes], [texData length]);
+
+    return true;
+}
+
+bool Texture::snapshotRead(const unsigned char *&ptr,const unsigned char *end)
+{
+    if (!SnapshotReadString(ptr, end, name))
+        return false;
+    unsigned int uiVal;
+    if (!SnapshotRead(ptr, end, &uiVal, sizeof(uiVal)))
+        return false;
+    width = uiVal;
+    if (!SnapshotRead(ptr, end, &uiVal, sizeof(uiVal)))
+        return false;
+    height = uiVal;
+    if (!SnapshotRead(ptr, end, &uiVal, sizeof(uiVal)))
+        return false;
+    format = uiVal;
+    unsigned char flags[6];
+    if (!SnapshotRead(ptr, end, flags, sizeof(flags)))
+        return false;
+    isPVRTC = flags[0];  isPKM = flags[1];  converted = flags[2];
+    usesMipmaps = flags[3];  wrapU = flags[4];  wrapV = flags[5];
+    int iVal;
+    if (!SnapshotRead(ptr, end, &iVal, sizeof(iVal)))
+        return false;
+    byteSource = (WKSingleByteSource)iVal;
+    unsigned int dataLen;
+    if (!SnapshotRead(ptr, end, &dataLen, sizeof(dataLen)))
+        return false;
+    if (ptr + dataLen > end)
+        return false;
+    // Copy rather than point into the mapped file, since the upload
+    //  can happen after the snapshot goes away
+    texData = [NSData dataWithBytes:ptr length:dataLen];
+    ptr += dataLen;
+
+    return true;
+}
+
+// Respecify the image data over the existing GL storage.
+// The texture keeps its ID, so every drawable pointing at it just picks
+//  the new image up.  No reallocation, no retexture requests.
+bool Texture::updateInGL(NSData *newData)
+{
+    // The compressed formats would need a full reallocation
+    if (!glId || !newData || isPVRTC || isPKM || format == GL_COMPRESSED_RGB8_ETC2)
+        return false;
+
+    // Run the new data through the usual format conversion
+    texData = newData;
+    converted = false;
+    NSData *convertedData = processData();
+    texData = nil;
+    if (!convertedData)
+        return false;
+
+    // Make sure the new image is really the size we allocated for
+    size_t pixelSize = 4;
+    switch (format)
+    {
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            pixelSize = 2;
+            break;
+        case GL_ALPHA:
+            pixelSize = 1;
+            break;
+        default:
+            break;
+    }
+    if ([convertedData length] != width*height*pixelSize)
+        return false;
+
+    glBindTexture(GL_TEXTURE_2D, glId);
+    CheckGLError("Texture::updateInGL() glBindTexture()");
+
+    switch (format)
+    {
+        case GL_UNSIGNED_BYTE:
+        default:
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, [convertedData bytes]);
+            break;
+        case GL_UNSIGNED_SHORT_5_6_5:
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, [convertedData bytes]);
+            break;
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, [convertedData bytes]);
+            break;
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, [convertedData bytes]);
+            break;
+        case GL_ALPHA:
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_ALPHA, GL_UNSIGNED_BYTE, [convertedData bytes]);
+            break;
+    }
+    CheckGLError("Texture::updateInGL() glTexSubImage2D()");
+
+    if (usesMipmaps)
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return true;
+}
+
 // Release the OpenGL texture
 void Texture::destroyInGL(OpenGLMemManager *memManager)
 {
 	if (glId)
-        memManager->removeTexID(glId);
+    {
+        if (isPVRTC || isPKM)
+            memManager->removeTexID(glId);
+        else
+            memManager->recycleTexID(glId,width,height,format);
+        memManager->subTrackedMem(WKMemTexture,trackedMemSize);
+        trackedMemSize = 0;
+    }
 }
 
 }
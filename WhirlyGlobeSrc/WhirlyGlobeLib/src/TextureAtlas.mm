@@ -33,6 +33,19 @@ void SubTexture::setFromTex(const TexCoord &texOrg,const TexCoord &texDest)
     trans.scale(Point2f(texDest.x()-texOrg.x(),texDest.y()-texOrg.y()));
 }
 
+SubTexture SubTexture::subTextureForRegion(const TexCoord &org,const TexCoord &span) const
+{
+    SubTexture regionTex;
+    regionTex.texId = texId;
+    // Compose our transform with the region, so [0,1] in the result
+    //  addresses just that piece of whatever we point at
+    regionTex.trans = trans;
+    regionTex.trans.translate(org);
+    regionTex.trans.scale(span);
+
+    return regionTex;
+}
+
 // Calculate a destination texture coordinate
 TexCoord SubTexture::processTexCoord(const TexCoord &inCoord)
 {
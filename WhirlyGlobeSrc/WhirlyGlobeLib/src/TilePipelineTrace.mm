@@ -0,0 +1,296 @@
+/*
+ *  TilePipelineTrace.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 10/20/12.
+ *  Copyright 2011-2013 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import "TilePipelineTrace.h"
+#import <libkern/OSAtomic.h>
+#import <map>
+#import <algorithm>
+
+namespace WhirlyKit
+{
+
+// How many spans the ring holds.  Must be a power of two.
+// At six stages per tile that's a few hundred recent tiles.
+static const int SpanRingSize = 4096;
+
+/* One slot in the span ring.  The writer claims a slot with an atomic
+    increment, zeroes seq, fills the fields in and writes seq last.  A
+    reader that sees the same nonzero seq before and after copying the
+    slot got a clean copy; anything else it just skips.  No locks, and
+    the worst a race costs us is one diagnostic sample.
+  */
+class RawSpan
+{
+public:
+    volatile int32_t seq;
+    int level,x,y;
+    int stage;
+    NSTimeInterval enter,exit;
+};
+
+static RawSpan SpanRing[SpanRingSize];
+static volatile int32_t SpanHead = 0;
+static volatile int32_t TraceEnabled = 0;
+
+TilePipelineTrace::Span::Span()
+    : level(0), x(0), y(0), stage(StageQueued), enter(0.0), exit(0.0)
+{
+}
+
+TilePipelineTrace::TileTrace::TileTrace()
+    : level(0), x(0), y(0), totalTime(0.0), longestStage(StageQueued)
+{
+    for (unsigned int ii=0;ii<StageMax;ii++)
+        stageTime[ii] = 0.0;
+}
+
+TilePipelineTrace::StageHistogram::StageHistogram()
+    : numSpans(0), minDur(0.0), maxDur(0.0), totalDur(0.0)
+{
+    for (unsigned int ii=0;ii<NumBuckets;ii++)
+        counts[ii] = 0;
+}
+
+void TilePipelineTrace::setEnabled(bool enable)
+{
+    TraceEnabled = (enable ? 1 : 0);
+}
+
+bool TilePipelineTrace::isEnabled()
+{
+    return TraceEnabled != 0;
+}
+
+void TilePipelineTrace::addSpan(int level,int x,int y,Stage stage,NSTimeInterval enter,NSTimeInterval exit)
+{
+    if (!TraceEnabled)
+        return;
+
+    int32_t seq = OSAtomicIncrement32((int32_t *)&SpanHead);
+    RawSpan &slot = SpanRing[seq & (SpanRingSize-1)];
+    slot.seq = 0;
+    OSMemoryBarrier();
+    slot.level = level;
+    slot.x = x;
+    slot.y = y;
+    slot.stage = stage;
+    slot.enter = enter;
+    slot.exit = exit;
+    OSMemoryBarrier();
+    slot.seq = seq;
+}
+
+void TilePipelineTrace::clear()
+{
+    // Writers racing with this just land in freshly cleared slots
+    for (unsigned int ii=0;ii<SpanRingSize;ii++)
+        SpanRing[ii].seq = 0;
+}
+
+// Copy the valid spans out of the ring, skipping anything mid-write
+static void SnapshotSpans(std::vector<TilePipelineTrace::Span> &spans)
+{
+    spans.reserve(SpanRingSize);
+    for (unsigned int ii=0;ii<SpanRingSize;ii++)
+    {
+        RawSpan &slot = SpanRing[ii];
+        int32_t seqBefore = slot.seq;
+        if (seqBefore == 0)
+            continue;
+        TilePipelineTrace::Span span;
+        span.level = slot.level;
+        span.x = slot.x;
+        span.y = slot.y;
+        span.stage = (TilePipelineTrace::Stage)slot.stage;
+        span.enter = slot.enter;
+        span.exit = slot.exit;
+        OSMemoryBarrier();
+        // The writer got to it while we were copying.  Skip it.
+        if (slot.seq != seqBefore)
+            continue;
+        spans.push_back(span);
+    }
+}
+
+// So the spans within a tile come out in pipeline order
+static bool SpanOrder(const TilePipelineTrace::Span &a,const TilePipelineTrace::Span &b)
+{
+    return a.enter < b.enter;
+}
+
+// Most recently finished tiles first
+static bool TraceOrder(const TilePipelineTrace::TileTrace &a,const TilePipelineTrace::TileTrace &b)
+{
+    NSTimeInterval aEnd = a.spans.empty() ? 0.0 : a.spans.back().exit;
+    NSTimeInterval bEnd = b.spans.empty() ? 0.0 : b.spans.back().exit;
+    return aEnd > bEnd;
+}
+
+void TilePipelineTrace::getRecentTiles(std::vector<TileTrace> &traces,int maxTiles)
+{
+    std::vector<Span> spans;
+    SnapshotSpans(spans);
+
+    // Group the spans by tile
+    typedef std::pair<int,std::pair<int,int> > TileKey;
+    std::map<TileKey,TileTrace> tileMap;
+    for (unsigned int ii=0;ii<spans.size();ii++)
+    {
+        const Span &span = spans[ii];
+        TileKey key(span.level,std::pair<int,int>(span.x,span.y));
+        TileTrace &trace = tileMap[key];
+        trace.level = span.level;
+        trace.x = span.x;
+        trace.y = span.y;
+        trace.spans.push_back(span);
+    }
+
+    // Work out where each tile's time went
+    traces.clear();
+    traces.reserve(tileMap.size());
+    for (std::map<TileKey,TileTrace>::iterator it = tileMap.begin();
+         it != tileMap.end(); ++it)
+    {
+        TileTrace &trace = it->second;
+        std::sort(trace.spans.begin(),trace.spans.end(),SpanOrder);
+
+        NSTimeInterval firstEnter = trace.spans.front().enter;
+        NSTimeInterval lastExit = trace.spans.front().exit;
+        for (unsigned int ii=0;ii<trace.spans.size();ii++)
+        {
+            const Span &span = trace.spans[ii];
+            trace.stageTime[span.stage] += span.exit - span.enter;
+            if (span.exit > lastExit)
+                lastExit = span.exit;
+        }
+        trace.totalTime = lastExit - firstEnter;
+        for (unsigned int ii=0;ii<StageMax;ii++)
+            if (trace.stageTime[ii] > trace.stageTime[trace.longestStage])
+                trace.longestStage = (Stage)ii;
+
+        traces.push_back(trace);
+    }
+
+    std::sort(traces.begin(),traces.end(),TraceOrder);
+    if (maxTiles >= 0 && (int)traces.size() > maxTiles)
+        traces.resize(maxTiles);
+}
+
+void TilePipelineTrace::getStageHistograms(StageHistogram histograms[StageMax])
+{
+    for (unsigned int ii=0;ii<StageMax;ii++)
+        histograms[ii] = StageHistogram();
+
+    std::vector<Span> spans;
+    SnapshotSpans(spans);
+
+    for (unsigned int ii=0;ii<spans.size();ii++)
+    {
+        const Span &span = spans[ii];
+        NSTimeInterval dur = span.exit - span.enter;
+        StageHistogram &histogram = histograms[span.stage];
+
+        // Buckets double from 1ms; the last one takes whatever's left
+        int bucket = 0;
+        double ms = 1000.0 * dur;
+        while (bucket < StageHistogram::NumBuckets-1 && ms >= 1.0)
+        {
+            ms /= 2.0;
+            bucket++;
+        }
+        histogram.counts[bucket]++;
+
+        if (histogram.numSpans == 0 || dur < histogram.minDur)
+            histogram.minDur = dur;
+        if (dur > histogram.maxDur)
+            histogram.maxDur = dur;
+        histogram.totalDur += dur;
+        histogram.numSpans++;
+    }
+}
+
+const char *TilePipelineTrace::StageName(Stage stage)
+{
+    switch (stage)
+    {
+        case StageQueued:   return "queued";
+        case StageFetch:    return "fetch";
+        case StageInflate:  return "inflate";
+        case StageDecode:   return "decode";
+        case StageBuild:    return "build";
+        case StageUpload:   return "upload";
+        default:            return "unknown";
+    }
+}
+
+void TilePipelineTrace::report(std::string &outJson,int maxTiles)
+{
+    char line[1024];
+
+    std::vector<TileTrace> traces;
+    getRecentTiles(traces,maxTiles);
+
+    outJson += "{\"tiles\":[";
+    for (unsigned int ii=0;ii<traces.size();ii++)
+    {
+        const TileTrace &trace = traces[ii];
+        sprintf(line,"%s{\"tile\":\"%d/%d/%d\",\"totalMs\":%f,\"longest\":\"%s\",\"spans\":[",
+                (ii == 0 ? "" : ","),trace.level,trace.x,trace.y,
+                1000*trace.totalTime,StageName(trace.longestStage));
+        outJson += line;
+        NSTimeInterval firstEnter = trace.spans.empty() ? 0.0 : trace.spans.front().enter;
+        for (unsigned int jj=0;jj<trace.spans.size();jj++)
+        {
+            const Span &span = trace.spans[jj];
+            sprintf(line,"%s{\"stage\":\"%s\",\"startMs\":%f,\"durMs\":%f}",
+                    (jj == 0 ? "" : ","),StageName(span.stage),
+                    1000*(span.enter-firstEnter),1000*(span.exit-span.enter));
+            outJson += line;
+        }
+        outJson += "]}";
+    }
+
+    StageHistogram histograms[StageMax];
+    getStageHistograms(histograms);
+
+    outJson += "],\"stages\":[";
+    bool first = true;
+    for (unsigned int ii=0;ii<StageMax;ii++)
+    {
+        StageHistogram &histogram = histograms[ii];
+        if (histogram.numSpans == 0)
+            continue;
+        sprintf(line,"%s{\"stage\":\"%s\",\"spans\":%d,\"minMs\":%f,\"maxMs\":%f,\"avgMs\":%f,\"buckets\":[",
+                (first ? "" : ","),StageName((Stage)ii),histogram.numSpans,
+                1000*histogram.minDur,1000*histogram.maxDur,
+                1000*histogram.totalDur / histogram.numSpans);
+        outJson += line;
+        for (unsigned int jj=0;jj<StageHistogram::NumBuckets;jj++)
+        {
+            sprintf(line,"%s%d",(jj == 0 ? "" : ","),histogram.counts[jj]);
+            outJson += line;
+        }
+        outJson += "]}";
+        first = false;
+    }
+    outJson += "]}";
+}
+
+}
@@ -27,10 +27,70 @@
 #import "DynamicDrawableAtlas.h"
 #import "UIColor+Stuff.h"
 #import "GLUtils.h"
+#import "WorkRegulator.h"
+#import "TilePipelineTrace.h"
 
 using namespace Eigen;
 using namespace WhirlyKit;
 
+// How much geometry we'll relocate per flush to defragment the drawable atlas
+static const int CompactBudgetPerFlush = 512*1024;
+
+// Don't let prefetch requests pile up on the data source
+static const int MaxPrefetchFetches = 8;
+// How many prefetched tiles we'll hang on to, waiting for a real load
+static const int MaxPrefetchedTiles = 32;
+
+/* Rides at the back of a tile's change requests.  Constructed when the
+    tile's geometry is ready for the scene; by the time the render
+    thread executes it, everything the tile added has been processed.
+    The span is the time the tile spent waiting on upload.
+  */
+class TileTraceUploadReq : public ChangeRequest
+{
+public:
+    TileTraceUploadReq(const Quadtree::Identifier &ident) : ident(ident), enter(CFAbsoluteTimeGetCurrent()) { }
+    void execute(Scene *scene,WhirlyKitSceneRendererES *renderer,WhirlyKitView *view)
+    {
+        TilePipelineTrace::addSpan(ident.level,ident.x,ident.y,TilePipelineTrace::StageUpload,enter,CFAbsoluteTimeGetCurrent());
+    }
+protected:
+    Quadtree::Identifier ident;
+    NSTimeInterval enter;
+};
+
+/* Geometry and textures built for a tile on one of the background
+    workers, on their way back to the layer thread.
+  */
+@interface WhirlyKitTileBuildResult : NSObject
+{
+@public
+    WhirlyKit::Quadtree::Identifier ident;
+    WhirlyKit::BasicDrawable *draw;
+    WhirlyKit::BasicDrawable *skirtDraw;
+    std::vector<WhirlyKit::Texture *> texs;
+    std::vector<WhirlyKitLoadedImage *> loadImages;
+    bool success;
+}
+@end
+
+@implementation WhirlyKitTileBuildResult
+
+- (id)init
+{
+    self = [super init];
+    if (self)
+    {
+        draw = NULL;
+        skirtDraw = NULL;
+        success = false;
+    }
+
+    return self;
+}
+
+@end
+
 @interface WhirlyKitQuadTileLoader()
 {
 @public
@@ -55,17 +115,34 @@ using namespace WhirlyKit;
     
     // Parents to update after changes
     std::set<WhirlyKit::Quadtree::Identifier> parents;
+
+    // Tiles whose edges may need restitching after changes (stitchEdges mode)
+    std::set<WhirlyKit::Quadtree::Identifier> stitchTiles;
     
     /// Change requests queued up between a begin and end
     std::vector<WhirlyKit::ChangeRequest *> changeRequests;
     
     // Keep track of the slow (e.g. network) fetches
     std::set<WhirlyKit::Quadtree::Identifier> networkFetches,localFetches;
+
+    // When each in flight tile was asked for, for the pipeline trace
+    //  (layer thread only, like the fetch sets above)
+    std::map<WhirlyKit::Quadtree::Identifier,NSTimeInterval> loadStartTimes;
     
     // The images we're currently displaying, when we have more than one
     int currentImage0,currentImage1;
-    
+
     NSString *name;
+
+    // Worker pool for building tile geometry off the layer thread
+    dispatch_queue_t tileBuildQueue;
+    dispatch_group_t tileBuildGroup;
+    dispatch_semaphore_t tileBuildSema;
+
+    // Prefetches in flight for tiles we don't have yet (layer thread only)
+    std::set<WhirlyKit::Quadtree::Identifier> prefetchFetches;
+    // Prefetched data waiting for a real load to come asking
+    std::map<WhirlyKit::Quadtree::Identifier,id> prefetchedTiles;
 }
 
 - (id)initWithDataSource:(NSObject<WhirlyKitQuadTileImageDataSource> *)inDataSource;
@@ -79,6 +156,9 @@ using namespace WhirlyKit;
         _color = RGBAColor(255,255,255,255);
         _hasAlpha = false;
         _ignoreEdgeMatching = false;
+        _stitchEdges = false;
+        _buildNormalMaps = false;
+        _useTileCenters = false;
         _minVis = DrawVisibleInvalid;
         _maxVis = DrawVisibleInvalid;
         _minPageVis = DrawVisibleInvalid;
@@ -86,6 +166,7 @@ using namespace WhirlyKit;
         _imageType = WKTileIntRGBA;
         _useDynamicAtlas = true;
         _numImages = 1;
+        _frameResidency = 0;
         currentImage0 = 0;
         currentImage1 = 0;
         doingUpdate = false;
@@ -97,6 +178,9 @@ using namespace WhirlyKit;
         _activeTextures = -1;
         _borderTexel = 1;
         _enable = true;
+        _numTileBuildThreads = 2;
+        _convertFormatOnBuild = true;
+        _useMipmaps = false;
         defaultTessX = defaultTessY = 10;
         pthread_mutex_init(&tileLock, NULL);
     }
@@ -115,6 +199,18 @@ using namespace WhirlyKit;
 
 - (void)clear
 {
+    // Tell the workers to bail before we wait on them, so teardown
+    //  only waits out the builds already past their cancel checks
+    pthread_mutex_lock(&tileLock);
+    for (LoadedTileSet::iterator it = tileSet.begin();
+         it != tileSet.end(); ++it)
+        *(*it)->cancelled = true;
+    pthread_mutex_unlock(&tileLock);
+
+    // Wait out any builds the workers are still running
+    if (tileBuildGroup)
+        dispatch_group_wait(tileBuildGroup, DISPATCH_TIME_FOREVER);
+
     pthread_mutex_lock(&tileLock);
     for (LoadedTileSet::iterator it = tileSet.begin();
          it != tileSet.end(); ++it)
@@ -126,8 +222,10 @@ using namespace WhirlyKit;
     if (tileBuilder)
         delete tileBuilder;
     tileBuilder = NULL;
-    
+
     parents.clear();
+    prefetchFetches.clear();
+    prefetchedTiles.clear();
 }
 
 - (void)dealloc
@@ -150,15 +248,23 @@ using namespace WhirlyKit;
     }
     
     ChangeSet theChangeRequests;
-    
+
+    // Everything we loaded goes in a couple of bulk removals rather
+    //  than a change request per drawable.  Shutting down a deeply
+    //  loaded layer used to make thousands of them.
+    SimpleIDSet drawIDs,texIDs;
     pthread_mutex_lock(&tileLock);
     for (LoadedTileSet::iterator it = tileSet.begin();
          it != tileSet.end(); ++it)
     {
         LoadedTile *tile = *it;
-        tile->clearContents(tileBuilder,theChangeRequests);
+        tile->dropContents(tileBuilder,drawIDs,texIDs,theChangeRequests);
     }
     pthread_mutex_unlock(&tileLock);
+    if (!drawIDs.empty())
+        theChangeRequests.push_back(new RemDrawableSetReq(drawIDs));
+    if (!texIDs.empty())
+        theChangeRequests.push_back(new RemTextureSetReq(texIDs));
     
     networkFetches.clear();
     localFetches.clear();
@@ -274,10 +380,26 @@ using namespace WhirlyKit;
         retTile = *it;
     
     pthread_mutex_unlock(&tileLock);
-    
+
     return retTile;
 }
 
+// Check if anyone still cares about the given tile.  Any thread.
+- (bool)tileIsWantedLevel:(int)level col:(int)col row:(int)row
+{
+    Quadtree::Identifier ident(col,row,level);
+
+    pthread_mutex_lock(&tileLock);
+    LoadedTile dummyTile(ident);
+    bool wanted = tileSet.find(&dummyTile) != tileSet.end();
+    // A prefetch counts too, since we'd like to keep the data warm
+    if (!wanted)
+        wanted = prefetchFetches.find(ident) != prefetchFetches.end();
+    pthread_mutex_unlock(&tileLock);
+
+    return wanted;
+}
+
 // Make all the various parents update their child geometry
 - (void)refreshParents:(WhirlyKitQuadDisplayLayer *)layer
 {
@@ -307,6 +429,86 @@ using namespace WhirlyKit;
     parents.clear();
 }
 
+// Do two tiles share an edge (not just a corner)?
+static bool TilesAreEdgeAdjacent(const Quadtree::Identifier &a,const Quadtree::Identifier &b)
+{
+    int level = std::max(a.level,b.level);
+    long long sizeA = 1LL << (level-a.level), sizeB = 1LL << (level-b.level);
+    long long ax = a.x*sizeA, ay = a.y*sizeA;
+    long long bx = b.x*sizeB, by = b.y*sizeB;
+    bool xTouch = (ax+sizeA == bx) || (bx+sizeB == ax);
+    bool yTouch = (ay+sizeA == by) || (by+sizeB == ay);
+    bool xOverlap = (ax < bx+sizeB) && (bx < ax+sizeA);
+    bool yOverlap = (ay < by+sizeB) && (by < ay+sizeA);
+    return (xTouch && yOverlap) || (yTouch && xOverlap);
+}
+
+// A tile changed, so collect it and the loaded tiles along its edges for restitching
+- (void)markStitchNeighbors:(const WhirlyKit::Quadtree::Identifier &)ident
+{
+    if (!_stitchEdges)
+        return;
+
+    stitchTiles.insert(ident);
+    pthread_mutex_lock(&tileLock);
+    for (LoadedTileSet::iterator it = tileSet.begin();it != tileSet.end();++it)
+        if (TilesAreEdgeAdjacent((*it)->nodeInfo.ident,ident))
+            stitchTiles.insert((*it)->nodeInfo.ident);
+    pthread_mutex_unlock(&tileLock);
+}
+
+// Level of the loaded tile in the given direction, walking up to the
+//  nearest loaded ancestor of the immediate neighbor.  -1 if there isn't
+//  one, or if the walk lands on one of our own ancestors.
+- (int)loadedNeighborLevel:(WhirlyKit::Quadtree::Identifier)ident dx:(int)dx dy:(int)dy
+{
+    int nx = ident.x + dx, ny = ident.y + dy;
+    for (int level = ident.level;level >= 0;level--)
+    {
+        if (nx < 0 || ny < 0 || nx >= 1<<level || ny >= 1<<level)
+            return -1;
+        // If we've walked onto our own ancestor it contains us rather
+        //  than bordering us, so there's nothing to stitch against
+        if (nx == (ident.x >> (ident.level-level)) && ny == (ident.y >> (ident.level-level)))
+            return -1;
+        LoadedTile *theTile = [self getTile:Quadtree::Identifier(nx,ny,level)];
+        if (theTile && !theTile->isLoading && !theTile->placeholder)
+            return level;
+        nx /= 2;  ny /= 2;
+    }
+
+    return -1;
+}
+
+// Neighbor levels (bottom,top,left,right) the given tile should stitch against
+- (void)stitchLevelsForTile:(const WhirlyKit::Quadtree::Identifier &)ident levels:(int *)levels
+{
+    levels[0] = [self loadedNeighborLevel:ident dx:0 dy:-1];
+    levels[1] = [self loadedNeighborLevel:ident dx:0 dy:1];
+    levels[2] = [self loadedNeighborLevel:ident dx:-1 dy:0];
+    levels[3] = [self loadedNeighborLevel:ident dx:1 dy:0];
+}
+
+// Restitch the edges that may have changed with the recent loads and unloads
+- (void)refreshStitching
+{
+    if (!_stitchEdges || stitchTiles.empty())
+        return;
+
+    for (std::set<Quadtree::Identifier>::iterator it = stitchTiles.begin();
+         it != stitchTiles.end(); ++it)
+    {
+        LoadedTile *theTile = [self getTile:*it];
+        if (theTile && !theTile->isLoading)
+        {
+            int levels[4];
+            [self stitchLevelsForTile:*it levels:levels];
+            theTile->restitchContents(tileBuilder,levels,changeRequests);
+        }
+    }
+    stitchTiles.clear();
+}
+
 // This is not used, but it gets rid of the @selector warning below
 - (void)wakeUp
 {
@@ -321,8 +523,13 @@ using namespace WhirlyKit;
     {
         if (tileBuilder->drawAtlas->hasUpdates() && !tileBuilder->drawAtlas->waitingOnSwap())
         {
+            // Slide a little geometry down into lower free space while we're at it.
+            // Keeps the big drawables from fragmenting as tiles come and go.
+            tileBuilder->drawAtlas->compact(CompactBudgetPerFlush);
             tileBuilder->drawAtlas->swap(changeRequests,_quadLayer,@selector(wakeUp));
             tileBuilder->texAtlas->cleanup(changeRequests);
+            // Rebuild atlas mip chains once per flush, after the region adds
+            tileBuilder->texAtlas->regenMipmaps(changeRequests);
             tileBuilder->drawAtlas->clearUpdateFlag();
         }
     }
@@ -336,7 +543,13 @@ using namespace WhirlyKit;
     
     if (!changeRequests.empty())
     {
-        [layerThread addChangeRequests:(changeRequests)];
+        // A disabled layer is loading ahead of its enable, so its
+        //  uploads go through the warm up queue and trickle in on
+        //  the frame budget instead of spiking the enable frame
+        if (_enable)
+            [layerThread addChangeRequests:(changeRequests)];
+        else
+            [layerThread addPreheatChangeRequests:(changeRequests)];
         changeRequests.clear();
 //        [layerThread flushChangeRequests];
     }
@@ -409,8 +622,33 @@ using namespace WhirlyKit;
         networkFetches.insert(tileInfo->ident);
     else
         localFetches.insert(tileInfo->ident);
-    
-    [dataSource quadTileLoader:self startFetchForLevel:tileInfo->ident.level col:tileInfo->ident.x row:tileInfo->ident.y attrs:tileInfo->attrs];
+
+    if (TilePipelineTrace::isEnabled())
+        loadStartTimes[tileInfo->ident] = CFAbsoluteTimeGetCurrent();
+
+    // A prefetch may have already pulled this tile in, or still be working on it
+    id prefetchData = nil;
+    bool prefetchInFlight = false;
+    pthread_mutex_lock(&tileLock);
+    std::map<Quadtree::Identifier,id>::iterator pit = prefetchedTiles.find(tileInfo->ident);
+    if (pit != prefetchedTiles.end())
+    {
+        prefetchData = pit->second;
+        prefetchedTiles.erase(pit);
+    } else
+        prefetchInFlight = prefetchFetches.find(tileInfo->ident) != prefetchFetches.end();
+    pthread_mutex_unlock(&tileLock);
+
+    if (prefetchData)
+    {
+        [self dataSource:dataSource loadedImage:prefetchData forLevel:tileInfo->ident.level col:tileInfo->ident.x row:tileInfo->ident.y];
+        return;
+    }
+    // The in flight prefetch will finish the load when it comes back
+    if (prefetchInFlight)
+        return;
+
+    [dataSource quadTileLoader:self startFetchForLevel:tileInfo->ident.level col:tileInfo->ident.x row:tileInfo->ident.y attrs:tileInfo->attrs.dict()];
 }
 
 // Check if we're in the process of loading the given tile
@@ -423,11 +661,69 @@ using namespace WhirlyKit;
     LoadedTile *tile = [self getTile:tileInfo.ident];
     if (!tile)
         return false;
-    
+
     // If it's not loading, sure
     return !tile->isLoading;
 }
 
+// The display layer expects the view to shift about this far (in local
+//  coordinates), so warm up tiles just past the leading edge
+- (void)quadDisplayLayer:(WhirlyKitQuadDisplayLayer *)layer prefetchForShift:(WhirlyKit::Point2d)shift
+{
+    // Prefetch is the definition of droppable work, so it's first
+    //  against the wall when the frame rate is suffering
+    int maxFetches = WorkRegulator::scaleCount(MaxPrefetchFetches);
+    if (!dataSource || maxFetches == 0)
+        return;
+
+    // Gather up the neighbors the motion is headed into
+    std::set<Quadtree::Identifier> candidates;
+    pthread_mutex_lock(&tileLock);
+    for (LoadedTileSet::iterator it = tileSet.begin(); it != tileSet.end(); ++it)
+    {
+        const Quadtree::NodeInfo &nodeInfo = (*it)->nodeInfo;
+        Point2f tileSpan = nodeInfo.mbr.ur() - nodeInfo.mbr.ll();
+        if (tileSpan.x() <= 0.0 || tileSpan.y() <= 0.0)
+            continue;
+
+        // Only step over if the view will make it at least half way into the neighbor
+        int dx = 0, dy = 0;
+        if (std::abs(shift.x()) > tileSpan.x()/2.0)
+            dx = (shift.x() > 0.0 ? 1 : -1);
+        if (std::abs(shift.y()) > tileSpan.y()/2.0)
+            dy = (shift.y() > 0.0 ? 1 : -1);
+        if (dx == 0 && dy == 0)
+            continue;
+
+        Quadtree::Identifier neighbor(nodeInfo.ident.x+dx,nodeInfo.ident.y+dy,nodeInfo.ident.level);
+        int numTiles = 1<<neighbor.level;
+        if (neighbor.x < 0 || neighbor.y < 0 || neighbor.x >= numTiles || neighbor.y >= numTiles)
+            continue;
+
+        // Skip anything already loaded, fetching or warm
+        LoadedTile dummyTile(neighbor);
+        if (tileSet.find(&dummyTile) != tileSet.end())
+            continue;
+        if (prefetchFetches.find(neighbor) != prefetchFetches.end() ||
+            prefetchedTiles.find(neighbor) != prefetchedTiles.end())
+            continue;
+
+        if (prefetchFetches.size() + candidates.size() >= maxFetches)
+            break;
+        candidates.insert(neighbor);
+    }
+    for (std::set<Quadtree::Identifier>::iterator it = candidates.begin(); it != candidates.end(); ++it)
+        prefetchFetches.insert(*it);
+    pthread_mutex_unlock(&tileLock);
+
+    // Kick off the fetches.  The results land in the warm cache.
+    for (std::set<Quadtree::Identifier>::iterator it = candidates.begin(); it != candidates.end(); ++it)
+    {
+        const Quadtree::Identifier &ident = *it;
+        [dataSource quadTileLoader:self startFetchForLevel:ident.level col:ident.x row:ident.y attrs:[NSMutableDictionary dictionary]];
+    }
+}
+
 // When the data source loads the image, we'll get called here
 - (void)dataSource:(NSObject<WhirlyKitQuadTileImageDataSource> *)inDataSource loadedImage:(NSData *)image pvrtcSize:(int)pvrtcSize forLevel:(int)level col:(int)col row:(int)row
 {
@@ -474,6 +770,8 @@ using namespace WhirlyKit;
     if (!isPlaceholder && !tileBuilder)
     {
         tileBuilder = new TileBuilder(_quadLayer.coordSys,_quadLayer.mbr,_quadLayer.quadtree);
+        // The scratch arena can't be shared between concurrent builds
+        tileBuilder->scratchArena = (_numTileBuildThreads > 1) ? NULL : _quadLayer.layerThread.scratchArena;
         tileBuilder->tileScale = _tileScale;
         tileBuilder->fixedTileSize = _fixedTileSize;
         tileBuilder->drawOffset = _drawOffset;
@@ -486,9 +784,15 @@ using namespace WhirlyKit;
         tileBuilder->includeElev = _includeElev;
         tileBuilder->useElevAsZ = _useElevAsZ;
         tileBuilder->ignoreEdgeMatching = _ignoreEdgeMatching;
+        tileBuilder->stitchEdges = _stitchEdges;
+        tileBuilder->buildNormalMaps = _buildNormalMaps;
+        // Centered tiles can't live in the shared atlas drawables
+        tileBuilder->useTileCenters = _useTileCenters && !_useDynamicAtlas;
         tileBuilder->coverPoles = _coverPoles;
         tileBuilder->glFormat = [self glFormat];
         tileBuilder->singleByteSource = [self singleByteSource];
+        tileBuilder->convertFormatOnBuild = _convertFormatOnBuild;
+        tileBuilder->useMipmaps = _useMipmaps;
         tileBuilder->defaultSphereTessX = defaultTessX;
         tileBuilder->defaultSphereTessY = defaultTessY;
         tileBuilder->texelBinSize = 64;
@@ -525,6 +829,16 @@ using namespace WhirlyKit;
     if (nit != localFetches.end())
         localFetches.erase(nit);
 
+    // The whole wait on the data source, from asking to data in hand.
+    // The network fetch records its own span inside this one; what's
+    //  left over is queue and dispatch time.
+    std::map<Quadtree::Identifier,NSTimeInterval>::iterator lit = loadStartTimes.find(tileIdent);
+    if (lit != loadStartTimes.end())
+    {
+        TilePipelineTrace::addSpan(level,col,row,TilePipelineTrace::StageQueued,lit->second,CFAbsoluteTimeGetCurrent());
+        loadStartTimes.erase(lit);
+    }
+
     // Look for the tile
     // If it's not here, just drop this on the floor
     pthread_mutex_lock(&tileLock);
@@ -532,10 +846,19 @@ using namespace WhirlyKit;
     LoadedTileSet::iterator it = tileSet.find(&dummyTile);
     if (it == tileSet.end())
     {
+        // Unless it was a prefetch, in which case keep the data warm
+        //  for the real load
+        if (prefetchFetches.erase(tileIdent))
+        {
+            if (loadTile && prefetchedTiles.size() < MaxPrefetchedTiles)
+                prefetchedTiles[tileIdent] = loadTile;
+        }
         pthread_mutex_unlock(&tileLock);
         return;
     }
-    
+    // The real load may have adopted a prefetch that was in flight
+    prefetchFetches.erase(tileIdent);
+
     
     std::vector<WhirlyKitLoadedImage *> loadImages;
     WhirlyKitElevationChunk *loadElev = nil;
@@ -578,17 +901,89 @@ using namespace WhirlyKit;
     }
     
     LoadedTile *tile = *it;
+
+    // A tile that's already on screen coming through again is a
+    //  replacement, e.g. the full resolution copy arriving after a
+    //  low res first paint.  Drop the old representation and rebuild.
+    if (!tile->isLoading && !tile->placeholder)
+        tile->clearContents(tileBuilder,changeRequests);
+
+    // Hand the heavy lifting to the worker pool if we've got one.  Image
+    //  decode, mesh generation and the skirts run out there; only the atlas
+    //  insertion and scene changes come back to the layer thread.
+    if (!isPlaceholder && loadingSuccess && _numTileBuildThreads > 1 && (!loadImages.empty() || loadElev))
+    {
+        tile->elevData = loadElev;
+        if (!tileBuildQueue)
+        {
+            // Builds from every layer run on the shared pool; the
+            //  semaphore keeps any one layer from hogging it
+            tileBuildQueue = [WhirlyKitLayerThread sharedWorkQueue];
+            tileBuildGroup = dispatch_group_create();
+            tileBuildSema = dispatch_semaphore_create(_numTileBuildThreads);
+        }
+        Quadtree::NodeInfo buildInfo = tile->nodeInfo;
+        int numTexs = (int)loadImages.size();
+        TileBuilder *theBuilder = tileBuilder;
+        NSThread *layerThread = _quadLayer.layerThread;
+        boost::shared_ptr<bool> cancelToken = tile->cancelled;
+        pthread_mutex_unlock(&tileLock);
+
+        dispatch_group_async(tileBuildGroup, tileBuildQueue,
+        ^{
+            // Cap how many builds actually run at once
+            dispatch_semaphore_wait(tileBuildSema, DISPATCH_TIME_FOREVER);
+
+            // The tile may have been unloaded while we sat in the queue
+            if (!(*cancelToken))
+            {
+                WhirlyKitTileBuildResult *result = [[WhirlyKitTileBuildResult alloc] init];
+                result->ident = buildInfo.ident;
+                result->loadImages = loadImages;
+                result->texs.resize(numTexs,NULL);
+                // The captures are const, so make working copies
+                Quadtree::NodeInfo threadInfo = buildInfo;
+                std::vector<WhirlyKitLoadedImage *> threadImages = loadImages;
+                NSTimeInterval buildStart = CFAbsoluteTimeGetCurrent();
+                result->success = theBuilder->buildTile(&threadInfo, &result->draw, &result->skirtDraw, (numTexs > 0 ? &result->texs : NULL), Point2f(1.0,1.0), Point2f(0.0,0.0), &threadImages, loadElev, cancelToken.get());
+                TilePipelineTrace::addSpan(buildInfo.ident.level,buildInfo.ident.x,buildInfo.ident.y,TilePipelineTrace::StageBuild,buildStart,CFAbsoluteTimeGetCurrent());
+
+                [self performSelector:@selector(tileBuildComplete:) onThread:layerThread withObject:result waitUntilDone:NO];
+            }
+
+            dispatch_semaphore_signal(tileBuildSema);
+        });
+
+        // The atlases may want their setup flushed through right away
+        if (createdAtlases)
+            [self runSetCurrentImage:changeRequests];
+
+        // The rest happens when the build comes back
+        return;
+    }
+
     tile->isLoading = false;
     if (loadingSuccess && (isPlaceholder || !loadImages.empty() || loadElev))
     {
         tile->elevData = loadElev;
+        NSTimeInterval buildStart = CFAbsoluteTimeGetCurrent();
         if (tile->addToScene(tileBuilder,loadImages,currentImage0,currentImage1,loadElev,changeRequests))
         {
+            TilePipelineTrace::addSpan(level,col,row,TilePipelineTrace::StageBuild,buildStart,CFAbsoluteTimeGetCurrent());
+            if (TilePipelineTrace::isEnabled())
+                changeRequests.push_back(new TileTraceUploadReq(tile->nodeInfo.ident));
             // If we have more than one image to dispay, make sure we're doing the right one
             if (!isPlaceholder && _numImages > 1 && tileBuilder->texAtlas)
             {
                 tile->setCurrentImages(tileBuilder, currentImage0, currentImage1, changeRequests);
             }
+            // With a frame residency window we hang on to the compressed
+            //  sources and immediately shed the frames outside the window
+            if (!isPlaceholder && _numImages > 1 && _frameResidency > 0 && !tileBuilder->texAtlas)
+            {
+                tile->sourceImages = loadImages;
+                tile->updateFrameResidency(tileBuilder, _frameResidency, currentImage0, currentImage1, changeRequests);
+            }
         } else
             loadingSuccess = false;
     }
@@ -608,7 +1003,8 @@ using namespace WhirlyKit;
     // Various child state changed so let's update the parents
     if (level > 0 && _quadLayer.targetLevels.empty())
         parents.insert(Quadtree::Identifier(col/2,row/2,level-1));
-    
+    [self markStitchNeighbors:Quadtree::Identifier(col,row,level)];
+
     if (!doingUpdate)
         [self flushUpdates:_quadLayer.layerThread];
 
@@ -621,6 +1017,70 @@ using namespace WhirlyKit;
         [self runSetCurrentImage:changeRequests];
 }
 
+// Called back on the layer thread when one of the workers finishes a build
+- (void)tileBuildComplete:(WhirlyKitTileBuildResult *)result
+{
+    pthread_mutex_lock(&tileLock);
+    LoadedTile dummyTile(result->ident);
+    LoadedTileSet::iterator it = tileSet.find(&dummyTile);
+    if (it == tileSet.end())
+    {
+        // The tile was unloaded while we were building.  Toss the results.
+        pthread_mutex_unlock(&tileLock);
+        if (result->draw)
+            delete result->draw;
+        if (result->skirtDraw)
+            delete result->skirtDraw;
+        for (unsigned int ii=0;ii<result->texs.size();ii++)
+            if (result->texs[ii])
+                delete result->texs[ii];
+        return;
+    }
+
+    LoadedTile *tile = *it;
+    tile->isLoading = false;
+    bool loadingSuccess = result->success;
+    if (loadingSuccess)
+    {
+        if (tile->addToScene(tileBuilder,result->loadImages,result->draw,result->skirtDraw,result->texs,changeRequests))
+        {
+            if (TilePipelineTrace::isEnabled())
+                changeRequests.push_back(new TileTraceUploadReq(tile->nodeInfo.ident));
+            // If we have more than one image to display, make sure we're doing the right one
+            if (_numImages > 1 && tileBuilder->texAtlas)
+                tile->setCurrentImages(tileBuilder, currentImage0, currentImage1, changeRequests);
+            // With a frame residency window we hang on to the compressed
+            //  sources and immediately shed the frames outside the window
+            if (_numImages > 1 && _frameResidency > 0 && !tileBuilder->texAtlas)
+            {
+                tile->sourceImages = result->loadImages;
+                tile->updateFrameResidency(tileBuilder, _frameResidency, currentImage0, currentImage1, changeRequests);
+            }
+        } else
+            loadingSuccess = false;
+    }
+
+    if (loadingSuccess)
+        [_quadLayer loader:self tileDidLoad:tile->nodeInfo.ident];
+    else {
+        // Shouldn't have a visual representation, so just lose it
+        [_quadLayer loader:self tileDidNotLoad:tile->nodeInfo.ident];
+        tileSet.erase(it);
+        delete tile;
+    }
+    pthread_mutex_unlock(&tileLock);
+
+    // Various child state changed so let's update the parents
+    if (result->ident.level > 0 && _quadLayer.targetLevels.empty())
+        parents.insert(Quadtree::Identifier(result->ident.x/2,result->ident.y/2,result->ident.level-1));
+    [self markStitchNeighbors:result->ident];
+
+    if (!doingUpdate)
+        [self flushUpdates:_quadLayer.layerThread];
+
+    [self updateTexAtlasMapping];
+}
+
 // We'll get this before a series of unloads and loads
 - (void)quadDisplayLayerStartUpdates:(WhirlyKitQuadDisplayLayer *)layer
 {
@@ -636,7 +1096,8 @@ using namespace WhirlyKit;
     nit = localFetches.find(tileInfo->ident);
     if (nit != localFetches.end())
         localFetches.erase(nit);
-    
+    loadStartTimes.erase(tileInfo->ident);
+
     // Get rid of an old tile
     pthread_mutex_lock(&tileLock);
     LoadedTile dummyTile;
@@ -645,7 +1106,9 @@ using namespace WhirlyKit;
     if (it != tileSet.end())
     {
         LoadedTile *theTile = *it;
-                
+
+        // Let any fetch or build still in flight know it can quit
+        *theTile->cancelled = true;
         theTile->clearContents(tileBuilder,changeRequests);
         tileSet.erase(it);
         delete theTile;
@@ -657,6 +1120,7 @@ using namespace WhirlyKit;
     // We'll put this on the list of parents to update, but it'll actually happen in EndUpdates
     if (tileInfo->ident.level > 0 && layer.targetLevels.empty())
         parents.insert(Quadtree::Identifier(tileInfo->ident.x/2,tileInfo->ident.y/2,tileInfo->ident.level-1));
+    [self markStitchNeighbors:tileInfo->ident];
     
     [self updateTexAtlasMapping];
     
@@ -668,6 +1132,7 @@ using namespace WhirlyKit;
 - (void)updateWithoutFlush
 {
     [self refreshParents:_quadLayer];
+    [self refreshStitching];
 }
 
 // Thus ends the unloads.  Now we can update parents
@@ -676,7 +1141,8 @@ using namespace WhirlyKit;
     if (doingUpdate)
     {
         [self refreshParents:layer];
-        
+        [self refreshStitching];
+
         [self flushUpdates:layer.layerThread];
     }
     
@@ -733,7 +1199,10 @@ using namespace WhirlyKit;
             for (LoadedTileSet::iterator it = tileSet.begin();
                  it != tileSet.end(); ++it)
             {
-                (*it)->setCurrentImages(tileBuilder, currentImage0, currentImage1, theChanges);
+                if (_frameResidency > 0)
+                    (*it)->updateFrameResidency(tileBuilder, _frameResidency, currentImage0, currentImage1, theChanges);
+                else
+                    (*it)->setCurrentImages(tileBuilder, currentImage0, currentImage1, theChanges);
             }
 
             pthread_mutex_unlock(&tileLock);
@@ -798,7 +1267,10 @@ using namespace WhirlyKit;
             for (LoadedTileSet::iterator it = tileSet.begin();
                  it != tileSet.end(); ++it)
             {
-                (*it)->setCurrentImages(tileBuilder, currentImage0, currentImage1, theChanges);
+                if (_frameResidency > 0)
+                    (*it)->updateFrameResidency(tileBuilder, _frameResidency, currentImage0, currentImage1, theChanges);
+                else
+                    (*it)->setCurrentImages(tileBuilder, currentImage0, currentImage1, theChanges);
             }
 
             pthread_mutex_unlock(&tileLock);
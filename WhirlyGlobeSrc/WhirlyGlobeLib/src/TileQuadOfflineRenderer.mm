@@ -23,6 +23,9 @@
 
 using namespace WhirlyKit;
 
+@implementation WhirlyKitQuadTileOfflineSubTile
+@end
+
 @implementation WhirlyKitQuadTileOfflineImage
 @end
 
@@ -86,6 +89,12 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
     CFTimeInterval lastRender;
     bool somethingChanged;
     int currentMbr;
+    // Canvases retained between renders so we only redraw what changed
+    std::vector<CGContextRef> renderContexts;
+    CGSize renderSize;
+    int renderedMbr;
+    // Area covered by the tiles that changed since the last render
+    Mbr dirtyMbr;
 }
 
 - (id)initWithName:(NSString *)name dataSource:(NSObject<WhirlyKitQuadTileImageDataSource> *)imageSource
@@ -104,7 +113,10 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
     _on = true;
     _autoRes = true;
     _previewLevels = -1;
+    _subTileSize = 0;
     somethingChanged = true;
+    renderSize = CGSizeZero;
+    renderedMbr = -1;
     
     return self;
 }
@@ -114,9 +126,27 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
     for (OfflineTileSet::iterator it = tiles.begin();it != tiles.end();++it)
         delete *it;
     tiles.clear();
+    for (unsigned int ii=0;ii<renderContexts.size();ii++)
+        CGContextRelease(renderContexts[ii]);
+    renderContexts.clear();
+    renderSize = CGSizeZero;
+    renderedMbr = -1;
+    dirtyMbr.reset();
     somethingChanged = true;
 }
 
+// Note which part of the canvas a tile touches, so the next render can
+//  get away with redrawing just that
+- (void)addToDirty:(const WhirlyKit::Quadtree::Identifier &)ident
+{
+    if (!_quadLayer)
+        return;
+
+    Mbr tileMbr = _quadLayer.quadtree->generateMbrForNode(ident);
+    dirtyMbr.addPoint(tileMbr.ll());
+    dirtyMbr.addPoint(tileMbr.ur());
+}
+
 - (void)dealloc
 {
     [self clear];
@@ -164,6 +194,14 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
     }
 }
 
+- (void)setSubTileSize:(int)subTileSize
+{
+    _subTileSize = subTileSize;
+    // The grid moved, so the next render has to be a full one
+    renderedMbr = -1;
+    somethingChanged = true;
+}
+
 - (void)imageRenderImmediate
 {
 //    NSLog(@"Render:: Immediate");
@@ -312,16 +350,75 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
         }
         
         NSMutableArray *images = [NSMutableArray array];
-        
+
         CGSize texSize = [self calculateSize];
 //        NSLog(@"Tex Size = (%f,%f)",texSize.width,texSize.height);
-        
+
+        // If we've still got the canvases from last time and nothing
+        //  structural changed, we can redraw just the dirty area
+        bool incremental = renderContexts.size() == _numImages &&
+            CGSizeEqualToSize(renderSize,texSize) && renderedMbr == whichMbr && deep <= 0;
+
+        if (!incremental)
+        {
+            // Toss the old canvases and start over
+            for (unsigned int ii=0;ii<renderContexts.size();ii++)
+                CGContextRelease(renderContexts[ii]);
+            renderContexts.clear();
+            CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+            for (unsigned int ii=0;ii<_numImages;ii++)
+                renderContexts.push_back(CGBitmapContextCreate(NULL, texSize.width, texSize.height, 8, texSize.width * 4, colorSpace, kCGImageAlphaPremultipliedLast));
+            CGColorSpaceRelease(colorSpace);
+            renderSize = texSize;
+            renderedMbr = whichMbr;
+        }
+
+        // Work out which chunks of the canvas we're redrawing
+        Mbr drawMbr = dirtyMbr;
+        CGRect fullRect = CGRectMake(0, 0, texSize.width, texSize.height);
+        CGRect dirtyRects[2];
+        int numDirtyRects = 0;
+        if (incremental)
+        {
+            if (drawMbr.valid())
+            {
+                CGRect dirtyRect = [self canvasRectForMbr:drawMbr mbr:mbr texSize:texSize];
+                if (!CGRectIsEmpty(dirtyRect))
+                    dirtyRects[numDirtyRects++] = dirtyRect;
+                if (testMbrs.size() > 1)
+                {
+                    // The canvas wraps, so the dirty area can show up shifted too
+                    Mbr shiftMbr = drawMbr;
+                    shiftMbr.ll().x() += 2*M_PI;
+                    shiftMbr.ur().x() += 2*M_PI;
+                    dirtyRect = [self canvasRectForMbr:shiftMbr mbr:mbr texSize:texSize];
+                    if (!CGRectIsEmpty(dirtyRect))
+                        dirtyRects[numDirtyRects++] = dirtyRect;
+                }
+            }
+
+            // Nothing touched the canvas, so there's no reason to hand out a new image
+            if (numDirtyRects == 0)
+            {
+                dirtyMbr.reset();
+                somethingChanged = false;
+                return;
+            }
+        }
+
         // Draw each entry in the image stack individually
-        CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
-        CGContextRef theContext = CGBitmapContextCreate(NULL, texSize.width, texSize.height, 8, texSize.width * 4, colorSpace, kCGImageAlphaPremultipliedLast);
         int numRenderedTiles = 0;
         for (unsigned int ii=0;ii<_numImages;ii++)
         {
+            CGContextRef theContext = renderContexts[ii];
+            if (incremental)
+            {
+                // Only touch the parts of the canvas that changed
+                CGContextSaveGState(theContext);
+                CGContextClipToRects(theContext, dirtyRects, numDirtyRects);
+                for (int ri=0;ri<numDirtyRects;ri++)
+                    CGContextClearRect(theContext, dirtyRects[ri]);
+            }
             // Note: This draws the background in red.  Useful for seeing what doesn't get filled
 //            CGContextSetRGBFillColor(theContext, 1, 0, 0, 1);
 //            CGContextFillRect(theContext, CGRectMake(0, 0, texSize.width, texSize.height));
@@ -331,8 +428,8 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
                 // If this happens, they've changed the MBR while we were working on this one.  Punt.
                 if (whichMbr != currentMbr)
                 {
-                    CGContextRelease(theContext);
-                    CGColorSpaceRelease(colorSpace);
+                    if (incremental)
+                        CGContextRestoreGState(theContext);
 //                    NSLog(@"Aborted render");
                     return;
                 }
@@ -342,10 +439,13 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
                     continue;
                 if (deep > 0 && tile->ident.level > deep)
                     continue;
-                
+
                 // Scale the extents to the output image
                 Mbr tileMbr[2];
                 tileMbr[0] = _quadLayer.quadtree->generateMbrForNode(tile->ident);
+                // In incremental mode only the tiles touching the dirty area matter
+                if (incremental && !tileMbr[0].overlaps(drawMbr))
+                    continue;
                 bool overlaps = tileMbr[0].overlaps(testMbrs[0]);
                 if (testMbrs.size() > 1 && !overlaps)
                 {
@@ -397,32 +497,88 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
                 }
                 numRenderedTiles++;
             }
-            
+
+            if (incremental)
+                CGContextRestoreGState(theContext);
+
             CGImageRef imageRef = CGBitmapContextCreateImage(theContext);
             UIImage *image = [UIImage imageWithCGImage:imageRef];
             CGImageRelease(imageRef);
             if (image)
                 [images addObject:image];
         }
-        CGContextRelease(theContext);
-        CGColorSpaceRelease(colorSpace);
-        
+
+        // The canvases are all caught up now
+        dirtyMbr.reset();
+
 //        NSLog(@"Rendered %d tiles of %d",numRenderedTiles,(int)tiles.size());
         
         // Convert the images into OpenGL ES textures
         bool aborted = false;
         ChangeSet changes;
         std::vector<WhirlyKit::SimpleIdentity> texIDs;
-        for (UIImage *image in images)
+        NSMutableArray *subTiles = nil;
+        if (_subTileSize > 0)
         {
-            Texture *tex = new Texture("TileQuadOfflineRenderer",image,true);
-            texIDs.push_back(tex->getId());
-            tex->createInGL(_quadLayer.scene->getMemManager());
-            changes.push_back(new AddTextureReq(tex));
-            if (whichMbr != currentMbr)
+            // Carve the changed area up into cells on a fixed grid, so
+            //  the consumer can patch just those textures in place
+            int numCellX = ((int)texSize.width+_subTileSize-1)/_subTileSize;
+            int numCellY = ((int)texSize.height+_subTileSize-1)/_subTileSize;
+            std::set<std::pair<int,int> > gridCells;
+            if (incremental)
             {
-                aborted = true;
-                break;
+                for (int ri=0;ri<numDirtyRects;ri++)
+                {
+                    const CGRect &rect = dirtyRects[ri];
+                    int cx0 = std::max(0,(int)(CGRectGetMinX(rect)/_subTileSize));
+                    int cy0 = std::max(0,(int)(CGRectGetMinY(rect)/_subTileSize));
+                    int cx1 = std::min(numCellX-1,(int)((CGRectGetMaxX(rect)-1)/_subTileSize));
+                    int cy1 = std::min(numCellY-1,(int)((CGRectGetMaxY(rect)-1)/_subTileSize));
+                    for (int cy=cy0;cy<=cy1;cy++)
+                        for (int cx=cx0;cx<=cx1;cx++)
+                            gridCells.insert(std::pair<int,int>(cx,cy));
+                }
+            } else {
+                // Full render, so every cell goes out
+                for (int cy=0;cy<numCellY;cy++)
+                    for (int cx=0;cx<numCellX;cx++)
+                        gridCells.insert(std::pair<int,int>(cx,cy));
+            }
+
+            subTiles = [NSMutableArray array];
+            for (std::set<std::pair<int,int> >::iterator it = gridCells.begin();it != gridCells.end() && !aborted;++it)
+            {
+                WhirlyKitQuadTileOfflineSubTile *subTile = [[WhirlyKitQuadTileOfflineSubTile alloc] init];
+                subTile->gridX = it->first;
+                subTile->gridY = it->second;
+                subTile->rect = CGRectIntersection(CGRectMake(it->first*_subTileSize, it->second*_subTileSize, _subTileSize, _subTileSize),fullRect);
+                for (UIImage *image in images)
+                {
+                    // The crop shares the canvas data, so this is cheap
+                    CGImageRef cellRef = CGImageCreateWithImageInRect(image.CGImage, subTile->rect);
+                    UIImage *cellImage = [UIImage imageWithCGImage:cellRef];
+                    CGImageRelease(cellRef);
+                    Texture *tex = new Texture("TileQuadOfflineRenderer",cellImage,true);
+                    subTile->textures.push_back(tex->getId());
+                    tex->createInGL(_quadLayer.scene->getMemManager());
+                    changes.push_back(new AddTextureReq(tex));
+                }
+                [subTiles addObject:subTile];
+                if (whichMbr != currentMbr)
+                    aborted = true;
+            }
+        } else {
+            for (UIImage *image in images)
+            {
+                Texture *tex = new Texture("TileQuadOfflineRenderer",image,true);
+                texIDs.push_back(tex->getId());
+                tex->createInGL(_quadLayer.scene->getMemManager());
+                changes.push_back(new AddTextureReq(tex));
+                if (whichMbr != currentMbr)
+                {
+                    aborted = true;
+                    break;
+                }
             }
         }
         
@@ -451,16 +607,41 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
         image->cornerSizes[1] = [self pixelSizeForMbr:mbr texSize:texSize texel:CGPointMake(texSize.width, 0.0)];
         image->cornerSizes[2] = [self pixelSizeForMbr:mbr texSize:texSize texel:CGPointMake(texSize.width, texSize.height)];
         image->cornerSizes[3] = [self pixelSizeForMbr:mbr texSize:texSize texel:CGPointMake(0.0, texSize.height)];
+        CGRect updatedRect = fullRect;
+        if (incremental)
+        {
+            updatedRect = dirtyRects[0];
+            for (int ri=1;ri<numDirtyRects;ri++)
+                updatedRect = CGRectUnion(updatedRect,dirtyRects[ri]);
+        }
+        image.updatedRect = updatedRect;
+        image.subTiles = subTiles;
         [_outputDelegate loader:self image:image];
     }
     
     // If we did a quick render, we need to go back again
     if (deep > 0)
+    {
+        // And the canvas can't be patched up incrementally, since we skipped levels
+        renderedMbr = -1;
         somethingChanged = true;
-    else
+    } else
         somethingChanged = false;
 }
 
+// Convert an area of interest into the corresponding chunk of canvas
+- (CGRect)canvasRectForMbr:(const Mbr &)theMbr mbr:(const Mbr &)mbr texSize:(CGSize)texSize
+{
+    float orgX = texSize.width * (theMbr.ll().x() - mbr.ll().x()) / (mbr.ur().x()-mbr.ll().x());
+    float orgY = texSize.height * (theMbr.ll().y() - mbr.ll().y()) / (mbr.ur().y()-mbr.ll().y());
+    float spanX = texSize.width * (theMbr.ur().x()-theMbr.ll().x()) / (mbr.ur().x()-mbr.ll().x());
+    float spanY = texSize.height * (theMbr.ur().y()-theMbr.ll().y()) / (mbr.ur().y()-mbr.ll().y());
+
+    // A bit of padding for the filtering at the edges
+    return CGRectIntersection(CGRectMake(orgX-1.0, orgY-1.0, spanX+2.0, spanY+2.0),
+                              CGRectMake(0, 0, texSize.width, texSize.height));
+}
+
 // Calculate the real world size of a given pixel
 - (CGSize) pixelSizeForMbr:(Mbr)theMbr texSize:(CGSize)texSize texel:(CGPoint)texel
 {
@@ -525,7 +706,7 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
     
     tiles.insert(newTile);
     
-    [_imageSource quadTileLoader:self startFetchForLevel:tileInfo->ident.level col:tileInfo->ident.x row:tileInfo->ident.y attrs:tileInfo->attrs];
+    [_imageSource quadTileLoader:self startFetchForLevel:tileInfo->ident.level col:tileInfo->ident.x row:tileInfo->ident.y attrs:tileInfo->attrs.dict()];
     numFetches++;
     somethingChanged = true;
 }
@@ -551,6 +732,7 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
         OfflineTile *theTile = *it;
         delete theTile;
         tiles.erase(it);
+        [self addToDirty:tileInfo->ident];
     }
     somethingChanged = true;
 }
@@ -598,6 +780,7 @@ typedef std::set<OfflineTile *,OfflineTileSorter> OfflineTileSet;
 
 //    NSLog(@"Loaded tile %d: (%d,%d)",level,col,row);
     [_quadLayer loader:self tileDidLoad:tileIdent];
+    [self addToDirty:tileIdent];
     somethingChanged = true;
 }
 
@@ -128,7 +128,44 @@ using namespace WhirlyKit;
     }
 	
 	return retData;
-    
+
+}
+
+-(NSData *)rawDataSingleChannelScaleWidth:(unsigned int)destWidth height:(unsigned int)destHeight border:(int)border
+{
+	CGImageRef cgImage = self.CGImage;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+
+	NSMutableData *retData = [NSMutableData dataWithLength:destWidth*destHeight];
+	CGContextRef theContext = CGBitmapContextCreate((void *)[retData bytes], destWidth, destHeight, 8, destWidth, colorSpace, kCGImageAlphaNone);
+	CGContextDrawImage(theContext, CGRectMake((float)border, (float)border, (CGFloat)(destWidth-2*border), (CGFloat)(destWidth-2*border)), cgImage);
+	CGContextRelease(theContext);
+    CGColorSpaceRelease(colorSpace);
+
+    // Copy over the extra pixels
+    unsigned char *buf = (unsigned char *)[retData mutableBytes];
+    if (border > 0)
+    {
+        int ix,iy;
+        // Bottom
+        for (iy=border-1;iy>=0;iy--)
+            for (ix=0;ix<destWidth;ix++)
+            buf[iy*destWidth + ix] = buf[(iy+1)*destWidth + ix];
+        // Top
+        for (iy=destHeight-(1+border);iy<destHeight;iy++)
+        for (ix=0,iy=destHeight-1;ix<destWidth;ix++)
+            buf[iy*destWidth + ix] = buf[(iy-1)*destWidth + ix];
+        // Left
+        for (ix=border-1;ix>=0;ix--)
+            for (iy=0;iy<destHeight;iy++)
+            buf[iy*destWidth + ix] = buf[iy*destWidth + (ix+1)];
+        // Right
+        for (ix=destWidth-(1+border);ix<destWidth;ix++)
+            for (iy=0;iy<destHeight;iy++)
+            buf[iy*destWidth + ix] = buf[iy*destWidth + (ix-1)];
+    }
+
+	return retData;
 }
 
 
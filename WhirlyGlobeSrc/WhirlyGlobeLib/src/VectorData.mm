@@ -19,6 +19,11 @@
  */
 
 #import <string>
+#import <queue>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
 #import "VectorData.h"
 #import "ShapeReader.h"
 #import "libjson.h"
@@ -187,23 +192,204 @@ void SubdivideEdgesToSurfaceGC(const VectorRing &inPts,std::vector<Point3f> &out
     }    
 }
 
-    
+
+// Triangle area helper for the simplification
+static float TriArea(const Point2f &a,const Point2f &b,const Point2f &c)
+{
+    return std::abs((b.x()-a.x())*(c.y()-a.y()) - (c.x()-a.x())*(b.y()-a.y()))/2.0;
+}
+
+void VectorRankPoints(const VectorRing &ring,bool closed,VectorRanks &ranks)
+{
+    int numPts = (int)ring.size();
+    ranks.assign(numPts,MAXFLOAT);
+    if (numPts < 3)
+        return;
+
+    // Doubly linked list over the surviving points
+    std::vector<int> prevPt(numPts),nextPt(numPts);
+    for (int ii=0;ii<numPts;ii++)
+    {
+        prevPt[ii] = ii-1;
+        nextPt[ii] = ii+1;
+    }
+    if (closed)
+    {
+        prevPt[0] = numPts-1;
+        nextPt[numPts-1] = 0;
+    } else {
+        prevPt[0] = -1;
+        nextPt[numPts-1] = -1;
+    }
+
+    // Min heap of (effective area,point).  Stale entries are just skipped.
+    typedef std::pair<float,int> AreaEntry;
+    std::priority_queue<AreaEntry,std::vector<AreaEntry>,std::greater<AreaEntry> > minHeap;
+    std::vector<float> curArea(numPts,MAXFLOAT);
+    for (int ii=0;ii<numPts;ii++)
+        if (prevPt[ii] >= 0 && nextPt[ii] >= 0)
+        {
+            curArea[ii] = TriArea(ring[prevPt[ii]],ring[ii],ring[nextPt[ii]]);
+            minHeap.push(AreaEntry(curArea[ii],ii));
+        }
+
+    float maxSoFar = 0.0;
+    int numLeft = numPts;
+    int minLeft = closed ? 3 : 2;
+    while (!minHeap.empty() && numLeft > minLeft)
+    {
+        AreaEntry entry = minHeap.top();
+        minHeap.pop();
+        int ii = entry.second;
+        // Already gone, or the area has been recomputed since
+        if (ranks[ii] != MAXFLOAT || entry.first != curArea[ii])
+            continue;
+
+        // Force the areas monotonic so the subsets nest
+        maxSoFar = std::max(maxSoFar,entry.first);
+        ranks[ii] = maxSoFar;
+        numLeft--;
+
+        // Unlink the point and rescore the neighbors
+        int pi = prevPt[ii], ni = nextPt[ii];
+        if (pi >= 0)
+            nextPt[pi] = ni;
+        if (ni >= 0)
+            prevPt[ni] = pi;
+        if (pi >= 0 && ranks[pi] == MAXFLOAT && prevPt[pi] >= 0 && nextPt[pi] >= 0)
+        {
+            curArea[pi] = TriArea(ring[prevPt[pi]],ring[pi],ring[nextPt[pi]]);
+            minHeap.push(AreaEntry(curArea[pi],pi));
+        }
+        if (ni >= 0 && ranks[ni] == MAXFLOAT && prevPt[ni] >= 0 && nextPt[ni] >= 0)
+        {
+            curArea[ni] = TriArea(ring[prevPt[ni]],ring[ni],ring[nextPt[ni]]);
+            minHeap.push(AreaEntry(curArea[ni],ni));
+        }
+    }
+}
+
+void VectorSimplify(const VectorRing &ring,const VectorRanks &ranks,float minArea,VectorRing &outPts)
+{
+    // Mismatched ranks mean someone changed the geometry.  Punt.
+    if (ranks.size() != ring.size())
+    {
+        outPts = ring;
+        return;
+    }
+
+    for (unsigned int ii=0;ii<ring.size();ii++)
+        if (ranks[ii] >= minArea)
+            outPts.push_back(ring[ii]);
+}
+
+VectorAttrStore::VectorAttrStore()
+{
+    keyMap = nil;
+}
+
+int VectorAttrStore::getAddKey(NSString *key)
+{
+    if (!keyMap)
+        keyMap = [NSMutableDictionary dictionary];
+    NSNumber *which = keyMap[key];
+    if (which)
+        return [which intValue];
+    int idx = (int)keys.size();
+    keys.push_back(key);
+    keyMap[key] = @(idx);
+    return idx;
+}
+
+NSString *VectorAttrStore::getKey(int which)
+{
+    if (which < 0 || which >= keys.size())
+        return nil;
+    return keys[which];
+}
+
+int VectorAttrStore::addRow(NSDictionary *dict)
+{
+    AttrRow row;
+    row.reserve([dict count]);
+    for (NSString *key in dict)
+        row.push_back(AttrEntry(getAddKey(key),dict[key]));
+    rows.push_back(row);
+    return (int)rows.size()-1;
+}
+
+const VectorAttrStore::AttrRow &VectorAttrStore::getRow(int which)
+{
+    static AttrRow emptyRow;
+    if (which < 0 || which >= rows.size())
+        return emptyRow;
+    return rows[which];
+}
+
+NSMutableDictionary *VectorAttrStore::makeDictionary(int which)
+{
+    NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+    const AttrRow &row = getRow(which);
+    for (unsigned int ii=0;ii<row.size();ii++)
+        dict[keys[row[ii].first]] = row[ii].second;
+    return dict;
+}
+
 VectorShape::VectorShape()
 {
     attrDict = nil;
+    lazyAttrData = nil;
+    attrRow = -1;
 }
-   
+
 VectorShape::~VectorShape()
 {
 }
-    
+
 void VectorShape::setAttrDict(NSMutableDictionary *newDict)
-{ 
-    attrDict = newDict;  
+{
+    attrDict = newDict;
+    lazyAttrData = nil;
+    attrStore.reset();
 }
-    
-NSMutableDictionary *VectorShape::getAttrDict()    
+
+void VectorShape::setLazyAttrData(NSData *attrData)
+{
+    lazyAttrData = attrData;
+    attrDict = nil;
+    attrStore.reset();
+}
+
+void VectorShape::setAttrStore(VectorAttrStoreRef store,int row)
+{
+    attrStore = store;
+    attrRow = row;
+    attrDict = nil;
+    lazyAttrData = nil;
+}
+
+VectorAttrStore *VectorShape::getAttrStore(int &row)
+{
+    if (attrDict || !attrStore)
+        return NULL;
+    row = attrRow;
+    return attrStore.get();
+}
+
+NSMutableDictionary *VectorShape::getAttrDict()
 {
+    // Put off the unarchive until someone actually wants the attributes
+    if (!attrDict && lazyAttrData)
+    {
+        attrDict = (NSMutableDictionary *)[NSKeyedUnarchiver unarchiveObjectWithData:lazyAttrData];
+        lazyAttrData = nil;
+    }
+    // Copy on write out of the interned store
+    if (!attrDict && attrStore)
+    {
+        attrDict = attrStore->makeDictionary(attrRow);
+        attrStore.reset();
+    }
     return attrDict;
 }
     
@@ -266,6 +452,7 @@ void VectorTriangles::initGeoMbr()
 }
     
 VectorAreal::VectorAreal()
+    : cachedTessEps(0.0)
 {
 }
     
@@ -283,11 +470,22 @@ bool VectorAreal::pointInside(GeoCoord coord)
 {
     if (geoMbr.inside(coord))
     {
+        // Build the per loop bounding boxes the first time through
+        if (loopMbrs.size() != loops.size())
+        {
+            loopMbrs.resize(loops.size());
+            for (unsigned int ii=0;ii<loops.size();ii++)
+            {
+                loopMbrs[ii] = Mbr();
+                loopMbrs[ii].addPoints(loops[ii]);
+            }
+        }
+
         for (unsigned int ii=0;ii<loops.size();ii++)
-            if (PointInPolygon(coord,loops[ii]))
+            if (loopMbrs[ii].insideOrOnEdge(coord) && PointInPolygon(coord,loops[ii]))
                 return true;
     }
-    
+
     return false;
 }
     
@@ -312,6 +510,8 @@ void VectorAreal::subdivide(float maxLen)
         SubdivideEdges(loops[ii], newPts, true, maxLen);
         loops[ii] = newPts;
     }
+    // The loops changed, so the cached hit test boxes are stale
+    loopMbrs.clear();
 }
 
 VectorLinear::VectorLinear()
@@ -606,222 +806,1277 @@ bool VectorReadFile(const std::string &fileName,ShapeSet &shapes)
     return true;
 }
 
+/* Second generation vector file format, laid out for memory mapping.
+   All fields are 32 bit and native endian:
+     magic, version, feature count, attribute table offset
+     per-feature record offsets
+     feature records:  type, attribute offset (relative to the attribute
+       table), attribute length, then the geometry as counts followed by
+       raw point arrays
+     attribute table:  concatenated NSKeyedArchiver blobs
+   Everything ahead of the attribute table stays 4 byte aligned, so a
+    reader can point right at the arrays in the mapped region.
+ */
+static const unsigned int VectorMapFileMagic = 0x5747766d;
+static const unsigned int VectorMapFileVersion = 1;
 
-// Parse a single coordinate out of an array
-bool VectorParseCoord(Point2f &coord,NSArray *coords)
-{
-    if (![coords isKindOfClass:[NSArray class]] || ([coords count] != 2 && [coords count] != 3))
-        return false;
-    coord.x() = DegToRad([[coords objectAtIndex:0] floatValue]);
-    coord.y() = DegToRad([[coords objectAtIndex:1] floatValue]);
-    
-    return true;
-}
-    
-// Parse coordinates out of a coordinate string
-bool VectorParseCoords(VectorRing &coords,NSArray *coordArray)
+bool VectorWriteMapFile(const std::string &fileName,ShapeSet &shapes)
 {
-    if (![coordArray isKindOfClass:[NSArray class]])
+    FILE *fp = fopen(fileName.c_str(),"w");
+    if (!fp)
         return false;
-    
-    // Look at the type of the first object.  If it's not an array, we've got a coord.
-    NSObject *firstObj = [coordArray objectAtIndex:0];
-    if (![firstObj isKindOfClass:[NSArray class]])
-    {
-        coords.resize(1);
-        if (!VectorParseCoord(coords[0], coordArray))
-            return false;
-    } else {
-        coords.resize([coordArray count]);
-        int ci = 0;
-        for (NSArray *coord in coordArray)
+
+    NSMutableData *attrTable = [NSMutableData data];
+    std::vector<unsigned int> featureOffsets;
+    featureOffsets.reserve(shapes.size());
+
+    try {
+        unsigned int header[4];
+        header[0] = VectorMapFileMagic;
+        header[1] = VectorMapFileVersion;
+        header[2] = (unsigned int)shapes.size();
+        header[3] = 0;  // Attribute table offset, filled in at the end
+        if (fwrite(header,sizeof(unsigned int),4,fp) != 4)
+            throw 1;
+
+        // Placeholder for the offset table
+        std::vector<unsigned int> offsetTable(shapes.size(),0);
+        if (!offsetTable.empty())
+            if (fwrite(&offsetTable[0],sizeof(unsigned int),offsetTable.size(),fp) != offsetTable.size())
+                throw 1;
+
+        for (ShapeSet::iterator it = shapes.begin(); it != shapes.end(); ++it)
         {
-            if (!VectorParseCoord(coords[ci], coord))
-                return false;
-            ci++;
+            VectorShapeRef shape = *it;
+            featureOffsets.push_back((unsigned int)ftell(fp));
+
+            // Attributes pile up in the side table
+            unsigned int attrOffset = 0,attrLen = 0;
+            NSDictionary *dict = shape->getAttrDict();
+            if (dict)
+            {
+                NSData *dictData = [NSKeyedArchiver archivedDataWithRootObject:dict];
+                attrOffset = (unsigned int)[attrTable length];
+                attrLen = (unsigned int)[dictData length];
+                [attrTable appendData:dictData];
+            }
+
+            VectorPointsRef pts = boost::dynamic_pointer_cast<VectorPoints>(shape);
+            VectorLinearRef lin = boost::dynamic_pointer_cast<VectorLinear>(shape);
+            VectorArealRef ar = boost::dynamic_pointer_cast<VectorAreal>(shape);
+            VectorTrianglesRef mesh = boost::dynamic_pointer_cast<VectorTriangles>(shape);
+            unsigned int dataType;
+            if (pts.get())
+                dataType = FileVecPoints;
+            else if (lin.get())
+                dataType = FileVecLinear;
+            else if (ar.get())
+                dataType = FileVecAreal;
+            else if (mesh.get())
+                dataType = FileVecMesh;
+            else {
+                NSLog(@"Tried to write unknown object in VectorWriteMapFile");
+                throw 1;
+            }
+
+            unsigned int rec[3];
+            rec[0] = dataType;  rec[1] = attrOffset;  rec[2] = attrLen;
+            if (fwrite(rec,sizeof(unsigned int),3,fp) != 3)
+                throw 1;
+
+            if (pts.get())
+            {
+                unsigned int numPts = (unsigned int)pts->pts.size();
+                if (fwrite(&numPts,sizeof(unsigned int),1,fp) != 1)
+                    throw 1;
+                if (fwrite(&pts->pts[0],2*sizeof(float),numPts,fp) != numPts)
+                    throw 1;
+            } else if (lin.get())
+            {
+                unsigned int numPts = (unsigned int)lin->pts.size();
+                if (fwrite(&numPts,sizeof(unsigned int),1,fp) != 1)
+                    throw 1;
+                if (fwrite(&lin->pts[0],2*sizeof(float),numPts,fp) != numPts)
+                    throw 1;
+            } else if (ar.get())
+            {
+                unsigned int numLoops = (unsigned int)ar->loops.size();
+                if (fwrite(&numLoops,sizeof(unsigned int),1,fp) != 1)
+                    throw 1;
+                for (unsigned int ii=0;ii<numLoops;ii++)
+                {
+                    VectorRing &ring = ar->loops[ii];
+                    unsigned int numPts = (unsigned int)ring.size();
+                    if (fwrite(&numPts,sizeof(unsigned int),1,fp) != 1)
+                        throw 1;
+                    if (fwrite(&ring[0],2*sizeof(float),numPts,fp) != numPts)
+                        throw 1;
+                }
+            } else {
+                unsigned int numPts = (unsigned int)mesh->pts.size();
+                if (fwrite(&numPts,sizeof(unsigned int),1,fp) != 1)
+                    throw 1;
+                if (fwrite(&mesh->pts[0],3*sizeof(float),numPts,fp) != numPts)
+                    throw 1;
+
+                unsigned int numTri = (unsigned int)mesh->tris.size();
+                if (fwrite(&numTri,sizeof(unsigned int),1,fp) != 1)
+                    throw 1;
+                if (fwrite(&mesh->tris[0],3*sizeof(unsigned int),numTri,fp) != numTri)
+                    throw 1;
+            }
         }
+
+        // Attribute table brings up the rear
+        header[3] = (unsigned int)ftell(fp);
+        if ([attrTable length] > 0)
+            if (fwrite([attrTable bytes],[attrTable length],1,fp) != 1)
+                throw 1;
+
+        // Now that we know where everything went, rewrite the front
+        if (fseek(fp,0,SEEK_SET))
+            throw 1;
+        if (fwrite(header,sizeof(unsigned int),4,fp) != 4)
+            throw 1;
+        if (!featureOffsets.empty())
+            if (fwrite(&featureOffsets[0],sizeof(unsigned int),featureOffsets.size(),fp) != featureOffsets.size())
+                throw 1;
     }
-    
+    catch (...)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
     return true;
 }
 
-// Parse geometry objects out of the JSON
-bool VectorParseGeometry(ShapeSet &shapes,NSDictionary *jsonDict)
+// Pull a counted array out of the mapped region, checking that it fits
+static bool MapFileArray(const unsigned char *&at,const unsigned char *end,size_t structSize,unsigned int &count,const unsigned char *&arr)
 {
-    NSString *type = [jsonDict objectForKey:@"type"];
-    if (![type isKindOfClass:[NSString class]])
+    if ((size_t)(end - at) < sizeof(unsigned int))
         return false;
+    count = *(const unsigned int *)at;
+    at += sizeof(unsigned int);
+    if ((size_t)count*structSize > (size_t)(end - at))
+        return false;
+    arr = at;
+    at += (size_t)count*structSize;
+    return true;
+}
 
-    if (![type compare:@"Point"])
-    {
-        VectorRing coords;
-        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
-            return false;
-        if (coords.size() != 1)
-            return false;
-        VectorPointsRef pts = VectorPoints::createPoints();
-        pts->pts.push_back(coords[0]);
-        pts->initGeoMbr();
-        shapes.insert(pts);
-    } else if (![type compare:@"LineString"])
-    {
-        VectorRing coords;
-        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
-            return false;
-        if (coords.empty())
-            return false;
-        VectorLinearRef lin = VectorLinear::createLinear();
-        lin->pts = coords;
-        lin->initGeoMbr();
-        shapes.insert(lin);
-    } else if (![type compare:@"Polygon"])
+bool VectorReadMapFile(const std::string &fileName,ShapeSet &shapes)
+{
+    int fd = open(fileName.c_str(),O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat statBuf;
+    if (fstat(fd,&statBuf) || statBuf.st_size < (off_t)(4*sizeof(unsigned int)))
     {
-        NSArray *coordsArray = [jsonDict objectForKey:@"coordinates"];
-        if (![coordsArray isKindOfClass:[NSArray class]])
-            return false;
-        VectorArealRef ar = VectorAreal::createAreal();
-        for (NSArray *coordsEntry in coordsArray)
+        close(fd);
+        return false;
+    }
+    size_t fileLen = (size_t)statBuf.st_size;
+    const unsigned char *baseAddr = (const unsigned char *)mmap(NULL,fileLen,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (baseAddr == MAP_FAILED)
+        return false;
+
+    try {
+        const unsigned int *header = (const unsigned int *)baseAddr;
+        if (header[0] != VectorMapFileMagic || header[1] != VectorMapFileVersion)
+            throw 1;
+        unsigned int numFeatures = header[2];
+        unsigned int attrBase = header[3];
+        if (attrBase > fileLen)
+            throw 1;
+        if ((4+(size_t)numFeatures)*sizeof(unsigned int) > fileLen)
+            throw 1;
+        const unsigned int *featureOffsets = header+4;
+        // Geometry lives between the offset table and the attribute table
+        const unsigned char *geomEnd = baseAddr + attrBase;
+
+        for (unsigned int ii=0;ii<numFeatures;ii++)
         {
-            VectorRing coords;
-            if (!VectorParseCoords(coords, coordsEntry))
-                return false;
-            if (coords.empty())
-                return false;
-            ar->loops.push_back(coords);
-        }
-        ar->initGeoMbr();
-        shapes.insert(ar);
-    } else if (![type compare:@"MultiPoint"])
-    {
-        VectorRing coords;
-        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
-            return false;
-        if (coords.empty())
-            return false;
-        VectorPointsRef pts = VectorPoints::createPoints();
+            unsigned int offset = featureOffsets[ii];
+            if (offset > attrBase || attrBase - offset < 3*sizeof(unsigned int))
+                throw 1;
+            const unsigned int *rec = (const unsigned int *)(baseAddr + offset);
+            unsigned int dataType = rec[0],attrOffset = rec[1],attrLen = rec[2];
+
+            // The archived attributes are small next to the geometry, so we
+            //  copy them out, but the unarchive waits for the first lookup
+            NSData *attrData = nil;
+            if (attrLen > 0)
+            {
+                if (attrOffset > fileLen - attrBase || attrLen > fileLen - attrBase - attrOffset)
+                    throw 1;
+                attrData = [NSData dataWithBytes:baseAddr+attrBase+attrOffset length:attrLen];
+            }
+
+            const unsigned char *at = (const unsigned char *)(rec+3);
+            switch (dataType)
+            {
+                case FileVecPoints:
+                {
+                    VectorPointsRef pts(VectorPoints::createPoints());
+                    pts->setLazyAttrData(attrData);
+
+                    unsigned int numPts;
+                    const unsigned char *arr;
+                    if (!MapFileArray(at,geomEnd,2*sizeof(float),numPts,arr))
+                        throw 1;
+                    pts->pts.assign((const Point2f *)arr,(const Point2f *)arr + numPts);
+
+                    pts->initGeoMbr();
+                    shapes.insert(pts);
+                }
+                    break;
+                case FileVecLinear:
+                {
+                    VectorLinearRef lin(VectorLinear::createLinear());
+                    lin->setLazyAttrData(attrData);
+
+                    unsigned int numPts;
+                    const unsigned char *arr;
+                    if (!MapFileArray(at,geomEnd,2*sizeof(float),numPts,arr))
+                        throw 1;
+                    lin->pts.assign((const Point2f *)arr,(const Point2f *)arr + numPts);
+
+                    lin->initGeoMbr();
+                    shapes.insert(lin);
+                }
+                    break;
+                case FileVecAreal:
+                {
+                    VectorArealRef ar(VectorAreal::createAreal());
+                    ar->setLazyAttrData(attrData);
+
+                    if ((size_t)(geomEnd - at) < sizeof(unsigned int))
+                        throw 1;
+                    unsigned int numLoops = *(const unsigned int *)at;
+                    at += sizeof(unsigned int);
+                    ar->loops.resize(numLoops);
+
+                    for (unsigned int jj=0;jj<numLoops;jj++)
+                    {
+                        unsigned int numPts;
+                        const unsigned char *arr;
+                        if (!MapFileArray(at,geomEnd,2*sizeof(float),numPts,arr))
+                            throw 1;
+                        ar->loops[jj].assign((const Point2f *)arr,(const Point2f *)arr + numPts);
+                    }
+
+                    ar->initGeoMbr();
+                    shapes.insert(ar);
+                }
+                    break;
+                case FileVecMesh:
+                {
+                    VectorTrianglesRef mesh(VectorTriangles::createTriangles());
+                    mesh->setLazyAttrData(attrData);
+
+                    unsigned int numPts;
+                    const unsigned char *arr;
+                    if (!MapFileArray(at,geomEnd,3*sizeof(float),numPts,arr))
+                        throw 1;
+                    mesh->pts.assign((const Point3f *)arr,(const Point3f *)arr + numPts);
+
+                    unsigned int numTri;
+                    if (!MapFileArray(at,geomEnd,3*sizeof(unsigned int),numTri,arr))
+                        throw 1;
+                    mesh->tris.assign((const VectorTriangles::Triangle *)arr,(const VectorTriangles::Triangle *)arr + numTri);
+
+                    mesh->initGeoMbr();
+                    shapes.insert(mesh);
+                }
+                    break;
+                default:
+                    NSLog(@"Unknown data type in VectorReadMapFile()");
+                    throw 1;
+                    break;
+            }
+        }
+    }
+    catch (...)
+    {
+        munmap((void *)baseAddr,fileLen);
+        return false;
+    }
+
+    munmap((void *)baseAddr,fileLen);
+    return true;
+}
+
+
+// Parse a single coordinate out of an array
+bool VectorParseCoord(Point2f &coord,NSArray *coords)
+{
+    if (![coords isKindOfClass:[NSArray class]] || ([coords count] != 2 && [coords count] != 3))
+        return false;
+    coord.x() = DegToRad([[coords objectAtIndex:0] floatValue]);
+    coord.y() = DegToRad([[coords objectAtIndex:1] floatValue]);
+    
+    return true;
+}
+    
+// Parse coordinates out of a coordinate string
+bool VectorParseCoords(VectorRing &coords,NSArray *coordArray)
+{
+    if (![coordArray isKindOfClass:[NSArray class]])
+        return false;
+    
+    // Look at the type of the first object.  If it's not an array, we've got a coord.
+    NSObject *firstObj = [coordArray objectAtIndex:0];
+    if (![firstObj isKindOfClass:[NSArray class]])
+    {
+        coords.resize(1);
+        if (!VectorParseCoord(coords[0], coordArray))
+            return false;
+    } else {
+        coords.resize([coordArray count]);
+        int ci = 0;
+        for (NSArray *coord in coordArray)
+        {
+            if (!VectorParseCoord(coords[ci], coord))
+                return false;
+            ci++;
+        }
+    }
+    
+    return true;
+}
+
+// Parse geometry objects out of the JSON
+bool VectorParseGeometry(ShapeSet &shapes,NSDictionary *jsonDict)
+{
+    NSString *type = [jsonDict objectForKey:@"type"];
+    if (![type isKindOfClass:[NSString class]])
+        return false;
+
+    if (![type compare:@"Point"])
+    {
+        VectorRing coords;
+        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
+            return false;
+        if (coords.size() != 1)
+            return false;
+        VectorPointsRef pts = VectorPoints::createPoints();
+        pts->pts.push_back(coords[0]);
+        pts->initGeoMbr();
+        shapes.insert(pts);
+    } else if (![type compare:@"LineString"])
+    {
+        VectorRing coords;
+        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
+            return false;
+        if (coords.empty())
+            return false;
+        VectorLinearRef lin = VectorLinear::createLinear();
+        lin->pts = coords;
+        lin->initGeoMbr();
+        shapes.insert(lin);
+    } else if (![type compare:@"Polygon"])
+    {
+        NSArray *coordsArray = [jsonDict objectForKey:@"coordinates"];
+        if (![coordsArray isKindOfClass:[NSArray class]])
+            return false;
+        VectorArealRef ar = VectorAreal::createAreal();
+        for (NSArray *coordsEntry in coordsArray)
+        {
+            VectorRing coords;
+            if (!VectorParseCoords(coords, coordsEntry))
+                return false;
+            if (coords.empty())
+                return false;
+            ar->loops.push_back(coords);
+        }
+        ar->initGeoMbr();
+        shapes.insert(ar);
+    } else if (![type compare:@"MultiPoint"])
+    {
+        VectorRing coords;
+        if (!VectorParseCoords(coords,[jsonDict objectForKey:@"coordinates"]))
+            return false;
+        if (coords.empty())
+            return false;
+        VectorPointsRef pts = VectorPoints::createPoints();
         pts->pts = coords;
         pts->initGeoMbr();
         shapes.insert(pts);
-    } else if (![type compare:@"MultiLineString"])
+    } else if (![type compare:@"MultiLineString"])
+    {
+        NSArray *coordsArray = [jsonDict objectForKey:@"coordinates"];
+        if (![coordsArray isKindOfClass:[NSArray class]])
+            return false;
+        for (NSArray *coordsEntry in coordsArray)
+        {
+            VectorRing coords;
+            if (!VectorParseCoords(coords, coordsEntry) || coords.empty())
+                return false;
+            VectorLinearRef lin = VectorLinear::createLinear();
+            lin->pts = coords;
+            lin->initGeoMbr();
+            shapes.insert(lin);
+        }
+    } else if (![type compare:@"MultiPolygon"])
+    {
+        NSArray *polyArray = [jsonDict objectForKey:@"coordinates"];
+        if (![polyArray isKindOfClass:[NSArray class]])
+            return false;
+        for (NSArray *polyEntry in polyArray)
+        {
+            if ([polyEntry isKindOfClass:[NSArray class]])
+            {
+                VectorArealRef ar = VectorAreal::createAreal();
+                for (NSArray *coordsEntry in polyEntry)
+                {
+                    VectorRing coords;
+                    if (!VectorParseCoords(coords, coordsEntry) || coords.empty())
+                        return false;
+                    ar->loops.push_back(coords);
+                }
+                ar->initGeoMbr();
+                shapes.insert(ar);                
+            } else
+                return false;
+        }
+    } else if (![type compare:@"GeometryCollection"])
+    {
+        // Recurse down for the other geometry
+        NSArray *geom = [jsonDict objectForKey:@"geometries"];
+        if (![geom isKindOfClass:[NSArray class]])
+            return false;
+        for (NSDictionary *geomDict in geom)
+        {
+            if (![geomDict isKindOfClass:[NSDictionary class]])
+                return false;
+            if (!VectorParseGeometry(shapes, geomDict))
+                return false;
+        }
+    } else
+        return false;
+    
+    return true;
+}
+    
+// Parse a single feature out of geoJSON
+bool VectorParseFeature(ShapeSet &shapes,NSDictionary *jsonDict,VectorAttrStoreRef &attrStore)
+{
+    NSString *idStr = [jsonDict objectForKey:@"id"];
+    NSDictionary *geom = [jsonDict objectForKey:@"geometry"];
+    NSDictionary *prop = [jsonDict objectForKey:@"properties"];
+
+    if (![geom isKindOfClass:[NSDictionary class]])
+        return false;
+
+    // Parse out the geometry.  May result in multiple shapes
+    if (!VectorParseGeometry(shapes, geom))
+        return false;
+
+    // Apply the attributes if there are any.  The feature's shapes share
+    //  one interned row; dictionaries appear copy on write if anyone asks.
+    if ([prop isKindOfClass:[NSDictionary class]])
+    {
+        NSDictionary *attrs = prop;
+        if ([idStr isKindOfClass:[NSString class]])
+        {
+            NSMutableDictionary *withId = [NSMutableDictionary dictionaryWithDictionary:prop];
+            withId[@"id"] = idStr;
+            attrs = withId;
+        }
+        int row = attrStore->addRow(attrs);
+        for (ShapeSet::iterator it = shapes.begin(); it != shapes.end(); ++it)
+            (*it)->setAttrStore(attrStore,row);
+    }
+
+    return true;
+}
+
+// Parse a set of features out of GeoJSON using an NSDictionary
+bool VectorParseGeoJSON(ShapeSet &shapes,NSDictionary *jsonDict)
+{
+    NSString *type = [jsonDict objectForKey:@"type"];
+    if (![type isKindOfClass:[NSString class]])
+        return false;
+
+    // Attribute keys get interned here once for the whole load
+    VectorAttrStoreRef attrStore(new VectorAttrStore());
+
+    if (![type compare:@"FeatureCollection"])
+    {
+        NSArray *features = [jsonDict objectForKey:@"features"];
+        if (![features isKindOfClass:[NSArray class]])
+            return false;
+
+        for (NSDictionary *featDict in features)
+        {
+            if (![featDict isKindOfClass:[NSDictionary class]])
+                return false;
+
+            ShapeSet featShapes;
+            if (VectorParseFeature(featShapes,featDict,attrStore))
+                shapes.insert(featShapes.begin(),featShapes.end());
+            else
+                return false;
+        }
+    } else if (![type compare:@"Feature"]) {
+        ShapeSet featShapes;
+        if (VectorParseFeature(featShapes,jsonDict,attrStore))
+            shapes.insert(featShapes.begin(),featShapes.end());
+        else
+            return false;
+    }
+
+    return true;
+}
+    
+/* Streaming geoJSON parser.
+   Rather than materializing a parse tree for the whole document we walk
+   the raw bytes with a little tokenizer, building shapes one feature at
+   a time and handing them off in batches.  Keeps the memory high water
+   mark at roughly one batch, no matter how big the file is.
+ */
+typedef struct
+{
+    const char *pos;
+    const char *end;
+} JsonScanState;
+
+static void JsonSkipWhite(JsonScanState *scan)
+{
+    while (scan->pos < scan->end)
+    {
+        char c = *scan->pos;
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        scan->pos++;
+    }
+}
+
+// Next meaningful character, without consuming it
+static char JsonPeek(JsonScanState *scan)
+{
+    JsonSkipWhite(scan);
+    return (scan->pos < scan->end) ? *scan->pos : 0;
+}
+
+static bool JsonExpect(JsonScanState *scan,char c)
+{
+    if (JsonPeek(scan) != c)
+        return false;
+    scan->pos++;
+    return true;
+}
+
+// Pull four hex digits off the scan, for the \u escapes
+static bool JsonParseHex4(JsonScanState *scan,unsigned int *code)
+{
+    if (scan->end - scan->pos < 4)
+        return false;
+    *code = 0;
+    for (unsigned int ii=0;ii<4;ii++)
+    {
+        char h = *scan->pos++;
+        *code <<= 4;
+        if (h >= '0' && h <= '9')  *code |= h - '0';
+        else if (h >= 'a' && h <= 'f')  *code |= h - 'a' + 10;
+        else if (h >= 'A' && h <= 'F')  *code |= h - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// Parse a JSON string, dealing with the escapes
+static bool JsonParseString(JsonScanState *scan,std::string &str)
+{
+    if (!JsonExpect(scan,'"'))
+        return false;
+    str.clear();
+    while (scan->pos < scan->end)
+    {
+        char c = *scan->pos++;
+        if (c == '"')
+            return true;
+        if (c == '\\')
+        {
+            if (scan->pos >= scan->end)
+                return false;
+            char esc = *scan->pos++;
+            switch (esc)
+            {
+                case '"':  str.push_back('"');  break;
+                case '\\': str.push_back('\\');  break;
+                case '/':  str.push_back('/');  break;
+                case 'b':  str.push_back('\b');  break;
+                case 'f':  str.push_back('\f');  break;
+                case 'n':  str.push_back('\n');  break;
+                case 'r':  str.push_back('\r');  break;
+                case 't':  str.push_back('\t');  break;
+                case 'u':
+                {
+                    unsigned int code;
+                    if (!JsonParseHex4(scan,&code))
+                        return false;
+                    // Characters outside the BMP arrive as a surrogate
+                    //  pair split across two escapes.  Stitch them back
+                    //  into one code point; encoding the halves on their
+                    //  own makes byte sequences UTF-8 doesn't allow.
+                    if (code >= 0xD800 && code <= 0xDBFF)
+                    {
+                        if (scan->end - scan->pos < 2 || scan->pos[0] != '\\' || scan->pos[1] != 'u')
+                            return false;
+                        scan->pos += 2;
+                        unsigned int low;
+                        if (!JsonParseHex4(scan,&low))
+                            return false;
+                        if (low < 0xDC00 || low > 0xDFFF)
+                            return false;
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    else if (code >= 0xDC00 && code <= 0xDFFF)
+                        // A low surrogate with no high half before it
+                        return false;
+                    // UTF-8 encode it
+                    if (code < 0x80)
+                        str.push_back((char)code);
+                    else if (code < 0x800)
+                    {
+                        str.push_back((char)(0xC0 | (code >> 6)));
+                        str.push_back((char)(0x80 | (code & 0x3F)));
+                    } else if (code < 0x10000)
+                    {
+                        str.push_back((char)(0xE0 | (code >> 12)));
+                        str.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                        str.push_back((char)(0x80 | (code & 0x3F)));
+                    } else {
+                        str.push_back((char)(0xF0 | (code >> 18)));
+                        str.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+                        str.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                        str.push_back((char)(0x80 | (code & 0x3F)));
+                    }
+                }
+                    break;
+                default:
+                    return false;
+            }
+        } else
+            str.push_back(c);
+    }
+    return false;
+}
+
+static bool JsonParseNumber(JsonScanState *scan,double *val)
+{
+    JsonSkipWhite(scan);
+    // The buffer isn't null terminated, so pull the digits out first
+    char numBuf[64];
+    int numLen = 0;
+    const char *p = scan->pos;
+    while (p < scan->end && numLen < 63)
+    {
+        char c = *p;
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')
+        {
+            numBuf[numLen++] = c;
+            p++;
+        } else
+            break;
+    }
+    if (numLen == 0)
+        return false;
+    numBuf[numLen] = 0;
+    *val = strtod(numBuf,NULL);
+    scan->pos = p;
+    return true;
+}
+
+// Skip a value of any type, including whole objects and arrays
+static bool JsonSkipValue(JsonScanState *scan)
+{
+    char c = JsonPeek(scan);
+    switch (c)
+    {
+        case '{':
+        case '[':
+        {
+            char close = (c == '{') ? '}' : ']';
+            scan->pos++;
+            if (JsonPeek(scan) == close)
+            {
+                scan->pos++;
+                return true;
+            }
+            for (;;)
+            {
+                if (c == '{')
+                {
+                    std::string key;
+                    if (!JsonParseString(scan,key) || !JsonExpect(scan,':'))
+                        return false;
+                }
+                if (!JsonSkipValue(scan))
+                    return false;
+                char next = JsonPeek(scan);
+                if (next == ',')
+                {
+                    scan->pos++;
+                    continue;
+                }
+                if (next == close)
+                {
+                    scan->pos++;
+                    return true;
+                }
+                return false;
+            }
+        }
+        case '"':
+        {
+            std::string str;
+            return JsonParseString(scan,str);
+        }
+        case 't':
+            if (scan->end - scan->pos >= 4 && !strncmp(scan->pos,"true",4))
+            {
+                scan->pos += 4;
+                return true;
+            }
+            return false;
+        case 'f':
+            if (scan->end - scan->pos >= 5 && !strncmp(scan->pos,"false",5))
+            {
+                scan->pos += 5;
+                return true;
+            }
+            return false;
+        case 'n':
+            if (scan->end - scan->pos >= 4 && !strncmp(scan->pos,"null",4))
+            {
+                scan->pos += 4;
+                return true;
+            }
+            return false;
+        default:
+        {
+            double val;
+            return JsonParseNumber(scan,val);
+        }
+    }
+}
+
+// A position is an array of numbers.  Lon/lat up front, anything after ignored
+static bool JsonParsePosition(JsonScanState *scan,Point2f &pt)
+{
+    if (!JsonExpect(scan,'['))
+        return false;
+    double nums[2] = {0,0};
+    int numNums = 0;
+    for (;;)
+    {
+        double val;
+        if (!JsonParseNumber(scan,&val))
+            return false;
+        if (numNums < 2)
+            nums[numNums] = val;
+        numNums++;
+        char next = JsonPeek(scan);
+        if (next == ',')
+        {
+            scan->pos++;
+            continue;
+        }
+        if (next == ']')
+        {
+            scan->pos++;
+            break;
+        }
+        return false;
+    }
+    if (numNums < 2)
+        return false;
+    pt = GeoCoord::CoordFromDegrees(nums[0],nums[1]);
+    return true;
+}
+
+// An array of positions, straight into the ring
+static bool JsonParseRing(JsonScanState *scan,VectorRing &pts)
+{
+    if (!JsonExpect(scan,'['))
+        return false;
+    if (JsonPeek(scan) == ']')
+    {
+        scan->pos++;
+        return true;
+    }
+    for (;;)
+    {
+        Point2f pt;
+        if (!JsonParsePosition(scan,pt))
+            return false;
+        pts.push_back(pt);
+        char next = JsonPeek(scan);
+        if (next == ',')
+        {
+            scan->pos++;
+            continue;
+        }
+        if (next == ']')
+        {
+            scan->pos++;
+            return true;
+        }
+        return false;
+    }
+}
+
+static bool JsonParseGeometryObj(JsonScanState *scan,ShapeSet &shapes);
+
+// Parse the coordinates for a known geometry type
+static bool JsonParseCoordinates(JsonScanState *scan,const std::string &type,ShapeSet &shapes)
+{
+    if (type == "Point")
+    {
+        Point2f pt;
+        if (!JsonParsePosition(scan,pt))
+            return false;
+        VectorPointsRef pts = VectorPoints::createPoints();
+        pts->pts.push_back(pt);
+        pts->initGeoMbr();
+        shapes.insert(pts);
+    } else if (type == "LineString")
     {
-        NSArray *coordsArray = [jsonDict objectForKey:@"coordinates"];
-        if (![coordsArray isKindOfClass:[NSArray class]])
+        VectorLinearRef lin = VectorLinear::createLinear();
+        if (!JsonParseRing(scan,lin->pts) || lin->pts.empty())
             return false;
-        for (NSArray *coordsEntry in coordsArray)
-        {
-            VectorRing coords;
-            if (!VectorParseCoords(coords, coordsEntry) || coords.empty())
+        lin->initGeoMbr();
+        shapes.insert(lin);
+    } else if (type == "MultiPoint")
+    {
+        VectorPointsRef pts = VectorPoints::createPoints();
+        if (!JsonParseRing(scan,pts->pts) || pts->pts.empty())
+            return false;
+        pts->initGeoMbr();
+        shapes.insert(pts);
+    } else if (type == "Polygon")
+    {
+        VectorArealRef ar = VectorAreal::createAreal();
+        if (!JsonExpect(scan,'['))
+            return false;
+        if (JsonPeek(scan) == ']')
+            scan->pos++;
+        else
+            for (;;)
+            {
+                ar->loops.resize(ar->loops.size()+1);
+                if (!JsonParseRing(scan,ar->loops.back()) || ar->loops.back().empty())
+                    return false;
+                char next = JsonPeek(scan);
+                if (next == ',')
+                {
+                    scan->pos++;
+                    continue;
+                }
+                if (next == ']')
+                {
+                    scan->pos++;
+                    break;
+                }
                 return false;
+            }
+        ar->initGeoMbr();
+        shapes.insert(ar);
+    } else if (type == "MultiLineString")
+    {
+        if (!JsonExpect(scan,'['))
+            return false;
+        if (JsonPeek(scan) == ']')
+        {
+            scan->pos++;
+            return true;
+        }
+        for (;;)
+        {
             VectorLinearRef lin = VectorLinear::createLinear();
-            lin->pts = coords;
+            if (!JsonParseRing(scan,lin->pts) || lin->pts.empty())
+                return false;
             lin->initGeoMbr();
             shapes.insert(lin);
+            char next = JsonPeek(scan);
+            if (next == ',')
+            {
+                scan->pos++;
+                continue;
+            }
+            if (next == ']')
+            {
+                scan->pos++;
+                break;
+            }
+            return false;
         }
-    } else if (![type compare:@"MultiPolygon"])
+    } else if (type == "MultiPolygon")
     {
-        NSArray *polyArray = [jsonDict objectForKey:@"coordinates"];
-        if (![polyArray isKindOfClass:[NSArray class]])
+        if (!JsonExpect(scan,'['))
             return false;
-        for (NSArray *polyEntry in polyArray)
+        if (JsonPeek(scan) == ']')
         {
-            if ([polyEntry isKindOfClass:[NSArray class]])
-            {
-                VectorArealRef ar = VectorAreal::createAreal();
-                for (NSArray *coordsEntry in polyEntry)
+            scan->pos++;
+            return true;
+        }
+        for (;;)
+        {
+            VectorArealRef ar = VectorAreal::createAreal();
+            if (!JsonExpect(scan,'['))
+                return false;
+            if (JsonPeek(scan) == ']')
+                scan->pos++;
+            else
+                for (;;)
                 {
-                    VectorRing coords;
-                    if (!VectorParseCoords(coords, coordsEntry) || coords.empty())
+                    ar->loops.resize(ar->loops.size()+1);
+                    if (!JsonParseRing(scan,ar->loops.back()) || ar->loops.back().empty())
                         return false;
-                    ar->loops.push_back(coords);
+                    char next = JsonPeek(scan);
+                    if (next == ',')
+                    {
+                        scan->pos++;
+                        continue;
+                    }
+                    if (next == ']')
+                    {
+                        scan->pos++;
+                        break;
+                    }
+                    return false;
                 }
-                ar->initGeoMbr();
-                shapes.insert(ar);                
-            } else
-                return false;
+            ar->initGeoMbr();
+            shapes.insert(ar);
+            char next = JsonPeek(scan);
+            if (next == ',')
+            {
+                scan->pos++;
+                continue;
+            }
+            if (next == ']')
+            {
+                scan->pos++;
+                break;
+            }
+            return false;
         }
-    } else if (![type compare:@"GeometryCollection"])
+    } else
+        return false;
+
+    return true;
+}
+
+// Parse a geometry object in the stream
+static bool JsonParseGeometryObj(JsonScanState *scan,ShapeSet &shapes)
+{
+    if (!JsonExpect(scan,'{'))
+        return false;
+    if (JsonPeek(scan) == '}')
+        return false;
+
+    std::string key,type;
+    JsonScanState coordScan,geomScan;
+    coordScan.pos = NULL;  geomScan.pos = NULL;
+    for (;;)
     {
-        // Recurse down for the other geometry
-        NSArray *geom = [jsonDict objectForKey:@"geometries"];
-        if (![geom isKindOfClass:[NSArray class]])
+        if (!JsonParseString(scan,key) || !JsonExpect(scan,':'))
             return false;
-        for (NSDictionary *geomDict in geom)
+        if (key == "type")
         {
-            if (![geomDict isKindOfClass:[NSDictionary class]])
+            if (!JsonParseString(scan,type))
                 return false;
-            if (!VectorParseGeometry(shapes, geomDict))
+        } else if (key == "coordinates")
+        {
+            // Note where the coordinates start.  We may not have seen the
+            //  type yet, so we come back for these
+            JsonSkipWhite(scan);
+            coordScan = *scan;
+            if (!JsonSkipValue(scan))
+                return false;
+        } else if (key == "geometries")
+        {
+            JsonSkipWhite(scan);
+            geomScan = *scan;
+            if (!JsonSkipValue(scan))
+                return false;
+        } else {
+            if (!JsonSkipValue(scan))
                 return false;
         }
-    } else
+        char next = JsonPeek(scan);
+        if (next == ',')
+        {
+            scan->pos++;
+            continue;
+        }
+        if (next == '}')
+        {
+            scan->pos++;
+            break;
+        }
         return false;
-    
-    return true;
+    }
+
+    // Recurse down for collections
+    if (type == "GeometryCollection")
+    {
+        if (!geomScan.pos || !JsonExpect(&geomScan,'['))
+            return false;
+        if (JsonPeek(&geomScan) == ']')
+            return true;
+        for (;;)
+        {
+            if (!JsonParseGeometryObj(&geomScan,shapes))
+                return false;
+            char next = JsonPeek(&geomScan);
+            if (next == ',')
+            {
+                geomScan.pos++;
+                continue;
+            }
+            if (next == ']')
+                return true;
+            return false;
+        }
+    }
+
+    if (type.empty() || !coordScan.pos)
+        return false;
+    return JsonParseCoordinates(&coordScan,type,shapes);
 }
-    
-// Parse a single feature out of geoJSON
-bool VectorParseFeature(ShapeSet &shapes,NSDictionary *jsonDict)
+
+// Parse a properties dictionary.  Like the tree based parser we keep
+//  strings, numbers and bools and ignore anything nested
+static bool JsonParseProperties(JsonScanState *scan,NSMutableDictionary *dict)
 {
-    NSString *idStr = [jsonDict objectForKey:@"id"];
-    NSDictionary *geom = [jsonDict objectForKey:@"geometry"];
-    NSDictionary *prop = [jsonDict objectForKey:@"properties"];
+    if (!JsonExpect(scan,'{'))
+        return false;
+    if (JsonPeek(scan) == '}')
+    {
+        scan->pos++;
+        return true;
+    }
+    std::string key,strVal;
+    for (;;)
+    {
+        if (!JsonParseString(scan,key) || !JsonExpect(scan,':'))
+            return false;
+        NSString *keyStr = [NSString stringWithUTF8String:key.c_str()];
+        char c = JsonPeek(scan);
+        if (c == '"')
+        {
+            if (!JsonParseString(scan,strVal))
+                return false;
+            NSString *valStr = [NSString stringWithUTF8String:strVal.c_str()];
+            if (keyStr && valStr)
+                dict[keyStr] = valStr;
+        } else if (c == 't' || c == 'f')
+        {
+            bool bVal = (c == 't');
+            if (!JsonSkipValue(scan))
+                return false;
+            if (keyStr)
+                dict[keyStr] = @(bVal);
+        } else if (c == '{' || c == '[' || c == 'n')
+        {
+            if (!JsonSkipValue(scan))
+                return false;
+        } else {
+            double val;
+            if (!JsonParseNumber(scan,&val))
+                return false;
+            if (keyStr)
+                dict[keyStr] = @(val);
+        }
+        char next = JsonPeek(scan);
+        if (next == ',')
+        {
+            scan->pos++;
+            continue;
+        }
+        if (next == '}')
+        {
+            scan->pos++;
+            return true;
+        }
+        return false;
+    }
+}
 
-    if (![geom isKindOfClass:[NSDictionary class]])
+// Parse one feature out of the stream, geometry plus attributes
+static bool JsonParseFeature(JsonScanState *scan,ShapeSet &shapes,VectorAttrStoreRef &attrStore)
+{
+    if (!JsonExpect(scan,'{'))
+        return false;
+    if (JsonPeek(scan) == '}')
         return false;
 
-    // Parse out the geometry.  May result in multiple shapes
-    if (!VectorParseGeometry(shapes, geom))
+    NSMutableDictionary *properties = nil;
+    NSString *idStr = nil;
+    ShapeSet featShapes;
+    std::string key,strVal;
+    for (;;)
+    {
+        if (!JsonParseString(scan,key) || !JsonExpect(scan,':'))
+            return false;
+        if (key == "geometry")
+        {
+            if (!JsonParseGeometryObj(scan,featShapes))
+                return false;
+        } else if (key == "properties")
+        {
+            if (JsonPeek(scan) == '{')
+            {
+                properties = [NSMutableDictionary dictionary];
+                if (!JsonParseProperties(scan,properties))
+                    return false;
+            } else if (!JsonSkipValue(scan))
+                return false;
+        } else if (key == "id")
+        {
+            if (JsonPeek(scan) == '"')
+            {
+                if (!JsonParseString(scan,strVal))
+                    return false;
+                idStr = [NSString stringWithUTF8String:strVal.c_str()];
+            } else if (!JsonSkipValue(scan))
+                return false;
+        } else {
+            if (!JsonSkipValue(scan))
+                return false;
+        }
+        char next = JsonPeek(scan);
+        if (next == ',')
+        {
+            scan->pos++;
+            continue;
+        }
+        if (next == '}')
+        {
+            scan->pos++;
+            break;
+        }
         return false;
-    
-    // Apply the attributes if there are any
-    if ([prop isKindOfClass:[NSDictionary class]])
-        for (ShapeSet::iterator it = shapes.begin(); it != shapes.end(); ++it)
-            (*it)->setAttrDict([NSMutableDictionary dictionaryWithDictionary:prop]);
-    
-    // Apply the identity if there is one
-    if ([idStr isKindOfClass:[NSString class]])
-        for (ShapeSet::iterator it = shapes.begin(); it != shapes.end(); ++it)
-            [(*it)->getAttrDict() setObject:idStr forKey:@"id"];
-    
+    }
+
+    // Apply the attributes if there are any.  One interned row covers the
+    //  feature's shapes; dictionaries only appear (as copies) on demand.
+    if (properties)
+    {
+        if (idStr)
+            properties[@"id"] = idStr;
+        int row = attrStore->addRow(properties);
+        for (ShapeSet::iterator it = featShapes.begin(); it != featShapes.end(); ++it)
+            (*it)->setAttrStore(attrStore,row);
+    }
+
+    shapes.insert(featShapes.begin(),featShapes.end());
     return true;
 }
-    
-// Parse a set of features out of GeoJSON using an NSDictionary
-bool VectorParseGeoJSON(ShapeSet &shapes,NSDictionary *jsonDict)
+
+bool VectorParseGeoJSONStreaming(NSData *jsonData,unsigned int batchSize,bool (^shapeBlock)(ShapeSet &shapes,float progress))
 {
-    NSString *type = [jsonDict objectForKey:@"type"];
-    if (![type isKindOfClass:[NSString class]])
+    JsonScanState scan;
+    scan.pos = (const char *)[jsonData bytes];
+    scan.end = scan.pos + [jsonData length];
+    JsonScanState whole = scan;
+    double totalLen = (scan.end > scan.pos) ? (double)(scan.end - scan.pos) : 1.0;
+    if (batchSize < 1)
+        batchSize = 1;
+
+    // One key table for the whole stream; the shapes keep it alive
+    VectorAttrStoreRef attrStore(new VectorAttrStore());
+
+    if (!JsonExpect(&scan,'{'))
         return false;
-    
-    if (![type compare:@"FeatureCollection"])
+    if (JsonPeek(&scan) == '}')
+        return false;
+
+    std::string key,type;
+    bool sawFeatures = false;
+    ShapeSet batch;
+    for (;;)
     {
-        NSArray *features = [jsonDict objectForKey:@"features"];
-        if (![features isKindOfClass:[NSArray class]])
+        if (!JsonParseString(&scan,key) || !JsonExpect(&scan,':'))
             return false;
-        
-        for (NSDictionary *featDict in features)
+        if (key == "type")
         {
-            if (![featDict isKindOfClass:[NSDictionary class]])
+            if (!JsonParseString(&scan,type))
                 return false;
-            
-            ShapeSet featShapes;
-            if (VectorParseFeature(featShapes,featDict))
-                shapes.insert(featShapes.begin(),featShapes.end());
+        } else if (key == "features")
+        {
+            sawFeatures = true;
+            if (!JsonExpect(&scan,'['))
+                return false;
+            if (JsonPeek(&scan) == ']')
+                scan.pos++;
             else
+                for (;;)
+                {
+                    if (!JsonParseFeature(&scan,batch,attrStore))
+                        return false;
+                    // Hand off a batch as soon as we've got one, so the
+                    //  caller can start displaying before the file finishes
+                    if (batch.size() >= batchSize)
+                    {
+                        if (!shapeBlock(batch,(scan.pos - whole.pos) / totalLen))
+                            return false;
+                        batch.clear();
+                    }
+                    char next = JsonPeek(&scan);
+                    if (next == ',')
+                    {
+                        scan.pos++;
+                        continue;
+                    }
+                    if (next == ']')
+                    {
+                        scan.pos++;
+                        break;
+                    }
+                    return false;
+                }
+        } else {
+            if (!JsonSkipValue(&scan))
                 return false;
         }
-    } else if (![type compare:@"Feature"]) {
-        ShapeSet featShapes;
-        if (VectorParseFeature(featShapes,jsonDict))
-            shapes.insert(featShapes.begin(),featShapes.end());
-        else
+        char next = JsonPeek(&scan);
+        if (next == ',')
+        {
+            scan.pos++;
+            continue;
+        }
+        if (next == '}')
+        {
+            scan.pos++;
+            break;
+        }
+        return false;
+    }
+
+    // A bare feature comes through as a single batch
+    if (!sawFeatures)
+    {
+        if (type != "Feature")
+            return false;
+        if (!JsonParseFeature(&whole,batch,attrStore))
             return false;
     }
-    
+
+    if (!batch.empty() && !shapeBlock(batch,1.0))
+        return false;
+
     return true;
 }
-    
+
 using namespace libjson;
-    
+
 // Parse properties out of a node
 NSMutableDictionary *VectorParseProperties(JSONNode node)
 {
@@ -1048,7 +2303,7 @@ bool VectorParseGeometry(JSONNode node,ShapeSet &shapes)
 }
     
 // Parse a single feature
-bool VectorParseFeature(JSONNode node,ShapeSet &shapes)
+bool VectorParseFeature(JSONNode node,ShapeSet &shapes,VectorAttrStoreRef &attrStore)
 {
     JSONNode::const_iterator typeIt = node.end();
     JSONNode::const_iterator geomIt = node.end();
@@ -1077,31 +2332,35 @@ bool VectorParseFeature(JSONNode node,ShapeSet &shapes)
     ShapeSet newShapes;
     if (!VectorParseGeometry(*geomIt,newShapes))
         return false;
-    // Apply the properties to the geometry
-    for (ShapeSet::iterator sit = newShapes.begin(); sit != newShapes.end(); ++sit)
-        (*sit)->setAttrDict(properties);
-    
+    // Apply the properties to the geometry as one interned row
+    if (properties)
+    {
+        int row = attrStore->addRow(properties);
+        for (ShapeSet::iterator sit = newShapes.begin(); sit != newShapes.end(); ++sit)
+            (*sit)->setAttrStore(attrStore,row);
+    }
+
     shapes.insert(newShapes.begin(), newShapes.end());
     return true;
 }
 
 // Parse an array of features
-bool VectorParseFeatures(JSONNode node,ShapeSet &shapes)
+bool VectorParseFeatures(JSONNode node,ShapeSet &shapes,VectorAttrStoreRef &attrStore)
 {
     for (JSONNode::const_iterator it = node.begin();it != node.end(); ++it)
     {
         // Not sure what this would be
         if (it->type() != JSON_NODE)
             return false;
-        if (!VectorParseFeature(*it,shapes))
+        if (!VectorParseFeature(*it,shapes,attrStore))
             return false;
     }
-    
+
     return true;
 }
 
 // Recursively parse a feature collection
-bool VectorParseTopNode(JSONNode node,ShapeSet &shapes)
+bool VectorParseTopNode(JSONNode node,ShapeSet &shapes,VectorAttrStoreRef &attrStore)
 {
     JSONNode::const_iterator typeIt = node.end();
     JSONNode::const_iterator featIt = node.end();
@@ -1124,7 +2383,7 @@ bool VectorParseTopNode(JSONNode node,ShapeSet &shapes)
         // Expecting a features node
         if (featIt == node.end() || featIt->type() != JSON_ARRAY)
             return false;
-        return VectorParseFeatures(*featIt,shapes);
+        return VectorParseFeatures(*featIt,shapes,attrStore);
     } else
         return false;
 
@@ -1140,7 +2399,10 @@ bool VectorParseGeoJSON(ShapeSet &shapes,NSData *data)
     
     JSONNode topNode = libjson::parse(json);
 
-    if (!VectorParseTopNode(topNode,shapes))
+    // Attribute keys get interned here once for the whole load
+    VectorAttrStoreRef attrStore(new VectorAttrStore());
+
+    if (!VectorParseTopNode(topNode,shapes,attrStore))
     {
         NSLog(@"Failed to parse JSON in VectorParseGeoJSON");
         return false;
@@ -1157,13 +2419,15 @@ bool VectorParseGeoJSONAssembly(NSData *data,std::map<std::string,ShapeSet> &sha
     
     JSONNode topNode = libjson::parse(json);
 
+    VectorAttrStoreRef attrStore(new VectorAttrStore());
+
     for (JSONNode::iterator nodeIt = topNode.begin();
          nodeIt != topNode.end(); ++nodeIt)
     {
         if (nodeIt->type() == JSON_NODE)
         {
             ShapeSet theseShapes;
-            if (VectorParseTopNode(*nodeIt,theseShapes))
+            if (VectorParseTopNode(*nodeIt,theseShapes,attrStore))
             {
                 json_string name = nodeIt->name();
                 std::string nameStr = to_std_string(name);
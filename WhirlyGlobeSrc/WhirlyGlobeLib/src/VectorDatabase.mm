@@ -19,6 +19,7 @@
  */
 
 #import <UIKit/UIKit.h>
+#import <algorithm>
 #import "VectorDatabase.h"
 #import "sqlhelpers.h"
 
@@ -26,7 +27,7 @@ namespace WhirlyKit
 {
 
 VectorDatabase::VectorDatabase(NSString *bundleDir,NSString *cacheDir,NSString *baseName,VectorReader *reader,const std::set<std::string> *indices,bool memCache,bool autoload)
-    : reader(reader), db(NULL), autoloadOn(false), vecCacheOn(false)
+    : reader(reader), db(NULL), autoloadOn(false), vecCacheOn(false), spatialRoot(-1)
 {
     // Look for an existing MBR file and database
     NSString *mbrName0 = [NSString stringWithFormat:@"%@/%@.mbr",bundleDir,baseName];
@@ -62,7 +63,10 @@ VectorDatabase::VectorDatabase(NSString *bundleDir,NSString *cacheDir,NSString *
         if (!buildCaches(mbrName1, dbName1))
             throw (std::string)"Failed to build vector cache.  Giving up.";
     }
-    
+
+    // However we got the MBRs, index them
+    buildSpatialIndex();
+
     setMemCache(memCache);
     setAutoload(autoload);
 }
@@ -153,14 +157,135 @@ VectorShapeRef VectorDatabase::getVector(unsigned int vecIndex,bool withAttribut
     return retShape;
 }
     
+// Entries per R-tree node.  Small enough to keep the overlap tests
+//  cheap, big enough that the tree stays shallow.
+static const unsigned int SpatialNodeSize = 16;
+
+// Index/center pairs we sort around during the packing
+class SpatialSortEntry
+{
+public:
+    unsigned int index;
+    GeoCoord center;
+};
+static bool SpatialSortX(const SpatialSortEntry &a,const SpatialSortEntry &b) { return a.center.x() < b.center.x(); }
+static bool SpatialSortY(const SpatialSortEntry &a,const SpatialSortEntry &b) { return a.center.y() < b.center.y(); }
+
+// Build the in memory R-tree with a sort-tile-recursive packing.
+// The MBR list doesn't change once the caches load, so we can bulk
+//  load the whole tree rather than inserting one entry at a time.
+void VectorDatabase::buildSpatialIndex()
+{
+    spatialNodes.clear();
+    spatialRoot = -1;
+
+    // Start out with an entry per vector.  Shapes without geometry
+    //  have invalid MBRs and would never match a query, so leave them out.
+    std::vector<SpatialSortEntry> entries;
+    entries.reserve(mbrs.size());
+    for (unsigned int ii=0;ii<mbrs.size();ii++)
+        if (mbrs[ii].valid())
+        {
+            SpatialSortEntry entry;
+            entry.index = ii;
+            entry.center = mbrs[ii].mid();
+            entries.push_back(entry);
+        }
+    if (entries.empty())
+        return;
+
+    bool leaf = true;
+    for (;;)
+    {
+        // Lay the entries out in vertical slices, sorted horizontally,
+        //  then sort vertically within each slice
+        std::sort(entries.begin(),entries.end(),SpatialSortX);
+        unsigned int numNodes = ((unsigned int)entries.size()+SpatialNodeSize-1)/SpatialNodeSize;
+        unsigned int numSlices = (unsigned int)ceil(sqrt((double)numNodes));
+        unsigned int sliceLen = numSlices * SpatialNodeSize;
+        for (unsigned int ii=0;ii<entries.size();ii+=sliceLen)
+        {
+            unsigned int sliceEnd = std::min((unsigned int)entries.size(),ii+sliceLen);
+            std::sort(entries.begin()+ii,entries.begin()+sliceEnd,SpatialSortY);
+        }
+
+        // Pack each run of entries into a node
+        std::vector<SpatialSortEntry> parents;
+        for (unsigned int ii=0;ii<entries.size();ii+=SpatialNodeSize)
+        {
+            unsigned int nodeEnd = std::min((unsigned int)entries.size(),ii+SpatialNodeSize);
+            SpatialNode node;
+            node.leaf = leaf;
+            for (unsigned int jj=ii;jj<nodeEnd;jj++)
+            {
+                unsigned int which = entries[jj].index;
+                node.children.push_back(which);
+                node.mbr.expand(leaf ? mbrs[which] : spatialNodes[which].mbr);
+            }
+            SpatialSortEntry parent;
+            parent.index = (unsigned int)spatialNodes.size();
+            parent.center = node.mbr.mid();
+            spatialNodes.push_back(node);
+            parents.push_back(parent);
+        }
+
+        entries.swap(parents);
+        leaf = false;
+        if (entries.size() == 1)
+            break;
+    }
+
+    spatialRoot = entries[0].index;
+}
+
 // Return all the vectors that overlap the given Mbr
 void VectorDatabase::getVectorsWithinMbr(const GeoMbr &mbr,UIntSet &vecIds)
 {
-    for (unsigned int ii=0;ii<mbrs.size();ii++)
-        if (mbr.overlaps(mbrs[ii]))
-            vecIds.insert(ii);
+    // Fall back to the linear scan if the index didn't get built
+    if (spatialRoot < 0)
+    {
+        for (unsigned int ii=0;ii<mbrs.size();ii++)
+            if (mbr.overlaps(mbrs[ii]))
+                vecIds.insert(ii);
+        return;
+    }
+
+    // Walk the R-tree, skipping whole subtrees that miss the MBR
+    std::vector<unsigned int> toVisit;
+    toVisit.push_back(spatialRoot);
+    while (!toVisit.empty())
+    {
+        const SpatialNode &node = spatialNodes[toVisit.back()];
+        toVisit.pop_back();
+        for (unsigned int ii=0;ii<node.children.size();ii++)
+        {
+            unsigned int which = node.children[ii];
+            if (node.leaf)
+            {
+                if (mbr.overlaps(mbrs[which]))
+                    vecIds.insert(which);
+            } else {
+                if (mbr.overlaps(spatialNodes[which].mbr))
+                    toVisit.push_back(which);
+            }
+        }
+    }
 }
-    
+
+// Load up the vectors that overlap the given Mbr
+void VectorDatabase::getVectorsInMbr(const GeoMbr &mbr,ShapeSet &shapes)
+{
+    UIntSet vecIds;
+    getVectorsWithinMbr(mbr, vecIds);
+
+    for (UIntSet::iterator it = vecIds.begin();it != vecIds.end(); ++it)
+    {
+        VectorShapeRef shape = getVector(*it,true);
+        if (shape.get())
+            shapes.insert(shape);
+    }
+}
+
 sqlite3 *VectorDatabase::getSqliteDb()
 {
     return db;
@@ -178,16 +303,31 @@ bool VectorDatabase::buildCaches(NSString *mbrCache,NSString *sqlDb)
     // Create a sqlite db
     if (sqlite3_open([sqlDb cStringUsingEncoding:NSASCIIStringEncoding],&db) != SQLITE_OK)
         return false;
-    
+    sqlhelpers::ConfigureConnection(db,1000,true);
+
     // Set up the one table we need table
     sqlhelpers::OneShot(db,@"CREATE TABLE vectors (vecid INTEGER PRIMARY KEY);");
     std::set<std::string> fields;
     std::set<std::string> ignoreFields;
-    
+
+    // One transaction around the whole import, and most of the inserts
+    //  share the same SQL so the cache saves recompiling it per row
+    sqlhelpers::ScopedTransaction trans(db);
+    sqlhelpers::StatementCache stmtCache(db);
+
+    // Pull the shapes through in blocks.  Readers that can batch their
+    //  I/O (e.g. the shapefile reader) do much better this way.
+    const unsigned int ReadBlockSize = 256;
+    std::vector<VectorShapeRef> blockShapes;
     mbrs.resize(reader->getNumObjects());
     for (unsigned int ii=0;ii<mbrs.size();ii++)
     {
-        VectorShapeRef theShape = getVector(ii,true);
+        if (ii % ReadBlockSize == 0)
+        {
+            blockShapes.clear();
+            reader->getObjects(ii,std::min(ReadBlockSize,(unsigned int)(mbrs.size()-ii)),NULL,blockShapes);
+        }
+        VectorShapeRef theShape = blockShapes[ii % ReadBlockSize];
         if (theShape.get())
         {
             mbrs[ii] = theShape->calcGeoMbr();
@@ -257,7 +397,7 @@ bool VectorDatabase::buildCaches(NSString *mbrCache,NSString *sqlDb)
                 [keyStr appendFormat:@"%s%s",keys[jj].c_str(),(jj==keys.size()-1 ? "" : ", ")];
                 [valStr appendFormat:@"?%s",(jj==keys.size()-1 ? "" : ", ")];
             }
-            sqlhelpers::StatementWrite insStmt(db,[NSString stringWithFormat:@"INSERT INTO vectors (%@) values (%@);",keyStr,valStr]);
+            sqlhelpers::StatementWrite insStmt(stmtCache,[NSString stringWithFormat:@"INSERT INTO vectors (%@) values (%@);",keyStr,valStr]);
             insStmt.add((int)ii);
             for (NSObject *obj in data)
             {
@@ -284,7 +424,8 @@ bool VectorDatabase::buildCaches(NSString *mbrCache,NSString *sqlDb)
             insStmt.go();
         }
     }
-    
+    trans.commit();
+
     // Write the cache file
     //  Version
     //  Number of MBRs
@@ -364,15 +505,21 @@ bool VectorDatabase::readCaches(NSString *mbrCache, NSString *sqlDb)
 
     if (sqlite3_open([sqlDb cStringUsingEncoding:NSASCIIStringEncoding],&db) != SQLITE_OK)
         return false;
-    
+    sqlhelpers::ConfigureConnection(db,1000,false);
+
     return true;
 }
 
 // Look areals that pass that point in polygon test
 void VectorDatabase::findArealsForPoint(const GeoCoord &coord,ShapeSet &shapes)
 {
-    for (unsigned int ii=0;ii<mbrs.size();ii++)
+    // Let the spatial index narrow things down first
+    UIntSet candidates;
+    getVectorsWithinMbr(GeoMbr(coord,coord),candidates);
+
+    for (UIntSet::iterator it = candidates.begin();it != candidates.end(); ++it)
     {
+        unsigned int ii = *it;
         if (mbrs[ii].inside(coord))
         {
             // Load it in and see if it passes
@@ -40,6 +40,7 @@ typedef enum {TextureProjectionNone,TextureProjectionTanPlane} TextureProjection
     float                       drawOffset;
     int                         priority;
     float                       minVis,maxVis;
+    float                       minPix;
     BOOL                        filled;
     float                       sample;
     SimpleIdentity              texId;
@@ -47,6 +48,7 @@ typedef enum {TextureProjectionNone,TextureProjectionTanPlane} TextureProjection
     float                       subdivEps;
     BOOL                        gridSubdiv;
     TextureProjections          texProj;
+    BOOL                        optimizeTris;
 }
 
 @property (nonatomic) UIColor *color;
@@ -91,6 +93,7 @@ typedef enum {TextureProjectionNone,TextureProjectionTanPlane} TextureProjection
     priority = [dict intForKey:@"priority" default:priority];
     minVis = [dict floatForKey:@"minVis" default:DrawVisibleInvalid];
     maxVis = [dict floatForKey:@"maxVis" default:DrawVisibleInvalid];
+    minPix = [dict floatForKey:@"minpixels" default:0.0];
     _fade = [dict floatForKey:@"fade" default:0.0];
     _lineWidth = [dict floatForKey:@"width" default:1.0];
     filled = [dict boolForKey:@"filled" default:false];
@@ -101,6 +104,7 @@ typedef enum {TextureProjectionNone,TextureProjectionTanPlane} TextureProjection
     subdivEps = [dict floatForKey:@"subdivisionepsilon" default:0.0];
     NSString *subdivType = [dict stringForKey:@"subdivisiontype" default:nil];
     gridSubdiv = [subdivType isEqualToString:@"grid"];
+    optimizeTris = [dict boolForKey:@"optimizetriangles" default:true];
     NSString *texProjStr = [dict stringForKey:@"texprojection" default:nil];
     texProj = TextureProjectionNone;
     if ([texProjStr isEqualToString:@"texprojectiontanplane"])
@@ -172,19 +176,26 @@ public:
             drawable->setVisibleRange(vecInfo->minVis,vecInfo->maxVis);
         }
         drawMbr.addPoints(pts);
-        
+
+        // Batch the projection and display conversion for the whole ring
+        std::vector<GeoCoord> geoCoords(pts.size());
+        for (unsigned int jj=0;jj<pts.size();jj++)
+            geoCoords[jj] = GeoCoord(pts[jj].x(),pts[jj].y());
+        std::vector<Point3d> localPts(pts.size()),dispPts(pts.size());
+        if (!pts.empty())
+        {
+            coordAdapter->getCoordSystem()->geographicToLocal(&geoCoords[0],&localPts[0],(unsigned int)pts.size());
+            coordAdapter->localToDisplay(&localPts[0],&dispPts[0],(unsigned int)pts.size());
+        }
+
         Point3f prevPt,prevNorm,firstPt,firstNorm;
         for (unsigned int jj=0;jj<pts.size();jj++)
         {
-            // Convert to real world coordinates and offset from the globe
-            Point2f &geoPt = pts[jj];
-            GeoCoord geoCoord = GeoCoord(geoPt.x(),geoPt.y());
-            Point3d localPt = coordAdapter->getCoordSystem()->geographicToLocal3d(geoCoord);
-            Point3d norm3d = coordAdapter->normalForLocal(localPt);
+            Point3d norm3d = coordAdapter->normalForLocal(localPts[jj]);
             Point3f norm(norm3d.x(),norm3d.y(),norm3d.z());
-            Point3d pt3d = coordAdapter->localToDisplay(localPt) - center;
+            Point3d pt3d = dispPts[jj] - center;
             Point3f pt(pt3d.x(),pt3d.y(),pt3d.z());
-            
+
             // Add to drawable
             // Depending on the type, we do this differently
             if (primType == GL_POINTS)
@@ -236,6 +247,11 @@ public:
             if (drawable->getNumPoints() > 0)
             {
                 drawable->setLocalMbr(drawMbr);
+                if (vecInfo->minPix > 0.0)
+                {
+                    Point2f span = drawMbr.ur() - drawMbr.ll();
+                    drawable->setScreenSpaceGate(sqrtf(span.x()*span.x()+span.y()*span.y())/2.0,vecInfo->minPix);
+                }
                 sceneRep->drawIDs.insert(drawable->getId());
                 if (centerValid)
                 {
@@ -296,18 +312,59 @@ public:
     // This version converts a ring into a mesh (chopping, tesselating, etc...)
     void addPoints(VectorRing &ring,NSDictionary *attrs)
     {
-        // Grid subdivision is done here
-        std::vector<VectorRing> inRings;
-        if (vecInfo->subdivEps > 0.0 && vecInfo->gridSubdiv)
-            ClipLoopToGrid(ring, Point2f(0.0,0.0), Point2f(vecInfo->subdivEps,vecInfo->subdivEps), inRings);
-        else
-            inRings.push_back(ring);
-        VectorTrianglesRef mesh(VectorTriangles::createTriangles());
-        for (unsigned int ii=0;ii<inRings.size();ii++)
-            TesselateRing(inRings[ii],mesh);
-        
+        float gridEps = (vecInfo->subdivEps > 0.0 && vecInfo->gridSubdiv) ? vecInfo->subdivEps : 0.0;
+        long long tessKey = TessellationCache::hashFloat(TessellationCache::hashRing(TessellationCache::hashSeed(),ring),gridEps);
+        VectorTrianglesRef mesh = TessellationCache::getShared()->get(tessKey);
+        if (!mesh.get())
+        {
+            // Grid subdivision is done here
+            std::vector<VectorRing> inRings;
+            if (gridEps > 0.0)
+                ClipLoopToGrid(ring, Point2f(0.0,0.0), Point2f(gridEps,gridEps), inRings);
+            else
+                inRings.push_back(ring);
+            mesh = VectorTriangles::createTriangles();
+            for (unsigned int ii=0;ii<inRings.size();ii++)
+                TesselateRing(inRings[ii],mesh);
+            TessellationCache::getShared()->add(tessKey,mesh);
+        }
+
         addPoints(mesh, attrs);
     }
+
+    // Areal version.  Reuses the tessellation cached on the shape when
+    //  there is one, so restyling the same shape set skips the tessellator.
+    void addPoints(VectorArealRef areal)
+    {
+        float gridEps = (vecInfo->subdivEps > 0.0 && vecInfo->gridSubdiv) ? vecInfo->subdivEps : 0.0;
+        VectorTrianglesRef mesh = areal->cachedTess;
+        if (!mesh || areal->cachedTessEps != gridEps)
+        {
+            // The content addressed cache survives the shape itself, so a
+            //  toggled layer re-adding the same county doesn't retessellate
+            long long tessKey = TessellationCache::hashFloat(TessellationCache::hashRing(TessellationCache::hashSeed(),areal->loops[0]),gridEps);
+            mesh = TessellationCache::getShared()->get(tessKey);
+            if (!mesh.get())
+            {
+                std::vector<VectorRing> inRings;
+                if (gridEps > 0.0)
+                    ClipLoopToGrid(areal->loops[0], Point2f(0.0,0.0), Point2f(gridEps,gridEps), inRings);
+                else
+                    inRings.push_back(areal->loops[0]);
+                mesh = VectorTriangles::createTriangles();
+                for (unsigned int ii=0;ii<inRings.size();ii++)
+                    TesselateRing(inRings[ii],mesh);
+                TessellationCache::getShared()->add(tessKey,mesh);
+            }
+
+            // Hang on to it for the next restyle.  The memory lives only
+            //  as long as the caller keeps the shape around.
+            areal->cachedTess = mesh;
+            areal->cachedTessEps = gridEps;
+        }
+
+        addPoints(mesh, areal->getAttrDict());
+    }
     
     // If it's a mesh, we're assuming it's been fully processed (triangulated, chopped, and so on)
     void addPoints(VectorTrianglesRef mesh,NSDictionary *attrs)
@@ -414,18 +471,25 @@ public:
                 }
             }
             
+            // Batch the projection and display conversion for the triangle's points
+            std::vector<GeoCoord> geoCoords(pts.size());
+            for (unsigned int jj=0;jj<pts.size();jj++)
+                geoCoords[jj] = GeoCoord(pts[jj].x(),pts[jj].y());
+            std::vector<Point3d> localPts(pts.size()),dispPts(pts.size());
+            if (!pts.empty())
+            {
+                coordAdapter->getCoordSystem()->geographicToLocal(&geoCoords[0],&localPts[0],(unsigned int)pts.size());
+                coordAdapter->localToDisplay(&localPts[0],&dispPts[0],(unsigned int)pts.size());
+            }
+
             // Add the points
             for (unsigned int jj=0;jj<pts.size();jj++)
             {
-                // Convert to real world coordinates and offset from the globe
-                Point2f &geoPt = pts[jj];
-                GeoCoord geoCoord = GeoCoord(geoPt.x(),geoPt.y());
-                Point3d localPt = coordAdapter->getCoordSystem()->geographicToLocal3d(geoCoord);
-                Point3d norm3d = coordAdapter->normalForLocal(localPt);
+                Point3d norm3d = coordAdapter->normalForLocal(localPts[jj]);
                 Point3f norm(norm3d.x(),norm3d.y(),norm3d.z());
-                Point3d pt3d = coordAdapter->localToDisplay(localPt) - center;
+                Point3d pt3d = dispPts[jj] - center;
                 Point3f pt(pt3d.x(),pt3d.y(),pt3d.z());
-                
+
                 drawable->addPoint(pt);
                 if (doColor)
                     drawable->addColor(baseColor);
@@ -450,6 +514,11 @@ public:
             if (drawable->getNumPoints() > 0)
             {
                 drawable->setLocalMbr(drawMbr);
+                if (vecInfo->minPix > 0.0)
+                {
+                    Point2f span = drawMbr.ur() - drawMbr.ll();
+                    drawable->setScreenSpaceGate(sqrtf(span.x()*span.x()+span.y()*span.y())/2.0,vecInfo->minPix);
+                }
                 if (centerValid)
                 {
                     Eigen::Affine3d trans(Eigen::Translation3d(center.x(),center.y(),center.z()));
@@ -463,7 +532,9 @@ public:
                     NSTimeInterval curTime = CFAbsoluteTimeGetCurrent();
                     drawable->setFade(curTime,curTime+vecInfo.fade);
                 }
-                
+                if (vecInfo->optimizeTris)
+                    drawable->optimizeTriangles();
+
                 changeRequests.push_back(new AddDrawableReq(drawable));
             } else
                 delete drawable;
@@ -502,6 +573,20 @@ SimpleIdentity VectorManager::addVectors(ShapeSet *shapes, NSDictionary *desc, C
 {
     VectorInfo *vecInfo = [[VectorInfo alloc] initWithShapes:shapes desc:desc];
 
+    return addVectors(vecInfo,desc,changes);
+}
+
+SimpleIdentity VectorManager::addVectors(ShapeSet &&shapes, NSDictionary *desc, ChangeSet &changes)
+{
+    // Same as above, but we take the shapes rather than copying them
+    VectorInfo *vecInfo = [[VectorInfo alloc] initWithDesc:desc];
+    vecInfo->shapes.swap(shapes);
+
+    return addVectors(vecInfo,desc,changes);
+}
+
+SimpleIdentity VectorManager::addVectors(VectorInfo *vecInfo,NSDictionary *desc,ChangeSet &changes)
+{
     // All the shape types should be the same
     ShapeSet::iterator first = vecInfo->shapes.begin();
     if (first == vecInfo->shapes.end())
@@ -548,6 +633,24 @@ SimpleIdentity VectorManager::addVectors(ShapeSet *shapes, NSDictionary *desc, C
         }
     }
     
+    // Fan the tessellation out across cores up front.  The builder loop
+    //  below picks the cached meshes up in its usual order, so the
+    //  drawables come out the same as the one-core version.
+    if (vecInfo->filled)
+    {
+        std::vector<VectorArealRef> areals;
+        areals.reserve(vecInfo->shapes.size());
+        for (ShapeSet::iterator it = vecInfo->shapes.begin();
+             it != vecInfo->shapes.end(); ++it)
+        {
+            VectorArealRef theAreal = boost::dynamic_pointer_cast<VectorAreal>(*it);
+            if (theAreal.get())
+                areals.push_back(theAreal);
+        }
+        if (areals.size() > 1)
+            TesselateAreals(areals,(vecInfo->subdivEps > 0.0 && vecInfo->gridSubdiv) ? vecInfo->subdivEps : 0.0);
+    }
+
     // Used to toss out drawables as we go
     // Its destructor will flush out the last drawable
     VectorDrawableBuilder drawBuild(scene,changes,sceneRep,vecInfo,true,doColors);
@@ -565,8 +668,8 @@ SimpleIdentity VectorManager::addVectors(ShapeSet *shapes, NSDictionary *desc, C
         {
             if (vecInfo->filled)
             {
-                // Triangulate the outside
-                drawBuildTri.addPoints(theAreal->loops[0],theAreal->getAttrDict());
+                // Triangulate the outside (or use the cached tessellation)
+                drawBuildTri.addPoints(theAreal);
             } else {
                 // Work through the loops
                 for (unsigned int ri=0;ri<theAreal->loops.size();ri++)
@@ -768,9 +871,7 @@ void VectorManager::removeVectors(SimpleIDSet &vecIDs,ChangeSet &changes)
 
             if (sceneRep->fade > 0.0)
             {
-                for (SimpleIDSet::iterator idIt = allIDs.begin();
-                     idIt != allIDs.end(); ++idIt)
-                    changes.push_back(new FadeChangeRequest(*idIt, curTime, curTime+sceneRep->fade));
+                changes.push_back(new FadeGangChangeRequest(allIDs, curTime, curTime+sceneRep->fade));
                 
                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, sceneRep->fade * NSEC_PER_SEC),
                                scene->getDispatchQueue(),
@@ -815,8 +916,39 @@ void VectorManager::enableVectors(SimpleIDSet &vecIDs,bool enable,ChangeSet &cha
                 changes.push_back(new OnOffChangeRequest(*idIt,enable));
         }
     }
-    
-    pthread_mutex_unlock(&vectorLock);    
+
+    pthread_mutex_unlock(&vectorLock);
+}
+
+void VectorManager::getDrawIDs(const SimpleIDSet &vecIDs,SimpleIDSet &drawIDs)
+{
+    pthread_mutex_lock(&vectorLock);
+
+    for (SimpleIDSet::const_iterator vIt = vecIDs.begin();vIt != vecIDs.end();++vIt)
+    {
+        VectorSceneRep dummyRep(*vIt);
+        VectorSceneRepSet::iterator it = vectorReps.find(&dummyRep);
+        if (it != vectorReps.end())
+        {
+            VectorSceneRep *sceneRep = *it;
+            drawIDs.insert(sceneRep->drawIDs.begin(),sceneRep->drawIDs.end());
+            drawIDs.insert(sceneRep->instIDs.begin(),sceneRep->instIDs.end());
+        }
+    }
+
+    pthread_mutex_unlock(&vectorLock);
+}
+
+void VectorManager::memoryCensus(MemoryCensusEntry &entry)
+{
+    pthread_mutex_lock(&vectorLock);
+
+    entry.count = vectorReps.size();
+    for (VectorSceneRepSet::iterator it = vectorReps.begin();
+         it != vectorReps.end(); ++it)
+        entry.bytes += sizeof(VectorSceneRep) + ((*it)->drawIDs.size() + (*it)->instIDs.size()) * sizeof(SimpleIdentity);
+
+    pthread_mutex_unlock(&vectorLock);
 }
 
 }
@@ -18,6 +18,7 @@
  *
  */
 
+#import <QuartzCore/QuartzCore.h>
 #import "ViewPlacementGenerator.h"
 #import "MaplyView.h"
 
@@ -132,18 +133,32 @@ void ViewPlacementGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frame
 //        modelAndViewNormalMats.push_back(modelAndViewNormalMat);
     }
         
+    // One update per view that needs touching, collected over the whole
+    //  pass and applied as a single batch on the main thread
+    class ViewUpdate
+    {
+    public:
+        UIView *view;
+        bool hidden;
+        CGRect frame;
+    };
+    std::vector<ViewUpdate> updates;
+    updates.reserve(viewInstanceSet.size());
+
+    float visVal = [frameInfo.theView heightAboveSurface];
+    float scale = [UIScreen mainScreen].scale;
+
     for (std::set<ViewInstance>::iterator it = viewInstanceSet.begin();
          it != viewInstanceSet.end(); ++it)
     {
         const ViewInstance &viewInst = *it;
         bool hidden = NO;
         CGPoint screenPt;
-        
+
         if (!it->active)
             continue;
-        
+
         // Height above globe test
-        float visVal = [frameInfo.theView heightAboveSurface];
         if (!(viewInst.minVis == DrawVisibleInvalid || viewInst.maxVis == DrawVisibleInvalid ||
               ((viewInst.minVis <= visVal && visVal <= viewInst.maxVis) ||
                (viewInst.maxVis <= visVal && visVal <= viewInst.minVis))))
@@ -151,9 +166,13 @@ void ViewPlacementGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frame
 
         if (!hidden)
         {
-            // Note: Calculate this ahead of time
-            Point3d worldLoc = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal3d(viewInst.loc));
-     
+            if (!viewInst.worldLocValid)
+            {
+                viewInst.worldLoc = coordAdapter->localToDisplay(coordAdapter->getCoordSystem()->geographicToLocal3d(viewInst.loc));
+                viewInst.worldLocValid = true;
+            }
+            const Point3d &worldLoc = viewInst.worldLoc;
+
             // Check that it's not behind the globe
             if (globeView)
             {
@@ -191,33 +210,45 @@ void ViewPlacementGenerator::generateDrawables(WhirlyKitRendererFrameInfo *frame
             }
         }
         
+        // A view that stays off screen costs nothing further
+        if (hidden && viewInst.lastHidden)
+            continue;
+        viewInst.lastHidden = hidden;
+
+        ViewUpdate update;
+        update.view = viewInst.view;
+        update.hidden = hidden;
         if (!hidden)
         {
             CGSize size = viewInst.view.frame.size;
-            // Note: We should really be passing this in
-            float scale = [UIScreen mainScreen].scale;
-            // We can only modify UIViews on the main thread
-            if ([NSThread currentThread] != [NSThread mainThread])
-            {
-                dispatch_async(dispatch_get_main_queue(),
-                               ^{
-                                   viewInst.view.hidden = false;
-                                   viewInst.view.frame = CGRectMake(screenPt.x / scale + viewInst.offset.x(), screenPt.y / scale + viewInst.offset.y(), size.width, size.height);
-                               });
-            } else {
-                viewInst.view.hidden = false;
-                viewInst.view.frame = CGRectMake(screenPt.x / scale + viewInst.offset.x(), screenPt.y / scale + viewInst.offset.y(), size.width, size.height);
-            }
-        } else {
-            if ([NSThread currentThread] != [NSThread mainThread])
-            {
-                dispatch_async(dispatch_get_main_queue(),
-                               ^{
-                                   viewInst.view.hidden = true;
-                               });
-            } else
-                viewInst.view.hidden = true;
+            update.frame = CGRectMake(screenPt.x / scale + viewInst.offset.x(), screenPt.y / scale + viewInst.offset.y(), size.width, size.height);
         }
+        updates.push_back(update);
+    }
+
+    // We can only modify UIViews on the main thread.  The whole batch
+    //  goes in one transaction, so 200 callouts move as one layout
+    //  rather than 200 implicit animations
+    if (!updates.empty())
+    {
+        std::vector<ViewUpdate> theUpdates = updates;
+        void (^applyUpdates)(void) =
+            ^{
+                [CATransaction begin];
+                [CATransaction setDisableActions:YES];
+                for (unsigned int ii=0;ii<theUpdates.size();ii++)
+                {
+                    const ViewUpdate &update = theUpdates[ii];
+                    update.view.hidden = update.hidden;
+                    if (!update.hidden)
+                        update.view.frame = update.frame;
+                }
+                [CATransaction commit];
+            };
+        if ([NSThread currentThread] != [NSThread mainThread])
+            dispatch_async(dispatch_get_main_queue(),applyUpdates);
+        else
+            applyUpdates();
     }
 }
 
@@ -19,6 +19,9 @@
  */
 
 #import "WhirlyGeometry.h"
+#if defined(__ARM_NEON__)
+#import <arm_neon.h>
+#endif
 
 using namespace Eigen;
 
@@ -70,14 +73,67 @@ bool IntersectUnitSphere(Point3d org,Vector3d dir,Point3d &hit)
 
 bool PointInPolygon(Point2f pt,const std::vector<Point2f> &ring)
 {
-	size_t ii, jj;
-	bool c = false;
-	for (ii = 0, jj = ring.size()-1; ii < ring.size(); jj = ii++) {
-		if ( ((ring[ii].y()>pt.y()) != (ring[jj].y()>pt.y())) &&
-			(pt.x() < (ring[jj].x()-ring[ii].x()) * (pt.y()-ring[ii].y()) / (ring[jj].y()-ring[ii].y()) + ring[ii].x()) )
-			c = !c;
-	}
-	return c;
+    if (ring.empty())
+        return false;
+    return PointInPolygonRing(pt,&ring[0],ring.size());
+}
+
+// One edge of the crossing test, prev to cur
+static inline bool EdgeCrosses(const Point2f &prev,const Point2f &cur,const Point2f &pt)
+{
+    return ((cur.y()>pt.y()) != (prev.y()>pt.y())) &&
+        (pt.x() < (prev.x()-cur.x()) * (pt.y()-cur.y()) / (prev.y()-cur.y()) + cur.x());
+}
+
+bool PointInPolygonRing(const Point2f &pt,const Point2f *pts,size_t numPts)
+{
+    if (numPts < 3)
+        return false;
+
+    bool c = false;
+    size_t ii = 1;
+
+#if defined(__ARM_NEON__)
+    // Four edges per pass.  The scalar test divides to find where the
+    //  edge crosses the point's y; here both sides are multiplied
+    //  through by the edge's y extent instead, with the comparison
+    //  flipped when that's negative, so the lanes stay divide free.
+    //  The points are packed x,y pairs, which is what vld2 wants.
+    if (numPts >= 9)
+    {
+        float32x4_t px = vdupq_n_f32(pt.x());
+        float32x4_t py = vdupq_n_f32(pt.y());
+        float32x4_t zero = vdupq_n_f32(0.0);
+        uint32x4_t parity = vdupq_n_u32(0);
+        for (; ii + 4 <= numPts; ii += 4)
+        {
+            float32x4x2_t prev = vld2q_f32((const float *)&pts[ii-1]);
+            float32x4x2_t cur = vld2q_f32((const float *)&pts[ii]);
+            // Only edges that straddle the point's y can cross
+            uint32x4_t straddle = veorq_u32(vcgtq_f32(prev.val[1],py),vcgtq_f32(cur.val[1],py));
+            // t = (px-xi)*d - (xj-xi)*(py-yi), where d = yj-yi.
+            // The crossing is left of the point when t and d disagree in sign.
+            float32x4_t d = vsubq_f32(prev.val[1],cur.val[1]);
+            float32x4_t t = vsubq_f32(vmulq_f32(vsubq_f32(px,cur.val[0]),d),
+                                      vmulq_f32(vsubq_f32(prev.val[0],cur.val[0]),vsubq_f32(py,cur.val[1])));
+            uint32x4_t toggle = vorrq_u32(vandq_u32(vcgtq_f32(d,zero),vcltq_f32(t,zero)),
+                                          vandq_u32(vcltq_f32(d,zero),vcgtq_f32(t,zero)));
+            parity = veorq_u32(parity,vandq_u32(straddle,toggle));
+        }
+        // Each lane holds the parity of its own edges; fold them together
+        uint32x2_t fold = veor_u32(vget_low_u32(parity),vget_high_u32(parity));
+        c = ((vget_lane_u32(fold,0) ^ vget_lane_u32(fold,1)) != 0);
+    }
+#endif
+
+    // Whatever the vector pass didn't cover, plus the closing edge
+    for (; ii < numPts; ii++)
+        if (EdgeCrosses(pts[ii-1],pts[ii],pt))
+            c = !c;
+    if (EdgeCrosses(pts[numPts-1],pts[0],pt))
+        c = !c;
+
+    return c;
 }
     
 bool ConvexPolyIntersect(const std::vector<Point2f> &pts0,const std::vector<Point2f> &pts1)
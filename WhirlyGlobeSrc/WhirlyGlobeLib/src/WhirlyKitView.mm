@@ -30,6 +30,11 @@ using namespace Eigen;
 {
     /// Called when positions are updated
     WhirlyKitViewWatcherDelegateSet watchDelegates;
+    /// Last couple of matrix inverses we handed out.  A pan event works
+    ///  with the gesture's start transform and the current one, so two
+    ///  slots cover the usual traffic.
+    Eigen::Matrix4d invCacheSrc[2],invCacheResult[2];
+    int invCacheValid;
 }
 
 - (id)init
@@ -42,6 +47,8 @@ using namespace Eigen;
 		_farPlane = 4.0;
         _lastChangedTime = CFAbsoluteTimeGetCurrent();
         _continuousZoom = false;
+        _viewStateVersion = 0;
+        invCacheValid = 0;
     }
     
     return self;
@@ -90,6 +97,26 @@ using namespace Eigen;
     return [self calcViewMatrix] * [self calcModelMatrix];
 }
 
+- (Eigen::Matrix4d)cachedMatrixInverse:(const Eigen::Matrix4d &)mat
+{
+    for (int ii=0;ii<invCacheValid;ii++)
+        if (invCacheSrc[ii] == mat)
+            return invCacheResult[ii];
+
+    // Keep the newest result in front
+    if (invCacheValid > 0)
+    {
+        invCacheSrc[1] = invCacheSrc[0];
+        invCacheResult[1] = invCacheResult[0];
+    }
+    invCacheSrc[0] = mat;
+    invCacheResult[0] = mat.inverse();
+    if (invCacheValid < 2)
+        invCacheValid++;
+
+    return invCacheResult[0];
+}
+
 - (Eigen::Matrix4d)calcProjectionMatrix:(Point2f)frameBufferSize margin:(float)margin
 {
 	GLfloat near=0,far=0;
@@ -248,9 +275,12 @@ using namespace Eigen;
 
 - (void)runViewUpdates
 {
+    // Every watcher sees the same version, so they can share one
+    //  view state snapshot for this change
+    _viewStateVersion++;
     for (WhirlyKitViewWatcherDelegateSet::iterator it = watchDelegates.begin();
          it != watchDelegates.end(); ++it)
-        [(*it) viewUpdated:self];    
+        [(*it) viewUpdated:self];
 }
 
 @end
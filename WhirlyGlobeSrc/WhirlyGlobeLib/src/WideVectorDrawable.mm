@@ -98,6 +98,113 @@ static const char *fragmentShaderTri =
 "}                                                   \n"
 ;
 
+WideVectorGPUDrawable::WideVectorGPUDrawable()
+    : BasicDrawable("WideVectorGPU"), width(10.0/1024.0), texRepeat(1.0), miterLimit(2.0)
+{
+    prevIndex = addAttribute(BDFloat3Type, "a_prevPos");
+    nextIndex = addAttribute(BDFloat3Type, "a_nextPos");
+    sideTexIndex = addAttribute(BDFloat2Type, "a_sideTex");
+}
+
+void WideVectorGPUDrawable::addPrevPoint(const Point3d &pt)
+{
+    addAttributeValue(prevIndex, Point3f(pt.x(),pt.y(),pt.z()));
+}
+
+void WideVectorGPUDrawable::addNextPoint(const Point3d &pt)
+{
+    addAttributeValue(nextIndex, Point3f(pt.x(),pt.y(),pt.z()));
+}
+
+void WideVectorGPUDrawable::addSideTex(float side,float texY)
+{
+    addAttributeValue(sideTexIndex, Point2f(side,texY));
+}
+
+void WideVectorGPUDrawable::draw(WhirlyKitRendererFrameInfo *frameInfo, Scene *scene)
+{
+    if (frameInfo.program)
+    {
+        float scale = frameInfo.sceneRenderer.framebufferWidth;
+        float screenSize = frameInfo.screenSizeInDisplayCoords.x();
+        frameInfo.program->setUniform("u_length", width/scale);
+        float texScale = scale/(screenSize*texRepeat);
+        frameInfo.program->setUniform("u_texScale", texScale);
+        frameInfo.program->setUniform("u_miterLimit", miterLimit);
+    }
+
+    BasicDrawable::draw(frameInfo,scene);
+}
+
+// The join expansion lives in here.  Each vertex sees its neighbors, so
+//  it can work out the segment normals in screen space and push itself
+//  out along the (limited) miter direction.
+static const char *vertexShaderGPUTri =
+"uniform mat4  u_mvpMatrix;"
+"uniform float u_fade;"
+"uniform float u_length;"
+"uniform float u_texScale;"
+"uniform float u_miterLimit;"
+""
+"attribute vec3 a_position;"
+"attribute vec3 a_prevPos;"
+"attribute vec3 a_nextPos;"
+"attribute vec2 a_sideTex;"
+"attribute vec4 a_color;"
+""
+"varying vec2 v_texCoord;"
+"varying vec4 v_color;"
+""
+"void main()"
+"{"
+"   v_texCoord = vec2((a_sideTex.x+1.0)/2.0, a_sideTex.y * u_texScale);"
+"   v_color = a_color;"
+"   vec4 vertPos = u_mvpMatrix * vec4(a_position,1.0);"
+"   vertPos /= vertPos.w;"
+"   vec4 prevPos = u_mvpMatrix * vec4(a_prevPos,1.0);"
+"   prevPos /= prevPos.w;"
+"   vec4 nextPos = u_mvpMatrix * vec4(a_nextPos,1.0);"
+"   nextPos /= nextPos.w;"
+"   vec2 dirA = vertPos.xy - prevPos.xy;"
+"   vec2 dirB = nextPos.xy - vertPos.xy;"
+"   if (length(dirA) < 1e-6)  dirA = dirB;"
+"   if (length(dirB) < 1e-6)  dirB = dirA;"
+"   dirA = normalize(dirA);"
+"   dirB = normalize(dirB);"
+"   vec2 normA = vec2(-dirA.y,dirA.x);"
+"   vec2 normB = vec2(-dirB.y,dirB.x);"
+"   vec2 miterDir = normA + normB;"
+"   if (length(miterDir) < 1e-6)"
+"     miterDir = normA;"
+"   else"
+"     miterDir = normalize(miterDir);"
+"   float miterScale = 1.0 / max(dot(miterDir,normA), 1.0/u_miterLimit);"
+"   gl_Position = vertPos + vec4(miterDir * a_sideTex.x * u_length * miterScale, 0, 0);"
+"}"
+;
+
+WhirlyKit::OpenGLES2Program *BuildWideVectorGPUProgram()
+{
+    OpenGLES2Program *shader = new OpenGLES2Program(kWideVectorGPUShaderName,vertexShaderGPUTri,fragmentShaderTri);
+    if (!shader->isValid())
+    {
+        delete shader;
+        shader = NULL;
+    }
+
+    // Set some reasonable defaults
+    if (shader)
+    {
+        glUseProgram(shader->getProgram());
+
+        shader->setUniform("u_length", 10.f/1024);
+        shader->setUniform("u_texScale", 1.f);
+        shader->setUniform("u_miterLimit", 2.f);
+    }
+
+    return shader;
+}
+
 WhirlyKit::OpenGLES2Program *BuildWideVectorProgram()
 {
     OpenGLES2Program *shader = new OpenGLES2Program(kWideVectorShaderName,vertexShaderTri,fragmentShaderTri);
@@ -19,6 +19,7 @@
  */
 
 #import "WideVectorManager.h"
+#import "DefaultShaderPrograms.h"
 #import "NSDictionary+Stuff.h"
 #import "UIColor+Stuff.h"
 #import "FlatMath.h"
@@ -39,6 +40,7 @@ using namespace Eigen;
     _shader = [desc intForKey:@"shader" default:EmptyIdentity];
     _width = [desc floatForKey:@"width" default:2.0];
     _coordType = (WhirlyKit::WideVectorCoordsType)[desc enumForKey:@"wideveccoordtype" values:@[@"real",@"screen"] default:WideVecCoordScreen];
+    _implType = (WhirlyKit::WideVectorImplType)[desc enumForKey:@"widevecimpl" values:@[@"cpu",@"gpu"] default:WideVecImplCPU];
     _joinType = (WhirlyKit::WideVectorLineJoinType)[desc enumForKey:@"wideveclinejointype" values:@[@"miter",@"round",@"bevel"] default:WideVecMiterJoin];
     _capType = (WhirlyKit::WideVectorLineCapType)[desc enumForKey:@"wideveclinecaptype" values:@[@"butt",@"round",@"square"] default:WideVecButtCap];
     _texID = [desc intForKey:@"texture" default:EmptyIdentity];
@@ -712,6 +714,20 @@ public:
             if (vecInfo.coordType == WideVecCoordReal)
             {
                 drawable = new BasicDrawable("WideVector");
+            } else if (vecInfo.implType == WideVecImplGPU)
+            {
+                WideVectorGPUDrawable *gpuDrawable = new WideVectorGPUDrawable();
+                drawable = gpuDrawable;
+                // Unless the caller brought their own shader, we need the
+                //  GPU extrusion program rather than the regular one
+                SimpleIdentity progID = vecInfo.shader;
+                if (progID == EmptyIdentity ||
+                    progID == scene->getProgramIDBySceneName(kToolkitDefaultWideVectorProgram))
+                    progID = scene->getProgramIDBySceneName(kToolkitDefaultWideVectorGPUProgram);
+                drawable->setProgram(progID);
+                gpuDrawable->setTexRepeat(vecInfo.repeatSize);
+                gpuDrawable->setWidth(vecInfo.width);
+                gpuDrawable->setMiterLimit(vecInfo.miterLimit);
             } else {
                 WideVectorDrawable *wideDrawable = new WideVectorDrawable();
                 drawable = wideDrawable;
@@ -738,9 +754,86 @@ public:
         return drawable;
     }
     
+    // GPU extrusion path.  We emit just the spine, two vertices per point
+    //  with neighbor and side attributes, and the shader pushes the edges
+    //  out.  A fraction of the geometry of the CPU path and no join
+    //  triangles at all.
+    void addLinearGPU(VectorRing &pts,const Point3d &up)
+    {
+        RGBAColor color = [vecInfo.color asRGBAColor];
+
+        // Convert to display space up front, tossing duplicates
+        std::vector<Point3d> dispPts;
+        dispPts.reserve(pts.size());
+        for (unsigned int ii=0;ii<pts.size();ii++)
+        {
+            const Point2f &geoPt = pts[ii];
+            Point3d dispPt = coordAdapter->localToDisplay(coordSys->geographicToLocal3d(GeoCoord(geoPt.x(),geoPt.y()))) - dispCenter;
+            if (dispPts.empty() || dispPts.back() != dispPt)
+            {
+                dispPts.push_back(dispPt);
+                drawMbr.addPoint(geoPt);
+            }
+        }
+        unsigned int numPts = (unsigned int)dispPts.size();
+        if (numPts < 2)
+            return;
+
+        // A really long line may have to span drawables.  We repeat the
+        //  boundary point so the shared segment doesn't go missing.
+        double texLen = 0.0;
+        unsigned int start = 0;
+        while (start < numPts-1)
+        {
+            BasicDrawable *baseDrawable = getDrawable(4,2);
+            WideVectorGPUDrawable *drawable = dynamic_cast<WideVectorGPUDrawable *>(baseDrawable);
+            if (!drawable)
+                return;
+            unsigned int room = (MaxDrawablePoints - drawable->getNumPoints())/2;
+            unsigned int numHere = std::min(numPts-start,room);
+            if (numHere < 2)
+                break;
+
+            int baseVert = drawable->getNumPoints();
+            for (unsigned int ii=0;ii<numHere;ii++)
+            {
+                unsigned int which = start+ii;
+                const Point3d &pt = dispPts[which];
+                const Point3d &prevPt = dispPts[(which > 0) ? which-1 : 0];
+                const Point3d &nextPt = dispPts[(which < numPts-1) ? which+1 : numPts-1];
+                if (ii > 0)
+                    texLen += (pt-dispPts[which-1]).norm();
+                for (unsigned int side=0;side<2;side++)
+                {
+                    drawable->addPoint(pt);
+                    drawable->addPrevPoint(prevPt);
+                    drawable->addNextPoint(nextPt);
+                    drawable->addSideTex((side == 0) ? -1.0 : 1.0, texLen);
+                    drawable->addNormal(up);
+                    drawable->addColor(color);
+                }
+                if (ii > 0)
+                {
+                    int thisVert = baseVert + 2*ii;
+                    drawable->addTriangle(BasicDrawable::Triangle(thisVert-2,thisVert-1,thisVert+1));
+                    drawable->addTriangle(BasicDrawable::Triangle(thisVert-2,thisVert+1,thisVert));
+                }
+            }
+
+            start += numHere-1;
+        }
+    }
+
     // Add the points for a linear
     void addLinear(VectorRing &pts,const Point3d &up)
     {
+        // The GPU extrusion path skips the whole builder below
+        if (vecInfo.implType == WideVecImplGPU && vecInfo.coordType == WideVecCoordScreen)
+        {
+            addLinearGPU(pts,up);
+            return;
+        }
+
         // Note: Debugging
         RGBAColor color = [vecInfo.color asRGBAColor];
 //        color.r = random()%256;
@@ -1006,9 +1099,7 @@ void WideVectorManager::removeVectors(SimpleIDSet &vecIDs,ChangeSet &changes)
             {
                 SimpleIDSet allIDs = sceneRep->drawIDs;
                 allIDs.insert(sceneRep->instIDs.begin(),sceneRep->instIDs.end());
-                for (SimpleIDSet::iterator it = allIDs.begin();
-                     it != allIDs.end(); ++it)
-                    changes.push_back(new FadeChangeRequest(*it, curTime, curTime+sceneRep->fade));
+                changes.push_back(new FadeGangChangeRequest(allIDs, curTime, curTime+sceneRep->fade));
                 
                 // Spawn off the deletion for later
                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, sceneRep->fade * NSEC_PER_SEC),
@@ -0,0 +1,92 @@
+/*
+ *  WorkRegulator.mm
+ *  WhirlyGlobeLib
+ *
+ *  Created by Steve Gifford on 7/8/14.
+ *  Copyright 2011-2014 mousebird consulting
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#import <algorithm>
+#import "WorkRegulator.h"
+
+// Sustained over-budget frames before we back off another notch.
+// Roughly a second and a half of bad frames at 60Hz.
+static const int EscalateAfterFrames = 90;
+// Sustained healthy frames before we ease back up.  Recovery is slower
+//  than escalation on purpose; a hot device takes a while to cool.
+static const int RecoverAfterFrames = 600;
+
+// The level is written by the render thread and read anywhere.  It's an
+//  aligned int, so readers see one of the valid values; a slightly stale
+//  read just means one extra (or one fewer) piece of droppable work.
+static volatile int curLevel = WhirlyKit::WorkRegulator::WorkNormal;
+
+// Render thread only
+static NSTimeInterval frameBudget = 1.5/60.0;
+static int slowFrames = 0;
+static int goodFrames = 0;
+
+namespace WhirlyKit
+{
+
+WorkRegulator::Level WorkRegulator::getLevel()
+{
+    return (Level)curLevel;
+}
+
+int WorkRegulator::scaleCount(int fullCount)
+{
+    switch (getLevel())
+    {
+        case WorkNormal:
+            return fullCount;
+        case WorkReduced:
+            return std::max(fullCount/2,1);
+        case WorkMinimal:
+            return 0;
+    }
+
+    return fullCount;
+}
+
+void WorkRegulator::noteFrame(NSTimeInterval frameDuration)
+{
+    if (frameDuration > frameBudget)
+    {
+        slowFrames++;
+        goodFrames = 0;
+        if (slowFrames > EscalateAfterFrames && curLevel < WorkMinimal)
+        {
+            curLevel = curLevel + 1;
+            slowFrames = 0;
+        }
+    } else {
+        goodFrames++;
+        slowFrames = 0;
+        if (goodFrames > RecoverAfterFrames && curLevel > WorkNormal)
+        {
+            curLevel = curLevel - 1;
+            goodFrames = 0;
+        }
+    }
+}
+
+void WorkRegulator::setFrameBudget(NSTimeInterval budget)
+{
+    if (budget > 0.0)
+        frameBudget = budget;
+}
+
+}
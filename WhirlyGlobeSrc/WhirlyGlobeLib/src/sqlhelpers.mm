@@ -45,7 +45,61 @@ void OneShot(sqlite3 *db,NSString *stmtStr)
 {
 	OneShot(db,[stmtStr cStringUsingEncoding:NSASCIIStringEncoding]);
 }
-	
+
+// Standard connection setup
+void ConfigureConnection(sqlite3 *db,int busyTimeoutMs,bool useWAL)
+{
+    sqlite3_busy_timeout(db,busyTimeoutMs);
+    if (useWAL)
+    {
+        // This hands back the resulting mode as a row, so OneShot won't do.
+        // A read only database will just refuse, which is fine.
+        StatementRead modeStmt(db,"PRAGMA journal_mode=WAL;");
+        modeStmt.stepRow();
+    }
+}
+
+StatementCache::StatementCache(sqlite3 *db)
+    : db(db)
+{
+}
+
+StatementCache::~StatementCache()
+{
+    flush();
+}
+
+// Hand back a compiled statement, compiling it if it's new
+sqlite3_stmt *StatementCache::get(const char *stmtStr)
+{
+    if (!stmtStr)
+        return NULL;
+
+    std::map<std::string,sqlite3_stmt *>::iterator it = stmts.find(stmtStr);
+    if (it != stmts.end())
+    {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db,stmtStr,-1,&stmt,NULL) != SQLITE_OK)
+        return NULL;
+    stmts[stmtStr] = stmt;
+
+    return stmt;
+}
+
+// Toss everything we compiled
+void StatementCache::flush()
+{
+    for (std::map<std::string,sqlite3_stmt *>::iterator it = stmts.begin();
+         it != stmts.end(); ++it)
+        sqlite3_finalize(it->second);
+    stmts.clear();
+}
+
 // Constructor for the read statement
 StatementRead::StatementRead(sqlite3 *db,const char *stmtStr,bool justRun)
 {
@@ -58,25 +112,62 @@ StatementRead::StatementRead(sqlite3 *db,NSString *stmtStr,bool justRun)
 	init(db,[stmtStr cStringUsingEncoding:NSASCIIStringEncoding] ,justRun);
 }
 
+// Cached versions.  The statement belongs to the cache; we just reset it
+StatementRead::StatementRead(StatementCache &cache,const char *stmtStr,bool justRun)
+{
+    valid = false;
+    db = cache.getDb();
+    stmt = cache.get(stmtStr);
+    isFinalized = false;
+    fromCache = true;
+    curField = 0;
+    curBind = 1;
+    if (!stmt)
+        return;
+
+    valid = true;
+    if (justRun)
+        stepRow();
+}
+
+StatementRead::StatementRead(StatementCache &cache,NSString *stmtStr,bool justRun)
+{
+    valid = false;
+    db = cache.getDb();
+    stmt = cache.get([stmtStr cStringUsingEncoding:NSASCIIStringEncoding]);
+    isFinalized = false;
+    fromCache = true;
+    curField = 0;
+    curBind = 1;
+    if (!stmt)
+        return;
+
+    valid = true;
+    if (justRun)
+        stepRow();
+}
+
 void StatementRead::init(sqlite3 *db,const char *stmtStr,bool justRun)
 {
     valid = false;
     if (!stmtStr)
-        return;    
-    
+        return;
+
 	this->db = db;
 	stmt = NULL;
 	isFinalized = false;
+	fromCache = false;
 	curField = 0;
-	
+	curBind = 1;
+
 	if (sqlite3_prepare_v2(db,stmtStr,-1,&stmt,NULL) != SQLITE_OK)
     {
         return;
     }
-	
+
 	if (justRun)
 		stepRow();
-    
+
     valid = true;
 }
 		
@@ -113,12 +204,48 @@ void StatementRead::finalize()
 {
 	if (!isFinalized && valid)
 	{
-		sqlite3_finalize(stmt);
+		if (fromCache)
+		{
+			// The cache owns it.  Just hand it back clean
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+		} else
+			sqlite3_finalize(stmt);
 		isFinalized = true;
 		stmt = NULL;
 	}
 }
-	
+
+// Bind an integer parameter
+void StatementRead::add(int iVal)
+{
+	if (isFinalized)
+		throw 1;
+
+	sqlite3_bind_int(stmt,curBind++,iVal);
+}
+
+// Bind a double parameter
+void StatementRead::add(double dVal)
+{
+	if (isFinalized)
+		throw 1;
+
+	sqlite3_bind_double(stmt,curBind++,dVal);
+}
+
+// Bind a string parameter
+void StatementRead::add(NSString *str)
+{
+	if (isFinalized)
+		throw 1;
+
+	if (str != nil)
+		sqlite3_bind_text(stmt, curBind++, [str cStringUsingEncoding:NSASCIIStringEncoding], -1, SQLITE_TRANSIENT);
+	else
+		sqlite3_bind_null(stmt, curBind++);
+}
+
 // Return int from the current row
 int StatementRead::getInt()
 {
@@ -187,10 +314,38 @@ StatementWrite::StatementWrite(sqlite3 *db,NSString *stmtStr)
 {
 	init(db,[stmtStr cStringUsingEncoding:NSASCIIStringEncoding]);
 }
-	
+
+// Cached versions.  The statement belongs to the cache; we just reset it
+StatementWrite::StatementWrite(StatementCache &cache,const char *stmtStr)
+{
+    isFinalized = false;
+    fromCache = true;
+    stmt = cache.get(stmtStr);
+    if (!stmt)
+    {
+        NSLog(@"Sqlite error: %s",sqlite3_errmsg(cache.getDb()));
+        throw 1;
+    }
+    curField = 1;
+}
+
+StatementWrite::StatementWrite(StatementCache &cache,NSString *stmtStr)
+{
+    isFinalized = false;
+    fromCache = true;
+    stmt = cache.get([stmtStr cStringUsingEncoding:NSASCIIStringEncoding]);
+    if (!stmt)
+    {
+        NSLog(@"Sqlite error: %s",sqlite3_errmsg(cache.getDb()));
+        throw 1;
+    }
+    curField = 1;
+}
+
 void StatementWrite::init(sqlite3 *db,const char *stmtStr)
 {
 	isFinalized = false;
+	fromCache = false;
 	if (sqlite3_prepare_v2(db,stmtStr,-1,&stmt,NULL) != SQLITE_OK)
     {
         NSLog(@"Sqlite error: %s",sqlite3_errmsg(db));
@@ -220,7 +375,13 @@ void StatementWrite::finalize()
 {
 	if (!isFinalized)
 	{
-		sqlite3_finalize(stmt);
+		if (fromCache)
+		{
+			// The cache owns it.  Just hand it back clean
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+		} else
+			sqlite3_finalize(stmt);
 		isFinalized = true;
 		stmt = NULL;
 	}
@@ -260,8 +421,72 @@ void StatementWrite::add(BOOL bVal)
 {
 	if (isFinalized)
 		throw 1;
-	
+
 	sqlite3_bind_text(stmt, curField++, (bVal ? "yes" : "no"), -1, SQLITE_STATIC);
 }
-	
+
+// Start the transaction
+ScopedTransaction::ScopedTransaction(sqlite3 *db)
+    : db(db), isDone(false)
+{
+    OneShot(db,"BEGIN;");
+}
+
+// Roll back anything left hanging
+ScopedTransaction::~ScopedTransaction()
+{
+    if (!isDone)
+    {
+        try {
+            OneShot(db,"ROLLBACK;");
+        }
+        catch (...) { }
+    }
+}
+
+void ScopedTransaction::commit()
+{
+    OneShot(db,"COMMIT;");
+    isDone = true;
+}
+
+ConnectionPool::ConnectionPool(NSString *dbPath,int flags)
+    : flags(flags)
+{
+    path = [dbPath cStringUsingEncoding:NSASCIIStringEncoding];
+    pthread_mutex_init(&poolLock,NULL);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (std::map<pthread_t,sqlite3 *>::iterator it = connections.begin();
+         it != connections.end(); ++it)
+        sqlite3_close(it->second);
+    connections.clear();
+    pthread_mutex_destroy(&poolLock);
+}
+
+// Hand back this thread's connection, opening one if it's the first ask
+sqlite3 *ConnectionPool::getForThread()
+{
+    pthread_t self = pthread_self();
+
+    pthread_mutex_lock(&poolLock);
+    std::map<pthread_t,sqlite3 *>::iterator it = connections.find(self);
+    sqlite3 *conn = (it != connections.end() ? it->second : NULL);
+    pthread_mutex_unlock(&poolLock);
+    if (conn)
+        return conn;
+
+    if (sqlite3_open_v2(path.c_str(),&conn,flags,NULL) != SQLITE_OK)
+        return NULL;
+    ConfigureConnection(conn,1000,false);
+
+    pthread_mutex_lock(&poolLock);
+    connections[self] = conn;
+    pthread_mutex_unlock(&poolLock);
+
+    return conn;
+}
+
 }
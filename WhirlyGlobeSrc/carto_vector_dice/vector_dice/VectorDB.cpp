@@ -8,6 +8,9 @@
 
 #include "VectorDB.h"
 #include "zlib.h"
+#include <queue>
+// Header-only, shared with the toolkit so the frames match up
+#include "../../WhirlyGlobeLib/include/DataCompressor.h"
 
 using namespace Kompex;
 
@@ -101,11 +104,22 @@ int VectorDatabase::addVectorLayer(const char *name)
     
 // Compress data
 // Courtesy: http://stackoverflow.com/questions/6466178/how-to-convert-an-nsdata-to-a-zip-file-with-objective-c/6466832#6466832
-bool CompressData(void *data,int dataLen,void **retData,int &retDataLen)
+bool CompressData(void *data,int dataLen,void **retData,int &retDataLen,bool useLZ4)
 {
     if (dataLen == 0)
         return false;
-    
+
+    if (useLZ4)
+    {
+        std::vector<unsigned char> frame;
+        if (!WhirlyKit::CodecCompressBuffer(data, dataLen, WhirlyKit::DataCodecLZ4, frame))
+            return false;
+        *retData = malloc(frame.size());
+        memcpy(*retData, &frame[0], frame.size());
+        retDataLen = (int)frame.size();
+        return true;
+    }
+
     z_stream strm;
     
     strm.zalloc = Z_NULL;
@@ -536,6 +550,303 @@ void VectorDatabase::vectorToDBFormat(std::vector<OGRFeature *> &features,std::v
     retData.insert(retData.end(), vecData.begin(), vecData.end());
 }
 
+// Patch a 32 bit integer into data we've already written
+static void SetInt32(std::vector<unsigned char> &vecData,size_t where,int iVal)
+{
+    memcpy(&vecData[where],&iVal,4);
+}
+
+// Triangle area helper for the rank calculation
+static float TriAreaF(const float *a,const float *b,const float *c)
+{
+    return fabsf((b[0]-a[0])*(c[1]-a[1]) - (c[0]-a[0])*(b[1]-a[1]))/2.f;
+}
+
+// Visvalingam ranks for one pooled ring.  This mirrors what the toolkit's
+//  VectorRankPoints() does at runtime, so we can do the work here instead.
+// Appends one rank per point, keeping the rank pool parallel to the point pool.
+static void RankPooledRing(const std::vector<float> &pointPool,int startPt,int numPts,bool closed,std::vector<float> &rankPool)
+{
+    size_t base = rankPool.size();
+    rankPool.resize(base+numPts,MAXFLOAT);
+    if (numPts < 3)
+        return;
+    const float *pts = &pointPool[2*startPt];
+    float *ranks = &rankPool[base];
+
+    // Doubly linked list over the surviving points
+    std::vector<int> prevPt(numPts),nextPt(numPts);
+    for (int ii=0;ii<numPts;ii++)
+    {
+        prevPt[ii] = ii-1;
+        nextPt[ii] = ii+1;
+    }
+    if (closed)
+    {
+        prevPt[0] = numPts-1;
+        nextPt[numPts-1] = 0;
+    } else {
+        prevPt[0] = -1;
+        nextPt[numPts-1] = -1;
+    }
+
+    // Min heap of (effective area,point).  Stale entries are just skipped.
+    typedef std::pair<float,int> AreaEntry;
+    std::priority_queue<AreaEntry,std::vector<AreaEntry>,std::greater<AreaEntry> > minHeap;
+    std::vector<float> curArea(numPts,MAXFLOAT);
+    for (int ii=0;ii<numPts;ii++)
+        if (prevPt[ii] >= 0 && nextPt[ii] >= 0)
+        {
+            curArea[ii] = TriAreaF(&pts[2*prevPt[ii]],&pts[2*ii],&pts[2*nextPt[ii]]);
+            minHeap.push(AreaEntry(curArea[ii],ii));
+        }
+
+    float maxSoFar = 0.0;
+    int numLeft = numPts;
+    int minLeft = closed ? 3 : 2;
+    while (!minHeap.empty() && numLeft > minLeft)
+    {
+        AreaEntry entry = minHeap.top();
+        minHeap.pop();
+        int ii = entry.second;
+        // Already gone, or the area has been recomputed since
+        if (ranks[ii] != MAXFLOAT || entry.first != curArea[ii])
+            continue;
+
+        // Force the areas monotonic so the subsets nest
+        maxSoFar = std::max(maxSoFar,entry.first);
+        ranks[ii] = maxSoFar;
+        numLeft--;
+
+        // Unlink the point and rescore the neighbors
+        int pi = prevPt[ii], ni = nextPt[ii];
+        if (pi >= 0)
+            nextPt[pi] = ni;
+        if (ni >= 0)
+            prevPt[ni] = pi;
+        if (pi >= 0 && ranks[pi] == MAXFLOAT && prevPt[pi] >= 0 && nextPt[pi] >= 0)
+        {
+            curArea[pi] = TriAreaF(&pts[2*prevPt[pi]],&pts[2*pi],&pts[2*nextPt[pi]]);
+            minHeap.push(AreaEntry(curArea[pi],pi));
+        }
+        if (ni >= 0 && ranks[ni] == MAXFLOAT && prevPt[ni] >= 0 && nextPt[ni] >= 0)
+        {
+            curArea[ni] = TriAreaF(&pts[2*prevPt[ni]],&pts[2*ni],&pts[2*nextPt[ni]]);
+            minHeap.push(AreaEntry(curArea[ni],ni));
+        }
+    }
+}
+
+// Append a ring's points to the pool in radians, expanding the MBR.
+// Returns the index of the first point in the pool.
+static int AddRingToPool(OGRLineString *ring,std::vector<float> &pointPool,float mbr[4])
+{
+    int startPt = (int)(pointPool.size()/2);
+    for (unsigned int pp=0;pp<ring->getNumPoints();pp++)
+    {
+        OGRPoint pt;
+        ring->getPoint(pp, &pt);
+        float x = pt.getX() / 180.0 * M_PI;
+        float y = pt.getY() / 180.0 * M_PI;
+        pointPool.push_back(x);
+        pointPool.push_back(y);
+        if (x < mbr[0])  mbr[0] = x;
+        if (y < mbr[1])  mbr[1] = y;
+        if (x > mbr[2])  mbr[2] = x;
+        if (y > mbr[3])  mbr[3] = y;
+    }
+    return startPt;
+}
+
+// Write one geometry record and its feature table entry
+static void AddGeomToBinary(OGRGeometry *geom,std::vector<unsigned char> &vecData,std::vector<unsigned char> &featTable,std::vector<float> &pointPool,std::vector<float> &rankPool)
+{
+    float mbr[4] = {MAXFLOAT,MAXFLOAT,-MAXFLOAT,-MAXFLOAT};
+    int geomOffset = (int)vecData.size();
+
+    switch (geom->getGeometryType())
+    {
+        case wkbPoint:
+        {
+            OGRPoint *pt = (OGRPoint *)geom;
+            float x = pt->getX() / 180.0 * M_PI;
+            float y = pt->getY() / 180.0 * M_PI;
+            int startPt = (int)(pointPool.size()/2);
+            pointPool.push_back(x);
+            pointPool.push_back(y);
+            rankPool.push_back(MAXFLOAT);
+            mbr[0] = mbr[2] = x;  mbr[1] = mbr[3] = y;
+            // One loop of one point
+            AddToData(vecData,(int)1);
+            AddToData(vecData,(int)1);
+            AddToData(vecData,startPt);
+        }
+            break;
+        case wkbLineString:
+        {
+            OGRLineString *line = (OGRLineString *)geom;
+            int startPt = AddRingToPool(line,pointPool,mbr);
+            RankPooledRing(pointPool,startPt,(int)line->getNumPoints(),false,rankPool);
+            AddToData(vecData,(int)1);
+            AddToData(vecData,(int)line->getNumPoints());
+            AddToData(vecData,startPt);
+        }
+            break;
+        case wkbPolygon:
+        {
+            OGRPolygon *poly = (OGRPolygon *)geom;
+            int numLoops = 1+poly->getNumInteriorRings();
+            AddToData(vecData,(int)numLoops);
+            for (int ll=0;ll<numLoops;ll++)
+            {
+                OGRLinearRing *ring = (ll == 0) ? poly->getExteriorRing() : poly->getInteriorRing(ll-1);
+                int startPt = AddRingToPool(ring,pointPool,mbr);
+                RankPooledRing(pointPool,startPt,(int)ring->getNumPoints(),true,rankPool);
+                AddToData(vecData,(int)ring->getNumPoints());
+                AddToData(vecData,startPt);
+            }
+        }
+            break;
+        default:
+            throw (std::string)"Unhandled geometry type.";
+            break;
+    }
+
+    // The feature record is the MBR and where the geometry starts
+    for (unsigned int ii=0;ii<4;ii++)
+        AddToData(featTable,mbr[ii]);
+    AddToData(featTable,geomOffset);
+}
+
+void VectorDatabase::vectorToDBBinaryFormat(std::vector<OGRFeature *> &features,std::vector<unsigned char> &retData)
+{
+    // Group features by identical attributes, same as the raw format
+    VectorChunkSet vectorChunks;
+
+    for (unsigned int ii=0;ii<features.size();ii++)
+    {
+        OGRFeature *feature = features[ii];
+
+        // Look for a match
+        VectorChunk testChunk;
+        testChunk.features.push_back(feature);
+        VectorChunkSet::iterator it = vectorChunks.find(&testChunk);
+        // Add it to the existing one
+        if (it != vectorChunks.end())
+        {
+            VectorChunk *oldChunk = *it;
+            oldChunk->features.push_back(feature);
+        } else {
+            // Add it new
+            VectorChunk *newChunk = new VectorChunk();
+            newChunk->features.push_back(feature);
+            vectorChunks.insert(newChunk);
+        }
+    }
+
+    if (vectorChunks.empty())
+        return;
+
+    VectorTileAttrInfo attrInfo;
+    std::vector<unsigned char> vecData;
+    std::vector<float> pointPool,rankPool;
+
+    // Header.  The table offsets get patched in as we go.
+    vecData.push_back('W');  vecData.push_back('G');
+    vecData.push_back('V');  vecData.push_back('B');
+    AddToData(vecData,(int)1);
+    AddToData(vecData,(int)vectorChunks.size());
+    size_t chunkTableAt = vecData.size();   AddToData(vecData,(int)0);
+    size_t stringTableAt = vecData.size();  AddToData(vecData,(int)0);
+    size_t pointPoolAt = vecData.size();    AddToData(vecData,(int)0);
+    size_t rankPoolAt = vecData.size();     AddToData(vecData,(int)0);
+
+    // Chunk table.  Fixed 20 byte records, filled in below.
+    SetInt32(vecData,chunkTableAt,(int)vecData.size());
+    size_t chunkRecBase = vecData.size();
+    for (unsigned int ii=0;ii<vectorChunks.size();ii++)
+        for (unsigned int jj=0;jj<5;jj++)
+            AddToData(vecData,(int)0);
+
+    // Work through the chunks, writing as we go
+    int chunkIdx = 0;
+    for (VectorChunkSet::iterator it = vectorChunks.begin(); it != vectorChunks.end(); ++it)
+    {
+        VectorChunk *chunk = *it;
+        size_t chunkRec = chunkRecBase + 20*chunkIdx;
+
+        // All the attributes for this chunk.  They'll all be identical.
+        OGRFeature *feat = chunk->mainFeature();
+        SetInt32(vecData,chunkRec+0,(int)vecData.size());
+        SetInt32(vecData,chunkRec+4,(int)feat->GetFieldCount());
+        for (unsigned int fi=0;fi<feat->GetFieldCount();fi++)
+            attrInfo.addAttribute(feat,fi,vecData);
+
+        SetInt32(vecData,chunkRec+8,(int)chunk->geomType());
+        SetInt32(vecData,chunkRec+12,(int)chunk->numFeatures());
+
+        // Geometry records first, building up the feature table as we go.
+        // That way the feature records need no patching.
+        std::vector<unsigned char> featTable;
+        for (unsigned int ii=0;ii<chunk->features.size();ii++)
+        {
+            OGRGeometry *thisGeom = chunk->features[ii]->GetGeometryRef();
+            switch (thisGeom->getGeometryType())
+            {
+                case wkbPoint:
+                case wkbLineString:
+                case wkbPolygon:
+                    AddGeomToBinary(thisGeom,vecData,featTable,pointPool,rankPool);
+                    break;
+                case wkbMultiPoint:
+                case wkbMultiLineString:
+                case wkbMultiPolygon:
+                {
+                    OGRGeometryCollection *geomC = (OGRGeometryCollection *)thisGeom;
+                    for (unsigned int mi=0;mi<geomC->getNumGeometries();mi++)
+                        AddGeomToBinary(geomC->getGeometryRef(mi),vecData,featTable,pointPool,rankPool);
+                }
+                    break;
+                default:
+                    throw (std::string)"Unhandled geometry type.";
+                    break;
+            }
+        }
+
+        // Now the feature table, with fixed 20 byte records
+        SetInt32(vecData,chunkRec+16,(int)vecData.size());
+        vecData.insert(vecData.end(), featTable.begin(), featTable.end());
+
+        chunkIdx++;
+    }
+
+    // Clean up the sorted vectors
+    for (VectorChunkSet::iterator it = vectorChunks.begin(); it != vectorChunks.end(); ++it)
+        delete *it;
+
+    // String table
+    SetInt32(vecData,stringTableAt,(int)vecData.size());
+    attrInfo.convert(vecData);
+
+    // Point pool, 4 byte aligned, and then the parallel rank pool
+    while (vecData.size() % 4 != 0)
+        vecData.push_back(0);
+    SetInt32(vecData,pointPoolAt,(int)vecData.size());
+    if (!pointPool.empty())
+    {
+        const unsigned char *poolBytes = (const unsigned char *)&pointPool[0];
+        vecData.insert(vecData.end(), poolBytes, poolBytes + 4*pointPool.size());
+    }
+    SetInt32(vecData,rankPoolAt,(int)vecData.size());
+    if (!rankPool.empty())
+    {
+        const unsigned char *rankBytes = (const unsigned char *)&rankPool[0];
+        vecData.insert(vecData.end(), rankBytes, rankBytes + 4*rankPool.size());
+    }
+
+    retData = vecData;
+}
+
 bool VectorDatabase::addVectorTile(int x,int y,int level,int layerID,const char *data,unsigned int dataLen)
 {
     // Calculate a quad index for later use
@@ -598,6 +909,75 @@ bool VectorDatabase::addVectorTile(int x,int y,int level,int layerID,const char
     return true;
 }
     
+bool VectorDatabase::addCompressedVectorTile(int x,int y,int level,int layerID,const char *data,unsigned int dataLen)
+{
+    // Calculate a quad index for later use
+    int quadIndex = 0;
+    for (int iq=0;iq<level;iq++)
+        quadIndex += (1<<iq)*(1<<iq);
+    quadIndex += y*(1<<level) + x;
+
+    try {
+        if (!insertStmts[layerID])
+        {
+            insertStmts[layerID] = new SQLiteStatement(db);
+            insertStmts[layerID]->Sql((std::string)"INSERT INTO " + layerNames[layerID] + "_table (data,level,x,y,quadindex) VALUES (@data,@level,@x,@y,@quadinex);");
+        }
+        SQLiteStatement *insertStmt = insertStmts[layerID];
+
+        // The caller compressed the data for us
+        insertStmt->BindBlob(1, (void *)data, dataLen);
+        insertStmt->BindInt(2, level);
+        insertStmt->BindInt(3, x);
+        insertStmt->BindInt(4, y);
+        insertStmt->BindInt(5, quadIndex);
+        insertStmt->Execute();
+        insertStmt->Reset();
+    }
+    catch (SQLiteException &exc)
+    {
+        std::string errorStr = (std::string)"Failed to write to database:\n" + exc.GetString();
+        valid = false;
+        throw errorStr;
+    }
+    catch (...)
+    {
+        std::string errorStr = "Unknown error";
+        valid = false;
+        throw errorStr;
+    }
+
+    return true;
+}
+
+void VectorDatabase::beginBatch()
+{
+    try {
+        SQLiteStatement stmt(db);
+        stmt.SqlStatement((std::string)"BEGIN TRANSACTION");
+    }
+    catch (SQLiteException &exc)
+    {
+        std::string errorStr = (std::string)"Failed to write to database:\n" + exc.GetString();
+        valid = false;
+        throw errorStr;
+    }
+}
+
+void VectorDatabase::commitBatch()
+{
+    try {
+        SQLiteStatement stmt(db);
+        stmt.SqlStatement((std::string)"END TRANSACTION");
+    }
+    catch (SQLiteException &exc)
+    {
+        std::string errorStr = (std::string)"Failed to write to database:\n" + exc.GetString();
+        valid = false;
+        throw errorStr;
+    }
+}
+
 void VectorDatabase::flush()
 {
     try {
@@ -47,10 +47,25 @@ public:
     
     // Convert OGR vector data to our raw format
     void vectorToDBFormat(std::vector<OGRFeature *> &features,std::vector<unsigned char> &vecData);
-    
+
+    // Convert OGR vector data to the paged binary format (WGVB).
+    // Fixed size tables, one big point pool, and precomputed MBRs and
+    //  simplification ranks, so the runtime does bulk copies instead
+    //  of a parse.
+    void vectorToDBBinaryFormat(std::vector<OGRFeature *> &features,std::vector<unsigned char> &vecData);
+
     // Add the data for a vector tile
     bool addVectorTile(int x,int y,int level,int layerID,const char *data,unsigned int dataLen);
-    
+
+    // Add the data for a vector tile the caller has already run through CompressData()
+    bool addCompressedVectorTile(int x,int y,int level,int layerID,const char *data,unsigned int dataLen);
+
+    // Start a batched transaction for tile writes
+    void beginBatch();
+
+    // Commit the current batch of tile writes
+    void commitBatch();
+
     // Create the quadIndex index
     void createIndex();
     
@@ -75,7 +90,9 @@ protected:
 };
     
 // Simple compression routine.  Release data when done.
-    bool CompressData(void *data,int dataLen,void **retData,int &retDataLen);
+// Pass useLZ4 for an LZ4 codec frame instead of gzip; the toolkit
+//  readers detect which one they got.
+    bool CompressData(void *data,int dataLen,void **retData,int &retDataLen,bool useLZ4 = false);
     
 }
 
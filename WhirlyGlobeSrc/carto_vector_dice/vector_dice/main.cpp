@@ -16,6 +16,7 @@
 #include "cpl_minixml.h"
 #include "tinyxml2.h"
 #include <dirent.h>
+#include <pthread.h>
 #include <vector>
 #include <fstream>
 #include <iostream>
@@ -338,6 +339,18 @@ void TransformLayer(OGRLayer *inLayer,std::vector<OGRFeature *> &inFeatures,OGRL
                         exit(-1);
                     }
             }
+
+            // Point labels carry a placement rank, filled in per cell at dice time
+            if (dataType == MapnikConfig::SymbolDataPoint)
+            {
+                OGRFieldDefn rankDef("mx_layoutRank",OFTInteger);
+                if (outLayer->GetLayerDefn()->GetFieldIndex("mx_layoutRank") == -1)
+                    if (outLayer->CreateField(&rankDef) != OGRERR_NONE)
+                    {
+                        fprintf(stderr,"Unable to create field in output file");
+                        exit(-1);
+                    }
+            }
             
             for (unsigned int igeom=0;igeom<geoms.size();igeom++)
             {
@@ -385,7 +398,11 @@ void TransformLayer(OGRLayer *inLayer,std::vector<OGRFeature *> &inFeatures,OGRL
                                 newFeature->SetField(fieldName.c_str(), fieldVal);
                         }
                     }
-                    
+
+                    // Everything starts out unplaced; the dice loop fills the rank in
+                    if (dataType == MapnikConfig::SymbolDataPoint)
+                        newFeature->SetField("mx_layoutRank", -1);
+
                     outLayer->CreateFeature(newFeature);
                     OGRFeature::DestroyFeature(newFeature);
                 }
@@ -532,6 +549,63 @@ bool MergeIntoShapeFile(std::vector<OGRFeature *> &features,OGRLayer *srcLayer,O
     return true;
 }
 
+// Rough label metrics for the pre-layout pass, in pixels at tile resolution.
+// These just need to be in the ballpark of what the renderer draws.
+static const double LabelCharWidthPx = 7.0;
+static const double LabelHeightPx = 14.0;
+static const double LabelTilePixels = 256.0;
+
+// Work out which point labels within a cell can all be on screen at once.
+// Greedy pass in feature order: anything that doesn't collide with an
+//  earlier winner gets the next rank, colliders stay at -1 and the runtime
+//  layout sorts them out the old way.
+void PreLayoutLabels(std::vector<OGRFeature *> &features,double tileSpanX,double tileSpanY)
+{
+    if (features.empty())
+        return;
+    int rankIdx = features[0]->GetFieldIndex("mx_layoutRank");
+    if (rankIdx == -1)
+        return;
+
+    double unitsPerPixX = tileSpanX / LabelTilePixels;
+    double unitsPerPixY = tileSpanY / LabelTilePixels;
+
+    std::vector<OGREnvelope> placed;
+    int rank = 0;
+    for (unsigned int ii=0;ii<features.size();ii++)
+    {
+        OGRFeature *feat = features[ii];
+        int nameIdx = feat->GetFieldIndex("name");
+        const char *name = (nameIdx == -1 ? NULL : feat->GetFieldAsString(nameIdx));
+        if (!name || !name[0])
+            continue;
+        OGRGeometry *geom = feat->GetGeometryRef();
+        if (!geom || wkbFlatten(geom->getGeometryType()) != wkbPoint)
+            continue;
+        OGRPoint *pt = (OGRPoint *)geom;
+
+        // Estimate the box the label will take up, centered on the point
+        double halfW = strlen(name) * LabelCharWidthPx / 2.0 * unitsPerPixX;
+        double halfH = LabelHeightPx / 2.0 * unitsPerPixY;
+        OGREnvelope box;
+        box.MinX = pt->getX() - halfW;  box.MaxX = pt->getX() + halfW;
+        box.MinY = pt->getY() - halfH;  box.MaxY = pt->getY() + halfH;
+
+        bool collides = false;
+        for (unsigned int jj=0;jj<placed.size();jj++)
+            if (placed[jj].Intersects(box))
+            {
+                collides = true;
+                break;
+            }
+        if (!collides)
+        {
+            feat->SetField(rankIdx,rank++);
+            placed.push_back(box);
+        }
+    }
+}
+
 // Used for tracking what we build
 class BuildStats
 {
@@ -628,8 +702,116 @@ OGRDataSource *LoadAndCheck(const char *inputFile,OGREnvelope *clipEnv,OGRSpatia
     return poDS;
 }
 
+// Hands out work unit indices to the worker threads
+class WorkQueue
+{
+public:
+    WorkQueue() : next(0) { pthread_mutex_init(&lock,NULL); }
+    ~WorkQueue() { pthread_mutex_destroy(&lock); }
+
+    // Grab the next work unit index
+    int fetch()
+    {
+        pthread_mutex_lock(&lock);
+        int ret = next++;
+        pthread_mutex_unlock(&lock);
+        return ret;
+    }
+
+    int next;
+    pthread_mutex_t lock;
+};
+
+// One cell's worth of dicing work
+class ChopCell
+{
+public:
+    int ix,iy;
+    OGREnvelope clipEnv;
+};
+
+// Per-thread state for the dice loop.  Coordinate transforms aren't
+//  safe to share between threads, so each worker builds its own.
+class ChopWorker
+{
+public:
+    pthread_t thread;
+    WorkQueue *queue;
+    std::vector<ChopCell> *cells;
+    LayerSpatialIndex *layerIndex;
+    OGRLayer *layer;
+    OGRSpatialReference *hTrgSRS,*hTileSRS;
+    OGRCoordinateTransformation *tileTransform;
+    const char *targetDir;
+    const char *layerName;
+    MapnikConfig::SymbolDataType dataType;
+    int level;
+    BuildStats *stats;
+    pthread_mutex_t *statsLock;
+};
+
+// Dice cells until the queue runs dry.
+// Each cell writes its own shapefile, so the workers don't collide on output.
+void *ChopCells(void *threadInfo)
+{
+    ChopWorker *worker = (ChopWorker *)threadInfo;
+    std::vector<ChopCell> &cells = *worker->cells;
+
+    do {
+        int which = worker->queue->fetch();
+        if (which >= cells.size())
+            break;
+        ChopCell &cell = cells[which];
+
+        std::vector<OGRFeature *> clippedFeatures;
+        ClipInputToBox(worker->layerIndex,cell.clipEnv.MinX,cell.clipEnv.MinY,cell.clipEnv.MaxX,cell.clipEnv.MaxY,worker->hTrgSRS,clippedFeatures,worker->tileTransform);
+
+        int numFeat = (int)clippedFeatures.size();
+        pthread_mutex_lock(worker->statsLock);
+        worker->stats->minFeat = std::min(worker->stats->minFeat,numFeat);
+        worker->stats->maxFeat = std::max(worker->stats->maxFeat,numFeat);
+        worker->stats->numTiles++;
+        worker->stats->featAvg += numFeat;
+        pthread_mutex_unlock(worker->statsLock);
+
+        if (numFeat > 0)
+        {
+            // Point labels get a placement pass in tile coordinates, so the
+            //  runtime only has to resolve conflicts across tile edges
+            if (worker->dataType == MapnikConfig::SymbolDataPoint)
+            {
+                double spanX = cell.clipEnv.MaxX - cell.clipEnv.MinX;
+                double spanY = cell.clipEnv.MaxY - cell.clipEnv.MinY;
+                if (worker->tileTransform)
+                {
+                    double xs[2] = {cell.clipEnv.MinX,cell.clipEnv.MaxX};
+                    double ys[2] = {cell.clipEnv.MinY,cell.clipEnv.MaxY};
+                    if (worker->tileTransform->Transform(2,xs,ys))
+                    {
+                        spanX = xs[1] - xs[0];
+                        spanY = ys[1] - ys[0];
+                    }
+                }
+                PreLayoutLabels(clippedFeatures,spanX,spanY);
+            }
+
+            std::string cellDir = (std::string)worker->targetDir + "/" + std::to_string(worker->level) + "/" + std::to_string(cell.iy) + "/";
+            mkdir(cellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+            const char *typeName = (worker->dataType == MapnikConfig::SymbolDataPoint ? "_p" : ((worker->dataType == MapnikConfig::SymbolDataLinear) ? "_l" : ((worker->dataType == MapnikConfig::SymbolDataAreal) ? "_a" : "_u")));
+            std::string cellFileName = cellDir + std::to_string(cell.ix) + worker->layerName + typeName + ".shp";
+            if (!MergeIntoShapeFile(clippedFeatures,worker->layer,worker->hTileSRS,cellFileName.c_str()))
+                exit(-1);
+        }
+
+        for (unsigned int ii=0;ii<clippedFeatures.size();ii++)
+            OGRFeature::DestroyFeature(clippedFeatures[ii]);
+    } while (true);
+
+    return NULL;
+}
+
 // Chop up a shapefile into little bits
-void ChopShapefile(const char *layerName,OGRDataSource *poDS,std::vector<OGRFeature *> &inFeatures,std::vector<MapnikConfig::CompiledSymbolizerTable::SymbolizerGroup> &symGroups, MapnikConfig::SymbolDataType dataType,const char *targetDir,double xmin,double ymin,double xmax,double ymax,int level,OGRSpatialReference *hTrgSRS,OGRSpatialReference *hTileSRS,BuildStats &stats,OGREnvelope &totalEnv,OGREnvelope *clipEnv,int &copiedFeatures)
+void ChopShapefile(const char *layerName,OGRDataSource *poDS,std::vector<OGRFeature *> &inFeatures,std::vector<MapnikConfig::CompiledSymbolizerTable::SymbolizerGroup> &symGroups, MapnikConfig::SymbolDataType dataType,const char *targetDir,double xmin,double ymin,double xmax,double ymax,int level,OGRSpatialReference *hTrgSRS,OGRSpatialReference *hTileSRS,BuildStats &stats,OGREnvelope &totalEnv,OGREnvelope *clipEnv,int numThreads,int &copiedFeatures)
 {
     // Number of cells at this level
     int numCells = 1<<level;
@@ -661,13 +843,6 @@ void ChopShapefile(const char *layerName,OGRDataSource *poDS,std::vector<OGRFeat
             fprintf(stderr,"Can't transform from coordinate system to destination for input\n");
             exit(-1);
         }
-        OGRCoordinateTransformation *tileTransform = OGRCreateCoordinateTransformation(hTrgSRS,hTileSRS);
-        if (!tileTransform)
-        {
-            fprintf(stderr,"Can't transform from coordinate system to tile for input file\n");
-            exit(-1);
-        }
-
         OGRDataSource *memDS = memDriver->CreateDataSource("memory");
         OGRLayer *layer = memDS->CreateLayer("layer",hTrgSRS);
 
@@ -684,60 +859,95 @@ void ChopShapefile(const char *layerName,OGRDataSource *poDS,std::vector<OGRFeat
         sx = std::max(sx,0);  sy = std::max(sy,0);
         ex = std::min(ex,numCells-1);  ey = std::min(ey,numCells-1);
         
-        // Work through the possible cells
+        // Clip index: bucket the feature MBRs into cells first, so we
+        //  only run intersection tests in cells a feature actually touches
+        std::set<std::pair<int,int> > coveredCells;
+        for (unsigned int fi=0;fi<layerIndex.mbrs.size();fi++)
+        {
+            const OGREnvelope &mbr = layerIndex.mbrs[fi];
+            int fsx = std::max((int)floor((mbr.MinX - xmin) / cellSizeX),sx);
+            int fsy = std::max((int)floor((mbr.MinY - ymin) / cellSizeY),sy);
+            int fex = std::min((int)floor((mbr.MaxX - xmin) / cellSizeX),ex);
+            int fey = std::min((int)floor((mbr.MaxY - ymin) / cellSizeY),ey);
+            for (int iy=fsy;iy<=fey;iy++)
+                for (int ix=fsx;ix<=fex;ix++)
+                    coveredCells.insert(std::make_pair(ix,iy));
+        }
+
+        // Work through the possible cells, collecting the ones worth dicing
+        std::vector<ChopCell> cells;
         for (unsigned int iy=sy;iy<=ey;iy++)
         {
             for (unsigned int ix=sx;ix<=ex;ix++)
             {
-                std::string cellDir = (std::string)targetDir + "/" + std::to_string(iy) + "/";
-                std::string cellFileName = cellDir + std::to_string(ix) + ".shp";
-                
-                // Clip the input geometry to this cell
                 OGREnvelope cellEnv;
                 cellEnv.MinX = ix*cellSizeX+xmin;
                 cellEnv.MinY = iy*cellSizeY+ymin;
                 cellEnv.MaxX = (ix+1)*cellSizeX+xmin;
                 cellEnv.MaxY = (iy+1)*cellSizeY+ymin;
-                
+
                 // Check against clip bounds
                 if (clipEnv && !(clipEnv->Intersects(cellEnv) || clipEnv->Contains(cellEnv)))
                     continue;
-                
+
                 // Make sure we include the clipping box
                 OGREnvelope toClipEnv = cellEnv;
                 if (clipEnv)
                     toClipEnv.Intersect(*clipEnv);
-                
+
                 totalEnv.Merge(cellEnv);
-                
-                std::vector<OGRFeature *> clippedFeatures;
-                ClipInputToBox(&layerIndex,toClipEnv.MinX,toClipEnv.MinY,toClipEnv.MaxX,toClipEnv.MaxY,hTrgSRS,clippedFeatures,tileTransform);
-                
-                //                    fprintf(stdout, "            Cell (%d,%d):  %d features\n",ix,iy,cellLayer->GetFeatureCount());
-                
-                // Clean up and flush output data
-                int numFeat = (int)clippedFeatures.size();
-                stats.minFeat = std::min(stats.minFeat,numFeat);
-                stats.maxFeat = std::max(stats.maxFeat,numFeat);
-                stats.numTiles++;
-                stats.featAvg += numFeat;
-                if (numFeat > 0)
+
+                // The clip index already knows this cell is empty
+                if (coveredCells.find(std::make_pair((int)ix,(int)iy)) == coveredCells.end())
                 {
-                    std::string cellDir = (std::string)targetDir + "/" + std::to_string(level) + "/" + std::to_string(iy) + "/";
-                    mkdir(cellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-                    const char *typeName = (dataType == MapnikConfig::SymbolDataPoint ? "_p" : ((dataType == MapnikConfig::SymbolDataLinear) ? "_l" : ((dataType == MapnikConfig::SymbolDataAreal) ? "_a" : "_u")));
-                    std::string cellFileName = cellDir + std::to_string(ix) + layerName + typeName + ".shp";
-                    if (!MergeIntoShapeFile(clippedFeatures,layer,hTileSRS,cellFileName.c_str()))
-                        exit(-1);
+                    stats.minFeat = 0;
+                    stats.numTiles++;
+                    continue;
                 }
-                
-                for (unsigned int ii=0;ii<clippedFeatures.size();ii++)
-                    OGRFeature::DestroyFeature(clippedFeatures[ii]);
+
+                ChopCell cell;
+                cell.ix = ix;  cell.iy = iy;
+                cell.clipEnv = toClipEnv;
+                cells.push_back(cell);
             }
         }
-        
+
+        // Fan the cells out across the worker threads
+        WorkQueue queue;
+        pthread_mutex_t statsLock;
+        pthread_mutex_init(&statsLock,NULL);
+        std::vector<ChopWorker> workers(numThreads);
+        for (unsigned int ti=0;ti<workers.size();ti++)
+        {
+            ChopWorker &worker = workers[ti];
+            worker.queue = &queue;
+            worker.cells = &cells;
+            worker.layerIndex = &layerIndex;
+            worker.layer = layer;
+            worker.hTrgSRS = hTrgSRS;
+            worker.hTileSRS = hTileSRS;
+            worker.tileTransform = OGRCreateCoordinateTransformation(hTrgSRS,hTileSRS);
+            if (!worker.tileTransform)
+            {
+                fprintf(stderr,"Can't transform from coordinate system to tile for input file\n");
+                exit(-1);
+            }
+            worker.targetDir = targetDir;
+            worker.layerName = layerName;
+            worker.dataType = dataType;
+            worker.level = level;
+            worker.stats = &stats;
+            worker.statsLock = &statsLock;
+            pthread_create(&worker.thread, NULL, ChopCells, &worker);
+        }
+        for (unsigned int ti=0;ti<workers.size();ti++)
+        {
+            pthread_join(workers[ti].thread, NULL);
+            delete workers[ti].tileTransform;
+        }
+        pthread_mutex_destroy(&statsLock);
+
         OGRDataSource::DestroyDataSource(memDS);
-        delete tileTransform;
         delete transform;
     }
 }
@@ -745,7 +955,194 @@ void ChopShapefile(const char *layerName,OGRDataSource *poDS,std::vector<OGRFeat
 // Merge vectors from the source into the dest
 void MergeDataIntoLayer(OGRLayer *destLayer,OGRLayer *srcLayer)
 {
-    
+
+}
+
+// A tile's worth of vector DB output.  The workers build and compress
+//  these in memory and the main thread commits them in batches.
+class PendingTile
+{
+public:
+    PendingTile() : ix(0), iy(0), layerID(0), hasData(false) { }
+
+    int ix,iy;
+    int layerID;
+    bool hasData;
+    std::vector<unsigned char> compressed;
+};
+
+// Per-thread state for assembling DB tiles out of the diced shapefiles.
+//  Each worker opens its own datasource handles.
+class DBCellWorker
+{
+public:
+    pthread_t thread;
+    WorkQueue *queue;
+    std::vector<int> *cellXs;
+    int level,iy;
+    const char *targetDir;
+    const char *webDbDir,*webDbName;
+    std::vector<std::string> *localLayerNames;
+    std::vector<int> *layerIDs;
+    bool mergeLayers;
+    bool useLZ4;
+    bool binaryFormat;
+    int numOut;
+    int maxLevelSeen;
+    Maply::VectorDatabase *vectorDb;
+    std::set<std::string> *yFileNames;
+    bool fileNameCache;
+    std::vector<PendingTile> *pendingTiles;
+};
+
+// Assemble DB tiles until the queue runs dry
+void *ProcessDBCells(void *threadInfo)
+{
+    DBCellWorker *worker = (DBCellWorker *)threadInfo;
+    std::vector<int> &cellXs = *worker->cellXs;
+    std::vector<std::string> &localLayerNames = *worker->localLayerNames;
+    std::vector<int> &layerIDs = *worker->layerIDs;
+
+    do {
+        int which = worker->queue->fetch();
+        if (which >= cellXs.size())
+            break;
+        int ix = cellXs[which];
+
+        // Work through the layers at this level
+        std::vector<OGRDataSource *> dataSources;
+        std::vector<OGRFeature *> layerFeatures;
+        for (unsigned int li=0;li<localLayerNames.size();li++)
+        {
+            // Load all the data types together into memory at once
+            std::string layerName = localLayerNames[li];
+            std::string cellDir = (std::string)worker->targetDir + "/" + std::to_string(worker->level) + "/" + std::to_string(worker->iy) + "/";
+
+            for (int di=0;di<MapnikConfig::SymbolDataUnknown;di++)
+            {
+                const char *typeName = (di == MapnikConfig::SymbolDataPoint ? "_p" : ((di == MapnikConfig::SymbolDataLinear) ? "_l" : ((di == MapnikConfig::SymbolDataAreal) ? "_a" : "_u")));
+                std::string cellFileName = cellDir + std::to_string(ix) + layerName + typeName + ".shp";
+
+                // Look for the filename in the name cache.  Faster.
+                if (worker->fileNameCache)
+                    if (worker->yFileNames->find(cellFileName) == worker->yFileNames->end())
+                        continue;
+
+                // Open the shapefile and get pointers to the features
+                OGRDataSource *poCDS = shpDriver->Open(cellFileName.c_str());
+                if (poCDS)
+                {
+                    OGRLayer *srcLayer = poCDS->GetLayer(0);
+                    for (unsigned int fi=0;fi<srcLayer->GetFeatureCount();fi++)
+                        layerFeatures.push_back(srcLayer->GetFeature(fi));
+                    dataSources.push_back(poCDS);
+                }
+            }
+
+            // Build the tile in our custom format
+            if (!worker->mergeLayers || (li == localLayerNames.size()-1))
+            {
+                try {
+                    PendingTile &outTile = (*worker->pendingTiles)[which*worker->numOut + (worker->mergeLayers ? 0 : li)];
+                    outTile.ix = ix;
+                    outTile.iy = worker->iy;
+                    std::string outLayerName = "";
+                    if (!worker->mergeLayers)
+                    {
+                        outTile.layerID = layerIDs[li];
+                        outLayerName = layerName;
+                    } else {
+                        outTile.layerID = layerIDs[0];
+                    }
+                    // Also write it out to the web DB if needed
+                    std::string webCellDir = "";
+                    std::string webCellFileName = "";
+                    if (worker->webDbDir)
+                    {
+                        webCellDir = (std::string)worker->webDbDir + "/" + std::to_string(worker->level) + "/" + std::to_string(ix) + "/";
+                        webCellFileName = webCellDir + std::to_string(worker->iy) + outLayerName + ".mvt";
+                    }
+
+                    if (!layerFeatures.empty())
+                    {
+                        std::vector<unsigned char> vecData;
+                        // The web DB tiles go out to other consumers, so they stay in the raw format
+                        if (worker->binaryFormat && !worker->webDbName)
+                            worker->vectorDb->vectorToDBBinaryFormat(layerFeatures, vecData);
+                        else
+                            worker->vectorDb->vectorToDBFormat(layerFeatures, vecData);
+                        if (!vecData.empty())
+                        {
+                            // Compress the tile once, for both databases.
+                            // The web DB is served over HTTP, so it has to stay gzip.
+                            void *compressOut;
+                            int compressSize=0;
+                            if (Maply::CompressData((void *)&vecData[0], (int)vecData.size(), &compressOut, compressSize, worker->useLZ4 && !worker->webDbName))
+                            {
+                                outTile.compressed.assign((unsigned char *)compressOut,(unsigned char *)compressOut+compressSize);
+                                outTile.hasData = true;
+                                free(compressOut);
+
+                                if (worker->webDbName)
+                                {
+                                    mkdir(webCellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+                                    FILE *fp = fopen(webCellFileName.c_str(),"w");
+                                    if (!fp)
+                                    {
+                                        fprintf(stderr,"Failed to open file for write: %s\n",webCellFileName.c_str());
+                                        exit(-1);
+                                    }
+                                    if (fwrite(&outTile.compressed[0],outTile.compressed.size(),1,fp) != 1)
+                                    {
+                                        fprintf(stderr,"Failed to write to file: %s\n",webCellFileName.c_str());
+                                        exit(-1);
+                                    }
+                                    fclose(fp);
+                                }
+                            } else {
+                                fprintf(stderr,"Tile compression failed for %d: (%d,%d)\n",worker->level,ix,worker->iy);
+                                exit(-1);
+                            }
+                        }
+                    } else {
+                        // If it is empty and we're writing a web DB we need to create an empty file
+                        // This is dumb, yes.
+                        if (worker->level < worker->maxLevelSeen-1)
+                        {
+                            if (worker->webDbName)
+                            {
+                                mkdir(webCellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+                                FILE *fp = fopen(webCellFileName.c_str(),"w");
+                                if (!fp)
+                                {
+                                    fprintf(stderr,"Failed to open file for write: %s\n",webCellFileName.c_str());
+                                    exit(-1);
+                                }
+                                fclose(fp);
+                            }
+                        }
+                    }
+                }
+                catch (std::string &errorStr)
+                {
+                    fprintf(stderr,"Unable to build tile %d: (%d,%d)\nBecause: %s\n",worker->level,ix,worker->iy,errorStr.c_str());
+                    exit(-1);
+                }
+
+                // Clean up the layer features
+                for (unsigned int lf=0;lf<layerFeatures.size();lf++)
+                    delete layerFeatures[lf];
+                layerFeatures.clear();
+
+                // Clean up the data sources
+                for (unsigned int si=0;si<dataSources.size();si++)
+                    OGRDataSource::DestroyDataSource(dataSources[si]);
+                dataSources.clear();
+            }
+        }
+    } while (true);
+
+    return NULL;
 }
 
 // This is the map scale for the given level.
@@ -774,6 +1171,9 @@ int main(int argc, char * argv[])
     const char *webDbName = NULL,*webDbDir = NULL,*webDbURL = NULL;
     std::vector<std::string> pathRedirect;
     float levelScale = 4;
+    int numThreads = 1;
+    bool useLZ4 = false;
+    bool binaryFormat = false;
     
     GDALAllRegister();
     OGRRegisterAll();
@@ -896,6 +1296,14 @@ int main(int argc, char * argv[])
         {
             numArgs = 1;
             mergeLayers = true;
+        } else if (EQUAL(argv[ii],"-lz4"))
+        {
+            numArgs = 1;
+            useLZ4 = true;
+        } else if (EQUAL(argv[ii],"-binary"))
+        {
+            numArgs = 1;
+            binaryFormat = true;
         } else if (EQUAL(argv[ii],"-webdb"))
         {
             numArgs = 4;
@@ -931,9 +1339,21 @@ int main(int argc, char * argv[])
                 fprintf(stderr,"Expecting non-zero number for -levelscale");
                 return -1;
             }
+        } else if (EQUAL(argv[ii],"-threads"))
+        {
+            numArgs = 2;
+            if (ii+numArgs > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -threads");
+                return -1;
+            }
+            numThreads = atoi(argv[ii+1]);
         }
     }
 
+    if (numThreads < 1)
+        numThreads = 1;
+
     if (!targetDir)
     {
         fprintf(stderr, "Need a target directory.\n");
@@ -1129,7 +1549,7 @@ int main(int argc, char * argv[])
                             
                             int copiedFeatures = 0;
                             std::string thisLayerName = inLayer.name;
-                            ChopShapefile(thisLayerName.c_str(), inDataSource, inFeatures, symGroups, (MapnikConfig::SymbolDataType)di, targetDir, xmin, ymin, xmax, ymax, li, hTrgSRS, hTileSRS, buildStats,fullExtents, (clipBoundsSet ? &clipBounds : NULL),copiedFeatures);
+                            ChopShapefile(thisLayerName.c_str(), inDataSource, inFeatures, symGroups, (MapnikConfig::SymbolDataType)di, targetDir, xmin, ymin, xmax, ymax, li, hTrgSRS, hTileSRS, buildStats,fullExtents, (clipBoundsSet ? &clipBounds : NULL),numThreads,copiedFeatures);
                             
                             if (copiedFeatures > 0)
                             {
@@ -1233,17 +1653,18 @@ int main(int argc, char * argv[])
             return -1;
         }
         
-        // Do one big transaction
-        {
-            Kompex::SQLiteStatement transactStmt(sqliteDb);
-            transactStmt.SqlStatement((std::string)"BEGIN TRANSACTION");
-        }
-        
+        // How many tiles we'll write per transaction
+        const int TilesPerTransaction = 512;
+
         int cellsProcessed = 0;
+        int tilesInBatch = 0;
         try {
             // Set up the vector DB
             Maply::VectorDatabase *vectorDb = new Maply::VectorDatabase();
             vectorDb->setupDatabase(sqliteDb, destSRS, tileSRS, xmin, ymin, ymax, ymax, minLevelSeen, maxLevelSeen, true);
+
+            // We commit the tiles in big batched transactions
+            vectorDb->beginBatch();
             
             // Write out the styles
             for (unsigned int ii=0;ii<mapnikConfig->compiledSymTable.symGroups.size();ii++)
@@ -1336,154 +1757,73 @@ int main(int argc, char * argv[])
                         fileNameCache = false;
                     }
 
+                    // Collect the cells in the row and fan them out across
+                    //  the worker threads.  The workers read the diced
+                    //  shapefiles with their own OGR handles and build
+                    //  compressed tiles in memory.
+                    std::vector<int> cellXs;
                     for (unsigned int ix=sx;ix<=ex;ix++)
-                    {
-                        // Set up an in memory data source
-//                        OGRDataSource *memDS = memDriver->CreateDataSource("memory");
-//                        OGRLayer *memLayer = memDS->CreateLayer("layer",hTileSRS);
-                        
-                        // Work through the layers at this level
-                        std::vector<OGRDataSource *> dataSources;
-                        std::vector<OGRFeature *> layerFeatures;
-                        for (unsigned int li=0;li<layerNames.size();li++)
-                        {
-                            // Load all the data types together into memory at once
-                            std::string layerName = localLayerNames[li];
-                            std::string cellDir = (std::string)targetDir + "/" + std::to_string(level) + "/" + std::to_string(iy) + "/";
+                        cellXs.push_back(ix);
+                    int numOut = (mergeLayers ? 1 : (int)localLayerNames.size());
+                    std::vector<PendingTile> pendingTiles(cellXs.size()*numOut);
 
-                            for (int di=0;di<MapnikConfig::SymbolDataUnknown;di++)
-                            {
-                                const char *typeName = (di == MapnikConfig::SymbolDataPoint ? "_p" : ((di == MapnikConfig::SymbolDataLinear) ? "_l" : ((di == MapnikConfig::SymbolDataAreal) ? "_a" : "_u")));
-                                std::string cellFileName = cellDir + std::to_string(ix) + layerName + typeName + ".shp";
-                                
-                                // Look for the filename in the name cache.  Faster.
-                                if (fileNameCache)
-                                    if (yFileNames.find(cellFileName) == yFileNames.end())
-                                        continue;
-
-                                // Open the shapefile and get pointers to the features
-                                OGRDataSource *poCDS = shpDriver->Open(cellFileName.c_str());
-                                if (poCDS)
-                                {
-                                    OGRLayer *srcLayer = poCDS->GetLayer(0);
-                                    for (unsigned int fi=0;fi<srcLayer->GetFeatureCount();fi++)
-                                        layerFeatures.push_back(srcLayer->GetFeature(fi));
-                                    dataSources.push_back(poCDS);
-                                }
-                            }
-                            
-                            // Write the data out in our custom format
-                            if (!mergeLayers || (li == layerNames.size()-1))
-                            {
-                                try {
-                                    int layerID = 0;
-                                    std::string outLayerName = "";
-                                    if (!mergeLayers)
-                                    {
-                                        layerID = layerIDs[li];
-                                        outLayerName = layerName;
-                                    } else {
-                                        layerID = layerIDs[0];
-                                        outLayerName = "";
-                                    }
-                                    // Also write it out to the web DB if needed
-                                    std::string cellDir = "";
-                                    std::string cellFileName = "";
-                                    if (webDbDir)
-                                    {
-                                        cellDir = (std::string)webDbDir + "/" + std::to_string(level) + "/" + std::to_string(ix) + "/";
-                                        cellFileName = cellDir + std::to_string(iy) + outLayerName + ".mvt";
-                                    }
+                    WorkQueue queue;
+                    std::vector<DBCellWorker> workers(numThreads);
+                    for (unsigned int ti=0;ti<workers.size();ti++)
+                    {
+                        DBCellWorker &worker = workers[ti];
+                        worker.queue = &queue;
+                        worker.cellXs = &cellXs;
+                        worker.level = level;
+                        worker.iy = iy;
+                        worker.targetDir = targetDir;
+                        worker.webDbDir = webDbDir;
+                        worker.webDbName = webDbName;
+                        worker.localLayerNames = &localLayerNames;
+                        worker.layerIDs = &layerIDs;
+                        worker.mergeLayers = mergeLayers;
+                        worker.useLZ4 = useLZ4;
+                        worker.binaryFormat = binaryFormat;
+                        worker.numOut = numOut;
+                        worker.maxLevelSeen = maxLevelSeen;
+                        worker.vectorDb = vectorDb;
+                        worker.yFileNames = &yFileNames;
+                        worker.fileNameCache = fileNameCache;
+                        worker.pendingTiles = &pendingTiles;
+                        pthread_create(&worker.thread, NULL, ProcessDBCells, &worker);
+                    }
+                    for (unsigned int ti=0;ti<workers.size();ti++)
+                        pthread_join(workers[ti].thread, NULL);
 
-                                    if (!layerFeatures.empty())
-                                    {
-                                        std::vector<unsigned char> vecData;
-                                        vectorDb->vectorToDBFormat(layerFeatures, vecData);
-                                        if (!vecData.empty())
-                                        {
-                                            vectorDb->addVectorTile(ix, iy, level, layerID, (const char *)&vecData[0], (int)vecData.size());
-                                            
-                                            if (webDbName)
-                                            {
-                                                void *compressOut;
-                                                int compressSize=0;
-                                                // Need to compress the tiles first
-                                                if (Maply::CompressData((void *)&vecData[0], (int)vecData.size(), &compressOut, compressSize))
-                                                {
-                                                    mkdir(cellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-                                                    FILE *fp = fopen(cellFileName.c_str(),"w");
-                                                    if (!fp)
-                                                    {
-                                                        fprintf(stderr,"Failed to open file for write: %s\n",cellFileName.c_str());
-                                                        exit(-1);
-                                                    }
-                                                    if (fwrite(compressOut,compressSize,1,fp) != 1)
-                                                    {
-                                                        fprintf(stderr,"Failed to write to file: %s\n",cellFileName.c_str());
-                                                        exit(-1);
-                                                    }
-                                                    fclose(fp);
-                                                } else {
-                                                    fprintf(stderr,"Tile compression failed for %d: (%d,%d)\n",level,ix,iy);
-                                                    exit(-1);
-                                                }
-                                            }
-                                        }
-                                    } else {
-                                        // If it is empty and we're writing a web DB we need to create an empty file
-                                        // This is dumb, yes.
-                                        if (level < maxLevelSeen-1)
-                                        {
-                                            if (webDbName)
-                                            {
-                                                mkdir(cellDir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-                                                FILE *fp = fopen(cellFileName.c_str(),"w");
-                                                if (!fp)
-                                                {
-                                                    fprintf(stderr,"Failed to open file for write: %s\n",cellFileName.c_str());
-                                                    exit(-1);
-                                                }
-                                                fclose(fp);
-                                            }
-                                        }
-                                    }
-                                }
-                                catch (std::string &errorStr)
-                                {
-                                    fprintf(stderr,"Unable to write tile %d: (%d,%d)\nBecause: %s\n",level,ix,iy,errorStr.c_str());
-                                    return -1;
-                                }
-                                
-                                // Clean up the layer features
-                                for (unsigned int lf=0;lf<layerFeatures.size();lf++)
-                                    delete layerFeatures[lf];
-                                layerFeatures.clear();
-
-                                // Clean up the data sources
-                                for (unsigned int si=0;si<dataSources.size();si++)
-                                    OGRDataSource::DestroyDataSource(dataSources[si]);
-                                dataSources.clear();
-                            }
+                    // Commit the finished tiles, batching up the transactions
+                    for (unsigned int pi=0;pi<pendingTiles.size();pi++)
+                    {
+                        PendingTile &tile = pendingTiles[pi];
+                        if (!tile.hasData)
+                            continue;
+                        vectorDb->addCompressedVectorTile(tile.ix, tile.iy, level, tile.layerID, (const char *)&tile.compressed[0], (int)tile.compressed.size());
+                        if (++tilesInBatch >= TilesPerTransaction)
+                        {
+                            vectorDb->commitBatch();
+                            vectorDb->beginBatch();
+                            tilesInBatch = 0;
                         }
-                        
-                        cellsProcessed++;
-                        double done = cellsProcessed/((double)totalNumCells);
-                        GDALTermProgress(done,NULL,NULL);
                     }
+
+                    cellsProcessed += (int)cellXs.size();
+                    double done = cellsProcessed/((double)totalNumCells);
+                    GDALTermProgress(done,NULL,NULL);
                 }
             }
+
+            // Commit whatever's left in the last batch
+            vectorDb->commitBatch();
         }
         catch (const std::string &what)
         {
             fprintf(stderr,"Failed to write to target DB because:\n%s\n",what.c_str());
             return -1;
         }
-        
-        // End the big transaction
-        {
-            Kompex::SQLiteStatement transactStmt(sqliteDb);
-            transactStmt.SqlStatement((std::string)"END TRANSACTION");
-        }
 
         GDALTermProgress(1.0,NULL,NULL);
     }
@@ -8,11 +8,16 @@
 
 #include "ElevationPyramid.h"
 #include "zlib.h"
+// Header-only, shared with the toolkit so the frames match up
+#include "../../WhirlyGlobeLib/include/DataCompressor.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 using namespace Kompex;
 
 ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,const char *srs,GDALDataType dataType,double minX,double minY,double maxX,double maxY,unsigned int tileSizeX,unsigned int tileSizeY,bool compress,int minLevel,int maxLevel)
-: db(db), dataType(dataType), compress(compress), tileSizeX(tileSizeX), tileSizeY(tileSizeY), insertStmt(NULL),
+: db(db), dataType(dataType), compress(compress), deltaEncode(false), useLZ4(false), tileSizeX(tileSizeX), tileSizeY(tileSizeY), insertStmt(NULL),
     minLevel(minLevel), maxLevel(maxLevel), minx(minX), miny(minY), maxx(maxX), maxy(maxY), srs(srs)
 {
     SQLiteStatement stmt(db);
@@ -32,7 +37,7 @@ ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,const char *srs,GD
         sprintf(stmtStr,"INSERT INTO manifest (minx,miny,maxx,maxy,tilesizex,tilesizey,compressed,format,minlevel,maxlevel,srs) VALUES (%f,%f,%f,%f,%d,%d,%d,'%s',%d,%d,'%s');",minX,minY,maxX,maxY,tileSizeX,tileSizeY,1,"int16",minLevel,maxLevel,(srs ? srs : ""));
         stmt.SqlStatement(stmtStr);
         
-        stmt.SqlStatement("CREATE TABLE elevationtiles (data BLOB,level INTEGER,x INTEGER,y INTEGER,quadindex INTEGER PRIMARY KEY);");
+        stmt.SqlStatement("CREATE TABLE elevationtiles (data BLOB,level INTEGER,x INTEGER,y INTEGER,quadindex INTEGER PRIMARY KEY,maxerror REAL DEFAULT 0);");
     } catch (SQLiteException &exc) {
         fprintf(stderr,"Failed to write to database:\n%s\n",exc.GetString().c_str());
         valid = false;
@@ -42,7 +47,7 @@ ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,const char *srs,GD
 }
 
 ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,int newMaxLevel)
-: db(db)
+: db(db), deltaEncode(false), useLZ4(false), insertStmt(NULL)
 {
     SQLiteStatement stmt(db);
     
@@ -63,6 +68,14 @@ ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,int newMaxLevel)
         } else
             valid = false;
         
+        // Older databases predate the maxerror column
+        try {
+            SQLiteStatement alterStmt(db);
+            alterStmt.SqlStatement((std::string)"ALTER TABLE elevationtiles ADD maxerror REAL DEFAULT 0;");
+        } catch (SQLiteException &exc) {
+            // Already there, which is fine
+        }
+
         // Might need to update the levels
         if (newMaxLevel > maxLevel)
         {
@@ -83,11 +96,24 @@ ElevationPyramid::ElevationPyramid(Kompex::SQLiteDatabase *db,int newMaxLevel)
 
 // Compress data
 // Courtesy: http://stackoverflow.com/questions/6466178/how-to-convert-an-nsdata-to-a-zip-file-with-objective-c/6466832#6466832
-bool CompressData(void *data,int dataLen,void **retData,int &retDataLen)
+bool CompressData(void *data,int dataLen,void **retData,int &retDataLen,bool useLZ4)
 {
     if (dataLen == 0)
         return false;
-    
+
+    // LZ4 goes out in a self describing codec frame; the toolkit readers
+    //  check for the frame before falling back to gzip
+    if (useLZ4)
+    {
+        std::vector<unsigned char> frame;
+        if (!WhirlyKit::CodecCompressBuffer(data, dataLen, WhirlyKit::DataCodecLZ4, frame))
+            return false;
+        *retData = malloc(frame.size());
+        memcpy(*retData, &frame[0], frame.size());
+        retDataLen = (int)frame.size();
+        return true;
+    }
+
     z_stream strm;
     
     strm.zalloc = Z_NULL;
@@ -119,34 +145,170 @@ bool CompressData(void *data,int dataLen,void **retData,int &retDataLen)
     deflateEnd(&strm);
     
     retDataLen = (int)strm.total_out;
-    
+
     return true;
 }
 
-bool ElevationPyramid::addElevationTile(void *tileData,int x,int y,int level)
+// Header on the delta encoded tiles.  The toolkit decodes these
+//  (MaplyElevationDatabase), so the layout can't change casually.
+typedef struct
+{
+    char magic[4];              // 'WGED'
+    unsigned char version;
+    unsigned char reserved[3];
+    unsigned short sizeX,sizeY;
+    float scale,offset;
+} ElevDeltaHeader;
+
+// Same predictor PNG uses, run per sample instead of per byte
+static int PaethPredict(int a,int b,int c)
+{
+    int p = a + b - c;
+    int pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+// Quantize and delta encode a tile of int16 samples.
+// The residuals cluster near zero, which is where deflate earns its keep.
+bool DeltaEncodeTile(const short *samples,int sizeX,int sizeY,void **retData,int &retDataLen,bool useLZ4)
+{
+    int numSamples = sizeX*sizeY;
+
+    // Per chunk offset so the quantized values start at zero
+    short minVal = samples[0];
+    for (int ii=1;ii<numSamples;ii++)
+        if (samples[ii] < minVal)
+            minVal = samples[ii];
+
+    // Quantized values, then Paeth residuals (mod 2^16, like PNG does per byte)
+    unsigned short *quant = (unsigned short *)malloc(sizeof(unsigned short)*numSamples);
+    unsigned short *resid = (unsigned short *)malloc(sizeof(unsigned short)*numSamples);
+    for (int ii=0;ii<numSamples;ii++)
+        quant[ii] = (unsigned short)(samples[ii] - minVal);
+    for (int iy=0;iy<sizeY;iy++)
+        for (int ix=0;ix<sizeX;ix++)
+        {
+            int idx = iy*sizeX+ix;
+            int left = (ix > 0) ? quant[idx-1] : 0;
+            int up = (iy > 0) ? quant[idx-sizeX] : 0;
+            int upLeft = (ix > 0 && iy > 0) ? quant[idx-sizeX-1] : 0;
+            resid[idx] = (unsigned short)(quant[idx] - PaethPredict(left,up,upLeft));
+        }
+    free(quant);
+
+    void *compressOut;
+    int compressSize=0;
+    if (!CompressData(resid, sizeof(unsigned short)*numSamples, &compressOut, compressSize, useLZ4))
+    {
+        free(resid);
+        return false;
+    }
+    free(resid);
+
+    ElevDeltaHeader hdr;
+    hdr.magic[0] = 'W';  hdr.magic[1] = 'G';  hdr.magic[2] = 'E';  hdr.magic[3] = 'D';
+    hdr.version = 1;
+    hdr.reserved[0] = hdr.reserved[1] = hdr.reserved[2] = 0;
+    hdr.sizeX = sizeX;  hdr.sizeY = sizeY;
+    // Input is already int16, so the quantization is just the offset.
+    //  A float source would pick a real scale here.
+    hdr.scale = 1.0;
+    hdr.offset = minVal;
+
+    retDataLen = sizeof(ElevDeltaHeader)+compressSize;
+    *retData = malloc(retDataLen);
+    memcpy(*retData,&hdr,sizeof(hdr));
+    memcpy((char *)*retData+sizeof(hdr),compressOut,compressSize);
+    free(compressOut);
+
+    return true;
+}
+
+// Largest vertical gap between the samples and what a tile at half the
+//  resolution would reconstruct for them.  The toolkit reads this back
+//  as the tile's geometric error for screen space error paging.
+static float TileMaxError(const short *samples,int sizeX,int sizeY)
+{
+    float maxError = 0.0;
+    for (int iy=0;iy<sizeY;iy++)
+        for (int ix=0;ix<sizeX;ix++)
+        {
+            // Samples on the coarse grid survive subdivision untouched
+            if (!(ix & 1) && !(iy & 1))
+                continue;
+            int ix0 = ix & ~1, iy0 = iy & ~1;
+            int ix1 = (ix0+2 < sizeX) ? ix0+2 : sizeX-1;
+            int iy1 = (iy0+2 < sizeY) ? iy0+2 : sizeY-1;
+            float tx = (ix1 > ix0) ? (ix-ix0)/(float)(ix1-ix0) : 0.0;
+            float ty = (iy1 > iy0) ? (iy-iy0)/(float)(iy1-iy0) : 0.0;
+            float e00 = samples[iy0*sizeX+ix0], e10 = samples[iy0*sizeX+ix1];
+            float e01 = samples[iy1*sizeX+ix0], e11 = samples[iy1*sizeX+ix1];
+            float interp = (e00 + tx*(e10-e00)) + ty*((e01 + tx*(e11-e01)) - (e00 + tx*(e10-e00)));
+            float err = fabsf(samples[iy*sizeX+ix] - interp);
+            if (err > maxError)
+                maxError = err;
+        }
+
+    return maxError;
+}
+
+int ElevationPyramid::quadIndexForTile(int x,int y,int level)
 {
-    // Calculate a quad index for later use
     int quadIndex = 0;
     for (int iq=0;iq<level;iq++)
         quadIndex += (1<<iq)*(1<<iq);
     quadIndex += y*(1<<level) + x;
-    
+
+    return quadIndex;
+}
+
+bool ElevationPyramid::getExistingTileIndexes(std::set<int> &quadIndexes)
+{
+    try {
+        SQLiteStatement stmt(db);
+        stmt.Sql((std::string)"SELECT quadindex FROM elevationtiles;");
+        while (stmt.FetchRow())
+            quadIndexes.insert(stmt.GetColumnInt(0));
+        stmt.FreeQuery();
+    } catch (SQLiteException &exc) {
+        fprintf(stderr,"Failed to read from database:\n%s\n",exc.GetString().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool ElevationPyramid::addElevationTile(void *tileData,int x,int y,int level)
+{
+    // Calculate a quad index for later use
+    int quadIndex = quadIndexForTile(x,y,level);
+
     if (!insertStmt)
     {
         insertStmt = new SQLiteStatement(db);
-        insertStmt->Sql("INSERT INTO elevationtiles (data,level,x,y,quadindex) VALUES (@data,@level,@x,@y,@quadinex);");
+        insertStmt->Sql("INSERT INTO elevationtiles (data,level,x,y,quadindex,maxerror) VALUES (@data,@level,@x,@y,@quadinex,@maxerror);");
     }
     
     // Here we've got data to insert
     if (tileData)
     {
         unsigned int dataSize = sizeof(unsigned short)*tileSizeX*tileSizeY;
-        
+        float maxError = TileMaxError((const short *)tileData,tileSizeX,tileSizeY);
+
         if (compress)
         {
             void *compressOut;
             int compressSize=0;
-            if (CompressData((void *)tileData, dataSize, &compressOut, compressSize))
+            bool encodeOK;
+            if (deltaEncode)
+                encodeOK = DeltaEncodeTile((const short *)tileData,tileSizeX,tileSizeY,&compressOut,compressSize,useLZ4);
+            else
+                encodeOK = CompressData((void *)tileData, dataSize, &compressOut, compressSize, useLZ4);
+            if (encodeOK)
             {
                 // Now insert the samples into the database as a blob
                 try {
@@ -155,14 +317,17 @@ bool ElevationPyramid::addElevationTile(void *tileData,int x,int y,int level)
                     insertStmt->BindInt(3, x);
                     insertStmt->BindInt(4, y);
                     insertStmt->BindInt(5, quadIndex);
+                    insertStmt->BindDouble(6, maxError);
                     insertStmt->Execute();
                     insertStmt->Reset();
                 }
                 catch (SQLiteException &except)
                 {
                     fprintf(stderr,"Failed to write blob to database:\n%s\n",except.GetString().c_str());
+                    free(compressOut);
                     return false;
-                }            
+                }
+                free(compressOut);
             } else
                 return false;
         }
@@ -174,6 +339,7 @@ bool ElevationPyramid::addElevationTile(void *tileData,int x,int y,int level)
             insertStmt->BindInt(3, x);
             insertStmt->BindInt(4, y);
             insertStmt->BindInt(5, quadIndex);
+            insertStmt->BindDouble(6, 0.0);
             insertStmt->Execute();
             insertStmt->Reset();
         }
@@ -10,6 +10,7 @@
 #define __elev_assemble_pyramid__ElevationPyramid__
 
 #include <iostream>
+#include <set>
 #include "gdal.h"
 #include "KompexSQLitePrerequisites.h"
 #include "KompexSQLiteDatabase.h"
@@ -29,9 +30,17 @@ public:
     // Construct from a database and update a bit of info
     ElevationPyramid(Kompex::SQLiteDatabase *db,int maxLevel);
     
-    // Load the elevaiton tile and add it to the sqlite db
+    // Load the elevaiton tile and add it to the sqlite db.
+    // Also stores the tile's max geometric error (meters) alongside the samples.
     bool addElevationTile(void *tileData,int x,int y,int level);
-    
+
+    // Quad index the tiles are keyed by in the database
+    static int quadIndexForTile(int x,int y,int level);
+
+    // Fetch the quad indexes of the tiles already in the database.
+    // Used to resume a partial build.
+    bool getExistingTileIndexes(std::set<int> &quadIndexes);
+
     // Create the quadIndex index
     void createIndex();
     
@@ -52,7 +61,17 @@ public:
     
     // Check this after opening
     bool isValid() { return valid; }
-    
+
+    // Delta encode the tiles (Paeth prediction over quantized int16) rather
+    //  than deflating the raw samples.  The blobs are self describing, so
+    //  the two can mix in one database.
+    void setDeltaEncode(bool enable) { deltaEncode = enable; }
+
+    // Compress with LZ4 instead of gzip.  Decompresses much faster on
+    //  device, at a somewhat worse ratio.  These blobs are self
+    //  describing too, so they can mix with gzip in one database.
+    void setUseLZ4(bool enable) { useLZ4 = enable; }
+
 protected:
     Kompex::SQLiteDatabase *db;
     std::string srs;
@@ -61,6 +80,8 @@ protected:
     unsigned int tileSizeX,tileSizeY;
     GDALDataType dataType;
     bool compress;
+    bool deltaEncode;
+    bool useLZ4;
     bool valid;
     // Precompiled insert statement
     Kompex::SQLiteStatement *insertStmt;
@@ -17,6 +17,9 @@
 #include "cpl_minixml.h"
 #include <dirent.h>
 #include <vector>
+#include <deque>
+#include <set>
+#include <pthread.h>
 #include "KompexSQLitePrerequisites.h"
 #include "KompexSQLiteDatabase.h"
 #include "KompexSQLiteStatement.h"
@@ -105,10 +108,267 @@ GDALDatasetH CreateOutputDataFile(const char *pszFormat,const char *pszFilename,
     
     if( hDstDS == NULL )
         return NULL;
-    
+
     return hDstDS;
 }
 
+/************************************************************************/
+/*                       Threaded tile building                         */
+/************************************************************************/
+
+// How many tile inserts we'll batch into one sqlite transaction
+static const int TileTransactionBatch = 1024;
+
+// Geometry and output settings for one level.  Read only once the workers start.
+typedef struct
+{
+    unsigned int level;
+    int numChunks;
+    double xmin,ymin;
+    double sizeX,sizeY,cellX,cellY;
+    int pixelsX,pixelsY;
+    const double *adfInvGeoTransform;
+    int rasterXSize,rasterYSize;
+    const char *targetDir;
+    std::string levelDir;
+    const char *outFileFormat;
+    const char *outFormat;
+    const char *trgSrsWKT;
+    bool flipY;
+    bool wantShorts;
+} LevelContext;
+
+// One output tile waiting to be built
+typedef struct
+{
+    int ix,iy;
+} TileJob;
+
+// One built tile waiting on the writer
+typedef struct
+{
+    int ix,iy;
+    // Int16 samples.  NULL if the tile was all zeros (or nobody wants them).
+    short *tileData;
+    bool failed;
+} TileResult;
+
+// Jobs the workers pull from and results the writer drains
+class TileWorkQueue
+{
+public:
+    TileWorkQueue() : ctx(NULL), nextJob(0), failed(false)
+    {
+        pthread_mutex_init(&lock,NULL);
+        pthread_cond_init(&resultCond,NULL);
+    }
+    ~TileWorkQueue()
+    {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&resultCond);
+    }
+
+    LevelContext *ctx;
+    // One lock covers the whole queue.  The per-tile work dwarfs it.
+    pthread_mutex_t lock;
+    pthread_cond_t resultCond;
+    // Tiles left to build
+    std::vector<TileJob> jobs;
+    unsigned int nextJob;
+    // Built tiles the writer hasn't gotten to yet
+    std::deque<TileResult> results;
+    bool failed;
+};
+
+// Per-thread GDAL state.  Dataset handles and coordinate transforms
+//  aren't safe to share between threads, so each worker opens its own.
+class TileWorker
+{
+public:
+    TileWorker() : hSrcDS(NULL), hBand(NULL), hCTBack(NULL), queue(NULL) { }
+
+    pthread_t thread;
+    GDALDatasetH hSrcDS;
+    GDALRasterBandH hBand;
+    OGRCoordinateTransformationH hCTBack;
+    TileWorkQueue *queue;
+};
+
+// Workers run this until the jobs run out, sampling the source data
+//  for one output tile at a time
+void *ProcessTiles(void *threadInfo)
+{
+    TileWorker *worker = (TileWorker *)threadInfo;
+    TileWorkQueue *queue = worker->queue;
+    LevelContext *ctx = queue->ctx;
+
+    std::vector<float> tileData(ctx->pixelsX*ctx->pixelsY);
+    for (;;)
+    {
+        // Grab the next tile
+        pthread_mutex_lock(&queue->lock);
+        if (queue->failed || queue->nextJob >= queue->jobs.size())
+        {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        TileJob job = queue->jobs[queue->nextJob++];
+        pthread_mutex_unlock(&queue->lock);
+
+        // Extents for this particular tile
+        double tileMinX = ctx->xmin+job.ix*ctx->sizeX;
+        double tileMinY = ctx->ymin+job.iy*ctx->sizeY;
+        double tileMaxX = tileMinX + ctx->pixelsX * ctx->cellX;
+        double tileMaxY = tileMinY + ctx->pixelsY * ctx->cellY;
+
+        bool tileFailed = false;
+
+        GDALDatasetH hDestDS = NULL;
+        GDALRasterBandH hBandOut = NULL;
+        if (ctx->targetDir)
+        {
+            std::stringstream fileName;
+            int outY = (ctx->flipY ? (ctx->numChunks-1-job.iy) : job.iy);
+            fileName << ctx->levelDir << "/" << job.ix << "/" << outY << ".tif";
+
+            // Create the output file
+            hDestDS = CreateOutputDataFile(ctx->outFileFormat,fileName.str().c_str(),ctx->pixelsX,ctx->pixelsY,ctx->outFormat);
+            if (!hDestDS)
+                tileFailed = true;
+            else {
+                hBandOut = GDALGetRasterBand(hDestDS, 1);
+                if (!hBandOut)
+                {
+                    fprintf(stderr,"Failed to create output band.");
+                    tileFailed = true;
+                }
+            }
+        }
+
+        // Run through and query the various cells
+        for (unsigned int cy=0;cy<ctx->pixelsY && !tileFailed;cy++)
+            for (unsigned int cx=0;cx<ctx->pixelsX && !tileFailed;cx++)
+            {
+                double thisX = tileMinX + ctx->cellX*cx;
+                double thisY = tileMinY + ctx->cellY*cy;
+
+                // Project back to the original data file
+                if (worker->hCTBack)
+                    OCTTransform(worker->hCTBack, 1, &thisX, &thisY, NULL);
+
+                // Figure out which pixel this is
+                double pixX = ctx->adfInvGeoTransform[0] + ctx->adfInvGeoTransform[1] * thisX + ctx->adfInvGeoTransform[2] * thisY;
+                double pixY = ctx->adfInvGeoTransform[3] + ctx->adfInvGeoTransform[4] * thisX + ctx->adfInvGeoTransform[5] * thisY;
+
+                // Note: Should do some interpolation
+                int pixXint = (int)pixX,pixYint = (int)pixY;
+
+                double ta = pixX-pixXint;
+                double tb = pixY-pixYint;
+
+                // Look up the four nearby pixels
+                int pixXlookup[4],pixYlookup[4];
+                pixXlookup[0] = pixXint;  pixYlookup[0] = pixYint;
+                pixXlookup[1] = pixXint+1;  pixYlookup[1] = pixYint;
+                pixXlookup[2] = pixXint+1;  pixYlookup[2] = pixYint+1;
+                pixXlookup[3] = pixXint;  pixYlookup[3] = pixYint+1;
+                float pixVals[4];
+                for (unsigned int pi=0;pi<4;pi++)
+                {
+                    int pixXlook = pixXlookup[pi];
+                    int pixYlook = pixYlookup[pi];
+                    if (pixXlook < 0) pixXlook = 0;
+                    if (pixYlook < 0) pixYlook = 0;
+                    if (pixXlook >= ctx->rasterXSize)  pixXlook = ctx->rasterXSize-1;
+                    if (pixYlook >= ctx->rasterYSize)  pixYlook = ctx->rasterYSize-1;
+
+                    // Fetch the pixel
+                    if (GDALRasterIO( worker->hBand, GF_Read, pixXlook, pixYlook, 1, 1, &pixVals[pi], 1, 1, GDT_Float32, 0,  0) != CE_None)
+                    {
+                        fprintf(stderr,"Query failure in GDALRasterIO");
+                        tileFailed = true;
+                        break;
+                    }
+                }
+                if (tileFailed)
+                    break;
+
+                // Now do a bilinear interpolation
+                float pixA = (pixVals[1]-pixVals[0])*ta + pixVals[0];
+                float pixB = (pixVals[2]-pixVals[3])*ta + pixVals[3];
+                float pixVal = (pixB-pixA)*tb+pixA;
+
+                tileData[cy*ctx->pixelsX+cx] = pixVal;
+            }
+
+        // Output directory
+        if (hDestDS)
+        {
+            if (!tileFailed)
+            {
+                // Write all the data at once
+                if (GDALRasterIO( hBandOut, GF_Write, 0, 0, ctx->pixelsX, ctx->pixelsY, &tileData[0], ctx->pixelsX, ctx->pixelsX, GDT_Int16, 0, 0) != CE_None)
+                {
+                    fprintf(stderr,"Failed to write output data");
+                    tileFailed = true;
+                }
+
+                // Set projection and extents
+                GDALSetProjection(hDestDS, ctx->trgSrsWKT);
+
+                double adfOutTransform[6];
+                adfOutTransform[0] = tileMinX;
+                adfOutTransform[1] = (tileMaxX-tileMinX)/ctx->pixelsX;
+                adfOutTransform[2] = 0;
+                adfOutTransform[3] = tileMinY;
+                adfOutTransform[4] = 0;
+                adfOutTransform[5] = (tileMaxY-tileMinY)/ctx->pixelsY;
+                GDALSetGeoTransform(hDestDS, adfOutTransform);
+            }
+
+            // Close the output file
+            GDALClose(hDestDS);
+        }
+
+        TileResult result;
+        result.ix = job.ix;  result.iy = job.iy;
+        result.tileData = NULL;
+        result.failed = tileFailed;
+        if (!tileFailed && ctx->wantShorts)
+        {
+            // See if anything of is non-zero
+            bool nonZero = false;
+            for (unsigned int ip=0;ip<ctx->pixelsX*ctx->pixelsY;ip++)
+                if (tileData[ip] != 0)
+                {
+                    nonZero = true;
+                    break;
+                }
+
+            if (nonZero)
+            {
+                // The writer needs int16 data
+                result.tileData = (short *)malloc(sizeof(short)*ctx->pixelsX*ctx->pixelsY);
+                for (unsigned int ii=0;ii<ctx->pixelsX*ctx->pixelsY;ii++)
+                    result.tileData[ii] = tileData[ii];
+            }
+        }
+
+        // Hand it to the writer
+        pthread_mutex_lock(&queue->lock);
+        if (tileFailed)
+            queue->failed = true;
+        queue->results.push_back(result);
+        pthread_cond_signal(&queue->resultCond);
+        pthread_mutex_unlock(&queue->lock);
+
+        if (tileFailed)
+            break;
+    }
+
+    return NULL;
+}
+
 int main(int argc, char * argv[])
 {
     const char *inputFile = NULL;
@@ -125,6 +385,10 @@ int main(int argc, char * argv[])
     int updateMinLevel = -1, updateMaxLevel = -1;
     double updateMinX = 0.0,updateMaxX = 0.0,updateMinY = 0.0,updateMaxY = 0.0;
     const char *updateShapeFile = NULL,*outShapeFile;
+    int numThreads = 1;
+    bool resumePartial = false;
+    bool deltaEncode = false;
+    bool useLZ4 = false;
 
     GDALAllRegister();
     OGRRegisterAll();
@@ -250,6 +514,27 @@ int main(int argc, char * argv[])
                 return -1;
             }
             outShapeFile = argv[ii+1];
+        } else if (EQUAL(argv[ii],"-threads"))
+        {
+            numArgs = 2;
+            if (ii+numArgs > argc)
+            {
+                fprintf(stderr,"Expecting one argument for -threads");
+                return -1;
+            }
+            numThreads = atoi(argv[ii+1]);
+        } else if (EQUAL(argv[ii],"-resume"))
+        {
+            numArgs = 1;
+            resumePartial = true;
+        } else if (EQUAL(argv[ii],"-delta"))
+        {
+            numArgs = 1;
+            deltaEncode = true;
+        } else if (EQUAL(argv[ii],"-lz4"))
+        {
+            numArgs = 1;
+            useLZ4 = true;
         } else
         {
             if (inputFile)
@@ -294,7 +579,14 @@ int main(int argc, char * argv[])
             return -1;
         }
     }
-        
+    if (resumePartial && !targetDb)
+    {
+        fprintf(stderr, "Resume only makes sense with a target DB.");
+        return -1;
+    }
+    if (numThreads < 1)
+        numThreads = 1;
+
     Kompex::SQLiteDatabase *sqliteDb = NULL;
     ElevationPyramid *elevPyr = NULL;
 
@@ -383,6 +675,27 @@ int main(int argc, char * argv[])
         return -1;
     }
 
+    // Each worker thread gets its own dataset handle and transform.
+    //  GDAL and OGR handles aren't safe to share between threads.
+    std::vector<TileWorker> workers(numThreads);
+    for (unsigned int ti=0;ti<workers.size();ti++)
+    {
+        TileWorker &worker = workers[ti];
+        worker.hSrcDS = GDALOpen( inputFile, GA_ReadOnly );
+        if (!worker.hSrcDS)
+        {
+            fprintf(stderr, "Failed to open input for worker thread.");
+            return -1;
+        }
+        worker.hBand = GDALGetRasterBand( worker.hSrcDS, 1);
+        if (destSRS)
+        {
+            OGRSpatialReference *workerSrcSRS = new OGRSpatialReference ( GDALGetProjectionRef( worker.hSrcDS ) );
+            OGRSpatialReference *workerTrgSRS = new OGRSpatialReference ( destSRS );
+            worker.hCTBack = OCTNewCoordinateTransformation(workerTrgSRS,workerSrcSRS);
+        }
+    }
+
     // Shapefile we'll do inside/outside checks in
     std::vector<OGREnvelope> includeBounds;
     if (updateShapeFile)
@@ -505,26 +818,58 @@ int main(int argc, char * argv[])
     if (targetDir)
         mkdir(targetDir,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
     
-    // Create a new database.  Blow away the old one if it's there
+    // Create a new database.  Blow away the old one if it's there,
+    //  unless we're resuming a partial build
+    std::set<int> doneTiles;
     if (targetDb)
     {
-        remove(targetDb);
+        bool resuming = false;
+        if (resumePartial)
+        {
+            FILE *fp = fopen(targetDb,"rb");
+            if (fp)
+            {
+                fclose(fp);
+                resuming = true;
+            }
+        }
+        if (!resuming)
+            remove(targetDb);
         sqliteDb = new Kompex::SQLiteDatabase(targetDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
         if (!sqliteDb->GetDatabaseHandle())
         {
             fprintf(stderr, "Invalid sqlite database: %s\n",targetDb);
             return -1;
         }
-        elevPyr = new ElevationPyramid(sqliteDb,destSRS,GDT_Int16,xmin,ymin,xmax,ymax,pixelsX,pixelsY,true,0,levels-1);
-        if (!elevPyr->isValid())
-            return -1;
+        if (resuming)
+        {
+            // The manifest is already in place.  Find out which tiles made
+            //  it in last time so we don't redo them.
+            elevPyr = new ElevationPyramid(sqliteDb,levels-1);
+            if (!elevPyr->isValid())
+                return -1;
+            if (!elevPyr->getExistingTileIndexes(doneTiles))
+                return -1;
+            fprintf(stdout,"Resuming.  %ld tiles already built.\n",doneTiles.size());
+        } else {
+            elevPyr = new ElevationPyramid(sqliteDb,destSRS,GDT_Int16,xmin,ymin,xmax,ymax,pixelsX,pixelsY,true,0,levels-1);
+            if (!elevPyr->isValid())
+                return -1;
+        }
     }
     
     // Text version of SRS so we can write it
     char *trgSrsWKT = NULL;
     OSRExportToWkt( hTrgSRS, &trgSrsWKT );
 
-    if (targetDb)
+    if (elevPyr)
+    {
+        elevPyr->setDeltaEncode(deltaEncode);
+        elevPyr->setUseLZ4(useLZ4);
+    }
+
+    // Batch the inserts up in transactions, committing every so often below
+    if (sqliteDb)
     {
         Kompex::SQLiteStatement transactStmt(sqliteDb);
         transactStmt.SqlStatement((std::string)"BEGIN TRANSACTION");
@@ -539,7 +884,8 @@ int main(int argc, char * argv[])
     }
 
     // Work through the levels of detail, starting from the top
-    int totalTiles = 0,zeroTiles = 0, skippedTiles = 0;
+    int totalTiles = 0,zeroTiles = 0, skippedTiles = 0, resumedTiles = 0;
+    int pendingInserts = 0;
     for (unsigned int level=min_level;level<=max_level;level++)
     {
         printf("Level %d: ",level);
@@ -552,7 +898,7 @@ int main(int argc, char * argv[])
             levelDir << targetDir << "/" << level;
             mkdir(levelDir.str().c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
         }
-        
+
         int numChunks = 1<<level;
         double sizeY = (ymax-ymin)/numChunks;
         double cellY = sizeY/(pixelsY-1);
@@ -560,7 +906,7 @@ int main(int argc, char * argv[])
         double cellX = sizeX/(pixelsX-1);
 
         // We might only be updating some of the area
-        int min_ix = 0, min_iy = 0, max_ix = numChunks-1, max_iy=numChunks-1;        
+        int min_ix = 0, min_iy = 0, max_ix = numChunks-1, max_iy=numChunks-1;
         if (updateMinX != updateMaxX)
         {
             min_ix = floor((updateMinX-xmin)/sizeX);
@@ -568,10 +914,29 @@ int main(int argc, char * argv[])
             max_ix = ceil((updateMaxX-xmin)/sizeX);
             max_iy = ceil((updateMaxY-ymin)/sizeY);
         }
-        int numTilesToDo = (max_ix-min_ix+1)*(max_iy-min_iy+1);
-        int chunksProcessed = 0;
 
-        // Now through the individual files
+        // Everything the workers need to know about this level
+        LevelContext ctx;
+        ctx.level = level;
+        ctx.numChunks = numChunks;
+        ctx.xmin = xmin;  ctx.ymin = ymin;
+        ctx.sizeX = sizeX;  ctx.sizeY = sizeY;
+        ctx.cellX = cellX;  ctx.cellY = cellY;
+        ctx.pixelsX = pixelsX;  ctx.pixelsY = pixelsY;
+        ctx.adfInvGeoTransform = adfInvGeoTransform;
+        ctx.rasterXSize = rasterXSize;  ctx.rasterYSize = rasterYSize;
+        ctx.targetDir = targetDir;
+        ctx.levelDir = levelDir.str();
+        ctx.outFileFormat = outFileFormat;
+        ctx.outFormat = outFormat;
+        ctx.trgSrsWKT = trgSrsWKT;
+        ctx.flipY = flipY;
+        ctx.wantShorts = (elevPyr != NULL);
+
+        TileWorkQueue queue;
+        queue.ctx = &ctx;
+
+        // Figure out which tiles this level actually needs
         for (unsigned int ix=min_ix;ix<=max_ix;ix++)
         {
             std::stringstream xDir;
@@ -580,7 +945,7 @@ int main(int argc, char * argv[])
                 xDir << levelDir.str() << "/" << ix;
                 mkdir(xDir.str().c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
             }
-            
+
             for (unsigned int iy=min_iy;iy<=max_iy;iy++)
             {
                 // Extents for this particular tile
@@ -588,7 +953,7 @@ int main(int argc, char * argv[])
                 double tileMinY = ymin+iy*sizeY;
                 double tileMaxX = tileMinX + pixelsX * cellX;
                 double tileMaxY = tileMinY + pixelsY * cellY;
-               
+
                 // Let's check this against the inclusion polygons if we have them
                 bool includeTile = true;
                 if (!includeBounds.empty())
@@ -609,171 +974,133 @@ int main(int argc, char * argv[])
                         }
                     }
                 }
-                
-                if (includeTile)
+
+                if (!includeTile)
                 {
-                    // Update the shape file for what we're... updating
-                    if (outShapeLayer)
-                    {
-                        OGRPolygon *poly = new OGRPolygon();
-                        OGRLinearRing ring;
-                        ring.addPoint(tileMinX, tileMinY);
-                        ring.addPoint(tileMaxX, tileMinY);
-                        ring.addPoint(tileMaxX, tileMaxY);
-                        ring.addPoint(tileMinX, tileMaxY);
-                        ring.addPoint(tileMinX, tileMinY);
-                        poly->addRing(&ring);
-                        OGRFeature *feat = new OGRFeature(outShapeLayer->GetLayerDefn());
-                        feat->SetGeometry(poly);
-                        outShapeLayer->CreateFeature(feat);
-                        OGRFeature::DestroyFeature( feat );
-                    }
-                    
-                    GDALDatasetH hDestDS = NULL;
-                    GDALRasterBandH hBandOut = NULL;
-                    if (targetDir)
+                    skippedTiles++;
+                    continue;
+                }
+
+                // Already in the database from an earlier run
+                if (!doneTiles.empty() && doneTiles.find(ElevationPyramid::quadIndexForTile(ix,iy,level)) != doneTiles.end())
+                {
+                    resumedTiles++;
+                    continue;
+                }
+
+                TileJob job;
+                job.ix = ix;  job.iy = iy;
+                queue.jobs.push_back(job);
+            }
+        }
+
+        // Spin the workers up for this level
+        for (unsigned int ti=0;ti<workers.size();ti++)
+        {
+            workers[ti].queue = &queue;
+            pthread_create(&workers[ti].thread, NULL, ProcessTiles, &workers[ti]);
+        }
+
+        // Drain results as they come in.  All the sqlite and shapefile
+        //  work happens here, on the one thread that owns those handles.
+        unsigned int chunksProcessed = 0;
+        bool anyFailed = false;
+        while (chunksProcessed < queue.jobs.size() && !anyFailed)
+        {
+            std::deque<TileResult> batch;
+            pthread_mutex_lock(&queue.lock);
+            while (queue.results.empty() && !queue.failed)
+                pthread_cond_wait(&queue.resultCond,&queue.lock);
+            batch.swap(queue.results);
+            anyFailed = queue.failed;
+            pthread_mutex_unlock(&queue.lock);
+
+            for (unsigned int ri=0;ri<batch.size();ri++)
+            {
+                TileResult &result = batch[ri];
+                if (result.failed)
+                {
+                    anyFailed = true;
+                    break;
+                }
+
+                double tileMinX = xmin+result.ix*sizeX;
+                double tileMinY = ymin+result.iy*sizeY;
+                double tileMaxX = tileMinX + pixelsX * cellX;
+                double tileMaxY = tileMinY + pixelsY * cellY;
+
+                // Update the shape file for what we're... updating
+                if (outShapeLayer)
+                {
+                    OGRPolygon *poly = new OGRPolygon();
+                    OGRLinearRing ring;
+                    ring.addPoint(tileMinX, tileMinY);
+                    ring.addPoint(tileMaxX, tileMinY);
+                    ring.addPoint(tileMaxX, tileMaxY);
+                    ring.addPoint(tileMinX, tileMaxY);
+                    ring.addPoint(tileMinX, tileMinY);
+                    poly->addRing(&ring);
+                    OGRFeature *feat = new OGRFeature(outShapeLayer->GetLayerDefn());
+                    feat->SetGeometry(poly);
+                    outShapeLayer->CreateFeature(feat);
+                    OGRFeature::DestroyFeature( feat );
+                }
+
+                // Output pyramid sqlite db
+                if (elevPyr)
+                {
+                    totalTiles++;
+                    if (result.tileData)
                     {
-                        std::stringstream fileName;
-                        int outY = (flipY ? (numChunks-1-iy) : iy);
-                        fileName << xDir.str() << "/" << outY << ".tif";
-                    
-                        // Create the output file
-                        hDestDS = CreateOutputDataFile(outFileFormat,fileName.str().c_str(),pixelsX,pixelsY,outFormat);
-                        if (!hDestDS)
-                            return -1;
-                        hBandOut = GDALGetRasterBand(hDestDS, 1);
-                        if (!hBandOut)
+                        if (!elevPyr->addElevationTile(result.tileData, result.ix, result.iy, level))
                         {
-                            fprintf(stderr,"Failed to create output band.");
-                            return -1;
+                            fprintf(stderr, "Failed to write tile %d: %d, %d",level,result.ix,result.iy);
+                            anyFailed = true;
                         }
-                    }
-                    
-                    float tileData[pixelsX*pixelsY];
-                    
-                    // Run through and query the various cells
-                    for (unsigned int cy=0;cy<pixelsY;cy++)
-                        for (unsigned int cx=0;cx<pixelsX;cx++)
+                        free(result.tileData);
+                        result.tileData = NULL;
+                    } else {
+                        if (!elevPyr->addElevationTile(NULL, result.ix, result.iy, level))
                         {
-                            double thisX = tileMinX + cellX*cx;
-                            double thisY = tileMinY + cellY*cy;
-                            
-                            // Project back to the original data file
-                            if (hCT)
-                                OCTTransform(hCTBack, 1, &thisX, &thisY, NULL);
-
-                            // Figure out which pixel this is
-                            double pixX = adfInvGeoTransform[0] + adfInvGeoTransform[1] * thisX + adfInvGeoTransform[2] * thisY;
-                            double pixY = adfInvGeoTransform[3] + adfInvGeoTransform[4] * thisX + adfInvGeoTransform[5] * thisY;
-                            
-                            // Note: Should do some interpolation
-                            int pixXint = (int)pixX,pixYint = (int)pixY;
-                            
-                            double ta = pixX-pixXint;
-                            double tb = pixY-pixYint;
-
-                            // Look up the four nearby pixels
-                            int pixXlookup[4],pixYlookup[4];
-                            pixXlookup[0] = pixXint;  pixYlookup[0] = pixYint;
-                            pixXlookup[1] = pixXint+1;  pixYlookup[1] = pixYint;
-                            pixXlookup[2] = pixXint+1;  pixYlookup[2] = pixYint+1;
-                            pixXlookup[3] = pixXint;  pixYlookup[3] = pixYint+1;
-                            float pixVals[4];
-                            for (unsigned int pi=0;pi<4;pi++)
-                            {
-                                int pixXlook = pixXlookup[pi];
-                                int pixYlook = pixYlookup[pi];
-                                if (pixXlook < 0) pixXlook = 0;
-                                if (pixYlook < 0) pixYlook = 0;
-                                if (pixXlook >= rasterXSize)  pixXlook = rasterXSize-1;
-                                if (pixYlook >= rasterYSize)  pixYlook = rasterYSize-1;
-                            
-                                // Fetch the pixel
-                                if (GDALRasterIO( hBand, GF_Read, pixXlook, pixYlook, 1, 1, &pixVals[pi], 1, 1, GDT_Float32, 0,  0) != CE_None)
-                                {
-                                    fprintf(stderr,"Query failure in GDALRasterIO");
-                                    return -1;
-                                }
-                            }
-                            
-                            // Now do a bilinear interpolation
-                            float pixA = (pixVals[1]-pixVals[0])*ta + pixVals[0];
-                            float pixB = (pixVals[2]-pixVals[3])*ta + pixVals[3];
-                            float pixVal = (pixB-pixA)*tb+pixA;
-                            
-                            tileData[cy*pixelsX+cx] = pixVal;
+                            fprintf(stderr, "Failed to write empty tile %d: %d, %d",level,result.ix,result.iy);
+                            anyFailed = true;
                         }
-                    
-                    // Output directory
-                    if (targetDir)
-                    {
-                        // Write all the data at once
-                        if (GDALRasterIO( hBandOut, GF_Write, 0, 0, pixelsX, pixelsY, tileData, pixelsX, pixelsX, GDT_Int16, 0, 0) != CE_None)
-                        {
-                            fprintf(stderr,"Failed to write output data");
-                            return -1;
-                        }
-
-                        // Set projection and extents
-                        GDALSetProjection(hDestDS, trgSrsWKT);
-                        
-                        double adfOutTransform[6];
-                        adfOutTransform[0] = tileMinX;
-                        adfOutTransform[1] = (tileMaxX-tileMinX)/pixelsX;
-                        adfOutTransform[2] = 0;
-                        adfOutTransform[3] = tileMinY;
-                        adfOutTransform[4] = 0;
-                        adfOutTransform[5] = (tileMaxY-tileMinY)/pixelsY;
-                        GDALSetGeoTransform(hDestDS, adfOutTransform);
-                        
-                        // Close the output file
-                        GDALClose(hDestDS);
+                        zeroTiles++;
                     }
-                    
-                    // Output pyramid sqlite db
-                    if (elevPyr)
-                    {
-                        // See if anything of is non-zero
-                        bool nonZero = false;
-                        for (unsigned int ip=0;ip<pixelsX*pixelsY;ip++)
-                            if (tileData[ip] != 0)
-                            {
-                                nonZero = true;
-                                break;
-                            }
-                        
-                        totalTiles++;
-                        if (nonZero)
-                        {
-                            // Need int16 data
-                            short tileDataShort[pixelsX*pixelsY];
-                            for (unsigned int ii=0;ii<pixelsX*pixelsY;ii++)
-                                tileDataShort[ii] = tileData[ii];
+                    if (anyFailed)
+                        break;
 
-                            if (!elevPyr->addElevationTile(tileDataShort, ix, iy, level))
-                            {
-                                fprintf(stderr, "Failed to write tile %d: %d, %d",level,ix,iy);
-                                return -1;
-                            }
-                        } else {
-                            if (!elevPyr->addElevationTile(NULL, ix, iy, level))
-                            {
-                                fprintf(stderr, "Failed to write empty tile %d: %d, %d",level,ix,iy);
-                                return -1;
-                            }
-                            zeroTiles++;
-                        }                    
+                    // Commit every so often so a crash doesn't take the whole run with it
+                    if (sqliteDb && ++pendingInserts >= TileTransactionBatch)
+                    {
+                        Kompex::SQLiteStatement transactStmt(sqliteDb);
+                        transactStmt.SqlStatement((std::string)"END TRANSACTION");
+                        transactStmt.SqlStatement((std::string)"BEGIN TRANSACTION");
+                        pendingInserts = 0;
                     }
-                    
-                } else
-                    skippedTiles++;
-                
+                }
+
                 chunksProcessed++;
-                double done = chunksProcessed/((double)numTilesToDo);
+                double done = chunksProcessed/((double)queue.jobs.size());
                 GDALTermProgress(done,NULL,NULL);
             }
+
+            if (anyFailed)
+            {
+                // Tell the workers to stand down
+                pthread_mutex_lock(&queue.lock);
+                queue.failed = true;
+                pthread_mutex_unlock(&queue.lock);
+            }
         }
-        
+
+        // Wait for the workers to wind down
+        for (unsigned int ti=0;ti<workers.size();ti++)
+            pthread_join(workers[ti].thread, NULL);
+
+        if (anyFailed)
+            return -1;
+
         GDALTermProgress(1.0,NULL,NULL);
     }
     
@@ -782,7 +1109,7 @@ int main(int argc, char * argv[])
         
     printf("Flushing database...");  fflush(stdout);
     // Flush out one big one
-    if (targetDb)
+    if (sqliteDb)
     {
         Kompex::SQLiteStatement transactStmt(sqliteDb);
         transactStmt.SqlStatement((std::string)"END TRANSACTION");
@@ -808,6 +1135,8 @@ int main(int argc, char * argv[])
     }
     
     fprintf(stdout,"Wrote %d tiles, of which %d were empty and %d were skipped.\n",totalTiles,zeroTiles,skippedTiles);
+    if (resumedTiles > 0)
+        fprintf(stdout,"Left %d tiles alone from an earlier run.\n",resumedTiles);
 
     return 0;
 }